@@ -57,6 +57,7 @@
 #include <sys/user.h>
 
 #include <sys/aio_kern.h>
+#include <sys/aio_private.h>
 #include <sys/sysproto.h>
 
 #include <machine/limits.h>
@@ -105,6 +106,8 @@
 #define AIO_suspend                     110
 #define AIO_suspend_sleep               111
 #define AIO_worker_thread               120
+#define AIO_ring_setup                  130
+#define AIO_ring_enter                  140
 
 __options_decl(aio_entry_flags_t, uint32_t, {
 	AIO_READ        = 0x00000001, /* a read */
@@ -113,6 +116,7 @@ __options_decl(aio_entry_flags_t, uint32_t, {
 	AIO_DSYNC       = 0x00000008, /* aio_fsync with op = O_DSYNC (not supported yet) */
 	AIO_LIO         = 0x00000010, /* lio_listio generated IO */
 	AIO_LIO_WAIT    = 0x00000020, /* lio_listio is waiting on the leader */
+	AIO_RING        = 0x00000040, /* submitted through the process's aio ring */
 
 	/*
 	 * These flags mean that this entry is blocking either:
@@ -155,6 +159,11 @@ __options_decl(aio_entry_flags_t, uint32_t, {
  * - lastly, in lio_listio() when the LIO_WAIT behavior is requested,
  *   an extra ref is taken in this syscall as it needs to keep accessing
  *   the leader "lio_pending" field until it hits 0.
+ *
+ * Entries submitted through an aio ring (AIO_RING) are never looked up
+ * by aio_return(): do_aio_completion_and_unlock() posts their result to
+ * the ring and drops the "proc" refcount right away instead of moving
+ * them to the aio_doneq.
  */
 struct aio_workq_entry {
 	/* queue lock */
@@ -178,6 +187,34 @@ struct aio_workq_entry {
 
 	/* Initialized, and possibly freed by aio_work_thread() or at free if cancelled */
 	vm_map_t                        aio_map;        /* user land map we have a reference to */
+
+	/* Only for AIO_RING entries, initialized and never changed */
+	struct aio_ring_ctx            *aio_ring;       /* ring to post the completion to */
+	uint64_t                        aio_ring_user_data;
+};
+
+/*
+ * The kernel side of a process's aio ring (see <sys/aio_private.h>).
+ *
+ * The process owns one refcount from aio_ring_setup() until the ring is
+ * unregistered (or the process execs or exits), and every entry
+ * submitted through the ring owns one until it is freed.
+ *
+ * ar_lock serializes submissions against completions: the kernel owned
+ * ring indices only move under it.  It is never taken with the proc
+ * lock held.
+ */
+struct aio_ring_ctx {
+	lck_mtx_t                       ar_lock;
+	os_refcnt_t                     ar_refcount;
+	user_addr_t                     ar_uaddr;       /* struct aio_ring, NULL once unregistered */
+	vm_map_t                        ar_map;         /* the map ar_uaddr lives in */
+	uint32_t                        ar_sq_entries;
+	uint32_t                        ar_cq_entries;
+	uint32_t                        ar_sq_head;     /* next SQE to consume */
+	uint32_t                        ar_cq_tail;     /* next CQE to fill */
+	uint32_t                        ar_inflight;    /* handed to the workers, not completed yet */
+	bool                            ar_waiting;     /* someone sleeps on ar_cq_tail */
 };
 
 /*
@@ -258,8 +295,15 @@ static int              do_aio_write(aio_workq_entry *entryp);
 static void             do_munge_aiocb_user32_to_user(struct user32_aiocb *my_aiocbp, struct user_aiocb *the_user_aiocbp);
 static void             do_munge_aiocb_user64_to_user(struct user64_aiocb *my_aiocbp, struct user_aiocb *the_user_aiocbp);
 static aio_workq_entry *aio_create_queue_entry(proc_t procp, user_addr_t aiocbp, aio_entry_flags_t);
+static aio_workq_entry *aio_create_ring_entry(proc_t procp, struct aio_ring_ctx *ring,
+    const struct aio_ring_sqe *sqe, aio_entry_flags_t flags, int *errorp);
 static int              aio_copy_in_list(proc_t, user_addr_t, user_addr_t *, int);
 
+static struct aio_ring_ctx *aio_ring_get(proc_t procp);
+static void             aio_ring_release(struct aio_ring_ctx *ring);
+static void             aio_ring_complete(aio_workq_entry *entryp, bool post);
+static bool             aio_ring_unregister(proc_t procp);
+
 #define ASSERT_AIO_PROC_LOCK_OWNED(p)   LCK_MTX_ASSERT(aio_proc_mutex(p), LCK_MTX_ASSERT_OWNED)
 #define ASSERT_AIO_WORKQ_LOCK_OWNED(q)  LCK_SPIN_ASSERT(aio_workq_lock(q), LCK_ASSERT_OWNED)
 
@@ -293,6 +337,7 @@ os_refgrp_decl(static, aio_refgrp, "aio", NULL);
 static LCK_GRP_DECLARE(aio_proc_lock_grp, "aio_proc");
 static LCK_GRP_DECLARE(aio_queue_lock_grp, "aio_queue");
 static LCK_MTX_DECLARE(aio_proc_mtx, &aio_proc_lock_grp);
+static LCK_GRP_DECLARE(aio_ring_lock_grp, "aio_ring");
 
 static KALLOC_TYPE_DEFINE(aio_workq_zonep, aio_workq_entry, KT_DEFAULT);
 
@@ -365,7 +410,8 @@ aio_try_proc_insert_active_locked(proc_t procp, aio_workq_entry *entryp)
 		return false;
 	}
 
-	if (is_already_queued(procp, entryp->uaiocbp)) {
+	if ((entryp->flags & AIO_RING) == 0 &&
+	    is_already_queued(procp, entryp->uaiocbp)) {
 		return false;
 	}
 
@@ -389,9 +435,8 @@ aio_proc_move_done_locked(proc_t procp, aio_workq_entry *entryp)
 }
 
 static void
-aio_proc_remove_done_locked(proc_t procp, aio_workq_entry *entryp)
+aio_proc_remove_locked(proc_t procp, aio_workq_entry *entryp)
 {
-	TAILQ_REMOVE(&procp->p_aio_doneq, entryp, aio_proc_link);
 	entryp->aio_proc_link.tqe_prev = NULL;
 	if (os_atomic_dec_orig(&aio_anchor.aio_total_count, relaxed) <= 0) {
 		panic("Negative total AIO count!");
@@ -401,6 +446,23 @@ aio_proc_remove_done_locked(proc_t procp, aio_workq_entry *entryp)
 	}
 }
 
+static void
+aio_proc_remove_done_locked(proc_t procp, aio_workq_entry *entryp)
+{
+	TAILQ_REMOVE(&procp->p_aio_doneq, entryp, aio_proc_link);
+	aio_proc_remove_locked(procp, entryp);
+}
+
+/*
+ * Ring entries skip the done queue, nobody will aio_return() them.
+ */
+static void
+aio_proc_remove_active_locked(proc_t procp, aio_workq_entry *entryp)
+{
+	TAILQ_REMOVE(&procp->p_aio_activeq, entryp, aio_proc_link);
+	aio_proc_remove_locked(procp, entryp);
+}
+
 static void
 aio_proc_unlock(proc_t procp)
 {
@@ -606,8 +668,8 @@ aio_error(proc_t p, struct aio_error_args *uap, int *retval)
 	KERNEL_DEBUG(BSDDBG_CODE(DBG_BSD_AIO, AIO_error) | DBG_FUNC_START,
 	    VM_KERNEL_ADDRPERM(p), uap->aiocbp, 0, 0, 0);
 
-	/* see if there are any aios to check */
-	if (!aio_has_any_work()) {
+	/* see if there are any aios to check, ring entries have no aiocb */
+	if (!aio_has_any_work() || uap->aiocbp == USER_ADDR_NULL) {
 		return EINVAL;
 	}
 
@@ -733,8 +795,8 @@ aio_return(proc_t p, struct aio_return_args *uap, user_ssize_t *retval)
 	KERNEL_DEBUG(BSDDBG_CODE(DBG_BSD_AIO, AIO_return) | DBG_FUNC_START,
 	    VM_KERNEL_ADDRPERM(p), uap->aiocbp, 0, 0, 0);
 
-	/* See if there are any entries to check */
-	if (!aio_has_any_work()) {
+	/* See if there are any entries to check, ring entries have no aiocb */
+	if (!aio_has_any_work() || uap->aiocbp == USER_ADDR_NULL) {
 		goto ExitRoutine;
 	}
 
@@ -814,6 +876,11 @@ _aio_exit(proc_t p)
 	aio_workq_entry *entryp, *tmp;
 	int              error;
 
+	/* the ring lives in the address space that is going away */
+	if (p->p_aio_ring) {
+		aio_ring_unregister(p);
+	}
+
 	/* quick check to see if there are any async IO requests queued up */
 	if (!aio_has_any_work()) {
 		return;
@@ -1501,6 +1568,427 @@ ExitRoutine:
 }
 
 
+/*
+ * aio_ring_get - return a reference on the process's aio ring, if it has one.
+ */
+static struct aio_ring_ctx *
+aio_ring_get(proc_t procp)
+{
+	struct aio_ring_ctx *ring;
+
+	aio_proc_lock_spin(procp);
+	ring = procp->p_aio_ring;
+	if (ring) {
+		os_ref_retain(&ring->ar_refcount);
+	}
+	aio_proc_unlock(procp);
+
+	return ring;
+}
+
+static void
+aio_ring_release(struct aio_ring_ctx *ring)
+{
+	if (os_ref_release(&ring->ar_refcount) == 0) {
+		vm_map_deallocate(ring->ar_map);
+		lck_mtx_destroy(&ring->ar_lock, &aio_ring_lock_grp);
+		kfree_type(struct aio_ring_ctx, ring);
+	}
+}
+
+/*
+ * aio_ring_unregister - detach the ring from the process.  Operations
+ * still in flight complete normally, but are no longer posted to the ring.
+ * Returns false if the process had no ring.
+ */
+static bool
+aio_ring_unregister(proc_t procp)
+{
+	struct aio_ring_ctx *ring;
+
+	aio_proc_lock(procp);
+	ring = procp->p_aio_ring;
+	procp->p_aio_ring = NULL;
+	aio_proc_unlock(procp);
+
+	if (ring == NULL) {
+		return false;
+	}
+
+	lck_mtx_lock(&ring->ar_lock);
+	ring->ar_uaddr = USER_ADDR_NULL;
+	if (ring->ar_waiting) {
+		ring->ar_waiting = false;
+		wakeup(&ring->ar_cq_tail);
+	}
+	lck_mtx_unlock(&ring->ar_lock);
+
+	aio_ring_release(ring);
+	return true;
+}
+
+/*
+ * aio_ring_post_locked - write a completion to the completion queue, then
+ * publish it by moving ar_cq_tail.
+ *
+ * Completions are posted by the aio worker threads, which already assumed
+ * the process's address space, or by threads of the process itself, but
+ * cancellations can come from elsewhere: switch to the ring's map if needed.
+ *
+ * There is always room, see aio_ring_enter().  If the process unmapped or
+ * protected its ring, the completion is lost, which only hurts itself.
+ *
+ * Called with ar_lock held.
+ */
+static void
+aio_ring_post_locked(struct aio_ring_ctx *ring, uint64_t user_data, int64_t res)
+{
+	struct aio_ring_cqe cqe = {
+		.cqe_user_data = user_data,
+		.cqe_res = res,
+	};
+	vm_map_t    oldmap = VM_MAP_NULL;
+	user_addr_t uaddr;
+
+	LCK_MTX_ASSERT(&ring->ar_lock, LCK_MTX_ASSERT_OWNED);
+
+	if (ring->ar_uaddr == USER_ADDR_NULL) {
+		/* unregistered, nobody will reap it */
+		return;
+	}
+
+	if (current_map() != ring->ar_map) {
+		oldmap = vm_map_switch(ring->ar_map);
+	}
+
+	uaddr = ring->ar_uaddr + AIO_RING_CQES_OFFSET(ring->ar_sq_entries) +
+	    (ring->ar_cq_tail & (ring->ar_cq_entries - 1)) * sizeof(cqe);
+	(void)copyout(&cqe, uaddr, sizeof(cqe));
+
+	/* the CQE must be visible before the new tail */
+	os_atomic_thread_fence(release);
+	ring->ar_cq_tail++;
+	(void)copyout_atomic32(ring->ar_cq_tail,
+	    ring->ar_uaddr + offsetof(struct aio_ring, ar_cq_tail));
+
+	if (oldmap != VM_MAP_NULL) {
+		vm_map_switch(oldmap);
+	}
+
+	if (ring->ar_waiting) {
+		ring->ar_waiting = false;
+		wakeup(&ring->ar_cq_tail);
+	}
+}
+
+/*
+ * aio_ring_complete - called by do_aio_completion_and_unlock() for
+ * entries submitted through a ring, without the proc lock.
+ */
+static void
+aio_ring_complete(aio_workq_entry *entryp, bool post)
+{
+	struct aio_ring_ctx *ring = entryp->aio_ring;
+	int64_t res;
+
+	if (entryp->errorval) {
+		res = -(int64_t)entryp->errorval;
+	} else {
+		res = (int64_t)entryp->returnval;
+	}
+
+	lck_mtx_lock(&ring->ar_lock);
+	ring->ar_inflight--;
+	if (post) {
+		aio_ring_post_locked(ring, entryp->aio_ring_user_data, res);
+	} else if (ring->ar_waiting) {
+		ring->ar_waiting = false;
+		wakeup(&ring->ar_cq_tail);
+	}
+	lck_mtx_unlock(&ring->ar_lock);
+}
+
+/*
+ * aio_ring_submit_locked - perform or queue up one operation read from the
+ * submission queue.  Returns EAGAIN if the aio limits prevent queueing it
+ * for now, and 0 otherwise: every other failure is reported in its CQE.
+ *
+ * Called with ar_lock held, which may be dropped.
+ */
+static int
+aio_ring_submit_locked(proc_t p, struct aio_ring_ctx *ring,
+    const struct aio_ring_sqe *sqe)
+{
+	aio_workq_entry  *entryp;
+	aio_entry_flags_t flags;
+	int               error;
+
+	switch (sqe->sqe_op) {
+	case AIO_RING_OP_NOP:
+		aio_ring_post_locked(ring, sqe->sqe_user_data, 0);
+		return 0;
+
+	case AIO_RING_OP_OPENAT: {
+		/*
+		 * The workers run with the kernel's credentials and file
+		 * descriptor table, so opens are done right here, in the
+		 * caller's context, without holding up completions.
+		 */
+		struct openat_nocancel_args args = {
+			.fd = sqe->sqe_fd,
+			.path = (user_addr_t)sqe->sqe_addr,
+			.flags = (int)sqe->sqe_flags,
+			.mode = (int)sqe->sqe_len,
+		};
+		int32_t fd = -1;
+
+		ring->ar_inflight++;
+		lck_mtx_unlock(&ring->ar_lock);
+		error = openat_nocancel(p, &args, &fd);
+		lck_mtx_lock(&ring->ar_lock);
+		ring->ar_inflight--;
+
+		aio_ring_post_locked(ring, sqe->sqe_user_data, error ? -error : fd);
+		return 0;
+	}
+
+	case AIO_RING_OP_READ:
+		flags = AIO_READ;
+		break;
+	case AIO_RING_OP_WRITE:
+		flags = AIO_WRITE;
+		break;
+	case AIO_RING_OP_FSYNC:
+		flags = (sqe->sqe_flags & O_DSYNC) ? AIO_DSYNC : AIO_FSYNC;
+		break;
+	default:
+		aio_ring_post_locked(ring, sqe->sqe_user_data, -EINVAL);
+		return 0;
+	}
+
+	entryp = aio_create_ring_entry(p, ring, sqe, flags, &error);
+	if (entryp == NULL) {
+		aio_ring_post_locked(ring, sqe->sqe_user_data, -error);
+		return 0;
+	}
+
+	aio_proc_lock_spin(p);
+	if (!aio_try_enqueue_work_locked(p, entryp, NULL)) {
+		/*
+		 * This entry has not been queued up so no worries about
+		 * unlocked state and aio_map
+		 */
+		aio_proc_unlock(p);
+		aio_free_request(entryp);
+		return EAGAIN;
+	}
+	/* can't complete before we drop ar_lock */
+	ring->ar_inflight++;
+	aio_proc_unlock(p);
+
+	return 0;
+}
+
+/*
+ * aio_ring_setup - register the calling process's aio ring (see
+ * <sys/aio_private.h>), or unregister it when uap->ring is NULL.
+ */
+int
+aio_ring_setup(proc_t p, struct aio_ring_setup_args *uap, __unused int *retval)
+{
+	struct aio_ring_ctx *ring;
+	struct aio_ring      hdr = {
+		.ar_sq_entries = uap->sq_entries,
+		.ar_cq_entries = uap->cq_entries,
+	};
+	int                  error = 0;
+
+	KERNEL_DEBUG(BSDDBG_CODE(DBG_BSD_AIO, AIO_ring_setup) | DBG_FUNC_START,
+	    VM_KERNEL_ADDRPERM(p), uap->ring, uap->sq_entries, uap->cq_entries, 0);
+
+	if (uap->flags != 0) {
+		error = EINVAL;
+		goto ExitRoutine;
+	}
+
+	if (uap->ring == USER_ADDR_NULL) {
+		if (!aio_ring_unregister(p)) {
+			error = EINVAL;
+		}
+		goto ExitRoutine;
+	}
+
+	if (uap->sq_entries == 0 || uap->sq_entries > AIO_RING_MAX_ENTRIES ||
+	    !powerof2(uap->sq_entries) ||
+	    uap->cq_entries == 0 || uap->cq_entries > AIO_RING_MAX_ENTRIES ||
+	    !powerof2(uap->cq_entries) ||
+	    (uap->ring & (sizeof(uint64_t) - 1)) != 0 ||
+	    uap->ring + AIO_RING_SIZE(uap->sq_entries, uap->cq_entries) < uap->ring) {
+		error = EINVAL;
+		goto ExitRoutine;
+	}
+
+	error = copyout(&hdr, uap->ring, sizeof(hdr));
+	if (error) {
+		goto ExitRoutine;
+	}
+
+	ring = kalloc_type(struct aio_ring_ctx, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	lck_mtx_init(&ring->ar_lock, &aio_ring_lock_grp, LCK_ATTR_NULL);
+	os_ref_init(&ring->ar_refcount, &aio_refgrp);
+	ring->ar_uaddr = uap->ring;
+	ring->ar_map = get_task_map(proc_task(p));
+	vm_map_reference(ring->ar_map);
+	ring->ar_sq_entries = uap->sq_entries;
+	ring->ar_cq_entries = uap->cq_entries;
+
+	aio_proc_lock(p);
+	if (p->p_aio_ring == NULL) {
+		p->p_aio_ring = ring;
+		ring = NULL;
+	} else {
+		error = EBUSY;
+	}
+	aio_proc_unlock(p);
+
+	if (ring) {
+		aio_ring_release(ring);
+	}
+
+ExitRoutine:
+	KERNEL_DEBUG(BSDDBG_CODE(DBG_BSD_AIO, AIO_ring_setup) | DBG_FUNC_END,
+	    VM_KERNEL_ADDRPERM(p), error, 0, 0, 0);
+
+	return error;
+}
+
+/*
+ * aio_ring_enter - submit up to uap->to_submit operations from the
+ * submission queue of the process's ring, then wait for at least
+ * uap->min_complete completions to be available in its completion queue.
+ *
+ * Operations are only submitted as long as their completion is guaranteed
+ * to fit in the completion queue, and while the aio limits allow.
+ * Returns the number of operations submitted, or an error if none were.
+ */
+int
+aio_ring_enter(proc_t p, struct aio_ring_enter_args *uap, int *retval)
+{
+	struct aio_ring_ctx *ring;
+	struct aio_ring_sqe  sqe;
+	user_addr_t          uaddr;
+	uint32_t             sq_tail, cq_head, want;
+	uint32_t             submitted = 0;
+	int64_t              room;
+	int                  error = 0;
+
+	KERNEL_DEBUG(BSDDBG_CODE(DBG_BSD_AIO, AIO_ring_enter) | DBG_FUNC_START,
+	    VM_KERNEL_ADDRPERM(p), uap->to_submit, uap->min_complete, 0, 0);
+
+	if (uap->flags != 0) {
+		error = EINVAL;
+		goto ExitRoutine;
+	}
+
+	ring = aio_ring_get(p);
+	if (ring == NULL) {
+		error = EINVAL;
+		goto ExitRoutine;
+	}
+
+	lck_mtx_lock(&ring->ar_lock);
+
+	while (submitted < uap->to_submit) {
+		if ((uaddr = ring->ar_uaddr) == USER_ADDR_NULL) {
+			error = EINVAL;
+			break;
+		}
+
+		/* reread them every time, the lock may have been dropped */
+		error = copyin_atomic32(uaddr + offsetof(struct aio_ring, ar_sq_tail), &sq_tail);
+		if (error == 0) {
+			error = copyin_atomic32(uaddr + offsetof(struct aio_ring, ar_cq_head), &cq_head);
+		}
+		if (error) {
+			break;
+		}
+		/* pairs with the release store of the SQEs by the process */
+		os_atomic_thread_fence(acquire);
+
+		if (sq_tail == ring->ar_sq_head) {
+			break;
+		}
+		if (sq_tail - ring->ar_sq_head > ring->ar_sq_entries) {
+			error = EINVAL;
+			break;
+		}
+
+		room = (int64_t)ring->ar_cq_entries - ring->ar_inflight -
+		    (uint32_t)(ring->ar_cq_tail - cq_head);
+		if (room <= 0) {
+			error = EAGAIN;
+			break;
+		}
+
+		error = copyin(uaddr + AIO_RING_SQES_OFFSET +
+		    (ring->ar_sq_head & (ring->ar_sq_entries - 1)) * sizeof(sqe),
+		    &sqe, sizeof(sqe));
+		if (error) {
+			break;
+		}
+
+		/* consume it first, ar_lock may be dropped */
+		ring->ar_sq_head++;
+		error = aio_ring_submit_locked(p, ring, &sqe);
+		if (error) {
+			/* it was not dropped on the way to EAGAIN */
+			ring->ar_sq_head--;
+			break;
+		}
+		submitted++;
+	}
+
+	if (submitted && ring->ar_uaddr != USER_ADDR_NULL) {
+		(void)copyout_atomic32(ring->ar_sq_head,
+		    ring->ar_uaddr + offsetof(struct aio_ring, ar_sq_head));
+	}
+	if (submitted) {
+		error = 0;
+	}
+
+	want = MIN(uap->min_complete, ring->ar_cq_entries);
+	while (error == 0 && want && ring->ar_inflight &&
+	    (uaddr = ring->ar_uaddr) != USER_ADDR_NULL) {
+		error = copyin_atomic32(uaddr + offsetof(struct aio_ring, ar_cq_head), &cq_head);
+		if (error || ring->ar_cq_tail - cq_head >= want) {
+			break;
+		}
+
+		ring->ar_waiting = true;
+		error = msleep(&ring->ar_cq_tail, &ring->ar_lock, PRIBIO | PCATCH,
+		    "aio_ring", NULL);
+		if (error == ERESTART) {
+			/* the submissions can't be replayed */
+			error = EINTR;
+		}
+	}
+	if (submitted) {
+		error = 0;
+	}
+
+	lck_mtx_unlock(&ring->ar_lock);
+	aio_ring_release(ring);
+
+	*retval = (int)submitted;
+
+ExitRoutine:
+	KERNEL_DEBUG(BSDDBG_CODE(DBG_BSD_AIO, AIO_ring_enter) | DBG_FUNC_END,
+	    VM_KERNEL_ADDRPERM(p), submitted, error, 0, 0);
+
+	return error;
+}
+
+
 /*
  * aio worker thread.  this is where all the real work gets done.
  * we get a wake up call on sleep channel &aio_anchor.aio_async_workq
@@ -1513,6 +2001,7 @@ aio_work_thread(void *arg __unused, wait_result_t wr __unused)
 	aio_workq_entry *entryp;
 	int              error;
 	vm_map_t         currentmap;
+	vm_map_t         aiomap;
 	vm_map_t         oldmap = VM_MAP_NULL;
 	task_t           oldaiotask = TASK_NULL;
 	struct uthread  *uthreadp = NULL;
@@ -1569,25 +2058,30 @@ aio_work_thread(void *arg __unused, wait_result_t wr __unused)
 			error = EINVAL;
 		}
 
-		/* Restore old map */
-		if (currentmap != entryp->aio_map) {
-			vm_map_switch(oldmap);
-			uthreadp->uu_aio_task = oldaiotask;
-		}
-
-		/* liberate unused map */
-		vm_map_deallocate(entryp->aio_map);
-		entryp->aio_map = VM_MAP_NULL;
-
 		KERNEL_DEBUG(SDDBG_CODE(DBG_BSD_AIO, AIO_worker_thread) | DBG_FUNC_END,
 		    VM_KERNEL_ADDRPERM(p), VM_KERNEL_ADDRPERM(entryp->uaiocbp),
 		    entryp->errorval, entryp->returnval, 0);
 
-		/* we're done with the IO request so pop it off the active queue and */
-		/* push it on the done queue */
+		/*
+		 * we're done with the IO request so pop it off the active queue and
+		 * push it on the done queue... ring completions are copied out to
+		 * the user's ring, so this is done before leaving its map
+		 */
+		aiomap = entryp->aio_map;
+		entryp->aio_map = VM_MAP_NULL;
+
 		aio_proc_lock(p);
 		entryp->errorval = error;
 		do_aio_completion_and_unlock(p, entryp);
+
+		/* Restore old map */
+		if (currentmap != aiomap) {
+			vm_map_switch(oldmap);
+			uthreadp->uu_aio_task = oldaiotask;
+		}
+
+		/* liberate unused map */
+		vm_map_deallocate(aiomap);
 	}
 }
 
@@ -1683,6 +2177,23 @@ aio_delay_fsync_request(aio_workq_entry *entryp)
 	return TRUE;
 }
 
+/*
+ * The worker threads perform the request on behalf of the calling
+ * thread, in the caller's address space.
+ */
+static void
+aio_entry_take_context(proc_t procp, aio_workq_entry *entryp)
+{
+	/* get a reference to the user land map in order to keep it around */
+	entryp->aio_map = get_task_map(proc_task(procp));
+	vm_map_reference(entryp->aio_map);
+
+	/* get a reference on the current_thread, which is passed in vfs_context. */
+	entryp->context = *vfs_context_current();
+	thread_reference(entryp->context.vc_thread);
+	kauth_cred_ref(entryp->context.vc_ucred);
+}
+
 static aio_workq_entry *
 aio_create_queue_entry(proc_t procp, user_addr_t aiocbp, aio_entry_flags_t flags)
 {
@@ -1716,14 +2227,7 @@ aio_create_queue_entry(proc_t procp, user_addr_t aiocbp, aio_entry_flags_t flags
 		goto error_exit;
 	}
 
-	/* get a reference to the user land map in order to keep it around */
-	entryp->aio_map = get_task_map(proc_task(procp));
-	vm_map_reference(entryp->aio_map);
-
-	/* get a reference on the current_thread, which is passed in vfs_context. */
-	entryp->context = *vfs_context_current();
-	thread_reference(entryp->context.vc_thread);
-	kauth_cred_ref(entryp->context.vc_ucred);
+	aio_entry_take_context(procp, entryp);
 	return entryp;
 
 error_exit:
@@ -1731,6 +2235,41 @@ error_exit:
 	return NULL;
 }
 
+/*
+ * aio_create_ring_entry - same as aio_create_queue_entry(), for an operation
+ * read from the submission queue of the process's aio ring.
+ */
+static aio_workq_entry *
+aio_create_ring_entry(proc_t procp, struct aio_ring_ctx *ring,
+    const struct aio_ring_sqe *sqe, aio_entry_flags_t flags, int *errorp)
+{
+	aio_workq_entry *entryp;
+
+	entryp = zalloc_flags(aio_workq_zonep, Z_WAITOK | Z_ZERO);
+	entryp->procp = procp;
+	entryp->uaiocbp = USER_ADDR_NULL;
+	entryp->flags = flags | AIO_RING;
+	/* consumed in do_aio_completion_and_unlock */
+	os_ref_init(&entryp->aio_refcount, &aio_refgrp);
+
+	entryp->aiocb.aio_fildes = sqe->sqe_fd;
+	entryp->aiocb.aio_offset = (off_t)sqe->sqe_off;
+	entryp->aiocb.aio_buf = (user_addr_t)sqe->sqe_addr;
+	entryp->aiocb.aio_nbytes = sqe->sqe_len;
+
+	if ((*errorp = aio_validate(procp, entryp)) != 0) {
+		zfree(aio_workq_zonep, entryp);
+		return NULL;
+	}
+
+	aio_entry_take_context(procp, entryp);
+
+	os_ref_retain(&ring->ar_refcount);
+	entryp->aio_ring = ring;
+	entryp->aio_ring_user_data = sqe->sqe_user_data;
+	return entryp;
+}
+
 
 /*
  * aio_queue_async_request - queue up an async IO request on our work queue then
@@ -1794,6 +2333,10 @@ aio_free_request(aio_workq_entry *entryp)
 	}
 	kauth_cred_unref(&entryp->context.vc_ucred);
 
+	if (entryp->aio_ring) {
+		aio_ring_release(entryp->aio_ring);
+	}
+
 	zfree(aio_workq_zonep, entryp);
 }
 
@@ -1874,10 +2417,16 @@ do_aio_completion_and_unlock(proc_t p, aio_workq_entry *entryp)
 	aio_workq_entry *leader = entryp->lio_leader;
 	int              lio_pending = 0;
 	bool             do_signal = false;
+	bool             is_ring = (entryp->flags & AIO_RING) != 0;
+	bool             do_post = false;
 
 	ASSERT_AIO_PROC_LOCK_OWNED(p);
 
-	aio_proc_move_done_locked(p, entryp);
+	if (is_ring) {
+		aio_proc_remove_active_locked(p, entryp);
+	} else {
+		aio_proc_move_done_locked(p, entryp);
+	}
 
 	if (leader) {
 		lio_pending = --leader->lio_pending;
@@ -1915,6 +2464,8 @@ do_aio_completion_and_unlock(proc_t p, aio_workq_entry *entryp)
 			    VM_KERNEL_ADDRPERM(p), VM_KERNEL_ADDRPERM(entryp->uaiocbp),
 			    0, 0, 0);
 		}
+	} else if (is_ring) {
+		do_post = true;
 	} else if (entryp->aiocb.aio_sigevent.sigev_notify == SIGEV_SIGNAL) {
 		/*
 		 * If this was the last request in the group, or not part of
@@ -1940,6 +2491,10 @@ do_aio_completion_and_unlock(proc_t p, aio_workq_entry *entryp)
 
 	aio_proc_unlock(p);
 
+	if (is_ring) {
+		aio_ring_complete(entryp, do_post);
+	}
+
 	if (do_signal) {
 		KERNEL_DEBUG(BSDDBG_CODE(DBG_BSD_AIO, AIO_completion_sig) | DBG_FUNC_NONE,
 		    VM_KERNEL_ADDRPERM(p), VM_KERNEL_ADDRPERM(entryp->uaiocbp),
@@ -1959,6 +2514,9 @@ do_aio_completion_and_unlock(proc_t p, aio_workq_entry *entryp)
 	KERNEL_DEBUG(BSDDBG_CODE(DBG_BSD_AIO, AIO_completion_suspend_wake) | DBG_FUNC_NONE,
 	    VM_KERNEL_ADDRPERM(p), VM_KERNEL_ADDRPERM(entryp->uaiocbp), 0, 0, 0);
 
+	if (is_ring) {
+		aio_entry_unref(entryp); /* the proc's, see aio_proc_remove_active_locked */
+	}
 	aio_entry_unref(entryp); /* see aio_try_enqueue_work_locked */
 	if (leader) {
 		aio_entry_unref(leader); /* see lio_listio */
@@ -226,6 +226,7 @@ static int kq_add_knote(struct kqueue *kq, struct knote *kn,
 static struct knote *kq_find_knote_and_kq_lock(struct kqueue *kq,
     struct kevent_qos_s *kev, bool is_fd, struct proc *p);
 
+static inline void knote_mark_active(struct knote *kn);
 static void knote_activate(kqueue_t kqu, struct knote *kn, int result);
 static void knote_dequeue(kqueue_t kqu, struct knote *kn);
 
@@ -4154,9 +4155,13 @@ restart:
 			// this allows klist_copy_udata() not to take locks
 			os_atomic_store_wide(&kn->kn_udata, kev->udata, relaxed);
 		}
-		if ((kev->flags & EV_DISABLE) && !(kn->kn_status & KN_DISABLED)) {
-			kn->kn_status |= KN_DISABLED;
-			knote_dequeue(kq, kn);
+		if (kev->flags & EV_DISABLE) {
+			/* an explicit disable cancels a pending multishot re-enable */
+			kn->kn_status &= ~KN_REARM;
+			if (!(kn->kn_status & KN_DISABLED)) {
+				kn->kn_status |= KN_DISABLED;
+				knote_dequeue(kq, kn);
+			}
 		}
 	}
 
@@ -4340,6 +4345,10 @@ knote_process(struct knote *kn, kevent_ctx_t kectx,
 	} else if (kn->kn_flags & EV_DISPATCH) {
 		/* disable all dispatch knotes */
 		kn->kn_status |= KN_DISABLED;
+		if (kectx->kec_process_flags & KEVENT_FLAG_MULTISHOT) {
+			/* kqworkloop_acknowledge_events() will re-enable it */
+			kn->kn_status |= KN_REARM;
+		}
 	} else if ((kn->kn_flags & EV_CLEAR) == 0) {
 		/* re-activate in case there are more events */
 		knote_activate(kq, kn, FILTER_ACTIVE);
@@ -4468,6 +4477,23 @@ kqworkloop_acknowledge_events(struct kqworkloop *kqwl)
 	kqlock_held(kqwl);
 
 	TAILQ_FOREACH_SAFE(kn, &kqwl->kqwl_suppressed, kn_tqe, tmp) {
+		/*
+		 * EV_DISPATCH knotes delivered by a KEVENT_FLAG_MULTISHOT call
+		 * are re-enabled in bulk, as if the servicer had passed EV_ENABLE
+		 * for each of them.  Since we don't call f_touch(), level
+		 * triggered knotes are re-activated so that f_process() can tell
+		 * whether they still have an event, and like in kevent_register(),
+		 * knotes in defer-delete are re-activated to deliver their last
+		 * event.
+		 */
+		if ((kn->kn_status & (KN_REARM | KN_DROPPING)) == KN_REARM) {
+			kn->kn_status &= ~(KN_REARM | KN_DISABLED);
+			if ((kn->kn_flags & EV_CLEAR) == 0 ||
+			    (kn->kn_status & (KN_DEFERDELETE | KN_VANISHED))) {
+				knote_mark_active(kn);
+			}
+		}
+
 		/*
 		 * If a knote that can adjust QoS is disabled because of the automatic
 		 * behavior of EV_DISPATCH, the knotes should stay suppressed so that
@@ -6823,7 +6849,7 @@ knote_apply_touch(kqueue_t kqu, struct knote *kn, struct kevent_qos_s *kev,
     int result)
 {
 	if ((kev->flags & EV_ENABLE) && (kn->kn_status & KN_DISABLED)) {
-		kn->kn_status &= ~KN_DISABLED;
+		kn->kn_status &= ~(KN_DISABLED | KN_REARM);
 
 		/*
 		 * it is possible for userland to have knotes registered for a given
@@ -166,6 +166,7 @@
 #include <vm/vm_fault.h>
 #include <vm/vm_pageout.h>
 #include <vm/pmap.h>
+#include <vm/vm_launch_trace_internal.h>
 #include <vm/vm_reclaim_internal.h>
 
 #include <kdp/kdp_dyld.h>
@@ -2034,6 +2035,14 @@ cleanup_rosetta_fp:
 #endif
 
 	proc_setexecutableuuid(p, &load_result.uuid[0]);
+	{
+		/* after exec_handle_sugid(), so that set-id binaries record as their owner */
+		kauth_cred_t trace_cred = kauth_cred_proc_ref(p);
+
+		vm_launch_trace_exec(task, imgp->ip_vp, load_result.uuid,
+		    kauth_cred_getuid(trace_cred));
+		kauth_cred_unref(&trace_cred);
+	}
 
 #if CONFIG_DTRACE
 	dtrace_proc_exec(p);
@@ -287,6 +287,12 @@ filt_memorystatustouch(struct knote *kn, struct kevent_qos_s *kev)
 	prev_kn_sfflags = kn->kn_sfflags;
 	kn->kn_sfflags = (kev->fflags & EVFILT_MEMORYSTATUS_ALL_MASK);
 
+	if ((kn->kn_sfflags & NOTE_MEMORYSTATUS_PURGED) &&
+	    (prev_kn_sfflags & NOTE_MEMORYSTATUS_PURGED) == 0) {
+		/* only report what gets purged from now on */
+		kn->kn_hook32 = vm_purgeable_purged_count(proc_task(knote_get_kq(kn)->kq_p));
+	}
+
 #if XNU_TARGET_OS_OSX
 	/*
 	 * Only on desktop do we restrict notifications to
@@ -414,6 +420,11 @@ memorystatus_knote_register(struct knote *kn)
 		}
 #endif /* XNU_TARGET_OS_OSX */
 
+		if (kn->kn_sfflags & NOTE_MEMORYSTATUS_PURGED) {
+			/* only report what gets purged from now on */
+			kn->kn_hook32 = vm_purgeable_purged_count(proc_task(knote_get_kq(kn)->kq_p));
+		}
+
 		KNOTE_ATTACH(&memorystatus_klist, kn);
 	} else {
 		error = ENOTSUP;
@@ -432,6 +443,41 @@ memorystatus_knote_unregister(struct knote *kn __unused)
 	memorystatus_klist_unlock();
 }
 
+/*
+ * Called by the VM (from a thread call) after it purged volatile objects:
+ * fire the NOTE_MEMORYSTATUS_PURGED knotes of the processes that had some
+ * of theirs purged since the last time.  kn_hook32 remembers how many had
+ * been when the knote last fired.
+ */
+void
+memorystatus_purged_notify(void)
+{
+	struct knote *kn = NULL;
+	int send_knote_count = 0;
+	uint32_t purged;
+
+	memorystatus_klist_lock();
+
+	SLIST_FOREACH(kn, &memorystatus_klist, kn_selnext) {
+		if ((kn->kn_sfflags & NOTE_MEMORYSTATUS_PURGED) == 0) {
+			continue;
+		}
+
+		purged = vm_purgeable_purged_count(proc_task(knote_get_kq(kn)->kq_p));
+		if (purged != kn->kn_hook32) {
+			kn->kn_hook32 = purged;
+			kn->kn_fflags |= NOTE_MEMORYSTATUS_PURGED;
+			send_knote_count++;
+		}
+	}
+
+	if (send_knote_count > 0) {
+		KNOTE(&memorystatus_klist, 0);
+	}
+
+	memorystatus_klist_unlock();
+}
+
 #if VM_PRESSURE_EVENTS
 
 #if CONFIG_JETSAM
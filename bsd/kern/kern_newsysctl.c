@@ -98,6 +98,7 @@
 
 #if DEBUG || DEVELOPMENT
 #include <os/system_event_log.h>
+#include <vm/vm_compressor_algorithms.h>
 #endif /* DEBUG || DEVELOPMENT */
 
 static LCK_GRP_DECLARE(sysctl_lock_group, "sysctl");
@@ -2322,6 +2323,68 @@ sysctl_perf_compressor SYSCTL_HANDLER_ARGS
  */
 SYSCTL_PROC(_kern, OID_AUTO, perf_compressor, CTLFLAG_WR | CTLFLAG_MASKED | CTLTYPE_STRUCT,
     0, 0, sysctl_perf_compressor, "S", "Compressor & swap benchmark");
+
+kern_return_t
+run_compressor_codec_perf_test(
+	user_addr_t buf,
+	size_t buffer_size,
+	uint32_t mode,
+	bool dense,
+	struct vm_compressor_codec_perf *perf);
+
+struct perf_compressor_codec_data {
+	user_addr_t buffer;
+	size_t buffer_size;
+	uint32_t mode;
+	uint32_t dense;
+	struct vm_compressor_codec_perf results;
+};
+
+static int
+sysctl_perf_compressor_codec SYSCTL_HANDLER_ARGS
+{
+	int error = EINVAL;
+	size_t len = sizeof(struct perf_compressor_codec_data);
+	struct perf_compressor_codec_data benchmark_data = {0};
+
+	if (req->oldptr == USER_ADDR_NULL || req->oldlen != len ||
+	    req->newptr == USER_ADDR_NULL || req->newlen != len) {
+		return EINVAL;
+	}
+
+	error = SYSCTL_IN(req, &benchmark_data, len);
+	if (error) {
+		return error;
+	}
+
+	kern_return_t ret = run_compressor_codec_perf_test(benchmark_data.buffer, benchmark_data.buffer_size,
+	    benchmark_data.mode, benchmark_data.dense != 0, &benchmark_data.results);
+	switch (ret) {
+	case KERN_SUCCESS:
+		error = 0;
+		break;
+	case KERN_INVALID_ARGUMENT:
+		error = EINVAL;
+		break;
+	case KERN_RESOURCE_SHORTAGE:
+		error = ENOMEM;
+		break;
+	default:
+		error = EIO;
+		break;
+	}
+	if (error != 0) {
+		return error;
+	}
+
+	return SYSCTL_OUT(req, &benchmark_data, len);
+}
+
+/*
+ * Compressor codec ratio & throughput benchmark
+ */
+SYSCTL_PROC(_kern, OID_AUTO, perf_compressor_codec, CTLFLAG_WR | CTLFLAG_MASKED | CTLTYPE_STRUCT,
+    0, 0, sysctl_perf_compressor_codec, "S", "Compressor codec benchmark");
 #endif /* DEVELOPMENT || DEBUG */
 
 #if CONFIG_JETSAM
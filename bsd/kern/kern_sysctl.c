@@ -200,6 +200,9 @@ extern int nx_enabled;
 extern int speculative_reads_disabled;
 extern unsigned int speculative_prefetch_max;
 extern unsigned int speculative_prefetch_max_iosize;
+extern unsigned int cluster_ra_latency_target_us;
+extern uint64_t cluster_ra_stream_switches;
+extern uint64_t cluster_ra_strided_prefetches;
 extern unsigned int preheat_max_bytes;
 extern unsigned int preheat_min_bytes;
 extern long numvnodes;
@@ -2781,6 +2784,18 @@ SYSCTL_UINT(_kern, OID_AUTO, speculative_prefetch_max_iosize,
     CTLFLAG_RW | CTLFLAG_KERN | CTLFLAG_LOCKED,
     &speculative_prefetch_max_iosize, 0, "");
 
+SYSCTL_UINT(_kern, OID_AUTO, cluster_ra_latency_target_us,
+    CTLFLAG_RW | CTLFLAG_KERN | CTLFLAG_LOCKED,
+    &cluster_ra_latency_target_us, 0, "");
+
+SYSCTL_QUAD(_kern, OID_AUTO, cluster_ra_stream_switches,
+    CTLFLAG_RD | CTLFLAG_KERN | CTLFLAG_LOCKED,
+    &cluster_ra_stream_switches, "");
+
+SYSCTL_QUAD(_kern, OID_AUTO, cluster_ra_strided_prefetches,
+    CTLFLAG_RD | CTLFLAG_KERN | CTLFLAG_LOCKED,
+    &cluster_ra_strided_prefetches, "");
+
 SYSCTL_UINT(_kern, OID_AUTO, vm_page_free_target,
     CTLFLAG_RW | CTLFLAG_KERN | CTLFLAG_LOCKED,
     &vm_page_free_target, 0, "");
@@ -4377,6 +4392,15 @@ extern uint32_t compressor_sample_max_in_msecs;
 extern uint32_t compressor_thrashing_threshold_per_10msecs;
 extern uint32_t compressor_thrashing_min_per_10msecs;
 extern uint32_t vm_compressor_time_thread;
+extern uint32_t vm_compressor_batch_size;
+extern uint64_t c_segment_staged_compressions;
+extern uint64_t c_segment_staged_refits;
+extern boolean_t vm_compressor_dedup_enabled;
+extern uint64_t c_segment_dedup_hits;
+extern uint64_t c_segment_dedup_misses;
+extern uint64_t c_segment_dedup_bytes_saved;
+extern uint32_t c_segment_dedup_in_use;
+extern uint32_t c_segment_dedup_shared_pages;
 
 #if DEVELOPMENT || DEBUG
 extern uint32_t vm_compressor_minorcompact_threshold_divisor;
@@ -4476,6 +4500,13 @@ SYSCTL_INT(_vm, OID_AUTO, compressor_available, CTLFLAG_RD | CTLFLAG_LOCKED, &vm
 SYSCTL_INT(_vm, OID_AUTO, compressor_segment_buffer_size, CTLFLAG_RD | CTLFLAG_LOCKED, &c_seg_bufsize, 0, "");
 SYSCTL_QUAD(_vm, OID_AUTO, compressor_pool_size, CTLFLAG_RD | CTLFLAG_LOCKED, &compressor_pool_size, "");
 
+SYSCTL_INT(_vm, OID_AUTO, compressor_dedup_enabled, CTLFLAG_RW | CTLFLAG_LOCKED, &vm_compressor_dedup_enabled, 0, "");
+SYSCTL_QUAD(_vm, OID_AUTO, compressor_dedup_hits, CTLFLAG_RD | CTLFLAG_LOCKED, &c_segment_dedup_hits, "");
+SYSCTL_QUAD(_vm, OID_AUTO, compressor_dedup_misses, CTLFLAG_RD | CTLFLAG_LOCKED, &c_segment_dedup_misses, "");
+SYSCTL_QUAD(_vm, OID_AUTO, compressor_dedup_bytes_saved, CTLFLAG_RD | CTLFLAG_LOCKED, &c_segment_dedup_bytes_saved, "");
+SYSCTL_UINT(_vm, OID_AUTO, compressor_dedup_entries, CTLFLAG_RD | CTLFLAG_LOCKED, &c_segment_dedup_in_use, 0, "");
+SYSCTL_UINT(_vm, OID_AUTO, compressor_dedup_shared_pages, CTLFLAG_RD | CTLFLAG_LOCKED, &c_segment_dedup_shared_pages, 0, "");
+
 #if CONFIG_TRACK_UNMODIFIED_ANON_PAGES
 extern uint64_t compressor_ro_uncompressed;
 extern uint64_t compressor_ro_uncompressed_total_returned;
@@ -4512,11 +4543,44 @@ SYSCTL_QUAD(_vm, OID_AUTO, compressor_swapper_swapout_fileq_throttled, CTLFLAG_R
 SYSCTL_QUAD(_vm, OID_AUTO, compressor_swapper_swapout_free_count_low, CTLFLAG_RD | CTLFLAG_LOCKED, &vmcs_stats.free_count_below_reserve, "");
 SYSCTL_QUAD(_vm, OID_AUTO, compressor_swapper_swapout_thrashing_detected, CTLFLAG_RD | CTLFLAG_LOCKED, &vmcs_stats.thrashing_detected, "");
 SYSCTL_QUAD(_vm, OID_AUTO, compressor_swapper_swapout_fragmentation_detected, CTLFLAG_RD | CTLFLAG_LOCKED, &vmcs_stats.fragmentation_detected, "");
+SYSCTL_QUAD(_vm, OID_AUTO, compressor_swapper_dense_swapouts, CTLFLAG_RD | CTLFLAG_LOCKED, &vmcs_stats.dense_swapouts, "");
+SYSCTL_QUAD(_vm, OID_AUTO, compressor_swapper_dense_swapout_bytes_saved, CTLFLAG_RD | CTLFLAG_LOCKED, &vmcs_stats.dense_swapout_bytes_saved, "");
+SYSCTL_QUAD(_vm, OID_AUTO, compressor_swapper_dense_swapins, CTLFLAG_RD | CTLFLAG_LOCKED, &vmcs_stats.dense_swapins, "");
+SYSCTL_QUAD(_vm, OID_AUTO, compressor_swapper_dense_decode_failures, CTLFLAG_RD | CTLFLAG_LOCKED, &vmcs_stats.dense_decode_failures, "");
+SYSCTL_QUAD(_vm, OID_AUTO, compressor_major_compact_passes, CTLFLAG_RD | CTLFLAG_LOCKED, &vmcs_stats.major_compact_passes, "");
+SYSCTL_QUAD(_vm, OID_AUTO, compressor_major_compact_bytes_freed, CTLFLAG_RD | CTLFLAG_LOCKED, &vmcs_stats.major_compact_bytes_freed, "");
+SYSCTL_QUAD(_vm, OID_AUTO, compressor_major_compact_cpu_time_us, CTLFLAG_RD | CTLFLAG_LOCKED, &vmcs_stats.major_compact_cpu_time_us, "");
+SYSCTL_QUAD(_vm, OID_AUTO, compressor_major_compact_last_bytes_freed, CTLFLAG_RD | CTLFLAG_LOCKED, &vmcs_stats.major_compact_last_bytes_freed, "");
+SYSCTL_QUAD(_vm, OID_AUTO, compressor_major_compact_last_cpu_time_us, CTLFLAG_RD | CTLFLAG_LOCKED, &vmcs_stats.major_compact_last_cpu_time_us, "");
 
 SYSCTL_STRING(_vm, OID_AUTO, swapfileprefix, CTLFLAG_RW | CTLFLAG_KERN | CTLFLAG_LOCKED, swapfilename, sizeof(swapfilename) - SWAPFILENAME_INDEX_LEN, "");
 
 SYSCTL_INT(_vm, OID_AUTO, compressor_timing_enabled, CTLFLAG_RW | CTLFLAG_LOCKED, &vm_compressor_time_thread, 0, "");
 
+SYSCTL_INT(_vm, OID_AUTO, compressor_thread_count, CTLFLAG_RD | CTLFLAG_LOCKED, &vm_pageout_state.vm_compressor_thread_count, 0, "");
+SYSCTL_QUAD(_vm, OID_AUTO, compressor_staged_compressions, CTLFLAG_RD | CTLFLAG_LOCKED, &c_segment_staged_compressions, "");
+SYSCTL_QUAD(_vm, OID_AUTO, compressor_staged_refits, CTLFLAG_RD | CTLFLAG_LOCKED, &c_segment_staged_refits, "");
+
+STATIC int
+sysctl_compressor_batch_size(__unused struct sysctl_oid *oidp, __unused void *arg1, __unused int arg2, struct sysctl_req *req)
+{
+	int new_value, changed;
+	int error = sysctl_io_number(req, vm_compressor_batch_size, sizeof(int), &new_value, &changed);
+
+	if (!error && changed) {
+		/* can't stage more pages than compressor threads have buffers for */
+		if (new_value < 0 || (uint32_t)new_value > vm_pageout_state.vm_compressor_batch_max) {
+			return EINVAL;
+		}
+		os_atomic_store(&vm_compressor_batch_size, (uint32_t)new_value, relaxed);
+	}
+	return error;
+}
+
+SYSCTL_PROC(_vm, OID_AUTO, compressor_batch_size,
+    CTLTYPE_INT | CTLFLAG_LOCKED | CTLFLAG_RW,
+    0, 0, sysctl_compressor_batch_size, "I", "");
+
 #if DEVELOPMENT || DEBUG
 SYSCTL_QUAD(_vm, OID_AUTO, compressor_thread_runtime0, CTLFLAG_RD | CTLFLAG_LOCKED, &vmct_stats.vmct_runtimes[0], "");
 SYSCTL_QUAD(_vm, OID_AUTO, compressor_thread_runtime1, CTLFLAG_RD | CTLFLAG_LOCKED, &vmct_stats.vmct_runtimes[1], "");
@@ -4646,6 +4710,14 @@ SYSCTL_QUAD(_vm, OID_AUTO, wks_decompressions, CTLFLAG_RD | CTLFLAG_LOCKED, &com
 SYSCTL_QUAD(_vm, OID_AUTO, wk_decompressed_bytes, CTLFLAG_RD | CTLFLAG_LOCKED, &compressor_stats.wk_decompressed_bytes, "");
 SYSCTL_QUAD(_vm, OID_AUTO, wk_sv_decompressions, CTLFLAG_RD | CTLFLAG_LOCKED, &compressor_stats.wk_sv_decompressions, "");
 
+SYSCTL_QUAD(_vm, OID_AUTO, dense_compressions, CTLFLAG_RD | CTLFLAG_LOCKED, &compressor_stats.dense_compressions, "");
+SYSCTL_QUAD(_vm, OID_AUTO, dense_compression_failures, CTLFLAG_RD | CTLFLAG_LOCKED, &compressor_stats.dense_compression_failures, "");
+SYSCTL_QUAD(_vm, OID_AUTO, dense_compressed_bytes_in, CTLFLAG_RD | CTLFLAG_LOCKED, &compressor_stats.dense_compressed_bytes_in, "");
+SYSCTL_QUAD(_vm, OID_AUTO, dense_compressed_bytes_out, CTLFLAG_RD | CTLFLAG_LOCKED, &compressor_stats.dense_compressed_bytes_out, "");
+SYSCTL_QUAD(_vm, OID_AUTO, dense_catime, CTLFLAG_RD | CTLFLAG_LOCKED, &compressor_stats.dense_cabstime, "");
+SYSCTL_QUAD(_vm, OID_AUTO, dense_decompressions, CTLFLAG_RD | CTLFLAG_LOCKED, &compressor_stats.dense_decompressions, "");
+SYSCTL_QUAD(_vm, OID_AUTO, dense_datime, CTLFLAG_RD | CTLFLAG_LOCKED, &compressor_stats.dense_dabstime, "");
+
 SYSCTL_INT(_vm, OID_AUTO, lz4_threshold, CTLFLAG_RW | CTLFLAG_LOCKED, &vmctune.lz4_threshold, 0, "");
 SYSCTL_INT(_vm, OID_AUTO, wkdm_reeval_threshold, CTLFLAG_RW | CTLFLAG_LOCKED, &vmctune.wkdm_reeval_threshold, 0, "");
 SYSCTL_INT(_vm, OID_AUTO, lz4_max_failure_skips, CTLFLAG_RW | CTLFLAG_LOCKED, &vmctune.lz4_max_failure_skips, 0, "");
@@ -4654,6 +4726,30 @@ SYSCTL_INT(_vm, OID_AUTO, lz4_max_preselects, CTLFLAG_RW | CTLFLAG_LOCKED, &vmct
 SYSCTL_INT(_vm, OID_AUTO, lz4_run_preselection_threshold, CTLFLAG_RW | CTLFLAG_LOCKED, &vmctune.lz4_run_preselection_threshold, 0, "");
 SYSCTL_INT(_vm, OID_AUTO, lz4_run_continue_bytes, CTLFLAG_RW | CTLFLAG_LOCKED, &vmctune.lz4_run_continue_bytes, 0, "");
 SYSCTL_INT(_vm, OID_AUTO, lz4_profitable_bytes, CTLFLAG_RW | CTLFLAG_LOCKED, &vmctune.lz4_profitable_bytes, 0, "");
+
+static int
+sysctl_compressor_dense_mode(__unused struct sysctl_oid *oidp, __unused void *arg1, __unused int arg2, struct sysctl_req *req)
+{
+	uint32_t new_mode = vm_compressor_dense_mode;
+	int changed = 0;
+	int error;
+
+	error = sysctl_io_number(req, vm_compressor_dense_mode, sizeof(vm_compressor_dense_mode), &new_mode, &changed);
+	if (error || !changed) {
+		return error;
+	}
+	if (new_mode >= CDENSE_INVALID) {
+		return EINVAL;
+	}
+	os_atomic_store(&vm_compressor_dense_mode, new_mode, relaxed);
+
+	return 0;
+}
+
+SYSCTL_PROC(_vm, OID_AUTO, compressor_dense_mode, CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_LOCKED,
+    0, 0, sysctl_compressor_dense_mode, "I", "Which segments get the dense codec on swapout");
+SYSCTL_UINT(_vm, OID_AUTO, compressor_dense_age, CTLFLAG_RW | CTLFLAG_LOCKED, &vm_compressor_dense_age, 0,
+    "Age in seconds past which segments get the dense codec on swapout");
 #if DEVELOPMENT || DEBUG
 extern int vm_compressor_current_codec;
 extern int vm_compressor_test_seg_wp;
@@ -4674,11 +4770,22 @@ SYSCTL_INT(_vm, OID_AUTO, vm_ktrace, CTLFLAG_RW | CTLFLAG_LOCKED, &vm_ktrace_ena
 extern uint32_t phantom_cache_thrashing_threshold;
 extern uint32_t phantom_cache_eval_period_in_msecs;
 extern uint32_t phantom_cache_thrashing_threshold_ssd;
+extern uint32_t vm_phantom_cache_refault_distance[];
+extern uint32_t vm_phantom_cache_eviction_clock;
+extern int vm_phantom_cache_workingset;
 
 
 SYSCTL_INT(_vm, OID_AUTO, phantom_cache_eval_period_in_msecs, CTLFLAG_RW | CTLFLAG_LOCKED, &phantom_cache_eval_period_in_msecs, 0, "");
 SYSCTL_INT(_vm, OID_AUTO, phantom_cache_thrashing_threshold, CTLFLAG_RW | CTLFLAG_LOCKED, &phantom_cache_thrashing_threshold, 0, "");
 SYSCTL_INT(_vm, OID_AUTO, phantom_cache_thrashing_threshold_ssd, CTLFLAG_RW | CTLFLAG_LOCKED, &phantom_cache_thrashing_threshold_ssd, 0, "");
+SYSCTL_OPAQUE(_vm, OID_AUTO, phantom_cache_refault_distance, CTLFLAG_RD | CTLFLAG_LOCKED,
+    vm_phantom_cache_refault_distance, 8 * sizeof(uint32_t), "IU",
+    "Refaults found in the phantom cache, by log2 of the active queue passes since eviction");
+SYSCTL_INT(_vm, OID_AUTO, phantom_cache_workingset, CTLFLAG_RW | CTLFLAG_LOCKED, &vm_phantom_cache_workingset, 0,
+    "Activate pages that refault within the size of the active queue");
+SYSCTL_UINT(_vm, OID_AUTO, phantom_cache_eviction_clock, CTLFLAG_RD | CTLFLAG_LOCKED, &vm_phantom_cache_eviction_clock, 0, "");
+SYSCTL_ULONG(_vm, OID_AUTO, phantom_cache_workingset_refaults, CTLFLAG_RD | CTLFLAG_LOCKED,
+    &vm_pageout_vminfo.vm_phantom_cache_workingset_refault, "");
 #endif
 
 #if    defined(__LP64__)
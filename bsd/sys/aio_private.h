@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2024 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#ifndef _SYS_AIO_PRIVATE_H_
+#define _SYS_AIO_PRIVATE_H_
+
+#include <stdint.h>
+#include <sys/cdefs.h>
+
+/*
+ * Asynchronous I/O submission and completion rings.
+ *
+ * A process hands the kernel a block of its own memory laid out as a
+ * struct aio_ring header, followed by ar_sq_entries submission queue
+ * entries and ar_cq_entries completion queue entries (see
+ * AIO_RING_SIZE()).  It queues operations by filling SQEs and moving
+ * ar_sq_tail, submits any number of them with one aio_ring_enter()
+ * call, and reaps completions by reading CQEs between ar_cq_head and
+ * ar_cq_tail and moving ar_cq_head, without entering the kernel.
+ *
+ * Indices are free running and wrap at 2^32, the slot of an index is
+ * the index modulo the number of entries, which must be powers of 2.
+ * The kernel writes ar_sq_head and ar_cq_tail, the process writes
+ * ar_sq_tail and ar_cq_head.  A CQE is fully written before ar_cq_tail
+ * moves past it, so it must be read with acquire semantics.
+ *
+ * Reads, writes and fsyncs are performed by the aio worker threads and
+ * count against the same limits as aio_read(2) (kern.aioprocmax and
+ * kern.aiomax).  Opens are performed by aio_ring_enter() itself.
+ * aio_ring_enter() never submits more operations than there is room
+ * for in the completion queue, so the completion queue cannot overflow.
+ */
+
+#define AIO_RING_OP_NOP         0       /* completes immediately with 0 */
+#define AIO_RING_OP_READ        1       /* pread(fd, addr, len, off) */
+#define AIO_RING_OP_WRITE       2       /* pwrite(fd, addr, len, off) */
+#define AIO_RING_OP_FSYNC       3       /* fsync(fd), O_DSYNC in flags for fdatasync */
+#define AIO_RING_OP_OPENAT      4       /* openat(fd, addr, flags, len) */
+
+#define AIO_RING_MAX_ENTRIES    4096
+
+struct aio_ring_sqe {
+	uint8_t         sqe_op;                 /* AIO_RING_OP_* */
+	uint8_t         sqe_reserved[3];
+	int32_t         sqe_fd;                 /* file descriptor, or directory for openat */
+	uint32_t        sqe_flags;              /* open flags for openat, O_DSYNC for fsync */
+	uint32_t        sqe_len;                /* length of the transfer, mode for openat */
+	uint64_t        sqe_off;                /* file offset */
+	uint64_t        sqe_addr;               /* buffer, or path for openat */
+	uint64_t        sqe_user_data;          /* copied to the completion */
+};
+
+struct aio_ring_cqe {
+	uint64_t        cqe_user_data;          /* sqe_user_data of the operation */
+	int64_t         cqe_res;                /* bytes transferred, new fd, or -errno */
+};
+
+struct aio_ring {
+	/* submission queue */
+	uint32_t        ar_sq_head;             /* next SQE the kernel will consume */
+	uint32_t        ar_sq_tail;             /* next SQE the process will fill */
+	uint32_t        ar_sq_entries;
+	uint32_t        ar_reserved0;
+
+	/* completion queue */
+	uint32_t        ar_cq_head;             /* next CQE the process will reap */
+	uint32_t        ar_cq_tail;             /* next CQE the kernel will fill */
+	uint32_t        ar_cq_entries;
+	uint32_t        ar_reserved1;
+
+	uint64_t        ar_reserved[4];
+};
+
+#define AIO_RING_SQES_OFFSET            sizeof(struct aio_ring)
+#define AIO_RING_CQES_OFFSET(sq)        (AIO_RING_SQES_OFFSET + \
+	        (uint64_t)(sq) * sizeof(struct aio_ring_sqe))
+#define AIO_RING_SIZE(sq, cq)           (AIO_RING_CQES_OFFSET(sq) + \
+	        (uint64_t)(cq) * sizeof(struct aio_ring_cqe))
+
+#ifndef KERNEL
+
+__BEGIN_DECLS
+
+/*
+ * Register the AIO_RING_SIZE(sq_entries, cq_entries) bytes at `ring` as
+ * the process's ring, or unregister it when `ring` is NULL.  A process
+ * has at most one ring, it is unregistered on exec and exit.  Operations
+ * in flight when the ring is unregistered still complete, but are not
+ * posted to it anymore.
+ */
+int             aio_ring_setup(struct aio_ring *ring, uint32_t sq_entries,
+    uint32_t cq_entries, uint32_t flags);
+
+/*
+ * Submit up to `to_submit` queued operations, then wait until at least
+ * `min_complete` completions are available to reap.  Returns the number
+ * of operations submitted.
+ */
+int             aio_ring_enter(uint32_t to_submit, uint32_t min_complete,
+    uint32_t flags);
+
+__END_DECLS
+
+#endif /* !KERNEL */
+
+#endif /* _SYS_AIO_PRIVATE_H_ */
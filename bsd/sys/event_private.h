@@ -153,6 +153,7 @@ typedef uint64_t kqueue_id_t;
 #define KEVENT_FLAG_DYNAMIC_KQ_MUST_EXIST        0x020000   /* kq lookup by id must exist */
 #define KEVENT_FLAG_DYNAMIC_KQ_MUST_NOT_EXIST    0x040000   /* kq lookup by id must not exist */
 #define KEVENT_FLAG_WORKLOOP_NO_WQ_THREAD        0x080000   /* obsolete */
+#define KEVENT_FLAG_MULTISHOT                    0x100000   /* re-enable delivered EV_DISPATCH events on the next call */
 
 #ifdef XNU_KERNEL_PRIVATE
 
@@ -165,11 +166,13 @@ typedef uint64_t kqueue_id_t;
 #define KEVENT_FLAG_NEEDS_END_PROCESSING         0x4000  /* end processing required before returning */
 
 #define KEVENT_ID_FLAG_USER (KEVENT_FLAG_WORKLOOP | \
-	        KEVENT_FLAG_DYNAMIC_KQ_MUST_EXIST | KEVENT_FLAG_DYNAMIC_KQ_MUST_NOT_EXIST)
+	        KEVENT_FLAG_DYNAMIC_KQ_MUST_EXIST | KEVENT_FLAG_DYNAMIC_KQ_MUST_NOT_EXIST | \
+	        KEVENT_FLAG_MULTISHOT)
 
 #define KEVENT_FLAG_USER (KEVENT_FLAG_IMMEDIATE | KEVENT_FLAG_ERROR_EVENTS | \
 	        KEVENT_FLAG_STACK_DATA | KEVENT_FLAG_WORKQ | KEVENT_FLAG_WORKLOOP | \
-	        KEVENT_FLAG_DYNAMIC_KQ_MUST_EXIST | KEVENT_FLAG_DYNAMIC_KQ_MUST_NOT_EXIST)
+	        KEVENT_FLAG_DYNAMIC_KQ_MUST_EXIST | KEVENT_FLAG_DYNAMIC_KQ_MUST_NOT_EXIST | \
+	        KEVENT_FLAG_MULTISHOT)
 
 /*
  * Since some filter ops are not part of the standard sysfilt_ops, we use
@@ -304,6 +307,7 @@ typedef uint64_t kqueue_id_t;
 #define NOTE_MEMORYSTATUS_LOW_SWAP              0x00000008      /* system is in a low-swap state */
 #define NOTE_MEMORYSTATUS_PROC_LIMIT_WARN       0x00000010      /* process memory limit has hit a warning state */
 #define NOTE_MEMORYSTATUS_PROC_LIMIT_CRITICAL   0x00000020      /* process memory limit has hit a critical state - soft limit */
+#define NOTE_MEMORYSTATUS_PURGED                0x00000800      /* some of the process's volatile purgeable memory was purged */
 #define NOTE_MEMORYSTATUS_MSL_STATUS   0xf0000000      /* bits used to request change to process MSL status */
 
 #ifdef KERNEL_PRIVATE
@@ -321,7 +325,8 @@ typedef uint64_t kqueue_id_t;
  */
 #define EVFILT_MEMORYSTATUS_ALL_MASK \
 	(NOTE_MEMORYSTATUS_PRESSURE_NORMAL | NOTE_MEMORYSTATUS_PRESSURE_WARN | NOTE_MEMORYSTATUS_PRESSURE_CRITICAL | NOTE_MEMORYSTATUS_LOW_SWAP | \
-	 NOTE_MEMORYSTATUS_PROC_LIMIT_WARN | NOTE_MEMORYSTATUS_PROC_LIMIT_CRITICAL | NOTE_MEMORYSTATUS_MSL_STATUS)
+	 NOTE_MEMORYSTATUS_PROC_LIMIT_WARN | NOTE_MEMORYSTATUS_PROC_LIMIT_CRITICAL | NOTE_MEMORYSTATUS_PURGED | \
+	 NOTE_MEMORYSTATUS_MSL_STATUS)
 
 #endif /* KERNEL_PRIVATE */
 
@@ -392,7 +397,7 @@ __options_decl(kn_status_t, uint16_t /* 12 bits really */, {
 	KN_DROPPING       = 0x008,  /* knote is being dropped */
 	KN_LOCKED         = 0x010,  /* knote is locked (kq_knlocks) */
 	KN_POSTING        = 0x020,  /* f_event() in flight */
-	// was KN_STAYACTIVE  = 0x040,
+	KN_REARM          = 0x040,  /* EV_DISPATCH re-enabled on the next processing (KEVENT_FLAG_MULTISHOT) */
 	KN_DEFERDELETE    = 0x080,  /* defer delete until re-enabled */
 	KN_MERGE_QOS      = 0x100,  /* f_event() / f_* ran concurrently and overrides must merge */
 	KN_REQVANISH      = 0x200,  /* requested EV_VANISH */
@@ -548,6 +548,7 @@ __BEGIN_DECLS
 #define VM_RECLAIM_ALL_MEMORY        0x05
 #define VM_RECLAIM_ASYNC_MEMORY      0x06
 #define VM_RECLAIM_INIT              0x07
+#define VM_RECLAIM_SCHEDULE          0x08
 
 /* **** The Kernel Debug Sub Classes for Network (DBG_NETWORK) **** */
 #define DBG_NETIP       1       /* Internet Protocol */
@@ -35,6 +35,8 @@
 
 #if BSD_KERNEL_PRIVATE
 
+void memorystatus_purged_notify(void);
+
 #if VM_PRESSURE_EVENTS
 
 extern vm_pressure_level_t memorystatus_vm_pressure_level;
@@ -403,6 +403,7 @@ struct proc {
 
 	TAILQ_HEAD(, aio_workq_entry ) p_aio_activeq;   /* active async IO requests */
 	TAILQ_HEAD(, aio_workq_entry ) p_aio_doneq;     /* completed async IO requests */
+	struct aio_ring_ctx            *p_aio_ring;     /* submission/completion ring, if any */
 
 	struct klist p_klist;  /* knote list (PL ?)*/
 
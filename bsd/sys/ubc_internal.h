@@ -81,11 +81,17 @@ struct cl_wextent {
 	int             io_flags;
 };
 
+#define CL_READ_STREAMS 4       /* independent read-ahead streams tracked per vnode */
+
 struct cl_readahead {
 	lck_mtx_t       cl_lockr;
 	daddr64_t       cl_lastr;                       /* last block read by client */
 	daddr64_t       cl_maxra;                       /* last block prefetched by the read ahead */
 	int             cl_ralen;                       /* length of last prefetch */
+	uint32_t        cl_latency;                     /* moving average of read I/O latency in usecs */
+	daddr64_t       cl_firstr;                      /* first block read by client */
+	daddr64_t       cl_stride;                      /* distance between the last two reads, 0 if none */
+	uint64_t        cl_lastuse;                     /* mach_absolute_time of the last read */
 };
 
 struct cl_writebehind {
@@ -173,7 +179,7 @@ struct ubc_info {
 	uint32_t                ui_flags;       /* flags */
 	uint32_t                cs_add_gen;     /* generation count when csblob was validated */
 
-	struct  cl_readahead   *cl_rahead;      /* cluster read ahead context */
+	struct  cl_readahead   *cl_rahead;      /* cluster read ahead contexts, CL_READ_STREAMS of them */
 	struct  cl_writebehind *cl_wbehind;     /* cluster write behind context */
 
 	struct timespec         cs_mtime;       /* modify time of file when
@@ -85,6 +85,7 @@
 #include <mach/upl.h>
 #include <kern/task.h>
 #include <kern/policy_internal.h>
+#include <kern/clock.h>
 
 #include <vm/vm_kern.h>
 #include <vm/vm_map.h>
@@ -163,7 +164,7 @@ static LCK_MTX_DECLARE(cl_transaction_mtxp, &cl_mtx_grp);
 static LCK_SPIN_DECLARE(cl_direct_read_spin_lock, &cl_mtx_grp);
 
 static ZONE_DEFINE(cl_rd_zone, "cluster_read",
-    sizeof(struct cl_readahead), ZC_ZFREE_CLEARMEM);
+    sizeof(struct cl_readahead) * CL_READ_STREAMS, ZC_ZFREE_CLEARMEM);
 
 static ZONE_DEFINE(cl_wr_zone, "cluster_write",
     sizeof(struct cl_writebehind), ZC_ZFREE_CLEARMEM);
@@ -219,6 +220,9 @@ static int cluster_align_phys_io(vnode_t vp, struct uio *uio, addr64_t usr_paddr
 static int      cluster_read_prefetch(vnode_t vp, off_t f_offset, u_int size, off_t filesize, int (*callback)(buf_t, void *), void *callback_arg, int bflag);
 static void     cluster_read_ahead(vnode_t vp, struct cl_extent *extent, off_t filesize, struct cl_readahead *ra,
     int (*callback)(buf_t, void *), void *callback_arg, int bflag);
+static int      cluster_read_ahead_strided(vnode_t vp, struct cl_extent *extent, off_t filesize, struct cl_readahead *ra,
+    u_int max_prefetch, int (*callback)(buf_t, void *), void *callback_arg, int bflag);
+static void     cluster_read_done(struct cl_readahead *ra, struct cl_extent *extent);
 
 static int      cluster_push_now(vnode_t vp, struct cl_extent *, off_t EOF, int flags, int (*)(buf_t, void *), void *callback_arg, boolean_t vm_ioitiated);
 
@@ -298,6 +302,15 @@ uint32_t prefetch_max = (1024 * 1024 * 1024);
 uint32_t overlapping_read_max = (1024 * 1024 * 1024);
 /* maximum bytes for outstanding writes */
 uint32_t overlapping_write_max = (1024 * 1024 * 1024);
+/* read latency (usecs) a read-ahead window of speculative_prefetch_max is expected to hide */
+uint32_t cluster_ra_latency_target_us = 2000;
+/* read-ahead windows grow to at most this many times speculative_prefetch_max on slow devices */
+#define CL_RA_MAX_SCALE         4
+
+/* read-ahead streams recycled for a new reader */
+uint64_t cluster_ra_stream_switches = 0;
+/* records prefetched ahead of a strided reader */
+uint64_t cluster_ra_strided_prefetches = 0;
 
 #define IO_SCALE(vp, base)              (vp->v_mount->mnt_ioscale * (base))
 #define MAX_CLUSTER_SIZE(vp)            (cluster_max_io_size(vp->v_mount, CL_WRITE))
@@ -412,52 +425,110 @@ calculate_max_throttle_cnt(vnode_t vp)
 #define CLW_IONOCACHE           0x04
 #define CLW_IOPASSIVE   0x08
 
+static void
+cluster_ra_free(struct cl_readahead *ra_streams)
+{
+	for (int i = 0; i < CL_READ_STREAMS; i++) {
+		lck_mtx_destroy(&ra_streams[i].cl_lockr, &cl_mtx_grp);
+	}
+	zfree(cl_rd_zone, ra_streams);
+}
+
 /*
- * if the read ahead context doesn't yet exist,
- * allocate and initialize it...
+ * if the read ahead contexts don't yet exist,
+ * allocate and initialize them...
  * the vnode lock serializes multiple callers
  * during the actual assignment... first one
  * to grab the lock wins... the other callers
  * will release the now unnecessary storage
  *
- * once the context is present, try to grab (but don't block on)
+ * there are CL_READ_STREAMS contexts per vnode so that
+ * several readers working through different parts of
+ * the same file each keep their own read-ahead state...
+ * pick the stream this read continues (sequentially or
+ * at the stride it has been moving at), failing that the
+ * closest stream behind the read within a read-ahead window
+ * (it may be a strided reader we haven't recognized yet),
+ * and failing that recycle the least recently used one.
+ * the streams are looked at without their locks, so this
+ * is only a hint... cluster_read_ahead validates the
+ * pattern again once the lock is held
+ *
+ * once a context is chosen, try to grab (but don't block on)
  * the lock associated with it... if someone
  * else currently owns it, than the read
  * will run without read-ahead.  this allows
- * multiple readers to run in parallel and
- * since there's only 1 read ahead context,
- * there's no real loss in only allowing 1
- * reader to have read-ahead enabled.
+ * multiple readers of the same stream to run
+ * in parallel, and only 1 of them needs the
+ * read-ahead to keep the stream fed.
  */
 static struct cl_readahead *
-cluster_get_rap(vnode_t vp)
+cluster_get_rap(vnode_t vp, struct cl_extent *extent)
 {
 	struct ubc_info         *ubc;
-	struct cl_readahead     *rap;
+	struct cl_readahead     *ra_streams;
+	struct cl_readahead     *rap, *near = NULL, *lru = NULL;
+	daddr64_t               max_stride;
+	int                     i;
 
 	ubc = vp->v_ubcinfo;
 
-	if ((rap = ubc->cl_rahead) == NULL) {
-		rap = zalloc_flags(cl_rd_zone, Z_WAITOK | Z_ZERO);
-		rap->cl_lastr = -1;
-		lck_mtx_init(&rap->cl_lockr, &cl_mtx_grp, LCK_ATTR_NULL);
+	if ((ra_streams = ubc->cl_rahead) == NULL) {
+		ra_streams = zalloc_flags(cl_rd_zone, Z_WAITOK | Z_ZERO);
+
+		for (i = 0; i < CL_READ_STREAMS; i++) {
+			ra_streams[i].cl_lastr = -1;
+			ra_streams[i].cl_firstr = -1;
+			lck_mtx_init(&ra_streams[i].cl_lockr, &cl_mtx_grp, LCK_ATTR_NULL);
+		}
 
 		vnode_lock(vp);
 
 		if (ubc->cl_rahead == NULL) {
-			ubc->cl_rahead = rap;
+			ubc->cl_rahead = ra_streams;
 		} else {
-			lck_mtx_destroy(&rap->cl_lockr, &cl_mtx_grp);
-			zfree(cl_rd_zone, rap);
-			rap = ubc->cl_rahead;
+			cluster_ra_free(ra_streams);
+			ra_streams = ubc->cl_rahead;
 		}
 		vnode_unlock(vp);
 	}
-	if (lck_mtx_try_lock(&rap->cl_lockr) == TRUE) {
-		return rap;
+	max_stride = speculative_prefetch_max / PAGE_SIZE;
+
+	for (i = 0; i < CL_READ_STREAMS; i++) {
+		rap = &ra_streams[i];
+
+		if (rap->cl_lastr != -1) {
+			if (extent->b_addr == rap->cl_lastr || extent->b_addr == (rap->cl_lastr + 1) ||
+			    (rap->cl_stride && extent->b_addr == (rap->cl_firstr + rap->cl_stride))) {
+				near = rap;
+				break;
+			}
+			if (extent->b_addr > rap->cl_lastr && (extent->b_addr - rap->cl_firstr) <= max_stride &&
+			    (near == NULL || rap->cl_lastr > near->cl_lastr)) {
+				near = rap;
+			}
+		}
+		if (lru == NULL || rap->cl_lastuse < lru->cl_lastuse) {
+			lru = rap;
+		}
 	}
+	rap = near ? near : lru;
 
-	return (struct cl_readahead *)NULL;
+	if (lck_mtx_try_lock(&rap->cl_lockr) == FALSE) {
+		return (struct cl_readahead *)NULL;
+	}
+	if (near == NULL) {
+		if (rap->cl_lastr != -1) {
+			os_atomic_inc(&cluster_ra_stream_switches, relaxed);
+		}
+		rap->cl_lastr = -1;
+		rap->cl_firstr = -1;
+		rap->cl_maxra = 0;
+		rap->cl_ralen = 0;
+		rap->cl_stride = 0;
+		rap->cl_lastuse = mach_absolute_time();
+	}
+	return rap;
 }
 
 
@@ -2160,6 +2231,145 @@ cluster_read_prefetch(vnode_t vp, off_t f_offset, u_int size, off_t filesize, in
 
 
 
+/*
+ * the largest read-ahead window for a stream... a window of
+ * speculative_prefetch_max is assumed to hide cluster_ra_latency_target_us
+ * of read latency, streams that have been seeing slower I/O than
+ * that get proportionally larger windows so that the read-ahead
+ * stays far enough in front of the reader, up to CL_RA_MAX_SCALE
+ * times the usual size
+ */
+static u_int
+cluster_read_ahead_window(vnode_t vp, struct cl_readahead *rap)
+{
+	uint32_t        max_prefetch;
+	uint32_t        scale;
+
+	max_prefetch = cluster_max_prefetch(vp,
+	    cluster_max_io_size(vp->v_mount, CL_READ), speculative_prefetch_max);
+
+	if (cluster_ra_latency_target_us && rap->cl_latency > cluster_ra_latency_target_us) {
+		scale = MIN(CL_RA_MAX_SCALE, 1 + rap->cl_latency / cluster_ra_latency_target_us);
+
+		if (os_mul_overflow(max_prefetch, scale, &max_prefetch) || max_prefetch > prefetch_max) {
+			max_prefetch = prefetch_max;
+		}
+	}
+	return max_prefetch;
+}
+
+
+/*
+ * fold the latency of a read I/O issued on behalf of the
+ * stream into its moving average
+ */
+static void
+cluster_read_latency(struct cl_readahead *rap, uint64_t io_start)
+{
+	uint64_t        elapsed_ns;
+	uint32_t        sample;
+
+	absolutetime_to_nanoseconds(mach_absolute_time() - io_start, &elapsed_ns);
+	sample = (uint32_t)MIN(elapsed_ns / NSEC_PER_USEC, UINT32_MAX);
+
+	if (rap->cl_latency) {
+		rap->cl_latency = (uint32_t)(((uint64_t)rap->cl_latency * 7 + sample) / 8);
+	} else {
+		rap->cl_latency = sample;
+	}
+}
+
+
+/*
+ * the client has finished reading 'extent' through the
+ * stream... remember where it stopped, and how far it
+ * moved from the start of its previous read so that a
+ * constant stride can be recognized on the next one
+ */
+static void
+cluster_read_done(struct cl_readahead *rap, struct cl_extent *extent)
+{
+	if (extent->e_addr < rap->cl_lastr) {
+		rap->cl_maxra = 0;
+	}
+	if (rap->cl_firstr != -1 && extent->b_addr > (rap->cl_lastr + 1)) {
+		rap->cl_stride = extent->b_addr - rap->cl_firstr;
+	} else {
+		rap->cl_stride = 0;
+	}
+	rap->cl_firstr = extent->b_addr;
+	rap->cl_lastr = extent->e_addr;
+	rap->cl_lastuse = mach_absolute_time();
+}
+
+
+/*
+ * the client isn't reading sequentially, but if it has
+ * moved forward by the same distance twice in a row,
+ * assume it's working through fixed size records at a
+ * constant stride and prefetch the records it will be
+ * asking for next... cl_ralen counts records here, and
+ * doubles each time the stride holds up, until a full
+ * read-ahead window's worth of records is in flight...
+ * cl_maxra is the first block of the furthest record
+ * prefetched so far
+ *
+ * returns 0 if this isn't a strided read
+ */
+static int
+cluster_read_ahead_strided(vnode_t vp, struct cl_extent *extent, off_t filesize, struct cl_readahead *rap,
+    u_int max_prefetch, int (*callback)(buf_t, void *), void *callback_arg, int bflag)
+{
+	daddr64_t       stride;
+	daddr64_t       rec_len;
+	daddr64_t       max_records;
+	daddr64_t       r_addr;
+	daddr64_t       last_addr;
+	off_t           f_offset;
+
+	if (rap->cl_lastr == -1 || rap->cl_stride == 0) {
+		return 0;
+	}
+	stride = extent->b_addr - rap->cl_firstr;
+	rec_len = (extent->e_addr + 1) - extent->b_addr;
+
+	if (stride != rap->cl_stride || stride <= rec_len || rec_len > (max_prefetch / PAGE_SIZE)) {
+		return 0;
+	}
+	max_records = MAX(1, (max_prefetch / PAGE_SIZE) / rec_len);
+
+	if (rap->cl_maxra < extent->b_addr) {
+		/*
+		 * first time at this stride, or the reader
+		 * has overtaken the prefetch... start over
+		 */
+		rap->cl_ralen = 0;
+		rap->cl_maxra = extent->b_addr;
+	} else if ((rap->cl_maxra - extent->b_addr) / stride > (rap->cl_ralen / 2)) {
+		/*
+		 * more than half of the last batch of
+		 * records are still ahead of the reader
+		 */
+		return 1;
+	}
+	rap->cl_ralen = rap->cl_ralen ? (int)MIN(max_records, rap->cl_ralen << 1) : 1;
+	last_addr = extent->b_addr + (rap->cl_ralen * stride);
+
+	for (r_addr = rap->cl_maxra + stride; r_addr <= last_addr; r_addr += stride) {
+		f_offset = (off_t)(r_addr * PAGE_SIZE_64);
+
+		if (f_offset >= filesize) {
+			break;
+		}
+		cluster_read_prefetch(vp, f_offset, (u_int)(rec_len * PAGE_SIZE), filesize, callback, callback_arg, bflag);
+		os_atomic_inc(&cluster_ra_strided_prefetches, relaxed);
+
+		rap->cl_maxra = r_addr;
+	}
+	return 1;
+}
+
+
 static void
 cluster_read_ahead(vnode_t vp, struct cl_extent *extent, off_t filesize, struct cl_readahead *rap, int (*callback)(buf_t, void *), void *callback_arg,
     int bflag)
@@ -2178,7 +2388,14 @@ cluster_read_ahead(vnode_t vp, struct cl_extent *extent, off_t filesize, struct
 		    rap->cl_ralen, (int)rap->cl_maxra, (int)rap->cl_lastr, 0, 0);
 		return;
 	}
+	max_prefetch = cluster_read_ahead_window(vp, rap);
+
 	if (rap->cl_lastr == -1 || (extent->b_addr != rap->cl_lastr && extent->b_addr != (rap->cl_lastr + 1))) {
+		if (cluster_read_ahead_strided(vp, extent, filesize, rap, max_prefetch, callback, callback_arg, bflag)) {
+			KERNEL_DEBUG((FSDBG_CODE(DBG_FSRW, 48)) | DBG_FUNC_END,
+			    rap->cl_ralen, (int)rap->cl_maxra, (int)rap->cl_lastr, 5, 0);
+			return;
+		}
 		rap->cl_ralen = 0;
 		rap->cl_maxra = 0;
 
@@ -2188,9 +2405,6 @@ cluster_read_ahead(vnode_t vp, struct cl_extent *extent, off_t filesize, struct
 		return;
 	}
 
-	max_prefetch = cluster_max_prefetch(vp,
-	    cluster_max_io_size(vp->v_mount, CL_READ), speculative_prefetch_max);
-
 	if (max_prefetch <= PAGE_SIZE) {
 		KERNEL_DEBUG((FSDBG_CODE(DBG_FSRW, 48)) | DBG_FUNC_END,
 		    rap->cl_ralen, (int)rap->cl_maxra, (int)rap->cl_lastr, 6, 0);
@@ -4087,6 +4301,7 @@ cluster_read_copy(vnode_t vp, struct uio *uio, u_int32_t io_req_size, off_t file
 	int              take_reference = 1;
 	int              policy = IOPOL_DEFAULT;
 	boolean_t        iolock_inited = FALSE;
+	uint64_t         io_start;
 
 	KERNEL_DEBUG((FSDBG_CODE(DBG_FSRW, 32)) | DBG_FUNC_START,
 	    (int)uio->uio_offset, io_req_size, (int)filesize, flags, 0);
@@ -4140,11 +4355,11 @@ cluster_read_copy(vnode_t vp, struct uio *uio, u_int32_t io_req_size, off_t file
 
 			max_rd_size = calculate_max_throttle_size(vp);
 		}
-		if ((rap = cluster_get_rap(vp)) == NULL) {
+		extent.b_addr = uio->uio_offset / PAGE_SIZE_64;
+		extent.e_addr = (last_request_offset - 1) / PAGE_SIZE_64;
+
+		if ((rap = cluster_get_rap(vp, &extent)) == NULL) {
 			rd_ahead_enabled = 0;
-		} else {
-			extent.b_addr = uio->uio_offset / PAGE_SIZE_64;
-			extent.e_addr = (last_request_offset - 1) / PAGE_SIZE_64;
 		}
 	}
 	if (rap != NULL && rap->cl_ralen && (rap->cl_lastr == extent.b_addr || (rap->cl_lastr + 1) == extent.b_addr)) {
@@ -4252,10 +4467,7 @@ cluster_read_copy(vnode_t vp, struct uio *uio, u_int32_t io_req_size, off_t file
 			}
 			if (io_size == 0) {
 				if (rap != NULL) {
-					if (extent.e_addr < rap->cl_lastr) {
-						rap->cl_maxra = 0;
-					}
-					rap->cl_lastr = extent.e_addr;
+					cluster_read_done(rap, &extent);
 				}
 				break;
 			}
@@ -4270,6 +4482,7 @@ cluster_read_copy(vnode_t vp, struct uio *uio, u_int32_t io_req_size, off_t file
 		iostate.io_issued = 0;
 		iostate.io_error = 0;
 		iostate.io_wanted = 0;
+		io_start = 0;
 
 		if ((flags & IO_RETURN_ON_THROTTLE)) {
 			if (cluster_is_throttled(vp) == THROTTLE_NOW) {
@@ -4411,6 +4624,7 @@ cluster_read_copy(vnode_t vp, struct uio *uio, u_int32_t io_req_size, off_t file
 			/*
 			 * issue an asynchronous read to cluster_io
 			 */
+			io_start = mach_absolute_time();
 
 			error = cluster_io(vp, upl, upl_offset, upl_f_offset + upl_offset,
 			    io_size, CL_READ | CL_ASYNC | bflag, (buf_t)NULL, &iostate, callback, callback_arg);
@@ -4506,15 +4720,15 @@ cluster_read_copy(vnode_t vp, struct uio *uio, u_int32_t io_req_size, off_t file
 				}
 
 				if (rap != NULL) {
-					if (extent.e_addr < rap->cl_lastr) {
-						rap->cl_maxra = 0;
-					}
-					rap->cl_lastr = extent.e_addr;
+					cluster_read_done(rap, &extent);
 				}
 			}
 			if (iolock_inited == TRUE) {
 				cluster_iostate_wait(&iostate, 0, "cluster_read_copy");
 			}
+			if (rap != NULL && io_start) {
+				cluster_read_latency(rap, io_start);
+			}
 
 			if (iostate.io_error) {
 				error = iostate.io_error;
@@ -6018,8 +6232,7 @@ cluster_release(struct ubc_info *ubc)
 	}
 
 	if ((rap = ubc->cl_rahead)) {
-		lck_mtx_destroy(&rap->cl_lockr, &cl_mtx_grp);
-		zfree(cl_rd_zone, rap);
+		cluster_ra_free(rap);
 		ubc->cl_rahead  = NULL;
 	}
 
@@ -106,6 +106,7 @@
 #include <vm/vm_dyld_pager.h>
 
 #include <vm/vm_protos.h>
+#include <vm/vm_reclaim_internal.h>
 
 #include <sys/kern_memorystatus.h>
 #include <sys/kern_memorystatus_freeze.h>
@@ -244,6 +245,32 @@ sysctl_vm_self_region_page_size SYSCTL_HANDLER_ARGS
 }
 SYSCTL_PROC(_vm, OID_AUTO, self_region_page_size, CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_ANYBODY | CTLFLAG_LOCKED | CTLFLAG_MASKED, 0, 0, &sysctl_vm_self_region_page_size, "I", "");
 
+static int
+sysctl_vm_self_fault_around SYSCTL_HANDLER_ARGS
+{
+#pragma unused(arg1, arg2, oidp)
+	int     error = 0;
+	int     value;
+
+	value = vm_map_fault_around(current_map());
+	error = SYSCTL_OUT(req, &value, sizeof(int));
+	if (error) {
+		return error;
+	}
+
+	if (!req->newptr) {
+		return 0;
+	}
+
+	error = SYSCTL_IN(req, &value, sizeof(int));
+	if (error) {
+		return error;
+	}
+	vm_map_set_fault_around(current_map(), value != 0);
+	return 0;
+}
+SYSCTL_PROC(_vm, OID_AUTO, self_fault_around, CTLTYPE_INT | CTLFLAG_RW | CTLFLAG_ANYBODY | CTLFLAG_LOCKED | CTLFLAG_MASKED, 0, 0, &sysctl_vm_self_fault_around, "I", "");
+
 
 #if DEVELOPMENT || DEBUG
 extern int panic_on_unsigned_execute;
@@ -3389,6 +3416,25 @@ SYSCTL_SCALABLE_COUNTER(_vm, pages_grabbed, vm_page_grab_count, "Total pages gra
 SYSCTL_ULONG(_vm, OID_AUTO, pages_freed, CTLFLAG_RD | CTLFLAG_LOCKED,
     &vm_pageout_vminfo.vm_page_pages_freed, "Total pages freed");
 
+extern unsigned int vm_free_magazine_refill_limit;
+extern unsigned int vm_free_magazine_limit;
+SYSCTL_UINT(_vm, OID_AUTO, free_magazine_refill_limit, CTLFLAG_RD | CTLFLAG_LOCKED,
+    &vm_free_magazine_refill_limit, 0, "Pages moved to a per-CPU free page cache per refill");
+SYSCTL_UINT(_vm, OID_AUTO, free_magazine_limit, CTLFLAG_RD | CTLFLAG_LOCKED,
+    &vm_free_magazine_limit, 0, "Freed pages a per-CPU free page cache can hold");
+SCALABLE_COUNTER_DECLARE(vm_page_free_cache_hits);
+SCALABLE_COUNTER_DECLARE(vm_page_free_cache_refills);
+SCALABLE_COUNTER_DECLARE(vm_page_free_cache_releases);
+SCALABLE_COUNTER_DECLARE(vm_page_free_cache_drains);
+SYSCTL_SCALABLE_COUNTER(_vm, page_free_cache_hits, vm_page_free_cache_hits,
+    "Pages grabbed from a per-CPU free page cache without refilling it");
+SYSCTL_SCALABLE_COUNTER(_vm, page_free_cache_refills, vm_page_free_cache_refills,
+    "Per-CPU free page cache refills from the global free queues");
+SYSCTL_SCALABLE_COUNTER(_vm, page_free_cache_releases, vm_page_free_cache_releases,
+    "Pages freed into a per-CPU free page cache (not counted in pages_freed)");
+SYSCTL_SCALABLE_COUNTER(_vm, page_free_cache_drains, vm_page_free_cache_drains,
+    "Per-CPU free page cache drains to the global free queues");
+
 SYSCTL_INT(_vm, OID_AUTO, pageout_purged_objects, CTLFLAG_RD | CTLFLAG_LOCKED,
     &vm_pageout_debug.vm_pageout_purged_objects, 0, "System purged object count");
 SYSCTL_UINT(_vm, OID_AUTO, pageout_cleaned_busy, CTLFLAG_RD | CTLFLAG_LOCKED,
@@ -3482,6 +3528,19 @@ SYSCTL_UINT(_vm, OID_AUTO, page_realtime_count, CTLFLAG_RD | CTLFLAG_LOCKED, &vm
 extern int vm_pageout_protect_realtime;
 SYSCTL_INT(_vm, OID_AUTO, pageout_protect_realtime, CTLFLAG_RW | CTLFLAG_LOCKED, &vm_pageout_protect_realtime, 0, "");
 
+/* generations of the active queue */
+extern int vm_page_multigen;
+extern unsigned int vm_page_multigen_cluster;
+extern uint64_t vm_page_active_seq;
+SYSCTL_INT(_vm, OID_AUTO, page_multigen, CTLFLAG_RW | CTLFLAG_LOCKED, &vm_page_multigen, 0,
+    "Only deactivate active pages that went unreferenced for several passes");
+SYSCTL_UINT(_vm, OID_AUTO, page_multigen_cluster, CTLFLAG_RW | CTLFLAG_LOCKED, &vm_page_multigen_cluster, 0,
+    "Neighbours in the same object deactivated along with an oldest generation page");
+SYSCTL_QUAD(_vm, OID_AUTO, page_active_seq, CTLFLAG_RD | CTLFLAG_LOCKED, &vm_page_active_seq, "");
+SYSCTL_ULONG(_vm, OID_AUTO, page_gen_promoted, CTLFLAG_RD | CTLFLAG_LOCKED, &vm_pageout_vminfo.vm_page_gen_promoted, "");
+SYSCTL_ULONG(_vm, OID_AUTO, page_gen_aged, CTLFLAG_RD | CTLFLAG_LOCKED, &vm_pageout_vminfo.vm_page_gen_aged, "");
+SYSCTL_ULONG(_vm, OID_AUTO, page_gen_clustered, CTLFLAG_RD | CTLFLAG_LOCKED, &vm_pageout_vminfo.vm_page_gen_clustered, "");
+
 /* counts of pages prefaulted when entering a memory object */
 extern int64_t vm_prefault_nb_pages, vm_prefault_nb_bailout;
 SYSCTL_QUAD(_vm, OID_AUTO, prefault_nb_pages, CTLFLAG_RW | CTLFLAG_LOCKED, &vm_prefault_nb_pages, "");
@@ -3584,10 +3643,103 @@ extern uint64_t vm_reclaim_trim_divisor;
 
 SYSCTL_ULONG(_vm, OID_AUTO, reclaim_max_threshold, CTLFLAG_RW | CTLFLAG_LOCKED, &vm_reclaim_max_threshold, "");
 SYSCTL_ULONG(_vm, OID_AUTO, reclaim_trim_divisor, CTLFLAG_RW | CTLFLAG_LOCKED, &vm_reclaim_trim_divisor, "");
+
+extern uint32_t vm_reclaim_scan_interval_ms;
+extern uint64_t vm_reclaim_scan_min_bytes;
+extern uint32_t vm_reclaim_scan_max_buffers;
+
+SYSCTL_UINT(_vm, OID_AUTO, reclaim_scan_interval_ms, CTLFLAG_RW | CTLFLAG_LOCKED, &vm_reclaim_scan_interval_ms, 0, "");
+SYSCTL_ULONG(_vm, OID_AUTO, reclaim_scan_min_bytes, CTLFLAG_RW | CTLFLAG_LOCKED, &vm_reclaim_scan_min_bytes, "");
+SYSCTL_UINT(_vm, OID_AUTO, reclaim_scan_max_buffers, CTLFLAG_RW | CTLFLAG_LOCKED, &vm_reclaim_scan_max_buffers, 0, "");
 #endif /* DEVELOPMENT || DEBUG */
 
+static int
+sysctl_vm_reclaim_stats SYSCTL_HANDLER_ARGS
+{
+#pragma unused(oidp, arg1, arg2)
+	mach_vm_reclaim_stats_v1_t *stats;
+	size_t count, max_count;
+	int error;
+
+	count = vm_deferred_reclamation_copy_stats(NULL, 0);
+	if (req->oldptr == USER_ADDR_NULL) {
+		/* leave some room for buffers created in the meantime */
+		return SYSCTL_OUT(req, NULL, (count + 8) * sizeof(*stats));
+	}
+
+	max_count = MIN(count, req->oldlen / sizeof(*stats));
+	if (max_count == 0) {
+		return count ? ENOMEM : 0;
+	}
+	stats = kalloc_data(max_count * sizeof(*stats), Z_WAITOK | Z_ZERO);
+	if (stats == NULL) {
+		return ENOMEM;
+	}
+	count = MIN(vm_deferred_reclamation_copy_stats(stats, max_count), max_count);
+	error = SYSCTL_OUT(req, stats, count * sizeof(*stats));
+	kfree_data(stats, max_count * sizeof(*stats));
+
+	return error;
+}
+
+SYSCTL_PROC(_vm, OID_AUTO, reclaim_stats,
+    CTLTYPE_OPAQUE | CTLFLAG_RD | CTLFLAG_LOCKED, 0, 0,
+    &sysctl_vm_reclaim_stats, "S,mach_vm_reclaim_stats_v1_t",
+    "Deferred reclamation statistics for each process with a reclamation buffer");
+
 #endif /* CONFIG_DEFERRED_RECLAIM */
 
+#pragma mark Transparent Superpages
+
+#if CONFIG_TRANSPARENT_SUPERPAGES
+extern int vm_transparent_superpages;
+extern uint32_t vm_superpage_scan_interval_ms;
+extern uint32_t vm_superpage_scan_max_promotions;
+extern uint64_t vm_superpage_promotions;
+extern uint64_t vm_superpage_splits;
+extern uint64_t vm_superpage_promotion_failures;
+extern uint64_t vm_superpage_promoted_count;
+extern uint32_t vm_superpage_promoted_ranges(vm_map_t map);
+
+SYSCTL_INT(_vm, OID_AUTO, transparent_superpages, CTLFLAG_RW | CTLFLAG_LOCKED, &vm_transparent_superpages, 0,
+    "Promote populated anonymous ranges to superpages in the background");
+SYSCTL_UINT(_vm, OID_AUTO, superpage_scan_interval_ms, CTLFLAG_RW | CTLFLAG_LOCKED, &vm_superpage_scan_interval_ms, 0, "");
+SYSCTL_UINT(_vm, OID_AUTO, superpage_scan_max_promotions, CTLFLAG_RW | CTLFLAG_LOCKED, &vm_superpage_scan_max_promotions, 0, "");
+SYSCTL_QUAD(_vm, OID_AUTO, superpage_promotions, CTLFLAG_RD | CTLFLAG_LOCKED, &vm_superpage_promotions, "");
+SYSCTL_QUAD(_vm, OID_AUTO, superpage_splits, CTLFLAG_RD | CTLFLAG_LOCKED, &vm_superpage_splits, "");
+SYSCTL_QUAD(_vm, OID_AUTO, superpage_promotion_failures, CTLFLAG_RD | CTLFLAG_LOCKED, &vm_superpage_promotion_failures, "");
+SYSCTL_QUAD(_vm, OID_AUTO, superpage_promoted_count, CTLFLAG_RD | CTLFLAG_LOCKED, &vm_superpage_promoted_count, "");
+
+static int
+sysctl_vm_self_superpage_promoted SYSCTL_HANDLER_ARGS
+{
+#pragma unused(arg1, arg2, oidp)
+	uint32_t value;
+
+	value = vm_superpage_promoted_ranges(current_map());
+	return SYSCTL_OUT(req, &value, sizeof(value));
+}
+SYSCTL_PROC(_vm, OID_AUTO, self_superpage_promoted, CTLTYPE_INT | CTLFLAG_RD | CTLFLAG_ANYBODY | CTLFLAG_LOCKED, 0, 0,
+    &sysctl_vm_self_superpage_promoted, "IU", "Promoted ranges in place in the calling process");
+#endif /* CONFIG_TRANSPARENT_SUPERPAGES */
+
+#pragma mark Launch Traces
+
+extern int vm_launch_trace_enabled;
+extern uint32_t vm_launch_trace_window_ms;
+extern uint64_t vm_launch_trace_recordings;
+extern uint64_t vm_launch_trace_replays;
+extern uint64_t vm_launch_trace_prefetched;
+extern uint64_t vm_launch_trace_stale;
+
+SYSCTL_INT(_vm, OID_AUTO, launch_trace, CTLFLAG_RW | CTLFLAG_LOCKED, &vm_launch_trace_enabled, 0,
+    "Record the file pages a process faults on after exec, and prefetch them on its next launch");
+SYSCTL_UINT(_vm, OID_AUTO, launch_trace_window_ms, CTLFLAG_RW | CTLFLAG_LOCKED, &vm_launch_trace_window_ms, 0, "");
+SYSCTL_QUAD(_vm, OID_AUTO, launch_trace_recordings, CTLFLAG_RD | CTLFLAG_LOCKED, &vm_launch_trace_recordings, "");
+SYSCTL_QUAD(_vm, OID_AUTO, launch_trace_replays, CTLFLAG_RD | CTLFLAG_LOCKED, &vm_launch_trace_replays, "");
+SYSCTL_QUAD(_vm, OID_AUTO, launch_trace_prefetched, CTLFLAG_RD | CTLFLAG_LOCKED, &vm_launch_trace_prefetched, "");
+SYSCTL_QUAD(_vm, OID_AUTO, launch_trace_stale, CTLFLAG_RD | CTLFLAG_LOCKED, &vm_launch_trace_stale, "");
+
 #include <kern/thread.h>
 #include <sys/user.h>
 
@@ -4015,6 +4167,15 @@ SYSCTL_QUAD(_vm, OID_AUTO, fault_resilient_media_proceed, CTLFLAG_RD | CTLFLAG_L
 SYSCTL_QUAD(_vm, OID_AUTO, fault_resilient_media_release, CTLFLAG_RD | CTLFLAG_LOCKED, &vm_fault_resilient_media_release, "");
 SYSCTL_QUAD(_vm, OID_AUTO, fault_resilient_media_abort1, CTLFLAG_RD | CTLFLAG_LOCKED, &vm_fault_resilient_media_abort1, "");
 SYSCTL_QUAD(_vm, OID_AUTO, fault_resilient_media_abort2, CTLFLAG_RD | CTLFLAG_LOCKED, &vm_fault_resilient_media_abort2, "");
+
+extern unsigned int vm_fault_around_max_pages;
+extern unsigned int vm_fault_around_min_pages;
+extern uint64_t vm_fault_around_faults;
+extern uint64_t vm_fault_around_pages;
+SYSCTL_UINT(_vm, OID_AUTO, fault_around_max_pages, CTLFLAG_RW | CTLFLAG_LOCKED, &vm_fault_around_max_pages, 0, "");
+SYSCTL_UINT(_vm, OID_AUTO, fault_around_min_pages, CTLFLAG_RW | CTLFLAG_LOCKED, &vm_fault_around_min_pages, 0, "");
+SYSCTL_QUAD(_vm, OID_AUTO, fault_around_faults, CTLFLAG_RD | CTLFLAG_LOCKED, &vm_fault_around_faults, "");
+SYSCTL_QUAD(_vm, OID_AUTO, fault_around_pages, CTLFLAG_RD | CTLFLAG_LOCKED, &vm_fault_around_pages, "");
 #if MACH_ASSERT
 extern int vm_fault_resilient_media_inject_error1_rate;
 extern int vm_fault_resilient_media_inject_error1;
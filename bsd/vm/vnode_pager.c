@@ -47,6 +47,7 @@
 #include <sys/kauth.h>
 #include <sys/buf.h>
 #include <sys/uio.h>
+#include <sys/fcntl.h>
 #include <sys/vnode_internal.h>
 #include <sys/namei.h>
 #include <sys/mount_internal.h> /* needs internal due to fhandle_t */
@@ -216,6 +217,55 @@ vnode_pager_get_cs_blobs(
 	return KERN_SUCCESS;
 }
 
+uint32_t
+vnode_pager_get_vid(struct vnode *vp)
+{
+	return vnode_vid(vp);
+}
+
+/*
+ * Keep "vp" from being freed or reused, without keeping its file system
+ * from being unmounted: an O_EVTONLY use count doesn't make vflush() fail,
+ * and a vnode reclaimed under it gets a new vid.  "vp" must be in use.
+ */
+kern_return_t
+vnode_pager_ref_vnode(struct vnode *vp)
+{
+	return vnode_ref_ext(vp, O_EVTONLY, 0) == 0 ? KERN_SUCCESS : KERN_FAILURE;
+}
+
+void
+vnode_pager_rele_vnode(struct vnode *vp)
+{
+	vnode_rele_ext(vp, O_EVTONLY, 0);
+}
+
+/*
+ * Start reading [offset, offset + size) of "vp" into the UBC
+ * asynchronously, if "vp" still is the file it was when "vid" was taken.
+ * "vp" must be referenced (vnode_pager_ref_vnode()).
+ */
+kern_return_t
+vnode_pager_prefetch(
+	struct vnode            *vp,
+	uint32_t                vid,
+	vm_object_offset_t      offset,
+	vm_object_size_t        size)
+{
+	off_t filesize;
+
+	if (vnode_getwithvid(vp, vid) != 0) {
+		return KERN_FAILURE;
+	}
+	filesize = ubc_getsize(vp);
+	if ((off_t)offset < filesize) {
+		(void)advisory_read(vp, filesize, (off_t)offset,
+		    (int)MIN(size, (vm_object_size_t)(filesize - (off_t)offset)));
+	}
+	vnode_put(vp);
+	return KERN_SUCCESS;
+}
+
 /*
  * vnode_trim:
  * Used to call the DKIOCUNMAP ioctl on the underlying disk device for the specified vnode.
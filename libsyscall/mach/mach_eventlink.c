@@ -33,6 +33,9 @@
 #include <mach/mach_types.h>
 #include <mach/clock_types.h>
 #include <mach/mach_eventlink_types.h>
+#include <os/atomic_private.h>
+#include <stddef.h>
+#include <strings.h>
 
 /*
  * __mach_eventlink* calls are bsd syscalls instead of mach traps because
@@ -103,3 +106,169 @@ mach_eventlink_signal_wait_until(
 	*wait_count_ptr = decode_eventlink_count_from_retval(retval);
 	return decode_eventlink_error_from_retval(retval);
 }
+
+_Static_assert(offsetof(struct mach_eventlink_ring, mer_head) ==
+    MACH_EVENTLINK_RING_CLINE_SIZE,
+    "the consumer half of the ring header starts a cache line");
+_Static_assert(sizeof(struct mach_eventlink_ring) ==
+    2 * MACH_EVENTLINK_RING_CLINE_SIZE,
+    "the ring slots start a cache line");
+
+/*
+ * The geometry always comes from the handle: the ring header is shared
+ * with the other side, so indices read from it are only ever masked.
+ */
+static inline void *
+mach_eventlink_ring_slot(
+	const mach_eventlink_ring_handle_t   *handle,
+	uint32_t                             index)
+{
+	return (char *)(handle->merh_ring + 1) +
+	       (size_t)(index & (handle->merh_entries - 1)) * handle->merh_msg_size;
+}
+
+/*
+ * Wait for the other side to move the index at `idx` away from `value`,
+ * after announcing it in `waiting`, so that it knows to signal us.
+ */
+static kern_return_t
+mach_eventlink_ring_wait(
+	mach_port_t                          eventlink_port,
+	uint32_t                             *idx,
+	uint32_t                             value,
+	uint32_t                             *waiting,
+	uint64_t                             *count,
+	uint64_t                             deadline)
+{
+	kern_return_t kr;
+
+	os_atomic_store(waiting, 1, relaxed);
+	/* pairs with the fence in mach_eventlink_ring_wakeup() */
+	os_atomic_thread_fence(seq_cst);
+	if (os_atomic_load(idx, relaxed) != value) {
+		os_atomic_store(waiting, 0, relaxed);
+		return KERN_SUCCESS;
+	}
+
+	kr = mach_eventlink_wait_until(eventlink_port, count, MELSW_OPTION_NONE,
+	    KERN_CLOCK_MACH_ABSOLUTE_TIME, deadline);
+	os_atomic_store(waiting, 0, relaxed);
+	return kr;
+}
+
+/*
+ * Signal the other side if it announced that it is about to wait
+ * for the index we just moved.
+ */
+static kern_return_t
+mach_eventlink_ring_wakeup(
+	mach_port_t                          eventlink_port,
+	uint32_t                             *waiting)
+{
+	os_atomic_thread_fence(seq_cst);
+	if (os_atomic_load(waiting, relaxed) &&
+	    os_atomic_xchg(waiting, 0, relaxed)) {
+		return mach_eventlink_signal(eventlink_port, 0);
+	}
+	return KERN_SUCCESS;
+}
+
+kern_return_t
+mach_eventlink_ring_attach(
+	mach_eventlink_ring_handle_t         *handle,
+	struct mach_eventlink_ring           *ring,
+	uint32_t                             entries,
+	uint32_t                             msg_size)
+{
+	if (handle == NULL || ring == NULL ||
+	    entries == 0 || (entries & (entries - 1)) ||
+	    entries > MACH_EVENTLINK_RING_MAX_ENTRIES ||
+	    msg_size == 0 || msg_size > MACH_EVENTLINK_RING_MAX_MSG_SIZE) {
+		return KERN_INVALID_ARGUMENT;
+	}
+
+	handle->merh_ring = ring;
+	handle->merh_entries = entries;
+	handle->merh_msg_size = msg_size;
+	return KERN_SUCCESS;
+}
+
+kern_return_t
+mach_eventlink_ring_init(
+	mach_eventlink_ring_handle_t         *handle,
+	struct mach_eventlink_ring           *ring,
+	uint32_t                             entries,
+	uint32_t                             msg_size)
+{
+	kern_return_t kr;
+
+	kr = mach_eventlink_ring_attach(handle, ring, entries, msg_size);
+	if (kr == KERN_SUCCESS) {
+		bzero(ring, sizeof(*ring));
+	}
+	return kr;
+}
+
+kern_return_t
+mach_eventlink_ring_send(
+	const mach_eventlink_ring_handle_t   *handle,
+	mach_port_t                          eventlink_port,
+	const void                           *msg,
+	mach_eventlink_signal_wait_option_t  option,
+	uint64_t                             deadline)
+{
+	struct mach_eventlink_ring *ring = handle->merh_ring;
+	uint32_t tail = ring->mer_tail;
+	uint32_t head;
+	kern_return_t kr;
+
+	while (tail - (head = os_atomic_load(&ring->mer_head, acquire)) >=
+	    handle->merh_entries) {
+		if (option & MELSW_OPTION_NO_WAIT) {
+			return KERN_OPERATION_TIMED_OUT;
+		}
+		kr = mach_eventlink_ring_wait(eventlink_port, &ring->mer_head,
+		    head, &ring->mer_producer_waiting, &ring->mer_producer_count,
+		    deadline);
+		if (kr != KERN_SUCCESS) {
+			return kr;
+		}
+	}
+
+	memmove(mach_eventlink_ring_slot(handle, tail), msg, handle->merh_msg_size);
+	os_atomic_store(&ring->mer_tail, tail + 1, release);
+
+	return mach_eventlink_ring_wakeup(eventlink_port,
+	           &ring->mer_consumer_waiting);
+}
+
+kern_return_t
+mach_eventlink_ring_receive(
+	const mach_eventlink_ring_handle_t   *handle,
+	mach_port_t                          eventlink_port,
+	void                                 *msg,
+	mach_eventlink_signal_wait_option_t  option,
+	uint64_t                             deadline)
+{
+	struct mach_eventlink_ring *ring = handle->merh_ring;
+	uint32_t head = ring->mer_head;
+	kern_return_t kr;
+
+	while (os_atomic_load(&ring->mer_tail, acquire) == head) {
+		if (option & MELSW_OPTION_NO_WAIT) {
+			return KERN_OPERATION_TIMED_OUT;
+		}
+		kr = mach_eventlink_ring_wait(eventlink_port, &ring->mer_tail,
+		    head, &ring->mer_consumer_waiting, &ring->mer_consumer_count,
+		    deadline);
+		if (kr != KERN_SUCCESS) {
+			return kr;
+		}
+	}
+
+	memmove(msg, mach_eventlink_ring_slot(handle, head), handle->merh_msg_size);
+	os_atomic_store(&ring->mer_head, head + 1, release);
+
+	return mach_eventlink_ring_wakeup(eventlink_port,
+	           &ring->mer_producer_waiting);
+}
@@ -78,7 +78,8 @@
 #include <string.h>
 #include <sys/kdebug.h>
 
-KALLOC_ARRAY_TYPE_DEFINE(ipc_entry_table, struct ipc_entry, KT_PRIV_ACCT);
+KALLOC_ARRAY_TYPE_DEFINE(ipc_entry_chunk, struct ipc_entry, KT_PRIV_ACCT);
+KALLOC_ARRAY_TYPE_DEFINE(ipc_hash_table, struct ipc_hash_slot, KT_PRIV_ACCT);
 
 /*
  *	Routine: ipc_entry_table_count_max
@@ -91,7 +92,93 @@ KALLOC_ARRAY_TYPE_DEFINE(ipc_entry_table, struct ipc_entry, KT_PRIV_ACCT);
 unsigned int
 ipc_entry_table_count_max(void)
 {
-	return ipc_entry_table_size_to_count(CONFIG_IPC_TABLE_ENTRIES_SIZE_MAX);
+	/* every entry can use a slot of the reverse hash table too */
+	uint32_t count = CONFIG_IPC_TABLE_ENTRIES_SIZE_MAX /
+	    (sizeof(struct ipc_entry) + sizeof(struct ipc_hash_slot));
+
+	return count & ~IPC_ENTRY_CHUNK_MASK;
+}
+
+static ipc_entry_table_t
+ipc_entry_table_alloc_dir(uint32_t capacity)
+{
+	ipc_entry_table_t table;
+
+	table = kalloc_type(struct ipc_entry_table, ipc_entry_chunk_t,
+	    capacity, Z_WAITOK | Z_ZERO);
+	if (table) {
+		table->iet_capacity = capacity;
+	}
+	return table;
+}
+
+static void
+ipc_entry_table_free_dir(ipc_entry_table_t table)
+{
+	kfree_type(struct ipc_entry_table, ipc_entry_chunk_t,
+	    table->iet_capacity, table);
+}
+
+/*
+ *	Routine:	ipc_entry_table_alloc
+ *	Purpose:
+ *		Allocates a table with a single chunk
+ *		of at least `count` zeroed entries.
+ *	Conditions:
+ *		Nothing locked.  Allocates memory.
+ */
+ipc_entry_table_t
+ipc_entry_table_alloc(
+	ipc_entry_num_t         count)
+{
+	ipc_entry_table_t table;
+
+	assert(count <= IPC_ENTRY_CHUNK_COUNT);
+
+	table = kalloc_type(struct ipc_entry_table, ipc_entry_chunk_t, 1,
+	    Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	table->iet_capacity = 1;
+	table->iet_chunks[0] = ipc_entry_chunk_alloc_by_count(count,
+	    Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	table->iet_nchunks = 1;
+	return table;
+}
+
+static void
+ipc_entry_table_free_smr(smr_node_t node)
+{
+	ipc_entry_table_t table;
+
+	table = __container_of(node, struct ipc_entry_table, iet_smr_node);
+	for (uint32_t i = 0; i < table->iet_retired; i++) {
+		ipc_entry_chunk_free_noclear(table->iet_chunks[i]);
+	}
+	ipc_entry_table_free_dir(table);
+}
+
+/*
+ *	Routine:	ipc_entry_table_retire
+ *	Purpose:
+ *		Frees a table that has been replaced or unpublished,
+ *		along with its first `nchunks` chunks (the ones
+ *		no other table refers to), once lockless lookups
+ *		that could still observe them are done.
+ *	Conditions:
+ *		Nothing locked.
+ */
+void
+ipc_entry_table_retire(
+	ipc_entry_table_t       table,
+	uint32_t                nchunks)
+{
+	vm_size_t size = sizeof(*table) +
+	    table->iet_capacity * sizeof(ipc_entry_chunk_t);
+
+	for (uint32_t i = 0; i < nchunks; i++) {
+		size += ipc_entry_chunk_size(table->iet_chunks[i]);
+	}
+	table->iet_retired = nchunks;
+	smr_ipc_call(&table->iet_smr_node, size, ipc_entry_table_free_smr);
 }
 
 /*
@@ -162,7 +249,7 @@ ipc_entries_hold(
 		return KERN_NO_SPACE;
 	}
 
-	entry = ipc_entry_table_base(table);
+	entry = ipc_entry_table_get_nocheck(table, 0);
 
 	for (i = 0; i < entries_needed; i++) {
 		next_free = entry->ie_next;
@@ -208,7 +295,7 @@ ipc_entry_claim(
 	mach_port_name_t new_name;
 
 	table = is_active_table(space);
-	base  = ipc_entry_table_base(table);
+	base  = ipc_entry_table_get_nocheck(table, 0);
 
 	first_free = base->ie_next;
 	assert(first_free != 0);
@@ -389,7 +476,7 @@ ipc_entry_alloc_name(
 			 */
 
 			prev_index = 0;
-			prev_entry = ipc_entry_table_base(table);
+			prev_entry = ipc_entry_table_get_nocheck(table, 0);
 			while (prev_entry->ie_next != index) {
 				prev_index = prev_entry->ie_next;
 				prev_entry = ipc_entry_table_get(table, prev_index);
@@ -406,12 +493,9 @@ ipc_entry_alloc_name(
 			 *	reconstructing the name.
 			 *
 			 *	Do not do so for the first entry, which is
-			 *	reserved and ipc_entry_grow_table() will handle
-			 *	its ie_next separately after the rescan loop.
+			 *	reserved.
 			 */
 			if (prev_index > 0) {
-				/*
-				 */
 				ipc_entry_modified(space,
 				    MACH_PORT_MAKE(prev_index,
 				    IE_BITS_GEN(prev_entry->ie_bits)),
@@ -471,7 +555,7 @@ ipc_entry_dealloc(
 
 	index = MACH_PORT_INDEX(name);
 	table = is_active_table(space);
-	base  = ipc_entry_table_base(table);
+	base  = ipc_entry_table_get_nocheck(table, 0);
 
 	assert(index > 0 && entry == ipc_entry_table_get(table, index));
 
@@ -501,22 +585,8 @@ ipc_entry_modified(
 	mach_port_name_t        name,
 	__assert_only ipc_entry_t entry)
 {
-	ipc_entry_table_t table;
-	mach_port_index_t index;
-
-	index = MACH_PORT_INDEX(name);
-	table = is_active_table(space);
-
-	assert(entry == ipc_entry_table_get(table, index));
-	assert(space->is_low_mod <= ipc_entry_table_count(table));
-	assert(space->is_high_mod < ipc_entry_table_count(table));
-
-	if (index < space->is_low_mod) {
-		space->is_low_mod = index;
-	}
-	if (index > space->is_high_mod) {
-		space->is_high_mod = index;
-	}
+	assert(entry == ipc_entry_table_get(is_active_table(space),
+	    MACH_PORT_INDEX(name)));
 
 	KERNEL_DEBUG_CONSTANT(
 		MACHDBG_CODE(DBG_MACH_IPC, MACH_IPC_PORT_ENTRY_MODIFY) | DBG_FUNC_NONE,
@@ -530,12 +600,8 @@ ipc_entry_modified(
 #define IPC_ENTRY_GROW_STATS 1
 #if IPC_ENTRY_GROW_STATS
 static uint64_t ipc_entry_grow_count = 0;
-static uint64_t ipc_entry_grow_rescan = 0;
-static uint64_t ipc_entry_grow_rescan_max = 0;
-static uint64_t ipc_entry_grow_rescan_entries = 0;
-static uint64_t ipc_entry_grow_rescan_entries_max = 0;
-static uint64_t ipc_entry_grow_freelist_entries = 0;
-static uint64_t ipc_entry_grow_freelist_entries_max = 0;
+static uint64_t ipc_entry_grow_chunks = 0;
+static uint64_t ipc_entry_grow_hash_resizes = 0;
 #endif
 
 static inline void
@@ -554,10 +620,55 @@ ipc_space_done_growing_and_unlock(ipc_space_t space)
 	wakeup_all_with_inheritor((event_t)space, THREAD_AWAKENED);
 }
 
+/*
+ *	Routine:	ipc_entry_grow_abort
+ *	Purpose:
+ *		Frees what ipc_entry_grow_table() allocated
+ *		and didn't publish.
+ *	Conditions:
+ *		Nothing locked, the caller is still the grower.
+ */
+
+static void
+ipc_entry_grow_abort(
+	ipc_entry_table_t       otable,
+	ipc_entry_table_t       ntable,
+	ipc_entry_chunk_t       nchunk0,
+	uint32_t                onchunks,
+	uint32_t                nnchunks,
+	struct ipc_hash_rehash  *ihr)
+{
+	if (nchunk0) {
+		ipc_entry_chunk_free(&nchunk0);
+	}
+	if (ntable) {
+		for (uint32_t i = onchunks; i < nnchunks; i++) {
+			if (ntable->iet_chunks[i]) {
+				ipc_entry_chunk_free(&ntable->iet_chunks[i]);
+			}
+		}
+		if (ntable != otable) {
+			ipc_entry_table_free_dir(ntable);
+		}
+	}
+	ipc_hash_rehash_free(ihr);
+}
+
 /*
  *	Routine:	ipc_entry_grow_table
  *	Purpose:
  *		Grows the table in a space.
+ *
+ *		A table smaller than a chunk is reallocated,
+ *		and its entries are copied with the space locked,
+ *		which is cheap at that size.  Larger tables grow
+ *		by publishing new chunks: existing entries never
+ *		move, and are never copied.
+ *
+ *		The reverse hash table is doubled whenever the table
+ *		outgrows it.  The bigger one is filled with the space
+ *		unlocked, and only the entries that were hashed or
+ *		unhashed meanwhile are redone with the space locked.
  *	Conditions:
  *		The space must be write-locked and active before.
  *		If successful, the space is also returned locked.
@@ -576,16 +687,13 @@ ipc_entry_grow_table(
 	ipc_space_t             space,
 	ipc_table_elems_t       target_count)
 {
-	ipc_entry_num_t osize, nsize;
-	ipc_entry_num_t ocount, ncount;
-	ipc_entry_table_t otable, ntable;
-	ipc_entry_t obase, nbase;
-	mach_port_index_t free_index;
-	mach_port_index_t low_mod, hi_mod;
-	ipc_table_index_t sanity;
-#if IPC_ENTRY_GROW_STATS
-	uint64_t rescan_count = 0;
-#endif
+	ipc_entry_num_t ocount, ncount, hcount;
+	ipc_entry_table_t otable, ntable = NULL;
+	ipc_entry_chunk_t ochunk0, nchunk0 = NULL;
+	struct ipc_hash_rehash ihr = { };
+	uint32_t onchunks, nnchunks;
+	mach_port_index_t last_free;
+	ipc_entry_t base;
 
 	if (is_growing(space)) {
 		/*
@@ -596,198 +704,184 @@ ipc_entry_grow_table(
 		return KERN_SUCCESS;
 	}
 
-	otable = is_active_table(space);
-	obase  = ipc_entry_table_base(otable);
-	osize  = ipc_entry_table_size(otable);
-	ocount = ipc_entry_table_size_to_count(osize);
+	otable   = is_active_table(space);
+	ocount   = ipc_entry_table_count(otable);
+	onchunks = otable->iet_nchunks;
+	ochunk0  = otable->iet_chunks[0];
 
 	if (target_count == ITS_SIZE_NONE) {
-		nsize = ipc_entry_table_next_size(IPC_ENTRY_TABLE_MIN, osize,
-		    IPC_ENTRY_TABLE_PERIOD);
+		if (ocount < IPC_ENTRY_CHUNK_COUNT) {
+			ncount = 2 * ocount;
+		} else {
+			ncount = ocount + IPC_ENTRY_CHUNK_COUNT;
+		}
 	} else if (target_count <= ocount) {
 		return KERN_SUCCESS;
 	} else if (target_count > ipc_entry_table_count_max()) {
 		goto no_space;
 	} else {
-		uint32_t tsize = ipc_entry_table_count_to_size(target_count);
-
-		nsize = ipc_entry_table_next_size(IPC_ENTRY_TABLE_MIN, tsize,
-		    IPC_ENTRY_TABLE_PERIOD);
+		ncount = target_count;
+	}
+	if (ncount > IPC_ENTRY_CHUNK_COUNT) {
+		ncount = (ncount + IPC_ENTRY_CHUNK_MASK) & ~IPC_ENTRY_CHUNK_MASK;
 	}
-	if (nsize > CONFIG_IPC_TABLE_ENTRIES_SIZE_MAX) {
-		nsize = CONFIG_IPC_TABLE_ENTRIES_SIZE_MAX;
+	if (ncount > ipc_entry_table_count_max()) {
+		ncount = ipc_entry_table_count_max();
 	}
-	if (osize == nsize) {
+	if (ncount <= ocount) {
 		goto no_space;
 	}
-
+	if (ncount > IPC_ENTRY_CHUNK_COUNT) {
+		nnchunks = ncount >> IPC_ENTRY_CHUNK_SHIFT;
+	} else {
+		nnchunks = 1;
+	}
 
 	/*
 	 * We'll attempt to grow the table.
 	 *
-	 * Because we will be copying without the space lock, reset
-	 * the lowest_mod index to just beyond the end of the current
-	 * table.  Modification of entries (other than hashes) will
-	 * bump this downward, and we only have to reprocess entries
-	 * above that mark.  Eventually, we'll get done.
+	 * Only the grower changes the chunks of the table
+	 * or the reverse hash table, so they can be looked at
+	 * while the space is unlocked.  Entries can change
+	 * concurrently, but the only ones we copy are those
+	 * of a first chunk that is being reallocated,
+	 * and that is done after relocking the space.
 	 */
 	ipc_space_start_growing(space);
-	space->is_low_mod = ocount;
-	space->is_high_mod = 0;
 #if IPC_ENTRY_GROW_STATS
 	ipc_entry_grow_count++;
 #endif
 	is_write_unlock(space);
 
-	ntable = ipc_entry_table_alloc_by_size(nsize, Z_WAITOK | Z_ZERO);
-	if (ntable == NULL) {
-		is_write_lock(space);
-		ipc_space_done_growing_and_unlock(space);
-		return KERN_RESOURCE_SHORTAGE;
-	}
-
-	nbase  = ipc_entry_table_base(ntable);
-	nsize  = ipc_entry_table_size(ntable);
-	ncount = ipc_entry_table_count(ntable);
-	ipc_space_rand_freelist(space, nbase, ocount, ncount);
-
-	low_mod = 1;
-	hi_mod = ocount - 1;
-rescan:
-	/*
-	 * Within the range of the table that changed, determine what we
-	 * have to take action on. For each entry, take a snapshot of the
-	 * corresponding entry in the old table (so it won't change
-	 * during this iteration). The snapshot may not be self-consistent
-	 * (if we caught it in the middle of being changed), so be very
-	 * cautious with the values.
-	 */
-	assert(low_mod > 0);
-	for (mach_port_index_t i = MAX(1, low_mod); i <= hi_mod; i++) {
-		ipc_entry_t entry = &nbase[i];
-		ipc_object_t osnap_object = obase[i].ie_object;
-		ipc_entry_bits_t osnap_bits = obase[i].ie_bits;
-		ipc_entry_bits_t osnap_request = obase[i].ie_request;
-
-		/*
-		 * We need to make sure the osnap_* fields are never reloaded.
-		 */
-		os_compiler_barrier();
-
-		if (entry->ie_object != osnap_object ||
-		    IE_BITS_TYPE(entry->ie_bits) != IE_BITS_TYPE(osnap_bits)) {
-			if (entry->ie_object != IO_NULL &&
-			    IE_BITS_TYPE(entry->ie_bits) == MACH_PORT_TYPE_SEND) {
-				ipc_hash_table_delete(ntable, entry->ie_object, i, entry);
-			}
-
-			entry->ie_object = osnap_object;
-			entry->ie_bits = osnap_bits;
-			entry->ie_request = osnap_request; /* or ie_next */
-
-			if (osnap_object != IO_NULL &&
-			    IE_BITS_TYPE(osnap_bits) == MACH_PORT_TYPE_SEND) {
-				ipc_hash_table_insert(ntable, osnap_object, i, entry);
-			}
-		} else {
-			entry->ie_bits = osnap_bits;
-			entry->ie_request = osnap_request; /* or ie_next */
+	if (ocount < IPC_ENTRY_CHUNK_COUNT) {
+		nchunk0 = ipc_entry_chunk_alloc_by_count(
+			MIN(ncount, IPC_ENTRY_CHUNK_COUNT), Z_WAITOK | Z_ZERO);
+		if (nchunk0 == NULL) {
+			goto shortage;
 		}
+		if (nnchunks == 1) {
+			ncount = ipc_entry_chunk_count(nchunk0);
+		}
+		assert(ipc_entry_chunk_count(nchunk0) <= IPC_ENTRY_CHUNK_COUNT);
 	}
-	nbase[0].ie_next = obase[0].ie_next;  /* always rebase the freelist */
 
-	/*
-	 * find the end of the freelist (should be short). But be careful,
-	 * the list items can change so only follow through truly free entries
-	 * (no problem stopping short in those cases, because we'll rescan).
-	 */
-	free_index = 0;
-	for (sanity = 0; sanity < ocount; sanity++) {
-		if (nbase[free_index].ie_object != IPC_OBJECT_NULL) {
-			break;
+	if (nchunk0 || nnchunks > otable->iet_capacity) {
+		ntable = ipc_entry_table_alloc_dir(
+			MAX(nnchunks, 2 * otable->iet_capacity));
+		if (ntable == NULL) {
+			goto shortage;
 		}
-		mach_port_index_t i = nbase[free_index].ie_next;
-		if (i == 0 || i >= ocount) {
-			break;
+		for (uint32_t i = 0; i < onchunks; i++) {
+			ntable->iet_chunks[i] = otable->iet_chunks[i];
 		}
-		free_index = i;
+		if (nchunk0) {
+			ntable->iet_chunks[0] = nchunk0;
+		}
+	} else {
+		/* unpublished chunk slots are never looked at */
+		ntable = otable;
 	}
+
+	for (uint32_t i = onchunks; i < nnchunks; i++) {
+		ntable->iet_chunks[i] = ipc_entry_chunk_alloc_by_count(
+			IPC_ENTRY_CHUNK_COUNT, Z_WAITOK | Z_ZERO);
+		if (ntable->iet_chunks[i] == NULL) {
+			goto shortage;
+		}
 #if IPC_ENTRY_GROW_STATS
-	ipc_entry_grow_freelist_entries += sanity;
-	if (sanity > ipc_entry_grow_freelist_entries_max) {
-		ipc_entry_grow_freelist_entries_max = sanity;
-	}
+		ipc_entry_grow_chunks++;
 #endif
+	}
 
-	is_write_lock(space);
-
-	/*
-	 *	We need to do a wakeup on the space,
-	 *	to rouse waiting threads.  We defer
-	 *	this until the space is unlocked,
-	 *	because we don't want them to spin.
-	 */
-
-	if (!is_active(space)) {
-		/*
-		 *	The space died while it was unlocked.
-		 */
+	hcount = ipc_hash_table_count(space->is_hash);
+	if (hcount < ncount) {
+		/* the hash counts against ipc_entry_table_count_max() too */
+		hcount = MAX(ncount, MIN(2 * hcount, ipc_entry_table_count_max()));
+		if (!ipc_hash_rehash_alloc(&ihr, hcount, ocount)) {
+			goto shortage;
+		}
+#if IPC_ENTRY_GROW_STATS
+		ipc_entry_grow_hash_resizes++;
+#endif
 
-		ipc_space_done_growing_and_unlock(space);
-		ipc_entry_table_free(&ntable);
 		is_write_lock(space);
-		return KERN_SUCCESS;
+		if (!is_active(space)) {
+			goto died;
+		}
+		ipc_hash_rehash_start(space, &ihr);
+		is_write_unlock(space);
+
+		ipc_hash_rehash_fill(&ihr, otable);
 	}
 
-	/* If the space changed while unlocked, go back and process the changes */
-	if (space->is_low_mod < ocount) {
-		assert(space->is_high_mod > 0);
-		low_mod = space->is_low_mod;
-		space->is_low_mod = ocount;
-		hi_mod = space->is_high_mod;
-		space->is_high_mod = 0;
-		is_write_unlock(space);
+	last_free = ipc_space_rand_freelist(space, ntable, ocount, ncount);
 
-		if (hi_mod >= ocount) {
-			panic("corrupt hi_mod: %d, obase: %p, ocount: %d\n",
-			    hi_mod, obase, ocount);
-		}
+	is_write_lock(space);
 
-#if IPC_ENTRY_GROW_STATS
-		rescan_count++;
-		if (rescan_count > ipc_entry_grow_rescan_max) {
-			ipc_entry_grow_rescan_max = rescan_count;
-		}
+	if (!is_active(space)) {
+		goto died;
+	}
 
-		ipc_entry_grow_rescan++;
-		ipc_entry_grow_rescan_entries += hi_mod - low_mod + 1;
-		if (hi_mod - low_mod + 1 > ipc_entry_grow_rescan_entries_max) {
-			ipc_entry_grow_rescan_entries_max = hi_mod - low_mod + 1;
+	if (nchunk0) {
+		for (mach_port_index_t i = 0; i < ocount; i++) {
+			ipc_entry_t oentry = ipc_entry_chunk_get_nocheck(ochunk0, i);
+			ipc_entry_t nentry = ipc_entry_chunk_get_nocheck(nchunk0, i);
+
+			nentry->ie_object  = oentry->ie_object;
+			nentry->ie_bits    = oentry->ie_bits;
+			nentry->ie_request = oentry->ie_request; /* or ie_next */
 		}
-#endif
-		goto rescan;
 	}
 
-	/* link new free entries onto the rest of the freelist */
-	assert(nbase[free_index].ie_next == 0 &&
-	    nbase[free_index].ie_object == IO_NULL);
-	nbase[free_index].ie_next = ocount;
+	/* put the new entries at the head of the freelist */
+	base = ipc_entry_table_get_nocheck(ntable, 0);
+	ipc_entry_table_get_nocheck(ntable, last_free)->ie_next = base->ie_next;
+	base->ie_next = ocount;
+	space->is_table_free += ncount - ocount;
 
-	assert(smr_serialized_load(&space->is_table) == otable);
+	if (ntable != otable) {
+		ntable->iet_nchunks = nnchunks;
+		smr_serialized_store(&space->is_table, ntable);
+	} else {
+		os_atomic_store(&otable->iet_nchunks, nnchunks, release);
+	}
 
-	space->is_table_free += ncount - ocount;
-	smr_serialized_store(&space->is_table, ntable);
+	if (ihr.ihr_hash) {
+		ipc_hash_rehash_finish(space, &ihr);
+	}
 
 	ipc_space_done_growing_and_unlock(space);
 
 	/*
-	 *	Now we need to free the old table.
+	 *	Now we need to free the old table,
+	 *	and its first chunk if it was reallocated.
 	 */
-	ipc_space_retire_table(otable);
+	if (ntable != otable) {
+		ipc_entry_table_retire(otable, nchunk0 ? 1 : 0);
+	}
+	ipc_hash_rehash_free(&ihr);
 	is_write_lock(space);
 
 	return KERN_SUCCESS;
 
+died:
+	/*
+	 *	The space died while it was unlocked.
+	 */
+	space->is_hash_dirty = NULL;
+	is_write_unlock(space);
+	ipc_entry_grow_abort(otable, ntable, nchunk0, onchunks, nnchunks, &ihr);
+	is_write_lock(space);
+	ipc_space_done_growing_and_unlock(space);
+	is_write_lock(space);
+	return KERN_SUCCESS;
+
+shortage:
+	ipc_entry_grow_abort(otable, ntable, nchunk0, onchunks, nnchunks, &ihr);
+	is_write_lock(space);
+	ipc_space_done_growing_and_unlock(space);
+	return KERN_RESOURCE_SHORTAGE;
+
 no_space:
 	ipc_space_set_at_max_limit(space);
 	is_write_unlock(space);
@@ -74,6 +74,7 @@
 #include <kern/kern_types.h>
 #include <kern/kalloc.h>
 #include <kern/smr_types.h>
+#include <os/atomic_private.h>
 
 #include <ipc/ipc_types.h>
 
@@ -82,14 +83,12 @@
  *	Each ipc_entry_t records a capability.  Most capabilities have
  *	small names, and the entries are elements of a table.
  *
- *	The ie_index field of entries in the table implements
- *	a ordered hash table with open addressing and linear probing.
- *
- *	The ie_dist field holds the distance to the desired spot,
- *	which is used to implement robin-hood hashing.
- *
- *	This hash table converts (space, object) -> name.
- *	It is used independently of the other fields.
+ *	The table is a directory of chunks of IPC_ENTRY_CHUNK_COUNT
+ *	entries each: the entry for index i is entry
+ *	(i & IPC_ENTRY_CHUNK_MASK) of chunk (i >> IPC_ENTRY_CHUNK_SHIFT).
+ *	Growing a large table publishes new chunks, and never moves
+ *	existing entries.  A small table has a single chunk, which
+ *	is reallocated as the table grows, until it is a full chunk.
  *
  *	Free (unallocated) entries in the table have null ie_object
  *	fields.  The ie_bits field is zero except for IE_BITS_GEN.
@@ -97,6 +96,10 @@
  *
  *	The first entry in the table (index 0) is always free.
  *	It is used as the head of the free list.
+ *
+ *	The (space, object) -> name reverse hash table lives
+ *	next to the table, in an array of ipc_hash_slot (see ipc_hash.c),
+ *	which always has at least as many slots as the table has entries.
  */
 
 #define IPC_ENTRY_DIST_BITS   12
@@ -108,27 +111,77 @@ struct ipc_entry {
 	union {
 		struct ipc_object *XNU_PTRAUTH_SIGNED_PTR("ipc_entry.ie_object") ie_object;
 		struct ipc_object *XNU_PTRAUTH_SIGNED_PTR("ipc_entry.ie_object") volatile ie_volatile_object;
-		struct ipc_entry_table *XNU_PTRAUTH_SIGNED_PTR("ipc_entry.ie_self") ie_self;
 	};
+	ipc_entry_bits_t    ie_bits;
 	union {
-		struct {
-			ipc_entry_bits_t    ie_bits;
-			union {
-				mach_port_index_t ie_next;         /* next in freelist, or...  */
-				ipc_table_index_t ie_request;      /* dead name request notify */
-			};
-
-			/* hash fields */
-			uint32_t            ie_dist;
-			mach_port_index_t   ie_index;
-		};
-		struct smr_node             ie_smr_node;
+		mach_port_index_t ie_next;         /* next in freelist, or...  */
+		ipc_table_index_t ie_request;      /* dead name request notify */
 	};
 };
 
+struct ipc_hash_slot {
+	uint32_t                ihs_dist;       /* distance to the desired slot */
+	mach_port_index_t       ihs_index;      /* index of the entry, or 0 */
+};
+
 #define IPC_ENTRY_TABLE_MIN     32
-#define IPC_ENTRY_TABLE_PERIOD  16
-KALLOC_ARRAY_TYPE_DECL(ipc_entry_table, struct ipc_entry);
+#define IPC_ENTRY_CHUNK_SHIFT   10
+#define IPC_ENTRY_CHUNK_COUNT   (1u << IPC_ENTRY_CHUNK_SHIFT)
+#define IPC_ENTRY_CHUNK_MASK    (IPC_ENTRY_CHUNK_COUNT - 1)
+KALLOC_ARRAY_TYPE_DECL(ipc_entry_chunk, struct ipc_entry);
+KALLOC_ARRAY_TYPE_DECL(ipc_hash_table, struct ipc_hash_slot);
+
+/*
+ *	Chunks are published with a release store of iet_nchunks,
+ *	so that lockless readers (under SMR) that observe an index
+ *	as being in bounds also observe the initialized chunk.
+ */
+struct ipc_entry_table {
+	uint32_t                iet_nchunks;    /* number of published chunks */
+	uint32_t                iet_capacity;   /* number of chunk slots */
+	uint32_t                iet_retired;    /* chunks freed with the table */
+	struct smr_node         iet_smr_node;
+	ipc_entry_chunk_t       iet_chunks[];
+};
+typedef struct ipc_entry_table *ipc_entry_table_t;
+
+static inline ipc_entry_num_t
+ipc_entry_table_count(ipc_entry_table_t table)
+{
+	uint32_t nchunks = os_atomic_load(&table->iet_nchunks, relaxed);
+
+	if (nchunks == 1) {
+		return ipc_entry_chunk_count(table->iet_chunks[0]);
+	}
+	return nchunks << IPC_ENTRY_CHUNK_SHIFT;
+}
+
+static inline bool
+ipc_entry_table_contains(ipc_entry_table_t table, mach_port_index_t index)
+{
+	return index < ipc_entry_table_count(table);
+}
+
+static inline ipc_entry_t
+ipc_entry_table_get_nocheck(ipc_entry_table_t table, mach_port_index_t index)
+{
+	ipc_entry_chunk_t chunk = table->iet_chunks[index >> IPC_ENTRY_CHUNK_SHIFT];
+
+	return ipc_entry_chunk_get_nocheck(chunk, index & IPC_ENTRY_CHUNK_MASK);
+}
+
+static inline ipc_entry_t
+ipc_entry_table_get(ipc_entry_table_t table, mach_port_index_t index)
+{
+	uint32_t nchunks = os_atomic_load(&table->iet_nchunks, acquire);
+	uint32_t cindex  = index >> IPC_ENTRY_CHUNK_SHIFT;
+
+	if (__probable(cindex < nchunks)) {
+		return ipc_entry_chunk_get(table->iet_chunks[cindex],
+		           index & IPC_ENTRY_CHUNK_MASK);
+	}
+	return IE_NULL;
+}
 
 #define IE_REQ_NONE             0               /* no request */
 
@@ -229,6 +282,15 @@ ipc_entry_gen_rolled(
 
 extern unsigned int ipc_entry_table_count_max(void) __pure2;
 
+/* Allocate the table of a new space */
+extern ipc_entry_table_t ipc_entry_table_alloc(
+	ipc_entry_num_t         count);
+
+/* Free a table and its first chunks, once lockless readers are done */
+extern void ipc_entry_table_retire(
+	ipc_entry_table_t       table,
+	uint32_t                nchunks);
+
 /* Search for entry in a space by name */
 extern ipc_entry_t ipc_entry_lookup(
 	ipc_space_t             space,
@@ -89,6 +89,20 @@ void ipc_hash_local_delete(
 	mach_port_index_t       index,
 	ipc_entry_t             entry);
 
+static void ipc_hash_slots_insert(
+	ipc_hash_table_t        hash,
+	uint32_t                hval,
+	mach_port_index_t       index);
+
+static void ipc_hash_slots_delete(
+	ipc_hash_table_t        hash,
+	ipc_entry_table_t       table,
+	const uint32_t          *hvals,
+	uint32_t                hval,
+	mach_port_index_t       index);
+
+#define IH_HASH(obj)    os_hash_kernel_pointer(obj)
+
 /*
  *	Routine:	ipc_hash_lookup
  *	Purpose:
@@ -105,7 +119,8 @@ ipc_hash_lookup(
 	mach_port_name_t        *namep,
 	ipc_entry_t             *entryp)
 {
-	return ipc_hash_table_lookup(is_active_table(space), obj, namep, entryp);
+	return ipc_hash_table_lookup(space->is_hash, is_active_table(space),
+	           obj, namep, entryp);
 }
 
 /*
@@ -128,7 +143,11 @@ ipc_hash_insert(
 
 	index = MACH_PORT_INDEX(name);
 	space->is_table_hashed++;
-	ipc_hash_table_insert(is_active_table(space), obj, index, entry);
+	if (__improbable(space->is_hash_dirty)) {
+		/* a bigger table is being filled, see ipc_hash_rehash_fill() */
+		bitmap_set(space->is_hash_dirty, index);
+	}
+	ipc_hash_table_insert(space->is_hash, obj, index, entry);
 }
 
 /*
@@ -150,13 +169,198 @@ ipc_hash_delete(
 
 	index = MACH_PORT_INDEX(name);
 	space->is_table_hashed--;
-	ipc_hash_table_delete(is_active_table(space), obj, index, entry);
+	if (__improbable(space->is_hash_dirty)) {
+		/* a bigger table is being filled, see ipc_hash_rehash_fill() */
+		bitmap_set(space->is_hash_dirty, index);
+	}
+	ipc_hash_table_delete(space->is_hash, is_active_table(space),
+	    obj, index, entry);
+}
+
+/*
+ *	Routine:	ipc_hash_rehash_alloc
+ *	Purpose:
+ *		Allocates a (zeroed) reverse hash table of hcount slots,
+ *		and what ipc_hash_rehash_fill() needs to fill it from
+ *		the first count entries of the table of a space.
+ *	Conditions:
+ *		Nothing locked.  Allocates memory.
+ *	Returns:
+ *		FALSE if memory couldn't be allocated.
+ */
+
+boolean_t
+ipc_hash_rehash_alloc(
+	struct ipc_hash_rehash  *ihr,
+	ipc_entry_num_t         hcount,
+	ipc_entry_num_t         count)
+{
+	ihr->ihr_hash   = ipc_hash_table_alloc_by_count(hcount, Z_WAITOK | Z_ZERO);
+	ihr->ihr_count  = count;
+	ihr->ihr_dirty  = bitmap_alloc(count);
+	ihr->ihr_filled = bitmap_alloc(count);
+	ihr->ihr_hvals  = kalloc_data(count * sizeof(uint32_t), Z_WAITOK);
+
+	if (ihr->ihr_hash == NULL || ihr->ihr_dirty == NULL ||
+	    ihr->ihr_filled == NULL || ihr->ihr_hvals == NULL) {
+		ipc_hash_rehash_free(ihr);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ *	Routine:	ipc_hash_rehash_free
+ *	Purpose:
+ *		Frees what ipc_hash_rehash_alloc() allocated,
+ *		including the previous hash table of the space
+ *		once ipc_hash_rehash_finish() swapped them.
+ *	Conditions:
+ *		Nothing locked.
+ */
+
+void
+ipc_hash_rehash_free(
+	struct ipc_hash_rehash  *ihr)
+{
+	if (ihr->ihr_hash) {
+		ipc_hash_table_free(&ihr->ihr_hash);
+	}
+	if (ihr->ihr_dirty) {
+		bitmap_free(ihr->ihr_dirty, ihr->ihr_count);
+	}
+	if (ihr->ihr_filled) {
+		bitmap_free(ihr->ihr_filled, ihr->ihr_count);
+	}
+	if (ihr->ihr_hvals) {
+		kfree_data(ihr->ihr_hvals, ihr->ihr_count * sizeof(uint32_t));
+	}
+	*ihr = (struct ipc_hash_rehash){ };
+}
+
+/*
+ *	Routine:	ipc_hash_rehash_start
+ *	Purpose:
+ *		Makes ipc_hash_insert() and ipc_hash_delete() record
+ *		the entries they change, until ipc_hash_rehash_finish().
+ *	Conditions:
+ *		The space must be write-locked and active,
+ *		and the caller must be growing it.
+ */
+
+void
+ipc_hash_rehash_start(
+	ipc_space_t             space,
+	struct ipc_hash_rehash  *ihr)
+{
+	assert(space->is_grower == current_thread());
+	assert(space->is_hash_dirty == NULL);
+	space->is_hash_dirty = ihr->ihr_dirty;
+}
+
+/*
+ *	Routine:	ipc_hash_rehash_fill
+ *	Purpose:
+ *		Inserts the pure send rights of the table
+ *		into the new reverse hash table.
+ *
+ *		Entries are read without the space lock, so those
+ *		that change meanwhile can be seen in any state.
+ *		Changing whether (or with which object) an entry
+ *		is hashed goes through ipc_hash_insert() or
+ *		ipc_hash_delete(), which mark the entry dirty,
+ *		and ipc_hash_rehash_finish() redoes dirty entries:
+ *		the hash value of what was inserted here is kept
+ *		so that it can be found again.
+ *	Conditions:
+ *		Nothing locked, ipc_hash_rehash_start() was called.
+ *		The caller is growing the space, so the table
+ *		doesn't change size.
+ */
+
+void
+ipc_hash_rehash_fill(
+	struct ipc_hash_rehash  *ihr,
+	ipc_entry_table_t       table)
+{
+	assert(ihr->ihr_count <= ipc_entry_table_count(table));
+
+	for (mach_port_index_t i = 1; i < ihr->ihr_count; i++) {
+		ipc_entry_t entry = ipc_entry_table_get_nocheck(table, i);
+		ipc_entry_bits_t bits = os_atomic_load(&entry->ie_bits, relaxed);
+		ipc_object_t obj = entry->ie_volatile_object;
+		uint32_t hval;
+
+		if (IE_BITS_TYPE(bits) != MACH_PORT_TYPE_SEND || obj == IO_NULL) {
+			continue;
+		}
+
+		hval = IH_HASH(obj);
+		ipc_hash_slots_insert(ihr->ihr_hash, hval, i);
+		ihr->ihr_hvals[i] = hval;
+		bitmap_set(ihr->ihr_filled, i);
+	}
+}
+
+/*
+ *	Routine:	ipc_hash_rehash_finish
+ *	Purpose:
+ *		Redoes the entries that were hashed or unhashed
+ *		while ipc_hash_rehash_fill() ran, and makes the new
+ *		reverse hash table the one of the space.
+ *		The previous one is left in ihr for ipc_hash_rehash_free().
+ *
+ *		This only walks the dirty entries (and the bitmap),
+ *		not the whole table.
+ *	Conditions:
+ *		The space must be write-locked and active,
+ *		and its table must already have been grown.
+ */
+
+void
+ipc_hash_rehash_finish(
+	ipc_space_t             space,
+	struct ipc_hash_rehash  *ihr)
+{
+	ipc_entry_table_t table = is_active_table(space);
+	ipc_hash_table_t  hash  = ihr->ihr_hash;
+	int i;
+
+	assert(space->is_hash_dirty == ihr->ihr_dirty);
+	assert(ipc_hash_table_count(hash) >= ipc_entry_table_count(table));
+
+	/*
+	 *	First take out what the fill inserted for dirty entries,
+	 *	while every slot left is one it inserted, whose hash
+	 *	value is in ihr_hvals, then insert them as they are now.
+	 */
+	for (i = bitmap_lsb_first(ihr->ihr_dirty, ihr->ihr_count); i >= 0;
+	    i = bitmap_lsb_next(ihr->ihr_dirty, ihr->ihr_count, (uint)i)) {
+		if (bitmap_test(ihr->ihr_filled, (uint)i)) {
+			ipc_hash_slots_delete(hash, table, ihr->ihr_hvals,
+			    ihr->ihr_hvals[i], (mach_port_index_t)i);
+		}
+	}
+	for (i = bitmap_lsb_first(ihr->ihr_dirty, ihr->ihr_count); i >= 0;
+	    i = bitmap_lsb_next(ihr->ihr_dirty, ihr->ihr_count, (uint)i)) {
+		ipc_entry_t entry = ipc_entry_table_get_nocheck(table, (uint)i);
+
+		if (IE_BITS_TYPE(entry->ie_bits) == MACH_PORT_TYPE_SEND) {
+			ipc_hash_slots_insert(hash, IH_HASH(entry->ie_object),
+			    (mach_port_index_t)i);
+		}
+	}
+
+	space->is_hash_dirty = NULL;
+	ihr->ihr_hash = space->is_hash;
+	space->is_hash = hash;
 }
 
 /*
  *	Each space has a local reverse hash table, which holds
- *	entries from the space's table.  In fact, the hash table
- *	just uses a field (ie_index) in the table itself.
+ *	entries from the space's table.  It is an array of slots
+ *	holding entry indexes, with at least as many slots
+ *	as the table has entries.
  *
  *	The local hash table is an open-addressing hash table,
  *	which means that when a collision occurs, instead of
@@ -168,8 +372,8 @@ ipc_hash_delete(
  *
  *	Because at least one entry in the table (index 0) is always unused,
  *	there will always be room in the reverse hash table.  If a table
- *	with n slots gets completely full, the reverse hash table will
- *	have one giant clump of n-1 slots and one free slot somewhere.
+ *	with n entries gets completely full, the reverse hash table will
+ *	have one giant clump of n-1 slots and at least one free slot.
  *	Because entries are only entered into the reverse table if they
  *	are pure send rights (not receive, send-once, port-set,
  *	or dead-name rights), and free entries of course aren't entered,
@@ -184,26 +388,27 @@ ipc_hash_delete(
  */
 
 #define IH_TABLE_HASH(obj, size)                                \
-	        ((mach_port_index_t)(os_hash_kernel_pointer(obj) % (size)))
+	        ((mach_port_index_t)(IH_HASH(obj) % (size)))
 
 /*
  *	Routine:	ipc_hash_table_lookup
  *	Purpose:
  *		Converts (table, obj) -> (name, entry).
  *	Conditions:
- *		Must have read consistency on the table.
+ *		Must have read consistency on the tables.
  */
 
 boolean_t
 ipc_hash_table_lookup(
-	ipc_entry_table_t       array,
+	ipc_hash_table_t        hash,
+	ipc_entry_table_t       table,
 	ipc_object_t            obj,
 	mach_port_name_t        *namep,
 	ipc_entry_t             *entryp)
 {
 	mach_port_index_t hindex, index, hdist;
-	ipc_entry_t       table = ipc_entry_table_base(array);
-	ipc_entry_num_t   size  = ipc_entry_table_count(array);
+	struct ipc_hash_slot *slots = ipc_hash_table_begin(hash);
+	ipc_entry_num_t   size  = ipc_hash_table_count(hash);
 
 	if (obj == IO_NULL) {
 		return FALSE;
@@ -213,21 +418,21 @@ ipc_hash_table_lookup(
 	hdist  = 0;
 
 	/*
-	 *	Ideally, table[hindex].ie_index is the name we want.
+	 *	Ideally, slots[hindex].ihs_index is the name we want.
 	 *	However, must check ie_object to verify this,
 	 *	because collisions can happen.  In case of a collision,
 	 *	search farther along in the clump.
 	 */
 
-	while ((index = table[hindex].ie_index) != 0) {
-		ipc_entry_t entry = index < size ? &table[index] : IE_NULL;
+	while ((index = slots[hindex].ihs_index) != 0) {
+		ipc_entry_t entry = ipc_entry_table_get(table, index);
 
 		/*
 		 * if our current displacement is strictly larger
 		 * than the current slot one, then insertion would
 		 * have stolen his place so we can't possibly exist.
 		 */
-		if (hdist > table[hindex].ie_dist) {
+		if (hdist > slots[hindex].ihs_dist) {
 			return FALSE;
 		}
 
@@ -235,7 +440,7 @@ ipc_hash_table_lookup(
 		 * If our current displacement is exactly the current
 		 * slot displacement, then it can be a match, let's check.
 		 */
-		if (hdist == table[hindex].ie_dist) {
+		if (hdist == slots[hindex].ihs_dist) {
 			if (entry->ie_object == obj) {
 				*entryp = entry;
 				*namep = MACH_PORT_MAKE(index,
@@ -268,24 +473,41 @@ ipc_hash_table_lookup(
 
 void
 ipc_hash_table_insert(
-	ipc_entry_table_t               array,
+	ipc_hash_table_t                hash,
 	ipc_object_t                    obj,
 	mach_port_index_t               index,
 	__assert_only ipc_entry_t       entry)
+{
+	assert(obj != IO_NULL);
+	assert(entry->ie_object == obj);
+
+	ipc_hash_slots_insert(hash, IH_HASH(obj), index);
+}
+
+/*
+ *	Routine:	ipc_hash_slots_insert
+ *	Purpose:
+ *		Inserts an entry index into the reverse hash table,
+ *		given the hash value of its object.
+ *	Conditions:
+ *		Exclusive access to the hash table.
+ */
+
+static void
+ipc_hash_slots_insert(
+	ipc_hash_table_t                hash,
+	uint32_t                        hval,
+	mach_port_index_t               index)
 {
 	mach_port_index_t hindex, hdist;
-	ipc_entry_t       table = ipc_entry_table_base(array);
-	ipc_entry_num_t   size  = ipc_entry_table_count(array);
+	struct ipc_hash_slot *slots = ipc_hash_table_begin(hash);
+	ipc_entry_num_t   size  = ipc_hash_table_count(hash);
 
 	assert(index != 0);
-	assert(obj != IO_NULL);
 
-	hindex = IH_TABLE_HASH(obj, size);
+	hindex = hval % size;
 	hdist  = 0;
 
-	assert(entry == &table[index]);
-	assert(entry->ie_object == obj);
-
 	/*
 	 *	We want to insert at hindex, but there may be collisions.
 	 *	If a collision occurs, search for the end of the clump
@@ -296,11 +518,11 @@ ipc_hash_table_insert(
 	 *	displaced than we'd be, we steal his slot and
 	 *	keep inserting him in our stead.
 	 */
-	while (table[hindex].ie_index != 0) {
-		if (table[hindex].ie_dist < hdist) {
+	while (slots[hindex].ihs_index != 0) {
+		if (slots[hindex].ihs_dist < hdist) {
 #define swap(a, b)  ({ typeof(a) _tmp = (b); (b) = (a); (a) = _tmp; })
-			swap(hdist, table[hindex].ie_dist);
-			swap(index, table[hindex].ie_index);
+			swap(hdist, slots[hindex].ihs_dist);
+			swap(index, slots[hindex].ihs_index);
 #undef swap
 		}
 		if (hdist < IPC_ENTRY_DIST_MAX) {
@@ -312,8 +534,8 @@ ipc_hash_table_insert(
 		}
 	}
 
-	table[hindex].ie_index = index;
-	table[hindex].ie_dist = hdist;
+	slots[hindex].ihs_index = index;
+	slots[hindex].ihs_dist = hdist;
 }
 
 /*
@@ -326,22 +548,47 @@ ipc_hash_table_insert(
 
 void
 ipc_hash_table_delete(
-	ipc_entry_table_t               array,
+	ipc_hash_table_t                hash,
+	ipc_entry_table_t               table,
 	ipc_object_t                    obj,
 	mach_port_index_t               index,
 	__assert_only ipc_entry_t       entry)
+{
+	assert(obj != IO_NULL);
+	assert(entry == ipc_entry_table_get(table, index));
+	assert(entry->ie_object == obj);
+
+	ipc_hash_slots_delete(hash, table, NULL, IH_HASH(obj), index);
+}
+
+/*
+ *	Routine:	ipc_hash_slots_delete
+ *	Purpose:
+ *		Deletes an entry index from the reverse hash table,
+ *		given the hash value of the object it was inserted with.
+ *
+ *		The hash values of the other indexes are those of the
+ *		objects of their entries in the table, or in hvals
+ *		if it isn't NULL.
+ *	Conditions:
+ *		Exclusive access to the hash table.
+ */
+
+static void
+ipc_hash_slots_delete(
+	ipc_hash_table_t                hash,
+	ipc_entry_table_t               table,
+	const uint32_t                  *hvals,
+	uint32_t                        hval,
+	mach_port_index_t               index)
 {
 	mach_port_index_t hindex, dindex, dist;
-	ipc_entry_t       table = ipc_entry_table_base(array);
-	ipc_entry_num_t   size  = ipc_entry_table_count(array);
+	struct ipc_hash_slot *slots = ipc_hash_table_begin(hash);
+	ipc_entry_num_t   size  = ipc_hash_table_count(hash);
 
 	assert(index != MACH_PORT_NULL);
-	assert(obj != IO_NULL);
 
-	hindex = IH_TABLE_HASH(obj, size);
-
-	assert(entry == &table[index]);
-	assert(entry->ie_object == obj);
+	hindex = hval % size;
 
 	/*
 	 *	First check we have the right hindex for this index.
@@ -349,14 +596,14 @@ ipc_hash_table_delete(
 	 *	along in this clump.
 	 */
 
-	while (table[hindex].ie_index != index) {
+	while (slots[hindex].ihs_index != index) {
 		if (++hindex == size) {
 			hindex = 0;
 		}
 	}
 
 	/*
-	 *	Now we want to set table[hindex].ie_index = 0.
+	 *	Now we want to set slots[hindex].ihs_index = 0.
 	 *	But if we aren't the last index in a clump,
 	 *	this might cause problems for lookups of objects
 	 *	farther along in the clump that are displaced
@@ -385,11 +632,11 @@ ipc_hash_table_delete(
 		 * then lookup will end on the next element anyway,
 		 * so we can leave the hole right here, we're done
 		 */
-		index = table[dindex].ie_index;
-		dist  = table[dindex].ie_dist;
+		index = slots[dindex].ihs_index;
+		dist  = slots[dindex].ihs_dist;
 		if (index == 0 || dist == 0) {
-			table[hindex].ie_index = 0;
-			table[hindex].ie_dist = 0;
+			slots[hindex].ihs_index = 0;
+			slots[hindex].ihs_dist = 0;
 			return;
 		}
 
@@ -398,7 +645,14 @@ ipc_hash_table_delete(
 		 * If its displacement was pegged, recompute it.
 		 */
 		if (dist-- == IPC_ENTRY_DIST_MAX) {
-			uint32_t desired = IH_TABLE_HASH(table[index].ie_object, size);
+			uint32_t desired;
+
+			if (hvals) {
+				desired = hvals[index] % size;
+			} else {
+				ipc_entry_t dentry = ipc_entry_table_get_nocheck(table, index);
+				desired = IH_TABLE_HASH(dentry->ie_object, size);
+			}
 			if (hindex >= desired) {
 				dist = hindex - desired;
 			} else {
@@ -413,8 +667,8 @@ ipc_hash_table_delete(
 		 * Move the displaced element closer to its ideal bucket,
 		 * and keep shifting elements back.
 		 */
-		table[hindex].ie_index = index;
-		table[hindex].ie_dist = dist;
+		slots[hindex].ihs_index = index;
+		slots[hindex].ihs_dist = dist;
 		hindex = dindex;
 	}
 }
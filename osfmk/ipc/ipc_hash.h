@@ -70,6 +70,7 @@
 #include <mach/mach_types.h>
 #include <mach/boolean.h>
 #include <mach/kern_return.h>
+#include <kern/bits.h>
 #include <ipc/ipc_entry.h>
 
 /*
@@ -102,8 +103,46 @@ extern void ipc_hash_delete(
  *	local primitives are for table entries.
  */
 
+/*
+ *	A bigger reverse hash table for a space,
+ *	filled while the space is unlocked.
+ */
+struct ipc_hash_rehash {
+	ipc_hash_table_t        ihr_hash;       /* the new hash table */
+	ipc_entry_num_t         ihr_count;      /* entries it is filled from */
+	bitmap_t                *ihr_dirty;     /* entries (un)hashed meanwhile */
+	bitmap_t                *ihr_filled;    /* entries the fill inserted */
+	uint32_t                *ihr_hvals;     /* with the hash of this object */
+};
+
+/* Allocate a bigger reverse hash table for a space */
+extern boolean_t ipc_hash_rehash_alloc(
+	struct ipc_hash_rehash  *ihr,
+	ipc_entry_num_t         hcount,
+	ipc_entry_num_t         count);
+
+/* Free it, or the previous one once swapped */
+extern void ipc_hash_rehash_free(
+	struct ipc_hash_rehash  *ihr);
+
+/* Start recording hash changes of a space */
+extern void ipc_hash_rehash_start(
+	ipc_space_t             space,
+	struct ipc_hash_rehash  *ihr);
+
+/* Fill the bigger reverse hash table, unlocked */
+extern void ipc_hash_rehash_fill(
+	struct ipc_hash_rehash  *ihr,
+	ipc_entry_table_t       table);
+
+/* Redo recorded changes and swap the reverse hash tables */
+extern void ipc_hash_rehash_finish(
+	ipc_space_t             space,
+	struct ipc_hash_rehash  *ihr);
+
 /* Lookup (space, obj) in local hash table */
 extern boolean_t ipc_hash_table_lookup(
+	ipc_hash_table_t        hash,
 	ipc_entry_table_t       table,
 	ipc_object_t            obj,
 	mach_port_name_t        *namep,
@@ -111,16 +150,17 @@ extern boolean_t ipc_hash_table_lookup(
 
 /* Inserts an entry into the local reverse hash table */
 extern void ipc_hash_table_insert(
-	ipc_entry_table_t       table,
+	ipc_hash_table_t        hash,
 	ipc_object_t            obj,
 	mach_port_index_t       index,
 	ipc_entry_t             entry);
 
 /* Delete an entry from the appropriate reverse hash table */
 extern void ipc_hash_table_delete(
+	ipc_hash_table_t        hash,
 	ipc_entry_table_t       table,
 	ipc_object_t            obj,
-	mach_port_name_t        name,
+	mach_port_index_t       index,
 	ipc_entry_t             entry);
 
 #include <mach_debug/hash_info.h>
@@ -6011,6 +6011,37 @@ ipc_kmsg_copyout_port_descriptor(
 	return (mach_msg_descriptor_t *)user_dsc;
 }
 
+/*
+ * Out-of-line memory received with MACH64_RCV_OOL_REGION is overwritten
+ * into the region passed with that receive when it is page aligned and
+ * still fits: vm_map_copy_overwrite() then moves the pages of the copy
+ * into the existing map entries of the region (or copies small ones out
+ * into it) rather than creating new entries, so that receivers of
+ * repeated transfers don't churn through map entries.
+ *
+ * The descriptors of a message are packed from the start of the region,
+ * and are reported with deallocate unset: their memory belongs to the
+ * region, and is replaced by the next message received into it.
+ */
+static bool
+ipc_kmsg_ool_fits_rcv_region(
+	vm_map_t                    map,
+	vm_map_copy_t               copy,
+	vm_map_size_t               size,
+	mach_msg_copy_options_t     copy_options,
+	mach_msg_size_t             ool_rcv_size,
+	vm_map_offset_t             rcv_offset)
+{
+	return ool_rcv_size != 0 &&
+	       map == current_map() &&
+	       copy_options == MACH_MSG_VIRTUAL_COPY &&
+	       (copy->type == VM_MAP_COPY_ENTRY_LIST ||
+	       copy->type == VM_MAP_COPY_KERNEL_BUFFER) &&
+	       VM_MAP_PAGE_ALIGNED(copy->offset, VM_MAP_PAGE_MASK(map)) &&
+	       VM_MAP_PAGE_ALIGNED(size, VM_MAP_PAGE_MASK(map)) &&
+	       ool_rcv_size - rcv_offset >= size;
+}
+
 extern char *proc_best_name(struct proc *proc);
 static mach_msg_descriptor_t *
 ipc_kmsg_copyout_ool_descriptor(
@@ -6018,6 +6049,9 @@ ipc_kmsg_copyout_ool_descriptor(
 	mach_msg_descriptor_t       *user_dsc,
 	int                         is_64bit,
 	vm_map_t                    map,
+	mach_vm_address_t           ool_rcv_addr,
+	mach_msg_size_t             ool_rcv_size,
+	vm_map_offset_t             *rcv_offset,
 	mach_msg_return_t           *mr)
 {
 	vm_map_copy_t               copy;
@@ -6026,6 +6060,7 @@ ipc_kmsg_copyout_ool_descriptor(
 	vm_map_size_t               size;
 	mach_msg_descriptor_type_t  dsc_type;
 	boolean_t                   misaligned = FALSE;
+	bool                        in_rcv_region = false;
 
 	copy = (vm_map_copy_t)dsc->address;
 	size = (vm_map_size_t)dsc->size;
@@ -6092,6 +6127,21 @@ ipc_kmsg_copyout_ool_descriptor(
 
 				kr = vm_map_copy_overwrite(map, rcv_addr, copy, size, FALSE);
 			}
+		} else if (ipc_kmsg_ool_fits_rcv_region(map, copy, size,
+		    copy_options, ool_rcv_size, *rcv_offset)) {
+			rcv_addr = ool_rcv_addr + *rcv_offset;
+
+			/*
+			 * A failed overwrite may have consumed part of the copy
+			 * already (the region was unmapped or protected since
+			 * the receive was set up), so it can't be mapped at a
+			 * new address instead: it gets discarded below.
+			 */
+			kr = vm_map_copy_overwrite(map, rcv_addr, copy, size, FALSE);
+			if (kr == KERN_SUCCESS) {
+				*rcv_offset += size;
+				in_rcv_region = true;
+			}
 		} else {
 			kr = vm_map_copyout_size(map, &rcv_addr, copy, size);
 		}
@@ -6122,8 +6172,8 @@ ipc_kmsg_copyout_ool_descriptor(
 		bzero((void *)user_ool_dsc, sizeof(*user_ool_dsc));
 
 		user_ool_dsc->address = rcv_addr;
-		user_ool_dsc->deallocate = (copy_options == MACH_MSG_VIRTUAL_COPY) ?
-		    TRUE : FALSE;
+		user_ool_dsc->deallocate = (copy_options == MACH_MSG_VIRTUAL_COPY &&
+		    !in_rcv_region) ? TRUE : FALSE;
 		user_ool_dsc->copy = copy_options;
 		user_ool_dsc->type = dsc_type;
 		user_ool_dsc->size = (mach_msg_size_t)size;
@@ -6136,8 +6186,8 @@ ipc_kmsg_copyout_ool_descriptor(
 
 		user_ool_dsc->address = CAST_DOWN_EXPLICIT(uint32_t, rcv_addr);
 		user_ool_dsc->size = (mach_msg_size_t)size;
-		user_ool_dsc->deallocate = (copy_options == MACH_MSG_VIRTUAL_COPY) ?
-		    TRUE : FALSE;
+		user_ool_dsc->deallocate = (copy_options == MACH_MSG_VIRTUAL_COPY &&
+		    !in_rcv_region) ? TRUE : FALSE;
 		user_ool_dsc->copy = copy_options;
 		user_ool_dsc->type = dsc_type;
 
@@ -6355,7 +6405,9 @@ ipc_kmsg_copyout_body(
 	ipc_kmsg_t              kmsg,
 	ipc_space_t             space,
 	vm_map_t                map,
-	mach_msg_option_t       option)
+	mach_msg_option_t       option,
+	mach_vm_address_t       ool_rcv_addr,
+	mach_msg_size_t         ool_rcv_size)
 {
 	mach_msg_body_t             *body;
 	mach_msg_descriptor_t       *kern_dsc, *user_dsc;
@@ -6363,6 +6415,7 @@ ipc_kmsg_copyout_body(
 	mach_msg_return_t           mr = MACH_MSG_SUCCESS;
 	boolean_t                   is_task_64bit = (map->max_offset > VM_MAX_ADDRESS);
 	mach_msg_header_t           *hdr = ikm_header(kmsg);
+	vm_map_offset_t             rcv_offset = 0;
 
 	body = (mach_msg_body_t *) (hdr + 1);
 	dsc_count = body->msgh_descriptor_count;
@@ -6383,7 +6436,8 @@ ipc_kmsg_copyout_body(
 		case MACH_MSG_OOL_DESCRIPTOR:
 			user_dsc = ipc_kmsg_copyout_ool_descriptor(
 				(mach_msg_ool_descriptor_t *)&kern_dsc[i],
-				user_dsc, is_task_64bit, map, &mr);
+				user_dsc, is_task_64bit, map, ool_rcv_addr, ool_rcv_size,
+				&rcv_offset, &mr);
 			break;
 		case MACH_MSG_OOL_PORTS_DESCRIPTOR:
 			user_dsc = ipc_kmsg_copyout_ool_ports_descriptor(
@@ -6468,6 +6522,10 @@ ipc_kmsg_copyout_size(
  *	Purpose:
  *		"Copy-out" port rights and out-of-line memory
  *		in the message.
+ *
+ *		If ool_rcv_size isn't 0 (MACH64_RCV_OOL_REGION),
+ *		page aligned out-of-line memory is placed into the
+ *		region at ool_rcv_addr rather than at a new address.
  *	Conditions:
  *		Nothing locked.
  *	Returns:
@@ -6484,7 +6542,9 @@ ipc_kmsg_copyout(
 	ipc_kmsg_t              kmsg,
 	ipc_space_t             space,
 	vm_map_t                map,
-	mach_msg_option_t      option)
+	mach_msg_option_t       option,
+	mach_vm_address_t       ool_rcv_addr,
+	mach_msg_size_t         ool_rcv_size)
 {
 	mach_msg_return_t mr;
 
@@ -6496,7 +6556,8 @@ ipc_kmsg_copyout(
 	}
 
 	if (ikm_header(kmsg)->msgh_bits & MACH_MSGH_BITS_COMPLEX) {
-		mr = ipc_kmsg_copyout_body(kmsg, space, map, option);
+		mr = ipc_kmsg_copyout_body(kmsg, space, map, option,
+		    ool_rcv_addr, ool_rcv_size);
 
 		if (mr != MACH_MSG_SUCCESS) {
 			mr |= MACH_RCV_BODY_ERROR;
@@ -6603,7 +6664,7 @@ ipc_kmsg_copyout_pseudo(
 	}
 
 	if (mbits & MACH_MSGH_BITS_COMPLEX) {
-		mr |= ipc_kmsg_copyout_body(kmsg, space, map, 0);
+		mr |= ipc_kmsg_copyout_body(kmsg, space, map, 0, 0, 0);
 	}
 
 	current_thread()->ith_knote = ITH_KNOTE_NULL;
@@ -381,7 +381,9 @@ extern mach_msg_return_t ipc_kmsg_copyout(
 	ipc_kmsg_t              kmsg,
 	ipc_space_t             space,
 	vm_map_t                map,
-	mach_msg_option_t       option);
+	mach_msg_option_t       option,
+	mach_vm_address_t       ool_rcv_addr,
+	mach_msg_size_t         ool_rcv_size);
 
 /* Copyout port rights and out-of-line memory to a user message,
  *  not reversing the ports in the header */
@@ -1049,6 +1049,9 @@ filt_machportprocess(
 	self->ith_max_asize = 0;
 	self->ith_asize = 0;
 
+	self->ith_ool_rcv_addr = 0;
+	self->ith_ool_rcv_size = 0;
+
 	self->ith_option = option64;
 	self->ith_receiver_name = MACH_PORT_NULL;
 	option64 |= MACH_RCV_TIMEOUT; // never wait
@@ -214,11 +214,9 @@ ipc_right_lookup_read(
 	 * of the space table pointer. This is not a problem at all: by
 	 * definition, those didn't affect the state of the entry.
 	 *
-	 * TODO: a data-structure where the entries are grown by "slabs",
-	 *       would allow for the address of an ipc_entry_t to never
-	 *       change once it exists in a space and would avoid a reload
-	 *       (as well as making space growth faster).
-	 *       We however still need to check for termination.
+	 * Entries of tables larger than a chunk never move,
+	 * but the first chunk of smaller tables is reallocated as they
+	 * grow, and we need to check for termination anyway.
 	 */
 	table = smr_entered_load(&space->is_table);
 	if (__improbable(table == NULL)) {
@@ -118,27 +118,6 @@ ipc_space_free(ipc_space_t space)
 	zfree(ipc_space_zone, space);
 }
 
-static void
-ipc_space_free_table(smr_node_t node)
-{
-	ipc_entry_t entry = __container_of(node, struct ipc_entry, ie_smr_node);
-	ipc_entry_table_t table = entry->ie_self;
-
-	ipc_entry_table_free_noclear(table);
-}
-
-void
-ipc_space_retire_table(ipc_entry_table_t table)
-{
-	ipc_entry_t base;
-	vm_size_t size;
-
-	base = ipc_entry_table_base(table);
-	size = ipc_entry_table_size(table);
-	base->ie_self = table;
-	smr_ipc_call(&base->ie_smr_node, size, ipc_space_free_table);
-}
-
 void
 ipc_space_reference(
 	ipc_space_t     space)
@@ -200,14 +179,16 @@ ipc_space_get_rollpoint(
  *	Arguments:
  *		space:	the ipc space to initialize.
  *		table:	the corresponding ipc table to initialize.
- *			the table is 0 initialized.
+ *			the range is 0 initialized.
  *		bottom:	the start of the range to initialize (inclusive).
  *		top:	the end of the range to initialize (noninclusive).
+ *	Returns:
+ *		The index of the last entry of the free list.
  */
-void
+mach_port_index_t
 ipc_space_rand_freelist(
 	ipc_space_t             space,
-	ipc_entry_t             table,
+	ipc_entry_table_t       table,
 	mach_port_index_t       bottom,
 	mach_port_index_t       size)
 {
@@ -233,7 +214,7 @@ ipc_space_rand_freelist(
 	 *	number, in order to frustrate attacks involving port name reuse.
 	 */
 	while (bottom <= top) {
-		ipc_entry_t entry = &table[curr];
+		ipc_entry_t entry = ipc_entry_table_get_nocheck(table, curr);
 		int which;
 #ifdef CONFIG_SEMI_RANDOM_ENTRIES
 		/*
@@ -268,7 +249,8 @@ ipc_space_rand_freelist(
 		entry->ie_next   = next;
 		curr = next;
 	}
-	table[curr].ie_bits   = IE_BITS_GEN_MASK;
+	ipc_entry_table_get_nocheck(table, curr)->ie_bits = IE_BITS_GEN_MASK;
+	return curr;
 }
 
 
@@ -295,18 +277,18 @@ ipc_space_create(
 	ipc_entry_table_t table;
 	ipc_entry_num_t count;
 
-	table = ipc_entry_table_alloc_by_count(IPC_ENTRY_TABLE_MIN,
-	    Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	table = ipc_entry_table_alloc(IPC_ENTRY_TABLE_MIN);
 	space = ipc_space_alloc();
 	count = ipc_entry_table_count(table);
 
 	random_bool_init(&space->bool_gen);
-	ipc_space_rand_freelist(space, ipc_entry_table_base(table), 0, count);
+	ipc_space_rand_freelist(space, table, 0, count);
 
 	os_ref_init_count_mask(&space->is_bits, IS_FLAGS_BITS, &is_refgrp, 2, 0);
+	space->is_hash = ipc_hash_table_alloc_by_count(count,
+	    Z_WAITOK | Z_ZERO | Z_NOFAIL);
 	space->is_table_free = count - 1;
 	space->is_label = label;
-	space->is_low_mod = count;
 	space->is_node_id = HOST_LOCAL_NODE; /* HOST_LOCAL_NODE, except proxy spaces */
 	smr_init_store(&space->is_table, table);
 
@@ -468,7 +450,8 @@ ipc_space_terminate(
 		}
 	}
 
-	ipc_space_retire_table(table);
+	ipc_entry_table_retire(table, table->iet_nchunks);
+	ipc_hash_table_free(&space->is_hash);
 	space->is_table_free = 0;
 
 	/*
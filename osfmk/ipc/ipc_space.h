@@ -85,6 +85,7 @@
 #ifdef MACH_KERNEL_PRIVATE
 #include <kern/macro_help.h>
 #include <kern/kern_types.h>
+#include <kern/bits.h>
 #include <kern/smr.h>
 #include <kern/locks.h>
 #include <kern/task.h>
@@ -99,12 +100,14 @@
  *	IPC operations like send and receive use this space.
  *	IPC kernel calls manipulate the space of the target task.
  *
- *	Every space has a non-NULL is_table with is_table[0].ie_size entries.
+ *	Every space has a non-NULL is_table with
+ *	ipc_entry_table_count(is_table) entries.
  *
  *	Only one thread can be growing the space at a time.  Others
- *	that need it grown wait for the first.  We do almost all the
- *	work with the space unlocked, so lookups proceed pretty much
- *	unaffected while the grow operation is underway.
+ *	that need it grown wait for the first.  Memory is allocated,
+ *	and a bigger reverse hash table filled, with the space unlocked,
+ *	so lookups proceed pretty much unaffected while the grow
+ *	operation is underway.
  */
 
 typedef natural_t ipc_space_refs_t;
@@ -125,12 +128,12 @@ struct ipc_space {
 	os_ref_atomic_t is_bits;        /* holds refs, active, growing */
 	ipc_entry_num_t is_table_hashed;/* count of hashed elements */
 	ipc_entry_num_t is_table_free;  /* count of free elements */
-	SMR_POINTER(ipc_entry_table_t XNU_PTRAUTH_SIGNED_PTR("ipc_space.is_table")) is_table; /* an array of entries */
+	SMR_POINTER(ipc_entry_table_t XNU_PTRAUTH_SIGNED_PTR("ipc_space.is_table")) is_table; /* chunks of entries */
+	ipc_hash_table_t is_hash;       /* reverse hash table of the entries */
+	bitmap_t        *is_hash_dirty; /* entries (un)hashed while a bigger is_hash is filled */
 	task_t XNU_PTRAUTH_SIGNED_PTR("ipc_space.is_task") is_task; /* associated task */
 	thread_t        is_grower;      /* thread growing the space */
 	ipc_label_t     is_label;       /* [private] mandatory access label */
-	ipc_entry_num_t is_low_mod;     /* lowest modified entry during growth */
-	ipc_entry_num_t is_high_mod;    /* highest modified entry during growth */
 	struct bool_gen bool_gen;       /* state for boolean RNG */
 	unsigned int    is_entropy[IS_ENTROPY_CNT]; /* pool of entropy taken from RNG */
 	int             is_node_id;     /* HOST_LOCAL_NODE, or remote node if proxy space */
@@ -248,9 +251,6 @@ extern void         ipc_space_unlock(
 extern void         ipc_space_lock_sleep(
 	ipc_space_t             space);
 
-extern void         ipc_space_retire_table(
-	ipc_entry_table_t       table);
-
 /* Create a special IPC space */
 extern kern_return_t ipc_space_create_special(
 	ipc_space_t            *spacep);
@@ -275,9 +275,9 @@ extern void ipc_space_terminate(
 	ipc_space_t             space);
 
 /* Permute the order of a range within an IPC space */
-extern void ipc_space_rand_freelist(
+extern mach_port_index_t ipc_space_rand_freelist(
 	ipc_space_t             space,
-	ipc_entry_t             table,
+	ipc_entry_table_t       table,
 	mach_port_index_t       bottom,
 	mach_port_index_t       top);
 
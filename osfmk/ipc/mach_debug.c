@@ -233,7 +233,8 @@ allocate_loop:
 		iin->iin_urefs = IE_BITS_UREFS(bits);
 		iin->iin_object = (natural_t)VM_KERNEL_ADDRPERM((uintptr_t)entry->ie_object);
 		iin->iin_next = entry->ie_next;
-		iin->iin_hash = entry->ie_index;
+		iin->iin_hash = ipc_hash_table_get_nocheck(space->is_hash,
+		    index)->ihs_index;
 
 		if (index + 1 < tsize && (index + 1) % BATCH_SIZE == 0) {
 			/*
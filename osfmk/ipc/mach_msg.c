@@ -86,6 +86,7 @@
 #include <kern/thread.h>
 #include <kern/sched_prim.h>
 #include <kern/exception.h>
+#include <kern/kalloc.h>
 #include <kern/misc_protos.h>
 #include <kern/processor.h>
 #include <kern/syscall_subr.h>
@@ -227,6 +228,12 @@ mach_msg_receive_results_kevent(
 	ipc_kmsg_t        kmsg = self->ith_kmsg;
 	mach_port_seqno_t seqno = self->ith_seqno;
 
+	/* ith_ool_rcv_* are only set up by receives that asked for a region */
+	mach_vm_address_t ool_rcv_addr = (option64 & MACH64_RCV_OOL_REGION) ?
+	    self->ith_ool_rcv_addr : 0;
+	mach_msg_size_t   ool_rcv_size = (option64 & MACH64_RCV_OOL_REGION) ?
+	    self->ith_ool_rcv_size : 0;
+
 	mach_msg_size_t   cpout_msg_size = 0, cpout_aux_size = 0;
 
 	/*
@@ -322,7 +329,8 @@ mach_msg_receive_results_kevent(
 	/* Save destination port context for the trailer before copyout */
 	context = ikm_header(kmsg)->msgh_remote_port->ip_context;
 
-	mr = ipc_kmsg_copyout(kmsg, space, map, (mach_msg_option_t)option64);
+	mr = ipc_kmsg_copyout(kmsg, space, map, (mach_msg_option_t)option64,
+	    ool_rcv_addr, ool_rcv_size);
 
 	trailer_size = ipc_kmsg_trailer_size((mach_msg_option_t)option64, self);
 
@@ -415,8 +423,9 @@ static mach_msg_return_t
 mach_msg_validate_data_vectors(
 	mach_msg_vector_t       *msg_vec,
 	mach_msg_vector_t       *aux_vec,
+	mach_msg_vector_t       *ool_vec,
 	mach_msg_size_t         vec_count,
-	__unused mach_msg_option64_t     option64,
+	mach_msg_option64_t     option64,
 	bool                    sending)
 {
 	mach_msg_size_t msg_size = 0, aux_size = 0; /* user size */
@@ -426,6 +435,7 @@ mach_msg_validate_data_vectors(
 
 	assert(msg_vec != NULL);
 	assert(aux_vec != NULL);
+	assert(ool_vec != NULL);
 
 	if (vec_count == 0) {
 		/*
@@ -465,8 +475,42 @@ mach_msg_validate_data_vectors(
 		}
 	}
 
-	/* Validate second (optional auxiliary) data vector */
-	if (vec_count == MACH_MSGV_MAX_COUNT) {
+	/* Validate third (optional, receive only) OOL region data vector */
+	if (vec_count > MACH_MSGV_IDX_OOL_REGION) {
+		vm_map_t map = current_map();
+		mach_vm_address_t rcv_addr, end;
+
+		if (sending) {
+			return MACH_SEND_INVALID_DATA;
+		}
+		if (!(option64 & MACH64_RCV_OOL_REGION)) {
+			return MACH_RCV_INVALID_ARGUMENTS;
+		}
+
+		rcv_addr = ool_vec->msgv_rcv_addr ?
+		    ool_vec->msgv_rcv_addr : ool_vec->msgv_data;
+		if (ool_vec->msgv_rcv_size == 0 ||
+		    !VM_MAP_PAGE_ALIGNED(rcv_addr, VM_MAP_PAGE_MASK(map)) ||
+		    !VM_MAP_PAGE_ALIGNED(ool_vec->msgv_rcv_size, VM_MAP_PAGE_MASK(map)) ||
+		    os_add_overflow(rcv_addr, ool_vec->msgv_rcv_size, &end) ||
+		    rcv_addr < vm_map_min(map) || end > vm_map_max(map)) {
+			return MACH_RCV_INVALID_ARGUMENTS;
+		}
+		ool_vec->msgv_rcv_addr = rcv_addr;
+	} else if (!sending) {
+		if (option64 & MACH64_RCV_OOL_REGION) {
+			return MACH_RCV_INVALID_ARGUMENTS;
+		}
+		ool_vec->msgv_rcv_size = 0;
+	}
+
+	/*
+	 * Validate second (optional auxiliary) data vector, which may be left
+	 * empty when it only holds the place of the OOL region one.
+	 */
+	if (vec_count > MACH_MSGV_IDX_AUX &&
+	    (sending || vec_count <= MACH_MSGV_IDX_OOL_REGION ||
+	    aux_vec->msgv_rcv_size != 0)) {
 		if (sending) {
 			aux_size = aux_vec->msgv_send_size;
 			if (aux_size != 0 && aux_vec->msgv_data == 0) {
@@ -522,11 +566,12 @@ mach_msg_copyin_data_vectors(
 	mach_msg_size_t     cpin_count,
 	mach_msg_option64_t option64,
 	mach_msg_vector_t   *msg_vecp,/* out */
-	mach_msg_vector_t   *aux_vecp)/* out */
+	mach_msg_vector_t   *aux_vecp,/* out */
+	mach_msg_vector_t   *ool_vecp)/* out */
 {
 	mach_msg_vector_t data_vecs[MACH_MSGV_MAX_COUNT] = {};
 
-	static_assert(MACH_MSGV_MAX_COUNT == 2);
+	static_assert(MACH_MSGV_MAX_COUNT == 3);
 	assert(option64 & MACH64_MSG_VECTOR);
 
 	if (cpin_count > MACH_MSGV_MAX_COUNT) {
@@ -547,10 +592,14 @@ mach_msg_copyin_data_vectors(
 
 	memcpy(msg_vecp, &data_vecs[MACH_MSGV_IDX_MSG], sizeof(mach_msg_vector_t));
 
-	if (cpin_count == MACH_MSGV_MAX_COUNT) {
+	if (cpin_count > MACH_MSGV_IDX_AUX) {
 		memcpy(aux_vecp, &data_vecs[MACH_MSGV_IDX_AUX], sizeof(mach_msg_vector_t));
 	}
 
+	if (cpin_count > MACH_MSGV_IDX_OOL_REGION) {
+		memcpy(ool_vecp, &data_vecs[MACH_MSGV_IDX_OOL_REGION], sizeof(mach_msg_vector_t));
+	}
+
 	return MACH_MSG_SUCCESS;
 }
 
@@ -867,6 +916,64 @@ mach_msg_trap_send(
 	return mr;
 }
 
+/*
+ *  Routine:    mach_msg_receive_on_object [internal]
+ *  Purpose:
+ *      Receive a message from a port or port set the caller looked up.
+ *  Conditions:
+ *      MACH_RCV_MSG is set. Holding a ref on object, which is consumed.
+ *      max_{msg, aux}_rcv_size are already validated.
+ *  Returns:
+ *      All of mach_msg_receive error codes.
+ */
+static mach_msg_return_t
+mach_msg_receive_on_object(
+	ipc_object_t        object,
+	mach_vm_address_t   msg_addr,
+	mach_vm_address_t   aux_addr,        /* 0 if not vector send/rcv */
+	mach_msg_option64_t option64,
+	mach_msg_timeout_t  msg_timeout,
+	mach_msg_size_t     max_msg_rcv_size,
+	mach_msg_size_t     max_aux_rcv_size,        /* 0 if not vector send/rcv */
+	mach_vm_address_t   ool_rcv_addr,
+	mach_msg_size_t     ool_rcv_size,            /* 0 without MACH64_RCV_OOL_REGION */
+	bool                has_continuation)
+{
+	thread_t           self = current_thread();
+
+	/* Set up message proper receive params on thread */
+	self->ith_msg_addr = msg_addr;
+	self->ith_max_msize = max_msg_rcv_size;
+	self->ith_msize = 0;
+
+	/* Set up aux data receive params on thread */
+	self->ith_aux_addr = (max_aux_rcv_size == 0) ? 0 : aux_addr;
+	self->ith_max_asize = max_aux_rcv_size;
+	self->ith_asize = 0;
+
+	/* Set up out-of-line memory receive region on thread */
+	self->ith_ool_rcv_addr = (ool_rcv_size == 0) ? 0 : ool_rcv_addr;
+	self->ith_ool_rcv_size = ool_rcv_size;
+
+	self->ith_object = object;
+	self->ith_option = option64;
+	self->ith_receiver_name = MACH_PORT_NULL;
+	self->ith_knote = ITH_KNOTE_NULL;
+
+	ipc_mqueue_receive(io_waitq(object),
+	    option64, max_msg_rcv_size,
+	    max_aux_rcv_size, msg_timeout,
+	    THREAD_ABORTSAFE, has_continuation);
+	/* NOTREACHED if thread started waiting with a continuation */
+
+	if ((option64 & MACH_RCV_TIMEOUT) && msg_timeout == 0) {
+		thread_poll_yield(self);
+	}
+
+	/* release ref on ith_object */
+	return mach_msg_receive_results();
+}
+
 /*
  *  Routine:    mach_msg_trap_receive [internal]
  *  Purpose:
@@ -888,11 +995,12 @@ mach_msg_trap_receive(
 	/* msg receive args */
 	mach_msg_size_t     max_msg_rcv_size,
 	mach_msg_size_t     max_aux_rcv_size,        /* 0 if not vector send/rcv */
+	mach_vm_address_t   ool_rcv_addr,
+	mach_msg_size_t     ool_rcv_size,            /* 0 without MACH64_RCV_OOL_REGION */
 	mach_port_name_t    rcv_name)
 {
 	ipc_object_t object;
 
-	thread_t           self = current_thread();
 	ipc_space_t        space = current_space();
 	mach_msg_return_t  mr = MACH_MSG_SUCCESS;
 
@@ -914,35 +1022,9 @@ mach_msg_trap_receive(
 		}
 	}
 
-	/* Set up message proper receive params on thread */
-	self->ith_msg_addr = msg_addr;
-	self->ith_max_msize = max_msg_rcv_size;
-	self->ith_msize = 0;
-
-	/* Set up aux data receive params on thread */
-	self->ith_aux_addr = (max_aux_rcv_size == 0) ? 0 : aux_addr;
-	self->ith_max_asize = max_aux_rcv_size;
-	self->ith_asize = 0;
-
-	self->ith_object = object;
-	self->ith_option = option64;
-	self->ith_receiver_name = MACH_PORT_NULL;
-	self->ith_knote = ITH_KNOTE_NULL;
-
-	ipc_mqueue_receive(io_waitq(object),
-	    option64, max_msg_rcv_size,
-	    max_aux_rcv_size, msg_timeout,
-	    THREAD_ABORTSAFE, /* continuation ? */ true);
-	/* NOTREACHED if thread started waiting */
-
-	if ((option64 & MACH_RCV_TIMEOUT) && msg_timeout == 0) {
-		thread_poll_yield(self);
-	}
-
-	mr = mach_msg_receive_results();
-	/* release ref on ith_object */
-
-	return mr;
+	return mach_msg_receive_on_object(object, msg_addr, aux_addr, option64,
+	           msg_timeout, max_msg_rcv_size, max_aux_rcv_size,
+	           ool_rcv_addr, ool_rcv_size, /* continuation ? */ true);
 }
 
 /*
@@ -1028,7 +1110,7 @@ mach_msg_overwrite_trap(
 			msg_addr = rcv_msg_addr;
 		}
 		mr = mach_msg_trap_receive(msg_addr, 0, (mach_msg_option64_t)option32,
-		    msg_timeout, sync_send, rcv_size, 0, rcv_name);
+		    msg_timeout, sync_send, rcv_size, 0, 0, 0, rcv_name);
 	}
 
 end:
@@ -1073,6 +1155,188 @@ mach_msg2_cfi_option_valid(
 	return (option64 != 0) && ((option64 & (option64 - 1)) == 0);
 }
 
+/*
+ *  Routine:    mach_msg_batch_copyin_header
+ *  Purpose:
+ *      Copy in the header of a message of a mach_msg2() batch, and its
+ *      descriptor count if it is complex.
+ *  Returns:
+ *      MACH_MSG_SUCCESS - Copyin succeeded, msg_size needs the additional
+ *                         bound checks of mach_msg_trap_send().
+ *      MACH_SEND_MSG_TOO_SMALL
+ *      MACH_SEND_INVALID_DATA
+ */
+static mach_msg_return_t
+mach_msg_batch_copyin_header(
+	mach_vm_address_t       msg_addr,
+	mach_msg_size_t         msg_size,
+	mach_msg_user_header_t  *header,
+	mach_msg_size_t         *desc_count)
+{
+	mach_msg_user_base_t    user_base = {};
+	mach_msg_size_t         len_copied;
+
+	if ((msg_size < sizeof(mach_msg_user_header_t)) || (msg_size & 3)) {
+		return MACH_SEND_MSG_TOO_SMALL;
+	}
+
+	if (msg_size == sizeof(mach_msg_user_header_t)) {
+		len_copied = sizeof(mach_msg_user_header_t);
+	} else {
+		len_copied = sizeof(mach_msg_user_base_t);
+	}
+
+	if (copyinmsg(msg_addr, (char *)&user_base, len_copied)) {
+		return MACH_SEND_INVALID_DATA;
+	}
+
+	*header = user_base.header;
+	header->msgh_size = msg_size;
+
+	/* desc count bound check in mach_msg_trap_send() */
+	if (header->msgh_bits & MACH_MSGH_BITS_COMPLEX) {
+		*desc_count = user_base.body.msgh_descriptor_count;
+	} else {
+		*desc_count = 0;
+	}
+
+	return MACH_MSG_SUCCESS;
+}
+
+/*
+ *  Routine:    mach_msg2_trap_batch [internal]
+ *  Purpose:
+ *      Send, then receive, an array of messages in one mach_msg2() call.
+ *
+ *      Every message still goes through mach_msg_trap_send(), which
+ *      allocates its kmsg and takes the space lock to copy its header
+ *      in, like a scalar send does. What the batch saves is the trap
+ *      per message, the entries are copied in and out once, and the
+ *      receive right is looked up once for all the messages received.
+ *      Only the first receive waits for a message, the others stop as
+ *      soon as the queue is empty.
+ *
+ *      A failed send doesn't prevent the rest of the batch from being
+ *      sent, unless it was interrupted, but skips the receive like it
+ *      does for a scalar mach_msg2().
+ *  Conditions:
+ *      Nothing locked. Options are validated.
+ *  Returns:
+ *      The first send error of the batch, or the result of the first
+ *      receive. Per message results are in the entries.
+ */
+static mach_msg_return_t
+mach_msg2_trap_batch(
+	mach_vm_address_t   data_addr,
+	mach_msg_option64_t option64,
+	mach_msg_timeout_t  msg_timeout,
+	mach_msg_priority_t priority,
+	bool                filter_nonfatal,
+	mach_msg_size_t     send_cnt,
+	mach_msg_size_t     rcv_cnt,
+	mach_port_name_t    rcv_name)
+{
+	mach_msg_batch_entry_t *entries;
+	mach_msg_user_header_t user_header;
+	mach_msg_size_t        desc_count;
+	mach_msg_size_t        count = 0;
+	ipc_object_t           object;
+	mach_msg_return_t      mr = MACH_MSG_SUCCESS, emr;
+
+	assert(option64 & MACH64_MSG_BATCH);
+	option64 &= ~MACH64_MSG_BATCH;
+
+	if (option64 & MACH64_SEND_MSG) {
+		count = send_cnt;
+	}
+	if (option64 & MACH64_RCV_MSG) {
+		count = MAX(count, rcv_cnt);
+	}
+	if (count == 0 || count > MACH_MSG_BATCH_MAX_COUNT) {
+		return (option64 & MACH64_SEND_MSG) ?
+		       MACH_SEND_INVALID_DATA : MACH_RCV_INVALID_ARGUMENTS;
+	}
+
+	entries = kalloc_data(count * sizeof(mach_msg_batch_entry_t),
+	    Z_WAITOK | Z_NOFAIL);
+
+	if (copyin((user_addr_t)data_addr, (caddr_t)entries,
+	    count * sizeof(mach_msg_batch_entry_t))) {
+		kfree_data(entries, count * sizeof(mach_msg_batch_entry_t));
+		return (option64 & MACH64_SEND_MSG) ?
+		       MACH_SEND_INVALID_DATA : MACH_RCV_INVALID_ARGUMENTS;
+	}
+
+	for (mach_msg_size_t i = 0; (option64 & MACH64_SEND_MSG) && i < send_cnt; i++) {
+		mach_msg_batch_entry_t *entry = &entries[i];
+
+		if (mr == MACH_SEND_INTERRUPTED) {
+			entry->msgb_send_return = MACH_SEND_INTERRUPTED;
+			continue;
+		}
+
+		emr = mach_msg_batch_copyin_header(entry->msgb_data,
+		    entry->msgb_send_size, &user_header, &desc_count);
+		if (emr == MACH_MSG_SUCCESS) {
+			/* msgb_send_size is bound checked in mach_msg_trap_send() */
+			emr = mach_msg_trap_send(entry->msgb_data, 0, option64,
+			    msg_timeout, priority, filter_nonfatal,
+			    user_header, entry->msgb_send_size, 0, desc_count);
+		}
+
+		entry->msgb_send_return = emr;
+		if (emr != MACH_MSG_SUCCESS && mr == MACH_MSG_SUCCESS) {
+			mr = emr;
+		}
+	}
+
+	for (mach_msg_size_t i = 0; (option64 & MACH64_RCV_MSG) && i < rcv_cnt; i++) {
+		entries[i].msgb_rcv_return = MACH_RCV_TIMED_OUT;
+	}
+
+	/* if a send failed, skip receive */
+	if (mr == MACH_MSG_SUCCESS && (option64 & MACH64_RCV_MSG)) {
+		mr = ipc_mqueue_copyin(current_space(), rcv_name, &object);
+		if (mr != MACH_MSG_SUCCESS) {
+			goto out;
+		}
+		/* hold ref for object */
+		for (mach_msg_size_t i = 0; i < rcv_cnt; i++) {
+			mach_msg_batch_entry_t *entry = &entries[i];
+
+			/* consumed by mach_msg_receive_on_object() */
+			io_reference(object);
+			emr = mach_msg_receive_on_object(object,
+			    entry->msgb_rcv_addr ? entry->msgb_rcv_addr : entry->msgb_data,
+			    0, option64, msg_timeout, entry->msgb_rcv_size, 0, 0, 0,
+			    /* continuation ? */ false);
+
+			entry->msgb_rcv_return = emr;
+			if (i == 0) {
+				mr = emr;
+			}
+			if (emr != MACH_MSG_SUCCESS) {
+				break;
+			}
+
+			/* only wait for the first message, then drain the queue */
+			option64 |= MACH64_RCV_TIMEOUT;
+			msg_timeout = 0;
+		}
+		io_release(object);
+	}
+
+out:
+	if (copyout((caddr_t)entries, (user_addr_t)data_addr,
+	    count * sizeof(mach_msg_batch_entry_t)) && mr == MACH_MSG_SUCCESS) {
+		mr = (option64 & MACH64_RCV_MSG) ?
+		    MACH_RCV_INVALID_DATA : MACH_SEND_INVALID_DATA;
+	}
+	kfree_data(entries, count * sizeof(mach_msg_batch_entry_t));
+
+	return mr;
+}
+
 /*
  *  Routine:    mach_msg2_trap [mach trap]
  *  Purpose:
@@ -1108,7 +1372,7 @@ mach_msg2_trap(
 	mach_msg_return_t  mr = MACH_MSG_SUCCESS;
 
 	mach_msg_user_header_t user_header = {};
-	mach_msg_vector_t msg_vec = {}, aux_vec = {};         /* zeroed */
+	mach_msg_vector_t msg_vec = {}, aux_vec = {}, ool_vec = {}; /* zeroed */
 
 	option64 &= MACH64_MSG_OPTION_USER;
 	option64 |= MACH64_MACH_MSG2;
@@ -1129,12 +1393,38 @@ mach_msg2_trap(
 		return MACH_SEND_INVALID_OPTIONS;
 	}
 
+	/* the OOL receive region is passed as a data vector */
+	if (__improbable((option64 & MACH64_RCV_OOL_REGION) && !vector_msg)) {
+		return MACH_RCV_INVALID_ARGUMENTS;
+	}
+
+	if (option64 & MACH64_MSG_BATCH) {
+		/*
+		 * Batches are for message queues only: their messages have no aux
+		 * data, and can't wait for a reply on a special reply port.
+		 */
+		if (__improbable(vector_msg || (option64 & MACH64_RCV_SYNC_WAIT) ||
+		    ((option64 & MACH64_SEND_MSG) &&
+		    (option64 & MACH64_MSG_OPTION_CFI_MASK) != MACH64_SEND_MQ_CALL))) {
+			mach_port_guard_exception(0, 0, 0, kGUARD_EXC_INVALID_OPTIONS);
+			return MACH_SEND_INVALID_OPTIONS;
+		}
+
+		mr = mach_msg2_trap_batch(data_addr, option64, msg_timeout,
+		    (mach_msg_priority_t)(rs_pr >> 32), filter_nonfatal,
+		    (mach_msg_size_t)(mb_ss >> 32), (mach_msg_size_t)rs_pr,
+		    (mach_port_name_t)(dc_rn >> 32));
+		KDBG(MACHDBG_CODE(DBG_MACH_IPC, MACH_IPC_KMSG_INFO) | DBG_FUNC_END, mr);
+		goto end;
+	}
+
 	if (vector_msg) {
 		send_data_cnt = (mb_ss >> 32);
 		rcv_data_cnt = (mach_msg_size_t)rs_pr;
 
 		mr = mach_msg_copyin_data_vectors((mach_msg_vector_t *)data_addr,
-		    MAX(send_data_cnt, rcv_data_cnt), option64, &msg_vec, &aux_vec);
+		    MAX(send_data_cnt, rcv_data_cnt), option64, &msg_vec, &aux_vec,
+		    &ool_vec);
 
 		if (mr != MACH_MSG_SUCCESS) {
 			return mr;
@@ -1147,8 +1437,8 @@ mach_msg2_trap(
 			 * only validate msg send related arguments. bad receive args
 			 * do not stop us from sending during combined send/rcv.
 			 */
-			mr = mach_msg_validate_data_vectors(&msg_vec, &aux_vec, send_data_cnt,
-			    option64, /* sending? */ TRUE);
+			mr = mach_msg_validate_data_vectors(&msg_vec, &aux_vec, &ool_vec,
+			    send_data_cnt, option64, /* sending? */ TRUE);
 			if (mr != MACH_MSG_SUCCESS) {
 				return mr;
 			}
@@ -1206,8 +1496,8 @@ mach_msg2_trap(
 	if (option64 & MACH64_RCV_MSG) {
 		if (vector_msg) {
 			/* only validate msg receive related arguments */
-			mr = mach_msg_validate_data_vectors(&msg_vec, &aux_vec, rcv_data_cnt,
-			    option64, /* sending? */ FALSE);
+			mr = mach_msg_validate_data_vectors(&msg_vec, &aux_vec, &ool_vec,
+			    rcv_data_cnt, option64, /* sending? */ FALSE);
 			if (mr != MACH_MSG_SUCCESS) {
 				goto end;
 			}
@@ -1232,9 +1522,11 @@ mach_msg2_trap(
 			sync_send = MACH_PORT_NULL;
 		}
 
+		/* Zeroed unless MACH64_RCV_OOL_REGION */
 		mr = mach_msg_trap_receive(msg_addr, aux_addr, option64,
 		    msg_timeout, sync_send, max_msg_rcv_size,
-		    max_aux_rcv_size, rcv_name);
+		    max_aux_rcv_size, ool_vec.msgv_rcv_addr,
+		    ool_vec.msgv_rcv_size, rcv_name);
 	}
 
 end:
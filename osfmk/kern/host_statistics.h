@@ -56,5 +56,9 @@ SCALABLE_COUNTER_DECLARE(vm_statistics_swapouts);               /* # of pages sw
 SCALABLE_COUNTER_DECLARE(vm_statistics_total_uncompressed_pages_in_compressor); /* # of pages (uncompressed) held within the compressor. */
 
 SCALABLE_COUNTER_DECLARE(vm_page_grab_count);
+SCALABLE_COUNTER_DECLARE(vm_page_free_cache_hits);              /* grabs served by a per-CPU free page cache */
+SCALABLE_COUNTER_DECLARE(vm_page_free_cache_refills);           /* per-CPU free page cache refills */
+SCALABLE_COUNTER_DECLARE(vm_page_free_cache_releases);          /* frees kept in a per-CPU free page cache */
+SCALABLE_COUNTER_DECLARE(vm_page_free_cache_drains);            /* per-CPU free page cache drains */
 
 #endif  /* _KERN_HOST_STATISTICS_H_ */
@@ -167,11 +167,10 @@ fileport_walk(task_t task, size_t *countp,
 	}
 
 	table = is_active_table(space);
-	entry = ipc_entry_table_base(table);
 
 	/* skip the first element which is not a real entry */
 	index = 1;
-	entry = ipc_entry_table_next_elem(table, entry);
+	entry = ipc_entry_table_get_nocheck(table, index);
 
 	for (;;) {
 		ipc_entry_bits_t bits = entry->ie_bits;
@@ -195,10 +194,10 @@ fileport_walk(task_t task, size_t *countp,
 		}
 
 		index++;
-		entry = ipc_entry_table_next_elem(table, entry);
-		if (!entry) {
+		if (!ipc_entry_table_contains(table, index)) {
 			break;
 		}
+		entry = ipc_entry_table_get_nocheck(table, index);
 		if (index % BATCH_SIZE == 0) {
 			/*
 			 * Give the system some breathing room,
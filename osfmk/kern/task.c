@@ -1911,6 +1911,7 @@ task_create_internal(
 	new_task->task_objects_disowning = FALSE;
 	new_task->task_objects_disowned = FALSE;
 	new_task->task_owned_objects = 0;
+	new_task->task_purged_objects = 0;
 	queue_init(&new_task->task_objq);
 
 #if CONFIG_FREEZE
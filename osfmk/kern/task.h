@@ -506,6 +506,8 @@ struct task {
 	/* # of purgeable but not volatile VM objects owned by this task: */
 	int             task_nonvolatile_objects;
 	int             task_owned_objects;
+	/* # of its volatile VM objects purged, for NOTE_MEMORYSTATUS_PURGED: */
+	uint32_t        task_purged_objects;
 	queue_head_t    task_objq;
 	decl_lck_mtx_data(, task_objq_lock); /* protects "task_objq" */
 
@@ -567,6 +569,7 @@ struct task {
 #if CONFIG_DEFERRED_RECLAIM
 	vm_deferred_reclamation_metadata_t deferred_reclamation_metadata; /* Protected by the task lock */
 #endif /* CONFIG_DEFERRED_RECLAIM */
+	struct launch_trace *task_launch_trace; /* launch trace being recorded, see vm_launch_trace.c */
 
 #if CONFIG_EXCLAVES
 	void *conclave;
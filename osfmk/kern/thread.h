@@ -675,12 +675,14 @@ struct thread {
 			ipc_object_t            object;         /* object received on */
 			mach_vm_address_t       msg_addr;       /* receive msg buffer pointer */
 			mach_vm_address_t       aux_addr;       /* receive aux buffer pointer */
+			mach_vm_address_t       ool_rcv_addr;   /* MACH64_RCV_OOL_REGION region */
 			mach_msg_size_t         max_msize;      /* max rcv size for msg */
 			mach_msg_size_t         max_asize;      /* max rcv size for aux data */
 			mach_msg_size_t         msize;          /* actual size for the msg */
 			mach_msg_size_t         asize;          /* actual size for aux data */
 			mach_msg_option64_t     option;         /* 64 bits options for receive */
 			mach_port_name_t        receiver_name;  /* the receive port name */
+			mach_msg_size_t         ool_rcv_size;   /* MACH64_RCV_OOL_REGION size */
 			union {
 				struct ipc_kmsg   *XNU_PTRAUTH_SIGNED_PTR("thread.ith_kmsg")  kmsg;  /* received message */
 #if MACH_FLIPC
@@ -1017,6 +1019,8 @@ struct thread {
 #define ith_object          saved.receive.object
 #define ith_msg_addr        saved.receive.msg_addr
 #define ith_aux_addr        saved.receive.aux_addr
+#define ith_ool_rcv_addr    saved.receive.ool_rcv_addr
+#define ith_ool_rcv_size    saved.receive.ool_rcv_size
 #define ith_max_msize       saved.receive.max_msize
 #define ith_max_asize       saved.receive.max_asize
 #define ith_msize           saved.receive.msize
@@ -89,6 +89,7 @@
 #include <kern/sched.h>
 #include <kern/locks.h>
 #include <kern/sched_prim.h>
+#include <kern/processor.h>
 #include <kern/misc_protos.h>
 #include <kern/thread_call.h>
 #include <kern/zalloc_internal.h>
@@ -269,13 +270,21 @@ static_assert(sizeof(struct zone_page_metadata) == 16, "validate packing");
  * Magazine of cached allocations.
  *
  * @field zm_next       linkage used by magazine depots.
- * @field zm_elems      an array of @c zc_mag_size() elements.
+ * @field zm_seq        the SMR sequence the magazine was tagged with.
+ * @field zm_elems      an array of @c zone_magazine_capacity() elements.
+ *
+ * @discussion
+ * The header is kept at two words so that magazines keep filling whole
+ * cachelines: the size class of a magazine isn't stored, it is derived
+ * from the zone it was allocated from (see zone_magazine_class()).
  */
 struct zone_magazine {
 	zone_magazine_t         zm_next;
 	smr_seq_t               zm_seq;
 	vm_offset_t             zm_elems[0];
 };
+static_assert(sizeof(struct zone_magazine) == 2 * sizeof(vm_offset_t),
+    "magazine headers are two words");
 
 /*!
  * @typedef zone_cache_t
@@ -295,7 +304,7 @@ struct zone_magazine {
  * - the Zone Allocator.
  *
  * The per-cpu and recirculation depot layer use magazines (@c zone_magazine_t),
- * which are stacks of up to @c zc_mag_size() elements.
+ * which are stacks of up to @c zone_magazine_capacity() elements.
  *
  * <h2>CPU layer</h2>
  *
@@ -357,6 +366,20 @@ struct zone_magazine {
  * @c compute_zone_working_set_size() to return memory to the system when a zone
  * stops being used as much.
  *
+ * Once the per-cpu depots of a zone have reached @c z_depot_limit and the zone
+ * is still contended, @c compute_zone_working_set_size() moves it to the next
+ * magazine size class (@c z_mag_class), which doubles the size of its
+ * magazines, so that each trip to the recirculation layer moves twice as many
+ * elements. @c z_depot_limit is scaled down accordingly, so that the memory
+ * a CPU can cache stays bounded by @c zc_pcpu_max. When the contention goes
+ * away and the depots shrink back to nothing, the zone steps down a class.
+ *
+ * Magazines of the previous class keep circulating after a resize: a full
+ * magazine is always full at its own capacity, and the per-cpu layer keeps
+ * the capacity of the two magazines it has loaded in @c zc_alloc_cap and
+ * @c zc_free_cap. Empty magazines of the wrong class are replaced when they
+ * are about to be loaded (see @c zone_magazine_load_empty()).
+ *
  * <h2>Security considerations</h2>
  *
  * The zone caching layer has been designed to avoid returning elements in
@@ -370,20 +393,40 @@ struct zone_magazine {
  * @field zc_depot_lock     a lock to access @c zc_depot, @c zc_depot_cur.
  * @field zc_alloc_cur      denormalized number of elements in the (a) magazine
  * @field zc_free_cur       denormalized number of elements in the (f) magazine
+ * @field zc_alloc_cap      denormalized capacity of the (a) magazine
+ * @field zc_free_cap       denormalized capacity of the (f) magazine
  * @field zc_alloc_elems    a pointer to the array of elements in (a)
  * @field zc_free_elems     a pointer to the array of elements in (f)
  *
  * @field zc_depot          a list of @c zc_depot_cur full magazines
+ *
+ * @field zc_depot_hits     magazine exchanges satisfied by @c zc_depot
+ * @field zc_depot_misses   magazine exchanges that went to the recirculation
+ *                          layer or the zone
+ * @field zc_depot_contended
+ *                          how many times the recirculation lock was found
+ *                          held by another CPU
+ *
+ * The first cacheline holds what the allocation and free fast paths use,
+ * the depot and the statistics live on the second one, which is only
+ * touched when magazines are exchanged.
  */
 typedef struct zone_cache {
 	hw_lck_ticket_t            zc_depot_lock;
 	uint16_t                   zc_alloc_cur;
 	uint16_t                   zc_free_cur;
+	uint16_t                   zc_alloc_cap;
+	uint16_t                   zc_free_cap;
 	vm_offset_t               *zc_alloc_elems;
 	vm_offset_t               *zc_free_elems;
-	struct zone_depot          zc_depot;
 	smr_t                      zc_smr;
+
+	uint8_t                    zc_cacheline1[0] __attribute__((aligned(64)));
+	struct zone_depot          zc_depot;
 	zone_smr_free_cb_t XNU_PTRAUTH_SIGNED_FUNCTION_PTR("zc_free") zc_free;
+	uint64_t                   zc_depot_hits;
+	uint64_t                   zc_depot_misses;
+	uint64_t                   zc_depot_contended;
 } __attribute__((aligned(64))) * zone_cache_t;
 
 #if !__x86_64__
@@ -395,6 +438,9 @@ __security_const_late struct {
 	struct mach_vm_range       zi_meta_range; /* debugging only       */
 	struct mach_vm_range       zi_bits_range; /* bits buddy allocator */
 	struct mach_vm_range       zi_xtra_range; /* vm tracking metadata */
+#if ZALLOC_CLUSTER_POOLS
+	struct mach_vm_range       zi_cluster_range; /* chunk owners      */
+#endif /* ZALLOC_CLUSTER_POOLS */
 	struct mach_vm_range       zi_pgz_range;
 	struct zone_page_metadata *zi_pgz_meta;
 
@@ -412,12 +458,24 @@ __security_const_late struct {
 	 * that math all the time.
 	 */
 	struct zone_page_metadata *zi_meta_base;
+#if ZALLOC_CLUSTER_POOLS
+	/*
+	 * The cluster owning a chunk is kept in a byte array parallel
+	 * to the metadata (one byte per page, only the chunk head's is used),
+	 * pre-offset the same way as zi_meta_base.
+	 *
+	 * It is NULL until zone_metadata_init() ran, or if the system has
+	 * a single cluster, in which case the cluster pools aren't used.
+	 */
+	uint8_t                   *zi_cluster_base;
+#endif /* ZALLOC_CLUSTER_POOLS */
 } zone_info;
 
 __startup_data static struct mach_vm_range  zone_map_range;
 __startup_data static vm_map_size_t         zone_meta_size;
 __startup_data static vm_map_size_t         zone_bits_size;
 __startup_data static vm_map_size_t         zone_xtra_size;
+__startup_data static vm_map_size_t         zone_cluster_size;
 
 /*
  * Initial array of metadata for stolen memory.
@@ -488,8 +546,12 @@ SECURITY_READ_ONLY_LATE(unsigned int) zone_view_count;
  * this array is unmapped with the rest of __startup_data at lockdown.
  */
 
-/* zone to allocate zone_magazine structs from */
-static SECURITY_READ_ONLY_LATE(zone_t) zc_magazine_zone;
+/*
+ * zones to allocate zone_magazine structs from, one per size class,
+ * see zone_magazine_class_capacity().
+ */
+#define ZONE_MAG_CLASS_COUNT    4
+static SECURITY_READ_ONLY_LATE(zone_t) zc_magazine_zone[ZONE_MAG_CLASS_COUNT];
 /*
  * Until pid1 is made, zone caching is off,
  * until compute_zone_working_set_size() runs for the firt time.
@@ -528,6 +590,10 @@ size_t zone_guard_pages;
 TUNABLE(int, zone_exhausted_timeout, "zet", 5000);
 static bool zone_share_always = true;
 static TUNABLE_WRITEABLE(uint32_t, zone_early_thres_mul, "zone_early_thres_mul", 5);
+#if ZALLOC_CLUSTER_POOLS
+/* keep partially used chunks in per-cluster pools, see zalloc_import() */
+static TUNABLE(bool, zone_cluster_pools, "zone_cluster_pools", true);
+#endif /* ZALLOC_CLUSTER_POOLS */
 
 #if VM_TAG_SIZECLASSES
 /*
@@ -573,6 +639,13 @@ static int zalloc_simulate_vm_pressure;
  * zc_mag_size():
  *   size of magazines, larger to reduce contention at the expense of memory
  *
+ * zc_mag_grow_max
+ *   how many times the magazines of a zone can double in size when
+ *   its per-cpu depots can't grow anymore and it is still contended.
+ *   (at most ZONE_MAG_CLASS_COUNT - 1).
+ *
+ *   0 to disable.
+ *
  * zc_enable_level
  *   number of contentions per second after which zone caching engages
  *   automatically.
@@ -608,6 +681,7 @@ static int zalloc_simulate_vm_pressure;
  *   the zone lock held (and preemption disabled).
  */
 Z_TUNABLE(uint16_t, zc_mag_size, 8);
+static Z_TUNABLE(uint32_t, zc_mag_grow_max, ZONE_MAG_CLASS_COUNT - 1);
 static Z_TUNABLE(uint32_t, zc_enable_level, 10);
 static Z_TUNABLE(uint32_t, zc_grow_level, 5 * Z_WMA_UNIT);
 static Z_TUNABLE(uint32_t, zc_shrink_level, Z_WMA_UNIT / 2);
@@ -970,6 +1044,14 @@ zone_meta_to_addr(struct zone_page_metadata *meta)
 	return ptoa((int32_t)(meta - zone_info.zi_meta_base));
 }
 
+#if ZALLOC_CLUSTER_POOLS
+__header_always_inline uint8_t *
+zone_meta_cluster_ptr(struct zone_page_metadata *meta)
+{
+	return &zone_info.zi_cluster_base[zone_pva_from_meta(meta).packed_address];
+}
+#endif /* ZALLOC_CLUSTER_POOLS */
+
 __attribute__((overloadable))
 __header_always_inline void
 zone_meta_validate(zone_t z, struct zone_page_metadata *meta, vm_address_t addr)
@@ -1089,18 +1171,85 @@ zone_meta_unlock_from_partial(zone_t z, struct zone_page_metadata *m, uint32_t l
 	}
 }
 
+/*!
+ * @function zone_cluster_owner
+ *
+ * @brief
+ * Returns the owner token of the current cluster for the page pools
+ * of a given zone, or 0 if the zone doesn't use cluster pools.
+ *
+ * @discussion
+ * Owner tokens are the cluster ID plus one, which is what is recorded
+ * for the head of chunks in @c zi_cluster_base, 0 meaning "no owner".
+ *
+ * Per-cpu zones and permanent zones don't use cluster pools.
+ */
+__header_always_inline uint32_t
+zone_cluster_owner(zone_t z)
+{
+#if ZALLOC_CLUSTER_POOLS
+	processor_set_t pset;
+
+	if (zone_info.zi_cluster_base == NULL || z->z_percpu || z->z_permanent) {
+		return 0;
+	}
+	pset = current_processor()->processor_set;
+	return pset ? pset->pset_cluster_id + 1 : 0;
+#else
+#pragma unused(z)
+	return 0;
+#endif /* ZALLOC_CLUSTER_POOLS */
+}
+
+/* the queue of partially used chunks for a given owner token */
+__header_always_inline zone_pva_t *
+zone_pageq_partial(zone_t z, uint32_t owner)
+{
+#if ZALLOC_CLUSTER_POOLS
+	if (owner) {
+		return &z->z_pageq_local[owner - 1];
+	}
+#else
+#pragma unused(owner)
+#endif /* ZALLOC_CLUSTER_POOLS */
+	return &z->z_pageq_partial;
+}
+
+__header_always_inline uint32_t
+zone_meta_cluster(struct zone_page_metadata *meta)
+{
+#if ZALLOC_CLUSTER_POOLS
+	if (zone_info.zi_cluster_base) {
+		return *zone_meta_cluster_ptr(meta);
+	}
+#else
+#pragma unused(meta)
+#endif /* ZALLOC_CLUSTER_POOLS */
+	return 0;
+}
+
+__header_always_inline void
+zone_meta_set_cluster(struct zone_page_metadata *meta, uint32_t owner)
+{
+#if ZALLOC_CLUSTER_POOLS
+	if (owner) {
+		*zone_meta_cluster_ptr(meta) = (uint8_t)owner;
+	}
+#else
+#pragma unused(meta, owner)
+#endif /* ZALLOC_CLUSTER_POOLS */
+}
+
 /*
  * Routine to populate a page backing metadata in the zone_metadata_region.
  * Must be called without the zone lock held as it might potentially block.
  */
 static void
-zone_meta_populate(vm_offset_t base, vm_size_t size)
+zone_meta_populate_range(vm_offset_t from, vm_offset_t to)
 {
-	struct zone_page_metadata *from = zone_meta_from_addr(base);
-	struct zone_page_metadata *to   = from + atop(size);
 	vm_offset_t page_addr = trunc_page(from);
 
-	for (; page_addr < (vm_offset_t)to; page_addr += PAGE_SIZE) {
+	for (; page_addr < to; page_addr += PAGE_SIZE) {
 #if !KASAN
 		/*
 		 * This can race with another thread doing a populate on the same metadata
@@ -1142,6 +1291,23 @@ zone_meta_populate(vm_offset_t base, vm_size_t size)
 	}
 }
 
+static void
+zone_meta_populate(vm_offset_t base, vm_size_t size)
+{
+	struct zone_page_metadata *from = zone_meta_from_addr(base);
+	struct zone_page_metadata *to   = from + atop(size);
+
+	zone_meta_populate_range((vm_offset_t)from, (vm_offset_t)to);
+#if ZALLOC_CLUSTER_POOLS
+	if (zone_info.zi_cluster_base) {
+		uint8_t *owner = zone_meta_cluster_ptr(from);
+
+		zone_meta_populate_range((vm_offset_t)owner,
+		    (vm_offset_t)(owner + atop(size)));
+	}
+#endif /* ZALLOC_CLUSTER_POOLS */
+}
+
 __abortlike
 static void
 zone_invalid_element_panic(zone_t zone, vm_offset_t addr)
@@ -2371,7 +2537,7 @@ zstack_pop(zstack_t *stack)
 }
 
 static inline void
-zone_recirc_lock_nopreempt_check_contention(zone_t zone)
+zone_recirc_lock_nopreempt_check_contention(zone_t zone, zone_cache_t cache)
 {
 	uint32_t ticket;
 
@@ -2381,6 +2547,7 @@ zone_recirc_lock_nopreempt_check_contention(zone_t zone)
 	}
 
 	hw_lck_ticket_wait(&zone->z_recirc_lock, ticket, NULL, &zone_locks_grp);
+	cache->zc_depot_contended++;
 
 	/*
 	 * If zone caching has been disabled due to memory pressure,
@@ -2553,6 +2720,56 @@ zone_submaps_approx_size(void)
 	return size;
 }
 
+#define ZONE_MAG_HDR_WORDS  (sizeof(struct zone_magazine) / sizeof(vm_offset_t))
+
+/*!
+ * @function zone_magazine_class_capacity
+ *
+ * @brief
+ * Returns how many elements the magazines of a given size class hold.
+ *
+ * @discussion
+ * Class 0 magazines hold @c zc_mag_size() elements, and each class above
+ * doubles the size of the magazine allocation (header included), so that
+ * magazines sized to fill cachelines keep doing so.
+ */
+__pure2
+static inline uint16_t
+zone_magazine_class_capacity(uint32_t mclass)
+{
+	return (uint16_t)(((zc_mag_size() + ZONE_MAG_HDR_WORDS) << mclass) -
+	       ZONE_MAG_HDR_WORDS);
+}
+
+/*!
+ * @function zone_magazine_class
+ *
+ * @brief
+ * Returns the size class of a magazine.
+ *
+ * @discussion
+ * zone_init() creates the magazine zones with consecutive zone IDs,
+ * in class order.
+ */
+static inline uint32_t
+zone_magazine_class(zone_magazine_t mag)
+{
+	return zone_index_from_ptr(mag) - zone_index(zc_magazine_zone[0]);
+}
+
+static inline uint16_t
+zone_magazine_capacity(zone_magazine_t mag)
+{
+	return zone_magazine_class_capacity(zone_magazine_class(mag));
+}
+
+static inline zone_magazine_t
+zone_magazine_from_elems(vm_offset_t *elems)
+{
+	return (zone_magazine_t)((uintptr_t)elems -
+	       offsetof(struct zone_magazine, zm_elems));
+}
+
 static inline void
 zone_depot_init(struct zone_depot *zd)
 {
@@ -2567,6 +2784,7 @@ zone_depot_insert_head_full(struct zone_depot *zd, zone_magazine_t mag)
 	if (zd->zd_full++ == 0) {
 		zd->zd_tail = &mag->zm_next;
 	}
+	zd->zd_elems += zone_magazine_capacity(mag);
 	mag->zm_next = zd->zd_head;
 	zd->zd_head = mag;
 }
@@ -2575,6 +2793,7 @@ static inline void
 zone_depot_insert_tail_full(struct zone_depot *zd, zone_magazine_t mag)
 {
 	zd->zd_full++;
+	zd->zd_elems += zone_magazine_capacity(mag);
 	mag->zm_next = *zd->zd_tail;
 	*zd->zd_tail = mag;
 	zd->zd_tail = &mag->zm_next;
@@ -2596,6 +2815,7 @@ zone_depot_pop_head_full(struct zone_depot *zd, zone_t z)
 	assert(zd->zd_full);
 
 	zd->zd_full--;
+	zd->zd_elems -= zone_magazine_capacity(mag);
 	if (z && z->z_recirc_full_min > zd->zd_full) {
 		z->z_recirc_full_min = zd->zd_full;
 	}
@@ -2633,6 +2853,7 @@ zone_depot_move_full(
 	zone_t                  z)
 {
 	zone_magazine_t head, last;
+	uint32_t elems;
 
 	assert(n);
 	assert(src->zd_full >= n);
@@ -2642,9 +2863,13 @@ zone_depot_move_full(
 		z->z_recirc_full_min = src->zd_full;
 	}
 	head = last = src->zd_head;
+	elems = zone_magazine_capacity(head);
 	for (uint32_t i = n; i-- > 1;) {
 		last = last->zm_next;
+		elems += zone_magazine_capacity(last);
 	}
+	src->zd_elems -= elems;
+	dst->zd_elems += elems;
 
 	src->zd_head = last->zm_next;
 	if (src->zd_full == 0) {
@@ -2710,14 +2935,18 @@ zone_cache_swap_magazines(zone_cache_t cache)
 {
 	uint16_t count_a = cache->zc_alloc_cur;
 	uint16_t count_f = cache->zc_free_cur;
+	uint16_t cap_a = cache->zc_alloc_cap;
+	uint16_t cap_f = cache->zc_free_cap;
 	vm_offset_t *elems_a = cache->zc_alloc_elems;
 	vm_offset_t *elems_f = cache->zc_free_elems;
 
-	z_debug_assert(count_a <= zc_mag_size());
-	z_debug_assert(count_f <= zc_mag_size());
+	z_debug_assert(count_a <= cap_a);
+	z_debug_assert(count_f <= cap_f);
 
 	cache->zc_alloc_cur = count_f;
 	cache->zc_free_cur = count_a;
+	cache->zc_alloc_cap = cap_f;
+	cache->zc_free_cap = cap_a;
 	cache->zc_alloc_elems = elems_f;
 	cache->zc_free_elems = elems_a;
 }
@@ -2744,29 +2973,91 @@ zone_magazine_replace(zone_cache_t zc, zone_magazine_t mag, bool empty)
 	mag->zm_seq = SMR_SEQ_INVALID;
 
 	if (empty) {
+		z_debug_assert(zc->zc_free_cur == zc->zc_free_cap);
 		elems = &zc->zc_free_elems;
 		zc->zc_free_cur = 0;
+		zc->zc_free_cap = zone_magazine_capacity(mag);
 	} else {
+		z_debug_assert(zc->zc_alloc_cur == 0);
 		elems = &zc->zc_alloc_elems;
-		zc->zc_alloc_cur = zc_mag_size();
+		zc->zc_alloc_cur = zone_magazine_capacity(mag);
+		zc->zc_alloc_cap = zc->zc_alloc_cur;
 	}
-	old = (zone_magazine_t)((uintptr_t)*elems -
-	    offsetof(struct zone_magazine, zm_elems));
+	old = zone_magazine_from_elems(*elems);
 	*elems = mag->zm_elems;
 
 	return old;
 }
 
 static zone_magazine_t
-zone_magazine_alloc(zalloc_flags_t flags)
+zone_magazine_alloc(uint32_t mclass, zalloc_flags_t flags)
 {
-	return zalloc_flags(zc_magazine_zone, flags | Z_ZERO);
+	return zalloc_flags(zc_magazine_zone[mclass], flags | Z_ZERO);
 }
 
 static void
 zone_magazine_free(zone_magazine_t mag)
 {
-	(zfree)(zc_magazine_zone, mag);
+	(zfree)(zc_magazine_zone[zone_magazine_class(mag)], mag);
+}
+
+static bool
+zone_is_magazine_zone(zone_t z)
+{
+	for (uint32_t i = 0; i < ZONE_MAG_CLASS_COUNT; i++) {
+		if (z == zc_magazine_zone[i]) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*!
+ * @function zone_magazine_load_empty
+ *
+ * @brief
+ * Load an empty magazine as the (f) magazine, and return the full one
+ * it replaces.
+ *
+ * @discussion
+ * If the magazine isn't of the size class the zone uses now, trade it
+ * for one that is: this is how magazines of the previous class go away
+ * after the zone was resized. If that fails, the old magazine will do.
+ *
+ * Magazine zones have no caching layer and their lock is a leaf,
+ * so this is safe to call with the depot or recirculation locks held.
+ */
+static zone_magazine_t
+zone_magazine_load_empty(zone_t zone, zone_cache_t zc, zone_magazine_t mag)
+{
+	uint32_t mclass = os_atomic_load(&zone->z_mag_class, relaxed);
+
+	if (__improbable(zone_magazine_class(mag) != mclass)) {
+		zone_magazine_t tmp = zone_magazine_alloc(mclass, Z_NOWAIT);
+
+		if (tmp) {
+			zone_magazine_free(mag);
+			mag = tmp;
+		}
+	}
+
+	return zone_magazine_replace(zc, mag, true);
+}
+
+/*!
+ * @function zone_depot_limit
+ *
+ * @brief
+ * How many magazines of a given class a per-cpu depot can hold
+ * without caching more than @c zc_pcpu_max() bytes.
+ */
+static uint16_t
+zone_depot_limit(zone_t zone, uint32_t mclass)
+{
+	size_t size_per_mag = zone_elem_inner_size(zone) *
+	    zone_magazine_class_capacity(mclass);
+
+	return (uint16_t)MIN(zc_pcpu_max() / size_per_mag, INT16_MAX);
 }
 
 static void
@@ -2787,17 +3078,17 @@ zone_magazine_free_list(struct zone_depot *zd)
 void
 zone_enable_caching(zone_t zone)
 {
-	size_t size_per_mag = zone_elem_inner_size(zone) * zc_mag_size();
+	uint16_t cap = zone_magazine_class_capacity(0);
 	zone_cache_t caches;
-	size_t depot_limit;
 
-	depot_limit = zc_pcpu_max() / size_per_mag;
-	zone->z_depot_limit = (uint16_t)MIN(depot_limit, INT16_MAX);
+	zone->z_depot_limit = zone_depot_limit(zone, 0);
 
 	caches = zalloc_percpu_permanent_type(struct zone_cache);
 	zpercpu_foreach(zc, caches) {
-		zc->zc_alloc_elems = zone_magazine_alloc(Z_WAITOK | Z_NOFAIL)->zm_elems;
-		zc->zc_free_elems = zone_magazine_alloc(Z_WAITOK | Z_NOFAIL)->zm_elems;
+		zc->zc_alloc_elems = zone_magazine_alloc(0, Z_WAITOK | Z_NOFAIL)->zm_elems;
+		zc->zc_free_elems = zone_magazine_alloc(0, Z_WAITOK | Z_NOFAIL)->zm_elems;
+		zc->zc_alloc_cap = cap;
+		zc->zc_free_cap = cap;
 		zone_depot_init(&zc->zc_depot);
 		hw_lck_ticket_init(&zc->zc_depot_lock, &zone_locks_grp);
 	}
@@ -2807,6 +3098,7 @@ zone_enable_caching(zone_t zone)
 	zone->z_pcpu_cache = caches;
 	zone->z_recirc_cont_cur = 0;
 	zone->z_recirc_cont_wma = 0;
+	zone->z_mag_class = 0;
 	zone->z_elems_free_min = 0; /* becomes z_recirc_empty_min */
 	zone->z_elems_free_wma = 0; /* becomes z_recirc_empty_wma */
 	zone_unlock(zone);
@@ -3753,6 +4045,29 @@ zfree_log(zone_t zone, vm_offset_t addr, uint32_t count, void *fp)
  * queues are preferred.
  *
  *
+ * <h2>Cluster pools</h2>
+ *
+ * On AMP systems with several clusters, the partially used chunks of zones
+ * are further split in one @c z_pageq_local queue per cluster, so that
+ * a cluster refilling its caches gets elements from chunks it has been
+ * using recently, and that are likely hot in its cache.
+ *
+ * The cluster owning a chunk is recorded for its head in a byte array
+ * parallel to the page metadata (@c zi_cluster_base), since the metadata
+ * itself has no room left. A chunk is owned by the last cluster that
+ * took elements out of it, and goes back to its owner's queue when it
+ * stops being full.
+ *
+ * @c zalloc_import() looks at the current cluster's queue, then at
+ * @c z_pageq_partial (chunks nobody owns), then at @c z_pageq_empty,
+ * and steals chunks from other clusters last. Frees from other clusters
+ * than the owner and steals are counted in @c z_cluster_xfrees and
+ * @c z_cluster_steals respectively.
+ *
+ * Per-cpu and permanent zones don't use cluster pools, and they can
+ * be disabled with the @c zone_cluster_pools=0 boot-arg.
+ *
+ *
  * <h2>Asynchronous expansion</h2>
  *
  * This mechanism allows for refilling zones used mostly with non blocking
@@ -4675,7 +4990,8 @@ zalloc_expand_drain_exhausted_caches_locked(zone_t z)
 	zone_recirc_unlock_nopreempt(z);
 
 	if (mag) {
-		zone_reclaim_elements(z, zc_mag_size(), mag->zm_elems);
+		zone_reclaim_elements(z, zone_magazine_capacity(mag),
+		    mag->zm_elems);
 		zone_magazine_free(mag);
 	}
 
@@ -5752,12 +6068,37 @@ panic_display_pgz_uaf_info(bool has_syms, vm_offset_t addr)
  * will eventually go through the @c zfree_ext() choking point.
  */
 
+/*
+ * Returns the owner token of the chunk an element is freed to,
+ * and counts the frees made from another cluster than that owner.
+ */
+__header_always_inline uint32_t
+zfree_drop_owner(zone_t zone, struct zone_page_metadata *meta)
+{
+#if ZALLOC_CLUSTER_POOLS
+	uint32_t cur = zone_cluster_owner(zone);
+	uint32_t owner = 0;
+
+	if (cur) {
+		owner = zone_meta_cluster(meta);
+		if (owner && owner != cur) {
+			zone->z_cluster_xfrees++;
+		}
+	}
+	return owner;
+#else
+#pragma unused(zone, meta)
+	return 0;
+#endif /* ZALLOC_CLUSTER_POOLS */
+}
+
 __header_always_inline void
 zfree_drop(zone_t zone, vm_offset_t addr)
 {
 	vm_offset_t esize = zone_elem_outer_size(zone);
 	struct zone_page_metadata *meta;
 	vm_offset_t eidx;
+	uint32_t owner;
 
 	meta = zone_element_resolve(zone, addr, &eidx);
 
@@ -5765,6 +6106,8 @@ zfree_drop(zone_t zone, vm_offset_t addr)
 		zone_meta_double_free_panic(zone, addr, __func__);
 	}
 
+	owner = zfree_drop_owner(zone, meta);
+
 	vm_offset_t old_size = meta->zm_alloc_size;
 	vm_offset_t max_size = ptoa(meta->zm_chunk_len) + ZM_ALLOC_SIZE_LOCK;
 	vm_offset_t new_size = zone_meta_alloc_size_sub(zone, meta, esize);
@@ -5774,8 +6117,8 @@ zfree_drop(zone_t zone, vm_offset_t addr)
 		zone_meta_requeue(zone, &zone->z_pageq_empty, meta);
 		zone->z_wired_empty += meta->zm_chunk_len;
 	} else if (old_size + esize > max_size) {
-		/* first free element on page, move from all_used */
-		zone_meta_requeue(zone, &zone->z_pageq_partial, meta);
+		/* first free element on page, move from all_used to its owner's pool */
+		zone_meta_requeue(zone, zone_pageq_partial(zone, owner), meta);
 	}
 
 	if (__improbable(zone->z_exhausted_wait)) {
@@ -5806,7 +6149,7 @@ zfree_cached_depot_recirculate(
 	smr_seq_t seq;
 	uint32_t n;
 
-	zone_recirc_lock_nopreempt_check_contention(zone);
+	zone_recirc_lock_nopreempt_check_contention(zone, cache);
 
 	n = cache->zc_depot.zd_full;
 	if (n >= depot_max) {
@@ -5847,18 +6190,20 @@ zfree_cached_recirculate(zone_t zone, zone_cache_t cache)
 	smr_t smr = zone_cache_smr(cache);
 	bool wakeup_exhausted = false;
 
+	cache->zc_depot_misses++;
 	if (zone->z_recirc.zd_empty == 0) {
-		mag = zone_magazine_alloc(Z_NOWAIT);
+		mag = zone_magazine_alloc(os_atomic_load(&zone->z_mag_class,
+		    relaxed), Z_NOWAIT);
 	}
 
-	zone_recirc_lock_nopreempt_check_contention(zone);
+	zone_recirc_lock_nopreempt_check_contention(zone, cache);
 
 	if (mag == NULL && zone->z_recirc.zd_empty) {
 		mag = zone_depot_pop_head_empty(&zone->z_recirc, zone);
 		__builtin_assume(mag);
 	}
 	if (mag) {
-		tmp = zone_magazine_replace(cache, mag, true);
+		tmp = zone_magazine_load_empty(zone, cache, mag);
 		if (smr) {
 			smr_deferred_advance_commit(smr, tmp->zm_seq);
 		}
@@ -5896,17 +6241,21 @@ zfree_cached_trim(zone_t zone, zone_cache_t cache)
 		zone_depot_lock_nopreempt(cache);
 
 		if (cache->zc_depot.zd_empty == 0) {
+			cache->zc_depot_misses++;
 			zfree_cached_depot_recirculate(zone, depot_max, cache);
+		} else {
+			cache->zc_depot_hits++;
 		}
 
 		if (__probable(cache->zc_depot.zd_empty)) {
 			mag = zone_depot_pop_head_empty(&cache->zc_depot, NULL);
 			__builtin_assume(mag);
 		} else {
-			mag = zone_magazine_alloc(Z_NOWAIT);
+			mag = zone_magazine_alloc(os_atomic_load(&zone->z_mag_class,
+			    relaxed), Z_NOWAIT);
 		}
 		if (mag) {
-			tmp = zone_magazine_replace(cache, mag, true);
+			tmp = zone_magazine_load_empty(zone, cache, mag);
 			zone_depot_insert_tail_full(&cache->zc_depot, tmp);
 		}
 
@@ -5924,11 +6273,11 @@ zfree_cached_get_pcpu_cache(zone_t zone, int cpu)
 {
 	zone_cache_t cache = zpercpu_get_cpu(zone->z_pcpu_cache, cpu);
 
-	if (__probable(cache->zc_free_cur < zc_mag_size())) {
+	if (__probable(cache->zc_free_cur < cache->zc_free_cap)) {
 		return cache;
 	}
 
-	if (__probable(cache->zc_alloc_cur < zc_mag_size())) {
+	if (__probable(cache->zc_alloc_cur < cache->zc_alloc_cap)) {
 		zone_cache_swap_magazines(cache);
 		return cache;
 	}
@@ -5943,7 +6292,7 @@ zfree_cached_get_pcpu_cache_smr(zone_t zone, int cpu)
 	zone_cache_t cache = zpercpu_get_cpu(zone->z_pcpu_cache, cpu);
 	size_t idx = cache->zc_free_cur;
 
-	if (__probable(idx + 1 < zc_mag_size())) {
+	if (__probable(idx + 1 < cache->zc_free_cap)) {
 		return cache;
 	}
 
@@ -5960,11 +6309,10 @@ zfree_cached_get_pcpu_cache_smr(zone_t zone, int cpu)
 	 * mechanically reduces the pace of these commits as usage increases.
 	 */
 
-	if (__probable(idx + 1 == zc_mag_size())) {
+	if (__probable(idx + 1 == cache->zc_free_cap)) {
 		zone_magazine_t mag;
 
-		mag = (zone_magazine_t)((uintptr_t)cache->zc_free_elems -
-		    offsetof(struct zone_magazine, zm_elems));
+		mag = zone_magazine_from_elems(cache->zc_free_elems);
 		mag->zm_seq = smr_deferred_advance(zone_cache_smr(cache));
 		return cache;
 	}
@@ -6095,7 +6443,7 @@ zcache_free_stack_to_cpu(
 	zone_cache_ops_t        ops,
 	bool                    zero)
 {
-	size_t       n = MIN(zc_mag_size() - cache->zc_free_cur, stack.z_count);
+	size_t       n = MIN(cache->zc_free_cap - cache->zc_free_cur, stack.z_count);
 	vm_offset_t *p;
 
 	stack.z_count -= n;
@@ -6161,10 +6509,14 @@ static inline void
 zcache_free_n_ext(zone_id_t zid, zstack_t stack, zone_cache_ops_t ops, bool zero)
 {
 	zone_t zone = zone_by_id(zid);
-	zone_cache_t cache;
+	zone_cache_t cache = NULL;
 	vm_size_t esize;
 	int cpu;
 
+	if (__improbable(stack.z_count == 0)) {
+		return;
+	}
+
 	ZFREE_LOG(zone, stack.z_head, stack.z_count);
 
 	disable_preemption();
@@ -6174,7 +6526,14 @@ zcache_free_n_ext(zone_id_t zid, zstack_t stack, zone_cache_ops_t ops, bool zero
 	    stack.z_count * esize;
 
 	for (;;) {
-		cache = zfree_cached_get_pcpu_cache(zone, cpu);
+		/*
+		 * Elements are moved a magazine at a time: each pass fills
+		 * what is left of the per-cpu free magazine in a single
+		 * preemption disabled section.
+		 */
+		if (__probable(zone->z_pcpu_cache)) {
+			cache = zfree_cached_get_pcpu_cache(zone, cpu);
+		}
 		if (__probable(cache)) {
 			stack = zcache_free_stack_to_cpu(zid, cache,
 			    stack, esize, ops, zero);
@@ -6404,6 +6763,47 @@ kfree_type_impl_internal(
  * common treatment (zone logging, tags, kasan, validation, ...).
  */
 
+/*!
+ * @function zalloc_import_queue
+ *
+ * @brief
+ * Picks the queue of chunks @c zalloc_import() takes elements from next.
+ *
+ * @discussion
+ * Partially used chunks are preferred over empty ones to limit fragmentation,
+ * and on AMP systems, the chunks owned by the current cluster are preferred
+ * over the ones nobody owns.
+ *
+ * Chunks owned by other clusters are only stolen when there is no other
+ * choice: they are likely hot in the cache of their owner, which will
+ * come back for them.
+ */
+__header_always_inline zone_pva_t *
+zalloc_import_queue(zone_t zone, uint32_t owner)
+{
+	zone_pva_t *queue = zone_pageq_partial(zone, owner);
+
+	if (!zone_pva_is_null(*queue)) {
+		return queue;
+	}
+	if (!zone_pva_is_null(zone->z_pageq_partial)) {
+		return &zone->z_pageq_partial;
+	}
+	if (!zone_pva_is_null(zone->z_pageq_empty)) {
+		return &zone->z_pageq_empty;
+	}
+#if ZALLOC_CLUSTER_POOLS
+	for (uint32_t i = 0; i < ZONE_CLUSTER_COUNT; i++) {
+		queue = &zone->z_pageq_local[(owner + i) % ZONE_CLUSTER_COUNT];
+		if (!zone_pva_is_null(*queue)) {
+			zone->z_cluster_steals++;
+			return queue;
+		}
+	}
+#endif /* ZALLOC_CLUSTER_POOLS */
+	zone_accounting_panic(zone, "z_elems_free corruption");
+}
+
 /*!
  * @function zalloc_import
  *
@@ -6426,6 +6826,8 @@ zalloc_import(
 	vm_offset_t offs  = zone_elem_inner_offs(zone);
 	zone_stats_t zs;
 	int cpu = cpu_number();
+	uint32_t owner = zone_cluster_owner(zone);
+	zone_pva_t *local = zone_pageq_partial(zone, owner);
 	uint32_t i = 0;
 
 	zs = zpercpu_get_cpu(zone->z_stats, cpu);
@@ -6442,16 +6844,12 @@ zalloc_import(
 	do {
 		vm_offset_t page, eidx, size = 0;
 		struct zone_page_metadata *meta;
+		zone_pva_t *queue = zalloc_import_queue(zone, owner);
 
-		if (!zone_pva_is_null(zone->z_pageq_partial)) {
-			meta = zone_pva_to_meta(zone->z_pageq_partial);
-			page = zone_pva_to_addr(zone->z_pageq_partial);
-		} else if (!zone_pva_is_null(zone->z_pageq_empty)) {
-			meta = zone_pva_to_meta(zone->z_pageq_empty);
-			page = zone_pva_to_addr(zone->z_pageq_empty);
+		meta = zone_pva_to_meta(*queue);
+		page = zone_pva_to_addr(*queue);
+		if (queue == &zone->z_pageq_empty) {
 			zone_counter_sub(zone, z_wired_empty, meta->zm_chunk_len);
-		} else {
-			zone_accounting_panic(zone, "z_elems_free corruption");
 		}
 
 		zone_meta_validate(zone, meta, page);
@@ -6467,11 +6865,15 @@ zalloc_import(
 
 		vm_offset_t new_size = zone_meta_alloc_size_add(zone, meta, size);
 
+		if (queue != local) {
+			/* the chunk now belongs to the current cluster */
+			zone_meta_set_cluster(meta, owner);
+		}
 		if (new_size + esize > max_size) {
 			zone_meta_requeue(zone, &zone->z_pageq_full, meta);
-		} else if (old_size == 0) {
-			/* remove from free, move to intermediate */
-			zone_meta_requeue(zone, &zone->z_pageq_partial, meta);
+		} else if (queue != local) {
+			/* remove from free (or another pool), move to intermediate */
+			zone_meta_requeue(zone, local, meta);
 		}
 	} while (i < n);
 
@@ -6651,7 +7053,7 @@ zalloc_cached_import(
 	zalloc_flags_t          flags,
 	zone_cache_t            cache)
 {
-	uint16_t n_elems = zc_mag_size();
+	uint16_t n_elems = cache->zc_alloc_cap;
 
 	zone_lock_nopreempt(zone);
 
@@ -6680,7 +7082,7 @@ zalloc_cached_depot_recirculate(
 	smr_seq_t seq;
 	uint32_t n;
 
-	zone_recirc_lock_nopreempt_check_contention(zone);
+	zone_recirc_lock_nopreempt_check_contention(zone, cache);
 
 	n = cache->zc_depot.zd_empty;
 	if (n >= depot_max) {
@@ -6719,7 +7121,7 @@ zalloc_cached_reuse_smr(zone_t z, zone_cache_t cache, zone_magazine_t mag)
 	zone_smr_free_cb_t zc_free = cache->zc_free;
 	vm_size_t esize = zone_elem_inner_size(z);
 
-	for (uint16_t i = 0; i < zc_mag_size(); i++) {
+	for (uint16_t i = 0; i < zone_magazine_capacity(mag); i++) {
 		vm_offset_t elem = mag->zm_elems[i];
 
 		zc_free((void *)elem, zone_elem_inner_size(z));
@@ -6736,7 +7138,7 @@ zalloc_cached_recirculate(
 {
 	zone_magazine_t mag = NULL;
 
-	zone_recirc_lock_nopreempt_check_contention(zone);
+	zone_recirc_lock_nopreempt_check_contention(zone, cache);
 
 	if (zone_depot_poll(&zone->z_recirc, zone_cache_smr(cache))) {
 		mag = zone_depot_pop_head_full(&zone->z_recirc, zone);
@@ -6768,7 +7170,10 @@ zalloc_cached_prime(
 
 		zone_depot_lock_nopreempt(cache);
 
-		if (!zone_depot_poll(&cache->zc_depot, smr)) {
+		if (zone_depot_poll(&cache->zc_depot, smr)) {
+			cache->zc_depot_hits++;
+		} else {
+			cache->zc_depot_misses++;
 			zalloc_cached_depot_recirculate(zone, depot_max, cache,
 			    smr);
 		}
@@ -6783,8 +7188,11 @@ zalloc_cached_prime(
 		}
 
 		zone_depot_unlock_nopreempt(cache);
-	} else if (zone->z_recirc.zd_full) {
-		zalloc_cached_recirculate(zone, cache);
+	} else {
+		cache->zc_depot_misses++;
+		if (zone->z_recirc.zd_full) {
+			zalloc_cached_recirculate(zone, cache);
+		}
 	}
 
 	if (__probable(cache->zc_alloc_cur)) {
@@ -7014,10 +7422,14 @@ zcache_alloc_n_ext(
 	zone_cache_ops_t        ops)
 {
 	zstack_t stack = { };
-	zone_cache_t cache;
+	zone_cache_t cache = NULL;
 	zone_t zone;
 	int cpu;
 
+	if (__improbable(count == 0)) {
+		return stack;
+	}
+
 	disable_preemption();
 	cpu  = cpu_number();
 	zone = zone_by_id(zid);
@@ -7025,7 +7437,14 @@ zcache_alloc_n_ext(
 	    count * zone_elem_inner_size(zone);
 
 	for (;;) {
-		cache = zalloc_cached_get_pcpu_cache(zone, ops, cpu, flags);
+		/*
+		 * Elements are moved a magazine at a time: each pass empties
+		 * what it needs of the per-cpu alloc magazine in a single
+		 * preemption disabled section.
+		 */
+		if (__probable(zone->z_pcpu_cache)) {
+			cache = zalloc_cached_get_pcpu_cache(zone, ops, cpu, flags);
+		}
 		if (__probable(cache)) {
 			stack = zcache_alloc_stack_from_cpu(zid, cache, stack,
 			    count - stack.z_count, ops);
@@ -7573,7 +7992,7 @@ zone_reclaim_chunk(
 static void
 zone_reclaim_elements(zone_t z, uint16_t n, vm_offset_t *elems)
 {
-	z_debug_assert(n <= zc_mag_size());
+	z_debug_assert(n <= zone_magazine_class_capacity(ZONE_MAG_CLASS_COUNT - 1));
 
 	for (uint16_t i = 0; i < n; i++) {
 		vm_offset_t addr = elems[i];
@@ -7587,7 +8006,7 @@ zone_reclaim_elements(zone_t z, uint16_t n, vm_offset_t *elems)
 static void
 zcache_reclaim_elements(zone_id_t zid, uint16_t n, vm_offset_t *elems)
 {
-	z_debug_assert(n <= zc_mag_size());
+	z_debug_assert(n <= zone_magazine_class_capacity(ZONE_MAG_CLASS_COUNT - 1));
 	zone_cache_ops_t ops = zcache_ops[zid];
 
 	for (uint16_t i = 0; i < n; i++) {
@@ -7816,17 +8235,19 @@ zone_reclaim(zone_t z, zone_reclaim_mode_t mode)
 			smr_t smr = zone_cache_smr(cache);
 
 			while (zd.zd_full) {
+				uint16_t n;
+
 				mag = zone_depot_pop_head_full(&zd, NULL);
+				n = zone_magazine_capacity(mag);
 				if (smr) {
 					smr_wait(smr, mag->zm_seq);
 					zalloc_cached_reuse_smr(z, cache, mag);
-					freed += zc_mag_size();
+					freed += n;
 				}
-				zone_reclaim_elements(z, zc_mag_size(),
-				    mag->zm_elems);
+				zone_reclaim_elements(z, n, mag->zm_elems);
 				zone_depot_insert_head_empty(&zd, mag);
 
-				freed += zc_mag_size();
+				freed += n;
 				if (freed >= zc_free_batch_size()) {
 					zone_unlock(z);
 					zone_magazine_free_list(&zd);
@@ -7844,8 +8265,8 @@ zone_reclaim(zone_t z, zone_reclaim_mode_t mode)
 
 			while (zd.zd_full) {
 				mag = zone_depot_pop_head_full(&zd, NULL);
-				zcache_reclaim_elements(zid, zc_mag_size(),
-				    mag->zm_elems);
+				zcache_reclaim_elements(zid,
+				    zone_magazine_capacity(mag), mag->zm_elems);
 				zone_magazine_free(mag);
 			}
 
@@ -7914,7 +8335,7 @@ zone_reclaim_all(zone_reclaim_mode_t mode)
 	zone_index_foreach(zid) {
 		zone_t z = zone_by_id(zid);
 
-		if (z == zc_magazine_zone || z->z_chunk_elems == 0) {
+		if (zone_is_magazine_zone(z) || z->z_chunk_elems == 0) {
 			continue;
 		}
 		if (zone_submap_is_sequestered(zone_security_array[zid]) &&
@@ -7926,7 +8347,7 @@ zone_reclaim_all(zone_reclaim_mode_t mode)
 	zone_index_foreach(zid) {
 		zone_t z = zone_by_id(zid);
 
-		if (z == zc_magazine_zone || z->z_chunk_elems == 0) {
+		if (zone_is_magazine_zone(z) || z->z_chunk_elems == 0) {
 			continue;
 		}
 		if (!zone_submap_is_sequestered(zone_security_array[zid]) &&
@@ -7935,7 +8356,9 @@ zone_reclaim_all(zone_reclaim_mode_t mode)
 		}
 	}
 
-	zone_reclaim(zc_magazine_zone, mode);
+	for (uint32_t i = 0; i < ZONE_MAG_CLASS_COUNT; i++) {
+		zone_reclaim(zc_magazine_zone[i], mode);
+	}
 }
 
 void
@@ -8010,6 +8433,7 @@ zone_trim_needed(zone_t z)
 	}
 
 	if (z->z_pcpu_cache) {
+		uint32_t mag_size = zone_magazine_class_capacity(z->z_mag_class);
 		uint32_t e_n, f_n;
 
 		e_n = MIN(z->z_recirc_empty_wma, z->z_recirc_empty_min * Z_WMA_UNIT);
@@ -8019,8 +8443,8 @@ zone_trim_needed(zone_t z)
 			return true;
 		}
 
-		if (f_n * zc_mag_size() > z->z_elems_rsv * Z_WMA_UNIT &&
-		    f_n * zc_mag_size() * zone_elem_inner_size(z) >
+		if (f_n * mag_size > z->z_elems_rsv * Z_WMA_UNIT &&
+		    f_n * mag_size * zone_elem_inner_size(z) >
 		    zc_autotrim_size() * Z_WMA_UNIT) {
 			return true;
 		}
@@ -8045,7 +8469,7 @@ zone_trim_async(__unused thread_call_param_t p0, __unused thread_call_param_t p1
 	current_thread()->options |= TH_OPT_ZONE_PRIV;
 
 	zone_foreach(z) {
-		if (!z->collectable || z == zc_magazine_zone) {
+		if (!z->collectable || zone_is_magazine_zone(z)) {
 			continue;
 		}
 
@@ -8056,15 +8480,59 @@ zone_trim_async(__unused thread_call_param_t p0, __unused thread_call_param_t p1
 		}
 	}
 
-	if (zone_trim_needed(zc_magazine_zone)) {
-		lck_mtx_lock(&zone_gc_lock);
-		zone_reclaim(zc_magazine_zone, ZONE_RECLAIM_TRIM);
-		lck_mtx_unlock(&zone_gc_lock);
+	for (uint32_t i = 0; i < ZONE_MAG_CLASS_COUNT; i++) {
+		if (zone_trim_needed(zc_magazine_zone[i])) {
+			lck_mtx_lock(&zone_gc_lock);
+			zone_reclaim(zc_magazine_zone[i], ZONE_RECLAIM_TRIM);
+			lck_mtx_unlock(&zone_gc_lock);
+		}
 	}
 
 	current_thread()->options &= ~TH_OPT_ZONE_PRIV;
 }
 
+/*!
+ * @function zone_resize_magazines
+ *
+ * @brief
+ * Moves a zone to a new magazine size class.
+ *
+ * @discussion
+ * The depot limit is recomputed so that the per-cpu layer keeps caching
+ * about the same amount of memory, which makes the depots shrink when
+ * the magazines grow.
+ *
+ * Magazines already in circulation aren't touched: full ones stay full at
+ * their own capacity, and empty ones get traded for magazines of the new
+ * class by @c zone_magazine_load_empty() when they are next used.
+ */
+static void
+zone_resize_magazines(zone_t z, uint32_t mclass)
+{
+	uint16_t limit = zone_depot_limit(z, mclass);
+
+	os_atomic_store(&z->z_mag_class, (uint8_t)mclass, relaxed);
+	z->z_mag_resizes++;
+	z->z_depot_limit = limit;
+	if (z->z_depot_size > limit) {
+		z->z_depot_size = limit;
+		z->z_depot_cleanup = true;
+	}
+}
+
+static bool
+zone_magazines_can_grow(zone_t z)
+{
+	uint32_t mclass = z->z_mag_class + 1;
+
+	if (mclass > MIN(zc_mag_grow_max(), ZONE_MAG_CLASS_COUNT - 1)) {
+		return false;
+	}
+
+	/* bigger magazines are pointless if the depots can't hold a couple */
+	return zone_depot_limit(z, mclass) >= 2;
+}
+
 void
 compute_zone_working_set_size(__unused void *param)
 {
@@ -8125,6 +8593,9 @@ compute_zone_working_set_size(__unused void *param)
 					z->z_depot_size = 0;
 					z->z_depot_cleanup = true;
 				}
+				if (z->z_mag_class) {
+					zone_resize_magazines(z, 0);
+				}
 			} else if (size < z->z_depot_limit && cur > zc_grow_level()) {
 				/*
 				 * lose history on purpose now
@@ -8134,6 +8605,15 @@ compute_zone_working_set_size(__unused void *param)
 				cur  = (zc_grow_level() + zc_shrink_level()) / 2;
 				size = size ? (3 * size + 2) / 2 : 2;
 				z->z_depot_size = MIN(z->z_depot_limit, size);
+			} else if (cur > zc_grow_level() && zone_magazines_can_grow(z)) {
+				/*
+				 * The depots are as large as they can be,
+				 * and the CPUs still fight over the
+				 * recirculation layer: make every trip there
+				 * move twice as many elements.
+				 */
+				cur = (zc_grow_level() + zc_shrink_level()) / 2;
+				zone_resize_magazines(z, z->z_mag_class + 1);
 			} else if (size > 0 && cur <= zc_shrink_level()) {
 				/*
 				 * lose history on purpose now
@@ -8143,6 +8623,13 @@ compute_zone_working_set_size(__unused void *param)
 				cur = (zc_grow_level() + zc_shrink_level()) / 2;
 				z->z_depot_size = size - 1;
 				z->z_depot_cleanup = true;
+			} else if (z->z_mag_class && cur <= zc_shrink_level()) {
+				/*
+				 * The depots are gone, step down
+				 * to smaller magazines as well.
+				 */
+				cur = (zc_grow_level() + zc_shrink_level()) / 2;
+				zone_resize_magazines(z, z->z_mag_class - 1);
 			}
 		} else if (!z->z_nocaching && !zone_exhaustible(z) && zc_auto &&
 		    old >= zc_auto && cur >= zc_auto) {
@@ -8514,7 +9001,7 @@ get_zone_info(
 	if (z->z_pcpu_cache) {
 		zpercpu_foreach(zc, z->z_pcpu_cache) {
 			cached += zc->zc_alloc_cur + zc->zc_free_cur;
-			cached += zc->zc_depot.zd_full * zc_mag_size();
+			cached += zc->zc_depot.zd_elems;
 		}
 	}
 	zone_unlock(z);
@@ -8959,6 +9446,109 @@ mach_zone_info_for_largest_zone(
 	return KERN_FAILURE;
 }
 
+static boolean_t
+get_zone_cache_info(
+	zone_t                   z,
+	mach_zone_cache_info_t  *zci)
+{
+	*zci = (mach_zone_cache_info_t){ };
+
+	zone_lock(z);
+	if (!z->z_self) {
+		zone_unlock(z);
+		return FALSE;
+	}
+	if (z->z_pcpu_cache) {
+		zci->mzci_mag_size = zone_magazine_class_capacity(z->z_mag_class);
+		zci->mzci_mag_resizes = z->z_mag_resizes;
+		zci->mzci_depot_size = z->z_depot_size;
+		zci->mzci_depot_limit = z->z_depot_limit;
+		zpercpu_foreach(zc, z->z_pcpu_cache) {
+			zci->mzci_depot_hits += zc->zc_depot_hits;
+			zci->mzci_depot_misses += zc->zc_depot_misses;
+			zci->mzci_depot_contended += zc->zc_depot_contended;
+			zci->mzci_cached += zc->zc_alloc_cur + zc->zc_free_cur;
+			zci->mzci_cached += zc->zc_depot.zd_elems;
+		}
+	}
+#if ZALLOC_CLUSTER_POOLS
+	zci->mzci_cluster_xfrees = z->z_cluster_xfrees;
+	zci->mzci_cluster_steals = z->z_cluster_steals;
+#endif /* ZALLOC_CLUSTER_POOLS */
+	zone_unlock(z);
+
+	return TRUE;
+}
+
+kern_return_t
+mach_zone_cache_info(
+	host_priv_t                     host,
+	mach_zone_name_array_t          *namesp,
+	mach_msg_type_number_t          *namesCntp,
+	mach_zone_cache_info_array_t    *infop,
+	mach_msg_type_number_t          *infoCntp)
+{
+	mach_zone_name_t *names;
+	mach_zone_cache_info_t *info;
+	vm_offset_t names_addr, info_addr;
+	vm_size_t names_size, info_size;
+	unsigned int max_zones, used_zones = 0;
+	kern_return_t kr;
+
+	if (host == HOST_NULL) {
+		return KERN_INVALID_HOST;
+	}
+
+#if CONFIG_DEBUGGER_FOR_ZONE_INFO
+	if (!PE_i_can_has_debugger(NULL)) {
+		return KERN_INVALID_HOST;
+	}
+#endif
+
+	if (namesp == NULL || namesCntp == NULL ||
+	    infop == NULL || infoCntp == NULL) {
+		return KERN_INVALID_ARGUMENT;
+	}
+
+	max_zones = os_atomic_load(&num_zones, relaxed);
+
+	names_size = round_page(max_zones * sizeof *names);
+	kr = kmem_alloc(ipc_kernel_map, &names_addr, names_size,
+	    KMA_PAGEABLE | KMA_DATA, VM_KERN_MEMORY_IPC);
+	if (kr != KERN_SUCCESS) {
+		return kr;
+	}
+	names = (mach_zone_name_t *)names_addr;
+
+	info_size = round_page(max_zones * sizeof *info);
+	kr = kmem_alloc(ipc_kernel_map, &info_addr, info_size,
+	    KMA_PAGEABLE | KMA_DATA, VM_KERN_MEMORY_IPC);
+	if (kr != KERN_SUCCESS) {
+		kmem_free(ipc_kernel_map, names_addr, names_size);
+		return kr;
+	}
+	info = (mach_zone_cache_info_t *)info_addr;
+
+	for (unsigned int i = 0; i < max_zones; i++) {
+		zone_t z = &zone_array[i];
+
+		if (get_zone_info(z, &names[used_zones], NULL) &&
+		    get_zone_cache_info(z, &info[used_zones])) {
+			used_zones++;
+		}
+	}
+
+	*namesp = (mach_zone_name_t *)create_vm_map_copy(names_addr,
+	    names_size, used_zones * sizeof *names);
+	*namesCntp = used_zones;
+
+	*infop = (mach_zone_cache_info_t *)create_vm_map_copy(info_addr,
+	    info_size, used_zones * sizeof *info);
+	*infoCntp = used_zones;
+
+	return KERN_SUCCESS;
+}
+
 uint64_t
 get_zones_collectable_bytes(void)
 {
@@ -9149,7 +9739,7 @@ zone_get_stats(
 		zpercpu_foreach(zc, zone->z_pcpu_cache) {
 			stats->zbs_cached += zc->zc_alloc_cur +
 			    zc->zc_free_cur +
-			    zc->zc_depot.zd_full * zc_mag_size();
+			    zc->zc_depot.zd_elems;
 		}
 	}
 
@@ -9622,7 +10212,7 @@ zone_create_ext(
 		pgz_zone_init(z);
 	}
 #endif
-	if (zc_magazine_zone) { /* proxy for "has zone_init run" */
+	if (zc_magazine_zone[0]) { /* proxy for "has zone_init run" */
 #if ZALLOC_ENABLE_LOGGING
 		/*
 		 * Check for and set up zone leak detection
@@ -9685,7 +10275,7 @@ zone_create_ext(
 		/*
 		 * No zone made before zone_init() can have ZC_CACHING set.
 		 */
-		assert(zc_magazine_zone);
+		assert(zc_magazine_zone[0]);
 		zone_enable_caching(z);
 	}
 
@@ -9875,6 +10465,11 @@ zdestroy(zone_t z)
 	assert(zone_pva_is_null(z->z_pageq_empty));
 	assert(zone_pva_is_null(z->z_pageq_partial));
 	assert(zone_pva_is_null(z->z_pageq_full));
+#if ZALLOC_CLUSTER_POOLS
+	for (uint32_t i = 0; i < ZONE_CLUSTER_COUNT; i++) {
+		assert(zone_pva_is_null(z->z_pageq_local[i]));
+	}
+#endif /* ZALLOC_CLUSTER_POOLS */
 	if (!zone_submap_is_sequestered(zsflags)) {
 		assert(zone_pva_is_null(z->z_pageq_va));
 	}
@@ -9934,7 +10529,7 @@ zone_bootstrap(void)
 		 *   buckets (empirically affects networking performance)
 		 */
 		if (zpercpu_early_count >= 10) {
-			_zc_mag_size = 14;
+			_zc_mag_size = 128 / sizeof(vm_offset_t) - ZONE_MAG_HDR_WORDS;
 		} else if ((sane_size >> 30) >= 4) {
 			_zc_mag_size = 10;
 		}
@@ -10118,6 +10713,9 @@ zone_metadata_init(void)
 	vm_map_entry_t first;
 
 	struct mach_vm_range meta_r, bits_r, xtra_r, early_r;
+#if ZALLOC_CLUSTER_POOLS
+	struct mach_vm_range clus_r = { };
+#endif /* ZALLOC_CLUSTER_POOLS */
 	vm_size_t early_sz;
 	vm_offset_t reloc_base;
 
@@ -10131,7 +10729,7 @@ zone_metadata_init(void)
 	 */
 	vm_map_will_allocate_early_map(&zone_meta_map);
 	meta_r = zone_kmem_suballoc(zone_info.zi_meta_range.min_address,
-	    zone_meta_size + zone_bits_size + zone_xtra_size,
+	    zone_meta_size + zone_bits_size + zone_xtra_size + zone_cluster_size,
 	    VM_FLAGS_FIXED | VM_FLAGS_OVERWRITE,
 	    VM_KERN_MEMORY_ZONE, &zone_meta_map);
 	meta_r.min_address += ZONE_GUARD_SIZE;
@@ -10143,6 +10741,13 @@ zone_metadata_init(void)
 	} else {
 		xtra_r.min_address  = xtra_r.max_address = 0;
 	}
+#if ZALLOC_CLUSTER_POOLS
+	if (zone_cluster_size) {
+		clus_r.max_address  = meta_r.max_address;
+		meta_r.max_address -= zone_cluster_size;
+		clus_r.min_address  = meta_r.max_address;
+	}
+#endif /* ZALLOC_CLUSTER_POOLS */
 	bits_r.max_address  = meta_r.max_address;
 	meta_r.max_address -= zone_bits_size;
 	bits_r.min_address  = meta_r.max_address;
@@ -10160,6 +10765,12 @@ zone_metadata_init(void)
 	    (void *)xtra_r.min_address, (void *)xtra_r.max_address,
 	    mach_vm_size_pretty(mach_vm_range_size(&xtra_r)),
 	    mach_vm_size_unit(mach_vm_range_size(&xtra_r)));
+#if ZALLOC_CLUSTER_POOLS
+	printf("zone_init: clusters  %p:%p (%u%c)\n",
+	    (void *)clus_r.min_address, (void *)clus_r.max_address,
+	    mach_vm_size_pretty(mach_vm_range_size(&clus_r)),
+	    mach_vm_size_unit(mach_vm_range_size(&clus_r)));
+#endif /* ZALLOC_CLUSTER_POOLS */
 #endif /* DEBUG || DEVELOPMENT */
 
 	bits_r.min_address = (bits_r.min_address + ZBA_CHUNK_SIZE - 1) & -ZBA_CHUNK_SIZE;
@@ -10178,6 +10789,13 @@ zone_metadata_init(void)
 	zone_info.zi_xtra_range = xtra_r;
 	zone_info.zi_meta_base  = (struct zone_page_metadata *)meta_r.min_address -
 	    zone_pva_from_addr(zone_map_range.min_address).packed_address;
+#if ZALLOC_CLUSTER_POOLS
+	if (zone_cluster_size) {
+		zone_info.zi_cluster_range = clus_r;
+		zone_info.zi_cluster_base  = (uint8_t *)clus_r.min_address -
+		    zone_pva_from_addr(zone_map_range.min_address).packed_address;
+	}
+#endif /* ZALLOC_CLUSTER_POOLS */
 
 	vm_map_lock(vm_map);
 	first = vm_map_first_entry(vm_map);
@@ -10378,6 +10996,12 @@ zone_set_map_sizes(void)
 		zone_xtra_size = round_page(zone_bits_size * CHAR_BIT << zba_xtra_shift);
 	}
 #endif /* VM_TAG_SIZECLASSES */
+
+#if ZALLOC_CLUSTER_POOLS
+	if (zone_cluster_pools && ml_get_cluster_count() > 1) {
+		zone_cluster_size = round_page(atop(ZONE_MAP_VA_SIZE));
+	}
+#endif /* ZALLOC_CLUSTER_POOLS */
 }
 STARTUP(KMEM, STARTUP_RANK_FIRST, zone_set_map_sizes);
 
@@ -10388,7 +11012,7 @@ STARTUP(KMEM, STARTUP_RANK_FIRST, zone_set_map_sizes);
  */
 KMEM_RANGE_REGISTER_STATIC(zones, &zone_map_range, ZONE_MAP_VA_SIZE);
 KMEM_RANGE_REGISTER_DYNAMIC(zone_meta, &zone_info.zi_meta_range, ^{
-	return zone_meta_size + zone_bits_size + zone_xtra_size;
+	return zone_meta_size + zone_bits_size + zone_xtra_size + zone_cluster_size;
 });
 
 /*
@@ -10461,10 +11085,27 @@ zone_init(void)
 		z->z_elem_size = 1;
 	});
 
-	zc_magazine_zone = zone_create("zcc_magazine_zone", sizeof(struct zone_magazine) +
-	    zc_mag_size() * sizeof(vm_offset_t),
-	    ZC_VM | ZC_NOCACHING | ZC_ZFREE_CLEARMEM | ZC_PGZ_USE_GUARDS);
-	zone_raise_reserve(zc_magazine_zone, (uint16_t)(2 * zpercpu_count()));
+	for (uint32_t i = 0; i < ZONE_MAG_CLASS_COUNT; i++) {
+		static const char *const names[ZONE_MAG_CLASS_COUNT] = {
+			"zcc_magazine_zone",
+			"zcc_magazine_zone.1",
+			"zcc_magazine_zone.2",
+			"zcc_magazine_zone.3",
+		};
+
+		zc_magazine_zone[i] = zone_create(names[i],
+		    sizeof(struct zone_magazine) +
+		    zone_magazine_class_capacity(i) * sizeof(vm_offset_t),
+		    ZC_VM | ZC_NOCACHING | ZC_ZFREE_CLEARMEM | ZC_PGZ_USE_GUARDS);
+		/* zone_magazine_class() relies on this */
+		if (zone_index(zc_magazine_zone[i]) !=
+		    zone_index(zc_magazine_zone[0]) + i) {
+			panic("%s: non consecutive zone ID %d", names[i],
+			    zone_index(zc_magazine_zone[i]));
+		}
+	}
+	/* zone_enable_caching() relies on the reserve of class 0 */
+	zone_raise_reserve(zc_magazine_zone[0], (uint16_t)(2 * zpercpu_count()));
 
 	/*
 	 * Now migrate the startup statistics into their final storage,
@@ -10633,6 +11274,11 @@ zone_leaks(const char * zoneName, uint32_t nameLen, leak_site_proc proc)
 
 	next = array;
 	next = zone_copy_allocations(zone, next, zone->z_pageq_partial);
+#if ZALLOC_CLUSTER_POOLS
+	for (uint32_t i = 0; i < ZONE_CLUSTER_COUNT; i++) {
+		next = zone_copy_allocations(zone, next, zone->z_pageq_local[i]);
+	}
+#endif /* ZALLOC_CLUSTER_POOLS */
 	next = zone_copy_allocations(zone, next, zone->z_pageq_full);
 	count = (uint32_t)(next - array);
 
@@ -11275,4 +11921,93 @@ zone_alloc_replenish_test(__unused int64_t in, int64_t *out)
 }
 SYSCTL_TEST_REGISTER(zone_alloc_replenish_test, zone_alloc_replenish_test);
 
+/*
+ * Micro-benchmark of zalloc_n()/zfree_n() against as many zalloc_id()/zfree_id()
+ * calls, in batches of "in" elements (16 by default), on a caching zone.
+ *
+ * It also checks that batches come back zeroed and without duplicates.
+ */
+#define ZONE_BATCH_TEST_ROUNDS  10000
+#define ZONE_BATCH_TEST_MAX     256
+
+static int
+zone_batch_test_run(int64_t in, int64_t *out)
+{
+	uint32_t batch = in > 0 ? (uint32_t)MIN(in, ZONE_BATCH_TEST_MAX) : 16;
+	uint64_t start, single_ns, batch_ns;
+	zstack_t stack;
+	zone_id_t zid;
+	void **elems;
+	zone_t z;
+	int rc = 0;
+
+	if (os_atomic_xchg(&any_zone_test_running, true, relaxed)) {
+		printf("zone_batch_test: Test already running.\n");
+		return EALREADY;
+	}
+
+	z = zone_create("test_zone_batch", 64, ZC_DESTRUCTIBLE | ZC_CACHING);
+	zid = zone_index(z);
+	elems = kalloc_type(void *, batch, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+
+	stack = zalloc_n(zid, batch, Z_WAITOK | Z_NOFAIL);
+	if (zstack_count(stack) != batch) {
+		printf("zone_batch_test: got %u elements instead of %u\n",
+		    zstack_count(stack), batch);
+		rc = EIO;
+	}
+	for (uint32_t i = 0; zstack_count(stack); i++) {
+		uint64_t *e = zstack_pop(&stack);
+
+		for (uint32_t j = 0; j < 64 / sizeof(uint64_t); j++) {
+			if (e[j]) {
+				printf("zone_batch_test: element %p isn't zeroed\n", e);
+				rc = EIO;
+			}
+		}
+		for (uint32_t j = 0; j < i; j++) {
+			if (elems[j] == e) {
+				printf("zone_batch_test: element %p returned twice\n", e);
+				rc = EIO;
+			}
+		}
+		elems[i] = e;
+	}
+	for (uint32_t i = 0; i < batch; i++) {
+		zstack_push(&stack, elems[i]);
+	}
+	zfree_n(zid, stack);
+
+	start = mach_absolute_time();
+	for (uint32_t r = 0; r < ZONE_BATCH_TEST_ROUNDS; r++) {
+		for (uint32_t i = 0; i < batch; i++) {
+			elems[i] = (zalloc_id)(zid, Z_WAITOK | Z_NOFAIL);
+		}
+		for (uint32_t i = 0; i < batch; i++) {
+			zfree_id(zid, elems[i]);
+		}
+	}
+	absolutetime_to_nanoseconds(mach_absolute_time() - start, &single_ns);
+
+	start = mach_absolute_time();
+	for (uint32_t r = 0; r < ZONE_BATCH_TEST_ROUNDS; r++) {
+		stack = zalloc_n(zid, batch, Z_WAITOK | Z_NOFAIL);
+		zfree_n(zid, stack);
+	}
+	absolutetime_to_nanoseconds(mach_absolute_time() - start, &batch_ns);
+
+	printf("zone_batch_test: batches of %u, per batch: "
+	    "zalloc_id+zfree_id %lld ns, zalloc_n+zfree_n %lld ns\n",
+	    batch, single_ns / ZONE_BATCH_TEST_ROUNDS,
+	    batch_ns / ZONE_BATCH_TEST_ROUNDS);
+
+	kfree_type(void *, batch, elems);
+	zdestroy(z);
+
+	*out = (rc == 0);
+	os_atomic_store(&any_zone_test_running, false, relaxed);
+	return rc;
+}
+SYSCTL_TEST_REGISTER(zone_batch_test, zone_batch_test_run);
+
 #endif /* DEBUG || DEVELOPMENT */
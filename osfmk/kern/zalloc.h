@@ -2116,7 +2116,16 @@ extern void zfree_nozero(
  * Allocates a batch of elements from the specified zone.
  *
  * @discussion
- * This is for the sake of networking only, no one else should use this.
+ * This is meant for paths allocating several elements of the same zone
+ * back to back: elements are taken from the per-cpu caches a magazine
+ * at a time, in a single critical section, rather than one by one.
+ *
+ * Elements are returned chained in a @c zstack_t, and @c zstack_pop()
+ * returns them zeroed.  Elements that end up unused must be returned
+ * with @c zfree_n().
+ *
+ * Unless @c Z_NOFAIL is passed, fewer elements than requested can be
+ * returned when the zone is exhausted or @c Z_NOWAIT is used.
  *
  * @param zone_id       the zone id to allocate the element from.
  * @param count         how many elements to allocate (less might be returned)
@@ -2133,6 +2142,10 @@ extern zstack_t zalloc_n(
  * @abstract
  * Batched variant of zfree(): frees a stack of elements.
  *
+ * @discussion
+ * Like @c zalloc_n(), elements are given back to the per-cpu caches
+ * a magazine at a time.  The stack can be empty.
+ *
  * @param zone_id       the zone id to free the element to.
  * @param stack         a stack of elements to free.
  */
@@ -66,6 +66,7 @@
 #include <os/atomic_private.h>
 #include <sys/queue.h>
 #include <vm/vm_map_internal.h>
+#include <machine/smp.h>
 
 #if KASAN
 #include <san/kasan.h>
@@ -90,6 +91,19 @@
 #define ZALLOC_ENABLE_LOGGING           0
 #endif
 
+/*
+ * On AMP systems, the partially used chunks of a zone are kept in per-cluster
+ * pools, so that elements keep being allocated from pages whose cache lines
+ * are likely in the L2 of the allocating cluster.
+ */
+#if __AMP__
+#define ZALLOC_CLUSTER_POOLS            1
+#define ZONE_CLUSTER_COUNT              MAX_PSETS
+#else
+#define ZALLOC_CLUSTER_POOLS            0
+#define ZONE_CLUSTER_COUNT              1
+#endif
+
 /*!
  * @file <kern/zalloc_internal.h>
  *
@@ -158,16 +172,22 @@ typedef struct zone_magazine *zone_magazine_t;
  *
  *      zd_full = 3
  *      zd_empty = 1
+ *      zd_elems = 3 * zone_magazine_capacity()
  * ╭─── zd_head
  * │ ╭─ zd_tail
  * │ ╰────────────────────────────────────╮
  * │    ╭───────╮   ╭───────╮   ╭───────╮ v ╭───────╮
  * ╰───>│███████┼──>│███████┼──>│███████┼──>│       ┼─> X
  *      ╰───────╯   ╰───────╯   ╰───────╯   ╰───────╯
+ *
+ * Magazines of a zone don't all have the same capacity when its magazine
+ * size changed recently, hence @c zd_elems keeps the number of elements
+ * held by the full magazines.
  */
 struct zone_depot {
 	uint32_t            zd_full;
 	uint32_t            zd_empty;
+	uint32_t            zd_elems;
 	zone_magazine_t     zd_head;
 	zone_magazine_t    *zd_tail;
 };
@@ -292,10 +312,6 @@ struct zone {
 	 *
 	 * z_recirc* fields are protected by the recirculation lock.
 	 *
-	 * z_recirc_cont_wma:
-	 *   weighted moving average of the number of contentions per second,
-	 *   in Z_WMA_UNIT units (fixed point decimal).
-	 *
 	 * z_recirc_cont_cur:
 	 *   count of recorded contentions that will be fused
 	 *   in z_recirc_cont_wma at the next period.
@@ -332,10 +348,6 @@ struct zone {
 		uint32_t    z_elems_free_wma;
 	};
 	uint32_t            z_recirc_cont_cur;
-	uint32_t            z_recirc_cont_wma;
-
-	uint16_t            z_depot_size;
-	uint16_t            z_depot_limit;
 
 	uint8_t             z_cacheline2[0] __attribute__((aligned(64)));
 
@@ -380,6 +392,57 @@ struct zone {
 
 	uint8_t             z_cacheline3[0] __attribute__((aligned(64)));
 
+	/*
+	 * Per-cpu cache sizing
+	 *
+	 * These are only changed by compute_zone_working_set_size()
+	 * and when the zone gets exhausted, under the zone lock.
+	 * The per-cpu layer reads them on its slow paths.
+	 *
+	 * z_recirc_cont_wma:
+	 *   weighted moving average of the number of contentions per second,
+	 *   in Z_WMA_UNIT units (fixed point decimal).
+	 *
+	 * z_depot_size:
+	 *   how many magazines each per-cpu depot can hold.
+	 *
+	 * z_depot_limit:
+	 *   how large z_depot_size can grow for the current magazine size.
+	 *
+	 * z_mag_class:
+	 *   the size class of the magazines the per-cpu layer loads,
+	 *   each class doubles the size of a magazine
+	 *   (see zone_magazine_class_capacity()).
+	 *
+	 * z_mag_resizes:
+	 *   how many times z_mag_class changed.
+	 */
+	uint32_t            z_recirc_cont_wma;
+	uint16_t            z_depot_size;
+	uint16_t            z_depot_limit;
+	uint8_t             z_mag_class;
+	uint16_t            z_mag_resizes;
+
+#if ZALLOC_CLUSTER_POOLS
+	/*
+	 * Cluster page pools (protected by the zone lock)
+	 *
+	 * z_pageq_local:
+	 *   populated, partially filled chunks owned by a given cluster,
+	 *   the shared z_pageq_partial holds the chunks nobody owns.
+	 *
+	 * z_cluster_xfrees:
+	 *   number of elements freed back to their chunk from another cluster
+	 *   than the one owning it.
+	 *
+	 * z_cluster_steals:
+	 *   number of times a cluster took a chunk from another cluster's pool.
+	 */
+	zone_pva_t          z_pageq_local[ZONE_CLUSTER_COUNT];
+	uint64_t            z_cluster_xfrees;
+	uint64_t            z_cluster_steals;
+#endif /* ZALLOC_CLUSTER_POOLS */
+
 #if KASAN_CLASSIC
 	uint16_t            z_kasan_redzone;
 	spl_t               z_kasan_spl;
@@ -584,7 +647,6 @@ extern const char * const       kalloc_heap_names[KHEAP_ID_COUNT];
 extern mach_memory_info_t      *panic_kext_memory_info;
 extern vm_size_t                panic_kext_memory_size;
 extern vm_offset_t              panic_fault_address;
-extern uint16_t                 _zc_mag_size;
 
 #define zone_index_foreach(i) \
 	for (zone_id_t i = 1, num_zones_##i = os_atomic_load(&num_zones, acquire); \
@@ -679,7 +741,7 @@ zone_security_config(zone_t z)
 static inline uint32_t
 zone_count_free(zone_t zone)
 {
-	return zone->z_elems_free + zone->z_recirc.zd_full * _zc_mag_size;
+	return zone->z_elems_free + zone->z_recirc.zd_elems;
 }
 
 static inline uint32_t
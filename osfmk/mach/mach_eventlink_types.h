@@ -69,6 +69,59 @@ __options_decl(mach_eventlink_signal_wait_option_t, uint32_t, {
 #define decode_eventlink_error_from_retval(retval) \
 	((kern_return_t)(((retval) >> EVENTLINK_SIGNAL_ERROR_SHIFT) & EVENTLINK_SIGNAL_ERROR_MASK))
 
+/*
+ * Single producer, single consumer ring of fixed size messages,
+ * in memory shared by the two sides of an eventlink.
+ *
+ * The ring header is followed by `entries` slots of `msg_size` bytes
+ * (see MACH_EVENTLINK_RING_SIZE()).  Indices are free running and wrap
+ * at 2^32, the slot of an index is the index modulo `entries`, which
+ * must be a power of 2.
+ *
+ * The geometry isn't in the shared memory: each side keeps it in its
+ * own mach_eventlink_ring_handle_t, so that whatever the other side
+ * writes to the ring can't make a copy overrun it.
+ *
+ * Messages are exchanged without entering the kernel: the eventlink
+ * is only signaled when the other side is about to wait, which only
+ * happens when it finds the ring empty (consumer) or full (producer).
+ * Each side passes its own eventlink port, and the calling thread must
+ * be associated with it (or MELA_OPTION_ASSOCIATE_ON_WAIT be used).
+ */
+#define MACH_EVENTLINK_RING_MAX_ENTRIES   (1u << 16)
+#define MACH_EVENTLINK_RING_MAX_MSG_SIZE  (1u << 12)
+
+/*
+ * Each half of the header gets a whole cache line of the largest size
+ * in use (128 bytes on Apple arm64 cores), so that the two sides don't
+ * share one, and the slots start on a cache line boundary.
+ */
+#define MACH_EVENTLINK_RING_CLINE_SIZE    128
+
+struct mach_eventlink_ring {
+	/* written by the producer */
+	uint32_t        mer_tail;               /* next slot the producer will fill */
+	uint32_t        mer_producer_waiting;   /* producer waits for room */
+	uint64_t        mer_producer_count;     /* producer's eventlink count */
+	uint8_t         mer_reserved0[MACH_EVENTLINK_RING_CLINE_SIZE - 16];
+
+	/* written by the consumer */
+	uint32_t        mer_head;               /* next slot the consumer will read */
+	uint32_t        mer_consumer_waiting;   /* consumer waits for messages */
+	uint64_t        mer_consumer_count;     /* consumer's eventlink count */
+	uint8_t         mer_reserved1[MACH_EVENTLINK_RING_CLINE_SIZE - 16];
+};
+
+/* one side's view of a ring */
+typedef struct mach_eventlink_ring_handle {
+	struct mach_eventlink_ring *merh_ring;
+	uint32_t        merh_entries;
+	uint32_t        merh_msg_size;
+} mach_eventlink_ring_handle_t;
+
+#define MACH_EVENTLINK_RING_SIZE(entries, msg_size) \
+	(sizeof(struct mach_eventlink_ring) + (uint64_t)(entries) * (msg_size))
+
 #ifndef KERNEL
 kern_return_t
 mach_eventlink_signal(
@@ -92,6 +145,54 @@ mach_eventlink_signal_wait_until(
 	kern_clock_id_t                      clock_id,
 	uint64_t                             deadline);
 
+/*
+ * Initialize the MACH_EVENTLINK_RING_SIZE(entries, msg_size) bytes
+ * at `ring` as an empty ring, before either side uses it,
+ * and fill `handle` to use it.
+ */
+kern_return_t
+mach_eventlink_ring_init(
+	mach_eventlink_ring_handle_t         *handle,
+	struct mach_eventlink_ring           *ring,
+	uint32_t                             entries,
+	uint32_t                             msg_size);
+
+/*
+ * Fill `handle` to use a ring the other side initialized,
+ * with the same `entries` and `msg_size`.
+ */
+kern_return_t
+mach_eventlink_ring_attach(
+	mach_eventlink_ring_handle_t         *handle,
+	struct mach_eventlink_ring           *ring,
+	uint32_t                             entries,
+	uint32_t                             msg_size);
+
+/*
+ * Copy merh_msg_size bytes from `msg` into the ring, waiting for room
+ * until `deadline` (in mach_absolute_time, 0 for none) if it is full,
+ * unless MELSW_OPTION_NO_WAIT is passed.
+ */
+kern_return_t
+mach_eventlink_ring_send(
+	const mach_eventlink_ring_handle_t   *handle,
+	mach_port_t                          eventlink_port,
+	const void                           *msg,
+	mach_eventlink_signal_wait_option_t  option,
+	uint64_t                             deadline);
+
+/*
+ * Copy the oldest message of the ring to `msg`, waiting for one
+ * until `deadline` if it is empty, unless MELSW_OPTION_NO_WAIT is passed.
+ */
+kern_return_t
+mach_eventlink_ring_receive(
+	const mach_eventlink_ring_handle_t   *handle,
+	mach_port_t                          eventlink_port,
+	void                                 *msg,
+	mach_eventlink_signal_wait_option_t  option,
+	uint64_t                             deadline);
+
 #endif
 
 #endif  /* _MACH_EVENTLINK_TYPES_H_ */
@@ -560,9 +560,11 @@ typedef struct {
 __enum_decl(mach_msgv_index_t, uint32_t, {
 	MACH_MSGV_IDX_MSG = 0,
 	MACH_MSGV_IDX_AUX = 1,
+	/* receive only, see MACH64_RCV_OOL_REGION */
+	MACH_MSGV_IDX_OOL_REGION = 2,
 });
 
-#define MACH_MSGV_MAX_COUNT (MACH_MSGV_IDX_AUX + 1)
+#define MACH_MSGV_MAX_COUNT (MACH_MSGV_IDX_OOL_REGION + 1)
 /* at least DISPATCH_MSGV_AUX_MAX_SIZE in libdispatch */
 #define LIBSYSCALL_MSGV_AUX_MAX_SIZE 128
 
@@ -575,6 +577,30 @@ typedef struct {
 	mach_msg_size_t                 msgv_rcv_size;
 } mach_msg_vector_t;
 
+/*
+ * mach msg2 batches (MACH64_MSG_BATCH): the first send count entries are
+ * sent in order, then up to receive count messages are received into the
+ * first receive count entries. Only the first receive waits, the others
+ * only take what is already queued.
+ *
+ * Each message carries its own header (and descriptor count). The kernel
+ * fills in the return code of every entry it was asked to handle, entries
+ * that nothing was received into have msgb_rcv_return set to
+ * MACH_RCV_TIMED_OUT.
+ */
+#define MACH_MSG_BATCH_MAX_COUNT 64
+
+typedef struct {
+	/* a mach_msg_header_t* */
+	mach_vm_address_t               msgb_data;
+	/* if msgb_rcv_addr is non-zero, use it as rcv address instead */
+	mach_vm_address_t               msgb_rcv_addr;
+	mach_msg_size_t                 msgb_send_size;
+	mach_msg_size_t                 msgb_rcv_size;
+	mach_msg_return_t               msgb_send_return;       /* out */
+	mach_msg_return_t               msgb_rcv_return;        /* out */
+} mach_msg_batch_entry_t;
+
 typedef struct {
 	mach_msg_size_t         msgdh_size;
 	uint32_t                msgdh_reserved; /* For future */
@@ -1004,6 +1030,17 @@ __options_decl(mach_msg_option64_t, uint64_t, {
 	MACH64_SEND_ANY                        = 0x0000000800000000ull,
 	/* This message is a DriverKit call (Temporary) */
 	MACH64_SEND_DK_CALL                    = 0x0000001000000000ull,
+	/* Send and receive arrays of messages, see mach_msg_batch_entry_t */
+	MACH64_MSG_BATCH                       = 0x0000002000000000ull,
+	/*
+	 * Receive page aligned out-of-line memory into the region of the
+	 * MACH_MSGV_IDX_OOL_REGION data vector (its rcv address and size),
+	 * replacing what the region held, instead of mapping it at a new
+	 * address. Vector receives only, the aux vector may have a rcv size
+	 * of 0 if no aux data is wanted. Memory that can't be written to the
+	 * region is dropped with MACH_MSG_VM_SPACE.
+	 */
+	MACH64_RCV_OOL_REGION                  = 0x0000004000000000ull,
 
 #ifdef XNU_KERNEL_PRIVATE
 	/*
@@ -1079,14 +1116,15 @@ __options_decl(mach_msg_option64_t, uint64_t, {
 #define MACH64_MSG_OPTION_CFI_MASK (MACH64_SEND_KOBJECT_CALL | MACH64_SEND_MQ_CALL | \
 	        MACH64_SEND_ANY | MACH64_SEND_DK_CALL)
 
-#define MACH64_RCV_USER          (MACH_RCV_USER | MACH64_MSG_VECTOR)
+#define MACH64_RCV_USER          (MACH_RCV_USER | MACH64_MSG_VECTOR | \
+	        MACH64_MSG_BATCH | MACH64_RCV_OOL_REGION)
 
 #define MACH_MSG_OPTION_USER     (MACH_SEND_USER | MACH_RCV_USER)
 
 #define MACH64_MSG_OPTION_USER   (MACH64_SEND_USER | MACH64_RCV_USER)
 
 #define MACH64_SEND_USER (MACH_SEND_USER | MACH64_MSG_VECTOR | \
-	        MACH64_MSG_OPTION_CFI_MASK)
+	        MACH64_MSG_BATCH | MACH64_MSG_OPTION_CFI_MASK)
 
 /* The options implemented by the library interface to mach_msg et. al. */
 #define MACH_MSG_OPTION_LIB      (MACH_SEND_INTERRUPT | MACH_RCV_INTERRUPT)
@@ -1394,6 +1432,34 @@ mach_msg2(
 	           MACH_MSG2_SHIFT_ARGS(rcv_size, priority), timeout);
 #undef MACH_MSG2_SHIFT_ARGS
 }
+
+/*
+ * Send the first send_count messages of `entries`, then receive up to
+ * rcv_count messages from rcv_name, see mach_msg_batch_entry_t.
+ */
+__API_AVAILABLE(macos(15.0), ios(18.0), tvos(18.0), watchos(11.0))
+__IOS_PROHIBITED __WATCHOS_PROHIBITED __TVOS_PROHIBITED
+static inline mach_msg_return_t
+mach_msg2_batch(
+	mach_msg_batch_entry_t *entries,
+	mach_msg_option64_t option64,
+	mach_msg_size_t send_count,
+	mach_msg_size_t rcv_count,
+	mach_port_t rcv_name,
+	uint64_t timeout,
+	uint32_t priority)
+{
+	/*
+	 * Never let an interrupted send be restarted, it would send the
+	 * messages of the batch that did go through a second time.
+	 */
+	option64 |= MACH64_MSG_BATCH | MACH64_SEND_INTERRUPT;
+
+	return mach_msg2_internal(entries, option64,
+	           (uint64_t)send_count << 32, 0, 0,
+	           (uint64_t)rcv_name << 32,
+	           (uint64_t)priority << 32 | rcv_count, timeout);
+}
 #endif
 #endif /* PRIVATE */
 
@@ -59,6 +59,7 @@ typedef int     vm_purgable_t;
 #define VM_PURGABLE_GET_STATE   ((vm_purgable_t) 1)     /* get state of purgeable object */
 #define VM_PURGABLE_PURGE_ALL   ((vm_purgable_t) 2)     /* purge all volatile objects now */
 #define VM_PURGABLE_SET_STATE_FROM_KERNEL ((vm_purgable_t) 3) /* set state from kernel */
+#define VM_PURGABLE_PURGE_OWNED ((vm_purgable_t) 4)     /* purge *state pages of the caller's volatile objects */
 
 /*
  * Purgeable state:
@@ -74,6 +74,29 @@ typedef struct mach_vm_reclaim_buffer_v1_s {
 	mach_vm_reclaim_entry_v1_t entries[0];
 } *mach_vm_reclaim_buffer_v1_t;
 
+/*
+ * Per-process reclamation statistics, as reported by the vm.reclaim_stats
+ * sysctl (one entry per reclamation buffer).
+ */
+typedef struct mach_vm_reclaim_stats_v1_s {
+	int32_t pid;
+	uint32_t _reserved;
+	uint64_t bytes_reclaimed;
+	uint64_t entries_reclaimed;
+	/* VM operations performed, after merging adjacent entries */
+	uint64_t ranges_reclaimed;
+	/* Estimate of the bytes currently in the buffer */
+	uint64_t reclaimable_bytes;
+	/* Times the kernel drained the buffer, and how long that took */
+	uint64_t drains;
+	uint64_t drain_time_total_ns;
+	uint64_t drain_time_max_ns;
+	/* Asynchronous drains, and how long the buffer waited for them */
+	uint64_t async_drains;
+	uint64_t async_latency_total_ns;
+	uint64_t async_latency_max_ns;
+} mach_vm_reclaim_stats_v1_t;
+
 #if !KERNEL
 #define VM_RECLAIM_INDEX_NULL UINT64_MAX
 
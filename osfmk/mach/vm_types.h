@@ -79,6 +79,7 @@ __options_decl(vm_map_create_options_t, uint32_t, {
 	VM_MAP_CREATE_CORPSE_FOOTPRINT = 0x00000002,
 	VM_MAP_CREATE_DISABLE_HOLELIST = 0x00000004,
 	VM_MAP_CREATE_NEVER_FAULTS     = 0x00000008,
+	VM_MAP_CREATE_BTREE_STORE      = 0x00000010,
 });
 
 /*
@@ -214,6 +215,58 @@ typedef mach_vm_range_recipe_v1_t    mach_vm_range_recipe_t;
 
 typedef uint8_t                *mach_vm_range_recipes_raw_t;
 
+/*!
+ * @enum mach_vm_batch_flavor_t
+ *
+ * @brief
+ * A flavor for the mach_vm_batch() call.
+ *
+ * @const MACH_VM_BATCH_FLAVOR_V1
+ * The operations are an array of @c mach_vm_batch_op_v1_t.
+ */
+__enum_decl(mach_vm_batch_flavor_t, uint32_t, {
+	MACH_VM_BATCH_FLAVOR_INVALID,
+	MACH_VM_BATCH_FLAVOR_V1,
+});
+
+/*!
+ * @enum mach_vm_batch_op_kind_t
+ *
+ * @brief
+ * The operation a @c mach_vm_batch_op_v1_t applies to its range.
+ *
+ * @const MACH_VM_BATCH_OP_PROTECT
+ * Same as mach_vm_protect(), except that @c VM_PROT_COPY
+ * isn't supported.
+ *
+ * @const MACH_VM_BATCH_OP_DEALLOCATE
+ * Same as mach_vm_deallocate().
+ */
+__enum_decl(mach_vm_batch_op_kind_t, uint16_t, {
+	MACH_VM_BATCH_OP_INVALID,
+	MACH_VM_BATCH_OP_PROTECT,
+	MACH_VM_BATCH_OP_DEALLOCATE,
+});
+
+typedef struct {
+	mach_vm_address_t       address;
+	mach_vm_size_t          size;
+	mach_vm_batch_op_kind_t op;
+	uint16_t                set_maximum;
+	int                     new_protection; /* vm_prot_t */
+} mach_vm_batch_op_v1_t;
+
+/*
+ * The most operations a single mach_vm_batch() call takes,
+ * which sizes mach_vm_batch_ops_raw_t in mach_types.defs.
+ */
+#define MACH_VM_BATCH_OPS_MAX        128
+
+#define MACH_VM_BATCH_FLAVOR_DEFAULT MACH_VM_BATCH_FLAVOR_V1
+typedef mach_vm_batch_op_v1_t        mach_vm_batch_op_t;
+
+typedef uint8_t                *mach_vm_batch_ops_raw_t;
+
 #ifdef PRIVATE
 
 typedef struct {
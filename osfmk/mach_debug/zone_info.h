@@ -131,6 +131,28 @@ typedef mach_zone_info_t *mach_zone_info_array_t;
 #define SET_MZI_COLLECTABLE_FLAG(val, flag)             \
 	(val) = (flag) ? ((val) | 1) : (val)
 
+/*
+ * Per-cpu caching layer of a zone, as returned by mach_zone_cache_info().
+ * Zones without per-cpu caching report zeroes.
+ *
+ * The cluster counters are only maintained on systems with per-cluster
+ * pools of partially used chunks, and are zero otherwise.
+ */
+typedef struct mach_zone_cache_info_data {
+	uint64_t        mzci_mag_size;          /* elements per magazine */
+	uint64_t        mzci_mag_resizes;       /* magazine size changes */
+	uint64_t        mzci_depot_size;        /* per-cpu depot size (magazines) */
+	uint64_t        mzci_depot_limit;       /* how large the depots can grow */
+	uint64_t        mzci_depot_hits;        /* depot operations served locally */
+	uint64_t        mzci_depot_misses;      /* depot operations that recirculated */
+	uint64_t        mzci_depot_contended;   /* contended recirculation locks */
+	uint64_t        mzci_cached;            /* elements in the per-cpu layer */
+	uint64_t        mzci_cluster_xfrees;    /* frees to chunks of another cluster */
+	uint64_t        mzci_cluster_steals;    /* chunks taken from another cluster */
+} mach_zone_cache_info_t;
+
+typedef mach_zone_cache_info_t *mach_zone_cache_info_array_t;
+
 typedef struct task_zone_info_data {
 	uint64_t        tzi_count;      /* count of elements in use */
 	uint64_t        tzi_cur_size;   /* current memory utilization */
@@ -215,6 +215,34 @@ struct c_sv_hash_entry {
 #define C_SV_CSEG_ID            ((1 << 22) - 1)
 #endif /* CONFIG_TRACK_UNMODIFIED_ANON_PAGES */
 
+/*
+ * Pages whose compressed image is identical to one already in a c_segment
+ * share that copy through a dedup entry.  The entry's de_slot is the one
+ * mapping the c_slot back-points to, so compaction and swap keep it current
+ * like any other, while the pages themselves map the entry through the
+ * C_DEDUP_CSEG_COUNT segment numbers right below C_SV_CSEG_ID.
+ */
+struct c_dedup_entry {
+	struct c_slot_mapping   de_slot;        /* owner of the shared c_slot */
+	uint32_t                de_hash;
+	uint32_t                de_ref;
+	uint32_t                de_next;        /* hash chain or free list */
+	uint32_t                de_size:16,     /* rounded compressed size */
+	    de_hashed:1,
+	    :15;
+};
+
+#define C_DEDUP_CSEG_COUNT      256
+#define C_DEDUP_CSEG_BASE       (C_SV_CSEG_ID - C_DEDUP_CSEG_COUNT)
+#define C_DEDUP_MAX_ENTRIES     (C_DEDUP_CSEG_COUNT * C_SLOT_MAX_INDEX)
+#define C_DEDUP_CHUNK_ENTRIES   128
+#define C_DEDUP_LOCKS           16
+#define C_DEDUP_SEEN_SIZE       (1 << 12)
+#define C_DEDUP_NONE            ((uint32_t)-1)
+
+#define C_SLOT_IS_DEDUP(slot) \
+	((slot)->s_cseg >= C_DEDUP_CSEG_BASE && (slot)->s_cseg < C_SV_CSEG_ID)
+
 
 union c_segu {
 	c_segment_t     c_seg;
@@ -300,6 +328,15 @@ uint32_t        c_segment_svp_nonzero_compressions;
 uint32_t        c_segment_svp_zero_decompressions;
 uint32_t        c_segment_svp_nonzero_decompressions;
 
+TUNABLE_WRITEABLE(boolean_t, vm_compressor_dedup_enabled, "vm_compressor_dedup", TRUE);
+TUNABLE(uint32_t, vm_compressor_dedup_entries, "vm_compressor_dedup_entries", 1 << 16);
+
+uint64_t        c_segment_dedup_hits = 0;
+uint64_t        c_segment_dedup_misses = 0;
+uint64_t        c_segment_dedup_bytes_saved = 0;
+uint32_t        c_segment_dedup_in_use = 0;
+uint32_t        c_segment_dedup_shared_pages = 0;
+
 uint32_t        c_segment_noncompressible_pages;
 
 uint32_t        c_segment_pages_compressed = 0; /* Tracks # of uncompressed pages fed into the compressor */
@@ -379,6 +416,17 @@ mach_timespec_t major_compact_ts;
 
 struct c_sv_hash_entry c_segment_sv_hash_table[C_SV_HASH_SIZE]  __attribute__ ((aligned(8)));
 
+static zone_t   c_dedup_chunk_zone;
+static struct c_dedup_entry **c_dedup_chunks;
+static uint32_t *c_dedup_buckets;
+static uint32_t c_dedup_bucket_mask;
+static uint32_t c_dedup_max_entries;
+static uint32_t c_dedup_nentries;                       /* entries carved out so far */
+static uint32_t c_dedup_free_head = C_DEDUP_NONE;
+static uint32_t c_dedup_seen[C_DEDUP_SEEN_SIZE];        /* recently compressed hashes, lossy */
+static lck_mtx_t c_dedup_locks[C_DEDUP_LOCKS];          /* bucket chains and refcounts */
+LCK_MTX_DECLARE(c_dedup_free_lock, &vm_compressor_lck_grp);
+
 static void vm_compressor_swap_trigger_thread(void);
 static void vm_compressor_do_delayed_compactions(boolean_t);
 static void vm_compressor_compact_and_swap(boolean_t);
@@ -395,6 +443,9 @@ static void vm_compressor_take_paging_space_action(void);
 
 void compute_swapout_target_age(void);
 
+static void c_dedup_init(void);
+static int c_dedup_decompress_page(char *, c_slot_mapping_t, vm_compressor_options_t, int *);
+
 boolean_t c_seg_major_compact(c_segment_t, c_segment_t);
 boolean_t c_seg_major_compact_ok(c_segment_t, c_segment_t);
 
@@ -895,6 +946,11 @@ vm_compressor_set_size(void)
 		c_segments_limit = tmp_slot_ptr.s_cseg - 1; /*limited by segment idx bits in c_slot_mapping*/
 		compressor_pool_size = (c_segments_limit * (vm_size_t)(c_seg_allocsize));
 	}
+	if (c_segments_limit >= C_DEDUP_CSEG_BASE) {
+		/* the top of the s_cseg range names dedup entries and SV hash slots */
+		c_segments_limit = C_DEDUP_CSEG_BASE - 1;
+		compressor_pool_size = (c_segments_limit * (vm_size_t)(c_seg_allocsize));
+	}
 
 	c_segments_nearing_limit = (uint32_t)(((uint64_t)c_segments_limit * 98ULL) / 100ULL);
 
@@ -928,6 +984,7 @@ vm_compressor_set_size(void)
 		tmp_slot_ptr.s_cseg = c_segments_limit;
 		/* Panic on internal configs*/
 		assertf((tmp_slot_ptr.s_cseg == c_segments_limit), "vm_compressor_init: freezer reserve overflowed s_cseg field in c_slot_mapping with c_segno: %d", c_segments_limit);
+		assertf(c_segments_limit < C_DEDUP_CSEG_BASE, "vm_compressor_init: freezer reserve overlaps the dedup range with c_segno: %d", c_segments_limit);
 	}
 #endif
 	/*
@@ -1137,6 +1194,7 @@ vm_compressor_init(void)
 
 	c_segments_next_page = (caddr_t)c_segments;
 	vm_compressor_algorithm_init();
+	c_dedup_init();
 
 	{
 		host_basic_info_data_t hinfo;
@@ -2045,6 +2103,13 @@ c_seg_trim_tail(c_segment_t c_seg)
 	if (c_seg->c_bytes_used == 0) {
 		return;
 	}
+	if (c_seg->c_swap_dense_size) {
+		/*
+		 * The dense image decodes to c_swap_dense_srcsize bytes,
+		 * the buffer has to stay populated that far.
+		 */
+		return;
+	}
 	current_nextslot = c_seg->c_nextslot;
 	current_populated_offset = c_seg->c_populated_offset;
 
@@ -2234,6 +2299,8 @@ struct {
 	uint64_t count_of_freed_segs;
 	uint64_t bailed_compactions;
 	uint64_t bytes_freed_rate_us;
+	uint64_t bytes_freed;
+	uint64_t cpu_time_us;
 } c_seg_major_compact_stats[C_SEG_MAJOR_COMPACT_STATS_MAX];
 
 int c_seg_major_compact_stats_now = 0;
@@ -2938,6 +3005,116 @@ vm_compressor_do_delayed_compactions(boolean_t flush_all)
 
 int min_csegs_per_major_compaction = DELAYED_COMPACTIONS_PER_PASS;
 
+/*
+ * Occupancy index for major compaction.
+ *
+ * Rather than only pulling from the segment immediately behind the
+ * destination, we look at a window of the segments that follow it on
+ * the same queue and bucket them by how full they are.  Donors are then
+ * taken emptiest first: an emptier donor costs fewer bytes of copying
+ * per segment freed, and the window keeps the ages of the data we put
+ * together close.
+ *
+ * The index is built under the c_list_lock, which major compaction drops
+ * while it moves slots, so each entry remembers the segment's generation
+ * id and is revalidated before it is used.
+ */
+#define C_OCC_WINDOW            32
+#define C_OCC_BUCKETS           16
+
+struct c_occ_entry {
+	uint32_t        ce_segno;
+	uint64_t        ce_generation_id;
+};
+
+struct c_occ_index {
+	uint32_t        co_count;
+	uint32_t        co_next;
+	struct c_occ_entry co_entries[C_OCC_WINDOW];
+};
+
+static inline uint32_t
+c_occ_bucket(c_segment_t c_seg)
+{
+	return MIN((uint32_t)c_seg->c_bytes_used / (c_seg_bufsize / C_OCC_BUCKETS), C_OCC_BUCKETS - 1);
+}
+
+/*
+ * Collect the candidate donors for c_seg, sorted by occupancy bucket.
+ * The sort is a counting sort over the window, so within a bucket the
+ * queue (age) order is kept.
+ */
+static void
+c_occ_index_build(struct c_occ_index *occ, c_segment_t c_seg, queue_head_t *list_head)
+{
+	uint32_t        start[C_OCC_BUCKETS] = { 0 };
+	uint32_t        bucket, n, total = 0;
+	c_segment_t     c_seg_next;
+
+	LCK_MTX_ASSERT(c_list_lock, LCK_MTX_ASSERT_OWNED);
+
+	c_seg_next = (c_segment_t) queue_next(&c_seg->c_age_list);
+
+	for (n = 0; n < C_OCC_WINDOW && !queue_end(list_head, (queue_entry_t)c_seg_next); n++) {
+		assert(c_seg_next->c_state == c_seg->c_state);
+
+		if (c_seg_next->c_bytes_used < C_MAJOR_COMPACTION_SIZE_APPROPRIATE) {
+			start[c_occ_bucket(c_seg_next)]++;
+			total++;
+		}
+		c_seg_next = (c_segment_t) queue_next(&c_seg_next->c_age_list);
+	}
+	for (bucket = 0, n = 0; bucket < C_OCC_BUCKETS; bucket++) {
+		uint32_t count = start[bucket];
+
+		start[bucket] = n;
+		n += count;
+	}
+
+	c_seg_next = (c_segment_t) queue_next(&c_seg->c_age_list);
+
+	for (n = 0; n < C_OCC_WINDOW && !queue_end(list_head, (queue_entry_t)c_seg_next); n++) {
+		if (c_seg_next->c_bytes_used < C_MAJOR_COMPACTION_SIZE_APPROPRIATE) {
+			struct c_occ_entry *ce = &occ->co_entries[start[c_occ_bucket(c_seg_next)]++];
+
+			ce->ce_segno = c_seg_next->c_mysegno;
+			ce->ce_generation_id = c_seg_next->c_generation_id;
+		}
+		c_seg_next = (c_segment_t) queue_next(&c_seg_next->c_age_list);
+	}
+	occ->co_count = total;
+	occ->co_next = 0;
+}
+
+/*
+ * Return the next donor from the index that is still the segment we
+ * indexed and still on c_seg's queue, or NULL once the index is spent.
+ */
+static c_segment_t
+c_occ_index_next(struct c_occ_index *occ, c_segment_t c_seg)
+{
+	LCK_MTX_ASSERT(c_list_lock, LCK_MTX_ASSERT_OWNED);
+
+	while (occ->co_next < occ->co_count) {
+		struct c_occ_entry *ce = &occ->co_entries[occ->co_next++];
+		c_segment_t     c_seg_next;
+
+		if (c_segments[ce->ce_segno].c_segno < c_segments_available) {
+			/* freed, and now on the free list */
+			continue;
+		}
+		c_seg_next = c_segments[ce->ce_segno].c_seg;
+
+		if (c_seg_next->c_generation_id != ce->ce_generation_id ||
+		    c_seg_next->c_state != c_seg->c_state ||
+		    c_seg_next->c_bytes_used >= C_MAJOR_COMPACTION_SIZE_APPROPRIATE) {
+			continue;
+		}
+		return c_seg_next;
+	}
+	return NULL;
+}
+
 static bool
 vm_compressor_major_compact_cseg(c_segment_t c_seg, uint32_t* c_seg_considered, bool* bail_wanted_cseg, uint64_t* total_bytes_freed)
 {
@@ -2949,6 +3126,7 @@ vm_compressor_major_compact_cseg(c_segment_t c_seg, uint32_t* c_seg_considered,
 	c_segment_t c_seg_next;
 	uint64_t        bytes_to_free = 0, bytes_freed = 0;
 	uint32_t        number_considered = 0;
+	struct c_occ_index occ;
 
 	if (c_seg->c_state == C_ON_AGE_Q) {
 		assert(!c_seg->c_has_donated_pages);
@@ -2958,19 +3136,19 @@ vm_compressor_major_compact_cseg(c_segment_t c_seg, uint32_t* c_seg_considered,
 		list_head = &c_late_swappedin_list_head;
 	}
 
+	c_occ_index_build(&occ, c_seg, list_head);
+
 	while (keep_compacting == TRUE) {
 		assert(c_seg->c_busy);
 
-		/* look for another segment to consolidate */
+		/* look for another segment to consolidate, emptiest first */
 
-		c_seg_next = (c_segment_t) queue_next(&c_seg->c_age_list);
+		c_seg_next = c_occ_index_next(&occ, c_seg);
 
-		if (queue_end(list_head, (queue_entry_t)c_seg_next)) {
+		if (c_seg_next == NULL) {
 			break;
 		}
 
-		assert(c_seg_next->c_state == c_seg->c_state);
-
 		number_considered++;
 
 		if (c_seg_major_compact_ok(c_seg, c_seg_next) == FALSE) {
@@ -2981,26 +3159,13 @@ vm_compressor_major_compact_cseg(c_segment_t c_seg, uint32_t* c_seg_considered,
 
 		if (c_seg_next->c_busy) {
 			/*
-			 * We are going to block for our neighbor.
-			 * If our c_seg is wanted, we should unbusy
-			 * it because we don't know how long we might
-			 * have to block here.
+			 * Don't block for a busy donor, we have
+			 * others in the index to pick from.
 			 */
-			if (c_seg->c_wanted) {
-				lck_mtx_unlock_always(&c_seg_next->c_lock);
-				fully_compacted = false;
-				c_seg_major_compact_stats[c_seg_major_compact_stats_now].bailed_compactions++;
-				*bail_wanted_cseg = true;
-				break;
-			}
-
-			lck_mtx_unlock_always(c_list_lock);
+			lck_mtx_unlock_always(&c_seg_next->c_lock);
 
 			VM_DEBUG_CONSTANT_EVENT(vm_compressor_compact_and_swap, VM_COMPRESSOR_COMPACT_AND_SWAP, DBG_FUNC_NONE, 8, (void*) VM_KERNEL_ADDRPERM(c_seg_next), 0, 0);
 
-			c_seg_wait_on_busy(c_seg_next);
-			lck_mtx_lock_spin_always(c_list_lock);
-
 			continue;
 		}
 		/* grab that segment */
@@ -3686,10 +3851,13 @@ vm_compressor_compact_and_swap(boolean_t flush_all)
 	mach_timespec_t start_ts, end_ts;
 	unsigned int    number_considered, wanted_cseg_found, yield_after_considered_per_pass, number_yields;
 	uint64_t        bytes_freed, delta_usec;
+	uint64_t        cpu_time_start, cpu_time_ns;
 	uint32_t        c_swapout_count = 0;
 
 	VM_DEBUG_CONSTANT_EVENT(vm_compressor_compact_and_swap, VM_COMPRESSOR_COMPACT_AND_SWAP, DBG_FUNC_START, c_age_count, c_minor_count, c_major_count, vm_page_free_count);
 
+	cpu_time_start = thread_get_runtime_self();
+
 	if (fastwake_warmup == TRUE) {
 		uint64_t        starting_warmup_count;
 
@@ -4004,6 +4172,21 @@ vm_compressor_compact_and_swap(boolean_t flush_all)
 
 	c_seg_major_compact_stats[c_seg_major_compact_stats_now].bytes_freed_rate_us = (bytes_freed / delta_usec);
 
+	/*
+	 * wall time above includes the time we were blocked or preempted,
+	 * so also account the CPU time this pass actually cost us
+	 */
+	absolutetime_to_nanoseconds(thread_get_runtime_self() - cpu_time_start, &cpu_time_ns);
+
+	c_seg_major_compact_stats[c_seg_major_compact_stats_now].bytes_freed = bytes_freed;
+	c_seg_major_compact_stats[c_seg_major_compact_stats_now].cpu_time_us = cpu_time_ns / NSEC_PER_USEC;
+
+	vmcs_stats.major_compact_passes++;
+	vmcs_stats.major_compact_bytes_freed += bytes_freed;
+	vmcs_stats.major_compact_cpu_time_us += cpu_time_ns / NSEC_PER_USEC;
+	vmcs_stats.major_compact_last_bytes_freed = bytes_freed;
+	vmcs_stats.major_compact_last_cpu_time_us = cpu_time_ns / NSEC_PER_USEC;
+
 	if ((c_seg_major_compact_stats_now + 1) == C_SEG_MAJOR_COMPACT_STATS_MAX) {
 		c_seg_major_compact_stats_now = 0;
 	} else {
@@ -4408,6 +4591,8 @@ c_seg_swapin_requeue(c_segment_t c_seg, boolean_t has_data, boolean_t minor_comp
 	} else {
 		c_seg->c_store.c_buffer = (int32_t*) NULL;
 		c_seg->c_populated_offset = C_SEG_BYTES_TO_OFFSET(0);
+		c_seg->c_swap_dense_size = 0;
+		c_seg->c_swap_dense_srcsize = 0;
 
 		c_seg_switch_state(c_seg, C_ON_BAD_Q, FALSE);
 	}
@@ -4430,6 +4615,7 @@ c_seg_swapin(c_segment_t c_seg, boolean_t force_minor_compaction, boolean_t age_
 {
 	vm_offset_t     addr = 0;
 	uint32_t        io_size = 0;
+	uint32_t        read_size = 0;
 	uint64_t        f_offset;
 	thread_pri_floor_t token;
 
@@ -4441,6 +4627,12 @@ c_seg_swapin(c_segment_t c_seg, boolean_t force_minor_compaction, boolean_t age_
 	io_size = round_page_32(C_SEG_OFFSET_TO_BYTES(c_seg->c_populated_offset));
 	f_offset = c_seg->c_store.c_swap_handle;
 
+	read_size = io_size;
+	if (c_seg->c_swap_dense_size) {
+		assert(io_size == c_seg->c_swap_dense_srcsize);
+		read_size = round_page_32(c_seg->c_swap_dense_size);
+	}
+
 	C_SEG_BUSY(c_seg);
 	c_seg->c_busy_swapping = 1;
 
@@ -4461,7 +4653,8 @@ c_seg_swapin(c_segment_t c_seg, boolean_t force_minor_compaction, boolean_t age_
 	kernel_memory_populate(addr, io_size, KMA_NOFAIL | KMA_COMPRESSOR,
 	    VM_KERN_MEMORY_COMPRESSOR);
 
-	if (vm_swap_get(c_seg, f_offset, io_size) != KERN_SUCCESS) {
+	if (vm_swap_get(c_seg, f_offset, read_size) != KERN_SUCCESS ||
+	    !vm_swap_decode(c_seg)) {
 		PAGE_REPLACEMENT_DISALLOWED(TRUE);
 
 		kernel_memory_depopulate(addr, io_size, KMA_COMPRESSOR,
@@ -4469,10 +4662,6 @@ c_seg_swapin(c_segment_t c_seg, boolean_t force_minor_compaction, boolean_t age_
 
 		c_seg_swapin_requeue(c_seg, FALSE, TRUE, age_on_swapin_q);
 	} else {
-#if ENCRYPTED_SWAP
-		vm_swap_decrypt(c_seg);
-#endif /* ENCRYPTED_SWAP */
-
 #if CHECKSUM_THE_SWAP
 		if (c_seg->cseg_swap_size != io_size) {
 			panic("swapin size doesn't match swapout size");
@@ -4611,6 +4800,277 @@ c_segment_sv_hash_insert(uint32_t data)
 }
 
 
+static inline struct c_dedup_entry *
+c_dedup_entry(uint32_t index)
+{
+	return &c_dedup_chunks[index / C_DEDUP_CHUNK_ENTRIES][index % C_DEDUP_CHUNK_ENTRIES];
+}
+
+static inline uint32_t
+c_dedup_slot_index(c_slot_mapping_t slot_ptr)
+{
+	return (slot_ptr->s_cseg - C_DEDUP_CSEG_BASE) * C_SLOT_MAX_INDEX + slot_ptr->s_cindx;
+}
+
+static inline void
+c_dedup_slot_set(c_slot_mapping_t slot_ptr, uint32_t index)
+{
+	slot_ptr->s_cindx = index % C_SLOT_MAX_INDEX;
+	slot_ptr->s_cseg = C_DEDUP_CSEG_BASE + index / C_SLOT_MAX_INDEX;
+#if CONFIG_TRACK_UNMODIFIED_ANON_PAGES
+	slot_ptr->s_uncompressed = 0;
+#endif /* CONFIG_TRACK_UNMODIFIED_ANON_PAGES */
+}
+
+static inline lck_mtx_t *
+c_dedup_lock(uint32_t hash)
+{
+	return &c_dedup_locks[(hash & c_dedup_bucket_mask) % C_DEDUP_LOCKS];
+}
+
+static void
+c_dedup_init(void)
+{
+	uint32_t nentries = MIN(vm_compressor_dedup_entries, C_DEDUP_MAX_ENTRIES);
+
+	if (nentries < C_DEDUP_CHUNK_ENTRIES) {
+		vm_compressor_dedup_enabled = FALSE;
+		return;
+	}
+	/* a power of 2, so that a quarter of it makes a bucket mask */
+	c_dedup_max_entries = 1U << (31 - __builtin_clz(nentries));
+	c_dedup_bucket_mask = (c_dedup_max_entries / 4) - 1;
+
+	c_dedup_chunks = kalloc_type(struct c_dedup_entry *,
+	    c_dedup_max_entries / C_DEDUP_CHUNK_ENTRIES, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	c_dedup_buckets = kalloc_data((c_dedup_bucket_mask + 1) * sizeof(uint32_t),
+	    Z_WAITOK | Z_NOFAIL);
+	memset(c_dedup_buckets, 0xff, (c_dedup_bucket_mask + 1) * sizeof(uint32_t));
+
+	/*
+	 * The c_slots back-point at de_slot, so entries have to come from
+	 * the same packable range as the pagers' slot arrays.
+	 */
+	c_dedup_chunk_zone = zone_create("compressor_dedup",
+	    C_DEDUP_CHUNK_ENTRIES * sizeof(struct c_dedup_entry), ZC_VM | ZC_NOENCRYPT);
+
+	for (int i = 0; i < C_DEDUP_LOCKS; i++) {
+		lck_mtx_init(&c_dedup_locks[i], &vm_compressor_lck_grp, LCK_ATTR_NULL);
+	}
+}
+
+/*
+ * Carve out another chunk of entries once the free list runs dry.
+ * Called without any compressor lock held.
+ */
+static void
+c_dedup_grow(void)
+{
+	struct c_dedup_entry *chunk;
+
+	if (c_dedup_free_head != C_DEDUP_NONE || c_dedup_nentries >= c_dedup_max_entries) {
+		return;
+	}
+	chunk = zalloc_flags(c_dedup_chunk_zone, Z_NOWAIT | Z_ZERO);
+	if (chunk == NULL) {
+		return;
+	}
+
+	lck_mtx_lock_spin_always(&c_dedup_free_lock);
+
+	if (c_dedup_free_head != C_DEDUP_NONE || c_dedup_nentries >= c_dedup_max_entries) {
+		lck_mtx_unlock_always(&c_dedup_free_lock);
+		zfree(c_dedup_chunk_zone, chunk);
+		return;
+	}
+	C_SLOT_ASSERT_PACKABLE(&chunk[C_DEDUP_CHUNK_ENTRIES - 1].de_slot);
+
+	os_atomic_store(&c_dedup_chunks[c_dedup_nentries / C_DEDUP_CHUNK_ENTRIES], chunk, release);
+
+	for (uint32_t i = C_DEDUP_CHUNK_ENTRIES; i-- > 0;) {
+		chunk[i].de_next = c_dedup_free_head;
+		c_dedup_free_head = c_dedup_nentries + i;
+	}
+	c_dedup_nentries += C_DEDUP_CHUNK_ENTRIES;
+
+	lck_mtx_unlock_always(&c_dedup_free_lock);
+}
+
+static uint32_t
+c_dedup_entry_alloc(void)
+{
+	uint32_t        index;
+
+	lck_mtx_lock_spin_always(&c_dedup_free_lock);
+
+	if ((index = c_dedup_free_head) != C_DEDUP_NONE) {
+		c_dedup_free_head = c_dedup_entry(index)->de_next;
+		c_segment_dedup_in_use++;
+	}
+	lck_mtx_unlock_always(&c_dedup_free_lock);
+
+	return index;
+}
+
+static void
+c_dedup_entry_free(uint32_t index)
+{
+	struct c_dedup_entry *de = c_dedup_entry(index);
+
+	lck_mtx_lock_spin_always(&c_dedup_free_lock);
+
+	de->de_ref = 0;
+	de->de_next = c_dedup_free_head;
+	c_dedup_free_head = index;
+	c_segment_dedup_in_use--;
+
+	lck_mtx_unlock_always(&c_dedup_free_lock);
+}
+
+/*
+ * Compressed images are hashed rather than the pages themselves: a match
+ * still has to compare equal byte for byte, which is cheaper on the
+ * compressed side, and a page only reaches here once its image is known.
+ */
+static uint32_t
+c_dedup_hash(const char *buf, int len)
+{
+	uint64_t        h = (uint64_t)len * 0x9e3779b97f4a7c15ULL;
+	uint64_t        w;
+	int             i;
+
+	for (i = 0; i + (int)sizeof(w) <= len; i += sizeof(w)) {
+		memcpy(&w, &buf[i], sizeof(w));
+		h = (h ^ w) * 0xff51afd7ed558ccdULL;
+		h ^= h >> 32;
+	}
+	for (; i < len; i++) {
+		h = (h ^ (uint8_t)buf[i]) * 0x100000001b3ULL;
+	}
+	return (uint32_t)(h ^ (h >> 32));
+}
+
+/*
+ * Look for a slot holding the same "c_size" bytes the codec just wrote at
+ * "cs" and, if there is one, take a reference on it on behalf of "slot_ptr".
+ *
+ * Called with "c_seg" locked.  Any other segment is only try-locked, and
+ * passed over if it is busy or its data isn't resident.
+ */
+static bool
+c_dedup_lookup(c_segment_t c_seg, c_slot_t cs, int c_size, uint32_t hash, c_slot_mapping_t slot_ptr)
+{
+	lck_mtx_t       *lock = c_dedup_lock(hash);
+	uint32_t        index;
+	bool            found = false;
+
+	lck_mtx_lock_spin_always(lock);
+
+	index = c_dedup_buckets[hash & c_dedup_bucket_mask];
+
+	while (index != C_DEDUP_NONE) {
+		struct c_dedup_entry *de = c_dedup_entry(index);
+		c_segment_t     dc_seg;
+		c_slot_t        dcs;
+
+		if (de->de_hash != hash) {
+			index = de->de_next;
+			continue;
+		}
+		/* s_cseg only changes with the master lock held exclusive */
+		dc_seg = c_segments[de->de_slot.s_cseg - 1].c_seg;
+
+		if (dc_seg != c_seg) {
+			if (!lck_mtx_try_lock_spin_always(&dc_seg->c_lock)) {
+				index = de->de_next;
+				continue;
+			}
+			if (dc_seg->c_busy || C_SEG_IS_ON_DISK_OR_SOQ(dc_seg) || dc_seg->c_state == C_ON_BAD_Q) {
+				lck_mtx_unlock_always(&dc_seg->c_lock);
+				index = de->de_next;
+				continue;
+			}
+		}
+		dcs = C_SEG_SLOT_FROM_INDEX(dc_seg, de->de_slot.s_cindx);
+
+		if (UNPACK_C_SIZE(dcs) == (uint32_t)c_size &&
+#if defined(__arm64__)
+		    dcs->c_codec == cs->c_codec &&
+#endif
+		    memcmp(&dc_seg->c_store.c_buffer[dcs->c_offset],
+		    &c_seg->c_store.c_buffer[cs->c_offset], c_size) == 0) {
+			de->de_ref++;
+			found = true;
+		}
+		if (dc_seg != c_seg) {
+			lck_mtx_unlock_always(&dc_seg->c_lock);
+		}
+		if (found) {
+			c_dedup_slot_set(slot_ptr, index);
+
+			OSAddAtomic(1, &c_segment_dedup_shared_pages);
+			OSAddAtomic64(de->de_size, &c_segment_dedup_bytes_saved);
+			break;
+		}
+		index = de->de_next;
+	}
+	lck_mtx_unlock_always(lock);
+
+	return found;
+}
+
+/*
+ * Hand the slot just committed at "cs" over to entry "index", leaving
+ * "slot_ptr" mapping the entry.  Called with the c_seg lock held.
+ */
+static void
+c_dedup_insert(uint32_t index, uint32_t hash, int c_rounded_size, c_slot_t cs, c_slot_mapping_t slot_ptr)
+{
+	struct c_dedup_entry *de = c_dedup_entry(index);
+	lck_mtx_t       *lock = c_dedup_lock(hash);
+	uint32_t        bucket = hash & c_dedup_bucket_mask;
+
+	de->de_slot = *slot_ptr;
+	de->de_hash = hash;
+	de->de_ref = 1;
+	de->de_size = c_rounded_size;
+
+	C_SLOT_ASSERT_PACKABLE(&de->de_slot);
+	cs->c_packed_ptr = C_SLOT_PACK_PTR(&de->de_slot);
+
+	c_dedup_slot_set(slot_ptr, index);
+
+	lck_mtx_lock_spin_always(lock);
+
+	de->de_next = c_dedup_buckets[bucket];
+	de->de_hashed = 1;
+	c_dedup_buckets[bucket] = index;
+
+	lck_mtx_unlock_always(lock);
+}
+
+/*
+ * Called with the bucket lock held, once the caller owns the last
+ * reference, so that no further lookups can match the entry.
+ */
+static void
+c_dedup_unhash_locked(uint32_t index, struct c_dedup_entry *de)
+{
+	uint32_t        *prevp;
+
+	if (!de->de_hashed) {
+		return;
+	}
+	prevp = &c_dedup_buckets[de->de_hash & c_dedup_bucket_mask];
+
+	while (*prevp != index) {
+		prevp = &c_dedup_entry(*prevp)->de_next;
+	}
+	*prevp = de->de_next;
+	de->de_hashed = 0;
+}
+
+
 #if RECORD_THE_COMPRESSED_DATA
 
 static void
@@ -4630,8 +5090,71 @@ c_compressed_record_data(char *src, int c_size)
 #endif
 
 
+/*
+ * Run the active codec over one page of "src", writing at most
+ * (max_csize - 4) bytes to "dst".
+ *
+ * Returns the compressed size, 0 for a page that is a single repeated
+ * 32 bit value, or -1 if the page didn't fit.
+ */
 static int
-c_compress_page(char *src, c_slot_mapping_t slot_ptr, c_segment_t *current_chead, char *scratch_buf)
+c_compress_run_codec(char *src, char *dst, int max_csize, char *scratch_buf,
+    uint16_t *codec, boolean_t *incomp_copy)
+{
+	int             c_size = -1;
+	int             max_csize_adj = (max_csize - 4);
+
+	if (vm_compressor_algorithm() != VM_COMPRESSOR_DEFAULT_CODEC) {
+#if defined(__arm64__)
+		uint16_t ccodec = CINVALID;
+		uint32_t inline_popcount;
+		if (max_csize >= C_SEG_OFFSET_ALIGNMENT_BOUNDARY) {
+			c_size = metacompressor((const uint8_t *) src,
+			    (uint8_t *) dst,
+			    max_csize_adj, &ccodec,
+			    scratch_buf, incomp_copy, &inline_popcount);
+			assert(inline_popcount == C_SLOT_NO_POPCOUNT);
+
+#if C_SEG_OFFSET_ALIGNMENT_BOUNDARY > 4
+			if (c_size > max_csize_adj) {
+				c_size = -1;
+			}
+#endif
+		} else {
+			c_size = -1;
+		}
+		assert(ccodec == CCWK || ccodec == CCLZ4);
+		*codec = ccodec;
+#endif
+	} else {
+#if defined(__arm64__)
+		*codec = CCWK;
+		__unreachable_ok_push
+		if (PAGE_SIZE == 4096) {
+			c_size = WKdm_compress_4k((WK_word *)(uintptr_t)src, (WK_word *)(uintptr_t)dst,
+			    (WK_word *)(uintptr_t)scratch_buf, max_csize_adj);
+		} else {
+			c_size = WKdm_compress_16k((WK_word *)(uintptr_t)src, (WK_word *)(uintptr_t)dst,
+			    (WK_word *)(uintptr_t)scratch_buf, max_csize_adj);
+		}
+		__unreachable_ok_pop
+#else
+		c_size = WKdm_compress_new((const WK_word *)(uintptr_t)src, (WK_word *)(uintptr_t)dst,
+		    (WK_word *)(uintptr_t)scratch_buf, max_csize_adj);
+#endif
+	}
+	assertf(((c_size <= max_csize_adj) && (c_size >= -1)),
+	    "c_size invalid (%d, %d), cur compressions: %d", c_size, max_csize_adj, c_segment_pages_compressed);
+
+	return c_size;
+}
+
+
+uint64_t c_segment_staged_compressions = 0;
+uint64_t c_segment_staged_refits = 0;
+
+static int
+c_compress_page(char *src, c_slot_mapping_t slot_ptr, c_segment_t *current_chead, char *scratch_buf, c_stage_t stage)
 {
 	int             c_size = -1;
 	int             c_rounded_size = 0;
@@ -4639,6 +5162,8 @@ c_compress_page(char *src, c_slot_mapping_t slot_ptr, c_segment_t *current_chead
 	c_slot_t        cs;
 	c_segment_t     c_seg;
 	bool            single_value = false;
+	uint32_t        dedup_hash = 0;
+	uint32_t        dedup_index = C_DEDUP_NONE;
 
 	KERNEL_DEBUG(0xe0400000 | DBG_FUNC_START, *current_chead, 0, 0, 0, 0);
 retry:
@@ -4671,48 +5196,37 @@ retry:
 #endif
 	boolean_t incomp_copy = FALSE;
 	int max_csize_adj = (max_csize - 4);
+	uint16_t ccodec = CCWK;
 
-	if (vm_compressor_algorithm() != VM_COMPRESSOR_DEFAULT_CODEC) {
-#if defined(__arm64__)
-		uint16_t ccodec = CINVALID;
-		uint32_t inline_popcount;
-		if (max_csize >= C_SEG_OFFSET_ALIGNMENT_BOUNDARY) {
-			c_size = metacompressor((const uint8_t *) src,
-			    (uint8_t *) &c_seg->c_store.c_buffer[cs->c_offset],
-			    max_csize_adj, &ccodec,
-			    scratch_buf, &incomp_copy, &inline_popcount);
-			assert(inline_popcount == C_SLOT_NO_POPCOUNT);
+	if (stage != NULL && stage->cst_size != C_STAGE_EMPTY) {
+		/*
+		 * The codec already ran against a full page budget: all that is
+		 * left to do is to check that the output fits where we are in
+		 * this segment.  If it doesn't, behave as the codec would have
+		 * and move on to a fresh segment.
+		 */
+		c_size = stage->cst_size;
+		ccodec = stage->cst_codec;
 
+		if (c_size > max_csize_adj
 #if C_SEG_OFFSET_ALIGNMENT_BOUNDARY > 4
-			if (c_size > max_csize_adj) {
-				c_size = -1;
-			}
+		    || max_csize < C_SEG_OFFSET_ALIGNMENT_BOUNDARY
 #endif
-		} else {
+		    ) {
+			if (max_csize < PAGE_SIZE) {
+				OSAddAtomic64(1, &c_segment_staged_refits);
+			}
 			c_size = -1;
+		} else if (c_size > 0) {
+			memcpy(&c_seg->c_store.c_buffer[cs->c_offset], stage->cst_buf, c_size);
 		}
-		assert(ccodec == CCWK || ccodec == CCLZ4);
-		cs->c_codec = ccodec;
-#endif
 	} else {
+		c_size = c_compress_run_codec(src, (char *)&c_seg->c_store.c_buffer[cs->c_offset],
+		    max_csize, scratch_buf, &ccodec, &incomp_copy);
+	}
 #if defined(__arm64__)
-		cs->c_codec = CCWK;
-		__unreachable_ok_push
-		if (PAGE_SIZE == 4096) {
-			c_size = WKdm_compress_4k((WK_word *)(uintptr_t)src, (WK_word *)(uintptr_t)&c_seg->c_store.c_buffer[cs->c_offset],
-			    (WK_word *)(uintptr_t)scratch_buf, max_csize_adj);
-		} else {
-			c_size = WKdm_compress_16k((WK_word *)(uintptr_t)src, (WK_word *)(uintptr_t)&c_seg->c_store.c_buffer[cs->c_offset],
-			    (WK_word *)(uintptr_t)scratch_buf, max_csize_adj);
-		}
-		__unreachable_ok_pop
-#else
-		c_size = WKdm_compress_new((const WK_word *)(uintptr_t)src, (WK_word *)(uintptr_t)&c_seg->c_store.c_buffer[cs->c_offset],
-		    (WK_word *)(uintptr_t)scratch_buf, max_csize_adj);
+	cs->c_codec = ccodec;
 #endif
-	}
-	assertf(((c_size <= max_csize_adj) && (c_size >= -1)),
-	    "c_size invalid (%d, %d), cur compressions: %d", c_size, max_csize_adj, c_segment_pages_compressed);
 
 	if (c_size == -1) {
 		if (max_csize < PAGE_SIZE) {
@@ -4761,6 +5275,31 @@ retry:
 		memcpy(&c_seg->c_store.c_buffer[cs->c_offset], src, c_size);
 
 		OSAddAtomic(1, &c_segment_svp_hash_failed);
+	} else if (vm_compressor_dedup_enabled && c_dedup_max_entries) {
+		dedup_hash = c_dedup_hash((char *)&c_seg->c_store.c_buffer[cs->c_offset], c_size);
+
+		if (c_dedup_lookup(c_seg, cs, c_size, dedup_hash, slot_ptr)) {
+			/*
+			 * an identical image is already stored... leave what the
+			 * codec wrote to be overwritten by the next page
+			 */
+			OSAddAtomic64(1, &c_segment_dedup_hits);
+			c_size = 0;
+			goto sv_compression;
+		}
+		OSAddAtomic64(1, &c_segment_dedup_misses);
+
+		/*
+		 * Most pages are unique, so once the table is half full only
+		 * images seen recently get an entry: the rest would crowd out
+		 * the ones that do get shared.
+		 */
+		if (c_segment_dedup_in_use < c_dedup_max_entries / 2 ||
+		    c_dedup_seen[dedup_hash % C_DEDUP_SEEN_SIZE] == dedup_hash) {
+			dedup_index = c_dedup_entry_alloc();
+		} else {
+			c_dedup_seen[dedup_hash % C_DEDUP_SEEN_SIZE] = dedup_hash;
+		}
 	}
 
 #if RECORD_THE_COMPRESSED_DATA
@@ -4795,6 +5334,10 @@ retry:
 	slot_ptr->s_uncompressed = 0;
 #endif /* CONFIG_TRACK_UNMODIFIED_ANON_PAGES */
 
+	if (dedup_index != C_DEDUP_NONE) {
+		c_dedup_insert(dedup_index, dedup_hash, c_rounded_size, cs, slot_ptr);
+	}
+
 sv_compression:
 	if (c_seg->c_nextoffset >= c_seg_off_limit || c_seg->c_nextslot >= C_SLOT_MAX_INDEX) {
 		c_current_seg_filled(c_seg, current_chead);
@@ -4896,6 +5439,10 @@ c_decompress_page(char *dst, volatile c_slot_mapping_t slot_ptr, vm_compressor_o
 	boolean_t       consider_defragmenting = FALSE;
 	boolean_t       kdp_mode = FALSE;
 
+	if (C_SLOT_IS_DEDUP(slot_ptr)) {
+		return c_dedup_decompress_page(dst, (c_slot_mapping_t)slot_ptr, flags, zeroslot);
+	}
+
 	if (__improbable(flags & C_KDP)) {
 		if (not_in_kdp) {
 			panic("C_KDP passed to decompress page from outside of debugger context");
@@ -5342,6 +5889,67 @@ done:
 	return retval;
 }
 
+/*
+ * c_decompress_page() for a page that maps a dedup entry: the shared copy
+ * is decompressed and kept, and only released, through the entry's own
+ * mapping, along with the last reference to it.
+ */
+static int
+c_dedup_decompress_page(char *dst, c_slot_mapping_t slot_ptr, vm_compressor_options_t flags, int *zeroslot)
+{
+	uint32_t        index = c_dedup_slot_index(slot_ptr);
+	struct c_dedup_entry *de = c_dedup_entry(index);
+	lck_mtx_t       *lock;
+	int             retval = 0;
+	int             free_retval;
+
+	if (flags & C_KEEP) {
+		/* covers C_KDP as well, which can't take the bucket lock */
+		return c_decompress_page(dst, &de->de_slot, flags, zeroslot);
+	}
+	lock = c_dedup_lock(de->de_hash);
+
+	lck_mtx_lock_spin_always(lock);
+
+	if (de->de_ref > 1) {
+		lck_mtx_unlock_always(lock);
+
+		if (dst) {
+			retval = c_decompress_page(dst, &de->de_slot, flags | C_KEEP, zeroslot);
+			if (retval < 0) {
+				return retval;
+			}
+			/* C_KEEP cleared it, but this page's reference is going away */
+			*zeroslot = 1;
+		}
+		lck_mtx_lock_spin_always(lock);
+
+		if (de->de_ref > 1) {
+			de->de_ref--;
+			lck_mtx_unlock_always(lock);
+
+			OSAddAtomic(-1, &c_segment_dedup_shared_pages);
+			OSAddAtomic64(-(int64_t)de->de_size, &c_segment_dedup_bytes_saved);
+			OSAddAtomic(-1, &c_segment_pages_compressed);
+			return retval;
+		}
+		/* everyone else let go in the meantime, so free the copy too */
+		dst = NULL;
+	}
+	c_dedup_unhash_locked(index, de);
+
+	lck_mtx_unlock_always(lock);
+
+	free_retval = c_decompress_page(dst, &de->de_slot, flags, zeroslot);
+	if (free_retval < 0) {
+		/* still holding the last reference: the caller will retry */
+		return free_retval;
+	}
+	c_dedup_entry_free(index);
+
+	return MAX(retval, free_retval);
+}
+
 
 inline bool
 vm_compressor_is_slot_compressed(int *slot)
@@ -5475,8 +6083,33 @@ vm_compressor_free(int *slot, vm_compressor_options_t flags)
 	return KERN_SUCCESS;
 }
 
+/*
+ * Compress page "pn" into "stage" without touching any c_segment.
+ *
+ * Called by the compressor threads on a batch of pages before committing
+ * them, in order, with vm_compressor_put().  No locks are taken here.
+ */
+void
+vm_compressor_stage_page(ppnum_t pn, c_stage_t stage, char *scratch_buf)
+{
+	char            *src;
+	boolean_t       incomp_copy = FALSE;
+	uint16_t        ccodec = CCWK;
+
+	src = pmap_map_compressor_page(pn);
+	assert(src != NULL);
+
+	stage->cst_size = c_compress_run_codec(src, stage->cst_buf, PAGE_SIZE,
+	    scratch_buf, &ccodec, &incomp_copy);
+	stage->cst_codec = ccodec;
+
+	pmap_unmap_compressor_page(pn, src);
+
+	OSAddAtomic64(1, &c_segment_staged_compressions);
+}
+
 int
-vm_compressor_put(ppnum_t pn, int *slot, void  **current_chead, char *scratch_buf, bool unmodified)
+vm_compressor_put(ppnum_t pn, int *slot, void  **current_chead, char *scratch_buf, c_stage_t stage, bool unmodified)
 {
 	char    *src;
 	int     retval = 0;
@@ -5498,10 +6131,14 @@ vm_compressor_put(ppnum_t pn, int *slot, void  **current_chead, char *scratch_bu
 #pragma unused(unmodified)
 #endif /* CONFIG_TRACK_UNMODIFIED_ANON_PAGES */
 
+	if (vm_compressor_dedup_enabled) {
+		c_dedup_grow();
+	}
+
 	src = pmap_map_compressor_page(pn);
 	assert(src != NULL);
 
-	retval = c_compress_page(src, (c_slot_mapping_t)slot, (c_segment_t *)current_chead, scratch_buf);
+	retval = c_compress_page(src, (c_slot_mapping_t)slot, (c_segment_t *)current_chead, scratch_buf, stage);
 	pmap_unmap_compressor_page(pn, src);
 
 	return retval;
@@ -5519,7 +6156,9 @@ vm_compressor_transfer(
 
 	src_slot = (c_slot_mapping_t) src_slot_p;
 
-	if (src_slot->s_cseg == C_SV_CSEG_ID || !vm_compressor_is_slot_compressed(src_slot_p)) {
+	if (src_slot->s_cseg == C_SV_CSEG_ID || C_SLOT_IS_DEDUP(src_slot) ||
+	    !vm_compressor_is_slot_compressed(src_slot_p)) {
+		/* the c_slot, if any, doesn't point back at src_slot */
 		*dst_slot_p = *src_slot_p;
 		*src_slot_p = 0;
 		return;
@@ -5632,6 +6271,14 @@ vm_compressor_relocate(
 		return kr;
 	}
 
+	if (C_SLOT_IS_DEDUP(src_slot)) {
+		/*
+		 * the compressed copy is shared with pages of other
+		 * tasks, so it stays where it is
+		 */
+		return kr;
+	}
+
 	if (vm_compressor_is_slot_compressed((int *)src_slot) == false) {
 		/*
 		 * Unmodified anonymous pages are sitting uncompressed on disk.
@@ -5861,6 +6508,11 @@ vm_compressor_inject_error(int *slot)
 		printf("%s(): cannot inject errors in SV-compressed pages\n", __func__ );
 		return;
 	}
+	/* Nor in a copy other pages share. */
+	if (C_SLOT_IS_DEDUP(slot_ptr)) {
+		printf("%s(): cannot inject errors in deduplicated pages\n", __func__ );
+		return;
+	}
 
 	/* s_cseg is actually "segno+1" */
 	const uint32_t c_segno = slot_ptr->s_cseg - 1;
@@ -5945,6 +6597,181 @@ vm_compressor_inject_error(int *slot)
 	PAGE_REPLACEMENT_DISALLOWED(FALSE);
 }
 
+struct codec_perf_slot {
+	uint32_t        cps_offset;
+	int32_t         cps_size;       /* -1 stored raw, 0 single value */
+	uint16_t        cps_codec;
+};
+
+/*
+ * Decodes a batch of pages packed by run_compressor_codec_perf_test(),
+ * first undoing the dense codec over the whole batch if it was applied.
+ */
+static kern_return_t
+codec_perf_flush(uint8_t *seg_buf, uint32_t seg_used, struct codec_perf_slot *slots, uint32_t nslots,
+    uint8_t *dense_buf, uint8_t *page_buf, void *scratch, bool dense, struct vm_compressor_codec_perf *perf)
+{
+	uint64_t        start, nsec;
+	uint32_t        pop_count;
+
+	if (dense) {
+		uint32_t dense_size;
+
+		start = mach_absolute_time();
+		dense_size = vm_compressor_dense_encode(seg_buf, seg_used, dense_buf, seg_used);
+		absolutetime_to_nanoseconds(mach_absolute_time() - start, &nsec);
+		perf->dense_compress_time += nsec;
+
+		if (dense_size == 0) {
+			/* incompressible, the swap path would write the batch as is */
+			perf->dense_bytes += seg_used;
+		} else {
+			perf->dense_bytes += dense_size;
+
+			start = mach_absolute_time();
+			if (!vm_compressor_dense_decode(dense_buf, dense_size, seg_used)) {
+				return KERN_FAILURE;
+			}
+			absolutetime_to_nanoseconds(mach_absolute_time() - start, &nsec);
+			perf->dense_decompress_time += nsec;
+
+			if (memcmp(dense_buf, seg_buf, seg_used)) {
+				return KERN_FAILURE;
+			}
+		}
+	}
+
+	start = mach_absolute_time();
+	for (uint32_t i = 0; i < nslots; i++) {
+		struct codec_perf_slot *cps = &slots[i];
+
+		if (cps->cps_size == -1) {
+			memcpy(page_buf, seg_buf + cps->cps_offset, PAGE_SIZE);
+		} else if (cps->cps_size == 0) {
+			sv_decompress((int32_t *)page_buf, *(int32_t *)(seg_buf + cps->cps_offset));
+		} else if (!metadecompressor(seg_buf + cps->cps_offset, page_buf, cps->cps_size,
+		    cps->cps_codec, scratch, &pop_count)) {
+			return KERN_FAILURE;
+		}
+	}
+	absolutetime_to_nanoseconds(mach_absolute_time() - start, &nsec);
+	perf->decompress_time += nsec;
+
+	return KERN_SUCCESS;
+}
+
+/*
+ * Corpus benchmark for the codecs, for kern.perf_compressor_codec.
+ *
+ * Runs the pages of the caller's buffer through the page codec `mode`,
+ * packing the output c_seg_bufsize at a time the way c_compress_page()
+ * does, then optionally through the dense codec the swap path would
+ * apply to each such batch, and decodes everything back.  Nothing is
+ * inserted into the compressor, so this measures the codecs alone.
+ */
+kern_return_t
+run_compressor_codec_perf_test(user_addr_t buf, size_t buffer_size, uint32_t mode,
+    bool dense, struct vm_compressor_codec_perf *perf)
+{
+	struct codec_perf_slot *slots = NULL;
+	uint8_t         *page_buf = NULL, *seg_buf = NULL, *dense_buf = NULL, *cdst = NULL;
+	void            *scratch = NULL;
+	uint32_t        scratch_size = vm_compressor_codec_bench_scratch_size();
+	uint32_t        seg_used = 0, nslots = 0;
+	uint64_t        start, nsec;
+	kern_return_t   kr = KERN_SUCCESS;
+
+	bzero(perf, sizeof(*perf));
+
+	if (mode != CMODE_WK && mode != CMODE_LZ4 && mode != CMODE_HYB) {
+		return KERN_INVALID_ARGUMENT;
+	}
+	if (buffer_size == 0 || (buffer_size & PAGE_MASK)) {
+		return KERN_INVALID_ARGUMENT;
+	}
+	if (dense && !vm_compressor_dense_init()) {
+		return KERN_RESOURCE_SHORTAGE;
+	}
+
+	page_buf = kalloc_data(PAGE_SIZE, Z_WAITOK);
+	cdst = kalloc_data(PAGE_SIZE, Z_WAITOK);
+	seg_buf = kalloc_data(c_seg_bufsize, Z_WAITOK);
+	dense_buf = kalloc_data(c_seg_bufsize, Z_WAITOK);
+	scratch = kalloc_data(scratch_size, Z_WAITOK);
+	slots = kalloc_data(C_SLOT_MAX_INDEX * sizeof(*slots), Z_WAITOK);
+
+	if (!page_buf || !cdst || !seg_buf || !dense_buf || !scratch || !slots) {
+		kr = KERN_RESOURCE_SHORTAGE;
+		goto out;
+	}
+
+	for (size_t offset = 0; offset < buffer_size; offset += PAGE_SIZE) {
+		struct codec_perf_slot *cps;
+		uint16_t        codec = CCWK;
+		uint32_t        stored;
+		int             c_size;
+
+		if (copyin(buf + offset, page_buf, PAGE_SIZE)) {
+			kr = KERN_INVALID_ARGUMENT;
+			goto out;
+		}
+
+		start = mach_absolute_time();
+		c_size = vm_compressor_codec_bench_encode(mode, page_buf, cdst,
+		    PAGE_SIZE - 4, &codec, scratch);
+		absolutetime_to_nanoseconds(mach_absolute_time() - start, &nsec);
+		perf->compress_time += nsec;
+
+		if (c_size == -1) {
+			stored = PAGE_SIZE;
+		} else if (c_size == 0) {
+			stored = sizeof(int);
+		} else {
+			stored = c_size;
+		}
+		stored = (stored + C_SEG_OFFSET_ALIGNMENT_MASK) & ~C_SEG_OFFSET_ALIGNMENT_MASK;
+
+		if (seg_used + stored > c_seg_bufsize || nslots == C_SLOT_MAX_INDEX) {
+			kr = codec_perf_flush(seg_buf, seg_used, slots, nslots, dense_buf, cdst,
+			    scratch, dense, perf);
+			if (kr != KERN_SUCCESS) {
+				goto out;
+			}
+			seg_used = nslots = 0;
+		}
+		cps = &slots[nslots++];
+		cps->cps_offset = seg_used;
+		cps->cps_size = c_size;
+		cps->cps_codec = codec;
+
+		if (c_size == -1) {
+			memcpy(seg_buf + seg_used, page_buf, PAGE_SIZE);
+		} else if (c_size == 0) {
+			*(int *)(seg_buf + seg_used) = *(int *)page_buf;
+		} else {
+			memcpy(seg_buf + seg_used, cdst, c_size);
+		}
+		seg_used += stored;
+
+		perf->pages++;
+		perf->compressed_bytes += stored;
+	}
+	if (nslots) {
+		kr = codec_perf_flush(seg_buf, seg_used, slots, nslots, dense_buf, cdst,
+		    scratch, dense, perf);
+	}
+
+out:
+	kfree_data(page_buf, PAGE_SIZE);
+	kfree_data(cdst, PAGE_SIZE);
+	kfree_data(seg_buf, c_seg_bufsize);
+	kfree_data(dense_buf, c_seg_bufsize);
+	kfree_data(scratch, scratch_size);
+	kfree_data(slots, C_SLOT_MAX_INDEX * sizeof(*slots));
+
+	return kr;
+}
+
 #endif /* DEVELOPMENT || DEBUG */
 
 
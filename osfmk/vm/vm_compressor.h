@@ -211,6 +211,13 @@ struct c_segment {
 	unsigned int    cseg_hash;
 	unsigned int    cseg_swap_size;
 #endif /* CHECKSUM_THE_SWAP */
+	/*
+	 * While on disk: the size of the dense codec output that was
+	 * written instead of the buffer, and how many bytes of buffer it
+	 * decodes to.  c_swap_dense_size is 0 if the buffer went out as is.
+	 */
+	uint32_t        c_swap_dense_size;
+	uint32_t        c_swap_dense_srcsize;
 
 	thread_t        c_busy_for_thread;
 	uint32_t        c_agedin_ts;
@@ -269,6 +276,23 @@ struct  c_slot_mapping {
 typedef struct c_slot_mapping *c_slot_mapping_t;
 
 
+/*
+ * A page run through the codec ahead of time by vm_compressor_stage_page(),
+ * into a buffer private to the compressor thread.  vm_compressor_put()
+ * then only has to copy the result into the current c_segment, so the
+ * c_seg lock and the c_master_lock are no longer held while the codec runs.
+ */
+struct c_stage {
+	char            *cst_buf;       /* PAGE_SIZE output buffer owned by the compressor thread */
+	int32_t         cst_size;       /* compressed size, 0 for a single value page, -1 if incompressible */
+	uint16_t        cst_codec;
+};
+typedef struct c_stage *c_stage_t;
+
+#define C_STAGE_EMPTY           (-2)    /* cst_size of a stage holding no page */
+#define C_STAGE_MAX_BATCH       16      /* upper bound for the vmcomp_batch boot-arg */
+
+
 extern  int             c_seg_fixed_array_len;
 extern  vm_offset_t     c_buffers;
 extern int64_t c_segment_compressed_bytes;
@@ -401,6 +425,7 @@ extern lck_rw_t         c_master_lock;
 #if ENCRYPTED_SWAP
 extern void             vm_swap_decrypt(c_segment_t);
 #endif /* ENCRYPTED_SWAP */
+extern bool             vm_swap_decode(c_segment_t);
 
 extern int              vm_swap_low_on_space(void);
 extern int              vm_swap_out_of_space(void);
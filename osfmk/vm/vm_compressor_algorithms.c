@@ -33,6 +33,9 @@
 #include "WKdm_new.h"
 #include <vm/vm_compressor_algorithms.h>
 #include <vm/vm_compressor.h>
+#include <vm/vm_kern.h>
+#include <kern/locks.h>
+#include <libkern/zlib.h>
 
 #define MZV_MAGIC (17185)
 #if defined(__arm64__)
@@ -473,3 +476,241 @@ vm_compressor_algorithm_init(void)
 	vm_compressor_current_codec = new_codec;
 #endif /* arm/arm64 */
 }
+
+/*
+ * Dense codec.
+ *
+ * zlib deflate over a whole c_segment buffer.  The encoder only runs on
+ * the swapout thread and the decoder on the swapin/reclaim paths, so
+ * each direction gets a single preallocated workspace serialized by a
+ * mutex, rather than per-CPU state: the I/O that follows dwarfs the wait.
+ */
+extern uint32_t c_seg_bufsize;
+
+TUNABLE_WRITEABLE(uint32_t, vm_compressor_dense_mode, "vm_compressor_dense_mode", CDENSE_FROZEN);
+TUNABLE_WRITEABLE(uint32_t, vm_compressor_dense_age, "vm_compressor_dense_age", 300);
+TUNABLE(int, vm_compressor_dense_level, "vm_compressor_dense_level", Z_DEFAULT_COMPRESSION);
+
+#define DENSE_WBITS             15
+#define DENSE_MEMLEVEL          8
+/* struct inflate_state plus the 32K window, with room for alignment */
+#define DENSE_INFLATE_WS_SIZE   (64 * 1024)
+
+#define DENSE_ROUND_32B(x)      (~31UL & (31 + (x)))
+
+struct vm_compressor_dense_ws {
+	z_stream        cdw_zs;
+	vm_offset_t     cdw_base;
+	vm_size_t       cdw_size;
+	vm_size_t       cdw_offset;
+};
+
+static struct vm_compressor_dense_ws vm_compressor_dense_encoder;
+static struct vm_compressor_dense_ws vm_compressor_dense_decoder;
+static uint8_t *vm_compressor_dense_decode_buf;     /* c_seg_bufsize, holds the input */
+static bool vm_compressor_dense_ready = false;
+
+LCK_GRP_DECLARE(vm_compressor_dense_lck_grp, "vm_compressor_dense");
+LCK_MTX_DECLARE(vm_compressor_dense_init_lock, &vm_compressor_dense_lck_grp);
+LCK_MTX_DECLARE(vm_compressor_dense_encode_lock, &vm_compressor_dense_lck_grp);
+LCK_MTX_DECLARE(vm_compressor_dense_decode_lock, &vm_compressor_dense_lck_grp);
+
+static void *
+vm_compressor_dense_zalloc(void *opaque, u_int items, u_int size)
+{
+	struct vm_compressor_dense_ws *ws = opaque;
+	vm_size_t len = DENSE_ROUND_32B((vm_size_t)items * size);
+	void *result;
+
+	if (ws->cdw_offset + len > ws->cdw_size) {
+		return Z_NULL;
+	}
+	result = (void *)(ws->cdw_base + ws->cdw_offset);
+	ws->cdw_offset += len;
+
+	return result;
+}
+
+static void
+vm_compressor_dense_zfree(__unused void *opaque, __unused void *ptr)
+{
+	/* the workspaces are permanent, zlib only frees them on End() */
+}
+
+static bool
+vm_compressor_dense_ws_alloc(struct vm_compressor_dense_ws *ws, vm_size_t size)
+{
+	kern_return_t kr;
+
+	if (ws->cdw_base) {
+		return true;
+	}
+	kr = kmem_alloc(kernel_map, &ws->cdw_base, round_page(size),
+	    KMA_DATA | KMA_KOBJECT | KMA_PERMANENT, VM_KERN_MEMORY_COMPRESSOR);
+	if (kr != KERN_SUCCESS) {
+		ws->cdw_base = 0;
+		return false;
+	}
+	ws->cdw_size = round_page(size);
+	ws->cdw_offset = 0;
+	ws->cdw_zs.zalloc = vm_compressor_dense_zalloc;
+	ws->cdw_zs.zfree = vm_compressor_dense_zfree;
+	ws->cdw_zs.opaque = ws;
+
+	return true;
+}
+
+/*
+ * Sets up the dense codec the first time it is needed, so systems that
+ * never swap don't pay for the workspaces.  Returns false if it couldn't
+ * be, in which case segments are written out as is.
+ */
+bool
+vm_compressor_dense_init(void)
+{
+	vm_size_t deflate_size;
+
+	if (os_atomic_load(&vm_compressor_dense_ready, acquire)) {
+		return true;
+	}
+	/* zlib_deflate_memory_size() doesn't account for our 32 byte rounding */
+	deflate_size = zlib_deflate_memory_size(DENSE_WBITS, DENSE_MEMLEVEL) + PAGE_SIZE;
+
+	lck_mtx_lock(&vm_compressor_dense_init_lock);
+
+	if (!vm_compressor_dense_ready &&
+	    vm_compressor_dense_ws_alloc(&vm_compressor_dense_encoder, deflate_size) &&
+	    vm_compressor_dense_ws_alloc(&vm_compressor_dense_decoder, DENSE_INFLATE_WS_SIZE) &&
+	    (vm_compressor_dense_decode_buf != NULL ||
+	    kmem_alloc(kernel_map, (vm_offset_t *)&vm_compressor_dense_decode_buf, c_seg_bufsize,
+	    KMA_DATA | KMA_KOBJECT | KMA_PERMANENT, VM_KERN_MEMORY_COMPRESSOR) == KERN_SUCCESS)) {
+		if (deflateInit2(&vm_compressor_dense_encoder.cdw_zs, vm_compressor_dense_level,
+		    Z_DEFLATED, DENSE_WBITS, DENSE_MEMLEVEL, Z_DEFAULT_STRATEGY) != Z_OK) {
+			panic("vm_compressor_dense_init: deflateInit2 failed");
+		}
+		if (inflateInit2(&vm_compressor_dense_decoder.cdw_zs, DENSE_WBITS) != Z_OK) {
+			panic("vm_compressor_dense_init: inflateInit2 failed");
+		}
+		os_atomic_store(&vm_compressor_dense_ready, true, release);
+	}
+	lck_mtx_unlock(&vm_compressor_dense_init_lock);
+
+	return vm_compressor_dense_ready;
+}
+
+/*
+ * Returns the size of the encoded data, or 0 if it didn't fit in dstlen,
+ * in which case the caller should keep the raw segment.
+ */
+uint32_t
+vm_compressor_dense_encode(const uint8_t *src, uint32_t srclen, uint8_t *dst, uint32_t dstlen)
+{
+	z_stream        *zs = &vm_compressor_dense_encoder.cdw_zs;
+	uint32_t        dsize = 0;
+	__unused uint64_t start;
+	int             zr;
+
+	assert(vm_compressor_dense_ready);
+
+	lck_mtx_lock(&vm_compressor_dense_encode_lock);
+	VM_COMPRESSOR_STAT(start = mach_absolute_time());
+
+	zr = deflateReset(zs);
+	assert(zr == Z_OK);
+
+	zs->next_in = (Bytef *)(uintptr_t)src;
+	zs->avail_in = srclen;
+	zs->next_out = dst;
+	zs->avail_out = dstlen;
+
+	zr = deflate(zs, Z_FINISH);
+	if (zr == Z_STREAM_END) {
+		dsize = (uint32_t)zs->total_out;
+	}
+	VM_COMPRESSOR_STAT(compressor_stats.dense_cabstime += mach_absolute_time() - start);
+	lck_mtx_unlock(&vm_compressor_dense_encode_lock);
+
+	os_atomic_inc(&compressor_stats.dense_compressions, relaxed);
+	if (dsize == 0) {
+		os_atomic_inc(&compressor_stats.dense_compression_failures, relaxed);
+	} else {
+		os_atomic_add(&compressor_stats.dense_compressed_bytes_in, srclen, relaxed);
+		os_atomic_add(&compressor_stats.dense_compressed_bytes_out, dsize, relaxed);
+	}
+	return dsize;
+}
+
+/*
+ * Decodes the srclen bytes at the start of buf back into the dstlen bytes
+ * they were encoded from, in place.  Returns true on success.
+ */
+bool
+vm_compressor_dense_decode(uint8_t *buf, uint32_t srclen, uint32_t dstlen)
+{
+	z_stream        *zs = &vm_compressor_dense_decoder.cdw_zs;
+	bool            success;
+	__unused uint64_t start;
+	int             zr;
+
+	assert(vm_compressor_dense_ready);
+	assert(srclen <= dstlen && dstlen <= c_seg_bufsize);
+
+	lck_mtx_lock(&vm_compressor_dense_decode_lock);
+	VM_DECOMPRESSOR_STAT(start = mach_absolute_time());
+
+	memcpy(vm_compressor_dense_decode_buf, buf, srclen);
+
+	zr = inflateReset(zs);
+	assert(zr == Z_OK);
+
+	zs->next_in = (Bytef *)vm_compressor_dense_decode_buf;
+	zs->avail_in = srclen;
+	zs->next_out = buf;
+	zs->avail_out = dstlen;
+
+	zr = inflate(zs, Z_FINISH);
+	success = (zr == Z_STREAM_END && zs->total_out == dstlen);
+
+	VM_DECOMPRESSOR_STAT(compressor_stats.dense_dabstime += mach_absolute_time() - start);
+	lck_mtx_unlock(&vm_compressor_dense_decode_lock);
+
+	os_atomic_inc(&compressor_stats.dense_decompressions, relaxed);
+
+	return success;
+}
+
+#if DEVELOPMENT || DEBUG
+uint32_t
+vm_compressor_codec_bench_scratch_size(void)
+{
+	return MAX(sizeof(compressor_encode_scratch_t), WKdm_SCRATCH_BUF_SIZE_INTERNAL);
+}
+
+/*
+ * Runs one page through the given codec without touching the hybrid
+ * selector state, so the benchmark doesn't perturb the live compressor.
+ * CMODE_HYB falls back to LZ4 above the usual threshold.
+ */
+int
+vm_compressor_codec_bench_encode(vm_compressor_mode_t mode, const uint8_t *in,
+    uint8_t *cdst, int32_t outbufsz, uint16_t *codec, void *cscratchin)
+{
+	compressor_encode_scratch_t *cscratch = cscratchin;
+	boolean_t incomp_copy = FALSE;
+	uint32_t pop_count;
+	int sz = -1;
+
+	if (mode != CMODE_LZ4) {
+		*codec = CCWK;
+		sz = WKdmC((WK_word *)(uintptr_t)in, (WK_word *)(uintptr_t)cdst,
+		    (WK_word *)(uintptr_t)&cscratch->wkscratch[0], &incomp_copy, outbufsz, &pop_count);
+		if (mode == CMODE_WK || (sz != -1 && sz < vmctune.lz4_threshold)) {
+			return sz;
+		}
+	}
+	*codec = CCLZ4;
+	sz = (int)lz4raw_encode_buffer(cdst, outbufsz, in, PAGE_SIZE, &cscratch->lz4state[0]);
+
+	return sz ? sz : -1;
+}
+#endif /* DEVELOPMENT || DEBUG */
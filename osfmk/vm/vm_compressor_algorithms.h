@@ -72,6 +72,14 @@ typedef struct {
 
 	uint64_t wk_decompressed_bytes;
 	uint64_t wk_sv_decompressions;
+
+	uint64_t dense_compressions;
+	uint64_t dense_compression_failures;
+	uint64_t dense_compressed_bytes_in;
+	uint64_t dense_compressed_bytes_out;
+	uint64_t dense_cabstime;
+	uint64_t dense_decompressions;
+	uint64_t dense_dabstime;
 } compressor_stats_t;
 
 extern compressor_stats_t compressor_stats;
@@ -111,4 +119,46 @@ typedef enum {
 
 void vm_compressor_algorithm_init(void);
 int vm_compressor_algorithm(void);
+
+/*
+ * The dense codec trades CPU for ratio: it entropy codes a whole c_segment
+ * worth of WKdm/LZ4 output at once and is only used on the swap path, where
+ * the segment is cold and the cost of the I/O dominates.  Which segments
+ * get it is selected by vm_compressor_dense_mode.
+ */
+typedef enum {
+	CDENSE_OFF = 0,         /* never */
+	CDENSE_FROZEN = 1,      /* segments pushed out by the freezer */
+	CDENSE_AGED = 2,        /* and segments older than vm_compressor_dense_age */
+	CDENSE_ALL = 3,         /* every segment written to swap */
+	CDENSE_INVALID = 4
+} vm_compressor_dense_mode_t;
+
+extern uint32_t vm_compressor_dense_mode;
+extern uint32_t vm_compressor_dense_age;
+
+bool vm_compressor_dense_init(void);
+uint32_t vm_compressor_dense_encode(const uint8_t *src, uint32_t srclen,
+    uint8_t *dst, uint32_t dstlen);
+bool vm_compressor_dense_decode(uint8_t *buf, uint32_t srclen, uint32_t dstlen);
+
+#if DEVELOPMENT || DEBUG
+uint32_t vm_compressor_codec_bench_scratch_size(void);
+int vm_compressor_codec_bench_encode(vm_compressor_mode_t mode, const uint8_t *in,
+    uint8_t *cdst, int32_t outbufsz, uint16_t *codec, void *cscratch);
+
+/*
+ * Results of the kern.perf_compressor_codec benchmark, see
+ * run_compressor_codec_perf_test().
+ */
+struct vm_compressor_codec_perf {
+	uint64_t        pages;
+	uint64_t        compressed_bytes;       /* output of the page codec */
+	uint64_t        dense_bytes;            /* output of the dense codec, 0 if not run */
+	uint64_t        compress_time;          /* nanoseconds */
+	uint64_t        decompress_time;
+	uint64_t        dense_compress_time;
+	uint64_t        dense_decompress_time;
+};
+#endif /* DEVELOPMENT || DEBUG */
 #endif /* XNU_KERNEL_PRIVATE */
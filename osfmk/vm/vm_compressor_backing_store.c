@@ -29,6 +29,7 @@
 #include "vm_compressor_backing_store.h"
 #include <vm/vm_pageout.h>
 #include <vm/vm_protos.h>
+#include <vm/vm_compressor_algorithms.h>
 
 #include <IOKit/IOHibernatePrivate.h>
 
@@ -352,25 +353,17 @@ swap_crypt_initialize(void)
 }
 
 
-void
-vm_swap_encrypt(c_segment_t c_seg)
+static void
+vm_swap_encrypt_buffer(c_segment_t c_seg, uint8_t *ptr, int size)
 {
-	uint8_t *ptr;
 	uint8_t *iv;
 	uint64_t ivnum[2];
-	int size = 0;
 	int rc   = 0;
 
 	if (swap_crypt_initialized == FALSE) {
 		swap_crypt_initialize();
 	}
 
-#if DEVELOPMENT || DEBUG
-	C_SEG_MAKE_WRITEABLE(c_seg);
-#endif
-	ptr = (uint8_t *)c_seg->c_store.c_buffer;
-	size = round_page_32(C_SEG_OFFSET_TO_BYTES(c_seg->c_populated_offset));
-
 	ivnum[0] = (uint64_t)c_seg;
 	ivnum[1] = 0;
 	iv = (uint8_t *)ivnum;
@@ -379,12 +372,27 @@ vm_swap_encrypt(c_segment_t c_seg)
 	assert(!rc);
 
 	vm_page_encrypt_counter += (size / PAGE_SIZE_64);
+}
+
+void
+vm_swap_encrypt(c_segment_t c_seg)
+{
+#if DEVELOPMENT || DEBUG
+	C_SEG_MAKE_WRITEABLE(c_seg);
+#endif
+	vm_swap_encrypt_buffer(c_seg, (uint8_t *)c_seg->c_store.c_buffer,
+	    round_page_32(C_SEG_OFFSET_TO_BYTES(c_seg->c_populated_offset)));
 
 #if DEVELOPMENT || DEBUG
 	C_SEG_WRITE_PROTECT(c_seg);
 #endif
 }
 
+/*
+ * Decrypts the image of c_seg that is in its buffer, which is the
+ * dense codec output rather than the whole buffer if that is what
+ * was written out.
+ */
 void
 vm_swap_decrypt(c_segment_t c_seg)
 {
@@ -400,7 +408,11 @@ vm_swap_decrypt(c_segment_t c_seg)
 	C_SEG_MAKE_WRITEABLE(c_seg);
 #endif
 	ptr = (uint8_t *)c_seg->c_store.c_buffer;
-	size = round_page_32(C_SEG_OFFSET_TO_BYTES(c_seg->c_populated_offset));
+	if (c_seg->c_swap_dense_size) {
+		size = round_page_32(c_seg->c_swap_dense_size);
+	} else {
+		size = round_page_32(C_SEG_OFFSET_TO_BYTES(c_seg->c_populated_offset));
+	}
 
 	ivnum[0] = (uint64_t)c_seg;
 	ivnum[1] = 0;
@@ -1156,6 +1168,109 @@ vm_swapout_complete_soc(struct swapout_io_completion *soc)
 	vm_swapout_soc_done--;
 }
 
+/*
+ * Whether c_seg should be written out with the dense codec, which
+ * costs CPU on both the way out and the way back in, so it's reserved
+ * for segments unlikely to be needed soon: see vm_compressor_dense_mode.
+ */
+static bool
+vm_swapout_wants_dense(c_segment_t c_seg)
+{
+	clock_sec_t     sec;
+	clock_nsec_t    nsec;
+
+	if (hibernate_flushing == TRUE) {
+		return false;
+	}
+	switch (vm_compressor_dense_mode) {
+	case CDENSE_ALL:
+		return true;
+
+	case CDENSE_AGED:
+		clock_get_system_nanotime(&sec, &nsec);
+
+		if ((uint32_t)sec - c_seg->c_creation_ts >= vm_compressor_dense_age) {
+			return true;
+		}
+		OS_FALLTHROUGH;
+
+	case CDENSE_FROZEN:
+#if CONFIG_FREEZE
+		return c_seg->c_has_freezer_pages;
+#else /* CONFIG_FREEZE */
+		return false;
+#endif /* CONFIG_FREEZE */
+
+	default:
+		return false;
+	}
+}
+
+/*
+ * Encodes the size bytes of c_seg's buffer into soc's dense buffer.
+ * Returns false, leaving c_seg to be written out as is, if that doesn't
+ * save at least a page of I/O.
+ */
+static bool
+vm_swapout_dense_encode(c_segment_t c_seg, struct swapout_io_completion *soc, uint32_t size)
+{
+	uint32_t        dense_size;
+
+	if (size <= PAGE_SIZE || !vm_compressor_dense_init()) {
+		return false;
+	}
+	if (soc->swp_dense_buf == NULL &&
+	    kmem_alloc(kernel_map, (vm_offset_t *)&soc->swp_dense_buf, c_seg_bufsize,
+	    KMA_DATA | KMA_KOBJECT | KMA_PERMANENT, VM_KERN_MEMORY_COMPRESSOR) != KERN_SUCCESS) {
+		soc->swp_dense_buf = NULL;
+		return false;
+	}
+	dense_size = vm_compressor_dense_encode((const uint8_t *)c_seg->c_store.c_buffer, size,
+	    soc->swp_dense_buf, size - PAGE_SIZE);
+
+	if (dense_size == 0) {
+		return false;
+	}
+	c_seg->c_swap_dense_size = dense_size;
+	c_seg->c_swap_dense_srcsize = size;
+
+	return true;
+}
+
+/*
+ * Undoes the encryption and the dense codec, if any, on the image of
+ * c_seg that was just read back into its buffer.  Returns false if the
+ * dense image didn't decode, in which case the contents are lost.
+ */
+bool
+vm_swap_decode(c_segment_t c_seg)
+{
+	bool            success = true;
+
+#if ENCRYPTED_SWAP
+	vm_swap_decrypt(c_seg);
+#endif /* ENCRYPTED_SWAP */
+
+	if (c_seg->c_swap_dense_size) {
+#if DEVELOPMENT || DEBUG
+		C_SEG_MAKE_WRITEABLE(c_seg);
+#endif
+		success = vm_compressor_dense_decode((uint8_t *)c_seg->c_store.c_buffer,
+		    c_seg->c_swap_dense_size, c_seg->c_swap_dense_srcsize);
+#if DEVELOPMENT || DEBUG
+		C_SEG_WRITE_PROTECT(c_seg);
+#endif
+		if (success) {
+			os_atomic_inc(&vmcs_stats.dense_swapins, relaxed);
+		} else {
+			os_atomic_inc(&vmcs_stats.dense_decode_failures, relaxed);
+		}
+		c_seg->c_swap_dense_size = 0;
+		c_seg->c_swap_dense_srcsize = 0;
+	}
+	return success;
+}
+
 bool vm_swapout_thread_inited = false;
 extern uint32_t c_donate_swapout_count;
 #if CONFIG_JETSAM
@@ -1189,6 +1304,8 @@ void
 vm_swapout_thread(void)
 {
 	uint32_t        size = 0;
+	uint32_t        io_size = 0;
+	vm_offset_t     io_addr = 0;
 	c_segment_t     c_seg = NULL;
 	kern_return_t   kr = KERN_SUCCESS;
 	struct swapout_io_completion *soc;
@@ -1258,18 +1375,29 @@ again:
 		c_seg->cseg_swap_size = size;
 #endif /* CHECKSUM_THE_SWAP */
 
-#if ENCRYPTED_SWAP
-		vm_swap_encrypt(c_seg);
-#endif /* ENCRYPTED_SWAP */
-
 		soc = vm_swapout_find_free_soc();
 		assert(soc);
 
+		io_addr = (vm_offset_t)c_seg->c_store.c_buffer;
+		io_size = size;
+
+		if (vm_swapout_wants_dense(c_seg) && vm_swapout_dense_encode(c_seg, soc, size)) {
+			io_addr = (vm_offset_t)soc->swp_dense_buf;
+			io_size = round_page_32(c_seg->c_swap_dense_size);
+#if ENCRYPTED_SWAP
+			vm_swap_encrypt_buffer(c_seg, soc->swp_dense_buf, io_size);
+#endif /* ENCRYPTED_SWAP */
+		} else {
+#if ENCRYPTED_SWAP
+			vm_swap_encrypt(c_seg);
+#endif /* ENCRYPTED_SWAP */
+		}
+
 		soc->swp_upl_ctx.io_context = (void *)soc;
 		soc->swp_upl_ctx.io_done = (void *)vm_swapout_iodone;
 		soc->swp_upl_ctx.io_error = 0;
 
-		kr = vm_swap_put((vm_offset_t)c_seg->c_store.c_buffer, &soc->swp_f_offset, size, c_seg, soc);
+		kr = vm_swap_put(io_addr, &soc->swp_f_offset, io_size, c_seg, soc);
 
 		if (kr != KERN_SUCCESS) {
 			if (soc->swp_io_done) {
@@ -1280,7 +1408,7 @@ again:
 
 				lck_mtx_unlock_always(c_list_lock);
 			}
-			vm_swapout_finish(c_seg, soc->swp_f_offset, size, kr);
+			vm_swapout_finish(c_seg, soc->swp_f_offset, io_size, kr);
 		} else {
 			soc->swp_io_busy = 1;
 			vm_swapout_soc_busy++;
@@ -1389,14 +1517,33 @@ vm_swapout_iodone(void *io_context, int error)
 }
 
 
+/*
+ * size is the number of bytes that went to disk, which is less than
+ * the populated size of the buffer if it was written with the dense codec.
+ */
 static void
 vm_swapout_finish(c_segment_t c_seg, uint64_t f_offset, uint32_t size, kern_return_t kr)
 {
 	PAGE_REPLACEMENT_DISALLOWED(TRUE);
 
 	if (kr == KERN_SUCCESS) {
-		kernel_memory_depopulate((vm_offset_t)c_seg->c_store.c_buffer, size,
+		uint32_t populated_size = size;
+
+		if (c_seg->c_swap_dense_size) {
+			populated_size = c_seg->c_swap_dense_srcsize;
+
+			os_atomic_inc(&vmcs_stats.dense_swapouts, relaxed);
+			os_atomic_add(&vmcs_stats.dense_swapout_bytes_saved, populated_size - size, relaxed);
+		}
+		kernel_memory_depopulate((vm_offset_t)c_seg->c_store.c_buffer, populated_size,
 		    KMA_COMPRESSOR, VM_KERN_MEMORY_COMPRESSOR);
+	} else if (c_seg->c_swap_dense_size) {
+		/*
+		 * Only the copy in the soc was encoded (and encrypted),
+		 * the buffer is untouched.
+		 */
+		c_seg->c_swap_dense_size = 0;
+		c_seg->c_swap_dense_srcsize = 0;
 	}
 #if ENCRYPTED_SWAP
 	else {
@@ -2110,6 +2257,7 @@ vm_swap_reclaim(void)
 	unsigned int    byte_for_segidx = 0;
 	unsigned int    offset_within_byte = 0;
 	uint32_t        c_size = 0;
+	uint32_t        populated_size = 0;
 
 	c_segment_t     c_seg = NULL;
 
@@ -2242,6 +2390,15 @@ ReTry_for_cseg:
 
 		assert(c_size <= c_seg_bufsize && c_size);
 
+		/*
+		 * A dense image is moved as is, only the part of the
+		 * buffer it decodes to needs populating if the put fails.
+		 */
+		populated_size = c_size;
+		if (c_seg->c_swap_dense_size) {
+			c_size = round_page_32(c_seg->c_swap_dense_size);
+		}
+
 		lck_mtx_unlock_always(&c_seg->c_lock);
 
 		if (vnode_getwithref(swf->swp_vp)) {
@@ -2277,16 +2434,21 @@ ReTry_for_cseg:
 			 */
 			c_buffer = (vm_offset_t)C_SEG_BUFFER_ADDRESS(c_seg->c_mysegno);
 
-			kernel_memory_populate(c_buffer, c_size,
+			kernel_memory_populate(c_buffer, populated_size,
 			    KMA_NOFAIL | KMA_COMPRESSOR,
 			    VM_KERN_MEMORY_COMPRESSOR);
 
 			memcpy((char *)c_buffer, (char *)addr, c_size);
 
 			c_seg->c_store.c_buffer = (int32_t *)c_buffer;
-#if ENCRYPTED_SWAP
-			vm_swap_decrypt(c_seg);
-#endif /* ENCRYPTED_SWAP */
+
+			if (!vm_swap_decode(c_seg)) {
+				kernel_memory_depopulate(c_buffer, populated_size,
+				    KMA_COMPRESSOR, VM_KERN_MEMORY_COMPRESSOR);
+
+				c_seg_swapin_requeue(c_seg, FALSE, TRUE, FALSE);
+				goto swap_io_failed;
+			}
 			c_seg_swapin_requeue(c_seg, TRUE, TRUE, FALSE);
 			/*
 			 * returns with c_busy_swapping cleared
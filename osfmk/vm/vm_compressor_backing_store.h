@@ -83,6 +83,7 @@ struct swapout_io_completion {
 
 	uint32_t     swp_c_size;
 	c_segment_t  swp_c_seg;
+	uint8_t      *swp_dense_buf;    /* c_seg_bufsize, for the dense codec output */
 
 	struct swapfile *swp_swf;
 	uint64_t        swp_f_offset;
@@ -747,6 +747,7 @@ vm_compressor_pager_put(
 	bool                            unmodified,
 	void                            **current_chead,
 	char                            *scratch_buf,
+	struct c_stage                  *stage,
 	int                             *compressed_count_delta_p)
 {
 	compressor_pager_t      pager;
@@ -797,7 +798,7 @@ vm_compressor_pager_put(
 	 * disconnected.
 	 */
 
-	if (vm_compressor_put(ppnum, slot_p, current_chead, scratch_buf, unmodified)) {
+	if (vm_compressor_put(ppnum, slot_p, current_chead, scratch_buf, stage, unmodified)) {
 		return KERN_RESOURCE_SHORTAGE;
 	}
 	*compressed_count_delta_p += 1;
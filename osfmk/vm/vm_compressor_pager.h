@@ -35,6 +35,8 @@
 #include <kern/kern_types.h>
 #include <vm/vm_external.h>
 
+struct c_stage;
+
 extern kern_return_t vm_compressor_pager_put(
 	memory_object_t                 mem_obj,
 	memory_object_offset_t          offset,
@@ -42,6 +44,7 @@ extern kern_return_t vm_compressor_pager_put(
 	bool                            unmodified,
 	void                            **current_chead,
 	char                            *scratch_buf,
+	struct c_stage                  *stage,
 	int                             *compressed_count_delta_p);
 extern kern_return_t vm_compressor_pager_get(
 	memory_object_t         mem_obj,
@@ -115,7 +118,8 @@ extern memory_object_offset_t vm_compressor_pager_next_compressed(
 extern bool osenvironment_is_diagnostics(void);
 extern void vm_compressor_init(void);
 extern bool vm_compressor_is_slot_compressed(int *slot);
-extern int vm_compressor_put(ppnum_t pn, int *slot, void **current_chead, char *scratch_buf, bool unmodified);
+extern int vm_compressor_put(ppnum_t pn, int *slot, void **current_chead, char *scratch_buf, struct c_stage *stage, bool unmodified);
+extern void vm_compressor_stage_page(ppnum_t pn, struct c_stage *stage, char *scratch_buf);
 extern int vm_compressor_get(ppnum_t pn, int *slot, vm_compressor_options_t flags);
 extern int vm_compressor_free(int *slot, vm_compressor_options_t flags);
 
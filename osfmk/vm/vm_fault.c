@@ -89,6 +89,7 @@
 #include <vm/vm_compressor.h>
 #include <vm/vm_compressor_pager.h>
 #include <vm/vm_fault.h>
+#include <vm/vm_launch_trace_internal.h>
 #include <vm/vm_map.h>
 #include <vm/vm_object.h>
 #include <vm/vm_page.h>
@@ -3407,6 +3408,17 @@ vm_fault_enter_set_mapped(
 	return page_needs_sync;
 }
 
+/*
+ * pmap_enter() flags for a fault: a page of an entry with promoted ranges
+ * may have to be mapped as part of its superpage (see vm_superpage.c).
+ */
+#if CONFIG_TRANSPARENT_SUPERPAGES
+#define VM_FAULT_PMAP_FLAGS(fault_info) \
+	((fault_info)->fi_promoted ? VM_MEM_SUPERPAGE : 0)
+#else /* CONFIG_TRANSPARENT_SUPERPAGES */
+#define VM_FAULT_PMAP_FLAGS(fault_info) 0
+#endif /* CONFIG_TRANSPARENT_SUPERPAGES */
+
 /*
  * wrapper for pmap_enter_options()
  */
@@ -3435,6 +3447,21 @@ pmap_enter_options_check(
 	if (page->vmp_reusable || obj->all_reusable) {
 		extra_options |= PMAP_OPTIONS_REUSABLE;
 	}
+#if CONFIG_TRANSPARENT_SUPERPAGES
+	if (__improbable(flags & VM_MEM_SUPERPAGE)) {
+		/*
+		 * The map entry has promoted ranges (VM_FAULT_PMAP_FLAGS()).
+		 * A promoted page is only ever mapped as part of its
+		 * superpage: put the whole superpage mapping back.
+		 */
+		if (page->vmp_promoted) {
+			fault_phys_offset -= virtual_address & ~SUPERPAGE_MASK;
+			virtual_address &= SUPERPAGE_MASK;
+		} else {
+			flags &= ~VM_MEM_SUPERPAGE;
+		}
+	}
+#endif /* CONFIG_TRANSPARENT_SUPERPAGES */
 	return pmap_enter_options_addr(pmap,
 	           virtual_address,
 	           (pmap_paddr_t)ptoa(VM_PAGE_GET_PHYS_PAGE(page)) + fault_phys_offset,
@@ -3462,6 +3489,7 @@ vm_fault_attempt_pmap_enter(
 	vm_prot_t *prot,
 	vm_prot_t caller_prot,
 	vm_prot_t fault_type,
+	unsigned int flags,
 	bool wired,
 	int pmap_options)
 {
@@ -3482,7 +3510,7 @@ vm_fault_attempt_pmap_enter(
 
 	kr = pmap_enter_options_check(pmap, vaddr,
 	    fault_phys_offset,
-	    m, *prot, fault_type, 0,
+	    m, *prot, fault_type, flags,
 	    wired,
 	    pmap_options);
 
@@ -3499,7 +3527,7 @@ vm_fault_attempt_pmap_enter(
 		*prot &= ~VM_PROT_EXECUTE;
 		kr = pmap_enter_options_check(pmap, vaddr,
 		    fault_phys_offset,
-		    m, *prot, fault_type, 0,
+		    m, *prot, fault_type, flags,
 		    wired,
 		    pmap_options);
 	}
@@ -3526,6 +3554,7 @@ vm_fault_pmap_enter(
 	vm_prot_t *prot,
 	vm_prot_t caller_prot,
 	vm_prot_t fault_type,
+	unsigned int flags,
 	bool wired,
 	int pmap_options,
 	boolean_t *need_retry)
@@ -3541,7 +3570,7 @@ vm_fault_pmap_enter(
 	}
 	kr = vm_fault_attempt_pmap_enter(pmap, vaddr,
 	    fault_page_size, fault_phys_offset,
-	    m, prot, caller_prot, fault_type, wired, pmap_options);
+	    m, prot, caller_prot, fault_type, flags, wired, pmap_options);
 	if (kr == KERN_RESOURCE_SHORTAGE) {
 		if (need_retry) {
 			/*
@@ -3576,6 +3605,7 @@ vm_fault_pmap_enter_with_object_lock(
 	vm_prot_t *prot,
 	vm_prot_t caller_prot,
 	vm_prot_t fault_type,
+	unsigned int flags,
 	bool wired,
 	int pmap_options,
 	boolean_t *need_retry,
@@ -3589,7 +3619,8 @@ vm_fault_pmap_enter_with_object_lock(
 	 */
 	kr = vm_fault_attempt_pmap_enter(pmap, vaddr,
 	    fault_page_size, fault_phys_offset,
-	    m, prot, caller_prot, fault_type, wired, pmap_options | PMAP_OPTIONS_NOWAIT);
+	    m, prot, caller_prot, fault_type, flags, wired,
+	    pmap_options | PMAP_OPTIONS_NOWAIT);
 #if __x86_64__
 	if (kr == KERN_INVALID_ARGUMENT &&
 	    pmap == PMAP_NULL &&
@@ -3638,7 +3669,7 @@ vm_fault_pmap_enter_with_object_lock(
 		kr = pmap_enter_options_check(pmap, vaddr,
 		    fault_phys_offset,
 		    m, *prot, fault_type,
-		    0, wired,
+		    flags, wired,
 		    pmap_options);
 
 		assert(VM_PAGE_OBJECT(m) == object);
@@ -3907,7 +3938,8 @@ vm_fault_enter(
 
 		kr = vm_fault_pmap_enter_with_object_lock(object, pmap, vaddr,
 		    fault_page_size, fault_phys_offset, m,
-		    &prot, caller_prot, fault_type, wired, pmap_options, need_retry, object_lock_type);
+		    &prot, caller_prot, fault_type, VM_FAULT_PMAP_FLAGS(fault_info),
+		    wired, pmap_options, need_retry, object_lock_type);
 	}
 
 	return kr;
@@ -3989,6 +4021,168 @@ current_proc_is_privileged(void)
 
 uint64_t vm_copied_on_read = 0;
 
+/*
+ * Fault-around.
+ *
+ * When a read fault on a resident page of a file-backed object is
+ * resolved, also map the resident pages that follow it (or precede it,
+ * when the object is being read backwards), read-only, so that a
+ * sequential reader takes one fault per window instead of one per page.
+ *
+ * The window follows the object's sequential run: it starts at
+ * vm_fault_around_min_pages and grows with the run, up to
+ * vm_fault_around_max_pages.  It stops at the first neighbour that
+ * isn't resident and ready to be mapped without further work.
+ *
+ * This only applies to maps that opted in (vm_map_set_fault_around())
+ * and to mappings advised VM_BEHAVIOR_SEQUENTIAL.
+ */
+TUNABLE_WRITEABLE(unsigned int, vm_fault_around_max_pages, "vm_fault_around_max_pages", 16);
+unsigned int vm_fault_around_min_pages = 4;
+uint64_t vm_fault_around_faults = 0;    /* faults that mapped neighbours */
+uint64_t vm_fault_around_pages = 0;     /* neighbours mapped */
+
+static bool
+vm_fault_around_enabled(
+	vm_map_t                map,
+	vm_object_t             object,
+	vm_object_fault_info_t  fault_info)
+{
+	if (vm_fault_around_max_pages == 0 || object->internal) {
+		return false;
+	}
+	if (fault_info->behavior == VM_BEHAVIOR_RANDOM || fault_info->no_cache) {
+		return false;
+	}
+	return map->fault_around ||
+	       fault_info->behavior == VM_BEHAVIOR_SEQUENTIAL;
+}
+
+/*
+ * Map the neighbours of "fault_page", which was just entered at "vaddr"
+ * in "pmap" with protection "prot".
+ *
+ * object must be locked (shared is enough), along with the map the
+ * fault was resolved in.  The caller has checked that the page belongs
+ * to the top-level object of a mapping in that map's own pmap.
+ */
+static void
+vm_fault_around(
+	pmap_t                  pmap,
+	vm_object_t             object,
+	vm_page_t               fault_page,
+	vm_map_offset_t         vaddr,
+	vm_prot_t               prot,
+	vm_object_fault_info_t  fault_info)
+{
+	vm_object_offset_t      offset = fault_page->vmp_offset;
+	int                     sequential = object->sequential;
+	int                     new_sequential;
+	unsigned int            window, i, mapped = 0, done = 0;
+	bool                    backward = sequential < 0;
+
+	prot &= ~VM_PROT_WRITE;
+	if (!(prot & VM_PROT_READ)) {
+		return;
+	}
+
+	window = (unsigned int)((backward ? -(int64_t)sequential : sequential) >> PAGE_SHIFT);
+	window = MAX(window, vm_fault_around_min_pages);
+	window = MIN(window, vm_fault_around_max_pages);
+
+	for (i = 1; i <= window; i++) {
+		vm_object_offset_t      noffset;
+		vm_map_offset_t         nvaddr;
+		vm_page_t               m;
+		boolean_t               need_retry = FALSE;
+		int                     type_of_fault = DBG_CACHE_HIT_FAULT;
+		uint8_t                 object_lock_type = OBJECT_LOCK_SHARED;
+		kern_return_t           kr;
+
+		if (backward) {
+			if (offset < fault_info->lo_offset + ptoa_64(i)) {
+				break;
+			}
+			noffset = offset - ptoa_64(i);
+			nvaddr = vaddr - ptoa_64(i);
+		} else {
+			noffset = offset + ptoa_64(i);
+			nvaddr = vaddr + ptoa_64(i);
+			if (noffset >= fault_info->hi_offset ||
+			    noffset >= object->vo_size) {
+				break;
+			}
+		}
+
+		m = vm_page_lookup(object, noffset);
+		if (m == VM_PAGE_NULL ||
+		    m->vmp_busy ||
+		    m->vmp_unusual ||
+		    m->vmp_cleaning ||
+		    m->vmp_laundry ||
+		    m->vmp_fictitious) {
+			break;
+		}
+		if (vm_fault_cs_need_validation(pmap, m, object, PAGE_SIZE, 0)) {
+			/* validating wants the object lock exclusive */
+			break;
+		}
+		done = i;
+		if (m->vmp_pmapped && pmap_find_phys(pmap, nvaddr) != 0) {
+			continue;
+		}
+
+		kr = vm_fault_enter(m, pmap, nvaddr, PAGE_SIZE, 0,
+		    prot, VM_PROT_READ, FALSE, FALSE, VM_KERN_MEMORY_NONE,
+		    fault_info, &need_retry, &type_of_fault, &object_lock_type);
+		if (kr != KERN_SUCCESS) {
+			done = i - 1;
+			break;
+		}
+		mapped++;
+	}
+
+	if (mapped) {
+		os_atomic_inc(&vm_fault_around_faults, relaxed);
+		os_atomic_add(&vm_fault_around_pages, mapped, relaxed);
+	}
+
+	/*
+	 * The pages we mapped won't fault: account for them in the
+	 * sequential run as if they had, so that the next fault, one
+	 * window away, is still seen as sequential and the window
+	 * keeps growing.  Same unsynchronized protocol as
+	 * vm_fault_is_sequential().
+	 */
+	if (done) {
+		if (backward) {
+			new_sequential = MAX(sequential - (int)ptoa_64(done), -MAX_SEQUENTIAL_RUN);
+		} else {
+			new_sequential = MIN(sequential + (int)ptoa_64(done), MAX_SEQUENTIAL_RUN);
+		}
+		if (OSCompareAndSwap(sequential, new_sequential, (UInt32 *)&object->sequential)) {
+			object->last_alloc = backward ?
+			    offset - ptoa_64(done) : offset + ptoa_64(done);
+		}
+	}
+}
+
+/*
+ * Feed the file page a fault resolved to to the launch trace the
+ * current task is recording, if any.
+ */
+static inline void
+vm_fault_launch_trace(vm_object_t m_object, vm_page_t m)
+{
+	task_t task = current_task();
+
+	if (__improbable(task->task_launch_trace != NULL) &&
+	    !m_object->internal && m_object->pager != MEMORY_OBJECT_NULL) {
+		vm_launch_trace_record(task, m_object->pager,
+		    m_object->paging_offset + m->vmp_offset);
+	}
+}
+
 /*
  * Cleanup after a vm_fault_enter.
  * At this point, the fault should either have failed (kr != KERN_SUCCESS)
@@ -4033,7 +4227,9 @@ vm_fault_complete(
 	vm_prot_t fault_type,
 	vm_object_t *written_on_object,
 	memory_object_t *written_on_pager,
-	vm_object_offset_t *written_on_offset)
+	vm_object_offset_t *written_on_offset,
+	pmap_t fault_around_pmap,
+	vm_map_offset_t vaddr)
 {
 	int     event_code = 0;
 	vm_map_lock_assert_shared(map);
@@ -4055,6 +4251,7 @@ vm_fault_complete(
 		KDBG_FILTERED(MACHDBG_CODE(DBG_MACH_WORKINGSET, VM_REAL_FAULT_FAST), get_current_unique_pid());
 	}
 	DTRACE_VM6(real_fault, vm_map_offset_t, real_vaddr, vm_map_offset_t, m->vmp_offset, int, event_code, int, caller_prot, int, type_of_fault, int, fault_info->user_tag);
+	vm_fault_launch_trace(m_object, m);
 	if (kr == KERN_SUCCESS &&
 	    physpage_p != NULL) {
 		/* for vm_map_wire_and_extract() */
@@ -4094,6 +4291,11 @@ vm_fault_complete(
 
 		vm_fault_deactivate_behind(m_object, cur_offset, fault_info->behavior);
 	}
+
+	if (fault_around_pmap != PMAP_NULL && kr == KERN_SUCCESS && need_retry == FALSE) {
+		vm_fault_around(fault_around_pmap, m_object, m, vaddr, prot, fault_info);
+	}
+
 	/*
 	 * That's it, clean up and return.
 	 */
@@ -4208,6 +4410,7 @@ vm_fault_internal(
 	vm_object_t             resilient_media_object = VM_OBJECT_NULL;
 	vm_object_offset_t      resilient_media_offset = (vm_object_offset_t)-1;
 	bool                    page_needs_data_sync = false;
+	pmap_t                  fault_around_pmap;
 	/*
 	 * Was the VM object contended when vm_map_lookup_and_lock_object locked it?
 	 * If so, the zero fill path will drop the lock
@@ -4940,6 +5143,23 @@ FastPmapEnter:
 					    &object_lock_type);
 				}
 
+				/*
+				 * A plain read fault on the top-level object
+				 * of a mapping directly in this map's pmap
+				 * can map the page's neighbours too.
+				 */
+				fault_around_pmap = PMAP_NULL;
+				if (kr == KERN_SUCCESS &&
+				    caller_pmap == PMAP_NULL &&
+				    top_object == VM_OBJECT_NULL &&
+				    map == original_map && real_map == map &&
+				    !wired && !change_wiring && physpage_p == NULL &&
+				    !(fault_type & VM_PROT_WRITE) &&
+				    fault_page_size == PAGE_SIZE &&
+				    vm_fault_around_enabled(map, m_object, &fault_info)) {
+					fault_around_pmap = pmap;
+				}
+
 				vm_fault_complete(
 					map,
 					real_map,
@@ -4962,7 +5182,9 @@ FastPmapEnter:
 					fault_type,
 					&written_on_object,
 					&written_on_pager,
-					&written_on_offset);
+					&written_on_offset,
+					fault_around_pmap,
+					vaddr);
 				top_object = VM_OBJECT_NULL;
 				if (need_retry == TRUE) {
 					/*
@@ -5658,7 +5880,8 @@ FastPmapEnter:
 						panic("object_is_contended");
 						kr = vm_fault_pmap_enter(destination_pmap, destination_pmap_vaddr,
 						    fault_page_size, fault_phys_offset,
-						    m, &prot, caller_prot, enter_fault_type, wired,
+						    m, &prot, caller_prot, enter_fault_type,
+						    VM_FAULT_PMAP_FLAGS(&fault_info), wired,
 						    fault_info.pmap_options, need_retry_ptr);
 						vm_object_lock(object);
 						assertf(!((prot & VM_PROT_WRITE) && object->vo_copy),
@@ -5667,7 +5890,8 @@ FastPmapEnter:
 					} else {
 						kr = vm_fault_pmap_enter_with_object_lock(object, destination_pmap, destination_pmap_vaddr,
 						    fault_page_size, fault_phys_offset,
-						    m, &prot, caller_prot, enter_fault_type, wired,
+						    m, &prot, caller_prot, enter_fault_type,
+						    VM_FAULT_PMAP_FLAGS(&fault_info), wired,
 						    fault_info.pmap_options, need_retry_ptr, &object_lock_type);
 					}
 				}
@@ -5716,7 +5940,9 @@ zero_fill_cleanup:
 					fault_type,
 					&written_on_object,
 					&written_on_pager,
-					&written_on_offset);
+					&written_on_offset,
+					PMAP_NULL,
+					0);
 				top_object = VM_OBJECT_NULL;
 				if (need_retry == TRUE) {
 					/*
@@ -6265,6 +6491,7 @@ handle_copy_delay:
 			KDBG_FILTERED(MACHDBG_CODE(DBG_MACH_WORKINGSET, VM_REAL_FAULT_SLOW), get_current_unique_pid());
 
 			DTRACE_VM6(real_fault, vm_map_offset_t, real_vaddr, vm_map_offset_t, m->vmp_offset, int, event_code, int, caller_prot, int, type_of_fault, int, fault_info.user_tag);
+			vm_fault_launch_trace(m_object, m);
 		}
 		if (kr != KERN_SUCCESS) {
 			/* abort this page fault */
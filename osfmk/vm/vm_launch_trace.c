@@ -0,0 +1,478 @@
+/*
+ * Copyright (c) 2024 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Launch traces.
+ *
+ * A cold launch pages in its executable, its libraries and the parts of
+ * the dyld shared cache it uses one fault (or one fault cluster) at a
+ * time, in whatever order the code happens to touch them.  To take that
+ * latency off the next launch of the same binary, the first launch
+ * records the file pages its faults resolve to, for vm_launch_trace_window_ms
+ * after exec, and the trace is kept keyed by the UUID of the main
+ * executable and the effective uid it runs as.  When a binary with a
+ * known UUID gets exec'd again by the same user, a thread call walks its
+ * trace in fault order and starts asynchronous
+ * read-ahead (advisory_read(), through vnode_pager_prefetch()) for each
+ * run of pages, so that they are already in the UBC, or on their way in,
+ * by the time the process faults on them.
+ *
+ * Read-ahead fills the UBC with pages of files the launching process may
+ * not be allowed to read, and whether they are cached shows in how long
+ * reading them takes.  Keying traces by uid keeps one user's launches
+ * from prefetching the files another user's launch touched.
+ *
+ * A trace holds a reference on the vnode of each of its files for as
+ * long as it exists (vnode_pager_ref_vnode()), so it never looks at a
+ * vnode that was freed or reused.  That reference doesn't keep the file
+ * system from being unmounted, so the vnode id is remembered too: a file
+ * whose vnode got reclaimed since has a new one, is skipped, and
+ * makes the trace get dropped after the replay so that the next launch
+ * records a fresh one.  Traces only live in memory.
+ */
+
+#include <kern/clock.h>
+#include <kern/kalloc.h>
+#include <kern/locks.h>
+#include <kern/queue.h>
+#include <kern/startup.h>
+#include <kern/task.h>
+#include <kern/thread_call.h>
+#include <mach/mach_types.h>
+#include <mach/vm_param.h>
+#include <uuid/uuid.h>
+#include <vm/vm_launch_trace_internal.h>
+#include <vm/vm_protos.h>
+
+#pragma mark Tunables
+TUNABLE_WRITEABLE(int, vm_launch_trace_enabled, "vm_launch_trace", 1);
+/* how long after exec faults get recorded */
+TUNABLE_WRITEABLE(uint32_t, vm_launch_trace_window_ms, "vm_launch_trace_window_ms", 2000);
+/* pages skipped over between two faults that still extend the same run */
+TUNABLE(uint32_t, vm_launch_trace_run_gap, "vm_launch_trace_run_gap", 4);
+
+#pragma mark Statistics
+uint64_t vm_launch_trace_recordings;    /* traces recorded */
+uint64_t vm_launch_trace_replays;       /* traces replayed */
+uint64_t vm_launch_trace_prefetched;    /* bytes of read-ahead issued by replays */
+uint64_t vm_launch_trace_stale;         /* traces dropped because a file went away */
+
+#define LAUNCH_TRACE_MAX_TRACES         64
+#define LAUNCH_TRACE_MAX_FILES          16
+#define LAUNCH_TRACE_MAX_RUNS           1024
+#define LAUNCH_TRACE_MAX_RUN_PAGES      UINT16_MAX
+
+struct launch_trace_run {
+	uint32_t                ltr_page;       /* first page, in PAGE_SIZE units */
+	uint16_t                ltr_npages;
+	uint8_t                 ltr_file;       /* index in lt_files */
+	uint8_t                 ltr_pad;
+};
+
+struct launch_trace {
+	queue_chain_t           lt_link;        /* vm_launch_traces or vm_launch_trace_recording */
+	queue_chain_t           lt_replay_link; /* vm_launch_trace_replay_queue */
+	uuid_t                  lt_uuid;
+	uint32_t                lt_uid;         /* effective uid of the recording */
+	task_t                  lt_task;        /* recording task, holds a reference */
+	uint64_t                lt_deadline;    /* end of the recording */
+	uint32_t                lt_refs;        /* replays in flight, plus one while recording or cached */
+	bool                    lt_cached;
+	bool                    lt_replay_queued;
+	uint32_t                lt_nfiles;
+	uint32_t                lt_nruns;
+	struct {
+		struct vnode    *ltf_vp;        /* holds a reference */
+		uint32_t        ltf_vid;
+	}                       lt_files[LAUNCH_TRACE_MAX_FILES];
+	struct launch_trace_run lt_runs[LAUNCH_TRACE_MAX_RUNS];
+};
+
+/*
+ * vm_launch_trace_lock protects the lists below, the task_launch_trace of
+ * every task and everything in a trace but its runs once it is cached.
+ * It is taken with VM object locks held, by the fault path.
+ */
+static LCK_GRP_DECLARE(vm_launch_trace_lck_grp, "vm_launch_trace");
+static LCK_SPIN_DECLARE(vm_launch_trace_lock, &vm_launch_trace_lck_grp);
+/* recorded traces, most recently used first */
+static queue_head_t vm_launch_traces = QUEUE_HEAD_INITIALIZER(vm_launch_traces);
+static uint32_t vm_launch_trace_count;
+/* traces being recorded */
+static queue_head_t vm_launch_trace_recording = QUEUE_HEAD_INITIALIZER(vm_launch_trace_recording);
+/* traces waiting to be replayed */
+static queue_head_t vm_launch_trace_replay_queue = QUEUE_HEAD_INITIALIZER(vm_launch_trace_replay_queue);
+
+static thread_call_t vm_launch_trace_end_call;
+static uint64_t vm_launch_trace_end_deadline = UINT64_MAX; /* when vm_launch_trace_end_call is armed for */
+static thread_call_t vm_launch_trace_replay_call;
+
+static KALLOC_TYPE_DEFINE(vm_launch_trace_zone, struct launch_trace, KT_DEFAULT);
+
+static void
+vm_launch_trace_release_locked(struct launch_trace *trace, queue_head_t *to_free)
+{
+	assert(trace->lt_refs > 0);
+	if (--trace->lt_refs == 0) {
+		enqueue_tail(to_free, &trace->lt_link);
+	}
+}
+
+static void
+vm_launch_trace_free_queue(queue_head_t *to_free)
+{
+	struct launch_trace *trace;
+
+	while (!queue_empty(to_free)) {
+		trace = qe_dequeue_head(to_free, struct launch_trace, lt_link);
+		for (uint32_t i = 0; i < trace->lt_nfiles; i++) {
+			vnode_pager_rele_vnode(trace->lt_files[i].ltf_vp);
+		}
+		zfree(vm_launch_trace_zone, trace);
+	}
+}
+
+static void
+vm_launch_trace_uncache_locked(struct launch_trace *trace, queue_head_t *to_free)
+{
+	assert(trace->lt_cached);
+	remqueue(&trace->lt_link);
+	trace->lt_cached = false;
+	vm_launch_trace_count--;
+	vm_launch_trace_release_locked(trace, to_free);
+}
+
+/*
+ * Make sure vm_launch_trace_end() runs by "deadline", without pushing
+ * back an earlier deadline it is armed for.
+ */
+static void
+vm_launch_trace_arm_locked(uint64_t deadline)
+{
+	if (deadline < vm_launch_trace_end_deadline) {
+		vm_launch_trace_end_deadline = deadline;
+		thread_call_enter_delayed(vm_launch_trace_end_call, deadline);
+	}
+}
+
+static struct launch_trace *
+vm_launch_trace_lookup_locked(const uuid_t uuid, uint32_t uid)
+{
+	struct launch_trace *trace;
+
+	qe_foreach_element(trace, &vm_launch_traces, lt_link) {
+		if (trace->lt_uid == uid && uuid_compare(trace->lt_uuid, uuid) == 0) {
+			return trace;
+		}
+	}
+	return NULL;
+}
+
+void
+vm_launch_trace_record(
+	task_t                  task,
+	memory_object_t         pager,
+	memory_object_offset_t  offset)
+{
+	struct launch_trace_run *run;
+	struct launch_trace *trace;
+	struct vnode *vp;
+	uint64_t page = offset >> PAGE_SHIFT;
+	uint32_t vid, file;
+	bool referenced = false;
+
+	vp = vnode_pager_lookup_vnode(pager);
+	if (vp == NULL || page > UINT32_MAX) {
+		return;
+	}
+	vid = vnode_pager_get_vid(vp);
+
+again:
+	lck_spin_lock(&vm_launch_trace_lock);
+	trace = task->task_launch_trace;
+	if (trace == NULL || trace->lt_nruns == LAUNCH_TRACE_MAX_RUNS) {
+		goto out;
+	}
+
+	for (file = 0; file < trace->lt_nfiles; file++) {
+		if (trace->lt_files[file].ltf_vp == vp &&
+		    trace->lt_files[file].ltf_vid == vid) {
+			break;
+		}
+	}
+	if (file == trace->lt_nfiles) {
+		if (file == LAUNCH_TRACE_MAX_FILES) {
+			goto out;
+		}
+		if (!referenced) {
+			/*
+			 * The faulting mapping keeps the file in use, so
+			 * this doesn't block on it going away.
+			 */
+			lck_spin_unlock(&vm_launch_trace_lock);
+			if (vnode_pager_ref_vnode(vp) != KERN_SUCCESS) {
+				return;
+			}
+			referenced = true;
+			goto again;
+		}
+		trace->lt_files[file].ltf_vp = vp;
+		trace->lt_files[file].ltf_vid = vid;
+		trace->lt_nfiles++;
+		referenced = false;
+	}
+
+	/*
+	 * Extend the last run when the fault lands in it or shortly after it,
+	 * which is what sequential faults and fault clusters look like.
+	 */
+	if (trace->lt_nruns > 0) {
+		run = &trace->lt_runs[trace->lt_nruns - 1];
+		if (run->ltr_file == file && page >= run->ltr_page &&
+		    page <= (uint64_t)run->ltr_page + run->ltr_npages + vm_launch_trace_run_gap) {
+			if (page >= (uint64_t)run->ltr_page + run->ltr_npages &&
+			    page - run->ltr_page < LAUNCH_TRACE_MAX_RUN_PAGES) {
+				run->ltr_npages = (uint16_t)(page - run->ltr_page + 1);
+			}
+			if (page - run->ltr_page < run->ltr_npages) {
+				goto out;
+			}
+		}
+	}
+	run = &trace->lt_runs[trace->lt_nruns++];
+	run->ltr_page = (uint32_t)page;
+	run->ltr_npages = 1;
+	run->ltr_file = (uint8_t)file;
+
+out:
+	lck_spin_unlock(&vm_launch_trace_lock);
+	if (referenced) {
+		/* lost a race to add the file, or the trace is gone */
+		vnode_pager_rele_vnode(vp);
+	}
+}
+
+/*
+ * End the recordings that are past their deadline: detach them from
+ * their task and cache them, replacing any older trace for the same
+ * executable and user, and evicting the least recently used ones.
+ */
+static void
+vm_launch_trace_end(__unused thread_call_param_t p0, __unused thread_call_param_t p1)
+{
+	queue_head_t to_free = QUEUE_HEAD_INITIALIZER(to_free);
+	task_t tasks[8];
+	uint32_t ntasks;
+	struct launch_trace *trace, *next, *old;
+	uint64_t now, deadline;
+
+again:
+	ntasks = 0;
+	now = mach_absolute_time();
+	deadline = UINT64_MAX;
+	lck_spin_lock(&vm_launch_trace_lock);
+	vm_launch_trace_end_deadline = UINT64_MAX;
+	qe_foreach_element_safe(trace, &vm_launch_trace_recording, lt_link) {
+		if (trace->lt_deadline > now) {
+			deadline = MIN(deadline, trace->lt_deadline);
+			continue;
+		}
+		if (ntasks == sizeof(tasks) / sizeof(tasks[0])) {
+			break;
+		}
+		remqueue(&trace->lt_link);
+		if (trace->lt_task->task_launch_trace == trace) {
+			trace->lt_task->task_launch_trace = NULL;
+		}
+		tasks[ntasks++] = trace->lt_task;
+		trace->lt_task = TASK_NULL;
+
+		if (trace->lt_nruns == 0) {
+			vm_launch_trace_release_locked(trace, &to_free);
+			continue;
+		}
+		old = vm_launch_trace_lookup_locked(trace->lt_uuid, trace->lt_uid);
+		if (old != NULL) {
+			vm_launch_trace_uncache_locked(old, &to_free);
+		}
+		enqueue_head(&vm_launch_traces, &trace->lt_link);
+		trace->lt_cached = true;
+		vm_launch_trace_count++;
+		vm_launch_trace_recordings++;
+		while (vm_launch_trace_count > LAUNCH_TRACE_MAX_TRACES) {
+			next = qe_queue_last(&vm_launch_traces, struct launch_trace, lt_link);
+			vm_launch_trace_uncache_locked(next, &to_free);
+		}
+	}
+	if (deadline != UINT64_MAX) {
+		vm_launch_trace_arm_locked(deadline);
+	}
+	lck_spin_unlock(&vm_launch_trace_lock);
+
+	for (uint32_t i = 0; i < ntasks; i++) {
+		task_deallocate(tasks[i]);
+	}
+	vm_launch_trace_free_queue(&to_free);
+	if (ntasks == sizeof(tasks) / sizeof(tasks[0])) {
+		goto again;
+	}
+}
+
+/*
+ * Start read-ahead for the runs of the queued traces, in the order their
+ * pages were faulted in.
+ */
+static void
+vm_launch_trace_replay(__unused thread_call_param_t p0, __unused thread_call_param_t p1)
+{
+	queue_head_t to_free = QUEUE_HEAD_INITIALIZER(to_free);
+	struct launch_trace *trace;
+
+	lck_spin_lock(&vm_launch_trace_lock);
+	while (!queue_empty(&vm_launch_trace_replay_queue)) {
+		uint16_t stale = 0;     /* files that went away, one bit each */
+		uint64_t bytes = 0;
+		__typeof__(trace->lt_files) files;
+
+		trace = qe_dequeue_head(&vm_launch_trace_replay_queue,
+		    struct launch_trace, lt_replay_link);
+		trace->lt_replay_queued = false;
+		bcopy(trace->lt_files, files, sizeof(files));
+		lck_spin_unlock(&vm_launch_trace_lock);
+
+		/* the runs of a cached trace don't change */
+		for (uint32_t i = 0; i < trace->lt_nruns; i++) {
+			struct launch_trace_run *run = &trace->lt_runs[i];
+			kern_return_t kr;
+
+			if (stale & (1 << run->ltr_file)) {
+				continue;
+			}
+			kr = vnode_pager_prefetch(files[run->ltr_file].ltf_vp,
+			    files[run->ltr_file].ltf_vid,
+			    ptoa_64(run->ltr_page), ptoa_64(run->ltr_npages));
+			if (kr != KERN_SUCCESS) {
+				stale |= 1 << run->ltr_file;
+				continue;
+			}
+			bytes += ptoa_64(run->ltr_npages);
+		}
+
+		lck_spin_lock(&vm_launch_trace_lock);
+		vm_launch_trace_replays++;
+		vm_launch_trace_prefetched += bytes;
+		if (stale && trace->lt_cached) {
+			vm_launch_trace_stale++;
+			vm_launch_trace_uncache_locked(trace, &to_free);
+		}
+		vm_launch_trace_release_locked(trace, &to_free);
+	}
+	lck_spin_unlock(&vm_launch_trace_lock);
+
+	vm_launch_trace_free_queue(&to_free);
+}
+
+void
+vm_launch_trace_exec(
+	task_t                  task,
+	struct vnode            *vp,
+	const uuid_t            uuid,
+	uint32_t                uid)
+{
+	struct launch_trace *trace, *prev;
+	uint32_t vid = vnode_pager_get_vid(vp);
+	uint64_t window;
+	bool replay = false;
+
+	if (!vm_launch_trace_enabled || uuid_is_null(uuid)) {
+		return;
+	}
+
+	lck_spin_lock(&vm_launch_trace_lock);
+	/* an exec within the same task ends the previous image's recording */
+	prev = task->task_launch_trace;
+	if (prev != NULL) {
+		task->task_launch_trace = NULL;
+		prev->lt_deadline = 0;
+		vm_launch_trace_arm_locked(0);
+	}
+	trace = vm_launch_trace_lookup_locked(uuid, uid);
+	if (trace != NULL) {
+		remqueue(&trace->lt_link);
+		enqueue_head(&vm_launch_traces, &trace->lt_link);
+		if (!trace->lt_replay_queued) {
+			trace->lt_replay_queued = true;
+			trace->lt_refs++;
+			enqueue_tail(&vm_launch_trace_replay_queue, &trace->lt_replay_link);
+			replay = true;
+		}
+	}
+	lck_spin_unlock(&vm_launch_trace_lock);
+
+	if (replay) {
+		thread_call_enter(vm_launch_trace_replay_call);
+	}
+	if (trace != NULL) {
+		return;
+	}
+
+	if (vnode_pager_ref_vnode(vp) != KERN_SUCCESS) {
+		return;
+	}
+	trace = zalloc_flags(vm_launch_trace_zone, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	uuid_copy(trace->lt_uuid, uuid);
+	trace->lt_uid = uid;
+	trace->lt_files[0].ltf_vp = vp;
+	trace->lt_files[0].ltf_vid = vid;
+	trace->lt_nfiles = 1;
+	trace->lt_refs = 1;
+	task_reference(task);
+	trace->lt_task = task;
+	nanoseconds_to_absolutetime((uint64_t)vm_launch_trace_window_ms * NSEC_PER_MSEC, &window);
+	trace->lt_deadline = mach_absolute_time() + window;
+
+	lck_spin_lock(&vm_launch_trace_lock);
+	assert(task->task_launch_trace == NULL);
+	task->task_launch_trace = trace;
+	enqueue_tail(&vm_launch_trace_recording, &trace->lt_link);
+	vm_launch_trace_arm_locked(trace->lt_deadline);
+	lck_spin_unlock(&vm_launch_trace_lock);
+}
+
+__startup_func
+static void
+vm_launch_trace_init(void)
+{
+	vm_launch_trace_end_call = thread_call_allocate_with_options(
+		vm_launch_trace_end, NULL, THREAD_CALL_PRIORITY_KERNEL,
+		THREAD_CALL_OPTIONS_ONCE);
+	vm_launch_trace_replay_call = thread_call_allocate_with_options(
+		vm_launch_trace_replay, NULL, THREAD_CALL_PRIORITY_USER,
+		THREAD_CALL_OPTIONS_ONCE);
+}
+STARTUP(THREAD_CALL, STARTUP_RANK_MIDDLE, vm_launch_trace_init);
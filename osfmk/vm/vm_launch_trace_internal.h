@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2024 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#ifndef _VM_VM_LAUNCH_TRACE_INTERNAL_H_
+#define _VM_VM_LAUNCH_TRACE_INTERNAL_H_
+
+#ifdef XNU_KERNEL_PRIVATE
+
+#include <mach/mach_types.h>
+#include <mach/memory_object_types.h>
+#include <uuid/uuid.h>
+
+/*
+ * Launch traces: the order in which a process faults on file pages right
+ * after exec, keyed by the UUID of its main executable and its effective
+ * uid, gets recorded and replayed as asynchronous read-ahead the next time
+ * the same user launches the same binary.  See vm_launch_trace.c.
+ */
+struct vnode;
+
+extern int              vm_launch_trace_enabled;
+
+/*
+ * Called when "task" starts running the executable "vp", whose LC_UUID
+ * is "uuid", as the effective user "uid": replays the trace recorded for
+ * them if there is one, and starts recording one otherwise.
+ */
+extern void             vm_launch_trace_exec(
+	task_t                  task,
+	struct vnode            *vp,
+	const uuid_t            uuid,
+	uint32_t                uid);
+
+#ifdef MACH_KERNEL_PRIVATE
+
+/*
+ * Record a fault on the page at "offset" in "pager" in the trace "task"
+ * is recording, if any (see task_launch_trace).
+ */
+extern void             vm_launch_trace_record(
+	task_t                  task,
+	memory_object_t         pager,
+	memory_object_offset_t  offset);
+
+#endif /* MACH_KERNEL_PRIVATE */
+
+#endif /* XNU_KERNEL_PRIVATE */
+
+#endif /* _VM_VM_LAUNCH_TRACE_INTERNAL_H_ */
@@ -109,6 +109,7 @@
 #include <vm/vm_protos.h>
 #include <vm/vm_purgeable_internal.h>
 #include <vm/vm_reclaim_internal.h>
+#include <vm/vm_superpage_internal.h>
 
 #include <vm/vm_protos.h>
 #include <vm/vm_shared_region.h>
@@ -180,6 +181,36 @@ static TUNABLE(bool, vm_map_executable_immutable,
 #define vm_map_executable_immutable true
 #endif
 
+/*
+ * Transparent superpages (see vm_superpage.c) go back to base page
+ * mappings before any part of them gets clipped, protected, wired,
+ * copied or removed.
+ */
+#if CONFIG_TRANSPARENT_SUPERPAGES
+#define vm_map_entry_demote(map, entry, start, end)                     \
+	MACRO_BEGIN                                                     \
+	if (__improbable((entry)->vme_promoted)) {                      \
+	        vm_superpage_demote((map), (entry), (start), (end));    \
+	}                                                               \
+	MACRO_END
+/* only a superpage straddling "addr" needs to go */
+#define vm_map_entry_demote_at(map, entry, addr)                        \
+	MACRO_BEGIN                                                     \
+	if ((addr) & ~SUPERPAGE_MASK) {                                 \
+	        vm_map_entry_demote(map, entry, addr, (addr) + PAGE_SIZE); \
+	}                                                               \
+	MACRO_END
+#else /* CONFIG_TRANSPARENT_SUPERPAGES */
+#define vm_map_entry_demote(map, entry, start, end)     do { } while (0)
+#define vm_map_entry_demote_at(map, entry, addr)        do { } while (0)
+#endif /* CONFIG_TRANSPARENT_SUPERPAGES */
+
+/*
+ * Index the entries of user maps with a B+-tree,
+ * rather than a red-black tree and a hole list.
+ */
+static TUNABLE(bool, vm_map_btree_store, "vm_map_btree_store", false);
+
 os_refgrp_decl(static, map_refgrp, "vm_map", NULL);
 
 extern u_int32_t random(void);  /* from <libkern/libkern.h> */
@@ -252,6 +283,14 @@ static kmem_return_t vm_map_delete(
 	kmem_guard_t    guard,
 	vm_map_zap_t    zap);
 
+static kern_return_t    vm_map_protect_locked(
+	vm_map_t                map,
+	vm_map_offset_t         start,
+	vm_map_offset_t         end,
+	vm_prot_t               new_prot,
+	boolean_t               set_max,
+	pmap_flush_context     *pfc);
+
 static void             vm_map_copy_insert(
 	vm_map_t        map,
 	vm_map_entry_t  after_where,
@@ -534,6 +573,7 @@ vm_map_entry_copy(
 	new->wired_count = 0;
 	new->user_wired_count = 0;
 	new->vme_permanent = FALSE;
+	new->vme_promoted = FALSE;
 	vm_map_entry_copy_code_signing(map, new, old);
 	vm_map_entry_copy_csm_assoc(map, new, old);
 	if (new->iokit_acct) {
@@ -1507,8 +1547,18 @@ vm_map_create_options(
 	}
 #endif /* DEBUG || DEVELOPMENT */
 
+	if (vm_map_btree_store && pmap != PMAP_NULL && pmap != kernel_pmap &&
+	    (options & VM_MAP_CREATE_PAGEABLE)) {
+		options |= VM_MAP_CREATE_BTREE_STORE;
+	}
+
 	result = zalloc_id(ZONE_ID_VM_MAP, Z_WAITOK | Z_NOFAIL | Z_ZERO);
 
+	/* B+-tree maps find their holes with the tree, see vm_map_store_bt.c */
+	if (options & VM_MAP_CREATE_BTREE_STORE) {
+		result->hdr.entries_btree = true;
+		options |= VM_MAP_CREATE_DISABLE_HOLELIST;
+	}
 	vm_map_store_init(&result->hdr);
 	result->hdr.entries_pageable = (bool)(options & VM_MAP_CREATE_PAGEABLE);
 	vm_map_set_page_shift(result, PAGE_SHIFT);
@@ -1645,13 +1695,10 @@ vm_map_adjusted_size(vm_map_t map)
 #define vm_map_copy_entry_create(copy) _vm_map_entry_create(&(copy)->cpy_hdr)
 
 static vm_map_entry_t
-_vm_map_entry_create(
+_vm_map_entry_init(
+	vm_map_entry_t          entry,
 	struct vm_map_header    *map_header __unused)
 {
-	vm_map_entry_t entry = NULL;
-
-	entry = zalloc_id(ZONE_ID_VM_MAP_ENTRY, Z_WAITOK | Z_ZERO);
-
 	/*
 	 * Help the compiler with what we know to be true,
 	 * so that the further bitfields inits have good codegen.
@@ -1677,6 +1724,58 @@ _vm_map_entry_create(
 	return entry;
 }
 
+static vm_map_entry_t
+_vm_map_entry_create(
+	struct vm_map_header    *map_header)
+{
+	vm_map_entry_t entry = NULL;
+
+	entry = zalloc_id(ZONE_ID_VM_MAP_ENTRY, Z_WAITOK | Z_ZERO);
+	return _vm_map_entry_init(entry, map_header);
+}
+
+/*
+ *	vm_map_entry_batch_alloc:	[ internal use only ]
+ *
+ *	Preallocates the entries of a loop about to create "count" of them
+ *	(typically when cloning the entries of a copy map), so that they are
+ *	taken from the zone caches in one go rather than one at a time.
+ *
+ *	Entries are then created with vm_map_entry_batch_create(), which
+ *	falls back to allocating them one by one if the batch runs out,
+ *	and the unused ones are freed with vm_map_entry_batch_dispose().
+ */
+static zstack_t
+vm_map_entry_batch_alloc(
+	uint32_t                count)
+{
+	return zalloc_n(ZONE_ID_VM_MAP_ENTRY, count, Z_WAITOK | Z_ZERO);
+}
+
+#define vm_map_entry_batch_create(batch, map) \
+	_vm_map_entry_batch_create(batch, &(map)->hdr)
+
+#define vm_map_copy_entry_batch_create(batch, copy) \
+	_vm_map_entry_batch_create(batch, &(copy)->cpy_hdr)
+
+static vm_map_entry_t
+_vm_map_entry_batch_create(
+	zstack_t                *batch,
+	struct vm_map_header    *map_header)
+{
+	if (__improbable(zstack_empty(*batch))) {
+		return _vm_map_entry_create(map_header);
+	}
+	return _vm_map_entry_init(zstack_pop(batch), map_header);
+}
+
+static void
+vm_map_entry_batch_dispose(
+	zstack_t                *batch)
+{
+	zfree_n(ZONE_ID_VM_MAP_ENTRY, *batch);
+}
+
 /*
  *	vm_map_entry_dispose:	[ internal use only ]
  *
@@ -3112,7 +3211,7 @@ vm_map_enter(
 				DTRACE_VM5(map_entry_extend, vm_map_t, map, vm_map_entry_t, entry, vm_address_t, entry->vme_start, vm_address_t, entry->vme_end, vm_address_t, end);
 			}
 			entry->vme_end = end;
-			if (map->holelistenabled) {
+			if (map->holelistenabled || map->hdr.entries_btree) {
 				vm_map_store_update_first_free(map, entry, TRUE);
 			} else {
 				vm_map_store_update_first_free(map, map->first_free, TRUE);
@@ -5649,6 +5748,7 @@ vm_map_clip_start(
 			    (addr64_t)(entry->vme_start),
 			    (addr64_t)(entry->vme_end));
 		}
+		vm_map_entry_demote_at(map, entry, startaddr);
 		if (entry->vme_atomic) {
 			__vm_map_clip_atomic_entry_panic(map, entry, startaddr);
 		}
@@ -5776,6 +5876,7 @@ vm_map_clip_end(
 			    (addr64_t)(entry->vme_start),
 			    (addr64_t)(entry->vme_end));
 		}
+		vm_map_entry_demote_at(map, entry, endaddr);
 		if (entry->vme_atomic) {
 			__vm_map_clip_atomic_entry_panic(map, entry, endaddr);
 		}
@@ -5951,11 +6052,6 @@ vm_map_protect(
 	vm_prot_t       new_prot,
 	boolean_t       set_max)
 {
-	vm_map_entry_t                  current;
-	vm_map_offset_t                 prev;
-	vm_map_entry_t                  entry;
-	vm_prot_t                       new_max;
-	int                             pmap_options = 0;
 	kern_return_t                   kr;
 
 	if (__improbable(vm_map_range_overflows(map, start, end - start))) {
@@ -6036,13 +6132,40 @@ vm_map_protect(
 	}
 
 	vm_map_lock(map);
+	kr = vm_map_protect_locked(map, start, end, new_prot, set_max, NULL);
+	vm_map_unlock(map);
+
+	return kr;
+}
+
+/*
+ *	vm_map_protect_locked:
+ *
+ *	The body of vm_map_protect(), entered and left with the map
+ *	locked.  If "pfc" is provided, the TLB invalidations for the
+ *	range are accumulated in it rather than issued, and the caller
+ *	is responsible for a pmap_flush() before it drops the lock.
+ */
+static kern_return_t
+vm_map_protect_locked(
+	vm_map_t                map,
+	vm_map_offset_t         start,
+	vm_map_offset_t         end,
+	vm_prot_t               new_prot,
+	boolean_t               set_max,
+	pmap_flush_context     *pfc)
+{
+	vm_map_entry_t                  current;
+	vm_map_offset_t                 prev;
+	vm_map_entry_t                  entry;
+	vm_prot_t                       new_max;
+	int                             pmap_options = 0;
 
 	/* LP64todo - remove this check when vm_map_commpage64()
 	 * no longer has to stuff in a map_entry for the commpage
 	 * above the map's max_offset.
 	 */
 	if (start >= map->max_offset) {
-		vm_map_unlock(map);
 		return KERN_INVALID_ADDRESS;
 	}
 
@@ -6052,7 +6175,6 @@ vm_map_protect(
 		 *	entry, return an error.
 		 */
 		if (!vm_map_lookup_entry(map, start, &entry)) {
-			vm_map_unlock(map);
 			return KERN_INVALID_ADDRESS;
 		}
 
@@ -6079,7 +6201,6 @@ vm_map_protect(
 		 * If there is a hole, return an error.
 		 */
 		if (current->vme_start != prev) {
-			vm_map_unlock(map);
 			return KERN_INVALID_ADDRESS;
 		}
 
@@ -6096,20 +6217,17 @@ vm_map_protect(
 		}
 #endif
 		if ((new_prot & new_max) != new_prot) {
-			vm_map_unlock(map);
 			return KERN_PROTECTION_FAILURE;
 		}
 
 		if (current->used_for_jit &&
 		    pmap_has_prot_policy(map->pmap, current->translated_allow_execute, current->protection)) {
-			vm_map_unlock(map);
 			return KERN_PROTECTION_FAILURE;
 		}
 
 #if __arm64e__
 		/* Disallow remapping hw assisted TPRO mappings */
 		if (current->used_for_tpro) {
-			vm_map_unlock(map);
 			return KERN_PROTECTION_FAILURE;
 		}
 #endif /* __arm64e__ */
@@ -6149,7 +6267,6 @@ vm_map_protect(
 			    new_prot);
 			new_prot &= ~VM_PROT_ALLEXEC;
 			if (VM_MAP_POLICY_WX_FAIL(map)) {
-				vm_map_unlock(map);
 				return KERN_PROTECTION_FAILURE;
 			}
 		}
@@ -6163,7 +6280,6 @@ vm_map_protect(
 		if (map->map_disallow_new_exec == TRUE) {
 			if ((new_prot & VM_PROT_ALLEXEC) ||
 			    ((current->protection & VM_PROT_EXECUTE) && (new_prot & VM_PROT_WRITE))) {
-				vm_map_unlock(map);
 				return KERN_PROTECTION_FAILURE;
 			}
 		}
@@ -6195,7 +6311,6 @@ vm_map_protect(
 #endif /* __arm64__ */
 
 	if (end > prev) {
-		vm_map_unlock(map);
 		return KERN_INVALID_ADDRESS;
 	}
 
@@ -6216,6 +6331,7 @@ vm_map_protect(
 		vm_prot_t       old_prot;
 
 		vm_map_clip_end(map, current, end);
+		vm_map_entry_demote(map, current, current->vme_start, current->vme_end);
 
 #if DEVELOPMENT || DEBUG
 		if (current->csm_associated && vm_log_xnu_user_debug) {
@@ -6271,6 +6387,8 @@ vm_map_protect(
 			 * mapping as "user_debug" if appropriate.
 			 */
 			vm_map_kernel_flags_t vmk_flags;
+			kern_return_t kr;
+
 			vmk_flags = VM_MAP_KERNEL_FLAGS_NONE;
 			/* pretend it's a vm_protect(VM_PROT_COPY)... */
 			vmk_flags.vmkf_remap_prot_copy = true;
@@ -6370,8 +6488,8 @@ vm_map_protect(
 				    current->vme_start,
 				    current->vme_end,
 				    prot,
-				    pmap_options,
-				    NULL);
+				    pfc ? pmap_options | PMAP_OPTIONS_NOFLUSH : pmap_options,
+				    pfc);
 			}
 		}
 		current = current->vme_next;
@@ -6384,10 +6502,87 @@ vm_map_protect(
 		current = current->vme_next;
 	}
 
-	vm_map_unlock(map);
 	return KERN_SUCCESS;
 }
 
+/*
+ *	vm_map_batch:
+ *
+ *	Apply a vector of protect and deallocate operations to the
+ *	target map, in order, under one hold of the map lock.
+ *
+ *	The TLB invalidations for protection changes are gathered
+ *	in a single flush context and issued together, and the
+ *	entries removed by deallocations are only freed once the
+ *	lock has been dropped.  vm_map_delete() can drop the lock
+ *	to wait on wired or in-transition entries, so pending
+ *	invalidations are issued before each deallocation.
+ *
+ *	The caller has validated every operation, including its range
+ *	with vm_map_range_overflows(), so that nothing is applied
+ *	when any of them is invalid.  Processing stops at the first
+ *	operation that fails, whose error is returned; "*completed"
+ *	is set to the number of operations that were applied.
+ */
+kern_return_t
+vm_map_batch(
+	vm_map_t                map,
+	mach_vm_batch_op_v1_t   *ops,
+	uint32_t                count,
+	uint32_t                *completed)
+{
+	pmap_flush_context      pfc;
+	bool                    pfc_pending = false;
+	kern_return_t           kr = KERN_SUCCESS;
+	uint32_t                i;
+	VM_MAP_ZAP_DECLARE(zap);
+
+	pmap_flush_context_init(&pfc);
+
+	vm_map_lock(map);
+
+	for (i = 0; i < count; i++) {
+		vm_map_offset_t start, end;
+
+		if (ops[i].size == 0) {
+			continue;
+		}
+
+		start = vm_map_trunc_page(ops[i].address, VM_MAP_PAGE_MASK(map));
+		end = vm_map_round_page(ops[i].address + ops[i].size,
+		    VM_MAP_PAGE_MASK(map));
+		assert(start < end);
+
+		if (ops[i].op == MACH_VM_BATCH_OP_PROTECT) {
+			kr = vm_map_protect_locked(map, start, end,
+			    ops[i].new_protection, ops[i].set_maximum, &pfc);
+			pfc_pending = true;
+		} else {
+			if (pfc_pending) {
+				pmap_flush(&pfc);
+				pmap_flush_context_init(&pfc);
+				pfc_pending = false;
+			}
+			kr = vm_map_delete(map, start, end,
+			    VM_MAP_REMOVE_NO_FLAGS, KMEM_GUARD_NONE, &zap).kmr_return;
+		}
+		if (kr != KERN_SUCCESS) {
+			break;
+		}
+	}
+
+	if (pfc_pending) {
+		pmap_flush(&pfc);
+	}
+
+	vm_map_unlock(map);
+
+	vm_map_zap_dispose(&zap);
+
+	*completed = i;
+	return kr;
+}
+
 /*
  *	vm_map_inherit:
  *
@@ -7239,6 +7434,7 @@ vm_map_wire_nested(
 			goto done;
 		}
 
+		vm_map_entry_demote(map, entry, entry->vme_start, entry->vme_end);
 		assert(entry->wired_count == 0 && entry->user_wired_count == 0);
 
 		if ((rc = add_wire_counts(map, entry, user_wire)) != KERN_SUCCESS) {
@@ -8568,6 +8764,7 @@ in_transition:
 			continue;
 		}
 
+		vm_map_entry_demote(map, entry, entry->vme_start, entry->vme_end);
 
 		/*
 		 * Step 5: Handle wiring
@@ -10769,6 +10966,9 @@ vm_map_copy_overwrite_aligned(
 		assert((tmp_entry->vme_end - tmp_entry->vme_start) == size);
 		assert((copy_entry->vme_end - copy_entry->vme_start) == size);
 
+		/* its object is about to be replaced, or written to */
+		vm_map_entry_demote(dst_map, entry, entry->vme_start, entry->vme_end);
+
 		/*
 		 *	If the destination contains temporary unshared memory,
 		 *	we can perform the copy by throwing it away and
@@ -11364,12 +11564,15 @@ vm_map_copy_remap(
 	vm_inherit_t    inheritance)
 {
 	vm_map_entry_t  copy_entry, new_entry;
+	zstack_t        batch;
+
+	batch = vm_map_entry_batch_alloc((uint32_t)copy->cpy_hdr.nentries);
 
 	for (copy_entry = vm_map_copy_first_entry(copy);
 	    copy_entry != vm_map_copy_to_entry(copy);
 	    copy_entry = copy_entry->vme_next) {
 		/* get a new VM map entry for the map */
-		new_entry = vm_map_entry_create(map);
+		new_entry = vm_map_entry_batch_create(&batch, map);
 		/* copy the "copy entry" to the new entry */
 		vm_map_entry_copy(map, new_entry, copy_entry);
 		/* adjust "start" and "end" */
@@ -11393,6 +11596,8 @@ vm_map_copy_remap(
 		/* continue inserting the "copy entries" after the new entry */
 		where = new_entry;
 	}
+
+	vm_map_entry_batch_dispose(&batch);
 }
 
 
@@ -11625,12 +11830,14 @@ vm_map_copyout_internal(
 		 * pager.
 		 */
 		vm_map_entry_t  next, new;
+		zstack_t        batch;
 
 		/*
 		 * Find the zone that the copies were allocated from
 		 */
 
 		entry = vm_map_copy_first_entry(copy);
+		batch = vm_map_entry_batch_alloc((uint32_t)copy->cpy_hdr.nentries);
 
 		/*
 		 * Reinitialize the copy so that vm_map_copy_entry_link
@@ -11643,7 +11850,7 @@ vm_map_copyout_internal(
 		 * Copy each entry.
 		 */
 		while (entry != vm_map_copy_to_entry(copy)) {
-			new = vm_map_copy_entry_create(copy);
+			new = vm_map_copy_entry_batch_create(&batch, copy);
 			vm_map_entry_copy_full(new, entry);
 			new->vme_no_copy_on_read = FALSE;
 			assert(!new->iokit_acct);
@@ -11658,6 +11865,8 @@ vm_map_copyout_internal(
 			vm_map_entry_dispose(entry);
 			entry = next;
 		}
+
+		vm_map_entry_batch_dispose(&batch);
 	}
 
 	/*
@@ -12216,6 +12425,7 @@ vm_map_copyin_internal(
 		 */
 
 		vm_map_clip_end(src_map, src_entry, src_end);
+		vm_map_entry_demote(src_map, src_entry, src_start, src_entry->vme_end);
 
 		src_size = src_entry->vme_end - src_start;
 		src_object = VME_OBJECT(src_entry);
@@ -13399,6 +13609,9 @@ vm_map_fork(
 	if (old_map->hdr.entries_pageable) {
 		map_create_options |= VM_MAP_CREATE_PAGEABLE;
 	}
+	if (old_map->hdr.entries_btree) {
+		map_create_options |= VM_MAP_CREATE_BTREE_STORE;
+	}
 	if (options & VM_MAP_FORK_CORPSE_FOOTPRINT) {
 		map_create_options |= VM_MAP_CREATE_CORPSE_FOOTPRINT;
 		footprint_collect_kr = KERN_SUCCESS;
@@ -13419,6 +13632,9 @@ vm_map_fork(
 	/* inherit the parent rlimits */
 	vm_map_inherit_limits(new_map, old_map);
 
+	/* inherit the fault-around opt-in */
+	new_map->fault_around = old_map->fault_around;
+
 #if CONFIG_MAP_RANGES
 	/* inherit the parent map's VM ranges */
 	vm_map_range_fork(new_map, old_map);
@@ -13471,6 +13687,8 @@ vm_map_fork(
 		}
 
 		entry_size = old_entry->vme_end - old_entry->vme_start;
+		vm_map_entry_demote(old_map, old_entry,
+		    old_entry->vme_start, old_entry->vme_end);
 
 #if PMAP_FORK_NEST
 		/*
@@ -14696,6 +14914,7 @@ protection_failure:
 #else /* __arm64e__ */
 		fault_info->fi_used_for_tpro = FALSE;
 #endif
+		fault_info->fi_promoted = entry->vme_promoted;
 		if (entry->translated_allow_execute) {
 			fault_info->pmap_options |= PMAP_OPTIONS_TRANSLATED_ALLOW_EXECUTE;
 		}
@@ -15996,8 +16215,10 @@ vm_map_simplify_entry(
 		}
 		this_entry->vme_start = prev_entry->vme_start;
 		VME_OFFSET_SET(this_entry, VME_OFFSET(prev_entry));
+		/* promoted ranges carry over to the merged entry */
+		this_entry->vme_promoted |= prev_entry->vme_promoted;
 
-		if (map->holelistenabled) {
+		if (map->holelistenabled || map->hdr.entries_btree) {
 			vm_map_store_update_first_free(map, this_entry, TRUE);
 		}
 
@@ -17439,6 +17660,8 @@ vm_map_remap_extract(
 
 		entry_size = (vm_map_size_t)(src_entry->vme_end -
 		    src_entry->vme_start);
+		vm_map_entry_demote(map, src_entry,
+		    src_entry->vme_start, src_entry->vme_end);
 
 		if (src_entry->is_sub_map &&
 		    vmk_flags.vmkf_copy_single_object) {
@@ -18458,6 +18681,7 @@ vm_map_copy_adjust_get_target_copy_map(
 {
 	vm_map_copy_t   target_copy_map;
 	vm_map_entry_t  entry, target_entry;
+	zstack_t        batch;
 
 	if (*target_copy_map_p != VM_MAP_COPY_NULL) {
 		/* the caller already has a "target_copy_map": use it */
@@ -18470,10 +18694,12 @@ vm_map_copy_adjust_get_target_copy_map(
 	target_copy_map->offset = copy_map->offset;
 	target_copy_map->size = copy_map->size;
 	target_copy_map->cpy_hdr.page_shift = copy_map->cpy_hdr.page_shift;
+	batch = vm_map_entry_batch_alloc((uint32_t)copy_map->cpy_hdr.nentries);
 	for (entry = vm_map_copy_first_entry(copy_map);
 	    entry != vm_map_copy_to_entry(copy_map);
 	    entry = entry->vme_next) {
-		target_entry = vm_map_copy_entry_create(target_copy_map);
+		target_entry = vm_map_copy_entry_batch_create(&batch,
+		    target_copy_map);
 		vm_map_entry_copy_full(target_entry, entry);
 		if (target_entry->is_sub_map) {
 			vm_map_reference(VME_SUBMAP(target_entry));
@@ -18485,6 +18711,7 @@ vm_map_copy_adjust_get_target_copy_map(
 			vm_map_copy_last_entry(target_copy_map),
 			target_entry);
 	}
+	vm_map_entry_batch_dispose(&batch);
 	entry = VM_MAP_ENTRY_NULL;
 	*target_copy_map_p = target_copy_map;
 }
@@ -19650,6 +19877,7 @@ vm_map_purgable_control(
 	if (control != VM_PURGABLE_SET_STATE &&
 	    control != VM_PURGABLE_GET_STATE &&
 	    control != VM_PURGABLE_PURGE_ALL &&
+	    control != VM_PURGABLE_PURGE_OWNED &&
 	    control != VM_PURGABLE_SET_STATE_FROM_KERNEL) {
 		return KERN_INVALID_ARGUMENT;
 	}
@@ -19659,6 +19887,21 @@ vm_map_purgable_control(
 		return KERN_SUCCESS;
 	}
 
+	if (control == VM_PURGABLE_PURGE_OWNED) {
+		uint64_t purged;
+
+		/*
+		 * Purge the caller's own volatile objects, least recently
+		 * made volatile first, until *state pages were freed.
+		 */
+		if (map != current_map() || *state < 0) {
+			return KERN_INVALID_ARGUMENT;
+		}
+		purged = vm_purgeable_purge_bytes(current_task(), ptoa_64(*state));
+		*state = (int)MIN(atop_64(purged), INT_MAX);
+		return KERN_SUCCESS;
+	}
+
 	if ((control == VM_PURGABLE_SET_STATE ||
 	    control == VM_PURGABLE_SET_STATE_FROM_KERNEL) &&
 	    (((*state & ~(VM_PURGABLE_ALL_MASKS)) != 0) ||
@@ -21388,6 +21631,27 @@ vm_map_cs_enforcement_set(
 	vm_map_unlock(map);
 }
 
+bool
+vm_map_fault_around(
+	vm_map_t map)
+{
+	return map->fault_around;
+}
+
+/*
+ * Opt the map in or out of mapping the resident neighbours of
+ * file-backed pages on read faults (see vm_fault_around()).
+ */
+void
+vm_map_set_fault_around(
+	vm_map_t map,
+	bool val)
+{
+	vm_map_lock(map);
+	map->fault_around = val;
+	vm_map_unlock(map);
+}
+
 /*
  * IOKit has mapped a region into this map; adjust the pmap's ledgers appropriately.
  * phys_footprint is a composite limit consisting of iokit + physmem, so we need to
@@ -273,7 +273,7 @@ struct vm_map_entry {
 	/* vm_object_offset_t*/ vme_offset:VME_OFFSET_BITS, /* offset into object */
 
 	/* boolean_t         */ is_shared:1,                /* region is shared */
-	/* boolean_t         */ __unused1:1,
+	/* boolean_t         */ vme_promoted:1,             /* has transparent superpages */
 	/* boolean_t         */ in_transition:1,            /* Entry being changed */
 	/* boolean_t         */ needs_wakeup:1,             /* Waiters on in_transition */
 	/* behavior is not defined for submap type */
@@ -626,8 +626,9 @@ struct _vm_map {
 	/* boolean_t */ uses_user_ranges:1,       /* has the map been configured to use user VM ranges */
 	/* boolean_t */ tpro_enforcement:1,       /* enforce TPRO propagation */
 	/* boolean_t */ corpse_source:1,          /* map is being used to create a corpse for diagnostics.*/
+	/* boolean_t */ fault_around:1,           /* read faults also map resident neighbours */
 	/* reserved */ res0:1,
-	/* reserved  */pad:9;
+	/* reserved  */pad:8;
 	unsigned int            timestamp;        /* Version number */
 };
 
@@ -1169,6 +1170,13 @@ extern kern_return_t vm_map_csm_allow_jit(vm_map_t map);
 
 #ifdef XNU_KERNEL_PRIVATE
 
+/* Map resident neighbours of file-backed pages on read faults */
+extern bool vm_map_fault_around(
+	vm_map_t                map);
+extern void vm_map_set_fault_around(
+	vm_map_t                map,
+	bool                    val);
+
 extern void vm_map_will_allocate_early_map(
 	vm_map_t               *map_owner);
 
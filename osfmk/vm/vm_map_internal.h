@@ -204,6 +204,13 @@ vm_map_remove(
 	(void)vm_map_remove_guard(map, start, end, flags, guard);
 }
 
+/* Apply a vector of protect and deallocate operations */
+extern kern_return_t vm_map_batch(
+	vm_map_t                map,
+	mach_vm_batch_op_v1_t   *ops,
+	uint32_t                count,
+	uint32_t                *completed);
+
 extern bool kmem_is_ptr_range(vm_map_range_id_t range_id);
 
 extern mach_vm_range_t kmem_validate_range_for_overwrite(
@@ -43,6 +43,9 @@ first_free_is_valid_store( vm_map_t map )
 bool
 vm_map_store_has_RB_support( struct vm_map_header *hdr )
 {
+	if (hdr->entries_btree) {
+		return FALSE;
+	}
 	if ((void*)hdr->rb_head_store.rbh_root == (void*)(int)SKIP_RB_TREE) {
 		return FALSE;
 	}
@@ -53,6 +56,12 @@ void
 vm_map_store_init( struct vm_map_header *hdr )
 {
 	vm_map_store_init_ll( hdr );
+#ifdef VM_MAP_STORE_USE_BT
+	if (hdr->entries_btree) {
+		vm_map_store_init_bt( hdr );
+		return;
+	}
+#endif
 #ifdef VM_MAP_STORE_USE_RB
 	if (vm_map_store_has_RB_support( hdr )) {
 		vm_map_store_init_rb( hdr );
@@ -66,6 +75,11 @@ _vm_map_store_lookup_entry(
 	vm_map_offset_t         address,
 	vm_map_entry_t          *entry)         /* OUT */
 {
+#ifdef VM_MAP_STORE_USE_BT
+	if (map->hdr.entries_btree) {
+		return vm_map_store_lookup_entry_bt( map, address, entry );
+	}
+#endif
 #ifdef VM_MAP_STORE_USE_RB
 	if (vm_map_store_has_RB_support( &map->hdr )) {
 		return vm_map_store_lookup_entry_rb( map, address, entry );
@@ -119,6 +133,11 @@ _vm_map_store_entry_link(
 	}
 
 	vm_map_store_entry_link_ll(mapHdr, after_where, entry);
+#ifdef VM_MAP_STORE_USE_BT
+	if (mapHdr->entries_btree) {
+		vm_map_store_entry_link_bt(mapHdr, after_where, entry);
+	}
+#endif
 #ifdef VM_MAP_STORE_USE_RB
 	if (vm_map_store_has_RB_support( mapHdr )) {
 		vm_map_store_entry_link_rb(mapHdr, entry);
@@ -220,6 +239,11 @@ _vm_map_store_entry_unlink(
 	}
 
 	vm_map_store_entry_unlink_ll(mapHdr, entry);
+#ifdef VM_MAP_STORE_USE_BT
+	if (mapHdr->entries_btree) {
+		vm_map_store_entry_unlink_bt(mapHdr, entry);
+	}
+#endif
 #ifdef VM_MAP_STORE_USE_RB
 	if (vm_map_store_has_RB_support( mapHdr )) {
 		vm_map_store_entry_unlink_rb(mapHdr, entry);
@@ -277,6 +301,26 @@ vm_map_store_update_first_free(
 	vm_map_entry_t          first_free_entry,
 	bool                    new_entry_creation)
 {
+#ifdef VM_MAP_STORE_USE_BT
+	if (map->hdr.entries_btree) {
+		/*
+		 * The entry was resized in place: refresh
+		 * the gaps the tree has cached around it.
+		 *
+		 * B+-tree maps have no hole list, and maintain first_free
+		 * like linked list maps do (vm_toggle_entry_reuse() relies
+		 * on it), but callers pass the resized entry rather than
+		 * a first_free candidate: resizing in place only ever fills
+		 * holes, so walking forward from first_free is enough.
+		 */
+		if (first_free_entry != VM_MAP_ENTRY_NULL &&
+		    first_free_entry != vm_map_to_entry(map)) {
+			vm_map_store_update_bt(&map->hdr, first_free_entry);
+		}
+		update_first_free_ll(map, map->first_free);
+		return;
+	}
+#endif
 	update_first_free_ll(map, first_free_entry);
 #ifdef VM_MAP_STORE_USE_RB
 	if (vm_map_store_has_RB_support( &map->hdr )) {
@@ -322,6 +366,7 @@ vm_map_store_find_space_backwards(
 {
 	const vm_map_offset_t map_mask  = VM_MAP_PAGE_MASK(map);
 	const bool            use_holes = map->holelistenabled;
+	const bool            use_btree = map->hdr.entries_btree;
 	vm_map_offset_t       start;
 	vm_map_entry_t        entry;
 
@@ -416,6 +461,18 @@ vm_map_store_find_space_backwards(
 				break;
 			}
 
+			if (use_btree) {
+				/*
+				 * Skip the entries that are packed
+				 * too tightly for the region to fit.
+				 */
+				entry = vm_map_store_prev_gap_bt(map, entry,
+				    size + guard_offset);
+				if (entry == vm_map_to_entry(map)) {
+					return VM_MAP_ENTRY_NULL;
+				}
+			}
+
 			end = entry->vme_start;
 		}
 	}
@@ -436,6 +493,7 @@ vm_map_store_find_space_forward(
 {
 	const vm_map_offset_t map_mask  = VM_MAP_PAGE_MASK(map);
 	const bool            use_holes = map->holelistenabled;
+	const bool            use_btree = map->hdr.entries_btree;
 	vm_map_entry_t        entry;
 
 	/*
@@ -551,7 +609,18 @@ vm_map_store_find_space_forward(
 				break;
 			}
 
-			entry = next;
+			if (use_btree) {
+				/*
+				 * Skip to the entry preceding the next gap
+				 * that could fit the region, or to the last
+				 * one if there is none.
+				 */
+				next = vm_map_store_next_gap_bt(map, next,
+				    size + guard_offset);
+				entry = next->vme_prev;
+			} else {
+				entry = next;
+			}
 			start = entry->vme_end;
 		}
 	}
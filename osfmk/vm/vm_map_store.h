@@ -33,6 +33,10 @@
 #define VM_MAP_STORE_USE_RB
 #endif
 
+#ifndef VM_MAP_STORE_USE_BT
+#define VM_MAP_STORE_USE_BT
+#endif
+
 #include <libkern/tree.h>
 #include <mach/shared_region.h>
 
@@ -40,11 +44,21 @@ struct _vm_map;
 struct vm_map_entry;
 struct vm_map_copy;
 struct vm_map_header;
+struct vm_map_bt_node;
 
+/*
+ * A map's entries are indexed either by the red-black tree,
+ * or by the B+-tree (see vm_map_store_bt.c), never both.
+ */
 struct vm_map_store {
+	union {
 #ifdef VM_MAP_STORE_USE_RB
-	RB_ENTRY(vm_map_store) entry;
+		RB_ENTRY(vm_map_store) entry;
+#endif
+#ifdef VM_MAP_STORE_USE_BT
+		struct vm_map_bt_node *bt_leaf;         /* leaf holding the entry */
 #endif
+	};
 };
 
 #ifdef VM_MAP_STORE_USE_RB
@@ -91,10 +105,16 @@ struct vm_map_header {
 	int                     nentries;       /* Number of entries */
 	uint16_t                page_shift;     /* page shift */
 	uint16_t                entries_pageable : 1;   /* are map entries pageable? */
-	uint16_t                __padding : 15;
+	uint16_t                entries_btree : 1;      /* are map entries in a B+-tree? */
+	uint16_t                __padding : 14;
+	union {
 #ifdef VM_MAP_STORE_USE_RB
-	struct rb_head          rb_head_store;
+		struct rb_head          rb_head_store;
 #endif /* VM_MAP_STORE_USE_RB */
+#ifdef VM_MAP_STORE_USE_BT
+		struct vm_map_bt_node  *bt_root;
+#endif /* VM_MAP_STORE_USE_BT */
+	};
 };
 
 #define VM_MAP_HDR_PAGE_SHIFT(hdr)      ((hdr)->page_shift)
@@ -104,6 +124,7 @@ struct vm_map_header {
 
 #include <vm/vm_map_store_ll.h>
 #include <vm/vm_map_store_rb.h>
+#include <vm/vm_map_store_bt.h>
 
 /*
  *	SAVE_HINT_MAP_WRITE:
@@ -0,0 +1,556 @@
+/*
+ * Copyright (c) 2024 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#include <kern/zalloc.h>
+#include <vm/vm_map.h>
+
+/*
+ * B+-tree map entry store.
+ *
+ * Maps created with VM_MAP_CREATE_BTREE_STORE index their entries with
+ * a B+-tree instead of the red-black tree.  Leaves point to the entries
+ * in address order, and every node keeps, next to its pointers, the
+ * start address of each of them and the largest gap found in front of
+ * an entry beneath them.  A lookup reads a couple of cache lines per
+ * level instead of a node per level of a binary tree, and so do hole
+ * searches, which is why these maps don't need a hole list.
+ *
+ * The doubly linked list of entries is kept, the rest of the VM walks
+ * it.  The tree only needs to get close: lookups take their last step
+ * using the entries' own addresses, so that a start address cached
+ * in a leaf going stale (an entry clipped or simplified in place) costs
+ * a step along the list at worst.
+ *
+ * Cached gaps may only ever be larger than the actual ones, which is
+ * the direction in which they go stale when an entry grows in place.
+ * Hole searches use them to skip whole subtrees, and the holes they
+ * pick are then checked against the entries themselves.
+ */
+
+#define VM_MAP_BT_ORDER         16
+
+struct vm_map_bt_node {
+	struct vm_map_bt_node  *bn_parent;
+	uint16_t                bn_count;
+	uint16_t                bn_slot;        /* index in bn_parent */
+	bool                    bn_leaf;
+	vm_map_offset_t         bn_keys[VM_MAP_BT_ORDER];
+	vm_map_size_t           bn_gaps[VM_MAP_BT_ORDER];
+	union {
+		struct vm_map_bt_node  *bn_children[VM_MAP_BT_ORDER];
+		struct vm_map_entry    *bn_entries[VM_MAP_BT_ORDER];
+	};
+};
+
+static KALLOC_TYPE_DEFINE(vm_map_bt_node_zone, struct vm_map_bt_node, KT_DEFAULT);
+
+static struct vm_map_bt_node *
+vm_map_bt_node_alloc(bool leaf)
+{
+	struct vm_map_bt_node *node;
+
+	node = zalloc_flags(vm_map_bt_node_zone, Z_WAITOK | Z_ZERO | Z_NOFAIL);
+	node->bn_leaf = leaf;
+	return node;
+}
+
+static void
+vm_map_bt_node_free(struct vm_map_bt_node *node)
+{
+	zfree(vm_map_bt_node_zone, node);
+}
+
+/*
+ * The gap in front of an entry.  For the first one, this counts from 0
+ * rather than the map's minimum address, which can move.
+ */
+static vm_map_size_t
+vm_map_bt_entry_gap(struct vm_map_header *hdr, vm_map_entry_t entry)
+{
+	vm_map_entry_t prev = entry->vme_prev;
+
+	if (prev == CAST_TO_VM_MAP_ENTRY(hdr)) {
+		return entry->vme_start;
+	}
+	return entry->vme_start - prev->vme_end;
+}
+
+static vm_map_size_t
+vm_map_bt_node_gap(const struct vm_map_bt_node *node)
+{
+	vm_map_size_t gap = 0;
+
+	for (uint16_t i = 0; i < node->bn_count; i++) {
+		gap = MAX(gap, node->bn_gaps[i]);
+	}
+	return gap;
+}
+
+/*
+ * Index of the last slot whose key is at most "address", -1 if none.
+ */
+static int
+vm_map_bt_node_search(const struct vm_map_bt_node *node, vm_map_offset_t address)
+{
+	int slot = -1;
+
+	for (int i = 0; i < node->bn_count && node->bn_keys[i] <= address; i++) {
+		slot = i;
+	}
+	return slot;
+}
+
+static uint16_t
+vm_map_bt_leaf_slot(const struct vm_map_bt_node *leaf, vm_map_entry_t entry)
+{
+	for (uint16_t i = 0; i < leaf->bn_count; i++) {
+		if (leaf->bn_entries[i] == entry) {
+			return i;
+		}
+	}
+	panic("vm_map_bt: entry %p isn't in leaf %p", entry, leaf);
+}
+
+static struct vm_map_bt_node *
+vm_map_bt_first_leaf(struct vm_map_bt_node *node)
+{
+	while (!node->bn_leaf) {
+		node = node->bn_children[0];
+	}
+	return node;
+}
+
+/*
+ * Fills a slot with an entry (leaves) or a child (inner nodes),
+ * computing its key and gap.
+ */
+static void
+vm_map_bt_node_set(
+	struct vm_map_header   *hdr,
+	struct vm_map_bt_node  *node,
+	uint16_t                slot,
+	void                   *item)
+{
+	if (node->bn_leaf) {
+		vm_map_entry_t entry = item;
+
+		node->bn_entries[slot] = entry;
+		node->bn_keys[slot] = entry->vme_start;
+		node->bn_gaps[slot] = vm_map_bt_entry_gap(hdr, entry);
+		entry->store.bt_leaf = node;
+	} else {
+		struct vm_map_bt_node *child = item;
+
+		node->bn_children[slot] = child;
+		node->bn_keys[slot] = child->bn_keys[0];
+		node->bn_gaps[slot] = vm_map_bt_node_gap(child);
+		child->bn_parent = node;
+		child->bn_slot = slot;
+	}
+}
+
+static void
+vm_map_bt_node_move(struct vm_map_bt_node *node, uint16_t dst, uint16_t src)
+{
+	node->bn_keys[dst] = node->bn_keys[src];
+	node->bn_gaps[dst] = node->bn_gaps[src];
+	if (node->bn_leaf) {
+		node->bn_entries[dst] = node->bn_entries[src];
+	} else {
+		node->bn_children[dst] = node->bn_children[src];
+		node->bn_children[dst]->bn_slot = dst;
+	}
+}
+
+static inline void *
+vm_map_bt_node_item(const struct vm_map_bt_node *node, uint16_t slot)
+{
+	if (node->bn_leaf) {
+		return node->bn_entries[slot];
+	}
+	return node->bn_children[slot];
+}
+
+/*
+ * Pushes the first key and the largest gap of a node up the tree,
+ * stopping as soon as an ancestor already has them right.
+ */
+static void
+vm_map_bt_propagate(struct vm_map_bt_node *node)
+{
+	struct vm_map_bt_node *parent;
+
+	while ((parent = node->bn_parent) != NULL) {
+		vm_map_offset_t key = node->bn_keys[0];
+		vm_map_size_t   gap = vm_map_bt_node_gap(node);
+
+		if (parent->bn_keys[node->bn_slot] == key &&
+		    parent->bn_gaps[node->bn_slot] == gap) {
+			break;
+		}
+		parent->bn_keys[node->bn_slot] = key;
+		parent->bn_gaps[node->bn_slot] = gap;
+		node = parent;
+	}
+}
+
+/*
+ * Inserts an item at "slot" of "node", splitting it in half
+ * (and its ancestors, as needed) when it is full.
+ */
+static void
+vm_map_bt_insert(
+	struct vm_map_header   *hdr,
+	struct vm_map_bt_node  *node,
+	uint16_t                slot,
+	void                   *item)
+{
+	void *items[VM_MAP_BT_ORDER + 1];
+	struct vm_map_bt_node *parent, *right;
+	uint16_t count = node->bn_count;
+	uint16_t half = (VM_MAP_BT_ORDER + 1) / 2;
+
+	if (count < VM_MAP_BT_ORDER) {
+		for (uint16_t i = count; i > slot; i--) {
+			vm_map_bt_node_move(node, i, (uint16_t)(i - 1));
+		}
+		vm_map_bt_node_set(hdr, node, slot, item);
+		node->bn_count++;
+		vm_map_bt_propagate(node);
+		return;
+	}
+
+	for (uint16_t i = 0, j = 0; i <= count; i++) {
+		items[i] = i == slot ? item : vm_map_bt_node_item(node, j++);
+	}
+
+	right = vm_map_bt_node_alloc(node->bn_leaf);
+	for (uint16_t i = 0; i < half; i++) {
+		vm_map_bt_node_set(hdr, node, i, items[i]);
+	}
+	for (uint16_t i = half; i <= count; i++) {
+		vm_map_bt_node_set(hdr, right, (uint16_t)(i - half), items[i]);
+	}
+	node->bn_count = half;
+	right->bn_count = (uint16_t)(count + 1 - half);
+
+	parent = node->bn_parent;
+	if (parent == NULL) {
+		parent = vm_map_bt_node_alloc(false);
+		vm_map_bt_node_set(hdr, parent, 0, node);
+		vm_map_bt_node_set(hdr, parent, 1, right);
+		parent->bn_count = 2;
+		hdr->bt_root = parent;
+	} else {
+		vm_map_bt_propagate(node);
+		vm_map_bt_insert(hdr, parent, (uint16_t)(node->bn_slot + 1), right);
+	}
+}
+
+/*
+ * Removes the item at "slot" of "node", freeing the node once empty,
+ * merging it with a neighbor once they fit in one, and shrinking the
+ * tree when the root is left with a single child.
+ */
+static void
+vm_map_bt_remove(
+	struct vm_map_header   *hdr,
+	struct vm_map_bt_node  *node,
+	uint16_t                slot)
+{
+	struct vm_map_bt_node *parent = node->bn_parent;
+	struct vm_map_bt_node *left, *right;
+
+	for (uint16_t i = slot; i + 1 < node->bn_count; i++) {
+		vm_map_bt_node_move(node, i, (uint16_t)(i + 1));
+	}
+	node->bn_count--;
+
+	if (parent == NULL) {
+		if (node->bn_count == 0) {
+			vm_map_bt_node_free(node);
+			hdr->bt_root = NULL;
+			return;
+		}
+		while (!node->bn_leaf && node->bn_count == 1) {
+			struct vm_map_bt_node *child = node->bn_children[0];
+
+			vm_map_bt_node_free(node);
+			child->bn_parent = NULL;
+			child->bn_slot = 0;
+			node = child;
+		}
+		hdr->bt_root = node;
+		return;
+	}
+
+	if (node->bn_count == 0) {
+		slot = node->bn_slot;
+		vm_map_bt_node_free(node);
+		vm_map_bt_remove(hdr, parent, slot);
+		return;
+	}
+
+	if (node->bn_count < VM_MAP_BT_ORDER / 2) {
+		if (node->bn_slot > 0) {
+			left = parent->bn_children[node->bn_slot - 1];
+			right = node;
+		} else if (node->bn_slot + 1 < parent->bn_count) {
+			left = node;
+			right = parent->bn_children[node->bn_slot + 1];
+		} else {
+			left = right = NULL;
+		}
+
+		if (left && left->bn_count + right->bn_count <= VM_MAP_BT_ORDER) {
+			for (uint16_t i = 0; i < right->bn_count; i++) {
+				vm_map_bt_node_set(hdr, left, (uint16_t)(left->bn_count + i),
+				    vm_map_bt_node_item(right, i));
+			}
+			left->bn_count += right->bn_count;
+			slot = right->bn_slot;
+			vm_map_bt_node_free(right);
+			vm_map_bt_propagate(left);
+			vm_map_bt_remove(hdr, parent, slot);
+			return;
+		}
+	}
+
+	vm_map_bt_propagate(node);
+}
+
+/*
+ * Recomputes the key and gap of an entry after it changed in place.
+ */
+static void
+vm_map_bt_refresh(struct vm_map_header *hdr, vm_map_entry_t entry)
+{
+	struct vm_map_bt_node *leaf = entry->store.bt_leaf;
+	uint16_t slot = vm_map_bt_leaf_slot(leaf, entry);
+
+	leaf->bn_keys[slot] = entry->vme_start;
+	leaf->bn_gaps[slot] = vm_map_bt_entry_gap(hdr, entry);
+	vm_map_bt_propagate(leaf);
+}
+
+void
+vm_map_store_init_bt(struct vm_map_header *hdr)
+{
+	hdr->bt_root = NULL;
+}
+
+bool
+vm_map_store_lookup_entry_bt(
+	vm_map_t                map,
+	vm_map_offset_t         address,
+	vm_map_entry_t         *vm_entry)
+{
+	struct vm_map_bt_node *node = map->hdr.bt_root;
+	vm_map_entry_t         head = vm_map_to_entry(map);
+	vm_map_entry_t         cur = head;
+	vm_map_entry_t         next;
+	int                    slot;
+
+	if (node != NULL) {
+		for (;;) {
+			slot = vm_map_bt_node_search(node, address);
+			if (node->bn_leaf) {
+				break;
+			}
+			node = node->bn_children[MAX(slot, 0)];
+		}
+		if (slot >= 0) {
+			cur = node->bn_entries[slot];
+		}
+	}
+
+	/*
+	 * The keys are a hint, the entry list is what's authoritative.
+	 */
+	while (cur != head && address < cur->vme_start) {
+		cur = cur->vme_prev;
+	}
+	while ((next = cur->vme_next) != head && next->vme_start <= address) {
+		cur = next;
+	}
+
+	*vm_entry = cur;
+	return cur != head && address < cur->vme_end;
+}
+
+void
+vm_map_store_entry_link_bt(
+	struct vm_map_header   *hdr,
+	vm_map_entry_t          after_where,
+	vm_map_entry_t          entry)
+{
+	vm_map_entry_t         next = entry->vme_next;
+	struct vm_map_bt_node *leaf;
+	uint16_t               slot;
+
+	if (hdr->bt_root == NULL) {
+		leaf = hdr->bt_root = vm_map_bt_node_alloc(true);
+		slot = 0;
+	} else if (after_where == CAST_TO_VM_MAP_ENTRY(hdr)) {
+		leaf = vm_map_bt_first_leaf(hdr->bt_root);
+		slot = 0;
+	} else {
+		leaf = after_where->store.bt_leaf;
+		slot = vm_map_bt_leaf_slot(leaf, after_where) + 1;
+	}
+
+	vm_map_bt_insert(hdr, leaf, slot, entry);
+
+	/* the entry took over part of the gap in front of its successor */
+	if (next != CAST_TO_VM_MAP_ENTRY(hdr)) {
+		vm_map_bt_refresh(hdr, next);
+	}
+}
+
+void
+vm_map_store_entry_unlink_bt(
+	struct vm_map_header   *hdr,
+	vm_map_entry_t          entry)
+{
+	vm_map_entry_t         next = entry->vme_next;
+	struct vm_map_bt_node *leaf = entry->store.bt_leaf;
+
+	vm_map_bt_remove(hdr, leaf, vm_map_bt_leaf_slot(leaf, entry));
+	entry->store.bt_leaf = NULL;
+
+	/* and its successor inherits the gap */
+	if (next != CAST_TO_VM_MAP_ENTRY(hdr)) {
+		vm_map_bt_refresh(hdr, next);
+	}
+}
+
+void
+vm_map_store_update_bt(
+	struct vm_map_header   *hdr,
+	vm_map_entry_t          entry)
+{
+	vm_map_bt_refresh(hdr, entry);
+	if (entry->vme_next != CAST_TO_VM_MAP_ENTRY(hdr)) {
+		vm_map_bt_refresh(hdr, entry->vme_next);
+	}
+}
+
+/*
+ * Returns the first entry after "entry" with at least "size" bytes
+ * of free space in front of it (as far as the tree knows),
+ * or the map header when there is none.
+ */
+vm_map_entry_t
+vm_map_store_next_gap_bt(
+	vm_map_t                map,
+	vm_map_entry_t          entry,
+	vm_map_size_t           size)
+{
+	struct vm_map_bt_node *node;
+	int                    slot;
+
+	if (map->hdr.bt_root == NULL) {
+		return vm_map_to_entry(map);
+	}
+	if (entry == vm_map_to_entry(map)) {
+		node = vm_map_bt_first_leaf(map->hdr.bt_root);
+		slot = -1;
+	} else {
+		node = entry->store.bt_leaf;
+		slot = vm_map_bt_leaf_slot(node, entry);
+	}
+
+	/* climb until some node to the right has a wide enough gap... */
+	for (;;) {
+		while (++slot < node->bn_count) {
+			if (node->bn_gaps[slot] >= size) {
+				break;
+			}
+		}
+		if (slot < node->bn_count) {
+			break;
+		}
+		if (node->bn_parent == NULL) {
+			return vm_map_to_entry(map);
+		}
+		slot = node->bn_slot;
+		node = node->bn_parent;
+	}
+
+	/* ... and come back down, leftmost first */
+	while (!node->bn_leaf) {
+		node = node->bn_children[slot];
+		for (slot = 0; node->bn_gaps[slot] < size; slot++) {
+			assert(slot + 1 < node->bn_count);
+		}
+	}
+
+	return node->bn_entries[slot];
+}
+
+/*
+ * Returns the last entry, "entry" included, with at least "size" bytes
+ * of free space in front of it (as far as the tree knows),
+ * or the map header when there is none.
+ */
+vm_map_entry_t
+vm_map_store_prev_gap_bt(
+	vm_map_t                map,
+	vm_map_entry_t          entry,
+	vm_map_size_t           size)
+{
+	struct vm_map_bt_node *node = entry->store.bt_leaf;
+	int                    slot = vm_map_bt_leaf_slot(node, entry) + 1;
+
+	/* climb until some node to the left has a wide enough gap... */
+	for (;;) {
+		while (--slot >= 0) {
+			if (node->bn_gaps[slot] >= size) {
+				break;
+			}
+		}
+		if (slot >= 0) {
+			break;
+		}
+		if (node->bn_parent == NULL) {
+			return vm_map_to_entry(map);
+		}
+		slot = node->bn_slot;
+		node = node->bn_parent;
+	}
+
+	/* ... and come back down, rightmost first */
+	while (!node->bn_leaf) {
+		node = node->bn_children[slot];
+		for (slot = node->bn_count - 1; node->bn_gaps[slot] < size; slot--) {
+			assert(slot > 0);
+		}
+	}
+
+	return node->bn_entries[slot];
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2024 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#ifndef _VM_VM_MAP_STORE_BT_H
+#define _VM_VM_MAP_STORE_BT_H
+
+extern void vm_map_store_init_bt(
+	struct vm_map_header   *header);
+
+extern bool vm_map_store_lookup_entry_bt(
+	struct _vm_map         *map,
+	vm_map_offset_t         address,
+	struct vm_map_entry   **entryp);
+
+extern void vm_map_store_entry_link_bt(
+	struct vm_map_header   *header,
+	struct vm_map_entry    *after_where,
+	struct vm_map_entry    *entry);
+
+extern void vm_map_store_entry_unlink_bt(
+	struct vm_map_header   *header,
+	struct vm_map_entry    *entry);
+
+extern void vm_map_store_update_bt(
+	struct vm_map_header   *header,
+	struct vm_map_entry    *entry);
+
+extern struct vm_map_entry *vm_map_store_next_gap_bt(
+	struct _vm_map         *map,
+	struct vm_map_entry    *entry,
+	vm_map_size_t           size);
+
+extern struct vm_map_entry *vm_map_store_prev_gap_bt(
+	struct _vm_map         *map,
+	struct vm_map_entry    *entry,
+	vm_map_size_t           size);
+
+#endif /* _VM_VM_MAP_STORE_BT_H */
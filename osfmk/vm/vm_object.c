@@ -7565,7 +7565,7 @@ vm_object_compressed_freezer_pageout(
 
 		if (vm_pageout_compress_page(&(freezer_context_global.freezer_ctx_chead),
 		    (freezer_context_global.freezer_ctx_compressor_scratch_buf),
-		    p) == KERN_SUCCESS) {
+		    NULL, p) == KERN_SUCCESS) {
 			/*
 			 * page has already been un-tabled from the object via 'vm_page_remove'
 			 */
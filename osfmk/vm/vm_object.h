@@ -128,7 +128,8 @@ struct vm_object_fault_info {
 	/* boolean_t */ no_copy_on_read:1,
 	/* boolean_t */ fi_xnu_user_debug:1,
 	/* boolean_t */ fi_used_for_tpro:1,
-	    __vm_object_fault_info_unused_bits:21;
+	/* boolean_t */ fi_promoted:1,
+	    __vm_object_fault_info_unused_bits:20;
 	int             pmap_options;
 };
 
@@ -179,7 +180,9 @@ struct vm_object {
 	                                         * copy_call.
 	                                         */
 	uint32_t                vo_copy_version;
-	uint32_t                __vo_unused_padding;
+	uint32_t                vo_purgeable_volatile_seq; /* when it was last made
+	                                                    * volatile, see
+	                                                    * vm_purgeable_purge_bytes() */
 	struct vm_object        *shadow;        /* My shadow */
 	memory_object_t         pager;          /* Where to get data */
 
@@ -229,11 +229,11 @@ struct vm_page {
 	    vmp_reference:1,                 /* page has been used (P) */
 	    vmp_lopage:1,
 	    vmp_realtime:1,                  /* page used by realtime thread */
+	    vmp_gen:2,                       /* active queue generation, see vm_page_balance_inactive (P) */
 #if !CONFIG_TRACK_UNMODIFIED_ANON_PAGES
-	    vmp_unused_page_bits:3;
+	    vmp_promoted:1;                  /* wired as part of a transparent superpage (O&P) */
 #else /* ! CONFIG_TRACK_UNMODIFIED_ANON_PAGES */
-	vmp_unmodified_ro:1,                 /* Tracks if an anonymous page is modified after a decompression (O&P).*/
-	vmp_unused_page_bits:2;
+	vmp_unmodified_ro:1;                 /* Tracks if an anonymous page is modified after a decompression (O&P).*/
 #endif /* ! CONFIG_TRACK_UNMODIFIED_ANON_PAGES */
 
 	/*
@@ -1489,6 +1489,8 @@ extern void             vm_page_release(
 extern boolean_t        vm_page_wait(
 	int             interruptible );
 
+extern void             vm_page_free_cache_flush(void);
+
 extern vm_page_t        vm_page_alloc(
 	vm_object_t             object,
 	vm_object_offset_t      offset);
@@ -1508,6 +1510,27 @@ extern void             vm_page_free_unlocked(
 extern void             vm_page_balance_inactive(
 	int             max_to_move);
 
+/*
+ * Generations of the active queue (see vm_page_balance_inactive()).
+ * vm_page_active_seq counts the passes made over the active queue, and
+ * a page entering it joins the youngest generation.
+ */
+#define VM_PAGE_NGENS           4
+#define VM_PAGE_GEN_MASK        (VM_PAGE_NGENS - 1)
+
+extern uint64_t         vm_page_active_seq;
+
+/*
+ * Active pages vm_page_balance_inactive() deactivates even with the
+ * inactive queue at its target, one for each page the phantom cache
+ * activated on a working set refault.
+ */
+extern uint32_t         vm_page_workingset_debt;
+#define VM_PAGE_WORKINGSET_DEBT_MAX     1024
+
+#define VM_PAGE_SET_YOUNGEST_GEN(m) \
+	((m)->vmp_gen = (vm_page_active_seq & VM_PAGE_GEN_MASK))
+
 extern void             vm_page_activate(
 	vm_page_t       page);
 
@@ -1696,7 +1696,9 @@ update_vm_info(void)
 	vm_pageout_stats[vm_pageout_stat_now].pages_grabbed = (unsigned int)(tmp64 - last_vm_page_pages_grabbed);
 	last_vm_page_pages_grabbed = tmp64;
 
-	tmp = vm_pageout_vminfo.vm_page_pages_freed;
+	/* pages freed into the per-CPU free page caches never reach vm_page_pages_freed */
+	tmp = vm_pageout_vminfo.vm_page_pages_freed +
+	    (unsigned long)counter_load(&vm_page_free_cache_releases);
 	vm_pageout_stats[vm_pageout_stat_now].pages_freed = (unsigned int)(tmp - last.vm_page_pages_freed);
 	last.vm_page_pages_freed = tmp;
 
@@ -2853,6 +2855,7 @@ vps_deal_with_throttled_queues(vm_page_t m, vm_object_t *object, uint32_t *vm_pa
 		assert(m->vmp_q_state == VM_PAGE_NOT_ON_Q);
 		vm_page_queue_enter(&vm_page_queue_active, m, vmp_pageq);
 		m->vmp_q_state = VM_PAGE_ON_ACTIVE_Q;
+		VM_PAGE_SET_YOUNGEST_GEN(m);
 		vm_page_active_count++;
 		vm_page_pageable_external_count++;
 
@@ -2897,6 +2900,118 @@ vps_deal_with_throttled_queues(vm_page_t m, vm_object_t *object, uint32_t *vm_pa
 	}
 }
 
+/*
+ * Multi-generational aging of the active queue.
+ *
+ * vm_page_balance_inactive() refills the inactive queues from the head of
+ * the active queue.  By default, it deactivates whatever it finds there
+ * and lets vm_pageout_scan() reactivate the pages that get referenced
+ * while inactive.
+ *
+ * With vm_page_multigen set, each active page carries one of
+ * VM_PAGE_NGENS generations instead.  Every page examined has its
+ * reference bit sampled and cleared: a referenced page moves to the
+ * youngest generation, an unreferenced one keeps its generation and gets
+ * older as vm_page_active_seq advances, once per pass over the active
+ * queue.  Only pages that reached the oldest generation are deactivated,
+ * along with their resident neighbours in the same object that are just
+ * as old, so that vm_pageout_scan() finds them together.  A page has to
+ * go unreferenced for VM_PAGE_NGENS - 1 passes before it can be evicted,
+ * rather than for the time it takes to cross the inactive queue.
+ *
+ * vm_page_active_seq is maintained in both modes; the phantom cache uses
+ * it to measure refault distances, so the two can be compared.
+ */
+TUNABLE_WRITEABLE(int, vm_page_multigen, "vm_page_multigen", 0);
+uint64_t        vm_page_active_seq = 0;
+static uint32_t vm_page_active_seq_scanned = 0;
+unsigned int    vm_page_multigen_cluster = 8;
+uint32_t        vm_page_workingset_debt = 0;
+
+#define VM_PAGE_GEN_AGE(m) \
+	((unsigned int)((vm_page_active_seq - (m)->vmp_gen) & VM_PAGE_GEN_MASK))
+
+static bool
+vm_page_gen_referenced(vm_page_t m)
+{
+	if (m->vmp_reference) {
+		return true;
+	}
+	if (m->vmp_pmapped && !m->vmp_absent) {
+		vm_page_lockconvert_queues();
+		return (pmap_get_refmod(VM_PAGE_GET_PHYS_PAGE(m)) & VM_MEM_REFERENCED) != 0;
+	}
+	return false;
+}
+
+/*
+ * Decide the fate of the page at the head of the active queue.
+ * Returns true if it stays active, false if it should be deactivated.
+ */
+static bool
+vm_page_gen_age(vm_page_t m)
+{
+	if (vm_page_inactive_count + vm_page_speculative_count == 0) {
+		/*
+		 * Nothing left to evict at all: don't make the pageout
+		 * daemon wait for a generation to grow old.
+		 */
+		return false;
+	}
+
+	if (vm_page_gen_referenced(m)) {
+		if (m->vmp_pmapped) {
+			vm_page_lockconvert_queues();
+			pmap_clear_refmod_options(VM_PAGE_GET_PHYS_PAGE(m),
+			    VM_MEM_REFERENCED, PMAP_OPTIONS_NOFLUSH, (void *)NULL);
+		}
+		m->vmp_reference = FALSE;
+		VM_PAGE_SET_YOUNGEST_GEN(m);
+		vm_pageout_vminfo.vm_page_gen_promoted++;
+	} else if (VM_PAGE_GEN_AGE(m) < VM_PAGE_NGENS - 1) {
+		vm_pageout_vminfo.vm_page_gen_aged++;
+	} else {
+		return false;
+	}
+
+	vm_page_queue_remove(&vm_page_queue_active, m, vmp_pageq);
+	vm_page_queue_enter(&vm_page_queue_active, m, vmp_pageq);
+	return true;
+}
+
+/*
+ * "m" was just deactivated from the oldest generation: deactivate the
+ * pages that follow it in its object too, as long as they are active,
+ * unreferenced and as old.
+ *
+ * Only done on behalf of vm_pageout_scan(): other callers of
+ * vm_page_balance_inactive() may hold object locks.
+ */
+static void
+vm_page_gen_deactivate_neighbours(vm_page_t m)
+{
+	vm_object_t     object = VM_PAGE_OBJECT(m);
+	vm_page_t       p;
+
+	if (vm_page_multigen_cluster == 0 ||
+	    current_thread() != vm_pageout_scan_thread ||
+	    !vm_object_lock_try_shared(object)) {
+		return;
+	}
+	for (unsigned int i = 1; i <= vm_page_multigen_cluster; i++) {
+		p = vm_page_lookup(object, m->vmp_offset + ptoa_64(i));
+		if (p == VM_PAGE_NULL ||
+		    p->vmp_q_state != VM_PAGE_ON_ACTIVE_Q ||
+		    p->vmp_busy || p->vmp_laundry ||
+		    VM_PAGE_GEN_AGE(p) < VM_PAGE_NGENS - 1 ||
+		    vm_page_gen_referenced(p)) {
+			break;
+		}
+		vm_page_deactivate_internal(p, FALSE);
+		vm_pageout_vminfo.vm_page_gen_clustered++;
+	}
+	vm_object_unlock(object);
+}
 
 void
 vm_page_balance_inactive(int max_to_move)
@@ -2920,7 +3035,9 @@ vm_page_balance_inactive(int max_to_move)
 	    vm_page_inactive_count +
 	    vm_page_speculative_count);
 
-	while (max_to_move-- && (vm_page_inactive_count + vm_page_speculative_count) < vm_page_inactive_target) {
+	while (max_to_move-- &&
+	    ((vm_page_inactive_count + vm_page_speculative_count) < vm_page_inactive_target ||
+	    (vm_page_workingset_debt && !vm_page_queue_empty(&vm_page_queue_active)))) {
 		VM_PAGEOUT_DEBUG(vm_pageout_balanced, 1);
 
 		m = (vm_page_t) vm_page_queue_first(&vm_page_queue_active);
@@ -2932,6 +3049,15 @@ vm_page_balance_inactive(int max_to_move)
 
 		DTRACE_VM2(scan, int, 1, (uint64_t *), NULL);
 
+		if (++vm_page_active_seq_scanned >= vm_page_active_count) {
+			vm_page_active_seq_scanned = 0;
+			vm_page_active_seq++;
+		}
+
+		if (vm_page_multigen && vm_page_gen_age(m)) {
+			continue;
+		}
+
 		/*
 		 * by not passing in a pmap_flush_context we will forgo any TLB flushing, local or otherwise...
 		 *
@@ -2961,6 +3087,13 @@ vm_page_balance_inactive(int max_to_move)
 		 * FALSE indicates that we don't want a H/W clear reference
 		 */
 		vm_page_deactivate_internal(m, FALSE);
+
+		if (vm_page_workingset_debt) {
+			vm_page_workingset_debt--;
+		}
+		if (vm_page_multigen) {
+			vm_page_gen_deactivate_neighbours(m);
+		}
 	}
 }
 
@@ -3015,6 +3148,9 @@ vm_pageout_scan(void)
 	/* Ask the pmap layer to return any pages it no longer needs. */
 	pmap_release_pages_fast();
 
+	/* And the other CPUs to return the pages they cached on free. */
+	vm_page_free_cache_flush();
+
 	vm_page_lock_queues();
 
 	delayed_unlock = 1;
@@ -4078,6 +4214,46 @@ uint32_t vm_compressor_time_thread; /* Set via sysctl to record time accrued by
                                      * this thread.
                                      */
 
+/*
+ * Number of pages a compressor thread runs through the codec, outside of
+ * any c_segment, before committing them in order.  0 or 1 compresses every
+ * page straight into its c_segment.  Bounded by the stages allocated at
+ * boot (vm_pageout_state.vm_compressor_batch_max).
+ */
+TUNABLE(uint32_t, vm_compressor_batch_boot_size, "vmcomp_batch", 8);
+uint32_t vm_compressor_batch_size;
+
+/*
+ * Stage up to vm_compressor_batch_size pages from the head of "local_q",
+ * in list order.  These pages are busy and already off the paging queues,
+ * so their contents can't change before vm_pageout_compress_page() commits
+ * the stages, in that same order.
+ */
+static uint32_t
+vm_pageout_stage_pages(struct pgo_iothread_state *cq, vm_page_t local_q)
+{
+	uint32_t        batch = os_atomic_load(&vm_compressor_batch_size, relaxed);
+	uint32_t        count = 0;
+	vm_page_t       m;
+
+	if (batch <= 1 || cq->stages == NULL) {
+		return 0;
+	}
+	for (m = local_q; m != VM_PAGE_NULL && count < batch; m = m->vmp_snext) {
+		c_stage_t stage = &cq->stages[count++];
+
+#if CONFIG_TRACK_UNMODIFIED_ANON_PAGES
+		if (m->vmp_unmodified_ro == true) {
+			/* headed for vm_uncompressed_put(), don't bother compressing */
+			stage->cst_size = C_STAGE_EMPTY;
+			continue;
+		}
+#endif /* CONFIG_TRACK_UNMODIFIED_ANON_PAGES */
+		vm_compressor_stage_page(VM_PAGE_GET_PHYS_PAGE(m), stage, cq->scratch_buf);
+	}
+	return count;
+}
+
 
 OS_NORETURN
 static void
@@ -4091,6 +4267,8 @@ vm_pageout_iothread_internal_continue(struct pgo_iothread_state *cq, __unused wa
 	vm_page_t   local_freeq = NULL;
 	int         local_freed = 0;
 	int         local_batch_size;
+	uint32_t    local_staged;
+	uint32_t    local_stage_idx;
 #if DEVELOPMENT || DEBUG
 	int       ncomps = 0;
 	boolean_t marked_active = FALSE;
@@ -4198,7 +4376,13 @@ vm_pageout_iothread_internal_continue(struct pgo_iothread_state *cq, __unused wa
 #endif
 			KERNEL_DEBUG(0xe0400018 | DBG_FUNC_END, q->pgo_laundry, 0, 0, 0, 0);
 
+			local_staged = local_stage_idx = 0;
+
 			while (local_q) {
+				if (local_stage_idx == local_staged) {
+					local_staged = vm_pageout_stage_pages(cq, local_q);
+					local_stage_idx = 0;
+				}
 				KERNEL_DEBUG(0xe0400024 | DBG_FUNC_START, local_cnt, 0, 0, 0, 0);
 
 				m = local_q;
@@ -4227,7 +4411,12 @@ vm_pageout_iothread_internal_continue(struct pgo_iothread_state *cq, __unused wa
 					chead = &cq->current_regular_swapout_chead;
 				}
 
-				if (vm_pageout_compress_page(chead, cq->scratch_buf, m) == KERN_SUCCESS) {
+				c_stage_t stage = NULL;
+				if (local_staged) {
+					stage = &cq->stages[local_stage_idx++];
+				}
+
+				if (vm_pageout_compress_page(chead, cq->scratch_buf, stage, m) == KERN_SUCCESS) {
 #if DEVELOPMENT || DEBUG
 					ncomps++;
 #endif
@@ -4366,7 +4555,7 @@ vm_pageout_iothread_internal_continue(struct pgo_iothread_state *cq, __unused wa
 
 
 kern_return_t
-vm_pageout_compress_page(void **current_chead, char *scratch_buf, vm_page_t m)
+vm_pageout_compress_page(void **current_chead, char *scratch_buf, c_stage_t stage, vm_page_t m)
 {
 	vm_object_t     object;
 	memory_object_t pager;
@@ -4447,6 +4636,7 @@ vm_pageout_compress_page(void **current_chead, char *scratch_buf, vm_page_t m)
 #endif /* CONFIG_TRACK_UNMODIFIED_ANON_PAGES */
 		current_chead,
 		scratch_buf,
+		stage,
 		&compressed_count_delta);
 
 	vm_object_lock(object);
@@ -5348,6 +5538,7 @@ vm_pageout_internal_start(void)
 	kern_return_t   result = KERN_SUCCESS;
 	host_basic_info_data_t hinfo;
 	vm_offset_t     buf, bufsize;
+	vm_offset_t     stage_buf = 0;
 
 	assert(VM_CONFIG_COMPRESSOR_IS_PRESENT);
 
@@ -5402,6 +5593,17 @@ vm_pageout_internal_start(void)
 	    KMA_DATA | KMA_NOFAIL | KMA_KOBJECT | KMA_PERMANENT,
 	    VM_KERN_MEMORY_COMPRESSOR);
 
+	vm_pageout_state.vm_compressor_batch_max = MIN(vm_compressor_batch_boot_size, C_STAGE_MAX_BATCH);
+	if (vm_pageout_state.vm_compressor_batch_max <= 1) {
+		vm_pageout_state.vm_compressor_batch_max = 0;
+	} else {
+		kmem_alloc(kernel_map, &stage_buf,
+		    ptoa(vm_pageout_state.vm_compressor_batch_max) * vm_pageout_state.vm_compressor_thread_count,
+		    KMA_DATA | KMA_NOFAIL | KMA_KOBJECT | KMA_PERMANENT,
+		    VM_KERN_MEMORY_COMPRESSOR);
+	}
+	vm_compressor_batch_size = vm_pageout_state.vm_compressor_batch_max;
+
 	for (int i = 0; i < vm_pageout_state.vm_compressor_thread_count; i++) {
 		struct pgo_iothread_state *iq = &pgo_iothread_internal_state[i];
 		iq->id = i;
@@ -5410,6 +5612,18 @@ vm_pageout_internal_start(void)
 		iq->current_regular_swapout_chead = NULL;
 		iq->current_late_swapout_chead = NULL;
 		iq->scratch_buf = (char *)(buf + i * bufsize);
+		iq->stages = NULL;
+		if (vm_pageout_state.vm_compressor_batch_max) {
+			uint32_t batch_max = vm_pageout_state.vm_compressor_batch_max;
+
+			iq->stages = zalloc_permanent(sizeof(struct c_stage) * batch_max,
+			    ZALIGN(struct c_stage));
+			for (uint32_t j = 0; j < batch_max; j++) {
+				iq->stages[j].cst_buf = (char *)(stage_buf +
+				    ptoa(i * batch_max + j));
+				iq->stages[j].cst_size = C_STAGE_EMPTY;
+			}
+		}
 #if DEVELOPMENT || DEBUG
 		iq->benchmark_q = &vm_pageout_queue_benchmark;
 #endif /* DEVELOPMENT || DEBUG */
@@ -7915,6 +8129,7 @@ process_upl_to_commit:
 							}
 						} else {
 							m->vmp_q_state = VM_PAGE_ON_ACTIVE_Q;
+							VM_PAGE_SET_YOUNGEST_GEN(m);
 						}
 					}
 				}
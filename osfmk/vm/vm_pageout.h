@@ -634,7 +634,8 @@ extern void hibernate_create_paddr_map(void);
 extern void vm_set_restrictions(unsigned int num_cpus);
 
 extern int vm_compressor_mode;
-extern kern_return_t vm_pageout_compress_page(void **, char *, vm_page_t);
+struct c_stage;
+extern kern_return_t vm_pageout_compress_page(void **, char *, struct c_stage *, vm_page_t);
 extern void vm_pageout_anonymous_pages(void);
 extern void vm_pageout_disconnect_all_pages(void);
 extern int vm_toggle_task_selfdonate_pages(task_t);
@@ -677,6 +678,7 @@ struct vm_pageout_state {
 	boolean_t vm_pressure_changed;
 	boolean_t vm_restricted_to_single_processor;
 	int vm_compressor_thread_count;
+	uint32_t vm_compressor_batch_max;       /* stages allocated per compressor thread */
 
 	unsigned int vm_page_speculative_q_age_ms;
 	unsigned int vm_page_speculative_percentage;
@@ -747,6 +749,11 @@ struct vm_pageout_vminfo {
 
 	unsigned long vm_phantom_cache_found_ghost;
 	unsigned long vm_phantom_cache_added_ghost;
+	unsigned long vm_phantom_cache_workingset_refault;
+
+	unsigned long vm_page_gen_promoted;             /* referenced active pages moved to the youngest generation */
+	unsigned long vm_page_gen_aged;                 /* unreferenced active pages left to age another pass */
+	unsigned long vm_page_gen_clustered;            /* neighbours deactivated along with an oldest generation page */
 
 	unsigned long vm_pageout_protected_sharedcache;
 	unsigned long vm_pageout_forcereclaimed_sharedcache;
@@ -850,6 +857,7 @@ struct pgo_iothread_state {
 	void                    *current_regular_swapout_chead;
 	void                    *current_late_swapout_chead;
 	char                    *scratch_buf;
+	struct c_stage          *stages;        // unused by external thread
 	int                     id;
 	thread_t                pgo_iothread; // holds a +1 ref
 	sched_cond_atomic_t     pgo_wakeup;
@@ -874,6 +882,15 @@ struct vm_compressor_swapper_stats {
 	uint64_t free_count_below_reserve;
 	uint64_t thrashing_detected;
 	uint64_t fragmentation_detected;
+	uint64_t dense_swapouts;
+	uint64_t dense_swapout_bytes_saved;
+	uint64_t dense_swapins;
+	uint64_t dense_decode_failures;
+	uint64_t major_compact_passes;
+	uint64_t major_compact_bytes_freed;
+	uint64_t major_compact_cpu_time_us;
+	uint64_t major_compact_last_bytes_freed;
+	uint64_t major_compact_last_cpu_time_us;
 };
 extern struct vm_compressor_swapper_stats vmcs_stats;
 
@@ -78,6 +78,33 @@ uint32_t        vm_phantom_cache_hash_size;
 uint32_t        vm_ghost_hash_mask;             /* Mask for hash function */
 uint32_t        vm_ghost_bucket_hash;           /* Basic bucket hash */
 
+uint32_t        vm_phantom_cache_refault_distance[VM_PHANTOM_REFAULT_BUCKETS];
+
+/*
+ * Workingset detection.
+ *
+ * The eviction clock ticks once per page added to the phantom cache, and
+ * each entry remembers its value at the time of the last eviction.  When
+ * a page comes back, the difference is the number of pages that were
+ * evicted in the meantime: had the inactive queue been that much larger,
+ * the page would still be resident.  If the active queue could have
+ * spared that many pages, the page is part of the working set and is
+ * activated right away, instead of going through the inactive queue
+ * again, and vm_page_balance_inactive() deactivates one more page from
+ * the active queue to make up for it.
+ *
+ * The clock is per entry, so the distance of the older pages of an entry
+ * is underestimated, erring on the side of keeping them.  Entries only
+ * have room for 16 bits of it, so they store it in units of
+ * 1 << vm_phantom_cache_clock_shift evictions, enough for 16 bits to span
+ * the pages the whole ring can hold before the entry is recycled.
+ */
+uint32_t        vm_phantom_cache_eviction_clock = 0;
+static uint32_t vm_phantom_cache_clock_shift = 0;
+#define VM_GHOST_EVICT_CLOCK() \
+	((uint16_t)(vm_phantom_cache_eviction_clock >> vm_phantom_cache_clock_shift))
+TUNABLE_WRITEABLE(int, vm_phantom_cache_workingset, "vm_phantom_cache_workingset", 1);
+
 
 int pg_masks[4] = {
 	0x1, 0x2, 0x4, 0x8
@@ -131,6 +158,11 @@ vm_phantom_cache_init(void)
 		vm_phantom_cache_num_entries = (1 << VM_GHOST_INDEX_BITS);
 	}
 
+	while (((uint64_t)UINT16_MAX << vm_phantom_cache_clock_shift) <
+	    (uint64_t)vm_phantom_cache_num_entries * VM_GHOST_PAGES_PER_ENTRY) {
+		vm_phantom_cache_clock_shift++;
+	}
+
 	vm_phantom_cache_size = sizeof(struct vm_ghost) * vm_phantom_cache_num_entries;
 	vm_phantom_cache_hash_size = sizeof(vm_phantom_hash_entry_t) * vm_phantom_cache_num_entries;
 
@@ -204,6 +236,8 @@ vm_phantom_cache_add_ghost(vm_page_t m)
 	} else {
 		if ((vpce = vm_phantom_cache_lookup_ghost(m, 0))) {
 			vpce->g_pages_held |= pg_mask;
+			vpce->g_evict_clock = VM_GHOST_EVICT_CLOCK();
+			vpce->g_evict_seq = vm_page_active_seq & VM_GHOST_SEQ_MASK;
 
 			phantom_cache_stats.pcs_added_page_to_entry++;
 			goto done;
@@ -258,12 +292,15 @@ vm_phantom_cache_add_ghost(vm_page_t m)
 	vpce->g_pages_held = pg_mask;
 	vpce->g_obj_offset = (m->vmp_offset >> (PAGE_SHIFT + VM_GHOST_PAGE_SHIFT)) & VM_GHOST_OFFSET_MASK;
 	vpce->g_obj_id = object->phantom_object_id;
+	vpce->g_evict_clock = VM_GHOST_EVICT_CLOCK();
+	vpce->g_evict_seq = vm_page_active_seq & VM_GHOST_SEQ_MASK;
 
 	ghost_hash_index = vm_phantom_hash(vpce->g_obj_id, vpce->g_obj_offset);
 	vpce->g_next_index = vm_phantom_cache_hash[ghost_hash_index];
 	vm_phantom_cache_hash[ghost_hash_index] = ghost_index;
 
 done:
+	vm_phantom_cache_eviction_clock++;
 	vm_pageout_vminfo.vm_phantom_cache_added_ghost++;
 
 	if (object->phantom_isssd) {
@@ -318,12 +355,18 @@ vm_phantom_cache_lookup_ghost(vm_page_t m, uint32_t pg_mask)
 
 
 
-void
+/*
+ * Called when "m" is paged back in: returns TRUE if it was evicted
+ * recently enough to be part of the working set, and should be
+ * activated.
+ */
+boolean_t
 vm_phantom_cache_update(vm_page_t m)
 {
 	int             pg_mask;
 	vm_ghost_t      vpce;
 	vm_object_t     object;
+	boolean_t       workingset = FALSE;
 
 	object = VM_PAGE_OBJECT(m);
 
@@ -331,14 +374,32 @@ vm_phantom_cache_update(vm_page_t m)
 	vm_object_lock_assert_exclusive(object);
 
 	if (vm_phantom_cache_num_entries == 0) {
-		return;
+		return FALSE;
 	}
 
 	pg_mask = pg_masks[(m->vmp_offset >> PAGE_SHIFT) & VM_GHOST_PAGE_MASK];
 
 	if ((vpce = vm_phantom_cache_lookup_ghost(m, pg_mask))) {
+		uint32_t refault_distance;
+		uint32_t distance;
+		int      bucket = 0;
+
+		refault_distance = (uint16_t)(VM_GHOST_EVICT_CLOCK() - vpce->g_evict_clock);
+		refault_distance <<= vm_phantom_cache_clock_shift;
+		distance = ((uint32_t)vm_page_active_seq - vpce->g_evict_seq) & VM_GHOST_SEQ_MASK;
+
 		vpce->g_pages_held &= ~pg_mask;
 
+		if (distance) {
+			bucket = MIN(fls(distance), VM_PHANTOM_REFAULT_BUCKETS - 1);
+		}
+		vm_phantom_cache_refault_distance[bucket]++;
+
+		if (vm_phantom_cache_workingset &&
+		    refault_distance <= vm_page_active_count) {
+			workingset = TRUE;
+		}
+
 		phantom_cache_stats.pcs_updated_phantom_state++;
 		vm_pageout_vminfo.vm_phantom_cache_found_ghost++;
 
@@ -348,6 +409,7 @@ vm_phantom_cache_update(vm_page_t m)
 			OSAddAtomic(1, &sample_period_ghost_found_count);
 		}
 	}
+	return workingset;
 }
 
 
@@ -28,26 +28,50 @@
 
 #include <vm/vm_page.h>
 
-#define         VM_GHOST_OFFSET_BITS    39
-#define         VM_GHOST_OFFSET_MASK    0x7FFFFFFFFF
+#define         VM_GHOST_OFFSET_BITS    31
+#define         VM_GHOST_OFFSET_MASK    0x7FFFFFFF
 #define         VM_GHOST_PAGES_PER_ENTRY 4
 #define         VM_GHOST_PAGE_MASK      0x3
 #define         VM_GHOST_PAGE_SHIFT     2
-#define         VM_GHOST_INDEX_BITS     (64 - VM_GHOST_OFFSET_BITS - VM_GHOST_PAGES_PER_ENTRY)
+#define         VM_GHOST_SEQ_BITS       8
+#define         VM_GHOST_SEQ_MASK       0xFF
+#define         VM_GHOST_INDEX_BITS     (64 - VM_GHOST_OFFSET_BITS - VM_GHOST_PAGES_PER_ENTRY - VM_GHOST_SEQ_BITS)
 
+/*
+ * Offsets are truncated to 31 bits of 4-page units, files larger than
+ * that (32TB with 4K pages) alias, which only costs spurious ghost hits.
+ */
 struct  vm_ghost {
 	uint64_t        g_next_index:VM_GHOST_INDEX_BITS,
 	    g_pages_held:VM_GHOST_PAGES_PER_ENTRY,
-	    g_obj_offset:VM_GHOST_OFFSET_BITS;
+	    g_obj_offset:VM_GHOST_OFFSET_BITS,
+	    g_evict_seq:VM_GHOST_SEQ_BITS;      /* vm_page_active_seq at the last eviction */
 	uint32_t        g_obj_id;
+	uint16_t        g_evict_clock;          /* scaled vm_phantom_cache_eviction_clock at the last eviction */
 } __attribute__((packed));
 
+static_assert(sizeof(struct vm_ghost) == 14, "vm_ghost is 14 bytes");
+
 typedef struct vm_ghost *vm_ghost_t;
 
+/*
+ * Refault distances, in passes over the active queue between a page's
+ * eviction and its refault: bucket 0 counts refaults within the same
+ * pass, bucket i > 0 those that took [2^(i-1), 2^i) passes, and the last
+ * bucket everything further.  Entries keep 8 bits of the pass count, so
+ * distances are modulo 256 passes.
+ */
+#define         VM_PHANTOM_REFAULT_BUCKETS      8
+
+extern uint32_t vm_phantom_cache_refault_distance[VM_PHANTOM_REFAULT_BUCKETS];
+
+extern uint32_t vm_phantom_cache_eviction_clock;
+extern int      vm_phantom_cache_workingset;
+
 
 extern  void            vm_phantom_cache_init(void);
 extern  void            vm_phantom_cache_add_ghost(vm_page_t);
 extern  vm_ghost_t      vm_phantom_cache_lookup_ghost(vm_page_t, uint32_t);
-extern  void            vm_phantom_cache_update(vm_page_t);
+extern  boolean_t       vm_phantom_cache_update(vm_page_t);
 extern  boolean_t       vm_phantom_cache_check_pressure(void);
 extern  void            vm_phantom_cache_restart_sample(void);
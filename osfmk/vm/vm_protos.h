@@ -337,6 +337,17 @@ extern kern_return_t vnode_pager_get_mtime(
 extern kern_return_t vnode_pager_get_cs_blobs(
 	struct vnode    *vp,
 	void            **blobs);
+extern uint32_t vnode_pager_get_vid(
+	struct vnode    *vp);
+extern kern_return_t vnode_pager_ref_vnode(
+	struct vnode    *vp);
+extern void vnode_pager_rele_vnode(
+	struct vnode    *vp);
+extern kern_return_t vnode_pager_prefetch(
+	struct vnode            *vp,
+	uint32_t                vid,
+	vm_object_offset_t      offset,
+	vm_object_size_t        size);
 
 #if CONFIG_IOSCHED
 void vnode_pager_issue_reprioritize_io(
@@ -660,6 +671,8 @@ extern int proc_get_memstat_priority(struct proc*, boolean_t);
 /* the object purger. purges the next eligible object from memory. */
 /* returns TRUE if an object was purged, otherwise FALSE. */
 boolean_t vm_purgeable_object_purge_one_unlocked(int force_purge_below_group);
+/* number of volatile objects owned by the task that the system purged */
+uint32_t vm_purgeable_purged_count(task_t task);
 void vm_purgeable_nonvolatile_owner_update(task_t       owner,
     int          delta);
 void vm_purgeable_volatile_owner_update(task_t          owner,
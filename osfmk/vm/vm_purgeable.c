@@ -24,6 +24,8 @@
 #include <kern/sched_prim.h>
 #include <kern/ledger.h>
 #include <kern/policy_internal.h>
+#include <kern/startup.h>
+#include <kern/thread_call.h>
 
 #include <libkern/OSDebug.h>
 
@@ -88,7 +90,20 @@ int purgeable_nonvolatile_count;
 
 decl_lck_mtx_data(, vm_purgeable_queue_lock);
 
+/*
+ * Bumped every time an object is made volatile, so that
+ * vo_purgeable_volatile_seq orders volatile objects by how long they
+ * have been unused.  Protected by vm_purgeable_queue_lock.
+ */
+static uint32_t vm_purgeable_volatile_seq = 0;
+
+#if CONFIG_MEMORYSTATUS
+extern void memorystatus_purged_notify(void);
+static thread_call_t vm_purgeable_purged_call;
+#endif /* CONFIG_MEMORYSTATUS */
+
 static token_idx_t vm_purgeable_token_remove_first(purgeable_q_t queue);
+static void vm_purgeable_object_purged(vm_object_t object);
 
 static void vm_purgeable_stats_helper(vm_purgeable_stat_t *stat, purgeable_q_t queue, int group, task_t target_task);
 
@@ -857,6 +872,7 @@ restart:
 				(void) vm_object_purge(object, 0);
 				assert(object->purgable == VM_PURGABLE_EMPTY);
 				/* no change in purgeable accounting */
+				vm_purgeable_object_purged(object);
 
 				vm_object_unlock(object);
 				purged_count++;
@@ -1011,6 +1027,7 @@ purge_now:
 	(void) vm_object_purge(object, flags);
 	assert(object->purgable == VM_PURGABLE_EMPTY);
 	/* no change in purgeable accounting */
+	vm_purgeable_object_purged(object);
 	vm_object_unlock(object);
 	vm_page_lock_queues();
 
@@ -1060,6 +1077,7 @@ vm_purgeable_object_add(vm_object_t object, purgeable_q_t queue, int group)
 
 	object->purgeable_queue_type = queue->type;
 	object->purgeable_queue_group = group;
+	object->vo_purgeable_volatile_seq = ++vm_purgeable_volatile_seq;
 
 #if DEBUG
 	assert(object->vo_purgeable_volatilizer == NULL);
@@ -1400,6 +1418,243 @@ vm_purgeable_purge_task_owned(
 	return num_pages_purged;
 }
 
+/*
+ * Account for the purge of a volatile object by the system, and let its
+ * owner know (EVFILT_MEMORYSTATUS, NOTE_MEMORYSTATUS_PURGED), so that it
+ * doesn't have to poll the state of its objects to find out.
+ * Called with the object locked.
+ */
+static void
+vm_purgeable_object_purged(vm_object_t object)
+{
+	task_t  owner;
+
+	vm_object_lock_assert_exclusive(object);
+
+	owner = VM_OBJECT_OWNER(object);
+	if (owner == TASK_NULL || owner == kernel_task) {
+		return;
+	}
+
+	os_atomic_inc(&owner->task_purged_objects, relaxed);
+#if CONFIG_MEMORYSTATUS
+	thread_call_enter(vm_purgeable_purged_call);
+#endif /* CONFIG_MEMORYSTATUS */
+}
+
+/* number of volatile objects owned by "task" the system purged so far */
+uint32_t
+vm_purgeable_purged_count(task_t task)
+{
+	return os_atomic_load(&task->task_purged_objects, relaxed);
+}
+
+#if CONFIG_MEMORYSTATUS
+static void
+vm_purgeable_purged_notify(
+	__unused thread_call_param_t    p0,
+	__unused thread_call_param_t    p1)
+{
+	memorystatus_purged_notify();
+}
+
+__startup_func
+static void
+vm_purgeable_purged_init(void)
+{
+	vm_purgeable_purged_call = thread_call_allocate_with_options(
+		vm_purgeable_purged_notify, NULL, THREAD_CALL_PRIORITY_USER,
+		THREAD_CALL_OPTIONS_ONCE);
+}
+STARTUP(THREAD_CALL, STARTUP_RANK_MIDDLE, vm_purgeable_purged_init);
+#endif /* CONFIG_MEMORYSTATUS */
+
+#define PURGEABLE_BATCH_MAX 16
+
+/*
+ * Order in which vm_purgeable_purge_bytes() purges an owner's volatile
+ * objects: obsolete objects first, then lower groups before higher
+ * groups, as for regular purging, and within a group, the objects made
+ * volatile the longest ago first.
+ */
+static boolean_t
+vm_purgeable_owned_before(vm_object_t a, vm_object_t b)
+{
+	int rank_a = (a->purgeable_queue_type == PURGEABLE_Q_TYPE_OBSOLETE) ?
+	    0 : 1 + a->purgeable_queue_group;
+	int rank_b = (b->purgeable_queue_type == PURGEABLE_Q_TYPE_OBSOLETE) ?
+	    0 : 1 + b->purgeable_queue_group;
+
+	if (rank_a != rank_b) {
+		return rank_a < rank_b;
+	}
+	return (int32_t)(a->vo_purgeable_volatile_seq -
+	       b->vo_purgeable_volatile_seq) < 0;
+}
+
+/*
+ * Pick the next objects vm_purgeable_purge_bytes() should purge, until
+ * they hold "target" bytes or there are "max" of them, lock them and take
+ * them off their purgeable queues.
+ *
+ * This walks the objects "owner" owns rather than the purgeable queues,
+ * which hold every volatile object in the system, once per batch.
+ *
+ * Sets "*busy" if an eligible object couldn't be locked.
+ * Call with purgeable queue locked.
+ */
+static unsigned int
+vm_purgeable_owned_find_lru_and_lock(
+	task_t          owner,
+	uint64_t        target,
+	vm_object_t     *objects,
+	purgeable_q_t   *queues,
+	unsigned int    max,
+	boolean_t       *busy)
+{
+	vm_object_t     picks[PURGEABLE_BATCH_MAX];
+	unsigned int    num_picks = 0, count = 0, i;
+	uint64_t        pending = 0;
+	purgeable_q_t   queue;
+	vm_object_t     object;
+
+	LCK_MTX_ASSERT(&vm_purgeable_queue_lock, LCK_MTX_ASSERT_OWNED);
+	assert(max <= PURGEABLE_BATCH_MAX);
+
+	/* vm_purgeable_queue_lock is taken before the task_objq_lock */
+	task_objq_lock(owner);
+	queue_iterate(&owner->task_objq, object, vm_object_t, task_objq) {
+		if (object->purgeable_queue_type == PURGEABLE_Q_TYPE_MAX) {
+			/* not volatile */
+			continue;
+		}
+		/* keep the picks sorted, first to purge first */
+		for (i = num_picks; i > 0 && vm_purgeable_owned_before(object, picks[i - 1]); i--) {
+			if (i < max) {
+				picks[i] = picks[i - 1];
+			}
+		}
+		if (i < max) {
+			picks[i] = object;
+			num_picks = MIN(num_picks + 1, max);
+		}
+	}
+
+	for (i = 0; i < num_picks && pending < target; i++) {
+		object = picks[i];
+		if (!vm_object_lock_try(object)) {
+			*busy = TRUE;
+			continue;
+		}
+
+		queue = &purgeable_queues[object->purgeable_queue_type];
+		queue_remove(&queue->objq[object->purgeable_queue_group], object,
+		    vm_object_t, objq);
+		object->objq.next = NULL;
+		object->objq.prev = NULL;
+		object->purgeable_queue_type = PURGEABLE_Q_TYPE_MAX;
+		object->purgeable_queue_group = 0;
+		/* one less volatile object for this object's owner */
+		assert(object->vo_owner == owner);
+		vm_purgeable_volatile_owner_update(owner, -1);
+
+#if DEBUG
+		object->vo_purgeable_volatilizer = NULL;
+#endif /* DEBUG */
+
+		/* keep queue of non-volatile objects */
+		queue_enter(&purgeable_nonvolatile_queue, object,
+		    vm_object_t, objq);
+		assert(purgeable_nonvolatile_count >= 0);
+		purgeable_nonvolatile_count++;
+		assert(purgeable_nonvolatile_count > 0);
+		/* one more nonvolatile object for this object's owner */
+		vm_purgeable_nonvolatile_owner_update(owner, +1);
+
+#if MACH_ASSERT
+		queue->debug_count_objects--;
+#endif
+		pending += ptoa_64(object->resident_page_count);
+		if (object->pager != NULL) {
+			pending += ptoa_64(vm_compressor_pager_get_count(object->pager));
+		}
+		objects[count] = object;
+		queues[count] = queue;
+		count++;
+	}
+	task_objq_unlock(owner);
+
+	return count;
+}
+
+/*
+ * Purge volatile objects, least recently made volatile first, until at
+ * least "target" bytes were freed or there is nothing left to purge.
+ *
+ * Rather than going back and forth between the owner's objects and
+ * the purgeable queues for each of them, up to PURGEABLE_BATCH_MAX objects
+ * are picked in one walk of the owner's objects, under one hold of the
+ * purgeable queue lock, their tokens are removed under one hold of the
+ * page queue lock, then they get purged.
+ *
+ * Can be called without holding locks.
+ */
+uint64_t
+vm_purgeable_purge_bytes(
+	task_t          owner,
+	uint64_t        target)
+{
+	vm_object_t     objects[PURGEABLE_BATCH_MAX];
+	purgeable_q_t   queues[PURGEABLE_BATCH_MAX];
+	uint64_t        purged = 0;
+	unsigned int    count, i;
+	uint32_t        collisions = 0;
+	boolean_t       busy;
+
+	KERNEL_DEBUG_CONSTANT((MACHDBG_CODE(DBG_MACH_VM, OBJECT_PURGE_BYTES)) | DBG_FUNC_START,
+	    VM_KERNEL_UNSLIDE_OR_PERM(owner), target, 0, 0, 0);
+
+	while (purged < target) {
+		busy = FALSE;
+
+		lck_mtx_lock(&vm_purgeable_queue_lock);
+		count = vm_purgeable_owned_find_lru_and_lock(owner, target - purged,
+		    objects, queues, PURGEABLE_BATCH_MAX, &busy);
+		lck_mtx_unlock(&vm_purgeable_queue_lock);
+
+		if (count == 0) {
+			if (!busy || collisions >= PURGEABLE_LOOP_MAX) {
+				/* nothing left to purge, or not for now */
+				break;
+			}
+			mutex_pause(collisions++);
+			continue;
+		}
+		collisions = 0;
+
+		vm_page_lock_queues();
+		for (i = 0; i < count; i++) {
+			if (objects[i]->purgeable_when_ripe) {
+				vm_purgeable_token_remove_first(queues[i]);
+			}
+		}
+		vm_page_unlock_queues();
+
+		for (i = 0; i < count; i++) {
+			purged += ptoa_64(vm_object_purge(objects[i], 0));
+			assert(objects[i]->purgable == VM_PURGABLE_EMPTY);
+			/* no change in purgeable accounting */
+			vm_purgeable_object_purged(objects[i]);
+			vm_object_unlock(objects[i]);
+		}
+	}
+
+	KERNEL_DEBUG_CONSTANT((MACHDBG_CODE(DBG_MACH_VM, OBJECT_PURGE_BYTES)) | DBG_FUNC_END,
+	    VM_KERNEL_UNSLIDE_OR_PERM(owner), purged, available_for_purge, 0, 0);
+
+	return purged;
+}
+
 void
 vm_purgeable_nonvolatile_enqueue(
 	vm_object_t     object,
@@ -120,6 +120,13 @@ kern_return_t vm_purgeable_account(task_t task, pvm_account_info_t acnt_info);
 #endif /* DEVELOPMENT || DEBUG */
 
 uint64_t vm_purgeable_purge_task_owned(task_t task);
+
+/*
+ * purge "owner"'s volatile objects, least recently made volatile first,
+ * until at least "target" bytes were freed.  Returns the number of bytes
+ * freed.
+ */
+uint64_t vm_purgeable_purge_bytes(task_t owner, uint64_t target);
 void vm_purgeable_nonvolatile_enqueue(vm_object_t object, task_t task);
 void vm_purgeable_nonvolatile_dequeue(vm_object_t object);
 void vm_purgeable_accounting(vm_object_t        object,
@@ -138,5 +145,6 @@ void vm_object_owner_compressed_update(vm_object_t      object,
 #define OBJECT_PURGE_ALL        0x4b    /* 0x12c */
 #define OBJECT_PURGE_ONE        0x4c    /* 0x12d */
 #define OBJECT_PURGE_LOOP       0x4e    /* 0x12e */
+#define OBJECT_PURGE_BYTES      0x4f    /* 0x13c */
 
 #endif /* __VM_PURGEABLE_INTERNAL__ */
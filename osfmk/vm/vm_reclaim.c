@@ -27,6 +27,7 @@
  */
 
 #include <kern/exc_guard.h>
+#include <kern/clock.h>
 #include <kern/locks.h>
 #include <kern/task.h>
 #include <kern/zalloc.h>
@@ -42,6 +43,7 @@
 #include <pexpert/pexpert.h>
 #include <vm/vm_map.h>
 #include <vm/vm_map_internal.h>
+#include <vm/vm_page.h>
 #include <vm/vm_reclaim_internal.h>
 #include <sys/kdebug.h>
 #include <sys/queue.h>
@@ -55,6 +57,14 @@ TUNABLE_DEV_WRITEABLE(uint64_t, vm_reclaim_trim_divisor, "vm_reclaim_trim_diviso
 TUNABLE_DT_DEV_WRITEABLE(uint64_t, vm_reclaim_max_threshold, "/defaults", "kern.vm_reclaim_max_threshold", "vm_reclaim_max_threshold", 0, TUNABLE_DT_NONE);
 // Used to debug vm_reclaim kills
 TUNABLE(bool, panic_on_kill, "vm_reclaim_panic_on_kill", false);
+// Entries the reclaim thread copies in at once when draining a buffer
+TUNABLE(uint32_t, kReclaimBatchSize, "vm_reclaim_batch_size", 256);
+// How often the reclaim thread looks for buffers to drain on its own (0 to only drain when asked to)
+TUNABLE_DEV_WRITEABLE(uint32_t, vm_reclaim_scan_interval_ms, "vm_reclaim_scan_interval_ms", 1000);
+// Buffers with fewer estimated reclaimable bytes are only drained proactively when memory is short
+TUNABLE_DEV_WRITEABLE(uint64_t, vm_reclaim_scan_min_bytes, "vm_reclaim_scan_min_bytes", 16ULL << 20);
+// Most buffers the reclaim thread picks to drain per scan
+TUNABLE_DEV_WRITEABLE(uint32_t, vm_reclaim_scan_max_buffers, "vm_reclaim_scan_max_buffers", 8);
 
 #pragma mark Declarations
 typedef struct proc *proc_t;
@@ -90,11 +100,26 @@ struct vm_deferred_reclamation_metadata_s {
 	 */
 	_Atomic size_t vdrm_num_bytes_put_in_buffer;
 	_Atomic size_t vdrm_num_bytes_reclaimed;
+	/* When the buffer went on the async list, protected by the async_reclamation_buffers_lock */
+	uint64_t vdrm_async_queued_at;
+	/*
+	 * Statistics reported by vm_deferred_reclamation_copy_stats(),
+	 * protected by the vdrm_lock. Times are in absolute time units.
+	 */
+	uint64_t vdrm_entries_reclaimed;
+	uint64_t vdrm_ranges_reclaimed; /* VM operations, after merging adjacent entries */
+	uint64_t vdrm_drains;
+	uint64_t vdrm_drain_time_total;
+	uint64_t vdrm_drain_time_max;
+	uint64_t vdrm_async_drains;
+	uint64_t vdrm_async_latency_total;
+	uint64_t vdrm_async_latency_max;
 };
-static void process_async_reclamation_list(void);
+static void process_async_reclamation_list(mach_vm_reclaim_entry_v1_t *reclaim_entries, size_t max_entries);
 
 extern void *proc_find(int pid);
 extern task_t proc_task(proc_t);
+extern void qsort(void *a, size_t n, size_t es, int (*cmp)(const void *, const void *));
 
 #pragma mark Globals
 static KALLOC_TYPE_DEFINE(vm_reclaim_metadata_zone, struct vm_deferred_reclamation_metadata_s, KT_DEFAULT);
@@ -128,6 +153,12 @@ static uint64_t reclamation_counter; // generation count for global reclaims
 
 static SECURITY_READ_ONLY_LATE(thread_t) vm_reclaim_thread;
 static void reclaim_thread(void *param __unused, wait_result_t wr __unused);
+static void reclaim_thread_wakeup_scan(void);
+/* Copy-in space for the reclaim thread, kReclaimBatchSize entries */
+static SECURITY_READ_ONLY_LATE(mach_vm_reclaim_entry_v1_t *) vm_reclaim_batch_entries;
+/* Upper bound on vm_reclaim_scan_max_buffers */
+#define RECLAIM_SCAN_MAX_BUFFERS 32
+static uint64_t vm_reclaim_last_scan; // mach_absolute_time of the reclaim thread's last scan
 
 #pragma mark Implementation
 
@@ -218,7 +249,7 @@ vm_deferred_reclamation_buffer_init_internal(
 {
 	kern_return_t kr = KERN_FAILURE, tmp_kr;
 	vm_deferred_reclamation_metadata_t metadata = NULL;
-	bool success;
+	bool success, first;
 	uint64_t head = 0, tail = 0, busy = 0;
 
 	if (address == 0 ||
@@ -311,13 +342,17 @@ vm_deferred_reclamation_buffer_init_internal(
 	}
 
 	TAILQ_INSERT_TAIL(&reclamation_buffers, metadata, vdrm_list);
-	reclamation_buffers_length++;
+	first = (reclamation_buffers_length++ == 0);
 
 	task->deferred_reclamation_metadata = metadata;
 
 	task_unlock(task);
 	lck_mtx_unlock(&reclamation_buffers_lock);
 
+	if (first) {
+		reclaim_thread_wakeup_scan();
+	}
+
 	KDBG(VM_RECLAIM_CODE(VM_RECLAIM_INIT) | DBG_FUNC_END,
 	    task_pid(task), KERN_SUCCESS);
 	return KERN_SUCCESS;
@@ -357,6 +392,7 @@ vm_deferred_reclamation_buffer_uninstall(vm_deferred_reclamation_metadata_t meta
 		TAILQ_REMOVE(&async_reclamation_buffers, metadata, vdrm_async_list);
 		metadata->vdrm_async_list.tqe_next = NULL;
 		metadata->vdrm_async_list.tqe_prev = NULL;
+		metadata->vdrm_async_queued_at = 0;
 	}
 	lck_mtx_unlock(&async_reclamation_buffers_lock);
 
@@ -589,11 +625,25 @@ reclaim_copyout_head(vm_deferred_reclamation_metadata_t metadata, uint64_t value
 	return true;
 }
 
+static int
+reclaim_entry_compare(const void *a, const void *b)
+{
+	const mach_vm_reclaim_entry_v1_t *entry_a = a, *entry_b = b;
+
+	if (entry_a->address < entry_b->address) {
+		return -1;
+	}
+	return entry_a->address > entry_b->address;
+}
+
 /*
- * Reclaim a chunk (kReclaimChunkSize entries) from the buffer.
+ * Reclaim a batch of up to `max_entries` entries from the buffer, using
+ * `reclaim_entries` to copy them in. Entries whose (page rounded) ranges
+ * are adjacent and that have the same behavior are reclaimed with a single
+ * VM operation.
  *
  * Writes the number of entries reclaimed to `num_reclaimed_out`. Note that
- * there may be zero reclaimable entries in the chunk (they have all been
+ * there may be zero reclaimable entries in the batch (they have all been
  * re-used by userspace).
  *
  * Returns:
@@ -602,7 +652,9 @@ reclaim_copyout_head(vm_deferred_reclamation_metadata_t metadata, uint64_t value
  *    before returning
  */
 static kern_return_t
-reclaim_chunk(vm_deferred_reclamation_metadata_t metadata, size_t *num_reclaimed_out)
+reclaim_batch(vm_deferred_reclamation_metadata_t metadata,
+    mach_vm_reclaim_entry_v1_t *reclaim_entries, size_t max_entries,
+    size_t *num_reclaimed_out)
 {
 	assert(metadata != NULL);
 	LCK_MTX_ASSERT(&metadata->vdrm_lock, LCK_MTX_ASSERT_OWNED);
@@ -611,15 +663,14 @@ reclaim_chunk(vm_deferred_reclamation_metadata_t metadata, size_t *num_reclaimed
 	uint64_t head = 0, tail = 0, busy = 0, num_to_reclaim = 0, new_tail = 0, num_copied = 0, buffer_len = 0;
 	user_addr_t indices;
 	vm_map_t map = metadata->vdrm_map, old_map;
-	mach_vm_reclaim_entry_v1_t reclaim_entries[kReclaimChunkSize];
 	bool success;
 
 	KDBG(VM_RECLAIM_CODE(VM_RECLAIM_CHUNK) | DBG_FUNC_START,
-	    task_pid(metadata->vdrm_task), kReclaimChunkSize);
+	    task_pid(metadata->vdrm_task), max_entries);
 
 	buffer_len = metadata->vdrm_buffer_size / sizeof(mach_vm_reclaim_entry_v1_t);
 
-	memset(reclaim_entries, 0, sizeof(reclaim_entries));
+	memset(reclaim_entries, 0, max_entries * sizeof(reclaim_entries[0]));
 
 	indices = (user_addr_t) metadata->vdrm_reclaim_indices;
 	old_map = vm_map_switch(map);
@@ -657,7 +708,7 @@ reclaim_chunk(vm_deferred_reclamation_metadata_t metadata, size_t *num_reclaimed
 
 	num_to_reclaim = tail - head;
 	while (true) {
-		num_to_reclaim = MIN(num_to_reclaim, kReclaimChunkSize);
+		num_to_reclaim = MIN(num_to_reclaim, max_entries);
 		if (num_to_reclaim == 0) {
 			break;
 		}
@@ -708,7 +759,7 @@ reclaim_chunk(vm_deferred_reclamation_metadata_t metadata, size_t *num_reclaimed
 		memcpy_end_idx = MIN(memcpy_end_idx, buffer_len);
 		uint64_t num_to_copy = memcpy_end_idx - memcpy_start_idx;
 
-		assert(num_to_copy + num_copied <= kReclaimChunkSize);
+		assert(num_to_copy + num_copied <= max_entries);
 		user_addr_t src_ptr = metadata->vdrm_reclaim_buffer + memcpy_start_idx * sizeof(mach_vm_reclaim_entry_v1_t);
 		mach_vm_reclaim_entry_v1_t *dst_ptr = reclaim_entries + num_copied;
 
@@ -728,59 +779,81 @@ reclaim_chunk(vm_deferred_reclamation_metadata_t metadata, size_t *num_reclaimed
 
 	for (size_t i = 0; i < num_to_reclaim; i++) {
 		mach_vm_reclaim_entry_v1_t *entry = &reclaim_entries[i];
-		KDBG_FILTERED(VM_RECLAIM_CODE(VM_RECLAIM_ENTRY) | DBG_FUNC_START,
-		    task_pid(metadata->vdrm_task), entry->address, entry->size,
-		    entry->behavior);
 		DTRACE_VM4(vm_reclaim_chunk,
 		    int, task_pid(metadata->vdrm_task),
 		    mach_vm_address_t, entry->address,
 		    size_t, entry->size,
 		    mach_vm_reclaim_behavior_v1_t, entry->behavior);
-		if (entry->address != 0 && entry->size != 0) {
-			kern_return_t kr;
-			switch (entry->behavior) {
-			case MACH_VM_RECLAIM_DEALLOCATE:
-				kr = vm_map_remove_guard(map,
-				    vm_map_trunc_page(entry->address,
-				    VM_MAP_PAGE_MASK(map)),
-				    vm_map_round_page(entry->address + entry->size,
-				    VM_MAP_PAGE_MASK(map)),
-				    VM_MAP_REMOVE_GAPS_FAIL,
-				    KMEM_GUARD_NONE).kmr_return;
-				if (kr == KERN_INVALID_VALUE) {
-					reclaim_kill_with_reason(metadata, kGUARD_EXC_DEALLOC_GAP, entry->address);
-					goto fail;
-				} else if (kr != KERN_SUCCESS) {
-					os_log_error(vm_reclaim_log_handle,
-					    "vm_reclaim: Unable to deallocate 0x%llx (%u) from 0x%llx err=%d\n",
-					    entry->address, entry->size, (uint64_t) map, kr);
-					reclaim_kill_with_reason(metadata, kGUARD_EXC_RECLAIM_DEALLOCATE_FAILURE, kr);
-					goto fail;
-				}
-				break;
-			case MACH_VM_RECLAIM_REUSABLE:
-				kr = vm_map_behavior_set(map,
-				    vm_map_trunc_page(entry->address, VM_MAP_PAGE_MASK(map)),
-				    vm_map_round_page(entry->address + entry->size, VM_MAP_PAGE_MASK(map)),
-				    VM_BEHAVIOR_REUSABLE);
-				if (kr != KERN_SUCCESS) {
-					os_log_error(vm_reclaim_log_handle,
-					    "vm_reclaim: unable to free(reusable) 0x%llx (%u) for pid %d err=%d\n",
-					    entry->address, entry->size, task_pid(metadata->vdrm_task), kr);
-				}
+	}
+
+	/* Entries re-used by userspace have a 0 address and sort first */
+	qsort(reclaim_entries, num_to_reclaim, sizeof(reclaim_entries[0]),
+	    reclaim_entry_compare);
+
+	for (size_t i = 0, j; i < num_to_reclaim; i = j) {
+		mach_vm_reclaim_entry_v1_t *entry = &reclaim_entries[i];
+		vm_map_offset_t start, end;
+		size_t size;
+		kern_return_t kr;
+
+		j = i + 1;
+		if (entry->address == 0 || entry->size == 0) {
+			continue;
+		}
+		start = vm_map_trunc_page(entry->address, VM_MAP_PAGE_MASK(map));
+		end = vm_map_round_page(entry->address + entry->size, VM_MAP_PAGE_MASK(map));
+		size = entry->size;
+		for (; j < num_to_reclaim; j++) {
+			mach_vm_reclaim_entry_v1_t *next = &reclaim_entries[j];
+
+			if (next->behavior != entry->behavior || next->size == 0 ||
+			    vm_map_trunc_page(next->address, VM_MAP_PAGE_MASK(map)) != end) {
 				break;
-			default:
+			}
+			end = vm_map_round_page(next->address + next->size, VM_MAP_PAGE_MASK(map));
+			size += next->size;
+		}
+
+		KDBG_FILTERED(VM_RECLAIM_CODE(VM_RECLAIM_ENTRY) | DBG_FUNC_START,
+		    task_pid(metadata->vdrm_task), start, end - start,
+		    entry->behavior);
+		switch (entry->behavior) {
+		case MACH_VM_RECLAIM_DEALLOCATE:
+			kr = vm_map_remove_guard(map, start, end,
+			    VM_MAP_REMOVE_GAPS_FAIL,
+			    KMEM_GUARD_NONE).kmr_return;
+			if (kr == KERN_INVALID_VALUE) {
+				reclaim_kill_with_reason(metadata, kGUARD_EXC_DEALLOC_GAP, entry->address);
+				goto fail;
+			} else if (kr != KERN_SUCCESS) {
 				os_log_error(vm_reclaim_log_handle,
-				    "vm_reclaim: attempted to reclaim entry with unsupported behavior %uh",
-				    entry->behavior);
+				    "vm_reclaim: Unable to deallocate 0x%llx (%llu) from 0x%llx err=%d\n",
+				    start, end - start, (uint64_t) map, kr);
 				reclaim_kill_with_reason(metadata, kGUARD_EXC_RECLAIM_DEALLOCATE_FAILURE, kr);
 				goto fail;
 			}
-			num_reclaimed++;
-			os_atomic_add(&metadata->vdrm_num_bytes_reclaimed, entry->size, relaxed);
-			KDBG_FILTERED(VM_RECLAIM_CODE(VM_RECLAIM_ENTRY) | DBG_FUNC_END,
-			    task_pid(metadata->vdrm_task), entry->address);
+			break;
+		case MACH_VM_RECLAIM_REUSABLE:
+			kr = vm_map_behavior_set(map, start, end, VM_BEHAVIOR_REUSABLE);
+			if (kr != KERN_SUCCESS) {
+				os_log_error(vm_reclaim_log_handle,
+				    "vm_reclaim: unable to free(reusable) 0x%llx (%llu) for pid %d err=%d\n",
+				    start, end - start, task_pid(metadata->vdrm_task), kr);
+			}
+			break;
+		default:
+			os_log_error(vm_reclaim_log_handle,
+			    "vm_reclaim: attempted to reclaim entry with unsupported behavior %uh",
+			    entry->behavior);
+			reclaim_kill_with_reason(metadata, kGUARD_EXC_RECLAIM_DEALLOCATE_FAILURE, KERN_INVALID_ARGUMENT);
+			goto fail;
 		}
+		num_reclaimed += j - i;
+		metadata->vdrm_entries_reclaimed += j - i;
+		metadata->vdrm_ranges_reclaimed++;
+		os_atomic_add(&metadata->vdrm_num_bytes_reclaimed, size, relaxed);
+		KDBG_FILTERED(VM_RECLAIM_CODE(VM_RECLAIM_ENTRY) | DBG_FUNC_END,
+		    task_pid(metadata->vdrm_task), start);
 	}
 
 	success = reclaim_copyout_head(metadata, head);
@@ -805,16 +878,44 @@ fail:
 	return KERN_FAILURE;
 }
 
+static kern_return_t
+reclaim_chunk(vm_deferred_reclamation_metadata_t metadata, size_t *num_reclaimed_out)
+{
+	mach_vm_reclaim_entry_v1_t reclaim_entries[kReclaimChunkSize];
+
+	return reclaim_batch(metadata, reclaim_entries, kReclaimChunkSize, num_reclaimed_out);
+}
+
+/*
+ * Estimate of the number of bytes sitting in the buffer. Racy, as
+ * neither counter is protected by the vdrm_lock.
+ */
+static size_t
+reclaim_estimated_bytes(vm_deferred_reclamation_metadata_t metadata)
+{
+	size_t num_bytes_reclaimed, reclaimable_bytes;
+
+	num_bytes_reclaimed = os_atomic_load(&metadata->vdrm_num_bytes_reclaimed, relaxed);
+	reclaimable_bytes = os_atomic_load(&metadata->vdrm_num_bytes_put_in_buffer, relaxed);
+	if (num_bytes_reclaimed > reclaimable_bytes) {
+		return 0;
+	}
+	return reclaimable_bytes - num_bytes_reclaimed;
+}
+
 /*
  * Attempts to reclaim until the buffer's estimated number of available bytes
- * is <= num_bytes_reclaimable_threshold. The metadata buffer lock should be
+ * is <= num_bytes_reclaimable_threshold, `max_entries` at a time using
+ * `reclaim_entries` to copy them in. The metadata buffer lock should be
  * held by the caller.
  *
  * Writes the number of entries reclaimed to `num_reclaimed_out`.
  */
 static kern_return_t
 reclaim_entries_from_buffer(vm_deferred_reclamation_metadata_t metadata,
-    size_t num_bytes_reclaimable_threshold, size_t *num_reclaimed_out)
+    size_t num_bytes_reclaimable_threshold,
+    mach_vm_reclaim_entry_v1_t *reclaim_entries, size_t max_entries,
+    size_t *num_reclaimed_out)
 {
 	assert(metadata != NULL);
 	assert(num_reclaimed_out != NULL);
@@ -830,21 +931,17 @@ reclaim_entries_from_buffer(vm_deferred_reclamation_metadata_t metadata,
 
 	KDBG(VM_RECLAIM_CODE(VM_RECLAIM_ENTRIES) | DBG_FUNC_START, task_pid(metadata->vdrm_task));
 
-	size_t num_entries_reclaimed = 0, num_bytes_reclaimed, estimated_reclaimable_bytes, reclaimable_bytes;
+	size_t num_entries_reclaimed = 0, estimated_reclaimable_bytes;
+	uint64_t start_time = mach_absolute_time(), elapsed;
 	while (true) {
 		kern_return_t kr;
 		size_t curr_entries_reclaimed = 0;
-		num_bytes_reclaimed = os_atomic_load(&metadata->vdrm_num_bytes_reclaimed, relaxed);
-		reclaimable_bytes = os_atomic_load(&metadata->vdrm_num_bytes_put_in_buffer, relaxed);
-		if (num_bytes_reclaimed > reclaimable_bytes) {
-			estimated_reclaimable_bytes = 0;
-		} else {
-			estimated_reclaimable_bytes = reclaimable_bytes - num_bytes_reclaimed;
-		}
-		if (reclaimable_bytes <= num_bytes_reclaimable_threshold) {
+		estimated_reclaimable_bytes = reclaim_estimated_bytes(metadata);
+		if (estimated_reclaimable_bytes <= num_bytes_reclaimable_threshold) {
 			break;
 		}
-		kr = reclaim_chunk(metadata, &curr_entries_reclaimed);
+		kr = reclaim_batch(metadata, reclaim_entries, max_entries,
+		    &curr_entries_reclaimed);
 		if (kr == KERN_NOT_FOUND) {
 			break;
 		} else if (kr != KERN_SUCCESS) {
@@ -857,6 +954,11 @@ reclaim_entries_from_buffer(vm_deferred_reclamation_metadata_t metadata,
 		num_entries_reclaimed += curr_entries_reclaimed;
 	}
 
+	elapsed = mach_absolute_time() - start_time;
+	metadata->vdrm_drains++;
+	metadata->vdrm_drain_time_total += elapsed;
+	metadata->vdrm_drain_time_max = MAX(metadata->vdrm_drain_time_max, elapsed);
+
 	KDBG(VM_RECLAIM_CODE(VM_RECLAIM_ENTRIES) | DBG_FUNC_END,
 	    task_pid(metadata->vdrm_task), num_entries_reclaimed,
 	    estimated_reclaimable_bytes, KERN_SUCCESS);
@@ -953,9 +1055,12 @@ vm_deferred_reclamation_buffer_update_reclaimable_bytes_internal(task_t task, si
 	if (reclaimable_bytes > num_bytes_reclaimed) {
 		estimated_reclaimable_bytes = reclaimable_bytes - num_bytes_reclaimed;
 		if (estimated_reclaimable_bytes > vm_reclaim_max_threshold) {
+			mach_vm_reclaim_entry_v1_t reclaim_entries[kReclaimChunkSize];
+
 			lck_mtx_lock(&metadata->vdrm_lock);
 			kr = reclaim_entries_from_buffer(metadata,
-			    vm_reclaim_max_threshold, &num_reclaimed);
+			    vm_reclaim_max_threshold, reclaim_entries, kReclaimChunkSize,
+			    &num_reclaimed);
 			if (kr != KERN_SUCCESS) {
 				/* Lock has already been released & task is in the process of getting killed. */
 				goto done;
@@ -989,11 +1094,12 @@ vm_deferred_reclamation_reclaim_memory(vm_deferred_reclamation_action_t action)
 {
 	kern_return_t kr;
 	size_t num_reclaimed;
+	mach_vm_reclaim_entry_v1_t reclaim_entries[kReclaimChunkSize];
 
 	if (action == RECLAIM_ASYNC) {
 		lck_mtx_lock(&async_reclamation_buffers_lock);
 
-		process_async_reclamation_list();
+		process_async_reclamation_list(reclaim_entries, kReclaimChunkSize);
 		lck_mtx_unlock(&async_reclamation_buffers_lock);
 	} else {
 		size_t reclaim_threshold = pick_reclaim_threshold(action);
@@ -1019,7 +1125,8 @@ vm_deferred_reclamation_reclaim_memory(vm_deferred_reclamation_action_t action)
 			lck_mtx_unlock(&reclamation_buffers_lock);
 
 			kr = reclaim_entries_from_buffer(metadata,
-			    reclaim_threshold, &num_reclaimed);
+			    reclaim_threshold, reclaim_entries, kReclaimChunkSize,
+			    &num_reclaimed);
 			if (kr == KERN_SUCCESS) {
 				lck_mtx_unlock(&metadata->vdrm_lock);
 			}
@@ -1050,6 +1157,8 @@ vm_deferred_reclamation_reclaim_from_task_async(task_t task)
 		    metadata->vdrm_async_list.tqe_prev != NULL) {
 			// move this buffer to the tail if still on the async list
 			TAILQ_REMOVE(&async_reclamation_buffers, metadata, vdrm_async_list);
+		} else {
+			metadata->vdrm_async_queued_at = mach_absolute_time();
 		}
 		TAILQ_INSERT_TAIL(&async_reclamation_buffers, metadata, vdrm_async_list);
 		lck_mtx_unlock(&async_reclamation_buffers_lock);
@@ -1096,6 +1205,7 @@ vm_deferred_reclamation_buffer_fork(task_t task, vm_deferred_reclamation_metadat
 {
 	kern_return_t kr;
 	vm_deferred_reclamation_metadata_t metadata = NULL;
+	bool first;
 
 	LCK_MTX_ASSERT(&parent->vdrm_lock, LCK_MTX_ASSERT_OWNED);
 
@@ -1112,9 +1222,13 @@ vm_deferred_reclamation_buffer_fork(task_t task, vm_deferred_reclamation_metadat
 
 	lck_mtx_lock(&reclamation_buffers_lock);
 	TAILQ_INSERT_TAIL(&reclamation_buffers, metadata, vdrm_list);
-	reclamation_buffers_length++;
+	first = (reclamation_buffers_length++ == 0);
 	lck_mtx_unlock(&reclamation_buffers_lock);
 
+	if (first) {
+		reclaim_thread_wakeup_scan();
+	}
+
 	return metadata;
 }
 
@@ -1130,6 +1244,41 @@ vm_deferred_reclamation_buffer_unlock(vm_deferred_reclamation_metadata_t metadat
 	lck_mtx_unlock(&metadata->vdrm_lock);
 }
 
+size_t
+vm_deferred_reclamation_copy_stats(mach_vm_reclaim_stats_v1_t *stats, size_t max_stats)
+{
+	vm_deferred_reclamation_metadata_t metadata;
+	size_t i = 0;
+
+	lck_mtx_lock(&reclamation_buffers_lock);
+	TAILQ_FOREACH(metadata, &reclamation_buffers, vdrm_list) {
+		mach_vm_reclaim_stats_v1_t *st;
+
+		if (i >= max_stats) {
+			break;
+		}
+		st = &stats[i++];
+		bzero(st, sizeof(*st));
+		lck_mtx_lock(&metadata->vdrm_lock);
+		st->pid = task_pid(metadata->vdrm_task);
+		st->bytes_reclaimed = os_atomic_load(&metadata->vdrm_num_bytes_reclaimed, relaxed);
+		st->entries_reclaimed = metadata->vdrm_entries_reclaimed;
+		st->ranges_reclaimed = metadata->vdrm_ranges_reclaimed;
+		st->reclaimable_bytes = reclaim_estimated_bytes(metadata);
+		st->drains = metadata->vdrm_drains;
+		absolutetime_to_nanoseconds(metadata->vdrm_drain_time_total, &st->drain_time_total_ns);
+		absolutetime_to_nanoseconds(metadata->vdrm_drain_time_max, &st->drain_time_max_ns);
+		st->async_drains = metadata->vdrm_async_drains;
+		absolutetime_to_nanoseconds(metadata->vdrm_async_latency_total, &st->async_latency_total_ns);
+		absolutetime_to_nanoseconds(metadata->vdrm_async_latency_max, &st->async_latency_max_ns);
+		lck_mtx_unlock(&metadata->vdrm_lock);
+	}
+	i = reclamation_buffers_length;
+	lck_mtx_unlock(&reclamation_buffers_lock);
+
+	return i;
+}
+
 
 static void
 reclaim_thread_init(void)
@@ -1141,8 +1290,12 @@ reclaim_thread_init(void)
 }
 
 
+/*
+ * Drain every buffer on the async list, `max_entries` at a time using
+ * `reclaim_entries` to copy them in.
+ */
 static void
-process_async_reclamation_list(void)
+process_async_reclamation_list(mach_vm_reclaim_entry_v1_t *reclaim_entries, size_t max_entries)
 {
 	kern_return_t kr;
 	size_t total_entries_reclaimed = 0;
@@ -1153,14 +1306,22 @@ process_async_reclamation_list(void)
 	vm_deferred_reclamation_metadata_t metadata = TAILQ_FIRST(&async_reclamation_buffers);
 	while (metadata != NULL) {
 		size_t num_reclaimed;
+		uint64_t latency;
 		TAILQ_REMOVE(&async_reclamation_buffers, metadata, vdrm_async_list);
 		metadata->vdrm_async_list.tqe_next = NULL;
 		metadata->vdrm_async_list.tqe_prev = NULL;
+		latency = mach_absolute_time() - metadata->vdrm_async_queued_at;
+		metadata->vdrm_async_queued_at = 0;
 		lck_mtx_lock(&metadata->vdrm_lock);
 		lck_mtx_unlock(&async_reclamation_buffers_lock);
 
+		metadata->vdrm_async_drains++;
+		metadata->vdrm_async_latency_total += latency;
+		metadata->vdrm_async_latency_max = MAX(metadata->vdrm_async_latency_max, latency);
+
 		// NB: Currently the async reclaim thread fully reclaims the buffer.
-		kr = reclaim_entries_from_buffer(metadata, 0, &num_reclaimed);
+		kr = reclaim_entries_from_buffer(metadata, 0, reclaim_entries,
+		    max_entries, &num_reclaimed);
 		total_entries_reclaimed += num_reclaimed;
 		if (kr != KERN_SUCCESS) {
 			/* Lock has already been released & task is in the process of getting killed. */
@@ -1185,13 +1346,123 @@ __enum_decl(reclaim_thread_state, uint32_t, {
 	RECLAIM_THREAD_CONT = 1,
 });
 
+/*
+ * Queue the buffers holding the most reclaimable bytes on the async list,
+ * so that the reclaim thread drains them before their owners (or the
+ * memorystatus thread) have to. Buffers under vm_reclaim_scan_min_bytes
+ * are only picked while the free page count is below target.
+ *
+ * Called with the async_reclamation_buffers_lock held, which is dropped
+ * and retaken.
+ */
+static void
+reclaim_schedule_buffers(void)
+{
+	vm_deferred_reclamation_metadata_t picks[RECLAIM_SCAN_MAX_BUFFERS];
+	size_t sizes[RECLAIM_SCAN_MAX_BUFFERS];
+	uint32_t max_picks = MIN(vm_reclaim_scan_max_buffers, RECLAIM_SCAN_MAX_BUFFERS);
+	uint32_t num_picks = 0, num_queued = 0;
+	size_t min_bytes = vm_reclaim_scan_min_bytes;
+	vm_deferred_reclamation_metadata_t metadata;
+
+	LCK_MTX_ASSERT(&async_reclamation_buffers_lock, LCK_MTX_ASSERT_OWNED);
+
+	if (vm_page_free_count < vm_page_free_target) {
+		min_bytes = 1;
+	}
+
+	/* reclamation_buffers_lock is taken before async_reclamation_buffers_lock */
+	lck_mtx_unlock(&async_reclamation_buffers_lock);
+	lck_mtx_lock(&reclamation_buffers_lock);
+	TAILQ_FOREACH(metadata, &reclamation_buffers, vdrm_list) {
+		size_t bytes = reclaim_estimated_bytes(metadata);
+		uint32_t i;
+
+		if (bytes < min_bytes) {
+			continue;
+		}
+		/* keep picks sorted by size, largest first */
+		for (i = num_picks; i > 0 && sizes[i - 1] < bytes; i--) {
+			if (i < max_picks) {
+				picks[i] = picks[i - 1];
+				sizes[i] = sizes[i - 1];
+			}
+		}
+		if (i < max_picks) {
+			picks[i] = metadata;
+			sizes[i] = bytes;
+			num_picks = MIN(num_picks + 1, max_picks);
+		}
+	}
+
+	/*
+	 * Buffers stay on reclamation_buffers until they are uninstalled,
+	 * which takes them off the async list after the global one: queueing
+	 * them with reclamation_buffers_lock held is safe.
+	 */
+	lck_mtx_lock(&async_reclamation_buffers_lock);
+	for (uint32_t i = 0; i < num_picks; i++) {
+		metadata = picks[i];
+		if (metadata->vdrm_async_list.tqe_next != NULL ||
+		    metadata->vdrm_async_list.tqe_prev != NULL) {
+			continue;
+		}
+		metadata->vdrm_async_queued_at = mach_absolute_time();
+		TAILQ_INSERT_TAIL(&async_reclamation_buffers, metadata, vdrm_async_list);
+		num_queued++;
+	}
+	lck_mtx_unlock(&reclamation_buffers_lock);
+
+	KDBG(VM_RECLAIM_CODE(VM_RECLAIM_SCHEDULE), num_picks, num_queued,
+	    min_bytes, vm_page_free_count);
+}
+
+/*
+ * The reclaim thread only arms its scan timer while there are buffers to
+ * scan: wake it up when the first one is registered, so that it does.
+ *
+ * reclaim_thread_continue() checks for buffers and waits with the
+ * async_reclamation_buffers_lock held, so taking it here is enough not to
+ * lose the wakeup.
+ */
+static void
+reclaim_thread_wakeup_scan(void)
+{
+	if (vm_reclaim_scan_interval_ms == 0) {
+		return;
+	}
+	lck_mtx_lock(&async_reclamation_buffers_lock);
+	thread_wakeup(&vm_reclaim_thread);
+	lck_mtx_unlock(&async_reclamation_buffers_lock);
+}
+
 static void
 reclaim_thread_continue(void)
 {
+	uint64_t interval_ms = vm_reclaim_scan_interval_ms, now, interval;
+
 	lck_mtx_lock(&async_reclamation_buffers_lock);
 
-	process_async_reclamation_list();
-	assert_wait(&vm_reclaim_thread, THREAD_UNINT);
+	if (os_atomic_load(&reclamation_buffers_length, relaxed) == 0) {
+		interval_ms = 0;
+	}
+	if (interval_ms != 0) {
+		now = mach_absolute_time();
+		nanoseconds_to_absolutetime(interval_ms * NSEC_PER_MSEC, &interval);
+		if (now - vm_reclaim_last_scan >= interval) {
+			vm_reclaim_last_scan = now;
+			reclaim_schedule_buffers();
+		}
+	}
+	process_async_reclamation_list(vm_reclaim_batch_entries, kReclaimBatchSize);
+	if (interval_ms != 0) {
+		/* the scan is opportunistic, let it coalesce with other timers */
+		assert_wait_timeout_with_leeway(&vm_reclaim_thread, THREAD_UNINT,
+		    TIMEOUT_URGENCY_SYS_BACKGROUND, (uint32_t)interval_ms,
+		    (uint32_t)interval_ms / 2, NSEC_PER_MSEC);
+	} else {
+		assert_wait(&vm_reclaim_thread, THREAD_UNINT);
+	}
 
 	lck_mtx_unlock(&async_reclamation_buffers_lock);
 }
@@ -1217,6 +1488,9 @@ vm_deferred_reclamation_init(void)
 	// Note: no-op pending rdar://27006343 (Custom kernel log handles)
 	vm_reclaim_log_handle = os_log_create("com.apple.mach.vm", "reclaim");
 
+	vm_reclaim_batch_entries = kalloc_data(kReclaimBatchSize * sizeof(mach_vm_reclaim_entry_v1_t),
+	    Z_WAITOK | Z_ZERO | Z_NOFAIL);
+
 	(void)kernel_thread_start_priority(reclaim_thread,
 	    (void *)RECLAIM_THREAD_INIT, kReclaimThreadPriority,
 	    &vm_reclaim_thread);
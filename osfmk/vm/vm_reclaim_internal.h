@@ -35,6 +35,7 @@
 
 #include <mach/mach_types.h>
 #include <mach/mach_vm.h>
+#include <mach/vm_reclaim.h>
 
 extern uint64_t vm_reclaim_max_threshold;
 
@@ -99,6 +100,12 @@ vm_deferred_reclamation_metadata_t vm_deferred_reclamation_buffer_fork(
 void vm_deferred_reclamation_buffer_lock(vm_deferred_reclamation_metadata_t metadata);
 void vm_deferred_reclamation_buffer_unlock(vm_deferred_reclamation_metadata_t metadata);
 
+/*
+ * Copy the statistics of up to max_stats reclamation buffers into stats.
+ * Returns the number of buffers in the system (which may exceed max_stats).
+ */
+size_t vm_deferred_reclamation_copy_stats(mach_vm_reclaim_stats_v1_t *stats, size_t max_stats);
+
 #if DEVELOPMENT || DEBUG
 /*
  * Testing helpers
@@ -154,6 +154,7 @@ unsigned int shared_region_pagers_resident_peak = 0;
 
 int             PERCPU_DATA(start_color);
 vm_page_t       PERCPU_DATA(free_pages);
+unsigned int    PERCPU_DATA(free_pages_count);
 boolean_t       hibernate_cleaning_in_progress = FALSE;
 
 uint32_t        vm_lopage_free_count = 0;
@@ -321,6 +322,34 @@ unsigned int    vm_color_mask;                  /* mask is == (vm_colors-1) */
 unsigned int    vm_cache_geometry_colors = 0;   /* set by hw dependent code during startup */
 unsigned int    vm_free_magazine_refill_limit = 0;
 
+/*
+ * Per-CPU free page caches.
+ *
+ * vm_page_grab() takes pages from the current CPU's free_pages list
+ * without the free page queue lock, and refills it from the global free
+ * queues vm_free_magazine_refill_limit pages at a time.  While memory is
+ * plentiful, pages being freed go back to the cache of the CPU freeing
+ * them, up to vm_free_magazine_limit pages; past that, half of the cache
+ * is drained back to the global free queues in one batch.
+ *
+ * Pages in these caches aren't counted in vm_page_free_count, which is
+ * why frees are only cached above vm_page_free_target and when nobody
+ * is waiting for memory, and why vm_page_wait() and vm_pageout_scan()
+ * give every CPU's cache back to the global free queues with
+ * vm_page_free_cache_flush() before concluding that memory is short.
+ *
+ * Only the owning CPU pushes pages on its list or pops them off, with
+ * preemption disabled.  A flush takes whole lists from other CPUs with
+ * an atomic exchange, so the owner pops and pushes with compare and swap,
+ * and detaches its whole list before cutting it in two.  The per-CPU
+ * count is only a hint, which a flush resets.
+ */
+unsigned int    vm_free_magazine_limit = 0;
+SCALABLE_COUNTER_DEFINE(vm_page_free_cache_hits);       /* grabs served without the free page lock */
+SCALABLE_COUNTER_DEFINE(vm_page_free_cache_refills);    /* refills from the global free queues */
+SCALABLE_COUNTER_DEFINE(vm_page_free_cache_releases);   /* frees kept in a per-CPU cache */
+SCALABLE_COUNTER_DEFINE(vm_page_free_cache_drains);     /* batches drained to the global free queues */
+
 
 struct vm_page_queue_free_head {
 	vm_page_queue_head_t    qhead;
@@ -589,6 +618,8 @@ vm_page_setup_clump( void )
 #endif  /* #if defined (__x86_64__) */
 
 #define COLOR_GROUPS_TO_STEAL   4
+#define FREE_MAGAZINE_REFILL_MIN 16
+#define FREE_MAGAZINE_LIMIT_MAX 256
 
 /* Called once during statup, once the cache geometry is known.
  */
@@ -630,6 +661,27 @@ vm_page_set_colors( void )
 		vm_free_magazine_refill_limit *= (vm_clump_size * real_ncpus);
 	}
 #endif
+	if (vm_free_magazine_refill_limit < FREE_MAGAZINE_REFILL_MIN) {
+		vm_free_magazine_refill_limit = FREE_MAGAZINE_REFILL_MIN;
+	}
+
+	/* 0 keeps freed pages out of the per-CPU caches */
+	if (!PE_parse_boot_argn("vm_free_magazine_limit", &vm_free_magazine_limit,
+	    sizeof(vm_free_magazine_limit))) {
+		vm_free_magazine_limit = MIN(2 * vm_free_magazine_refill_limit,
+		    FREE_MAGAZINE_LIMIT_MAX);
+	}
+
+	/*
+	 * A refill must leave room for frees in the cache, or the next
+	 * free would drain half of what was just refilled: the refill
+	 * limit scales with the number of CPUs on x86, and can be well
+	 * past the cap.
+	 */
+	if (vm_free_magazine_limit) {
+		vm_free_magazine_refill_limit = MIN(vm_free_magazine_refill_limit,
+		    MAX(vm_free_magazine_limit / 2, 1));
+	}
 }
 
 /*
@@ -3192,11 +3244,24 @@ vm_page_grab_options(
 	int grab_options)
 {
 	vm_page_t       mem;
+	bool            refilled = false;
 
 restart:
 	disable_preemption();
 
-	if ((mem = *PERCPU_GET(free_pages))) {
+	if ((mem = os_atomic_load(PERCPU_GET(free_pages), relaxed))) {
+		vm_offset_t pcpu_base = current_percpu_base();
+		unsigned int *countp;
+
+		/*
+		 * vm_page_free_cache_flush() might have taken the list:
+		 * only pop the page if it is still the head.
+		 */
+		if (!os_atomic_cmpxchg(PERCPU_GET_WITH_BASE(pcpu_base, free_pages),
+		    mem, mem->vmp_snext, relaxed)) {
+			enable_preemption();
+			goto restart;
+		}
 		assert(mem->vmp_q_state == VM_PAGE_ON_FREE_LOCAL_Q);
 
 #if HIBERNATION
@@ -3207,9 +3272,14 @@ restart:
 
 		vm_page_grab_diags();
 
-		vm_offset_t pcpu_base = current_percpu_base();
 		counter_inc_preemption_disabled(&vm_page_grab_count);
-		*PERCPU_GET_WITH_BASE(pcpu_base, free_pages) = mem->vmp_snext;
+		if (!refilled) {
+			counter_inc_preemption_disabled(&vm_page_free_cache_hits);
+		}
+		countp = PERCPU_GET_WITH_BASE(pcpu_base, free_pages_count);
+		if (*countp) {
+			*countp -= 1;
+		}
 		VM_DEBUG_EVENT(vm_page_grab, VM_PAGE_GRAB, DBG_FUNC_NONE, grab_options, 0, 0, 0);
 
 		VM_PAGE_ZERO_PAGEQ_ENTRY(mem);
@@ -3311,6 +3381,7 @@ restart:
 		vm_page_t        head;
 		vm_page_t        tail;
 		unsigned int     pages_to_steal;
+		unsigned int     free_pages_count;
 		unsigned int     color;
 		unsigned int clump_end, sub_count;
 
@@ -3336,7 +3407,7 @@ restart:
 		/*
 		 * If we got preempted the cache might now have pages.
 		 */
-		if ((mem = *PERCPU_GET(free_pages))) {
+		if ((mem = os_atomic_load(PERCPU_GET(free_pages), relaxed))) {
 			vm_free_page_unlock();
 			enable_preemption();
 			goto restart;
@@ -3355,6 +3426,7 @@ restart:
 		head = tail = NULL;
 
 		vm_page_free_count -= pages_to_steal;
+		free_pages_count = pages_to_steal;
 		clump_end = sub_count = 0;
 
 		while (pages_to_steal--) {
@@ -3426,11 +3498,15 @@ restart:
 		}
 #endif /* HIBERNATION */
 		vm_offset_t pcpu_base = current_percpu_base();
-		*PERCPU_GET_WITH_BASE(pcpu_base, free_pages) = head;
+		/* the list is empty, and a flush only ever empties it */
+		os_atomic_store(PERCPU_GET_WITH_BASE(pcpu_base, free_pages), head, release);
+		*PERCPU_GET_WITH_BASE(pcpu_base, free_pages_count) = free_pages_count;
 		*PERCPU_GET_WITH_BASE(pcpu_base, start_color) = color;
+		counter_inc_preemption_disabled(&vm_page_free_cache_refills);
 
 		vm_free_page_unlock();
 		enable_preemption();
+		refilled = true;
 		goto restart;
 	}
 
@@ -3690,6 +3766,208 @@ vm_page_grab_diags()
 #endif /* DEVELOPMENT || DEBUG */
 }
 
+/*
+ * Return a chain of pages taken off a per-CPU free page cache to the
+ * global free queues, with a single acquisition of the free page lock.
+ */
+static void
+vm_page_free_cache_drain(
+	vm_page_t       list)
+{
+	vm_page_t       mem, nxt;
+	event_t         wakeup_events[3] = { NULL, NULL, NULL };
+	unsigned int    color, i, count = 0;
+
+	vm_free_page_lock_spin();
+
+	for (mem = list; mem; mem = nxt) {
+		nxt = mem->vmp_snext;
+		count++;
+
+		assert(mem->vmp_q_state == VM_PAGE_ON_FREE_LOCAL_Q);
+		assert(mem->vmp_busy);
+		VM_PAGE_ZERO_PAGEQ_ENTRY(mem);
+		mem->vmp_q_state = VM_PAGE_ON_FREE_Q;
+
+		color = VM_PAGE_GET_COLOR(mem);
+#if defined(__x86_64__)
+		vm_page_queue_enter_clump(&vm_page_queue_free[color].qhead, mem);
+#else
+		vm_page_queue_enter(&vm_page_queue_free[color].qhead, mem, vmp_pageq);
+#endif
+	}
+	vm_page_free_count += count;
+
+	/*
+	 * Caches only take pages while nobody is waiting for memory,
+	 * but someone might have started waiting since: these pages
+	 * are for them.
+	 */
+	if (vm_page_free_wanted_privileged > 0) {
+		vm_page_free_wanted_privileged = 0;
+		wakeup_events[0] = (event_t)&vm_page_free_wanted_privileged;
+	}
+#if CONFIG_SECLUDED_MEMORY
+	if (vm_page_free_wanted_secluded > 0 &&
+	    vm_page_free_count > vm_page_free_reserved) {
+		vm_page_free_wanted_secluded = 0;
+		wakeup_events[1] = (event_t)&vm_page_free_wanted_secluded;
+	}
+#endif /* CONFIG_SECLUDED_MEMORY */
+	if (vm_page_free_wanted > 0 &&
+	    vm_page_free_count > vm_page_free_reserved) {
+		vm_page_free_wanted = 0;
+		wakeup_events[2] = (event_t)&vm_page_free_count;
+	}
+
+	vm_free_page_unlock();
+
+	counter_inc(&vm_page_free_cache_drains);
+	VM_DEBUG_CONSTANT_EVENT(vm_page_release, VM_PAGE_RELEASE, DBG_FUNC_NONE, count, 0, 0, 0);
+
+	for (i = 0; i < 3; i++) {
+		if (wakeup_events[i] == NULL) {
+			continue;
+		}
+		if (vps_dynamic_priority_enabled) {
+			wakeup_all_with_inheritor(wakeup_events[i], THREAD_AWAKENED);
+		} else {
+			thread_wakeup(wakeup_events[i]);
+		}
+	}
+}
+
+/*
+ * Try to keep a page that is being freed in the current CPU's free
+ * page cache, rather than taking the free page lock to put it on the
+ * global free queues.
+ *
+ * The page must be ready to be freed, with pmap_clear_noencrypt()
+ * already done.  Returns false if the page must go to the global free
+ * queues instead.
+ */
+static bool
+vm_page_free_cache_put(
+	vm_page_t       mem)
+{
+	vm_offset_t     pcpu_base;
+	vm_page_t       *headp, *tailp;
+	vm_page_t       head, drain = VM_PAGE_NULL;
+	unsigned int    count;
+
+	/*
+	 * These are racy, and that's fine: they're only here to keep
+	 * the caches from sitting on pages that are needed elsewhere.
+	 */
+	if (vm_free_magazine_limit == 0 ||
+	    vm_page_free_count <= vm_page_free_target ||
+	    vm_page_free_wanted > 0 ||
+	    vm_page_free_wanted_privileged > 0) {
+		return false;
+	}
+	if (mem->vmp_lopage || vm_lopage_refill) {
+		return false;
+	}
+#if CONFIG_SECLUDED_MEMORY
+	if (vm_page_secluded_count < vm_page_secluded_target &&
+	    num_tasks_can_use_secluded_mem == 0) {
+		return false;
+	}
+#endif /* CONFIG_SECLUDED_MEMORY */
+
+	assert(mem->vmp_q_state == VM_PAGE_NOT_ON_Q);
+	assert(mem->vmp_busy);
+	assert(!mem->vmp_laundry);
+	assert(!mem->vmp_realtime);
+	assert(mem->vmp_object == 0);
+	assert(mem->vmp_pageq.next == 0 && mem->vmp_pageq.prev == 0);
+	assert(mem->vmp_listq.next == 0 && mem->vmp_listq.prev == 0);
+	assert(mem->vmp_specialq.next == 0 && mem->vmp_specialq.prev == 0);
+
+	disable_preemption();
+
+#if HIBERNATION
+	if (hibernate_rebuild_needed) {
+		enable_preemption();
+		return false;
+	}
+#endif /* HIBERNATION */
+
+	pcpu_base = current_percpu_base();
+	headp = PERCPU_GET_WITH_BASE(pcpu_base, free_pages);
+	count = *PERCPU_GET_WITH_BASE(pcpu_base, free_pages_count);
+
+	mem->vmp_on_specialq = VM_PAGE_SPECIAL_Q_EMPTY;
+	mem->vmp_lopage = FALSE;
+	mem->vmp_q_state = VM_PAGE_ON_FREE_LOCAL_Q;
+
+	if (count >= vm_free_magazine_limit) {
+		/*
+		 * Full: keep the most recently freed half, which is the
+		 * likeliest to still be in the caches, and drain the rest.
+		 *
+		 * Detach the list first so that a flush can't walk it
+		 * while it is being cut.
+		 */
+		head = os_atomic_xchg(headp, VM_PAGE_NULL, relaxed);
+		tailp = &head;
+		for (count = 0; *tailp && count < vm_free_magazine_limit / 2; count++) {
+			tailp = &(*tailp)->vmp_snext;
+		}
+		drain = *tailp;
+		*tailp = VM_PAGE_NULL;
+
+		mem->vmp_snext = head;
+		os_atomic_store(headp, mem, release);
+	} else {
+		head = os_atomic_load(headp, relaxed);
+		do {
+			mem->vmp_snext = head;
+		} while (!os_atomic_cmpxchgv(headp, head, mem, &head, release));
+	}
+	*PERCPU_GET_WITH_BASE(pcpu_base, free_pages_count) = count + 1;
+	counter_inc_preemption_disabled(&vm_page_free_cache_releases);
+
+	enable_preemption();
+
+	if (drain) {
+		vm_page_free_cache_drain(drain);
+	}
+	return true;
+}
+
+/*
+ * Give the pages of every CPU's free page cache back to the global free
+ * queues, before deciding that free memory is short: they aren't counted
+ * in vm_page_free_count, and CPUs that stopped allocating would otherwise
+ * sit on them for good.
+ */
+void
+vm_page_free_cache_flush(void)
+{
+	vm_page_t       list;
+
+#if HIBERNATION
+	if (hibernate_rebuild_needed) {
+		return;
+	}
+#endif /* HIBERNATION */
+
+	percpu_foreach_base(pcpu_base) {
+		vm_page_t *headp = PERCPU_GET_WITH_BASE(pcpu_base, free_pages);
+
+		if (os_atomic_load(headp, relaxed) == VM_PAGE_NULL) {
+			continue;
+		}
+		list = os_atomic_xchg(headp, VM_PAGE_NULL, acquire);
+		if (list) {
+			os_atomic_store(PERCPU_GET_WITH_BASE(pcpu_base,
+			    free_pages_count), 0, relaxed);
+			vm_page_free_cache_drain(list);
+		}
+	}
+}
+
 /*
  *	vm_page_release:
  *
@@ -3740,6 +4018,11 @@ vm_page_release(
 		}
 	}
 
+	if (vm_page_free_cache_put(mem)) {
+		VM_DEBUG_CONSTANT_EVENT(vm_page_release, VM_PAGE_RELEASE, DBG_FUNC_NONE, 1, 0, 0, 0);
+		return;
+	}
+
 	vm_free_page_lock_spin();
 
 	assert(mem->vmp_q_state == VM_PAGE_NOT_ON_Q);
@@ -3951,6 +4234,9 @@ vm_page_wait(
 	int             is_privileged = current_thread()->options & TH_OPT_VMPRIV;
 	event_t         wait_event = NULL;
 
+	/* the pages cached by other CPUs might be all that's needed */
+	vm_page_free_cache_flush();
+
 	vm_free_page_lock_spin();
 
 	if (is_privileged && vm_page_free_count) {
@@ -4387,20 +4673,22 @@ vm_page_free_list(
 					    FALSE);             /* page queues are not locked */
 #endif /* CONFIG_SECLUDED_MEMORY */
 				} else {
-					/*
-					 * IMPORTANT: we can't set the page "free" here
-					 * because that would make the page eligible for
-					 * a physically-contiguous allocation (see
-					 * vm_page_find_contiguous()) right away (we don't
-					 * hold the vm_page_queue_free lock).  That would
-					 * cause trouble because the page is not actually
-					 * in the free queue yet...
-					 */
-					mem->vmp_snext = local_freeq;
-					local_freeq = mem;
-					pg_count++;
-
 					pmap_clear_noencrypt(VM_PAGE_GET_PHYS_PAGE(mem));
+
+					if (!vm_page_free_cache_put(mem)) {
+						/*
+						 * IMPORTANT: we can't set the page "free" here
+						 * because that would make the page eligible for
+						 * a physically-contiguous allocation (see
+						 * vm_page_find_contiguous()) right away (we don't
+						 * hold the vm_page_queue_free lock).  That would
+						 * cause trouble because the page is not actually
+						 * in the free queue yet...
+						 */
+						mem->vmp_snext = local_freeq;
+						local_freeq = mem;
+						pg_count++;
+					}
 				}
 			} else {
 				assert(VM_PAGE_GET_PHYS_PAGE(mem) == vm_page_fictitious_addr ||
@@ -5341,6 +5629,7 @@ vm_page_reactivate_all_throttled(void)
 			}
 
 			m->vmp_q_state = VM_PAGE_ON_ACTIVE_Q;
+			VM_PAGE_SET_YOUNGEST_GEN(m);
 			VM_PAGE_CHECK(m);
 			vm_page_add_to_specialq(m, FALSE);
 		}
@@ -5432,6 +5721,7 @@ vm_page_reactivate_local(uint32_t lid, boolean_t force, boolean_t nolocks)
 
 			m->vmp_local_id = 0;
 			m->vmp_q_state = VM_PAGE_ON_ACTIVE_Q;
+			VM_PAGE_SET_YOUNGEST_GEN(m);
 			VM_PAGE_CHECK(m);
 			vm_page_add_to_specialq(m, FALSE);
 			count++;
@@ -6791,7 +7081,22 @@ vm_page_do_delayed_work(
 		}
 #if CONFIG_PHANTOM_CACHE
 		if (dwp->dw_mask & DW_vm_phantom_cache_update) {
-			vm_phantom_cache_update(m);
+			if (vm_phantom_cache_update(m) &&
+			    (dwp->dw_mask & (DW_vm_page_deactivate_internal | DW_vm_page_speculate)) &&
+			    !(dwp->dw_mask & (DW_vm_page_wire | DW_vm_page_unwire | DW_vm_page_free))) {
+				/*
+				 * refaulted within the working set: activate it
+				 * rather than put it on the inactive or speculative
+				 * queue, anything else is left to the caller
+				 */
+				dwp->dw_mask &= ~(DW_vm_page_deactivate_internal | DW_vm_page_speculate);
+				dwp->dw_mask |= DW_vm_page_activate;
+
+				vm_pageout_vminfo.vm_phantom_cache_workingset_refault++;
+				if (vm_page_workingset_debt < VM_PAGE_WORKINGSET_DEBT_MAX) {
+					vm_page_workingset_debt++;
+				}
+			}
 		}
 #endif
 		if (dwp->dw_mask & DW_vm_page_wire) {
@@ -9043,6 +9348,7 @@ vm_page_enqueue_active(vm_page_t mem, boolean_t first)
 	vm_page_check_pageable_safe(mem);
 
 	mem->vmp_q_state = VM_PAGE_ON_ACTIVE_Q;
+	VM_PAGE_SET_YOUNGEST_GEN(mem);
 	if (first == TRUE) {
 		vm_page_queue_enter_first(&vm_page_queue_active, mem, vmp_pageq);
 	} else {
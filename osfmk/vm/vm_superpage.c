@@ -0,0 +1,634 @@
+/*
+ * Copyright (c) 2024 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+/*
+ * Transparent superpages.
+ *
+ * Explicit superpages (VM_FLAGS_SUPERPAGE_SIZE_2MB) are allocated
+ * physically contiguous and wired up front.  This promotes ordinary
+ * private anonymous memory to the same kind of mapping after the fact:
+ * a background thread looks for SUPERPAGE_SIZE aligned ranges whose base
+ * pages are all resident, moves them into a naturally aligned physically
+ * contiguous run if they aren't in one already, and replaces their base
+ * page mappings with a single superpage mapping.
+ *
+ * Like explicit superpages, the pages of a promoted range stay wired so
+ * that the pageout daemon never has to break up the mapping to reclaim
+ * one of them; they carry "vmp_promoted" and their map entry carries
+ * "vme_promoted".  The VM demotes a range, i.e. removes the superpage
+ * mapping and unwires the pages, before clipping through it, changing
+ * its protection, wiring it, copying it or removing it (see
+ * vm_map_entry_demote() in vm_map.c).  The scanner demotes everything
+ * when memory gets tight or the feature gets turned off.
+ *
+ * The pmap layer only accounts one base page for a superpage mapping,
+ * so promotion and demotion adjust the task ledgers for the others.
+ */
+
+#include <kern/kalloc.h>
+#include <kern/ledger.h>
+#include <kern/processor.h>
+#include <kern/sched_prim.h>
+#include <kern/startup.h>
+#include <kern/task.h>
+#include <kern/thread.h>
+#include <mach/kern_return.h>
+#include <mach/mach_types.h>
+#include <os/atomic_private.h>
+#include <vm/pmap.h>
+#include <vm/vm_map.h>
+#include <vm/vm_object.h>
+#include <vm/vm_page.h>
+#include <vm/vm_pageout.h>
+#include <vm/vm_superpage_internal.h>
+
+#pragma mark Tunables
+TUNABLE_WRITEABLE(int, vm_transparent_superpages, "vm_transparent_superpages", 0);
+TUNABLE_WRITEABLE(uint32_t, vm_superpage_scan_interval_ms, "vm_superpage_scan_interval_ms", 1000);
+/* most ranges one scan promotes, across all tasks */
+TUNABLE_WRITEABLE(uint32_t, vm_superpage_scan_max_promotions, "vm_superpage_scan_max_promotions", 32);
+
+#pragma mark Statistics
+uint64_t vm_superpage_promotions;
+uint64_t vm_superpage_splits;
+uint64_t vm_superpage_promotion_failures;
+/* promoted ranges currently in place */
+uint64_t vm_superpage_promoted_count;
+
+/* candidate ranges collected per map and scan */
+#define VM_SUPERPAGE_SCAN_BATCH 8
+
+static thread_t vm_superpage_scan_thread;
+
+#pragma mark Eligibility
+
+static bool
+vm_superpage_entry_eligible(
+	vm_map_t        map,
+	vm_map_entry_t  entry)
+{
+	return !entry->is_sub_map &&
+	       !entry->superpage_size &&
+	       !entry->needs_copy &&
+	       !entry->in_transition &&
+	       !entry->is_shared &&
+	       !entry->used_for_jit &&
+	       !entry->iokit_acct &&
+	       entry->use_pmap &&
+	       entry->wired_count == 0 &&
+	       entry->protection == VM_PROT_DEFAULT &&
+	       VM_MAP_PAGE_SHIFT(map) == PAGE_SHIFT &&
+	       VME_OBJECT(entry) != VM_OBJECT_NULL &&
+	       SUPERPAGE_ROUND_UP(entry->vme_start) + SUPERPAGE_SIZE <= entry->vme_end;
+}
+
+/*
+ * The object must be private to the one entry mapping it, so that
+ * nothing else can map, copy or page its pages behind our back.
+ */
+static bool
+vm_superpage_object_eligible(
+	vm_object_t     object)
+{
+	return object->internal &&
+	       !object->phys_contiguous &&
+	       !object->true_share &&
+	       object->ref_count == 1 &&
+	       object->vo_copy == VM_OBJECT_NULL &&
+	       object->purgable == VM_PURGABLE_DENY &&
+	       object->copy_strategy == MEMORY_OBJECT_COPY_SYMMETRIC &&
+	       object->wimg_bits == VM_WIMG_USE_DEFAULT &&
+	       object->resident_page_count - object->wired_page_count >=
+	       SUPERPAGE_NBASEPAGES;
+}
+
+static bool
+vm_superpage_page_eligible(
+	vm_page_t       m)
+{
+	return m != VM_PAGE_NULL &&
+	       !m->vmp_busy &&
+	       !m->vmp_absent &&
+	       !m->vmp_error &&
+	       !m->vmp_unusual &&
+	       !m->vmp_cleaning &&
+	       !m->vmp_laundry &&
+	       !m->vmp_fictitious &&
+	       !m->vmp_private &&
+	       !m->vmp_reusable &&
+	       !m->vmp_realtime &&
+	       !m->vmp_gobbled &&
+	       !m->vmp_promoted &&
+	       !VM_PAGE_WIRED(m) &&
+	       m->vmp_q_state != VM_PAGE_USED_BY_COMPRESSOR;
+}
+
+/*
+ * Check the SUPERPAGE_SIZE run of "object" at "offset" and tell whether
+ * it already sits in a naturally aligned, physically contiguous run.
+ */
+static bool
+vm_superpage_run_eligible(
+	vm_object_t             object,
+	vm_object_offset_t      offset,
+	bool                    *contiguous)
+{
+	ppnum_t head_pn = 0;
+
+	*contiguous = true;
+	for (unsigned int i = 0; i < SUPERPAGE_NBASEPAGES; i++) {
+		vm_page_t m = vm_page_lookup(object, offset + ptoa_64(i));
+
+		if (!vm_superpage_page_eligible(m)) {
+			return false;
+		}
+		if (i == 0) {
+			head_pn = VM_PAGE_GET_PHYS_PAGE(m);
+			if (head_pn & (SUPERPAGE_NBASEPAGES - 1)) {
+				*contiguous = false;
+			}
+		} else if (VM_PAGE_GET_PHYS_PAGE(m) != head_pn + i) {
+			*contiguous = false;
+		}
+	}
+	return true;
+}
+
+#pragma mark Promotion
+
+static void
+vm_superpage_free_run(
+	vm_page_t       pages)
+{
+	vm_page_t m;
+
+	vm_page_lock_queues();
+	while ((m = pages) != VM_PAGE_NULL) {
+		pages = NEXT_PAGE(m);
+		*(NEXT_PAGE_PTR(m)) = VM_PAGE_NULL;
+		vm_page_free(m);
+	}
+	vm_page_unlock_queues();
+}
+
+/*
+ * Move the run of "object" at "offset" into the contiguous "pages".
+ * The base page mappings are gone by the time the contents are copied,
+ * and the map is locked exclusively, so nobody can write to them.
+ */
+static void
+vm_superpage_migrate_run(
+	vm_object_t             object,
+	vm_object_offset_t      offset,
+	vm_page_t               pages)
+{
+	for (unsigned int i = 0; i < SUPERPAGE_NBASEPAGES; i++) {
+		vm_object_offset_t off = offset + ptoa_64(i);
+		vm_page_t old_m = vm_page_lookup(object, off);
+		vm_page_t new_m = pages;
+
+		pages = NEXT_PAGE(new_m);
+		*(NEXT_PAGE_PTR(new_m)) = VM_PAGE_NULL;
+
+		pmap_disconnect(VM_PAGE_GET_PHYS_PAGE(old_m));
+		pmap_copy_page(VM_PAGE_GET_PHYS_PAGE(old_m),
+		    VM_PAGE_GET_PHYS_PAGE(new_m));
+		VM_PAGE_FREE(old_m);
+
+		vm_page_insert(new_m, object, off);
+		new_m->vmp_busy = FALSE;
+	}
+	assert(pages == VM_PAGE_NULL);
+}
+
+/*
+ * Returns KERN_NOT_SUPPORTED if the range can't be promoted as is,
+ * and KERN_RESOURCE_SHORTAGE if it needs a contiguous run of pages
+ * the caller has to provide in "*pages".
+ */
+static kern_return_t
+vm_superpage_promote_locked(
+	vm_map_t                map,
+	vm_map_offset_t         start,
+	vm_page_t               *pages)
+{
+	vm_map_entry_t          entry;
+	vm_object_t             object;
+	vm_object_offset_t      offset;
+	vm_page_t               m;
+	ppnum_t                 head_pn;
+	bool                    contiguous;
+	kern_return_t           kr;
+
+	vm_map_lock_assert_exclusive(map);
+
+	if (!vm_map_lookup_entry(map, start, &entry) ||
+	    !vm_superpage_entry_eligible(map, entry) ||
+	    start + SUPERPAGE_SIZE > entry->vme_end) {
+		return KERN_NOT_SUPPORTED;
+	}
+
+	object = VME_OBJECT(entry);
+	offset = VME_OFFSET(entry) + (start - entry->vme_start);
+
+	vm_object_lock(object);
+	if (!vm_superpage_object_eligible(object) ||
+	    !vm_superpage_run_eligible(object, offset, &contiguous)) {
+		vm_object_unlock(object);
+		return KERN_NOT_SUPPORTED;
+	}
+	if (!contiguous) {
+		if (*pages == VM_PAGE_NULL) {
+			vm_object_unlock(object);
+			return KERN_RESOURCE_SHORTAGE;
+		}
+		vm_superpage_migrate_run(object, offset, *pages);
+		*pages = VM_PAGE_NULL;
+	}
+
+	for (unsigned int i = 0; i < SUPERPAGE_NBASEPAGES; i++) {
+		m = vm_page_lookup(object, offset + ptoa_64(i));
+		if (m->vmp_pmapped) {
+			pmap_disconnect(VM_PAGE_GET_PHYS_PAGE(m));
+		}
+		/* the superpage mapping only tracks modifications as a whole */
+		SET_PAGE_DIRTY(m, FALSE);
+		m->vmp_pmapped = TRUE;
+		m->vmp_wpmapped = TRUE;
+	}
+	vm_page_lock_queues();
+	for (unsigned int i = 0; i < SUPERPAGE_NBASEPAGES; i++) {
+		m = vm_page_lookup(object, offset + ptoa_64(i));
+		m->vmp_promoted = TRUE;
+		vm_page_wire(m, VM_KERN_MEMORY_OSFMK, FALSE);
+	}
+	vm_page_unlock_queues();
+
+	head_pn = VM_PAGE_GET_PHYS_PAGE(vm_page_lookup(object, offset));
+	vm_object_unlock(object);
+
+	kr = pmap_enter_options(map->pmap, start, head_pn,
+	    entry->protection, VM_PROT_NONE,
+	    VM_WIMG_USE_DEFAULT | VM_MEM_SUPERPAGE, FALSE,
+	    PMAP_OPTIONS_INTERNAL, NULL, PMAP_MAPPING_TYPE_INFER);
+	if (kr != KERN_SUCCESS) {
+		/* leave the pages to be faulted back in one by one */
+		vm_object_lock(object);
+		vm_page_lock_queues();
+		for (unsigned int i = 0; i < SUPERPAGE_NBASEPAGES; i++) {
+			m = vm_page_lookup(object, offset + ptoa_64(i));
+			m->vmp_promoted = FALSE;
+			vm_page_unwire(m, TRUE);
+		}
+		vm_page_unlock_queues();
+		vm_object_unlock(object);
+		return kr;
+	}
+
+	pmap_ledger_credit(map->pmap, task_ledgers.phys_mem,
+	    SUPERPAGE_SIZE - PAGE_SIZE);
+	pmap_ledger_credit(map->pmap, task_ledgers.internal,
+	    SUPERPAGE_SIZE - PAGE_SIZE);
+	pmap_ledger_credit(map->pmap, task_ledgers.phys_footprint,
+	    SUPERPAGE_SIZE - PAGE_SIZE);
+
+	entry->vme_promoted = TRUE;
+	return KERN_SUCCESS;
+}
+
+kern_return_t
+vm_superpage_promote(
+	vm_map_t                map,
+	vm_map_offset_t         start)
+{
+	vm_page_t               pages = VM_PAGE_NULL;
+	kern_return_t           kr;
+
+	assert((start & ~SUPERPAGE_MASK) == 0);
+
+	vm_map_lock(map);
+	kr = vm_superpage_promote_locked(map, start, &pages);
+	vm_map_unlock(map);
+
+	if (kr == KERN_RESOURCE_SHORTAGE) {
+		kr = cpm_allocate(SUPERPAGE_SIZE, &pages, 0,
+		    SUPERPAGE_NBASEPAGES - 1, FALSE, 0);
+		if (kr == KERN_SUCCESS) {
+			/* the range could have changed while unlocked */
+			vm_map_lock(map);
+			kr = vm_superpage_promote_locked(map, start, &pages);
+			vm_map_unlock(map);
+		} else {
+			kr = KERN_RESOURCE_SHORTAGE;
+		}
+	}
+	if (pages != VM_PAGE_NULL) {
+		vm_superpage_free_run(pages);
+	}
+
+	switch (kr) {
+	case KERN_SUCCESS:
+		os_atomic_inc(&vm_superpage_promotions, relaxed);
+		os_atomic_inc(&vm_superpage_promoted_count, relaxed);
+		break;
+	case KERN_NOT_SUPPORTED:
+		break;
+	default:
+		os_atomic_inc(&vm_superpage_promotion_failures, relaxed);
+		break;
+	}
+	return kr;
+}
+
+#pragma mark Demotion
+
+static void
+vm_superpage_demote_run(
+	vm_map_t                map,
+	vm_object_t             object,
+	vm_map_offset_t         start,
+	vm_object_offset_t      offset)
+{
+	vm_page_t               m;
+
+	pmap_remove(map->pmap, start, start + SUPERPAGE_SIZE);
+
+	vm_page_lock_queues();
+	for (unsigned int i = 0; i < SUPERPAGE_NBASEPAGES; i++) {
+		m = vm_page_lookup(object, offset + ptoa_64(i));
+		assert(m != VM_PAGE_NULL && m->vmp_promoted);
+		m->vmp_promoted = FALSE;
+		vm_page_unwire(m, TRUE);
+	}
+	vm_page_unlock_queues();
+
+	pmap_ledger_debit(map->pmap, task_ledgers.phys_mem,
+	    SUPERPAGE_SIZE - PAGE_SIZE);
+	pmap_ledger_debit(map->pmap, task_ledgers.internal,
+	    SUPERPAGE_SIZE - PAGE_SIZE);
+	pmap_ledger_debit(map->pmap, task_ledgers.phys_footprint,
+	    SUPERPAGE_SIZE - PAGE_SIZE);
+
+	os_atomic_inc(&vm_superpage_splits, relaxed);
+	os_atomic_dec(&vm_superpage_promoted_count, relaxed);
+}
+
+void
+vm_superpage_demote(
+	vm_map_t                map,
+	vm_map_entry_t          entry,
+	vm_map_offset_t         start,
+	vm_map_offset_t         end)
+{
+	vm_object_t             object = VME_OBJECT(entry);
+	vm_object_offset_t      offset;
+	vm_map_offset_t         va;
+	vm_page_t               head;
+	bool                    promoted = false;
+
+	vm_map_lock_assert_exclusive(map);
+	assert(entry->vme_promoted && !entry->is_sub_map);
+
+	vm_object_lock(object);
+	for (va = SUPERPAGE_ROUND_UP(entry->vme_start);
+	    va + SUPERPAGE_SIZE <= entry->vme_end;
+	    va += SUPERPAGE_SIZE) {
+		offset = VME_OFFSET(entry) + (va - entry->vme_start);
+		head = vm_page_lookup(object, offset);
+		if (head == VM_PAGE_NULL || !head->vmp_promoted) {
+			continue;
+		}
+		if (va + SUPERPAGE_SIZE <= start || va >= end) {
+			promoted = true;
+			continue;
+		}
+		vm_superpage_demote_run(map, object, va, offset);
+	}
+	vm_object_unlock(object);
+
+	entry->vme_promoted = promoted;
+}
+
+uint32_t
+vm_superpage_promoted_ranges(
+	vm_map_t                map)
+{
+	vm_map_entry_t          entry;
+	vm_object_t             object;
+	vm_object_offset_t      offset;
+	vm_map_offset_t         va;
+	vm_page_t               head;
+	uint32_t                count = 0;
+
+	vm_map_lock_read(map);
+	for (entry = vm_map_first_entry(map);
+	    entry != vm_map_to_entry(map);
+	    entry = entry->vme_next) {
+		if (!entry->vme_promoted) {
+			continue;
+		}
+		object = VME_OBJECT(entry);
+		vm_object_lock_shared(object);
+		for (va = SUPERPAGE_ROUND_UP(entry->vme_start);
+		    va + SUPERPAGE_SIZE <= entry->vme_end;
+		    va += SUPERPAGE_SIZE) {
+			offset = VME_OFFSET(entry) + (va - entry->vme_start);
+			head = vm_page_lookup(object, offset);
+			if (head != VM_PAGE_NULL && head->vmp_promoted) {
+				count++;
+			}
+		}
+		vm_object_unlock(object);
+	}
+	vm_map_unlock_read(map);
+
+	return count;
+}
+
+#pragma mark Scanner
+
+/*
+ * Collect ranges of "map" that look worth promoting: the map and the
+ * objects are only locked shared, vm_superpage_promote() checks again.
+ */
+static unsigned int
+vm_superpage_scan_map(
+	vm_map_t                map,
+	vm_map_offset_t         *candidates,
+	unsigned int            max)
+{
+	vm_map_entry_t          entry;
+	vm_object_t             object;
+	vm_object_offset_t      offset;
+	vm_map_offset_t         va;
+	vm_page_t               head, tail;
+	unsigned int            count = 0;
+
+	vm_map_lock_read(map);
+	for (entry = vm_map_first_entry(map);
+	    entry != vm_map_to_entry(map) && count < max;
+	    entry = entry->vme_next) {
+		if (!vm_superpage_entry_eligible(map, entry)) {
+			continue;
+		}
+		object = VME_OBJECT(entry);
+		vm_object_lock_shared(object);
+		if (!vm_superpage_object_eligible(object)) {
+			vm_object_unlock(object);
+			continue;
+		}
+		for (va = SUPERPAGE_ROUND_UP(entry->vme_start);
+		    va + SUPERPAGE_SIZE <= entry->vme_end && count < max;
+		    va += SUPERPAGE_SIZE) {
+			offset = VME_OFFSET(entry) + (va - entry->vme_start);
+			head = vm_page_lookup(object, offset);
+			tail = vm_page_lookup(object, offset + SUPERPAGE_SIZE - PAGE_SIZE);
+			if (vm_superpage_page_eligible(head) &&
+			    vm_superpage_page_eligible(tail)) {
+				candidates[count++] = va;
+			}
+		}
+		vm_object_unlock(object);
+	}
+	vm_map_unlock_read(map);
+
+	return count;
+}
+
+static void
+vm_superpage_demote_map(
+	vm_map_t                map)
+{
+	vm_map_entry_t          entry;
+
+	vm_map_lock(map);
+	for (entry = vm_map_first_entry(map);
+	    entry != vm_map_to_entry(map);
+	    entry = entry->vme_next) {
+		if (entry->vme_promoted) {
+			vm_superpage_demote(map, entry,
+			    entry->vme_start, entry->vme_end);
+		}
+	}
+	vm_map_unlock(map);
+}
+
+static void
+vm_superpage_scan(void)
+{
+	vm_map_offset_t         candidates[VM_SUPERPAGE_SCAN_BATCH];
+	task_t                  *task_list;
+	task_t                  task;
+	vm_map_t                map;
+	unsigned int            task_count, ntasks = 0;
+	uint32_t                budget = 0;
+	bool                    demote;
+
+	demote = !vm_transparent_superpages ||
+	    vm_page_free_count < vm_page_free_target;
+	if (demote) {
+		if (os_atomic_load(&vm_superpage_promoted_count, relaxed) == 0) {
+			return;
+		}
+	} else {
+		budget = vm_superpage_scan_max_promotions;
+		if (budget == 0) {
+			return;
+		}
+	}
+
+	for (;;) {
+		task_count = (unsigned int)tasks_count;
+		task_list = kalloc_type(task_t, task_count, Z_WAITOK | Z_ZERO);
+		lck_mtx_lock(&tasks_threads_lock);
+		if ((unsigned int)tasks_count <= task_count) {
+			break;
+		}
+		lck_mtx_unlock(&tasks_threads_lock);
+		kfree_type(task_t, task_count, task_list);
+	}
+	queue_iterate(&tasks, task, task_t, tasks) {
+		if (task == kernel_task ||
+		    !task->ipc_active || task_is_exec_copy(task)) {
+			continue;
+		}
+		task_reference(task);
+		task_list[ntasks++] = task;
+	}
+	lck_mtx_unlock(&tasks_threads_lock);
+
+	for (unsigned int i = 0; i < ntasks; i++) {
+		map = get_task_map_reference(task_list[i]);
+		if (map == VM_MAP_NULL) {
+			/* task is terminating */
+		} else if (demote) {
+			vm_superpage_demote_map(map);
+		} else if (budget) {
+			unsigned int count;
+
+			count = vm_superpage_scan_map(map, candidates,
+			    MIN(budget, VM_SUPERPAGE_SCAN_BATCH));
+			for (unsigned int j = 0; j < count; j++) {
+				vm_superpage_promote(map, candidates[j]);
+				budget--;
+			}
+		}
+		if (map != VM_MAP_NULL) {
+			vm_map_deallocate(map);
+		}
+		task_deallocate(task_list[i]);
+	}
+	kfree_type(task_t, task_count, task_list);
+}
+
+static void
+vm_superpage_scan_continue(void *param __unused, wait_result_t wr __unused)
+{
+	vm_superpage_scan();
+
+	assert_wait_timeout((event_t)&vm_superpage_scan_thread, THREAD_UNINT,
+	    MAX(vm_superpage_scan_interval_ms, 1), NSEC_PER_MSEC);
+	thread_block(vm_superpage_scan_continue);
+	/* NOTREACHED */
+}
+
+__startup_func
+static void
+vm_superpage_scan_init(void)
+{
+	kern_return_t kr;
+
+	kr = kernel_thread_start_priority(vm_superpage_scan_continue, NULL,
+	    MINPRI_KERNEL, &vm_superpage_scan_thread);
+	if (kr != KERN_SUCCESS) {
+		panic("%s: failed to start the scanner thread: %d", __func__, kr);
+	}
+	thread_set_thread_name(vm_superpage_scan_thread, "VM_superpage_scan");
+}
+
+STARTUP(EARLY_BOOT, STARTUP_RANK_MIDDLE, vm_superpage_scan_init);
@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2024 Apple Inc. All rights reserved.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. The rights granted to you under the License
+ * may not be used to create, or enable the creation or redistribution of,
+ * unlawful or unlicensed copies of an Apple operating system, or to
+ * circumvent, violate, or enable the circumvention or violation of, any
+ * terms of an Apple operating system software license agreement.
+ *
+ * Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_OSREFERENCE_LICENSE_HEADER_END@
+ */
+
+#ifndef _VM_VM_SUPERPAGE_INTERNAL_H_
+#define _VM_VM_SUPERPAGE_INTERNAL_H_
+
+#if CONFIG_TRANSPARENT_SUPERPAGES
+
+#if CONFIG_TRACK_UNMODIFIED_ANON_PAGES
+#error "vmp_promoted shares its bit with vmp_unmodified_ro"
+#endif /* CONFIG_TRACK_UNMODIFIED_ANON_PAGES */
+
+#ifdef MACH_KERNEL_PRIVATE
+
+#include <mach/mach_types.h>
+#include <vm/vm_map.h>
+
+/*
+ * Transparent superpages: fully populated, aligned SUPERPAGE_SIZE ranges
+ * of private anonymous memory get collapsed into a single superpage
+ * mapping by a background thread ("promoted"), and go back to base page
+ * mappings ("demoted") before anything maps, protects or unmaps part of
+ * them.  See vm_superpage.c.
+ */
+extern int              vm_transparent_superpages;
+
+extern uint64_t         vm_superpage_promotions;
+extern uint64_t         vm_superpage_splits;
+extern uint64_t         vm_superpage_promotion_failures;
+extern uint64_t         vm_superpage_promoted_count;
+
+/*
+ * Promote the SUPERPAGE_SIZE range of "map" at "start".
+ * The map must not be locked.
+ */
+extern kern_return_t    vm_superpage_promote(
+	vm_map_t                map,
+	vm_map_offset_t         start);
+
+/*
+ * Demote the promoted ranges of "entry" that intersect [start, end).
+ * The map must be locked exclusively.
+ */
+extern void             vm_superpage_demote(
+	vm_map_t                map,
+	vm_map_entry_t          entry,
+	vm_map_offset_t         start,
+	vm_map_offset_t         end);
+
+/*
+ * Count the promoted ranges currently in place in "map".
+ * The map must not be locked.
+ */
+extern uint32_t         vm_superpage_promoted_ranges(
+	vm_map_t                map);
+
+#endif /* MACH_KERNEL_PRIVATE */
+
+#endif /* CONFIG_TRANSPARENT_SUPERPAGES */
+
+#endif /* _VM_VM_SUPERPAGE_INTERNAL_H_ */
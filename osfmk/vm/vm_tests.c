@@ -40,6 +40,7 @@
 #include <vm/vm_map_internal.h>
 #include <vm/vm_object.h>
 #include <vm/vm_pageout.h>
+#include <vm/vm_phantom_cache.h>
 #include <vm/vm_protos.h>
 
 #include <mach/mach_vm.h>
@@ -1393,3 +1394,374 @@ vm_map_non_aligned_test(__unused int64_t in, int64_t *out)
 	return 0;
 }
 SYSCTL_TEST_REGISTER(vm_map_non_aligned, vm_map_non_aligned_test);
+
+/*
+ * Times vm_map_lookup_entry() and vm_map_enter() in maps with
+ * a lot of entries (100k by default), indexed with the red-black tree
+ * and the hole list, or with the B+-tree store, and checks that both
+ * agree on every answer.
+ *
+ * The entries are a page each, one page apart, so that the allocations
+ * that don't fit in any of the holes have to go past all of them.
+ *
+ * Both maps then go through the same deletions, clips and
+ * simplifications, after which the B+-tree must still agree with
+ * the entry list, and first_free must still be valid.
+ */
+#define VM_MAP_STORE_BENCH_BASE         0x100000000ull
+#define VM_MAP_STORE_BENCH_LOOKUPS      (1u << 20)
+#define VM_MAP_STORE_BENCH_ENTERS       1000
+#define VM_MAP_STORE_BENCH_MAX          (1u << 20)
+
+/* the i-th page looked up, spread over the first "pages" of the range */
+static vm_map_offset_t
+vm_map_store_bench_addr(uint32_t i, uint64_t pages)
+{
+	return VM_MAP_STORE_BENCH_BASE + (i * 2654435761ull) % pages * PAGE_SIZE;
+}
+
+static kern_return_t
+vm_map_store_bench_enter(
+	vm_map_t                map,
+	vm_map_offset_t        *addr,
+	vm_map_size_t           size,
+	bool                    anywhere)
+{
+	return vm_map_enter(map, addr, size, 0,
+	           anywhere ? VM_MAP_KERNEL_FLAGS_DATA_ANYWHERE() : VM_MAP_KERNEL_FLAGS_FIXED(),
+	           VM_OBJECT_NULL, 0, FALSE, VM_PROT_DEFAULT, VM_PROT_ALL,
+	           VM_INHERIT_DEFAULT);
+}
+
+static vm_map_t
+vm_map_store_bench_one(
+	const char             *name,
+	vm_map_create_options_t options,
+	uint32_t                count,
+	vm_map_offset_t        *addrs)
+{
+	uint64_t start, build_ns, lookup_ns, enter_ns;
+	vm_map_entry_t entry;
+	uint32_t found = 0;
+	kern_return_t kr;
+	vm_map_t map;
+
+	map = vm_map_create_options(PMAP_NULL, 0, (vm_map_offset_t)1 << 40,
+	    VM_MAP_CREATE_PAGEABLE | options);
+
+	start = mach_absolute_time();
+	for (uint32_t i = 0; i < count; i++) {
+		vm_map_offset_t addr = VM_MAP_STORE_BENCH_BASE + 2ull * i * PAGE_SIZE;
+
+		kr = vm_map_store_bench_enter(map, &addr, PAGE_SIZE, false);
+		assert(kr == KERN_SUCCESS);
+	}
+	absolutetime_to_nanoseconds(mach_absolute_time() - start, &build_ns);
+	assert(map->hdr.nentries == (int)count);
+
+	start = mach_absolute_time();
+	vm_map_lock_read(map);
+	for (uint32_t i = 0; i < VM_MAP_STORE_BENCH_LOOKUPS; i++) {
+		vm_map_offset_t addr = vm_map_store_bench_addr(i, 2ull * count);
+
+		found += vm_map_lookup_entry(map, addr, &entry);
+	}
+	vm_map_unlock_read(map);
+	absolutetime_to_nanoseconds(mach_absolute_time() - start, &lookup_ns);
+
+	/* too large for the holes: these go to the end of the map */
+	start = mach_absolute_time();
+	for (uint32_t i = 0; i < VM_MAP_STORE_BENCH_ENTERS; i++) {
+		addrs[i] = VM_MAP_STORE_BENCH_BASE;
+		kr = vm_map_store_bench_enter(map, &addrs[i], 2 * PAGE_SIZE, true);
+		assert(kr == KERN_SUCCESS);
+	}
+	absolutetime_to_nanoseconds(mach_absolute_time() - start, &enter_ns);
+
+	printf("vm_map_store_bench: %-8s %u entries: enter (fixed) %lld ns, "
+	    "lookup %lld ns (%u%% hits), enter (anywhere, past every hole) %lld ns\n",
+	    name, count, build_ns / count, lookup_ns / VM_MAP_STORE_BENCH_LOOKUPS,
+	    (uint32_t)(found * 100ull / VM_MAP_STORE_BENCH_LOOKUPS),
+	    enter_ns / VM_MAP_STORE_BENCH_ENTERS);
+
+	return map;
+}
+
+/* every entry of the list must be what a lookup of its range finds */
+static int
+vm_map_store_bench_verify(vm_map_t map, const char *what)
+{
+	vm_map_offset_t prev_end = map->min_offset;
+	vm_map_entry_t entry, found;
+	int nentries = 0;
+	int rc = 0;
+
+	vm_map_lock_read(map);
+	for (entry = vm_map_first_entry(map);
+	    entry != vm_map_to_entry(map) && rc == 0;
+	    entry = entry->vme_next) {
+		if (prev_end < entry->vme_start &&
+		    (vm_map_lookup_entry(map, prev_end, &found) ||
+		    found != entry->vme_prev)) {
+			rc = EIO;
+		} else if (!vm_map_lookup_entry(map, entry->vme_start, &found) ||
+		    found != entry ||
+		    !vm_map_lookup_entry(map, entry->vme_end - 1, &found) ||
+		    found != entry) {
+			rc = EIO;
+		} else {
+			prev_end = entry->vme_end;
+			nentries++;
+		}
+	}
+	if (rc == 0 && nentries != map->hdr.nentries) {
+		rc = EIO;
+	}
+	if (rc == 0 && !first_free_is_valid_ll(map)) {
+		rc = EIO;
+	}
+	vm_map_unlock_read(map);
+
+	if (rc) {
+		printf("vm_map_store_bench: after %s, the store disagrees with "
+		    "the entry list near 0x%llx\n", what, prev_end);
+	}
+	return rc;
+}
+
+/* apply the same changes to both maps, and check the B+-tree map */
+static int
+vm_map_store_bench_mutate(
+	vm_map_t                rb_map,
+	vm_map_t                bt_map,
+	uint32_t                count,
+	vm_map_offset_t        *addrs)
+{
+	vm_map_t maps[] = { rb_map, bt_map };
+	int rc;
+
+	/* delete a third of the one page entries, and a run of them */
+	for (uint32_t m = 0; m < 2; m++) {
+		vm_map_offset_t run = VM_MAP_STORE_BENCH_BASE +
+		    2ull * (count / 2) * PAGE_SIZE;
+
+		for (uint32_t i = 0; i < count; i += 3) {
+			vm_map_offset_t addr = VM_MAP_STORE_BENCH_BASE +
+			    2ull * i * PAGE_SIZE;
+
+			vm_map_remove(maps[m], addr, addr + PAGE_SIZE);
+		}
+		vm_map_remove(maps[m], run, run + 128 * PAGE_SIZE);
+	}
+	rc = vm_map_store_bench_verify(bt_map, "deletions");
+
+	/* punch a page out of every other two page allocation */
+	for (uint32_t m = 0; m < 2 && rc == 0; m++) {
+		for (uint32_t i = 0; i < VM_MAP_STORE_BENCH_ENTERS; i += 2) {
+			vm_map_remove(maps[m], addrs[i] + PAGE_SIZE,
+			    addrs[i] + 2 * PAGE_SIZE);
+		}
+	}
+	if (rc == 0) {
+		rc = vm_map_store_bench_verify(bt_map, "clipping deletions");
+	}
+
+	/* clip the others in two, and put them back together */
+	for (uint32_t m = 0; m < 2 && rc == 0; m++) {
+		for (uint32_t i = 1; i < VM_MAP_STORE_BENCH_ENTERS; i += 2) {
+			vm_map_inherit(maps[m], addrs[i], addrs[i] + PAGE_SIZE,
+			    VM_INHERIT_NONE);
+		}
+	}
+	if (rc == 0) {
+		rc = vm_map_store_bench_verify(bt_map, "clips");
+	}
+	for (uint32_t m = 0; m < 2 && rc == 0; m++) {
+		for (uint32_t i = 1; i < VM_MAP_STORE_BENCH_ENTERS; i += 2) {
+			vm_map_inherit(maps[m], addrs[i], addrs[i] + PAGE_SIZE,
+			    VM_INHERIT_DEFAULT);
+			vm_map_simplify(maps[m], addrs[i]);
+		}
+	}
+	if (rc == 0) {
+		rc = vm_map_store_bench_verify(bt_map, "simplifications");
+	}
+
+	if (rc == 0 && rb_map->hdr.nentries != bt_map->hdr.nentries) {
+		printf("vm_map_store_bench: %d and %d entries after the changes\n",
+		    rb_map->hdr.nentries, bt_map->hdr.nentries);
+		rc = EIO;
+	}
+	return rc;
+}
+
+static int
+vm_map_store_bench(int64_t in, int64_t *out)
+{
+	uint32_t count = in > 0 ? (uint32_t)MIN(in, VM_MAP_STORE_BENCH_MAX) : 100000;
+	vm_map_offset_t *rb_addrs, *bt_addrs;
+	vm_map_entry_t rb_entry, bt_entry;
+	vm_map_t rb_map, bt_map;
+	int rc = 0;
+
+	rb_addrs = kalloc_data(VM_MAP_STORE_BENCH_ENTERS * sizeof(vm_map_offset_t),
+	    Z_WAITOK | Z_NOFAIL);
+	bt_addrs = kalloc_data(VM_MAP_STORE_BENCH_ENTERS * sizeof(vm_map_offset_t),
+	    Z_WAITOK | Z_NOFAIL);
+
+	rb_map = vm_map_store_bench_one("rb-tree", VM_MAP_CREATE_DEFAULT,
+	    count, rb_addrs);
+	bt_map = vm_map_store_bench_one("b+-tree", VM_MAP_CREATE_BTREE_STORE,
+	    count, bt_addrs);
+	assert(!rb_map->hdr.entries_btree && rb_map->holelistenabled);
+	assert(bt_map->hdr.entries_btree && !bt_map->holelistenabled);
+
+	for (uint32_t i = 0; i < VM_MAP_STORE_BENCH_ENTERS; i++) {
+		if (rb_addrs[i] != bt_addrs[i]) {
+			printf("vm_map_store_bench: allocation %u at 0x%llx and 0x%llx\n",
+			    i, rb_addrs[i], bt_addrs[i]);
+			rc = EIO;
+			break;
+		}
+	}
+
+	/* both maps must hold the same entries */
+	vm_map_lock_read(rb_map);
+	vm_map_lock_read(bt_map);
+	for (uint32_t i = 0; i < VM_MAP_STORE_BENCH_LOOKUPS / 16 && rc == 0; i++) {
+		vm_map_offset_t addr = vm_map_store_bench_addr(i, 4ull * count);
+		bool rb_found = vm_map_lookup_entry(rb_map, addr, &rb_entry);
+		bool bt_found = vm_map_lookup_entry(bt_map, addr, &bt_entry);
+
+		if (rb_found != bt_found ||
+		    rb_entry->vme_start != bt_entry->vme_start ||
+		    rb_entry->vme_end != bt_entry->vme_end) {
+			printf("vm_map_store_bench: lookups of 0x%llx disagree\n", addr);
+			rc = EIO;
+		}
+	}
+	vm_map_unlock_read(bt_map);
+	vm_map_unlock_read(rb_map);
+
+	/* the holes are found in the same order too */
+	for (uint32_t i = 0; i < VM_MAP_STORE_BENCH_ENTERS && rc == 0; i++) {
+		vm_map_offset_t rb_addr = VM_MAP_STORE_BENCH_BASE;
+		vm_map_offset_t bt_addr = VM_MAP_STORE_BENCH_BASE;
+
+		if (vm_map_store_bench_enter(rb_map, &rb_addr, PAGE_SIZE, true) != KERN_SUCCESS ||
+		    vm_map_store_bench_enter(bt_map, &bt_addr, PAGE_SIZE, true) != KERN_SUCCESS ||
+		    rb_addr != bt_addr) {
+			printf("vm_map_store_bench: hole %u at 0x%llx and 0x%llx\n",
+			    i, rb_addr, bt_addr);
+			rc = EIO;
+		}
+	}
+
+	if (rc == 0) {
+		rc = vm_map_store_bench_mutate(rb_map, bt_map, count, bt_addrs);
+	}
+
+	vm_map_deallocate(bt_map);
+	vm_map_deallocate(rb_map);
+	kfree_data(bt_addrs, VM_MAP_STORE_BENCH_ENTERS * sizeof(vm_map_offset_t));
+	kfree_data(rb_addrs, VM_MAP_STORE_BENCH_ENTERS * sizeof(vm_map_offset_t));
+
+	*out = (rc == 0);
+	return rc;
+}
+SYSCTL_TEST_REGISTER(vm_map_store_bench, vm_map_store_bench);
+
+#if CONFIG_PHANTOM_CACHE
+extern uint32_t vm_phantom_object_id;
+extern uint32_t vm_phantom_cache_num_entries;
+
+/*
+ * Evicts 3 pages into the phantom cache and pages them back in through
+ * vm_page_do_delayed_work(), the way vm_upl_commit does: the one headed
+ * for the inactive queue must be activated as a working set refault,
+ * the ones that were explicitly moved to the tail of the inactive queue
+ * or taken off the queues must be left alone.
+ */
+static int
+vm_phantom_cache_workingset_test(__unused int64_t in, int64_t *out)
+{
+	struct vm_page_delayed_work dw[3];
+	unsigned long refaults;
+	vm_object_t object;
+	vm_page_t m[3];
+	int rc = 0;
+
+	if (vm_phantom_cache_num_entries == 0 || !vm_phantom_cache_workingset) {
+		return ENOTSUP;
+	}
+
+	object = vm_object_allocate(3 * PAGE_SIZE);
+	assert(object != VM_OBJECT_NULL);
+
+	vm_object_lock(object);
+	for (int i = 0; i < 3; i++) {
+		while ((m[i] = vm_page_grab()) == VM_PAGE_NULL) {
+			vm_object_unlock(object);
+			VM_PAGE_WAIT();
+			vm_object_lock(object);
+		}
+		vm_page_insert(m[i], object, i * PAGE_SIZE_64);
+	}
+
+	vm_page_lock_queues();
+	/* no pager to ask whether it's on an SSD */
+	object->phantom_object_id = vm_phantom_object_id++;
+	for (int i = 0; i < 3; i++) {
+		vm_phantom_cache_add_ghost(m[i]);
+	}
+	refaults = vm_pageout_vminfo.vm_phantom_cache_workingset_refault;
+	vm_page_unlock_queues();
+
+	dw[0] = (struct vm_page_delayed_work){
+		.dw_m = m[0],
+		.dw_mask = DW_vm_phantom_cache_update | DW_vm_page_deactivate_internal,
+	};
+	dw[1] = (struct vm_page_delayed_work){
+		.dw_m = m[1],
+		.dw_mask = DW_vm_phantom_cache_update | DW_vm_page_lru,
+	};
+	dw[2] = (struct vm_page_delayed_work){
+		.dw_m = m[2],
+		.dw_mask = DW_vm_phantom_cache_update | DW_VM_PAGE_QUEUES_REMOVE,
+	};
+	for (int i = 0; i < 3; i++) {
+		dw[i].dw_mask |= DW_clear_busy | DW_PAGE_WAKEUP;
+	}
+	vm_page_do_delayed_work(object, VM_KERN_MEMORY_NONE, dw, 3);
+
+	vm_page_lock_queues();
+	if (m[0]->vmp_q_state != VM_PAGE_ON_ACTIVE_Q) {
+		printf("%s: refaulted page not activated (%d)\n", __func__,
+		    m[0]->vmp_q_state);
+		rc = EINVAL;
+	}
+	if (m[1]->vmp_q_state != VM_PAGE_ON_INACTIVE_INTERNAL_Q) {
+		printf("%s: page not left on the inactive queue (%d)\n", __func__,
+		    m[1]->vmp_q_state);
+		rc = EINVAL;
+	}
+	if (m[2]->vmp_q_state != VM_PAGE_NOT_ON_Q) {
+		printf("%s: dequeued page requeued (%d)\n", __func__,
+		    m[2]->vmp_q_state);
+		rc = EINVAL;
+	}
+	if (vm_pageout_vminfo.vm_phantom_cache_workingset_refault - refaults != 1) {
+		printf("%s: %lu working set refaults, expected 1\n", __func__,
+		    vm_pageout_vminfo.vm_phantom_cache_workingset_refault - refaults);
+		rc = EINVAL;
+	}
+	vm_page_unlock_queues();
+	vm_object_unlock(object);
+
+	vm_object_deallocate(object);
+
+	*out = (rc == 0);
+	return rc;
+}
+SYSCTL_TEST_REGISTER(vm_phantom_cache_workingset, vm_phantom_cache_workingset_test);
+#endif /* CONFIG_PHANTOM_CACHE */
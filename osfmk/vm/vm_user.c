@@ -602,6 +602,68 @@ vm_protect(
 	           set_maximum);
 }
 
+/*
+ *	mach_vm_batch -
+ *	Applies a vector of protect and deallocate operations to
+ *	the specified map under a single hold of its lock, with
+ *	their TLB invalidations coalesced.
+ *
+ *	The whole vector is validated before anything is applied;
+ *	past that point, operations are applied in order and the
+ *	first failure stops the batch.
+ */
+kern_return_t
+mach_vm_batch(
+	vm_map_t                map,
+	mach_vm_batch_flavor_t  flavor,
+	mach_vm_batch_ops_raw_t raw_ops,
+	natural_t               size,
+	natural_t               *completed)
+{
+	mach_vm_batch_op_v1_t *ops;
+	natural_t count;
+
+	*completed = 0;
+
+	if (map == VM_MAP_NULL || flavor != MACH_VM_BATCH_FLAVOR_V1) {
+		return KERN_INVALID_ARGUMENT;
+	}
+
+	if (size % sizeof(mach_vm_batch_op_v1_t)) {
+		return KERN_INVALID_ARGUMENT;
+	}
+
+	count = size / sizeof(mach_vm_batch_op_v1_t);
+	if (count > MACH_VM_BATCH_OPS_MAX) {
+		return KERN_INVALID_ARGUMENT;
+	}
+	if (count == 0) {
+		return KERN_SUCCESS;
+	}
+
+	ops = (mach_vm_batch_op_v1_t *)raw_ops;
+	for (natural_t i = 0; i < count; i++) {
+		if (vm_map_range_overflows(map, ops[i].address, ops[i].size)) {
+			return KERN_INVALID_ARGUMENT;
+		}
+
+		switch (ops[i].op) {
+		case MACH_VM_BATCH_OP_PROTECT:
+			if ((ops[i].new_protection & ~VM_PROT_ALL) ||
+			    ops[i].set_maximum > 1) {
+				return KERN_INVALID_ARGUMENT;
+			}
+			break;
+		case MACH_VM_BATCH_OP_DEALLOCATE:
+			break;
+		default:
+			return KERN_INVALID_ARGUMENT;
+		}
+	}
+
+	return vm_map_batch(map, ops, count, completed);
+}
+
 /*
  * mach_vm_machine_attributes -
  * Handle machine-specific attributes for a mapping, such
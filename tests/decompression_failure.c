@@ -37,6 +37,8 @@ dirty_page(const vm_address_t address)
 		page_as_u32[i + 0] = i % 4;
 		page_as_u32[i + 1] = 0xcdcdcdcd;
 	}
+	/* keep the pages distinct, identical ones would share a compressed copy */
+	page_as_u32[1] = (uint32_t)(address / page_size);
 }
 
 static bool
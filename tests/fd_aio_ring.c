@@ -0,0 +1,161 @@
+#include <sys/aio_private.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <darwintest.h>
+#include <darwintest_utils.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.fd"),
+	T_META_RUN_CONCURRENTLY(true));
+
+#define SQ_ENTRIES      8
+#define CQ_ENTRIES      16
+#define NBLOCKS         4
+#define BLOCK_SIZE      4096
+
+static struct aio_ring *ring;
+static struct aio_ring_sqe *sqes;
+static struct aio_ring_cqe *cqes;
+
+static void
+queue(uint8_t op, int fd, uint32_t flags, uint32_t len, uint64_t off,
+    const void *addr, uint64_t user_data)
+{
+	uint32_t tail = ring->ar_sq_tail;
+	struct aio_ring_sqe *sqe = &sqes[tail & (SQ_ENTRIES - 1)];
+
+	*sqe = (struct aio_ring_sqe){
+		.sqe_op = op,
+		.sqe_fd = fd,
+		.sqe_flags = flags,
+		.sqe_len = len,
+		.sqe_off = off,
+		.sqe_addr = (uint64_t)(uintptr_t)addr,
+		.sqe_user_data = user_data,
+	};
+	atomic_store_explicit((_Atomic uint32_t *)&ring->ar_sq_tail, tail + 1,
+	    memory_order_release);
+}
+
+static int
+submit_and_wait(uint32_t count)
+{
+	int submitted;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(submitted = aio_ring_enter(count, count, 0),
+	    "aio_ring_enter");
+	T_QUIET; T_ASSERT_EQ(submitted, (int)count, "submitted everything");
+	return submitted;
+}
+
+static struct aio_ring_cqe
+reap(void)
+{
+	uint32_t head = ring->ar_cq_head;
+	struct aio_ring_cqe cqe;
+
+	T_QUIET; T_ASSERT_NE(atomic_load_explicit((_Atomic uint32_t *)&ring->ar_cq_tail,
+	    memory_order_acquire), head, "completion available");
+	cqe = cqes[head & (CQ_ENTRIES - 1)];
+	atomic_store_explicit((_Atomic uint32_t *)&ring->ar_cq_head, head + 1,
+	    memory_order_release);
+	return cqe;
+}
+
+T_DECL(fd_aio_ring, "batched aio through a submission/completion ring")
+{
+	char path[PATH_MAX];
+	char *wbuf, *rbuf;
+	struct aio_ring_cqe cqe;
+	bool seen[2 * NBLOCKS + 1] = { };
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/fd_aio_ring.%d", dt_tmpdir(), getpid());
+
+	T_QUIET; T_ASSERT_POSIX_ZERO(posix_memalign((void **)&ring, 64,
+	    AIO_RING_SIZE(SQ_ENTRIES, CQ_ENTRIES)), "posix_memalign");
+	sqes = (struct aio_ring_sqe *)((char *)ring + AIO_RING_SQES_OFFSET);
+	cqes = (struct aio_ring_cqe *)((char *)ring + AIO_RING_CQES_OFFSET(SQ_ENTRIES));
+
+	T_ASSERT_POSIX_FAILURE(aio_ring_setup(ring, 3, CQ_ENTRIES, 0), EINVAL,
+	    "entries must be powers of 2");
+	T_ASSERT_POSIX_SUCCESS(aio_ring_setup(ring, SQ_ENTRIES, CQ_ENTRIES, 0),
+	    "aio_ring_setup");
+	T_ASSERT_POSIX_FAILURE(aio_ring_setup(ring, SQ_ENTRIES, CQ_ENTRIES, 0), EBUSY,
+	    "one ring per process");
+	T_QUIET; T_ASSERT_EQ(ring->ar_sq_entries, SQ_ENTRIES, "ar_sq_entries");
+	T_QUIET; T_ASSERT_EQ(ring->ar_cq_entries, CQ_ENTRIES, "ar_cq_entries");
+
+	/* open, completes inline */
+	queue(AIO_RING_OP_OPENAT, AT_FDCWD, O_RDWR | O_CREAT | O_TRUNC, 0644, 0, path, 100);
+	submit_and_wait(1);
+	cqe = reap();
+	T_ASSERT_EQ(cqe.cqe_user_data, 100ULL, "openat completion");
+	T_ASSERT_GE(cqe.cqe_res, 0LL, "openat returned a descriptor");
+	fd = (int)cqe.cqe_res;
+
+	wbuf = malloc(NBLOCKS * BLOCK_SIZE);
+	rbuf = calloc(NBLOCKS, BLOCK_SIZE);
+	T_QUIET; T_ASSERT_NOTNULL(wbuf, "malloc");
+	T_QUIET; T_ASSERT_NOTNULL(rbuf, "calloc");
+	for (int i = 0; i < NBLOCKS * BLOCK_SIZE; i++) {
+		wbuf[i] = (char)(i * 7);
+	}
+
+	/* a batch of writes and a NOP, in one call */
+	for (int i = 0; i < NBLOCKS; i++) {
+		queue(AIO_RING_OP_WRITE, fd, 0, BLOCK_SIZE, (uint64_t)i * BLOCK_SIZE,
+		    wbuf + i * BLOCK_SIZE, (uint64_t)i);
+	}
+	queue(AIO_RING_OP_NOP, -1, 0, 0, 0, NULL, 2 * NBLOCKS);
+	submit_and_wait(NBLOCKS + 1);
+	for (int i = 0; i < NBLOCKS + 1; i++) {
+		cqe = reap();
+		T_QUIET; T_ASSERT_LE(cqe.cqe_user_data, (uint64_t)(2 * NBLOCKS), "user data");
+		T_QUIET; T_ASSERT_FALSE(seen[cqe.cqe_user_data], "completed once");
+		seen[cqe.cqe_user_data] = true;
+		T_QUIET; T_ASSERT_EQ(cqe.cqe_res,
+		    cqe.cqe_user_data == 2 * NBLOCKS ? 0LL : (int64_t)BLOCK_SIZE,
+		    "result of %llu", cqe.cqe_user_data);
+	}
+	T_PASS("writes completed");
+
+	queue(AIO_RING_OP_FSYNC, fd, 0, 0, 0, NULL, 200);
+	submit_and_wait(1);
+	cqe = reap();
+	T_ASSERT_EQ(cqe.cqe_res, 0LL, "fsync completion");
+
+	/* a batch of reads, and one on a bad descriptor */
+	for (int i = 0; i < NBLOCKS; i++) {
+		queue(AIO_RING_OP_READ, fd, 0, BLOCK_SIZE, (uint64_t)i * BLOCK_SIZE,
+		    rbuf + i * BLOCK_SIZE, (uint64_t)(NBLOCKS + i));
+	}
+	queue(AIO_RING_OP_READ, -1, 0, BLOCK_SIZE, 0, rbuf, 300);
+	submit_and_wait(NBLOCKS + 1);
+	for (int i = 0; i < NBLOCKS + 1; i++) {
+		cqe = reap();
+		if (cqe.cqe_user_data == 300) {
+			T_ASSERT_EQ(cqe.cqe_res, (int64_t)-EBADF, "bad descriptor");
+			continue;
+		}
+		T_QUIET; T_ASSERT_EQ(cqe.cqe_res, (int64_t)BLOCK_SIZE,
+		    "read %llu", cqe.cqe_user_data);
+	}
+	T_ASSERT_EQ(memcmp(wbuf, rbuf, NBLOCKS * BLOCK_SIZE), 0, "read back what was written");
+
+	T_ASSERT_POSIX_SUCCESS(aio_ring_setup(NULL, 0, 0, 0), "unregister");
+	T_ASSERT_POSIX_FAILURE(aio_ring_enter(0, 0, 0), EINVAL, "no ring anymore");
+
+	close(fd);
+	unlink(path);
+	free(rbuf);
+	free(wbuf);
+	free(ring);
+}
@@ -0,0 +1,341 @@
+/*
+ * Fixed size messages between two threads, over an eventlink ring
+ * (mach_eventlink_ring_send()/mach_eventlink_ring_receive()) versus
+ * mach_msg.  Reports the round trip latency of a ping-pong, and the
+ * throughput of a one way stream, for both.
+ */
+#include <darwintest.h>
+#include <darwintest_utils.h>
+
+#include <mach/mach.h>
+#include <mach/mach_error.h>
+#include <mach/mach_eventlink.h>
+#include <mach/mach_time.h>
+#include <mach/mach_vm.h>
+#include <pthread.h>
+#include <string.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.ipc"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("IPC"),
+	T_META_CHECK_LEAKS(false),
+	T_META_RUN_CONCURRENTLY(false));
+
+#define MSG_SIZE        64
+#define RING_ENTRIES    1024
+#define PINGS           100000
+#define STREAM_MSGS     (1U << 21)
+
+struct payload {
+	uint64_t                        seq;
+	uint8_t                         data[MSG_SIZE - sizeof(uint64_t)];
+};
+
+struct inline_msg {
+	mach_msg_header_t               header;
+	struct payload                  payload;
+};
+
+struct inline_rcv_msg {
+	struct inline_msg               msg;
+	mach_msg_trailer_t              trailer;
+};
+
+/* one direction: a ring, and the eventlink ports of its two sides */
+struct channel {
+	struct mach_eventlink_ring      *ring;
+	mach_eventlink_ring_handle_t    producer_ring;
+	mach_eventlink_ring_handle_t    consumer_ring;
+	mach_port_t                     producer;
+	mach_port_t                     consumer;
+	mach_port_t                     port;   /* for mach_msg */
+};
+
+struct peer {
+	struct channel                  *in;
+	struct channel                  *out;
+	uint64_t                        count;
+};
+
+static double
+ns_between(uint64_t start, uint64_t end)
+{
+	static mach_timebase_info_data_t tb;
+
+	if (tb.denom == 0) {
+		mach_timebase_info(&tb);
+	}
+	return (double)(end - start) * tb.numer / tb.denom;
+}
+
+static void
+channel_init(struct channel *ch)
+{
+	mach_port_t pair[2];
+	mach_vm_address_t addr = 0;
+	mach_port_limits_t limits = { .mpl_qlimit = MACH_PORT_QLIMIT_MAX };
+
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_vm_allocate(mach_task_self(), &addr,
+	    MACH_EVENTLINK_RING_SIZE(RING_ENTRIES, MSG_SIZE), VM_FLAGS_ANYWHERE),
+	    "allocate the ring");
+	ch->ring = (struct mach_eventlink_ring *)addr;
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_eventlink_ring_init(&ch->producer_ring,
+	    ch->ring, RING_ENTRIES, MSG_SIZE), "mach_eventlink_ring_init");
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_eventlink_ring_attach(&ch->consumer_ring,
+	    ch->ring, RING_ENTRIES, MSG_SIZE), "mach_eventlink_ring_attach");
+
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_eventlink_create(mach_task_self(),
+	    MELC_OPTION_NO_COPYIN, pair), "mach_eventlink_create");
+	ch->producer = pair[0];
+	ch->consumer = pair[1];
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_eventlink_associate(ch->producer,
+	    MACH_PORT_NULL, 0, 0, 0, 0, MELA_OPTION_ASSOCIATE_ON_WAIT),
+	    "associate the producer");
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_eventlink_associate(ch->consumer,
+	    MACH_PORT_NULL, 0, 0, 0, 0, MELA_OPTION_ASSOCIATE_ON_WAIT),
+	    "associate the consumer");
+
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_port_allocate(mach_task_self(),
+	    MACH_PORT_RIGHT_RECEIVE, &ch->port), "mach_port_allocate");
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_port_insert_right(mach_task_self(),
+	    ch->port, ch->port, MACH_MSG_TYPE_MAKE_SEND), "mach_port_insert_right");
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_port_set_attributes(mach_task_self(),
+	    ch->port, MACH_PORT_LIMITS_INFO, (mach_port_info_t)&limits,
+	    MACH_PORT_LIMITS_INFO_COUNT), "queue limit");
+}
+
+static void
+channel_destroy(struct channel *ch)
+{
+	mach_eventlink_destroy(ch->producer);
+	mach_eventlink_destroy(ch->consumer);
+	mach_port_destruct(mach_task_self(), ch->port, -1, 0);
+	mach_vm_deallocate(mach_task_self(), (mach_vm_address_t)ch->ring,
+	    MACH_EVENTLINK_RING_SIZE(RING_ENTRIES, MSG_SIZE));
+}
+
+static void
+ring_send(struct channel *ch, uint64_t seq)
+{
+	struct payload p = { .seq = seq };
+
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_eventlink_ring_send(&ch->producer_ring,
+	    ch->producer, &p, MELSW_OPTION_NONE, 0), "mach_eventlink_ring_send");
+}
+
+static uint64_t
+ring_receive(struct channel *ch)
+{
+	struct payload p;
+
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_eventlink_ring_receive(&ch->consumer_ring,
+	    ch->consumer, &p, MELSW_OPTION_NONE, 0), "mach_eventlink_ring_receive");
+	return p.seq;
+}
+
+static void
+msg_send(struct channel *ch, uint64_t seq)
+{
+	struct inline_msg msg = {
+		.header = {
+			.msgh_bits = MACH_MSGH_BITS_SET(MACH_MSG_TYPE_COPY_SEND, 0, 0, 0),
+			.msgh_size = sizeof(msg),
+			.msgh_remote_port = ch->port,
+		},
+		.payload.seq = seq,
+	};
+
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_msg(&msg.header, MACH_SEND_MSG,
+	    sizeof(msg), 0, MACH_PORT_NULL, MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL),
+	    "mach_msg send");
+}
+
+static uint64_t
+msg_receive(struct channel *ch)
+{
+	struct inline_rcv_msg rcv = { };
+
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_msg(&rcv.msg.header, MACH_RCV_MSG,
+	    0, sizeof(rcv), ch->port, MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL),
+	    "mach_msg receive");
+	return rcv.msg.payload.seq;
+}
+
+static void *
+ring_echo(void *arg)
+{
+	struct peer *peer = arg;
+
+	for (uint64_t i = 0; i < peer->count; i++) {
+		ring_send(peer->out, ring_receive(peer->in));
+	}
+	return NULL;
+}
+
+static void *
+msg_echo(void *arg)
+{
+	struct peer *peer = arg;
+
+	for (uint64_t i = 0; i < peer->count; i++) {
+		msg_send(peer->out, msg_receive(peer->in));
+	}
+	return NULL;
+}
+
+static void *
+ring_drain(void *arg)
+{
+	struct peer *peer = arg;
+
+	for (uint64_t i = 0; i < peer->count; i++) {
+		T_QUIET; T_ASSERT_EQ(ring_receive(peer->in), i, "in order");
+	}
+	return NULL;
+}
+
+static void *
+msg_drain(void *arg)
+{
+	struct peer *peer = arg;
+
+	for (uint64_t i = 0; i < peer->count; i++) {
+		T_QUIET; T_ASSERT_EQ(msg_receive(peer->in), i, "in order");
+	}
+	return NULL;
+}
+
+static double
+ping_pong(bool ring)
+{
+	struct channel ping, pong;
+	struct peer peer = { .in = &ping, .out = &pong, .count = PINGS };
+	uint64_t start, end;
+	pthread_t thread;
+
+	channel_init(&ping);
+	channel_init(&pong);
+	T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&thread, NULL,
+	    ring ? ring_echo : msg_echo, &peer), "pthread_create");
+
+	start = mach_absolute_time();
+	for (uint64_t i = 0; i < PINGS; i++) {
+		uint64_t seq;
+
+		if (ring) {
+			ring_send(&ping, i);
+			seq = ring_receive(&pong);
+		} else {
+			msg_send(&ping, i);
+			seq = msg_receive(&pong);
+		}
+		T_QUIET; T_ASSERT_EQ(seq, i, "echoed");
+	}
+	end = mach_absolute_time();
+
+	T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(thread, NULL), "pthread_join");
+	channel_destroy(&ping);
+	channel_destroy(&pong);
+
+	return ns_between(start, end) / PINGS;
+}
+
+static double
+stream(bool ring)
+{
+	struct channel ch;
+	struct peer peer = { .in = &ch, .count = STREAM_MSGS };
+	uint64_t start, end;
+	pthread_t thread;
+
+	channel_init(&ch);
+	T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&thread, NULL,
+	    ring ? ring_drain : msg_drain, &peer), "pthread_create");
+
+	start = mach_absolute_time();
+	for (uint64_t i = 0; i < STREAM_MSGS; i++) {
+		if (ring) {
+			ring_send(&ch, i);
+		} else {
+			msg_send(&ch, i);
+		}
+	}
+	T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(thread, NULL), "pthread_join");
+	end = mach_absolute_time();
+
+	channel_destroy(&ch);
+
+	return STREAM_MSGS / (ns_between(start, end) / NSEC_PER_SEC);
+}
+
+T_DECL(eventlink_ring_semantics,
+    "eventlink rings are FIFO, bounded, and don't block with MELSW_OPTION_NO_WAIT")
+{
+	mach_eventlink_ring_handle_t handle;
+	struct channel ch;
+	struct payload p = { };
+
+	channel_init(&ch);
+
+	T_EXPECT_MACH_ERROR(mach_eventlink_ring_init(&handle, ch.ring, 3, MSG_SIZE),
+	    KERN_INVALID_ARGUMENT, "the number of entries must be a power of 2");
+	T_EXPECT_MACH_ERROR(mach_eventlink_ring_attach(&handle, ch.ring,
+	    RING_ENTRIES, MACH_EVENTLINK_RING_MAX_MSG_SIZE + 1),
+	    KERN_INVALID_ARGUMENT, "messages are bounded");
+	T_EXPECT_MACH_ERROR(mach_eventlink_ring_receive(&ch.consumer_ring, ch.consumer, &p,
+	    MELSW_OPTION_NO_WAIT, 0), KERN_OPERATION_TIMED_OUT,
+	    "receiving from an empty ring doesn't block");
+
+	for (uint64_t i = 0; i < RING_ENTRIES; i++) {
+		p.seq = i;
+		T_QUIET; T_ASSERT_MACH_SUCCESS(mach_eventlink_ring_send(&ch.producer_ring,
+		    ch.producer, &p, MELSW_OPTION_NO_WAIT, 0), "send %llu", i);
+	}
+	T_EXPECT_MACH_ERROR(mach_eventlink_ring_send(&ch.producer_ring, ch.producer, &p,
+	    MELSW_OPTION_NO_WAIT, 0), KERN_OPERATION_TIMED_OUT,
+	    "sending to a full ring doesn't block");
+
+	for (uint64_t i = 0; i < RING_ENTRIES; i++) {
+		T_QUIET; T_ASSERT_MACH_SUCCESS(mach_eventlink_ring_receive(&ch.consumer_ring,
+		    ch.consumer, &p, MELSW_OPTION_NO_WAIT, 0), "receive %llu", i);
+		T_QUIET; T_ASSERT_EQ(p.seq, i, "in order");
+	}
+	T_PASS("%u messages went through in order", RING_ENTRIES);
+
+	/* the producer's index is shared memory, the geometry isn't */
+	ch.ring->mer_tail = ch.ring->mer_head + 7 * RING_ENTRIES + 3;
+	for (int i = 0; i < 4; i++) {
+		T_QUIET; T_ASSERT_MACH_SUCCESS(mach_eventlink_ring_receive(&ch.consumer_ring,
+		    ch.consumer, &p, MELSW_OPTION_NO_WAIT, 0), "receive");
+	}
+	T_PASS("a bogus producer index only reads slots of the ring");
+
+	channel_destroy(&ch);
+}
+
+T_DECL(eventlink_ring_perf,
+    "eventlink ring versus mach_msg, round trip latency and one way throughput",
+    T_META_TAG_PERF)
+{
+	double ns, rate;
+
+	ns = ping_pong(false);
+	T_LOG("mach_msg ping-pong:       %8.0f ns", ns);
+	T_PERF("mach_msg_round_trip", ns, "ns", "mach_msg ping-pong between two threads");
+
+	ns = ping_pong(true);
+	T_LOG("eventlink ring ping-pong: %8.0f ns", ns);
+	T_PERF("eventlink_ring_round_trip", ns, "ns",
+	    "eventlink ring ping-pong between two threads");
+
+	rate = stream(false);
+	T_LOG("mach_msg stream:          %8.0f msgs/s", rate);
+	T_PERF("mach_msg_stream", rate, "msgs/s",
+	    "one way mach_msg stream of 64 byte messages");
+
+	rate = stream(true);
+	T_LOG("eventlink ring stream:    %8.0f msgs/s", rate);
+	T_PERF("eventlink_ring_stream", rate, "msgs/s",
+	    "one way eventlink ring stream of 64 byte messages");
+}
@@ -0,0 +1,302 @@
+/*
+ * mach_msg2() batches: per entry results, whole batch option checks, and
+ * what a sender gets back when one of its sends is interrupted.
+ */
+#include <darwintest.h>
+#include <darwintest_utils.h>
+
+#include <mach/mach.h>
+#include <mach/mach_error.h>
+#include <mach/message.h>
+
+#include <dispatch/dispatch.h>
+#include <pthread.h>
+#include <signal.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.ipc"),
+	T_META_RUN_CONCURRENTLY(TRUE),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("IPC"));
+
+/* Skip the whole test on armv7k */
+#if defined(__LP64__) || defined (__arm64__)
+
+#define BATCH_COUNT     4
+
+typedef struct {
+	mach_msg_header_t header;
+	uint64_t data;
+} inline_message_t;
+
+typedef struct {
+	inline_message_t msg;
+	mach_msg_max_trailer_t trailer;
+} msg_rcv_buffer_t;
+
+static mach_port_t
+make_port(mach_port_msgcount_t qlimit)
+{
+	mach_port_limits_t limits = { .mpl_qlimit = qlimit };
+	mach_port_t port;
+
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_port_allocate(mach_task_self(),
+	    MACH_PORT_RIGHT_RECEIVE, &port), "mach_port_allocate");
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_port_set_attributes(mach_task_self(),
+	    port, MACH_PORT_LIMITS_INFO, (mach_port_info_t)&limits,
+	    MACH_PORT_LIMITS_INFO_COUNT), "mach_port_set_attributes");
+	return port;
+}
+
+static mach_port_msgcount_t
+queued_messages(mach_port_t port)
+{
+	mach_port_status_t status;
+	mach_msg_type_number_t count = MACH_PORT_RECEIVE_STATUS_COUNT;
+
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_port_get_attributes(mach_task_self(),
+	    port, MACH_PORT_RECEIVE_STATUS, (mach_port_info_t)&status, &count),
+	    "mach_port_get_attributes");
+	return status.mps_msgcount;
+}
+
+static void
+init_batch(mach_msg_batch_entry_t *entries, inline_message_t *msgs,
+    msg_rcv_buffer_t *rcv_bufs, mach_port_t port)
+{
+	for (int i = 0; i < BATCH_COUNT; i++) {
+		msgs[i] = (inline_message_t){
+			.header = {
+				.msgh_bits = MACH_MSGH_BITS_SET(MACH_MSG_TYPE_MAKE_SEND, 0, 0, 0),
+				.msgh_size = sizeof(inline_message_t),
+				.msgh_remote_port = port,
+				.msgh_id = i,
+			},
+			.data = 0xdeadcafe00000000ull | (uint64_t)i,
+		};
+		entries[i] = (mach_msg_batch_entry_t){
+			.msgb_data = (mach_vm_address_t)&msgs[i],
+			.msgb_rcv_addr = rcv_bufs ? (mach_vm_address_t)&rcv_bufs[i] : 0,
+			.msgb_send_size = sizeof(inline_message_t),
+			.msgb_rcv_size = sizeof(msg_rcv_buffer_t),
+			.msgb_send_return = MACH_MSG_SUCCESS - 1,
+			.msgb_rcv_return = MACH_MSG_SUCCESS - 1,
+		};
+	}
+}
+
+/*
+ * Receives whatever is queued on `port` with one batch, and checks that
+ * the messages are the ones in `ids`, in order.
+ */
+static void
+receive_ids(mach_port_t port, const mach_msg_id_t *ids, int nids)
+{
+	mach_msg_batch_entry_t entries[BATCH_COUNT];
+	inline_message_t msgs[BATCH_COUNT];
+	msg_rcv_buffer_t rcv_bufs[BATCH_COUNT];
+	mach_msg_return_t mr;
+
+	init_batch(entries, msgs, rcv_bufs, port);
+	mr = mach_msg2_batch(entries, MACH64_RCV_MSG | MACH64_RCV_TIMEOUT,
+	    0, BATCH_COUNT, port, 1000, 0);
+	T_EXPECT_MACH_ERROR(mr, nids ? MACH_MSG_SUCCESS : MACH_RCV_TIMED_OUT,
+	    "batch receive of %d messages", nids);
+
+	for (int i = 0; i < BATCH_COUNT; i++) {
+		if (i < nids) {
+			T_EXPECT_MACH_SUCCESS(entries[i].msgb_rcv_return,
+			    "entry %d received", i);
+			T_EXPECT_EQ(rcv_bufs[i].msg.header.msgh_id, ids[i],
+			    "entry %d received message %d", i, ids[i]);
+			T_EXPECT_EQ(rcv_bufs[i].msg.data,
+			    0xdeadcafe00000000ull | (uint64_t)ids[i],
+			    "entry %d carries the data of message %d", i, ids[i]);
+		} else {
+			T_EXPECT_MACH_ERROR(entries[i].msgb_rcv_return,
+			    MACH_RCV_TIMED_OUT, "nothing received into entry %d", i);
+		}
+	}
+}
+
+T_DECL(mach_msg2_batch_send_receive,
+    "send and receive a batch of messages in one mach_msg2() call")
+{
+	mach_msg_batch_entry_t entries[BATCH_COUNT];
+	inline_message_t msgs[BATCH_COUNT];
+	msg_rcv_buffer_t rcv_bufs[BATCH_COUNT];
+	mach_port_t port = make_port(MACH_PORT_QLIMIT_DEFAULT);
+	mach_msg_return_t mr;
+
+	init_batch(entries, msgs, rcv_bufs, port);
+	mr = mach_msg2_batch(entries, MACH64_SEND_MSG | MACH64_SEND_MQ_CALL |
+	    MACH64_RCV_MSG | MACH64_RCV_TIMEOUT,
+	    BATCH_COUNT, BATCH_COUNT, port, 1000, 0);
+	T_ASSERT_MACH_SUCCESS(mr, "mach_msg2_batch");
+
+	for (int i = 0; i < BATCH_COUNT; i++) {
+		T_EXPECT_MACH_SUCCESS(entries[i].msgb_send_return, "entry %d sent", i);
+		T_EXPECT_MACH_SUCCESS(entries[i].msgb_rcv_return, "entry %d received", i);
+		T_EXPECT_EQ(rcv_bufs[i].msg.header.msgh_id, i,
+		    "messages are received in the order they were sent");
+	}
+	T_EXPECT_EQ(queued_messages(port), 0, "the batch drained the queue");
+
+	mach_port_mod_refs(mach_task_self(), port, MACH_PORT_RIGHT_RECEIVE, -1);
+}
+
+T_DECL(mach_msg2_batch_entry_errors,
+    "a bad message in the middle of a batch only fails its own entry")
+{
+	mach_msg_batch_entry_t entries[BATCH_COUNT];
+	inline_message_t msgs[BATCH_COUNT];
+	msg_rcv_buffer_t rcv_bufs[BATCH_COUNT];
+	mach_port_t port = make_port(MACH_PORT_QLIMIT_DEFAULT);
+	const mach_msg_id_t sent[] = { 0, 3 };
+	mach_msg_return_t mr;
+
+	init_batch(entries, msgs, rcv_bufs, port);
+	/* entry 1 is too small to hold a header, entry 2 has no destination */
+	entries[1].msgb_send_size = sizeof(uint32_t);
+	msgs[2].header.msgh_remote_port = MACH_PORT_NULL;
+
+	mr = mach_msg2_batch(entries, MACH64_SEND_MSG | MACH64_SEND_MQ_CALL |
+	    MACH64_RCV_MSG | MACH64_RCV_TIMEOUT,
+	    BATCH_COUNT, BATCH_COUNT, port, 1000, 0);
+	T_EXPECT_MACH_ERROR(mr, MACH_SEND_MSG_TOO_SMALL,
+	    "the batch returns its first send error");
+
+	T_EXPECT_MACH_SUCCESS(entries[0].msgb_send_return, "entry 0 sent");
+	T_EXPECT_MACH_ERROR(entries[1].msgb_send_return, MACH_SEND_MSG_TOO_SMALL,
+	    "entry 1 too small");
+	T_EXPECT_MACH_ERROR(entries[2].msgb_send_return, MACH_SEND_INVALID_DEST,
+	    "entry 2 has an invalid destination");
+	T_EXPECT_MACH_SUCCESS(entries[3].msgb_send_return,
+	    "entry 3 sent after the failed ones");
+	for (int i = 0; i < BATCH_COUNT; i++) {
+		T_EXPECT_MACH_ERROR(entries[i].msgb_rcv_return, MACH_RCV_TIMED_OUT,
+		    "a failed send skips the receive of entry %d", i);
+	}
+
+	receive_ids(port, sent, 2);
+
+	mach_port_mod_refs(mach_task_self(), port, MACH_PORT_RIGHT_RECEIVE, -1);
+}
+
+T_DECL(mach_msg2_batch_invalid_options,
+    "options batches don't support fail the call before anything is sent")
+{
+	mach_msg_batch_entry_t entries[MACH_MSG_BATCH_MAX_COUNT + 1] = {};
+	inline_message_t msgs[BATCH_COUNT];
+	mach_port_t port = make_port(MACH_PORT_QLIMIT_DEFAULT);
+	mach_msg_return_t mr;
+
+	init_batch(entries, msgs, NULL, port);
+	mr = mach_msg2_batch(entries, MACH64_SEND_MSG | MACH64_SEND_MQ_CALL |
+	    MACH64_MSG_VECTOR, BATCH_COUNT, 0, MACH_PORT_NULL, 0, 0);
+	T_EXPECT_MACH_ERROR(mr, MACH_SEND_INVALID_OPTIONS, "vector batch");
+
+	mr = mach_msg2_batch(entries, MACH64_SEND_MSG | MACH64_SEND_KOBJECT_CALL,
+	    BATCH_COUNT, 0, MACH_PORT_NULL, 0, 0);
+	T_EXPECT_MACH_ERROR(mr, MACH_SEND_INVALID_OPTIONS, "kobject call batch");
+
+	mr = mach_msg2_batch(entries, MACH64_SEND_MSG | MACH64_SEND_MQ_CALL |
+	    MACH64_RCV_MSG | MACH64_RCV_SYNC_WAIT, BATCH_COUNT, BATCH_COUNT,
+	    port, 0, 0);
+	T_EXPECT_MACH_ERROR(mr, MACH_SEND_INVALID_OPTIONS, "sync wait batch");
+
+	mr = mach_msg2_batch(entries, MACH64_SEND_MSG | MACH64_SEND_MQ_CALL,
+	    MACH_MSG_BATCH_MAX_COUNT + 1, 0, MACH_PORT_NULL, 0, 0);
+	T_EXPECT_MACH_ERROR(mr, MACH_SEND_INVALID_DATA, "oversized batch");
+
+	for (int i = 0; i < BATCH_COUNT; i++) {
+		T_EXPECT_EQ(entries[i].msgb_send_return, MACH_MSG_SUCCESS - 1,
+		    "entry %d left untouched", i);
+	}
+	T_EXPECT_EQ(queued_messages(port), 0, "nothing was sent");
+
+	mach_port_mod_refs(mach_task_self(), port, MACH_PORT_RIGHT_RECEIVE, -1);
+}
+
+struct interrupted_sender {
+	mach_port_t                     port;
+	mach_msg_batch_entry_t          entries[BATCH_COUNT];
+	inline_message_t                msgs[BATCH_COUNT];
+	mach_msg_return_t               mr;
+	dispatch_semaphore_t            done;
+};
+
+static void
+interrupt_handler(int sig)
+{
+	(void)sig;
+}
+
+static void *
+interrupted_sender_thread(void *arg)
+{
+	struct interrupted_sender *s = arg;
+
+	s->mr = mach_msg2_batch(s->entries, MACH64_SEND_MSG | MACH64_SEND_MQ_CALL,
+	    BATCH_COUNT, 0, MACH_PORT_NULL, 0, 0);
+	dispatch_semaphore_signal(s->done);
+	return NULL;
+}
+
+T_DECL(mach_msg2_batch_interrupted,
+    "an interrupted send stops the batch, and the sends before it are kept")
+{
+	struct interrupted_sender s = {
+		.port = make_port(2),
+		.done = dispatch_semaphore_create(0),
+	};
+	struct sigaction sa = { .sa_handler = interrupt_handler };
+	const mach_msg_id_t sent[] = { 0, 1 };
+	pthread_t thread;
+	int tries;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sigaction(SIGUSR1, &sa, NULL), "sigaction");
+
+	init_batch(s.entries, s.msgs, NULL, s.port);
+	T_ASSERT_POSIX_ZERO(pthread_create(&thread, NULL,
+	    interrupted_sender_thread, &s), "pthread_create");
+
+	/* the queue holds 2 messages, the third send blocks */
+	while (queued_messages(s.port) < 2) {
+		usleep(1000);
+	}
+	for (tries = 0; tries < 100; tries++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_kill(thread, SIGUSR1),
+		    "pthread_kill");
+		if (dispatch_semaphore_wait(s.done,
+		    dispatch_time(DISPATCH_TIME_NOW, 10 * NSEC_PER_MSEC)) == 0) {
+			break;
+		}
+	}
+	T_ASSERT_LT(tries, 100, "the blocked send was interrupted");
+	T_ASSERT_POSIX_ZERO(pthread_join(thread, NULL), "pthread_join");
+
+	T_EXPECT_MACH_ERROR(s.mr, MACH_SEND_INTERRUPTED, "mach_msg2_batch");
+	T_EXPECT_MACH_SUCCESS(s.entries[0].msgb_send_return, "entry 0 sent");
+	T_EXPECT_MACH_SUCCESS(s.entries[1].msgb_send_return, "entry 1 sent");
+	T_EXPECT_MACH_ERROR(s.entries[2].msgb_send_return, MACH_SEND_INTERRUPTED,
+	    "entry 2 was interrupted");
+	T_EXPECT_MACH_ERROR(s.entries[3].msgb_send_return, MACH_SEND_INTERRUPTED,
+	    "entry 3 wasn't attempted");
+
+	/* only the two messages sent before the interruption were queued */
+	receive_ids(s.port, sent, 2);
+
+	mach_port_mod_refs(mach_task_self(), s.port, MACH_PORT_RIGHT_RECEIVE, -1);
+	dispatch_release(s.done);
+}
+
+#else /* defined(__LP64__) || defined (__arm64__) */
+
+T_DECL(mach_msg2_batch_send_receive,
+    "send and receive a batch of messages in one mach_msg2() call")
+{
+	T_SKIP("This test is skipped on armv7k.");
+}
+
+#endif /* defined(__LP64__) || defined (__arm64__) */
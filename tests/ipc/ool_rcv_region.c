@@ -0,0 +1,240 @@
+/*
+ * Large out-of-line transfers, mapped at a new address by every receive
+ * versus overwritten into a region passed with MACH64_RCV_OOL_REGION.
+ * Reports the throughput of both from 16KB to 64MB, and checks that the
+ * region only applies to the receives that pass it.
+ */
+#include <darwintest.h>
+#include <darwintest_utils.h>
+
+#include <mach/mach.h>
+#include <mach/mach_error.h>
+#include <mach/mach_time.h>
+#include <mach/mach_vm.h>
+#include <string.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.ipc"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("IPC"),
+	T_META_CHECK_LEAKS(false),
+	T_META_RUN_CONCURRENTLY(false));
+
+#define MIN_SIZE        (16UL << 10)
+#define MAX_SIZE        (64UL << 20)
+#define BYTES_PER_SIZE  (1UL << 30)
+#define MIN_ITERATIONS  16
+
+struct ool_msg {
+	mach_msg_header_t               header;
+	mach_msg_body_t                 body;
+	mach_msg_ool_descriptor_t       ool;
+};
+
+struct ool_rcv_msg {
+	struct ool_msg                  msg;
+	mach_msg_trailer_t              trailer;
+};
+
+static void
+send_ool(mach_port_t port, void *buf, size_t size)
+{
+	struct ool_msg msg = {
+		.header = {
+			.msgh_bits = MACH_MSGH_BITS_SET(MACH_MSG_TYPE_MAKE_SEND,
+			    0, 0, MACH_MSGH_BITS_COMPLEX),
+			.msgh_size = sizeof(msg),
+			.msgh_remote_port = port,
+		},
+		.body.msgh_descriptor_count = 1,
+		.ool = {
+			.address = buf,
+			.size = (mach_msg_size_t)size,
+			.deallocate = false,
+			.copy = MACH_MSG_VIRTUAL_COPY,
+			.type = MACH_MSG_OOL_DESCRIPTOR,
+		},
+	};
+
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_msg(&msg.header, MACH_SEND_MSG,
+	    sizeof(msg), 0, MACH_PORT_NULL, MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL),
+	    "send %zu bytes", size);
+}
+
+static mach_msg_return_t
+receive_ool_into(mach_port_t port, mach_vm_address_t region,
+    mach_msg_size_t region_size, mach_msg_ool_descriptor_t *ool)
+{
+	struct ool_rcv_msg rcv = { };
+	mach_msg_vector_t vecs[MACH_MSGV_MAX_COUNT] = {
+		[MACH_MSGV_IDX_MSG] = {
+			.msgv_data = (mach_vm_address_t)&rcv,
+			.msgv_rcv_size = sizeof(rcv),
+		},
+		/* no aux data, the aux vector only holds its place */
+		[MACH_MSGV_IDX_OOL_REGION] = {
+			.msgv_rcv_addr = region,
+			.msgv_rcv_size = region_size,
+		},
+	};
+	mach_msg_return_t mr;
+
+	mr = mach_msg2(vecs, MACH64_RCV_MSG | MACH64_MSG_VECTOR |
+	    MACH64_RCV_OOL_REGION, MACH_MSG_HEADER_EMPTY, 0, MACH_MSGV_MAX_COUNT,
+	    port, 0, 0);
+	*ool = rcv.msg.ool;
+	return mr;
+}
+
+static mach_msg_ool_descriptor_t
+receive_ool(mach_port_t port, mach_vm_address_t region)
+{
+	struct ool_rcv_msg rcv = { };
+
+	if (region) {
+		mach_msg_ool_descriptor_t ool;
+
+		T_QUIET; T_ASSERT_MACH_SUCCESS(receive_ool_into(port, region,
+		    (mach_msg_size_t)MAX_SIZE, &ool), "receive into the region");
+		return ool;
+	}
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_msg(&rcv.msg.header, MACH_RCV_MSG,
+	    0, sizeof(rcv), port, MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL),
+	    "receive");
+	return rcv.msg.ool;
+}
+
+static double
+transfer(mach_port_t port, char *buf, size_t size, mach_vm_address_t region)
+{
+	size_t iterations = BYTES_PER_SIZE / size;
+	uint64_t start, end;
+	mach_timebase_info_data_t tb;
+
+	if (iterations < MIN_ITERATIONS) {
+		iterations = MIN_ITERATIONS;
+	}
+	mach_timebase_info(&tb);
+	start = mach_absolute_time();
+	for (size_t i = 0; i < iterations; i++) {
+		mach_msg_ool_descriptor_t ool;
+
+		/* dirty the buffer, so that every send has to copy-on-write again */
+		buf[0] = (char)i;
+		send_ool(port, buf, size);
+		ool = receive_ool(port, region);
+
+		T_QUIET; T_ASSERT_EQ((size_t)ool.size, size, "received size");
+		T_QUIET; T_ASSERT_EQ(((char *)ool.address)[0], (char)i, "received data");
+		if (region) {
+			T_QUIET; T_ASSERT_EQ((mach_vm_address_t)ool.address, region,
+			    "received into the region");
+			T_QUIET; T_ASSERT_FALSE(ool.deallocate, "region memory isn't deallocated");
+		} else {
+			T_QUIET; T_ASSERT_MACH_SUCCESS(mach_vm_deallocate(mach_task_self(),
+			    (mach_vm_address_t)ool.address, ool.size), "mach_vm_deallocate");
+		}
+	}
+	end = mach_absolute_time();
+
+	return (double)(size * iterations) / (1 << 20) /
+	       ((double)(end - start) * tb.numer / tb.denom / NSEC_PER_SEC);
+}
+
+T_DECL(ool_rcv_region_throughput,
+    "out-of-line transfers from 16KB to 64MB, with and without a receive region",
+    T_META_TAG_PERF)
+{
+	mach_vm_address_t region = 0;
+	mach_port_t port;
+	char *buf;
+
+	T_ASSERT_MACH_SUCCESS(mach_port_allocate(mach_task_self(),
+	    MACH_PORT_RIGHT_RECEIVE, &port), "mach_port_allocate");
+	T_ASSERT_MACH_SUCCESS(mach_vm_allocate(mach_task_self(),
+	    (mach_vm_address_t *)&buf, MAX_SIZE, VM_FLAGS_ANYWHERE), "source buffer");
+	memset(buf, 'x', MAX_SIZE);
+	T_ASSERT_MACH_SUCCESS(mach_vm_allocate(mach_task_self(), &region,
+	    MAX_SIZE, VM_FLAGS_ANYWHERE), "receive region");
+
+	for (size_t size = MIN_SIZE; size <= MAX_SIZE; size <<= 2) {
+		char name[64];
+		double mbps;
+
+		mbps = transfer(port, buf, size, 0);
+		T_LOG("%8zuKB copyout:        %8.1f MB/s", size >> 10, mbps);
+		snprintf(name, sizeof(name), "ool_copyout_%zuKB", size >> 10);
+		T_PERF(name, mbps, "MB/s", "OOL throughput, mapped at a new address");
+
+		mbps = transfer(port, buf, size, region);
+		T_LOG("%8zuKB receive region: %8.1f MB/s", size >> 10, mbps);
+		snprintf(name, sizeof(name), "ool_rcv_region_%zuKB", size >> 10);
+		T_PERF(name, mbps, "MB/s", "OOL throughput, into a receive region");
+	}
+
+	mach_vm_deallocate(mach_task_self(), region, MAX_SIZE);
+	mach_vm_deallocate(mach_task_self(), (mach_vm_address_t)buf, MAX_SIZE);
+	mach_port_mod_refs(mach_task_self(), port, MACH_PORT_RIGHT_RECEIVE, -1);
+}
+
+T_DECL(ool_rcv_region_per_receive,
+    "the receive region only applies to the receive that passes it, "
+    "and memory that can't be written there is dropped")
+{
+	size_t size = 1UL << 20;
+	mach_msg_ool_descriptor_t ool;
+	mach_vm_address_t region = 0;
+	mach_port_t port;
+	char *buf;
+
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_port_allocate(mach_task_self(),
+	    MACH_PORT_RIGHT_RECEIVE, &port), "mach_port_allocate");
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_vm_allocate(mach_task_self(),
+	    (mach_vm_address_t *)&buf, size, VM_FLAGS_ANYWHERE), "source buffer");
+	memset(buf, 'x', size);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_vm_allocate(mach_task_self(), &region,
+	    size, VM_FLAGS_ANYWHERE), "receive region");
+
+	send_ool(port, buf, size);
+	T_ASSERT_MACH_SUCCESS(receive_ool_into(port, region,
+	    (mach_msg_size_t)size, &ool), "receive into the region");
+	T_EXPECT_EQ((mach_vm_address_t)ool.address, region, "received into the region");
+	T_EXPECT_FALSE(ool.deallocate, "region memory isn't deallocated");
+
+	/* the next receive doesn't pass a region, and gets a new mapping */
+	send_ool(port, buf, size);
+	ool = receive_ool(port, 0);
+	T_EXPECT_NE((mach_vm_address_t)ool.address, region,
+	    "a receive without a region doesn't use the last one");
+	T_EXPECT_TRUE(ool.deallocate, "memory at a new address is deallocated");
+	T_EXPECT_EQ(((char *)ool.address)[size - 1], 'x', "received data");
+	mach_vm_deallocate(mach_task_self(), (mach_vm_address_t)ool.address, ool.size);
+
+	/* memory that can't be written to the region is dropped */
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_vm_protect(mach_task_self(), region,
+	    size, FALSE, VM_PROT_READ), "make the region read-only");
+	send_ool(port, buf, size);
+	T_EXPECT_MACH_ERROR(receive_ool_into(port, region,
+	    (mach_msg_size_t)size, &ool), MACH_RCV_BODY_ERROR | MACH_MSG_VM_SPACE,
+	    "receive into a read-only region");
+	T_EXPECT_EQ((mach_vm_address_t)ool.address, 0ull, "no memory was received");
+	T_EXPECT_EQ((size_t)ool.size, (size_t)0, "received size");
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_vm_protect(mach_task_self(), region,
+	    size, FALSE, VM_PROT_READ | VM_PROT_WRITE), "make the region writable again");
+
+	/* bad regions fail the receive before the message is dequeued */
+	send_ool(port, buf, size);
+	T_EXPECT_MACH_ERROR(receive_ool_into(port, region + 1,
+	    (mach_msg_size_t)size, &ool), MACH_RCV_INVALID_ARGUMENTS,
+	    "unaligned regions are rejected");
+	T_EXPECT_MACH_ERROR(mach_msg2(&ool, MACH64_RCV_MSG | MACH64_RCV_OOL_REGION,
+	    MACH_MSG_HEADER_EMPTY, 0, sizeof(ool), port, 0, 0),
+	    MACH_RCV_INVALID_ARGUMENTS, "regions need a vector receive");
+	ool = receive_ool(port, 0);
+	T_EXPECT_TRUE(ool.deallocate, "the message was still queued");
+	mach_vm_deallocate(mach_task_self(), (mach_vm_address_t)ool.address, ool.size);
+
+	mach_vm_deallocate(mach_task_self(), region, size);
+	mach_vm_deallocate(mach_task_self(), (mach_vm_address_t)buf, size);
+	mach_port_mod_refs(mach_task_self(), port, MACH_PORT_RIGHT_RECEIVE, -1);
+}
@@ -0,0 +1,276 @@
+/*
+ * Allocation of a large number of receive rights in one space.
+ *
+ * Allocates up to 1M names, or 7/8 of machdep.max_port_table_size when
+ * that is smaller, and reports the allocation rate at every power of 4,
+ * as well as the slowest single allocation, which includes the growth
+ * of the entry table.
+ *
+ * Also checks that, as the table grows by chunks and its reverse hash
+ * is resized, names stay valid and send rights keep their names.
+ */
+#include <darwintest.h>
+#include <darwintest_utils.h>
+
+#include <mach/mach.h>
+#include <mach/mach_error.h>
+#include <mach/mach_time.h>
+#include <stdlib.h>
+#include <sys/param.h>
+#include <sys/sysctl.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.ipc"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("IPC"),
+	T_META_CHECK_LEAKS(false),
+	T_META_RUN_CONCURRENTLY(false));
+
+#define MAX_NAMES               (1U << 20)
+#define MIN_MILESTONE           (1U << 10)
+/* without the sysctl (release kernels), stay well within the default limit */
+#define DEFAULT_NAMES           (1U << 16)
+/* crosses 32 chunks and 10 resizes of the reverse hash */
+#define REHASH_NAMES            (1U << 15)
+#define REHASH_STRIDE           (1U << 10)
+
+static uint32_t
+max_names(void)
+{
+	uint32_t count = MAX_NAMES;
+	size_t size = sizeof(int);
+	int limit = 0;
+
+	if (sysctlbyname("machdep.max_port_table_size", &limit, &size, NULL, 0) != 0) {
+		T_LOG("machdep.max_port_table_size unavailable, allocating %u names",
+		    DEFAULT_NAMES);
+		return DEFAULT_NAMES;
+	}
+	T_LOG("machdep.max_port_table_size = %d", limit);
+
+	/* stay away from the limit, to not trigger port space resource exceptions */
+	if (limit > 0 && (uint32_t)limit / 8 * 7 < count) {
+		count = (uint32_t)limit / 8 * 7;
+	}
+	return count;
+}
+
+static double
+ns_between(uint64_t start, uint64_t end)
+{
+	static mach_timebase_info_data_t tb;
+
+	if (tb.denom == 0) {
+		mach_timebase_info(&tb);
+	}
+	return (double)(end - start) * tb.numer / tb.denom;
+}
+
+T_DECL(port_alloc_throughput,
+    "receive right allocation rate, up to 1M names in one space",
+    T_META_TAG_PERF)
+{
+	uint32_t count = max_names();
+	uint32_t milestone = MIN_MILESTONE;
+	uint32_t allocated = 0;
+	mach_port_name_t *names;
+	uint64_t start, last, prev = 0;
+	double slowest = 0;
+
+	names = calloc(count, sizeof(*names));
+	T_QUIET; T_ASSERT_NOTNULL(names, "calloc");
+
+	start = last = mach_absolute_time();
+	while (allocated < count) {
+		kern_return_t kr;
+		uint64_t now;
+		double ns;
+
+		kr = mach_port_allocate(mach_task_self(), MACH_PORT_RIGHT_RECEIVE,
+		    &names[allocated]);
+		now = mach_absolute_time();
+		if (kr != KERN_SUCCESS) {
+			T_LOG("mach_port_allocate failed after %u names: %s",
+			    allocated, mach_error_string(kr));
+			break;
+		}
+		allocated++;
+
+		ns = ns_between(last, now);
+		if (ns > slowest) {
+			slowest = ns;
+		}
+		last = now;
+
+		if (allocated == milestone || allocated == count) {
+			char name[64];
+			double rate;
+
+			rate = (allocated - prev) / (ns_between(start, now) / NSEC_PER_SEC);
+			T_LOG("%8u names: %10.0f allocations/s", allocated, rate);
+			snprintf(name, sizeof(name), "port_alloc_rate_%u", allocated);
+			T_PERF(name, rate, "allocations/s",
+			    "receive rights allocated per second, since the previous milestone");
+			milestone <<= 2;
+			prev = allocated;
+			start = mach_absolute_time();
+			last = start;
+		}
+	}
+
+	T_EXPECT_GE(allocated, count / 2, "allocated %u names", allocated);
+	T_LOG("slowest allocation: %.0f ns", slowest);
+	T_PERF("port_alloc_max_latency", slowest, "ns",
+	    "slowest single receive right allocation, including table growth");
+
+	for (uint32_t i = 0; i < allocated; i++) {
+		T_QUIET; T_ASSERT_MACH_SUCCESS(mach_port_mod_refs(mach_task_self(),
+		    names[i], MACH_PORT_RIGHT_RECEIVE, -1), "mach_port_mod_refs");
+	}
+	free(names);
+}
+
+/*
+ * Sends the receive right for name to holder, in a message left queued,
+ * leaving a pure send right (which is in the reverse hash) named name.
+ */
+static void
+move_receive_right(mach_port_t holder, mach_port_name_t name)
+{
+	struct {
+		mach_msg_header_t          header;
+		mach_msg_body_t            body;
+		mach_msg_port_descriptor_t port;
+	} msg = {
+		.header = {
+			.msgh_bits = MACH_MSGH_BITS_SET(MACH_MSG_TYPE_MAKE_SEND,
+			    0, 0, MACH_MSGH_BITS_COMPLEX),
+			.msgh_size = sizeof(msg),
+			.msgh_remote_port = holder,
+		},
+		.body.msgh_descriptor_count = 1,
+		.port = {
+			.name = name,
+			.disposition = MACH_MSG_TYPE_MOVE_RECEIVE,
+			.type = MACH_MSG_PORT_DESCRIPTOR,
+		},
+	};
+
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_msg(&msg.header, MACH_SEND_MSG,
+	    sizeof(msg), 0, MACH_PORT_NULL, MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL),
+	    "move the receive right for %#x", name);
+}
+
+/*
+ * Sends a copy of the send right for name through echo and receives it
+ * back: the copyout finds the existing right with the reverse hash,
+ * and returns its name.
+ */
+static mach_port_name_t
+copyout_send_right(mach_port_t echo, mach_port_name_t name)
+{
+	struct {
+		mach_msg_header_t  header;
+		mach_msg_trailer_t trailer;
+	} msg = {
+		.header = {
+			.msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_MAKE_SEND,
+			    MACH_MSG_TYPE_COPY_SEND),
+			.msgh_size = sizeof(msg.header),
+			.msgh_remote_port = echo,
+			.msgh_local_port = name,
+		},
+	};
+
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_msg(&msg.header,
+	    MACH_SEND_MSG | MACH_RCV_MSG, sizeof(msg.header), sizeof(msg), echo,
+	    MACH_MSG_TIMEOUT_NONE, MACH_PORT_NULL), "send and receive %#x", name);
+	/* the copyout added a user reference */
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_port_deallocate(mach_task_self(),
+	    msg.header.msgh_remote_port), "mach_port_deallocate");
+	return msg.header.msgh_remote_port;
+}
+
+static void
+check_send_rights(mach_port_t echo, const mach_port_name_t *sends, uint32_t nsends)
+{
+	for (uint32_t i = 0; i < nsends; i++) {
+		mach_port_type_t type;
+
+		T_QUIET; T_ASSERT_MACH_SUCCESS(mach_port_type(mach_task_self(),
+		    sends[i], &type), "mach_port_type(%#x)", sends[i]);
+		T_QUIET; T_ASSERT_EQ(type, MACH_PORT_TYPE_SEND,
+		    "%#x is a send right", sends[i]);
+		T_QUIET; T_ASSERT_EQ(copyout_send_right(echo, sends[i]), sends[i],
+		    "a copy of the send right for %#x keeps its name", sends[i]);
+	}
+}
+
+T_DECL(port_alloc_reverse_hash,
+    "names and send rights survive entry table and reverse hash growth")
+{
+	mach_port_options_t opts = {
+		.flags = MPO_QLIMIT,
+		.mpl.mpl_qlimit = MACH_PORT_QLIMIT_LARGE,
+	};
+	uint32_t count = MIN(max_names(), REHASH_NAMES);
+	uint32_t nsends = 0;
+	mach_port_name_t *names, *sends;
+	mach_port_t holder, echo;
+
+	names = calloc(count, sizeof(*names));
+	sends = calloc(count / REHASH_STRIDE + 1, sizeof(*sends));
+	T_QUIET; T_ASSERT_NOTNULL(names, "calloc");
+	T_QUIET; T_ASSERT_NOTNULL(sends, "calloc");
+
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_port_construct(mach_task_self(),
+	    &opts, 0, &holder), "mach_port_construct");
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_port_allocate(mach_task_self(),
+	    MACH_PORT_RIGHT_RECEIVE, &echo), "mach_port_allocate");
+
+	for (uint32_t i = 0; i < count; i++) {
+		T_QUIET; T_ASSERT_MACH_SUCCESS(mach_port_allocate(mach_task_self(),
+		    MACH_PORT_RIGHT_RECEIVE, &names[i]), "mach_port_allocate");
+
+		if (i % REHASH_STRIDE == 0) {
+			mach_port_name_t name;
+
+			/* a send right in each chunk, hashed before the next growth */
+			T_QUIET; T_ASSERT_MACH_SUCCESS(mach_port_allocate(mach_task_self(),
+			    MACH_PORT_RIGHT_RECEIVE, &name), "mach_port_allocate");
+			T_QUIET; T_ASSERT_MACH_SUCCESS(mach_port_insert_right(mach_task_self(),
+			    name, name, MACH_MSG_TYPE_MAKE_SEND), "mach_port_insert_right");
+			move_receive_right(holder, name);
+			sends[nsends++] = name;
+
+			check_send_rights(echo, sends, nsends);
+		}
+	}
+	T_LOG("allocated %u names, with %u send rights", count, nsends);
+
+	check_send_rights(echo, sends, nsends);
+	T_PASS("%u send rights kept their names", nsends);
+
+	for (uint32_t i = 0; i < count; i++) {
+		mach_port_type_t type;
+
+		T_QUIET; T_ASSERT_MACH_SUCCESS(mach_port_type(mach_task_self(),
+		    names[i], &type), "mach_port_type(%#x)", names[i]);
+		T_QUIET; T_ASSERT_EQ(type, MACH_PORT_TYPE_RECEIVE,
+		    "%#x is a receive right", names[i]);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(mach_port_mod_refs(mach_task_self(),
+		    names[i], MACH_PORT_RIGHT_RECEIVE, -1), "mach_port_mod_refs");
+	}
+	T_PASS("%u names allocated while the table grew still resolve", count);
+
+	for (uint32_t i = 0; i < nsends; i++) {
+		T_QUIET; T_ASSERT_MACH_SUCCESS(mach_port_deallocate(mach_task_self(),
+		    sends[i]), "mach_port_deallocate");
+	}
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_port_mod_refs(mach_task_self(),
+	    holder, MACH_PORT_RIGHT_RECEIVE, -1), "mach_port_mod_refs");
+	T_QUIET; T_ASSERT_MACH_SUCCESS(mach_port_mod_refs(mach_task_self(),
+	    echo, MACH_PORT_RIGHT_RECEIVE, -1), "mach_port_mod_refs");
+	free(sends);
+	free(names);
+}
@@ -0,0 +1,297 @@
+/*
+ * Workloop servicing of thousands of pipe and socket read events.
+ *
+ * The same EV_DISPATCH knotes are serviced twice: once the usual way,
+ * where the handler returns to the kernel with the EV_ENABLE changes
+ * of the events it processed and gets the next few events, and once
+ * with KEVENT_FLAG_MULTISHOT, where the handler drains up to BATCH
+ * events per kevent_id() call and the kernel re-enables the previous
+ * batch by itself.  Reports the event rate and kernel crossings per
+ * event of both.
+ *
+ * Also checks that a deferred EV_DELETE of an EV_DISPATCH2 knote
+ * completes when multishot re-enables it.
+ */
+#include <darwintest.h>
+#include <darwintest_utils.h>
+
+#include <dispatch/dispatch.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <pthread/workqueue_private.h>
+#include <stdatomic.h>
+#include <sys/event.h>
+#include <sys/event_private.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.kevent"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("kevent"),
+	T_META_CHECK_LEAKS(false),
+	T_META_RUN_CONCURRENTLY(false));
+
+#define NPIPES          1024
+#define NSOCKETS        1024
+#define NFDS            (NPIPES + NSOCKETS)
+#define ROUNDS          64
+#define BATCH           256
+#define ROUND_TIMEOUT   (30 * NSEC_PER_SEC)
+
+#define WL_DEFAULT      0x4b510001ull
+#define WL_MULTISHOT    0x4b510002ull
+#define WL_DEFERDELETE  0x4b510003ull
+
+static int rfds[NFDS];
+static int wfds[NFDS];
+
+static _Atomic uint64_t events_seen;
+static _Atomic uint64_t crossings;
+static uint64_t round_target;
+static dispatch_semaphore_t round_done;
+
+static void
+consume(const struct kevent_qos_s *kev)
+{
+	char c;
+
+	T_QUIET; T_ASSERT_EQ(kev->filter, EVFILT_READ, "read event");
+	T_QUIET; T_ASSERT_EQ(read((int)kev->ident, &c, 1), 1L,
+	    "every event has data");
+	if (atomic_fetch_add(&events_seen, 1) + 1 == round_target) {
+		dispatch_semaphore_signal(round_done);
+	}
+}
+
+static void
+workloop_handler(uint64_t *workloop_id, void **eventslist, int *events)
+{
+	struct kevent_qos_s *kev = *eventslist;
+	struct kevent_qos_s batch[BATCH];
+	int n = *events;
+	int r;
+
+	atomic_fetch_add(&crossings, 1);
+	for (int i = 0; i < n; i++) {
+		consume(&kev[i]);
+		kev[i].flags = EV_ENABLE;
+	}
+
+	if (*workloop_id != WL_MULTISHOT) {
+		/* re-enable what we processed on the way back to the kernel */
+		return;
+	}
+
+	/*
+	 * The events we were woken up with weren't delivered in multishot
+	 * mode, re-enable them with the first call, after that the kernel
+	 * re-enables each batch when we ask for the next one.
+	 */
+	r = kevent_id(*workloop_id, kev, n, batch, BATCH, NULL, NULL,
+	    KEVENT_FLAG_WORKLOOP | KEVENT_FLAG_MULTISHOT | KEVENT_FLAG_IMMEDIATE);
+	for (;;) {
+		atomic_fetch_add(&crossings, 1);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(r, "kevent_id");
+		if (r == 0) {
+			break;
+		}
+		for (int i = 0; i < r; i++) {
+			consume(&batch[i]);
+		}
+		r = kevent_id(*workloop_id, NULL, 0, batch, BATCH, NULL, NULL,
+		    KEVENT_FLAG_WORKLOOP | KEVENT_FLAG_MULTISHOT |
+		    KEVENT_FLAG_IMMEDIATE);
+	}
+	*events = 0;
+}
+
+static void
+open_fds(void)
+{
+	struct rlimit rl;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(getrlimit(RLIMIT_NOFILE, &rl), "getrlimit");
+	if (rl.rlim_cur < 2 * NFDS + 64) {
+		rl.rlim_cur = 2 * NFDS + 64;
+		if (setrlimit(RLIMIT_NOFILE, &rl) != 0) {
+			T_SKIP("can't raise RLIMIT_NOFILE to %d", 2 * NFDS + 64);
+		}
+	}
+
+	for (int i = 0; i < NFDS; i++) {
+		int fds[2];
+
+		if (i < NPIPES) {
+			T_QUIET; T_ASSERT_POSIX_SUCCESS(pipe(fds), "pipe");
+		} else {
+			T_QUIET; T_ASSERT_POSIX_SUCCESS(socketpair(AF_UNIX,
+			    SOCK_STREAM, 0, fds), "socketpair");
+		}
+		/* a spurious event must not block the servicer */
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(fcntl(fds[0], F_SETFL, O_NONBLOCK),
+		    "O_NONBLOCK");
+		rfds[i] = fds[0];
+		wfds[i] = fds[1];
+	}
+}
+
+static void
+close_fds(void)
+{
+	for (int i = 0; i < NFDS; i++) {
+		close(rfds[i]);
+		close(wfds[i]);
+	}
+}
+
+static void
+register_fds(uint64_t workloop_id)
+{
+	struct kevent_qos_s kev[BATCH];
+	int r;
+
+	for (int base = 0; base < NFDS; base += BATCH) {
+		for (int i = 0; i < BATCH; i++) {
+			kev[i] = (struct kevent_qos_s){
+				.ident = (uint64_t)rfds[base + i],
+				.filter = EVFILT_READ,
+				.flags = EV_ADD | EV_DISPATCH,
+				.udata = (uint64_t)(base + i),
+				.qos = (int32_t)_pthread_qos_class_encode(QOS_CLASS_DEFAULT, 0, 0),
+			};
+		}
+		r = kevent_id(workloop_id, kev, BATCH, kev, BATCH, NULL, NULL,
+		    KEVENT_FLAG_WORKLOOP | KEVENT_FLAG_ERROR_EVENTS);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(r, "kevent_id");
+		T_QUIET; T_ASSERT_EQ(r, 0, "no errors registering knotes");
+	}
+}
+
+static void
+run(uint64_t workloop_id, const char *mode)
+{
+	uint64_t start, end, seen, crossed;
+	char name[64];
+	double secs;
+
+	atomic_store(&events_seen, 0);
+	atomic_store(&crossings, 0);
+	open_fds();
+
+	start = clock_gettime_nsec_np(CLOCK_MONOTONIC);
+	register_fds(workloop_id);
+	for (int r = 0; r < ROUNDS; r++) {
+		round_target = (uint64_t)(r + 1) * NFDS;
+		for (int i = 0; i < NFDS; i++) {
+			T_QUIET; T_ASSERT_EQ(write(wfds[i], "x", 1), 1L, "write");
+		}
+		T_QUIET; T_ASSERT_EQ(dispatch_semaphore_wait(round_done,
+		    dispatch_time(DISPATCH_TIME_NOW, ROUND_TIMEOUT)), 0L,
+		    "round %d serviced", r);
+	}
+	end = clock_gettime_nsec_np(CLOCK_MONOTONIC);
+
+	close_fds();
+
+	seen = atomic_load(&events_seen);
+	crossed = atomic_load(&crossings);
+	secs = (double)(end - start) / NSEC_PER_SEC;
+	T_EXPECT_EQ(seen, (uint64_t)ROUNDS * NFDS, "%s: every write was seen once", mode);
+	T_LOG("%-9s: %llu events in %.2fs, %.0f events/s, %.3f crossings/event",
+	    mode, seen, secs, seen / secs, (double)crossed / seen);
+
+	snprintf(name, sizeof(name), "kqworkloop_%s_events", mode);
+	T_PERF(name, seen / secs, "events/s",
+	    "pipe and socket read events serviced per second");
+	snprintf(name, sizeof(name), "kqworkloop_%s_crossings", mode);
+	T_PERF(name, (double)crossed / seen, "crossings/event",
+	    "servicer kernel crossings per event");
+}
+
+T_DECL(kqworkloop_multishot,
+    "workloop servicing of thousands of pipes and sockets, with and without multishot",
+    T_META_TAG_PERF)
+{
+	round_done = dispatch_semaphore_create(0);
+	T_QUIET; T_ASSERT_POSIX_ZERO(_pthread_workqueue_init_with_workloop(
+		    NULL, NULL, workloop_handler, 0, 0), "workloop handler");
+
+	run(WL_DEFAULT, "default");
+	run(WL_MULTISHOT, "multishot");
+}
+
+static int dd_fds[2];
+static struct kevent_qos_s dd_last;
+
+static void
+deferdelete_handler(uint64_t *workloop_id, void **eventslist, int *events)
+{
+	struct kevent_qos_s *kev = *eventslist;
+	struct kevent_qos_s out;
+	char c;
+	int r;
+
+	T_QUIET; T_ASSERT_EQ(*events, 1, "woken up with the read event");
+	T_QUIET; T_ASSERT_EQ(read(dd_fds[0], &c, 1), 1L, "read");
+
+	/* have the next event delivered by a multishot call */
+	T_QUIET; T_ASSERT_EQ(write(dd_fds[1], "x", 1), 1L, "write");
+	kev[0].flags = EV_ENABLE | EV_UDATA_SPECIFIC;
+	r = kevent_id(*workloop_id, kev, 1, &out, 1, NULL, NULL,
+	    KEVENT_FLAG_WORKLOOP | KEVENT_FLAG_MULTISHOT | KEVENT_FLAG_IMMEDIATE);
+	T_QUIET; T_ASSERT_EQ(r, 1, "multishot call delivered the read event");
+	T_QUIET; T_ASSERT_EQ(out.filter, EVFILT_READ, "read event");
+
+	/* the knote is disabled by EV_DISPATCH: its delete is deferred */
+	out.flags = EV_DELETE | EV_UDATA_SPECIFIC;
+	r = kevent_id(*workloop_id, &out, 1, &out, 1, NULL, NULL,
+	    KEVENT_FLAG_WORKLOOP | KEVENT_FLAG_ERROR_EVENTS);
+	T_QUIET; T_ASSERT_EQ(r, 1, "EV_DELETE returned an error event");
+	T_QUIET; T_ASSERT_EQ((int)out.data, EINPROGRESS, "EV_DELETE was deferred");
+
+	/* the bulk re-enable delivers the end-of-life event */
+	r = kevent_id(*workloop_id, NULL, 0, &dd_last, 1, NULL, NULL,
+	    KEVENT_FLAG_WORKLOOP | KEVENT_FLAG_MULTISHOT | KEVENT_FLAG_IMMEDIATE);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(r, "kevent_id");
+	if (r == 0) {
+		dd_last = (struct kevent_qos_s){ };
+	}
+	*events = 0;
+	dispatch_semaphore_signal(round_done);
+}
+
+T_DECL(kqworkloop_multishot_deferdelete,
+    "a deferred EV_DELETE completes when multishot re-enables the knote")
+{
+	struct kevent_qos_s kev = {
+		.filter = EVFILT_READ,
+		.flags = EV_ADD | EV_DISPATCH2 | EV_CLEAR,
+		.udata = 0x1234,
+		.qos = (int32_t)_pthread_qos_class_encode(QOS_CLASS_DEFAULT, 0, 0),
+	};
+	int r;
+
+	round_done = dispatch_semaphore_create(0);
+	T_QUIET; T_ASSERT_POSIX_ZERO(_pthread_workqueue_init_with_workloop(
+		    NULL, NULL, deferdelete_handler, 0, 0), "workloop handler");
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(pipe(dd_fds), "pipe");
+	kev.ident = (uint64_t)dd_fds[0];
+	r = kevent_id(WL_DEFERDELETE, &kev, 1, &kev, 1, NULL, NULL,
+	    KEVENT_FLAG_WORKLOOP | KEVENT_FLAG_ERROR_EVENTS);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(r, "kevent_id");
+	T_QUIET; T_ASSERT_EQ(r, 0, "no error registering the knote");
+
+	T_QUIET; T_ASSERT_EQ(write(dd_fds[1], "x", 1), 1L, "write");
+	T_ASSERT_EQ(dispatch_semaphore_wait(round_done,
+	    dispatch_time(DISPATCH_TIME_NOW, ROUND_TIMEOUT)), 0L,
+	    "the servicer ran");
+
+	T_EXPECT_EQ(dd_last.ident, (uint64_t)dd_fds[0], "the knote was delivered");
+	T_EXPECT_TRUE(dd_last.flags & EV_DELETE, "with EV_DELETE, as it was dropped");
+
+	close(dd_fds[0]);
+	close(dd_fds[1]);
+}
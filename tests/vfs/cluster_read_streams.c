@@ -0,0 +1,197 @@
+/*
+ * Concurrent readers of one large file.
+ *
+ * Each of N threads reads its own region of the same file sequentially,
+ * so that the cluster layer sees N interleaved sequential streams on one
+ * vnode, N being twice the read-ahead streams a vnode has, so that they
+ * get recycled.  Then as many threads as there are streams read fixed
+ * size records at a constant stride.  The file is written with F_NOCACHE so that the reads have to
+ * go to the device.  Reports the aggregate throughput of both patterns,
+ * checks that the read-ahead streams (kern.cluster_ra_*) picked up both,
+ * and that every read returned what was written.
+ */
+#include <sys/sysctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <darwintest.h>
+#include <darwintest_utils.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.vfs.perf"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("file system"),
+	T_META_CHECK_LEAKS(false),
+	T_META_TAG_PERF);
+
+#define FILE_SIZE       (512UL << 20)
+#define NREADERS        8       /* twice CL_READ_STREAMS */
+#define NSTRIDED        4       /* CL_READ_STREAMS */
+#define READ_SIZE       (64UL << 10)
+#define RECORD_SIZE     (32UL << 10)
+#define RECORD_STRIDE   (128UL << 10)
+
+struct reader {
+	pthread_t       thread;
+	int             fd;
+	off_t           start;
+	off_t           end;
+	size_t          stride;
+	size_t          size;
+	uint64_t        bytes;
+};
+
+static char file_path[PATH_MAX];
+
+static void
+remove_file(void)
+{
+	unlink(file_path);
+}
+
+static uint64_t
+sysctl_u64(const char *name)
+{
+	uint64_t value = 0;
+	size_t size = sizeof(value);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, &value, &size, NULL, 0),
+	    "%s", name);
+	return value;
+}
+
+static void
+create_file(void)
+{
+	size_t chunk = 1UL << 20;
+	char *buf = malloc(chunk);
+	int fd;
+
+	T_QUIET; T_ASSERT_NOTNULL(buf, "malloc");
+	snprintf(file_path, sizeof(file_path), "%s/cluster_read_streams.XXXXXX", dt_tmpdir());
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fd = mkstemp(file_path), "mkstemp");
+	T_ATEND(remove_file);
+
+	/* keep the contents out of the cache, the readers should hit the device */
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fcntl(fd, F_NOCACHE, 1), "F_NOCACHE");
+	for (size_t off = 0; off < FILE_SIZE; off += chunk) {
+		memset(buf, (int)(off / chunk), chunk);
+		T_QUIET; T_ASSERT_EQ(pwrite(fd, buf, chunk, (off_t)off), (ssize_t)chunk, "pwrite");
+	}
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fsync(fd), "fsync");
+	close(fd);
+	free(buf);
+}
+
+/*
+ * create_file() fills every MB with its index: check that a read of
+ * "size" bytes at "off", which doesn't cross an MB, returned that.
+ */
+static void
+check_contents(const uint64_t *buf, size_t size, off_t off)
+{
+	uint64_t pattern = 0x0101010101010101ULL * (uint8_t)(off >> 20);
+
+	for (size_t i = 0; i < size / sizeof(*buf); i++) {
+		if (buf[i] != pattern) {
+			T_ASSERT_FAIL("byte %zu of the read at %lld is 0x%02x, expected 0x%02x",
+			    i * sizeof(*buf), off, (uint8_t)buf[i], (uint8_t)pattern);
+		}
+	}
+}
+
+static void *
+read_region(void *arg)
+{
+	struct reader *r = arg;
+	uint64_t *buf = malloc(r->size);
+
+	T_QUIET; T_ASSERT_NOTNULL(buf, "malloc");
+	for (off_t off = r->start; off + (off_t)r->size <= r->end; off += r->stride) {
+		ssize_t n = pread(r->fd, buf, r->size, off);
+
+		T_QUIET; T_ASSERT_EQ(n, (ssize_t)r->size, "pread");
+		check_contents(buf, r->size, off);
+		r->bytes += (uint64_t)n;
+	}
+	free(buf);
+	return NULL;
+}
+
+static double
+run_readers(const char *pattern, int nreaders, size_t size, size_t stride)
+{
+	struct reader readers[NREADERS] = { };
+	off_t region = (off_t)(FILE_SIZE / nreaders);
+	struct timespec start, end;
+	uint64_t total = 0;
+	double elapsed;
+	void *map;
+	int fd;
+
+	/* the file was written uncached, and each pass evicts what it read */
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fd = open(file_path, O_RDONLY), "open");
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < nreaders; i++) {
+		readers[i].fd = fd;
+		readers[i].start = region * i;
+		readers[i].end = region * (i + 1);
+		readers[i].size = size;
+		readers[i].stride = stride;
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&readers[i].thread, NULL,
+		    read_region, &readers[i]), "pthread_create");
+	}
+	for (int i = 0; i < nreaders; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(readers[i].thread, NULL),
+		    "pthread_join");
+		total += readers[i].bytes;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	/* drop what we read, so the next pattern starts cold as well */
+	map = mmap(NULL, FILE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	T_QUIET; T_ASSERT_NE(map, MAP_FAILED, "mmap");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(msync(map, FILE_SIZE, MS_INVALIDATE), "msync");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(munmap(map, FILE_SIZE), "munmap");
+	close(fd);
+
+	elapsed = (double)(end.tv_sec - start.tv_sec) +
+	    (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+	T_LOG("%s: %d readers, %llu MB in %.2fs: %.1f MB/s", pattern, nreaders,
+	    total >> 20, elapsed, (double)(total >> 20) / elapsed);
+	return (double)(total >> 20) / elapsed;
+}
+
+T_DECL(cluster_read_streams,
+    "interleaved sequential and strided readers of one file")
+{
+	uint64_t switches, strided;
+	double mbps;
+
+	create_file();
+
+	switches = sysctl_u64("kern.cluster_ra_stream_switches");
+	mbps = run_readers("sequential", NREADERS, READ_SIZE, READ_SIZE);
+	T_PERF("cluster_read_interleaved_sequential", mbps, "MB/s",
+	    "aggregate throughput of concurrent sequential readers of one file");
+	switches = sysctl_u64("kern.cluster_ra_stream_switches") - switches;
+	T_LOG("kern.cluster_ra_stream_switches    %llu", switches);
+	T_EXPECT_GT(switches, 0ULL,
+	    "interleaved readers were told apart as separate read-ahead streams");
+
+	strided = sysctl_u64("kern.cluster_ra_strided_prefetches");
+	mbps = run_readers("strided", NSTRIDED, RECORD_SIZE, RECORD_STRIDE);
+	T_PERF("cluster_read_interleaved_strided", mbps, "MB/s",
+	    "aggregate throughput of concurrent strided readers of one file");
+	strided = sysctl_u64("kern.cluster_ra_strided_prefetches") - strided;
+	T_LOG("kern.cluster_ra_strided_prefetches %llu", strided);
+	T_EXPECT_GT(strided, 0ULL, "strided readers got strided read-ahead");
+}
@@ -0,0 +1,211 @@
+/*
+ * Corpus benchmark for the compressor codecs.
+ *
+ * Runs a corpus through kern.perf_compressor_codec once per page codec,
+ * with and without the dense codec the swap path applies to cold
+ * segments, and reports the compression ratio and the throughput of
+ * each.  The corpus is synthetic unless COMPRESSOR_CODEC_CORPUS names
+ * a file to use instead.
+ */
+#include <mach/clock_types.h>
+#include <sys/sysctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <darwintest.h>
+#include <darwintest_utils.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.vm.perf"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("VM"),
+	T_META_CHECK_LEAKS(false),
+	T_META_ASROOT(YES),
+	T_META_TAG_PERF);
+
+/* Keep in sync with vm_compressor_mode_t */
+#define CMODE_WK        0
+#define CMODE_LZ4       1
+#define CMODE_HYB       2
+
+/* Keep in sync with struct perf_compressor_codec_data in kern_newsysctl.c */
+struct perf_compressor_codec_data {
+	user_addr_t buffer;
+	size_t buffer_size;
+	uint32_t mode;
+	uint32_t dense;
+	uint64_t pages;
+	uint64_t compressed_bytes;
+	uint64_t dense_bytes;
+	uint64_t compress_time;
+	uint64_t decompress_time;
+	uint64_t dense_compress_time;
+	uint64_t dense_decompress_time;
+};
+
+#define CORPUS_SIZE     (64ULL << 20)
+
+static const char *corpus_words[] = {
+	"the", "page", "segment", "compressor", "memory", "object", "swap",
+	"kernel", "thread", "queue", "of", "and", "to", "in", "is", "that",
+	"for", "with", "on", "as", "free", "wired", "active", "inactive",
+};
+
+/*
+ * A mix meant to look like anonymous memory: zero and single value
+ * pages, small integers, heap-like pointers, text, and some noise.
+ */
+static void
+fill_synthetic_corpus(uint8_t *buf, size_t size)
+{
+	size_t page_size = (size_t)getpagesize();
+	uint64_t heap = 0x600000000000ULL;
+
+	srandom(0x5eed);
+	for (size_t off = 0; off < size; off += page_size) {
+		uint8_t *page = buf + off;
+
+		switch ((off / page_size) % 8) {
+		case 0:
+			memset(page, 0, page_size);
+			break;
+		case 1:
+			memset_pattern4(page, "\xde\xad\xbe\xef", page_size);
+			break;
+		case 2:
+		case 3: {
+			uint32_t *words = (uint32_t *)page;
+			for (size_t i = 0; i < page_size / sizeof(*words); i++) {
+				words[i] = (uint32_t)(random() % 1024);
+			}
+			break;
+		}
+		case 4:
+		case 5: {
+			uint64_t *ptrs = (uint64_t *)page;
+			for (size_t i = 0; i < page_size / sizeof(*ptrs); i++) {
+				ptrs[i] = (i & 1) ? heap + (uint64_t)(random() % (1 << 20)) * 16 : (uint64_t)(random() % 256);
+			}
+			break;
+		}
+		case 6: {
+			size_t i = 0;
+			while (i < page_size) {
+				const char *w = corpus_words[random() % (sizeof(corpus_words) / sizeof(corpus_words[0]))];
+				size_t len = strlen(w);
+				for (size_t j = 0; j < len && i < page_size; j++) {
+					page[i++] = (uint8_t)w[j];
+				}
+				if (i < page_size) {
+					page[i++] = ' ';
+				}
+			}
+			break;
+		}
+		default:
+			arc4random_buf(page, page_size);
+			break;
+		}
+	}
+}
+
+static size_t
+load_corpus(uint8_t **bufp)
+{
+	const char *path = getenv("COMPRESSOR_CODEC_CORPUS");
+	size_t page_size = (size_t)getpagesize();
+	size_t size = CORPUS_SIZE;
+	uint8_t *buf;
+
+	if (path) {
+		struct stat st;
+		int fd = open(path, O_RDONLY);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(fd, "open(%s)", path);
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(fstat(fd, &st), "fstat(%s)", path);
+		size = ((size_t)st.st_size + page_size - 1) & ~(page_size - 1);
+		T_QUIET; T_ASSERT_GT(size, 0UL, "corpus is not empty");
+
+		/* copied into anonymous memory, which is what the compressor sees */
+		buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+		T_QUIET; T_ASSERT_NE(buf, MAP_FAILED, "mmap");
+		T_QUIET; T_ASSERT_EQ(read(fd, buf, (size_t)st.st_size), (ssize_t)st.st_size, "read(%s)", path);
+		close(fd);
+		T_LOG("corpus: %s, %zu bytes", path, size);
+	} else {
+		buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+		T_QUIET; T_ASSERT_NE(buf, MAP_FAILED, "mmap");
+		fill_synthetic_corpus(buf, size);
+		T_LOG("corpus: synthetic, %zu bytes", size);
+	}
+	*bufp = buf;
+	return size;
+}
+
+static double
+mb_per_sec(uint64_t bytes, uint64_t ns)
+{
+	return ns ? ((double)bytes / (1024 * 1024)) / ((double)ns / NSEC_PER_SEC) : 0;
+}
+
+static void
+run_codec(uint8_t *buf, size_t size, uint32_t mode, const char *name, bool dense)
+{
+	struct perf_compressor_codec_data data = {
+		.buffer = (user_addr_t)buf,
+		.buffer_size = size,
+		.mode = mode,
+		.dense = dense,
+	};
+	size_t len = sizeof(data);
+	char metric[64];
+	uint64_t out_bytes;
+	uint64_t ctime, dtime;
+	int ret;
+
+	ret = sysctlbyname("kern.perf_compressor_codec", &data, &len, &data, sizeof(data));
+	if (ret == -1 && errno == ENOENT) {
+		T_SKIP("kern.perf_compressor_codec is only available on development kernels");
+	}
+	T_ASSERT_POSIX_SUCCESS(ret, "kern.perf_compressor_codec(%s%s)", name, dense ? "+dense" : "");
+
+	out_bytes = dense ? data.dense_bytes : data.compressed_bytes;
+	ctime = data.compress_time + (dense ? data.dense_compress_time : 0);
+	dtime = data.decompress_time + (dense ? data.dense_decompress_time : 0);
+
+	T_LOG("%-10s pages %8llu  ratio %6.3f  compress %8.1f MB/s  decompress %8.1f MB/s",
+	    dense ? "+dense" : name, data.pages, (double)size / (double)out_bytes,
+	    mb_per_sec(size, ctime), mb_per_sec(size, dtime));
+
+	snprintf(metric, sizeof(metric), "%s%s_ratio", name, dense ? "_dense" : "");
+	T_PERF(metric, (double)size / (double)out_bytes, "factor", "compression ratio");
+	snprintf(metric, sizeof(metric), "%s%s_compress_throughput", name, dense ? "_dense" : "");
+	T_PERF(metric, mb_per_sec(size, ctime), "MB/s", "compression throughput");
+	snprintf(metric, sizeof(metric), "%s%s_decompress_throughput", name, dense ? "_dense" : "");
+	T_PERF(metric, mb_per_sec(size, dtime), "MB/s", "decompression throughput");
+}
+
+T_DECL(compressor_codec_perf,
+    "Ratio and throughput of the compressor codecs over a corpus")
+{
+	static const struct {
+		uint32_t mode;
+		const char *name;
+	} codecs[] = {
+		{ CMODE_WK, "wkdm" },
+		{ CMODE_LZ4, "lz4" },
+		{ CMODE_HYB, "hybrid" },
+	};
+	uint8_t *buf;
+	size_t size = load_corpus(&buf);
+
+	for (size_t i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+		run_codec(buf, size, codecs[i].mode, codecs[i].name, false);
+		run_codec(buf, size, codecs[i].mode, codecs[i].name, true);
+	}
+	munmap(buf, size);
+}
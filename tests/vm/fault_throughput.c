@@ -1,10 +1,14 @@
 /*
  * Benchmark VM fault throughput.
  * This test faults memory for a configurable amount of time across a
- * configurable number of threads. Currently it only measures zero fill faults.
- * Currently it supports two variants:
- * 1. Each thread gets its own vm objects to fault in
- * 2. Threads share vm objects
+ * configurable number of threads.
+ * Currently it supports these variants:
+ * 1. Each thread gets its own vm objects to fault in (zero fill)
+ * 2. Threads share vm objects (zero fill)
+ * 3. Each thread reads through its own mapping of a file whose pages are
+ *    all resident, so every fault is a soft fault on a file-backed object
+ * 4. The same, with fault-around enabled for the process (vm.self_fault_around),
+ *    so a fault also maps the resident pages that follow the faulting one
  *
  * We'll add more fault types as we identify problematic user-facing workloads
  * in macro benchmarks.
@@ -20,10 +24,14 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <strings.h>
+#include <unistd.h>
 
 #include <sys/mman.h>
 #include <sys/types.h>
@@ -74,7 +82,9 @@ typedef struct fault_buffer {
 
 typedef enum test_variant {
 	VARIANT_SEPARATE_VM_OBJECTS,
-	VARIANT_SHARE_VM_OBJECTS
+	VARIANT_SHARE_VM_OBJECTS,
+	VARIANT_FILE_READ,
+	VARIANT_FILE_READ_FAULT_AROUND
 } test_variant_t;
 
 typedef struct test_globals {
@@ -90,6 +100,8 @@ typedef struct test_globals {
 	unsigned int tg_num_threads;
 	test_variant_t tg_variant;
 	bool pin_threads;
+	/* The (unlinked) file mapped by the file-read variants, or -1. */
+	int tg_file_fd;
 	/*
 	 * An array of memory objects to fault in.
 	 * This is basically a workqueue of
@@ -119,6 +131,8 @@ static faulting_thread_args_t *faulting_thread_args;
 
 static const char* kSeparateObjectsArgument = "separate-objects";
 static const char* kShareObjectsArgument = "share-objects";
+static const char* kFileReadArgument = "file-read";
+static const char* kFileReadFaultAroundArgument = "file-read-fault-around";
 
 /* Arguments parsed from the command line */
 typedef struct test_args {
@@ -188,6 +202,12 @@ static void cleanup_test(test_globals_t *globals);
  */
 static uint64_t join_background_threads(test_globals_t *globals, pthread_t *threads);
 static void unmap_fault_buffers(test_globals_t *globals);
+/*
+ * Create the file the file-read variants map, and make all of its pages resident.
+ * Returns the file descriptor. The file is unlinked right away.
+ */
+static int create_resident_file(size_t size);
+static bool variant_is_file_read(test_variant_t variant);
 /*
  * Get the stride between each vm object in the fault buffer array.
  */
@@ -412,7 +432,16 @@ setup_memory(test_globals_t* globals, test_variant_t variant)
 	size_t stride = fault_buffer_stride(globals);
 	for (size_t i = 0; i < globals->tg_fault_buffer_arr_length; i += stride) {
 		fault_buffer_t *object = &globals->tg_fault_buffer_arr[i];
-		object->fb_start = mmap_buffer(kVmObjectSize);
+		if (variant_is_file_read(variant)) {
+			object->fb_start = mmap(NULL, kVmObjectSize, PROT_READ, MAP_FILE | MAP_SHARED,
+			    globals->tg_file_fd, 0);
+			if ((void *) object->fb_start == MAP_FAILED) {
+				fprintf(stderr, "Unable to mmap the test file: %s\n", strerror(errno));
+				exit(2);
+			}
+		} else {
+			object->fb_start = mmap_buffer(kVmObjectSize);
+		}
 		object->fb_size = kVmObjectSize;
 		if (variant == VARIANT_SHARE_VM_OBJECTS) {
 			/*
@@ -426,7 +455,7 @@ setup_memory(test_globals_t* globals, test_variant_t variant)
 				offset_object->fb_start = object->fb_start + offset;
 				offset_object->fb_size = object->fb_size - offset;
 			}
-		} else if (variant != VARIANT_SEPARATE_VM_OBJECTS) {
+		} else if (variant != VARIANT_SEPARATE_VM_OBJECTS && !variant_is_file_read(variant)) {
 			fprintf(stderr, "Unknown test variant.\n");
 			exit(2);
 		}
@@ -493,13 +522,14 @@ init_globals(test_globals_t *globals, const test_args_t *args)
 	globals->tg_num_threads = args->n_threads;
 	globals->tg_variant = args->variant;
 	globals->pin_threads = args->pin_threads;
+	globals->tg_file_fd = -1;
 }
 
 static void
 init_fault_buffer_arr(test_globals_t *globals, const test_args_t *args, size_t memory_size)
 {
-	if (args->variant == VARIANT_SEPARATE_VM_OBJECTS) {
-		// This variant creates separate vm objects up to memory size bytes total
+	if (args->variant == VARIANT_SEPARATE_VM_OBJECTS || variant_is_file_read(args->variant)) {
+		// This variant creates separate vm objects (or mappings of the file) up to memory size bytes total
 		globals->tg_fault_buffer_arr_length = memory_size / kVmObjectSize;
 	} else if (args->variant == VARIANT_SHARE_VM_OBJECTS) {
 		// This variant creates separate vm objects up to memory size bytes total
@@ -547,6 +577,16 @@ setup_test(test_globals_t *globals, const test_args_t *args, size_t memory_size,
 {
 	init_globals(globals, args);
 	init_fault_buffer_arr(globals, args, memory_size);
+	if (variant_is_file_read(args->variant)) {
+		globals->tg_file_fd = create_resident_file(kVmObjectSize);
+		/* Fault-around is a property of the map, so this covers every worker. */
+		int fault_around = (args->variant == VARIANT_FILE_READ_FAULT_AROUND);
+		int ret = sysctlbyname("vm.self_fault_around", NULL, 0, &fault_around, sizeof(fault_around));
+		if (ret != 0 && fault_around) {
+			fprintf(stderr, "Unable to enable fault-around: %s\n", strerror(errno));
+			exit(2);
+		}
+	}
 	benchmark_log(verbose, "Initialized global data structures.\n");
 	pthread_t *workers = spawn_worker_threads(globals, args->n_threads, args->first_cpu);
 	benchmark_log(verbose, "Spawned workers.\n");
@@ -587,6 +627,10 @@ cleanup_test(test_globals_t* globals)
 	assert(ret == 0);
 	ret = pthread_cond_destroy(&globals->tg_cv);
 	assert(ret == 0);
+	if (globals->tg_file_fd != -1) {
+		ret = close(globals->tg_file_fd);
+		assert(ret == 0);
+	}
 	free(globals->tg_fault_buffer_arr);
 	free(globals);
 }
@@ -619,6 +663,8 @@ print_help(char** argv)
 	fprintf(stderr, "\ntest variants:\n");
 	fprintf(stderr, "	%s	Fault in different vm objects in each thread.\n", kSeparateObjectsArgument);
 	fprintf(stderr, "	%s		Share vm objects across faulting threads.\n", kShareObjectsArgument);
+	fprintf(stderr, "	%s		Read through separate mappings of a resident file in each thread.\n", kFileReadArgument);
+	fprintf(stderr, "	%s	Same as %s, with fault-around enabled.\n", kFileReadFaultAroundArgument, kFileReadArgument);
 }
 
 static void
@@ -640,7 +686,11 @@ parse_arguments(int argc, char** argv, test_args_t *args)
 		}
 		current_argument++;
 	}
-	if (strncasecmp(argv[current_argument], kSeparateObjectsArgument, strlen(kSeparateObjectsArgument)) == 0) {
+	if (strncasecmp(argv[current_argument], kFileReadFaultAroundArgument, strlen(kFileReadFaultAroundArgument)) == 0) {
+		args->variant = VARIANT_FILE_READ_FAULT_AROUND;
+	} else if (strncasecmp(argv[current_argument], kFileReadArgument, strlen(kFileReadArgument)) == 0) {
+		args->variant = VARIANT_FILE_READ;
+	} else if (strncasecmp(argv[current_argument], kSeparateObjectsArgument, strlen(kSeparateObjectsArgument)) == 0) {
 		args->variant = VARIANT_SEPARATE_VM_OBJECTS;
 	} else if (strncasecmp(argv[current_argument], kShareObjectsArgument, strlen(kShareObjectsArgument)) == 0) {
 		args->variant = VARIANT_SHARE_VM_OBJECTS;
@@ -684,7 +734,7 @@ static size_t
 fault_buffer_stride(const test_globals_t *globals)
 {
 	size_t stride;
-	if (globals->tg_variant == VARIANT_SEPARATE_VM_OBJECTS) {
+	if (globals->tg_variant == VARIANT_SEPARATE_VM_OBJECTS || variant_is_file_read(globals->tg_variant)) {
 		stride = 1;
 	} else if (globals->tg_variant == VARIANT_SHARE_VM_OBJECTS) {
 		stride = globals->tg_num_threads;
@@ -694,3 +744,47 @@ fault_buffer_stride(const test_globals_t *globals)
 	}
 	return stride;
 }
+
+static bool
+variant_is_file_read(test_variant_t variant)
+{
+	return variant == VARIANT_FILE_READ || variant == VARIANT_FILE_READ_FAULT_AROUND;
+}
+
+static int
+create_resident_file(size_t size)
+{
+	const char *tmpdir = getenv("TMPDIR");
+	char path[PATH_MAX];
+	int fd, ret;
+	ssize_t written;
+	size_t chunk_size = 1UL << 20;
+	unsigned char *chunk = malloc(chunk_size);
+	assert(chunk != NULL);
+
+	snprintf(path, sizeof(path), "%s/fault_throughput.XXXXXX", tmpdir ? tmpdir : "/tmp");
+	fd = mkstemp(path);
+	if (fd == -1) {
+		fprintf(stderr, "Unable to create %s: %s\n", path, strerror(errno));
+		exit(2);
+	}
+	ret = unlink(path);
+	assert(ret == 0);
+
+	/* Non-zero contents, written through the buffer cache so the pages stay resident. */
+	memset(chunk, 0xA5, chunk_size);
+	for (size_t offset = 0; offset < size; offset += chunk_size) {
+		written = pwrite(fd, chunk, chunk_size, (off_t) offset);
+		if (written != (ssize_t) chunk_size) {
+			fprintf(stderr, "Unable to write the test file: %s\n", strerror(errno));
+			exit(2);
+		}
+	}
+	/* Read it back in case anything was evicted in the meantime. */
+	for (size_t offset = 0; offset < size; offset += chunk_size) {
+		ssize_t nread = pread(fd, chunk, chunk_size, (off_t) offset);
+		assert(nread == (ssize_t) chunk_size);
+	}
+	free(chunk);
+	return fd;
+}
@@ -42,7 +42,8 @@ local benchmark = benchrun.new({
     parser:option{
       name = '--variant',
       description = 'Which benchmark variant to run',
-      choices = { 'separate-objects', 'share-objects' },
+      choices = { 'separate-objects', 'share-objects', 'file-read',
+          'file-read-fault-around' },
       default = 'separate-objects',
       argname = 'name',
     }
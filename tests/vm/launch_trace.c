@@ -0,0 +1,124 @@
+#include <sys/sysctl.h>
+#include <sys/wait.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <darwintest.h>
+#include <darwintest_utils.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.vm"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("VM"),
+	T_META_CHECK_LEAKS(false),
+	T_META_RUN_CONCURRENTLY(false));
+
+static uint64_t
+sysctl_u64(const char *name)
+{
+	uint64_t value = 0;
+	size_t size = sizeof(value);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, &value, &size, NULL, 0),
+	    "%s", name);
+	return value;
+}
+
+static uint32_t
+launch_trace_window_ms(void)
+{
+	uint32_t window_ms = 0;
+	size_t size;
+	int enabled = 0;
+
+	size = sizeof(enabled);
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.launch_trace", &enabled, &size, NULL, 0),
+	    "vm.launch_trace");
+	if (!enabled) {
+		T_SKIP("launch traces are disabled");
+	}
+	size = sizeof(window_ms);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.launch_trace_window_ms",
+	    &window_ms, &size, NULL, 0), "vm.launch_trace_window_ms");
+	return window_ms;
+}
+
+static void
+launch_and_wait(void)
+{
+	char *args[] = { "/usr/bin/true", NULL };
+	pid_t pid;
+	int status = 0;
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(dt_launch_tool(&pid, args, false, NULL, NULL),
+	    "launch %s", args[0]);
+	T_QUIET; T_ASSERT_TRUE(dt_waitpid(pid, &status, NULL, 30), "wait for %s", args[0]);
+}
+
+T_DECL(launch_trace,
+    "the second launch of a binary replays the file faults recorded by the first one")
+{
+	uint64_t recordings, replays, prefetched;
+	uint32_t window_ms = launch_trace_window_ms();
+
+	recordings = sysctl_u64("vm.launch_trace_recordings");
+	replays = sysctl_u64("vm.launch_trace_replays");
+	prefetched = sysctl_u64("vm.launch_trace_prefetched");
+
+	/* records a trace, unless an earlier launch already did */
+	launch_and_wait();
+	usleep((window_ms + 500) * 1000);
+	launch_and_wait();
+
+	for (int i = 0; i < 50 && sysctl_u64("vm.launch_trace_replays") == replays; i++) {
+		usleep(100 * 1000);
+	}
+	T_LOG("%llu traces recorded, %llu replayed, %llu bytes prefetched",
+	    sysctl_u64("vm.launch_trace_recordings") - recordings,
+	    sysctl_u64("vm.launch_trace_replays") - replays,
+	    sysctl_u64("vm.launch_trace_prefetched") - prefetched);
+	T_EXPECT_GT(sysctl_u64("vm.launch_trace_replays"), replays,
+	    "the second launch replayed a trace");
+}
+
+static void
+launch_as_and_wait(uid_t uid)
+{
+	pid_t pid;
+	int status = 0;
+
+	pid = fork();
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(pid, "fork");
+	if (pid == 0) {
+		if (setgid(uid) != 0 || setuid(uid) != 0) {
+			_exit(2);
+		}
+		execl("/usr/bin/true", "true", NULL);
+		_exit(3);
+	}
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(waitpid(pid, &status, 0), "waitpid");
+	T_QUIET; T_ASSERT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+	    "/usr/bin/true ran as uid %d", uid);
+}
+
+T_DECL(launch_trace_per_user,
+    "a launch by another user records its own trace instead of replaying one",
+    T_META_ASROOT(true))
+{
+	uint32_t window_ms = launch_trace_window_ms();
+	/* a uid nothing else runs as, so that it has no trace yet */
+	uid_t uid = 0x10000 + (uid_t)getpid();
+	uint64_t recordings;
+
+	/* makes sure root has a trace for /usr/bin/true */
+	launch_and_wait();
+	usleep((window_ms + 500) * 1000);
+
+	recordings = sysctl_u64("vm.launch_trace_recordings");
+	launch_as_and_wait(uid);
+	usleep((window_ms + 500) * 1000);
+	for (int i = 0; i < 50 && sysctl_u64("vm.launch_trace_recordings") == recordings; i++) {
+		usleep(100 * 1000);
+	}
+	T_EXPECT_GT(sysctl_u64("vm.launch_trace_recordings"), recordings,
+	    "the launch as uid %d recorded a trace of its own", uid);
+}
@@ -0,0 +1,131 @@
+/*
+ * Multi-threaded page grab and free stress.
+ *
+ * One thread per CPU repeatedly maps a chunk of anonymous memory, zero
+ * fills every page of it and unmaps it, so that each thread grabs and
+ * frees pages as fast as the fault path lets it.  Reports the aggregate
+ * throughput, and how the per-CPU free page caches (vm.page_free_cache_*)
+ * absorbed the traffic.
+ */
+#include <sys/sysctl.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <darwintest.h>
+#include <darwintest_utils.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.vm.perf"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("VM"),
+	T_META_CHECK_LEAKS(false),
+	T_META_TAG_PERF);
+
+#define CHUNK_SIZE      (2UL << 20)
+#define DURATION_SECS   10
+
+static const char *cache_counters[] = {
+	"vm.pages_grabbed",
+	"vm.page_free_cache_hits",
+	"vm.page_free_cache_refills",
+	"vm.page_free_cache_releases",
+	"vm.page_free_cache_drains",
+};
+#define NCOUNTERS       (sizeof(cache_counters) / sizeof(cache_counters[0]))
+
+static _Atomic bool done;
+
+static void
+read_counters(uint64_t values[NCOUNTERS])
+{
+	for (size_t i = 0; i < NCOUNTERS; i++) {
+		size_t size = sizeof(values[i]);
+
+		values[i] = 0;
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(cache_counters[i],
+		    &values[i], &size, NULL, 0), "%s", cache_counters[i]);
+	}
+}
+
+static void *
+grab_and_free(void *arg)
+{
+	uint64_t *pages = arg;
+	size_t page_size = (size_t)getpagesize();
+
+	while (!atomic_load_explicit(&done, memory_order_relaxed)) {
+		char *buf = mmap(NULL, CHUNK_SIZE, PROT_READ | PROT_WRITE,
+		    MAP_ANON | MAP_PRIVATE, -1, 0);
+
+		T_QUIET; T_ASSERT_NE((void *)buf, MAP_FAILED, "mmap");
+		for (size_t off = 0; off < CHUNK_SIZE; off += page_size) {
+			buf[off] = 1;
+		}
+		T_QUIET; T_ASSERT_POSIX_SUCCESS(munmap(buf, CHUNK_SIZE), "munmap");
+		*pages += CHUNK_SIZE / page_size;
+	}
+	return NULL;
+}
+
+T_DECL(page_grab_stress,
+    "zero fill and free pages from every CPU at once")
+{
+	unsigned int ncpu = (unsigned int)dt_ncpu();
+	pthread_t *threads = calloc(ncpu, sizeof(*threads));
+	uint64_t *pages = calloc(ncpu, 8 * sizeof(*pages));     /* a cache line each */
+	uint64_t before[NCOUNTERS], after[NCOUNTERS], total = 0;
+	struct timespec start, end;
+	double elapsed;
+
+	T_QUIET; T_ASSERT_NOTNULL(threads, "calloc");
+	T_QUIET; T_ASSERT_NOTNULL(pages, "calloc");
+
+	read_counters(before);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned int i = 0; i < ncpu; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_create(&threads[i], NULL,
+		    grab_and_free, &pages[8 * i]), "pthread_create");
+	}
+	sleep(DURATION_SECS);
+	atomic_store(&done, true);
+	for (unsigned int i = 0; i < ncpu; i++) {
+		T_QUIET; T_ASSERT_POSIX_ZERO(pthread_join(threads[i], NULL),
+		    "pthread_join");
+		total += pages[8 * i];
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	read_counters(after);
+
+	elapsed = (double)(end.tv_sec - start.tv_sec) +
+	    (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+	T_LOG("%u threads, %llu pages in %.2fs: %.0f pages/s",
+	    ncpu, total, elapsed, (double)total / elapsed);
+	for (size_t i = 0; i < NCOUNTERS; i++) {
+		T_LOG("%-30s %llu", cache_counters[i], after[i] - before[i]);
+	}
+	T_PERF("page_grab_throughput", (double)total / elapsed, "pages/s",
+	    "pages zero filled and freed per second, all CPUs");
+
+	uint64_t grabbed = after[0] - before[0];
+	uint64_t hits = after[1] - before[1];
+	uint64_t refills = after[2] - before[2];
+
+	if (grabbed) {
+		T_PERF("page_grab_lockless_ratio", (double)hits / (double)grabbed,
+		    "fraction", "grabs served by a per-CPU cache without refilling it");
+	}
+	if (refills) {
+		T_PERF("page_grab_per_refill", (double)grabbed / (double)refills,
+		    "pages", "pages grabbed per free page lock acquisition to refill");
+	}
+	T_EXPECT_GT(hits, 0ULL, "the per-CPU free page caches serve grabs");
+
+	free(pages);
+	free(threads);
+}
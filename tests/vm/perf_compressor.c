@@ -69,6 +69,7 @@ typedef struct test_args {
 	test_variant_t ta_variant;
 	allocation_type_t ta_alloc_type;
 	bool ta_verbose;
+	int ta_batch_size; /* -1 to leave vm.compressor_batch_size alone */
 } test_args_t;
 
 struct perf_compressor_data {
@@ -95,6 +96,7 @@ static int kInvalidArgument = 1;
 static int kAllocationFailure = 2;
 static int kCompressionFailure = 3;
 static int kNYI = 4;
+static int kSysctlFailure = 5;
 
 static void parse_arguments(int argc, const char **argv, test_args_t *args /* OUT */);
 static void print_help(const char** argv);
@@ -102,12 +104,17 @@ static unsigned char *alloc_and_fill_buffer(size_t size, allocation_type_t alloc
 void fill_with_typical_data(unsigned char *buf, size_t size);
 static void run_compress_benchmark(const test_args_t *args);
 static uint64_t decompress_buffer(unsigned char *buf, size_t size);
+static int set_compressor_batch_size(int batch_size);
 
 int
 main(int argc, const char **argv)
 {
 	test_args_t args = {0};
+	int old_batch_size = -1;
 	parse_arguments(argc, argv, &args);
+	if (args.ta_batch_size >= 0) {
+		old_batch_size = set_compressor_batch_size(args.ta_batch_size);
+	}
 	switch (args.ta_variant) {
 	case VARIANT_COMPRESS:
 	case VARIANT_COMPRESS_AND_DECOMPRESS:
@@ -116,6 +123,25 @@ main(int argc, const char **argv)
 	default:
 		err(kNYI, "NYI: Test variant has not been implemented");
 	}
+	if (old_batch_size >= 0) {
+		set_compressor_batch_size(old_batch_size);
+	}
+}
+
+/*
+ * Sets how many pages each compressor thread compresses ahead of committing
+ * them into c_segments.  Returns the previous value.
+ */
+static int
+set_compressor_batch_size(int batch_size)
+{
+	int old_batch_size;
+	size_t len = sizeof(old_batch_size);
+	int ret = sysctlbyname("vm.compressor_batch_size", &old_batch_size, &len, &batch_size, sizeof(batch_size));
+	if (ret < 0) {
+		err(kSysctlFailure, "Unable to set vm.compressor_batch_size to %d", batch_size);
+	}
+	return old_batch_size;
 }
 
 static void
@@ -126,6 +152,7 @@ run_compress_benchmark(const test_args_t *args)
 	uint64_t total_compressor_bytes_used = 0;
 	uint64_t total_decompressor_time = 0;
 	double compressor_throughput = 0, decompressor_throughput = 0, compression_ratio = 0;
+	double compressor_page_rate = 0;
 	while (total_compressor_time < args->ta_duration_seconds * NSEC_PER_SEC) {
 		unsigned char *buf;
 		struct perf_compressor_data sysctl_data = {0};
@@ -162,13 +189,14 @@ run_compress_benchmark(const test_args_t *args)
 		munmap(buf, args->ta_buffer_size);
 	}
 	compressor_throughput = (double) total_bytes_compressed / total_compressor_time * NSEC_PER_SEC;
+	compressor_page_rate = compressor_throughput / vm_kernel_page_size;
 	printf("bytes_compressed=%llu, compressor_bytes_used=%llu\n", total_bytes_compressed, total_compressor_bytes_used);
 	compression_ratio = (double) total_bytes_compressed / total_compressor_bytes_used;
 	if (total_decompressor_time != 0) {
 		decompressor_throughput = (double) total_bytes_compressed / total_decompressor_time * NSEC_PER_SEC;
 	}
 	printf("-----Results-----\n");
-	printf("Compressor Throughput");
+	printf("Compressor Throughput, Compressor Page Rate");
 	if (args->ta_variant == VARIANT_COMPRESS_AND_DECOMPRESS) {
 		printf(", Decompressor Throughput");
 	}
@@ -178,7 +206,7 @@ run_compress_benchmark(const test_args_t *args)
 		printf("\n");
 	}
 
-	printf("%.0f", compressor_throughput);
+	printf("%.0f, %.0f", compressor_throughput, compressor_page_rate);
 	if (args->ta_variant == VARIANT_COMPRESS_AND_DECOMPRESS) {
 		printf(", %.0f", decompressor_throughput);
 	}
@@ -253,10 +281,21 @@ parse_arguments(int argc, const char** argv, test_args_t *args)
 	int current_positional_argument = 0;
 	long duration = -1, size_mb = -1;
 	memset(args, 0, sizeof(test_args_t));
+	args->ta_batch_size = -1;
 	for (int current_argument = 1; current_argument < argc; current_argument++) {
 		if (argv[current_argument][0] == '-') {
 			if (strcmp(argv[current_argument], "-v") == 0) {
 				args->ta_verbose = true;
+			} else if (strcmp(argv[current_argument], "-b") == 0) {
+				if (++current_argument >= argc) {
+					print_help(argv);
+					exit(kInvalidArgument);
+				}
+				args->ta_batch_size = (int) strtol(argv[current_argument], NULL, 10);
+				if (args->ta_batch_size < 0) {
+					print_help(argv);
+					exit(kInvalidArgument);
+				}
 			} else {
 				fprintf(stderr, "Unknown argument %s\n", argv[current_argument]);
 				print_help(argv);
@@ -319,7 +358,8 @@ parse_arguments(int argc, const char** argv, test_args_t *args)
 static void
 print_help(const char** argv)
 {
-	fprintf(stderr, "%s: [-v] <test-variant> allocation-type duration_seconds buffer_size_mb\n", argv[0]);
+	fprintf(stderr, "%s: [-v] [-b batch_size] <test-variant> allocation-type duration_seconds buffer_size_mb\n", argv[0]);
+	fprintf(stderr, "\n	-b	Pages each compressor thread compresses before committing them (0 disables batching).\n");
 	fprintf(stderr, "\ntest variants:\n");
 	fprintf(stderr, "	%s	Measure compressor throughput.\n", kCompressArgument);
 	fprintf(stderr, "	%s	Measure compressor and decompressor throughput.\n", kCompressAndDecompressArgument);
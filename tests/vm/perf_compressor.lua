@@ -40,6 +40,10 @@ local benchmark = benchrun.new {
             default = 'typical',
             choices = {'typical', 'random', 'zero'}
         }
+        parser:option{
+            name = '--batch-size',
+            description = 'Pages each compressor thread compresses before committing them (0 disables batching)',
+        }
         parser:flag {
             name = '--verbose',
             description = 'Print benchmark progress',
@@ -61,7 +65,22 @@ if hw_page_size ~= vm_page_size then
     os.exit(0)
 end
 
+local ncpu, err = sysctl("hw.ncpu")
+benchmark:assert(err == nil, "Unable to check the number of cpus")
+local compressor_threads, err = sysctl("vm.compressor_thread_count")
+benchmark:assert(err == nil, "Unable to check the number of compressor threads")
+local batch_size = benchmark.opt.batch_size
+if batch_size == nil then
+    local err
+    batch_size, err = sysctl("vm.compressor_batch_size")
+    benchmark:assert(err == nil, "Unable to check the compressor batch size")
+end
+
 args = {benchmark.opt.path, benchmark.opt.variant, benchmark.opt.data_type, benchmark.opt.duration, benchmark.opt.buffer_size}
+if benchmark.opt.batch_size then
+    table.insert(args, 2, "-b")
+    table.insert(args, 3, benchmark.opt.batch_size)
+end
 if benchmark.opt.verbose then
     table.insert(args, 2, "-v")
     args["echo"] = true
@@ -75,10 +94,15 @@ for out in benchmark:run(args) do
             unit = perfdata.unit.bytes_per_second
             if k == "Compression Ratio" then
                 unit = perfdata.unit.custom("uncompressed / compressed")
+            elseif k == "Compressor Page Rate" then
+                unit = perfdata.unit.custom("pages / second")
             end
             benchmark.writer:add_value(k, unit, tonumber(v), {
                 data_type = benchmark.opt.data_type,
                 buffer_size = benchmark.opt.buffer_size,
+                batch_size = tonumber(batch_size),
+                compressor_threads = compressor_threads,
+                ncpu = ncpu,
                 [perfdata.larger_better] = true
             })
         end
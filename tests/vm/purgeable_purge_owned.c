@@ -0,0 +1,82 @@
+#include <sys/event.h>
+#include <sys/event_private.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <mach/mach.h>
+#include <mach/mach_vm.h>
+#include <darwintest.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.vm"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("VM"),
+	T_META_CHECK_LEAKS(false));
+
+#define NREGIONS        4
+#define REGION_SIZE     (1UL << 20)
+
+T_DECL(purgeable_purge_owned,
+    "VM_PURGABLE_PURGE_OWNED purges the least recently made volatile objects first, and notifies")
+{
+	mach_vm_address_t regions[NREGIONS];
+	struct kevent64_s kev = {
+		.ident = 0,
+		.filter = EVFILT_MEMORYSTATUS,
+		.flags = EV_ADD,
+		.fflags = NOTE_MEMORYSTATUS_PURGED,
+	};
+	struct timespec timeout = { .tv_sec = 5 };
+	struct kevent64_s out;
+	kern_return_t kr;
+	int kq, state, n;
+
+	for (int i = 0; i < NREGIONS; i++) {
+		regions[i] = 0;
+		kr = mach_vm_allocate(mach_task_self(), &regions[i], REGION_SIZE,
+		    VM_FLAGS_ANYWHERE | VM_FLAGS_PURGABLE);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_vm_allocate");
+		memset((void *)regions[i], 'a' + i, REGION_SIZE);
+	}
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(kq = kqueue(), "kqueue");
+	T_ASSERT_POSIX_SUCCESS(kevent64(kq, &kev, 1, NULL, 0, 0, NULL),
+	    "register for NOTE_MEMORYSTATUS_PURGED");
+
+	/* regions[0] is the least recently used one */
+	for (int i = 0; i < NREGIONS; i++) {
+		state = VM_PURGABLE_VOLATILE;
+		kr = mach_vm_purgable_control(mach_task_self(), regions[i],
+		    VM_PURGABLE_SET_STATE, &state);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "make region %d volatile", i);
+	}
+
+	state = (int)(2 * REGION_SIZE / vm_page_size);
+	kr = mach_vm_purgable_control(mach_task_self(), 0, VM_PURGABLE_PURGE_OWNED, &state);
+	T_ASSERT_MACH_SUCCESS(kr, "VM_PURGABLE_PURGE_OWNED");
+	T_EXPECT_GE(state, (int)(2 * REGION_SIZE / vm_page_size), "purged %d pages", state);
+
+	for (int i = 0; i < NREGIONS; i++) {
+		kr = mach_vm_purgable_control(mach_task_self(), regions[i],
+		    VM_PURGABLE_GET_STATE, &state);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "get state of region %d", i);
+		T_EXPECT_EQ(state & VM_PURGABLE_STATE_MASK,
+		    i < 2 ? VM_PURGABLE_EMPTY : VM_PURGABLE_VOLATILE,
+		    "state of region %d", i);
+	}
+
+	/* delivered from a thread call */
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(n = kevent64(kq, NULL, 0, &out, 1, 0, &timeout),
+	    "kevent64");
+	T_ASSERT_EQ(n, 1, "got a notification");
+	T_EXPECT_TRUE(out.fflags & NOTE_MEMORYSTATUS_PURGED, "NOTE_MEMORYSTATUS_PURGED");
+
+	state = -1;
+	kr = mach_vm_purgable_control(mach_task_self(), 0, VM_PURGABLE_PURGE_OWNED, &state);
+	T_EXPECT_MACH_ERROR(kr, KERN_INVALID_ARGUMENT, "negative target rejected");
+
+	close(kq);
+	for (int i = 0; i < NREGIONS; i++) {
+		mach_vm_deallocate(mach_task_self(), regions[i], REGION_SIZE);
+	}
+}
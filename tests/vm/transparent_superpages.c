@@ -0,0 +1,193 @@
+#include <sys/sysctl.h>
+#include <sys/mman.h>
+#include <mach/mach.h>
+#include <mach/mach_vm.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <darwintest.h>
+#include <darwintest_utils.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.vm"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("VM"),
+	T_META_CHECK_LEAKS(false),
+	T_META_RUN_CONCURRENTLY(false));
+
+#define SUPERPAGE_SIZE  (2UL << 20)
+#define NSUPERPAGES     4
+#define WAIT_SECS       10
+/* a leaked promotion credit is SUPERPAGE_SIZE - PAGE_SIZE */
+#define FOOTPRINT_SLACK (SUPERPAGE_SIZE / 4)
+
+static int saved_enable = -1;
+static uint32_t saved_max_promotions = UINT32_MAX;
+
+static void
+restore_enable(void)
+{
+	if (saved_max_promotions != UINT32_MAX) {
+		sysctlbyname("vm.superpage_scan_max_promotions", NULL, NULL,
+		    &saved_max_promotions, sizeof(saved_max_promotions));
+	}
+	if (saved_enable >= 0) {
+		sysctlbyname("vm.transparent_superpages", NULL, NULL,
+		    &saved_enable, sizeof(saved_enable));
+	}
+}
+
+static uint64_t
+sysctl_u64(const char *name)
+{
+	uint64_t value = 0;
+	size_t size = sizeof(value);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, &value, &size, NULL, 0),
+	    "%s", name);
+	return value;
+}
+
+static uint32_t
+self_promoted(void)
+{
+	uint32_t value = 0;
+	size_t size = sizeof(value);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.self_superpage_promoted",
+	    &value, &size, NULL, 0), "vm.self_superpage_promoted");
+	return value;
+}
+
+static int64_t
+footprint(void)
+{
+	task_vm_info_data_t info;
+	mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+
+	T_QUIET; T_ASSERT_MACH_SUCCESS(task_info(mach_task_self(), TASK_VM_INFO,
+	    (task_info_t)&info, &count), "task_info(TASK_VM_INFO)");
+	return (int64_t)info.phys_footprint;
+}
+
+static void
+expect_footprint(int64_t expected, const char *what)
+{
+	int64_t delta = footprint() - expected;
+
+	T_EXPECT_LE(llabs(delta), (long long)FOOTPRINT_SLACK,
+	    "phys_footprint after %s is off by %lld bytes", what, delta);
+}
+
+T_DECL(transparent_superpages,
+    "populated anonymous ranges get promoted, and split when partially protected, unmapped or overwritten",
+    T_META_ASROOT(true))
+{
+	size_t page_size = (size_t)getpagesize();
+	size_t size = sizeof(saved_enable);
+	uint64_t splits, promoted_count;
+	uint32_t pause = 0, promoted = 0;
+	int64_t fp_start, fp_filled;
+	mach_vm_address_t src;
+	kern_return_t kr;
+	int enable = 1;
+	char *raw, *buf;
+
+	if (sysctlbyname("vm.transparent_superpages", &saved_enable, &size,
+	    &enable, sizeof(enable)) != 0) {
+		T_QUIET; T_ASSERT_EQ(errno, ENOENT, "vm.transparent_superpages");
+		T_SKIP("no transparent superpages on this configuration");
+	}
+	T_ATEND(restore_enable);
+
+	fp_start = footprint();
+
+	/* one extra superpage to align the range on */
+	raw = mmap(NULL, (NSUPERPAGES + 1) * SUPERPAGE_SIZE, PROT_READ | PROT_WRITE,
+	    MAP_ANON | MAP_PRIVATE, -1, 0);
+	T_QUIET; T_ASSERT_NE((void *)raw, MAP_FAILED, "mmap");
+	buf = (char *)(((uintptr_t)raw + SUPERPAGE_SIZE - 1) & ~(SUPERPAGE_SIZE - 1));
+	for (size_t off = 0; off < NSUPERPAGES * SUPERPAGE_SIZE; off += page_size) {
+		buf[off] = (char)(off / page_size);
+	}
+	fp_filled = footprint();
+
+	for (int i = 0; i < WAIT_SECS * 10; i++) {
+		promoted = self_promoted();
+		if (promoted == NSUPERPAGES) {
+			break;
+		}
+		usleep(100 * 1000);
+	}
+
+	/* no more promotions: the counts below only move with what we do */
+	size = sizeof(saved_max_promotions);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.superpage_scan_max_promotions",
+	    &saved_max_promotions, &size, &pause, sizeof(pause)),
+	    "vm.superpage_scan_max_promotions");
+
+	promoted = self_promoted();
+	if (promoted != NSUPERPAGES) {
+		T_SKIP("%u of %d ranges promoted, no contiguous memory?",
+		    promoted, NSUPERPAGES);
+	}
+	splits = sysctl_u64("vm.superpage_splits");
+	promoted_count = sysctl_u64("vm.superpage_promoted_count");
+	T_EXPECT_GE(promoted_count, (uint64_t)NSUPERPAGES,
+	    "vm.superpage_promoted_count covers our ranges");
+	expect_footprint(fp_filled, "promotion");
+
+	/* split the first superpage with a protection change... */
+	T_ASSERT_POSIX_SUCCESS(mprotect(buf + page_size, page_size, PROT_READ),
+	    "mprotect within the first superpage");
+	T_EXPECT_EQ(self_promoted(), NSUPERPAGES - 1, "mprotect split a superpage");
+	/* ...and the second one with a hole */
+	T_ASSERT_POSIX_SUCCESS(munmap(buf + SUPERPAGE_SIZE + page_size, page_size),
+	    "munmap within the second superpage");
+	T_EXPECT_EQ(self_promoted(), NSUPERPAGES - 2, "munmap split a superpage");
+	expect_footprint(fp_filled - (int64_t)page_size, "splitting");
+
+	for (size_t off = 0; off < NSUPERPAGES * SUPERPAGE_SIZE; off += page_size) {
+		if (off == SUPERPAGE_SIZE + page_size) {
+			continue;
+		}
+		T_QUIET; T_ASSERT_EQ(buf[off], (char)(off / page_size),
+		    "contents at offset 0x%zx", off);
+	}
+	T_PASS("contents survived promotion and splitting");
+
+	/* overwrite the third superpage with vm_write, the fourth with vm_copy */
+	kr = mach_vm_allocate(mach_task_self(), &src, SUPERPAGE_SIZE,
+	    VM_FLAGS_ANYWHERE);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_vm_allocate");
+	memset((void *)src, 0x5a, SUPERPAGE_SIZE);
+
+	kr = mach_vm_write(mach_task_self(),
+	    (mach_vm_address_t)(buf + 2 * SUPERPAGE_SIZE),
+	    (vm_offset_t)src, (mach_msg_type_number_t)SUPERPAGE_SIZE);
+	T_ASSERT_MACH_SUCCESS(kr, "mach_vm_write over the third superpage");
+	T_EXPECT_EQ(self_promoted(), NSUPERPAGES - 3, "mach_vm_write split a superpage");
+	kr = mach_vm_copy(mach_task_self(), src, SUPERPAGE_SIZE,
+	    (mach_vm_address_t)(buf + 3 * SUPERPAGE_SIZE));
+	T_ASSERT_MACH_SUCCESS(kr, "mach_vm_copy over the fourth superpage");
+	T_EXPECT_EQ(self_promoted(), 0, "mach_vm_copy split a superpage");
+
+	for (size_t off = 2 * SUPERPAGE_SIZE; off < NSUPERPAGES * SUPERPAGE_SIZE; off += page_size) {
+		T_QUIET; T_ASSERT_EQ(buf[off], (char)0x5a, "contents at offset 0x%zx", off);
+	}
+	T_PASS("overwritten superpages hold the new contents");
+
+	T_EXPECT_GE(sysctl_u64("vm.superpage_splits") - splits, (uint64_t)NSUPERPAGES,
+	    "every superpage was split");
+	T_EXPECT_LE(sysctl_u64("vm.superpage_promoted_count"),
+	    promoted_count - NSUPERPAGES,
+	    "vm.superpage_promoted_count dropped with the splits");
+
+	kr = mach_vm_deallocate(mach_task_self(), src, SUPERPAGE_SIZE);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_vm_deallocate");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(munmap(raw, (NSUPERPAGES + 1) * SUPERPAGE_SIZE),
+	    "munmap");
+	expect_footprint(fp_start, "unmapping everything");
+}
@@ -0,0 +1,198 @@
+#include <darwintest.h>
+#include <mach/mach.h>
+#include <mach/mach_vm.h>
+#include <mach/vm_types.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.vm"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("VM"),
+	T_META_RUN_CONCURRENTLY(true)
+	);
+
+#define NPAGES  16
+
+static mach_vm_address_t
+allocate_pages(void)
+{
+	mach_vm_address_t addr = 0;
+	kern_return_t kr;
+
+	kr = mach_vm_allocate(mach_task_self(), &addr, NPAGES * PAGE_SIZE,
+	    VM_FLAGS_ANYWHERE);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_vm_allocate");
+
+	/* fault everything in so that protections reach the pmap */
+	for (int i = 0; i < NPAGES; i++) {
+		*(volatile char *)(addr + i * PAGE_SIZE) = 1;
+	}
+	return addr;
+}
+
+static kern_return_t
+region_at(mach_vm_address_t addr, mach_vm_address_t *start, vm_prot_t *prot,
+    vm_prot_t *max_prot)
+{
+	vm_region_basic_info_data_64_t info;
+	mach_msg_type_number_t count = VM_REGION_BASIC_INFO_COUNT_64;
+	mach_vm_size_t size = 0;
+	mach_port_t object_name;
+	kern_return_t kr;
+
+	*start = addr;
+	kr = mach_vm_region(mach_task_self(), start, &size,
+	    VM_REGION_BASIC_INFO_64, (vm_region_info_t)&info, &count,
+	    &object_name);
+	if (kr == KERN_SUCCESS) {
+		*prot = info.protection;
+		*max_prot = info.max_protection;
+	}
+	return kr;
+}
+
+static kern_return_t
+batch(mach_vm_batch_op_t *ops, unsigned int count, natural_t *completed)
+{
+	return mach_vm_batch(mach_task_self(), MACH_VM_BATCH_FLAVOR_V1,
+	           (mach_vm_batch_ops_raw_t)ops,
+	           (mach_msg_type_number_t)(count * sizeof(*ops)), completed);
+}
+
+T_DECL(vm_batch_protect_deallocate,
+    "mach_vm_batch() applies protections and deallocations in order")
+{
+	mach_vm_address_t addr = allocate_pages();
+	mach_vm_address_t start;
+	mach_vm_batch_op_t ops[NPAGES];
+	vm_prot_t prot, max_prot;
+	natural_t completed;
+	kern_return_t kr;
+
+	/* even pages read-only, odd pages gone; the last one also loses max write */
+	for (int i = 0; i < NPAGES; i++) {
+		ops[i] = (mach_vm_batch_op_t){
+			.address = addr + i * PAGE_SIZE,
+			.size = PAGE_SIZE,
+			.op = (i & 1) ? MACH_VM_BATCH_OP_DEALLOCATE : MACH_VM_BATCH_OP_PROTECT,
+			.new_protection = VM_PROT_READ,
+		};
+	}
+	ops[NPAGES - 2].set_maximum = 1;
+
+	kr = batch(ops, NPAGES, &completed);
+	T_ASSERT_MACH_SUCCESS(kr, "mach_vm_batch");
+	T_ASSERT_EQ(completed, NPAGES, "every operation was applied");
+
+	for (int i = 0; i < NPAGES; i += 2) {
+		kr = region_at(addr + i * PAGE_SIZE, &start, &prot, &max_prot);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_vm_region");
+		T_QUIET; T_ASSERT_EQ(start, addr + i * PAGE_SIZE, "page %d is mapped", i);
+		T_QUIET; T_ASSERT_EQ(prot, VM_PROT_READ, "page %d is read-only", i);
+		T_QUIET; T_ASSERT_EQ(max_prot,
+		    i == NPAGES - 2 ? VM_PROT_READ : VM_PROT_ALL,
+		    "page %d max protection", i);
+		T_QUIET; T_ASSERT_EQ(*(volatile char *)(addr + i * PAGE_SIZE), 1,
+		    "page %d kept its contents", i);
+
+		kr = region_at(addr + (i + 1) * PAGE_SIZE, &start, &prot, &max_prot);
+		T_QUIET; T_ASSERT_TRUE(kr != KERN_SUCCESS ||
+		    start != addr + (i + 1) * PAGE_SIZE,
+		    "page %d is deallocated", i + 1);
+	}
+	T_PASS("protections and holes are where the batch put them");
+
+	for (int i = 0; i < NPAGES; i += 2) {
+		mach_vm_deallocate(mach_task_self(), addr + i * PAGE_SIZE, PAGE_SIZE);
+	}
+}
+
+T_DECL(vm_batch_stops_at_failure,
+    "mach_vm_batch() stops at the first failing operation")
+{
+	mach_vm_address_t addr = allocate_pages();
+	mach_vm_address_t start;
+	vm_prot_t prot, max_prot;
+	natural_t completed;
+	kern_return_t kr;
+	mach_vm_batch_op_t ops[] = {
+		{ .address = addr, .size = PAGE_SIZE,
+		  .op = MACH_VM_BATCH_OP_PROTECT, .new_protection = VM_PROT_READ, },
+		{ .address = addr + PAGE_SIZE, .size = PAGE_SIZE,
+		  .op = MACH_VM_BATCH_OP_DEALLOCATE, },
+		/* spans the hole the previous operation made */
+		{ .address = addr, .size = 3 * PAGE_SIZE,
+		  .op = MACH_VM_BATCH_OP_PROTECT, .new_protection = VM_PROT_NONE, },
+		{ .address = addr + 2 * PAGE_SIZE, .size = PAGE_SIZE,
+		  .op = MACH_VM_BATCH_OP_DEALLOCATE, },
+	};
+
+	kr = batch(ops, 4, &completed);
+	T_ASSERT_MACH_ERROR(kr, KERN_INVALID_ADDRESS, "protecting across a hole fails");
+	T_ASSERT_EQ(completed, 2, "the operations before the failure were applied");
+
+	kr = region_at(addr, &start, &prot, &max_prot);
+	T_ASSERT_MACH_SUCCESS(kr, "mach_vm_region");
+	T_ASSERT_EQ(prot, VM_PROT_READ, "the first protection stuck");
+
+	kr = region_at(addr + 2 * PAGE_SIZE, &start, &prot, &max_prot);
+	T_ASSERT_MACH_SUCCESS(kr, "mach_vm_region");
+	T_ASSERT_EQ(start, addr + 2 * PAGE_SIZE, "the last deallocation didn't run");
+	T_ASSERT_EQ(prot, VM_PROT_DEFAULT, "the failed protection left no trace");
+
+	mach_vm_deallocate(mach_task_self(), addr, NPAGES * PAGE_SIZE);
+}
+
+T_DECL(vm_batch_invalid_arguments,
+    "mach_vm_batch() validates the whole vector before applying any of it")
+{
+	mach_vm_address_t addr = allocate_pages();
+	mach_vm_address_t start;
+	vm_prot_t prot, max_prot;
+	natural_t completed;
+	kern_return_t kr;
+	mach_vm_batch_op_t ops[] = {
+		{ .address = addr, .size = PAGE_SIZE,
+		  .op = MACH_VM_BATCH_OP_DEALLOCATE, },
+		{ .address = addr + PAGE_SIZE, .size = PAGE_SIZE,
+		  .op = MACH_VM_BATCH_OP_PROTECT, },
+	};
+
+	ops[1].new_protection = VM_PROT_READ | VM_PROT_COPY;
+	kr = batch(ops, 2, &completed);
+	T_ASSERT_MACH_ERROR(kr, KERN_INVALID_ARGUMENT, "VM_PROT_COPY is rejected");
+	T_ASSERT_EQ(completed, 0, "nothing was applied");
+
+	ops[1].new_protection = VM_PROT_READ;
+	ops[1].op = MACH_VM_BATCH_OP_INVALID;
+	kr = batch(ops, 2, &completed);
+	T_ASSERT_MACH_ERROR(kr, KERN_INVALID_ARGUMENT, "unknown operations are rejected");
+
+	ops[1].op = MACH_VM_BATCH_OP_PROTECT;
+	ops[1].size = (mach_vm_size_t)-1;
+	kr = batch(ops, 2, &completed);
+	T_ASSERT_MACH_ERROR(kr, KERN_INVALID_ARGUMENT, "wrapping ranges are rejected");
+
+	/* only wraps once rounded to pages */
+	ops[1].address = (mach_vm_address_t)-PAGE_SIZE + 1;
+	ops[1].size = PAGE_SIZE - 2;
+	kr = batch(ops, 2, &completed);
+	T_ASSERT_MACH_ERROR(kr, KERN_INVALID_ARGUMENT,
+	    "ranges overflowing after page rounding are rejected");
+	T_ASSERT_EQ(completed, 0, "nothing was applied");
+
+	ops[1].address = addr + PAGE_SIZE;
+	ops[1].size = PAGE_SIZE;
+	kr = mach_vm_batch(mach_task_self(), MACH_VM_BATCH_FLAVOR_V1,
+	    (mach_vm_batch_ops_raw_t)ops, sizeof(ops) - 1, &completed);
+	T_ASSERT_MACH_ERROR(kr, KERN_INVALID_ARGUMENT, "partial operations are rejected");
+
+	kr = mach_vm_batch(mach_task_self(), MACH_VM_BATCH_FLAVOR_INVALID,
+	    (mach_vm_batch_ops_raw_t)ops, sizeof(ops), &completed);
+	T_ASSERT_MACH_ERROR(kr, KERN_INVALID_ARGUMENT, "unknown flavors are rejected");
+
+	kr = region_at(addr, &start, &prot, &max_prot);
+	T_ASSERT_MACH_SUCCESS(kr, "mach_vm_region");
+	T_ASSERT_EQ(start, addr, "the deallocation never ran");
+
+	mach_vm_deallocate(mach_task_self(), addr, NPAGES * PAGE_SIZE);
+}
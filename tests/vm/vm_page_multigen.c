@@ -0,0 +1,201 @@
+#include <sys/sysctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <darwintest.h>
+#include <darwintest_utils.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.vm"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("VM"),
+	T_META_CHECK_LEAKS(false),
+	T_META_RUN_CONCURRENTLY(false));
+
+#define FILE_SIZE       (32UL << 20)
+#define WIRE_CHUNK      (64UL << 20)
+#define HOLD_PASSES     20
+
+static const char *gen_counters[] = {
+	"vm.page_active_seq",
+	"vm.page_gen_promoted",
+	"vm.page_gen_aged",
+	"vm.page_gen_clustered",
+};
+#define NCOUNTERS       (sizeof(gen_counters) / sizeof(gen_counters[0]))
+#define ACTIVE_SEQ      0
+#define GEN_AGED        2
+#define GEN_CLUSTERED   3
+
+static int saved_multigen = -1;
+
+static void
+restore_multigen(void)
+{
+	if (saved_multigen >= 0) {
+		sysctlbyname("vm.page_multigen", NULL, NULL,
+		    &saved_multigen, sizeof(saved_multigen));
+	}
+}
+
+static uint64_t
+sysctl_u64(const char *name)
+{
+	uint64_t value = 0;
+	size_t size = sizeof(value);
+
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(sysctlbyname(name, &value, &size, NULL, 0),
+	    "%s", name);
+	return value;
+}
+
+static void
+touch(volatile const char *buf, size_t size, size_t page_size)
+{
+	for (size_t off = 0; off < size; off += page_size) {
+		(void)buf[off];
+	}
+}
+
+static size_t
+resident_pages(char *buf, size_t size, size_t page_size)
+{
+	size_t npages = size / page_size, count = 0;
+	char *vec = malloc(npages);
+
+	T_QUIET; T_ASSERT_NOTNULL(vec, "malloc");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(mincore(buf, size, vec), "mincore");
+	for (size_t i = 0; i < npages; i++) {
+		count += (vec[i] & MINCORE_INCORE) != 0;
+	}
+	free(vec);
+	return count;
+}
+
+/*
+ * Reads a file made of a "hot" half, which keeps being referenced,
+ * and a "cold" half, which isn't touched again, then wires memory until
+ * the free page count falls under the pageout daemon's target, so that
+ * it has to age the active queue and reclaim pages.
+ */
+T_DECL(vm_page_multigen,
+    "with vm.page_multigen, pages in use survive the reclaim of idle ones",
+    T_META_ASROOT(true))
+{
+	size_t page_size = (size_t)getpagesize();
+	size_t size = sizeof(saved_multigen);
+	size_t npages = FILE_SIZE / page_size;
+	uint64_t before[NCOUNTERS], delta[NCOUNTERS];
+	uint64_t memsize, wire_limit, wired = 0;
+	size_t hot_resident, cold_resident;
+	char path[] = "/tmp/vm_page_multigen.XXXXXX";
+	char *chunks[256];
+	uint32_t distance[8];
+	unsigned int nchunks = 0;
+	int enable = 1;
+	char *file, *hot, *cold;
+	int fd;
+
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.page_multigen", &saved_multigen,
+	    &size, &enable, sizeof(enable)), "enable vm.page_multigen");
+	T_ATEND(restore_multigen);
+
+	fd = mkstemp(path);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fd, "mkstemp");
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(unlink(path), "unlink");
+	file = malloc(2 * FILE_SIZE);
+	T_QUIET; T_ASSERT_NOTNULL(file, "malloc");
+	memset(file, 'x', 2 * FILE_SIZE);
+	T_QUIET; T_ASSERT_EQ(pwrite(fd, file, 2 * FILE_SIZE, 0), (ssize_t)(2 * FILE_SIZE),
+	    "pwrite");
+	free(file);
+	/* clean pages, so that reclaiming them doesn't wait on I/O */
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(fsync(fd), "fsync");
+
+	file = mmap(NULL, 2 * FILE_SIZE, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
+	T_QUIET; T_ASSERT_NE((void *)file, MAP_FAILED, "mmap");
+	hot = file;
+	cold = file + FILE_SIZE;
+	touch(hot, FILE_SIZE, page_size);
+	touch(cold, FILE_SIZE, page_size);
+
+	for (size_t i = 0; i < NCOUNTERS; i++) {
+		before[i] = sysctl_u64(gen_counters[i]);
+	}
+
+	struct rlimit rl = { RLIM_INFINITY, RLIM_INFINITY };
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(setrlimit(RLIMIT_MEMLOCK, &rl), "RLIMIT_MEMLOCK");
+	memsize = sysctl_u64("hw.memsize");
+	wire_limit = sysctl_u64("vm.user_wire_limit");
+	while (sysctl_u64("vm.page_free_count") >= sysctl_u64("vm.vm_page_free_target")) {
+		char *chunk;
+
+		if (wired + WIRE_CHUNK > memsize / 2 || wired + WIRE_CHUNK > wire_limit ||
+		    nchunks == sizeof(chunks) / sizeof(chunks[0])) {
+			break;
+		}
+		chunk = mmap(NULL, WIRE_CHUNK, PROT_READ | PROT_WRITE,
+		    MAP_ANON | MAP_PRIVATE, -1, 0);
+		T_QUIET; T_ASSERT_NE((void *)chunk, MAP_FAILED, "mmap");
+		if (mlock(chunk, WIRE_CHUNK) != 0) {
+			T_LOG("mlock: %s", strerror(errno));
+			munmap(chunk, WIRE_CHUNK);
+			break;
+		}
+		chunks[nchunks++] = chunk;
+		wired += WIRE_CHUNK;
+		touch(hot, FILE_SIZE, page_size);
+	}
+	T_LOG("wired %llu MB", wired >> 20);
+
+	/* keep the hot half referenced while the pageout daemon catches up */
+	for (int pass = 0; pass < HOLD_PASSES; pass++) {
+		touch(hot, FILE_SIZE, page_size);
+		usleep(100 * 1000);
+	}
+
+	for (size_t i = 0; i < NCOUNTERS; i++) {
+		delta[i] = sysctl_u64(gen_counters[i]) - before[i];
+		T_LOG("%-24s +%llu", gen_counters[i], delta[i]);
+	}
+	hot_resident = resident_pages(hot, FILE_SIZE, page_size);
+	cold_resident = resident_pages(cold, FILE_SIZE, page_size);
+	T_LOG("resident: %zu/%zu hot pages, %zu/%zu cold pages",
+	    hot_resident, npages, cold_resident, npages);
+
+	for (unsigned int i = 0; i < nchunks; i++) {
+		munlock(chunks[i], WIRE_CHUNK);
+		munmap(chunks[i], WIRE_CHUNK);
+	}
+
+	if (cold_resident == npages) {
+		munmap(file, 2 * FILE_SIZE);
+		close(fd);
+		T_SKIP("couldn't wire enough memory to reclaim pages");
+	}
+
+	T_EXPECT_GT(delta[ACTIVE_SEQ], 0ULL, "the active queue was scanned");
+	T_EXPECT_GT(delta[GEN_AGED], 0ULL, "unreferenced active pages aged");
+	T_EXPECT_GT(delta[GEN_CLUSTERED], 0ULL,
+	    "idle neighbours were deactivated with the oldest pages");
+	T_EXPECT_GT(hot_resident, cold_resident,
+	    "pages in use outlived the idle ones");
+
+	size = sizeof(distance);
+	if (sysctlbyname("vm.phantom_cache_refault_distance", distance, &size,
+	    NULL, 0) == 0) {
+		T_EXPECT_EQ(size, sizeof(distance), "one counter per distance bucket");
+		for (size_t i = 0; i < size / sizeof(distance[0]); i++) {
+			T_LOG("refault distance bucket %zu: %u", i, distance[i]);
+		}
+	} else {
+		T_LOG("no phantom cache on this configuration");
+	}
+
+	munmap(file, 2 * FILE_SIZE);
+	close(fd);
+}
@@ -97,6 +97,61 @@ T_DECL(vm_reclaim_single_entry, "Place a single entry in the buffer and call syn
 	mach_vm_reclaim_synchronize(&ringbuffer, 1);
 }
 
+static bool
+get_reclaim_stats_for_pid(pid_t pid, mach_vm_reclaim_stats_v1_t *out)
+{
+	mach_vm_reclaim_stats_v1_t *stats;
+	size_t size = 0;
+	bool found = false;
+
+	int ret = sysctlbyname("vm.reclaim_stats", NULL, &size, NULL, 0);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(ret, "vm.reclaim_stats size");
+	stats = malloc(size);
+	T_QUIET; T_ASSERT_NOTNULL(stats, "malloc");
+	ret = sysctlbyname("vm.reclaim_stats", stats, &size, NULL, 0);
+	T_QUIET; T_ASSERT_POSIX_SUCCESS(ret, "vm.reclaim_stats");
+	for (size_t i = 0; i < size / sizeof(*stats); i++) {
+		if (stats[i].pid == pid) {
+			*out = stats[i];
+			found = true;
+			break;
+		}
+	}
+	free(stats);
+	return found;
+}
+
+T_DECL(vm_reclaim_merge_adjacent_entries, "Adjacent entries are reclaimed with fewer VM operations",
+    T_META_BOOTARGS_SET(VM_RECLAIM_THRESHOLD_BOOTARG_HIGH))
+{
+	struct mach_vm_reclaim_ringbuffer_v1_s ringbuffer;
+	static const size_t kNumEntries = 64;
+	const size_t kAllocationSize = vm_kernel_page_size;
+	mach_vm_reclaim_stats_v1_t stats;
+	mach_vm_address_t base = 0;
+
+	kern_return_t kr = mach_vm_reclaim_ringbuffer_init(&ringbuffer);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_vm_reclaim_ringbuffer_init");
+
+	kr = mach_vm_allocate(mach_task_self(), &base, kNumEntries * kAllocationSize, VM_FLAGS_ANYWHERE);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_vm_allocate");
+	memset((void *) base, 1, kNumEntries * kAllocationSize);
+	for (size_t i = 0; i < kNumEntries; i++) {
+		bool should_update_kernel_accounting = false;
+		mach_vm_reclaim_mark_free(&ringbuffer, base + i * kAllocationSize,
+		    (uint32_t) kAllocationSize, MACH_VM_RECLAIM_DEALLOCATE, &should_update_kernel_accounting);
+	}
+	kr = mach_vm_reclaim_synchronize(&ringbuffer, kNumEntries);
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_vm_reclaim_synchronize");
+
+	T_ASSERT_TRUE(get_reclaim_stats_for_pid(getpid(), &stats), "found our buffer in vm.reclaim_stats");
+	T_LOG("%llu entries reclaimed in %llu ranges, %llu bytes",
+	    stats.entries_reclaimed, stats.ranges_reclaimed, stats.bytes_reclaimed);
+	T_EXPECT_GE(stats.entries_reclaimed, (uint64_t) kNumEntries, "all entries were reclaimed");
+	T_EXPECT_LT(stats.ranges_reclaimed, stats.entries_reclaimed, "adjacent entries were merged");
+	T_EXPECT_GE(stats.bytes_reclaimed, (uint64_t) (kNumEntries * kAllocationSize), "bytes reclaimed are accounted");
+}
+
 static pid_t
 spawn_helper(char *helper)
 {
@@ -1,4 +1,5 @@
 #include <sys/sysctl.h>
+#include <errno.h>
 #include <signal.h>
 #include <darwintest.h>
 #include <darwintest_utils.h>
@@ -29,3 +30,40 @@ T_DECL(vm_map_non_aligned,
 {
 	T_EXPECT_EQ(1ull, run_sysctl_test("vm_map_non_aligned", 0), "vm_map_non_aligned");
 }
+
+T_DECL(vm_map_store_bench,
+    "Compare the red-black tree and the B+-tree map entry stores",
+    T_META_RUN_CONCURRENTLY(true))
+{
+	/* timings are reported in the kernel log */
+	T_EXPECT_EQ(1ull, run_sysctl_test("vm_map_store_bench", 100000), "vm_map_store_bench 100k");
+	T_EXPECT_EQ(1ull, run_sysctl_test("vm_map_store_bench", 500000), "vm_map_store_bench 500k");
+}
+
+T_DECL(vm_phantom_cache_workingset,
+    "Pages that refault within the working set are activated",
+    T_META_RUN_CONCURRENTLY(false))
+{
+	int64_t value = 0, result = 0;
+	unsigned long before, after;
+	size_t s = sizeof(before);
+	int rc;
+
+	if (sysctlbyname("vm.phantom_cache_workingset_refaults", &before, &s, NULL, 0) != 0) {
+		T_SKIP("no phantom cache on this configuration");
+	}
+
+	s = sizeof(result);
+	rc = sysctlbyname("debug.test.vm_phantom_cache_workingset", &result, &s,
+	    &value, sizeof(value));
+	if (rc != 0 && errno == ENOTSUP) {
+		T_SKIP("phantom cache or working set detection disabled");
+	}
+	T_ASSERT_POSIX_SUCCESS(rc, "sysctlbyname(vm_phantom_cache_workingset)");
+	T_EXPECT_EQ(1ll, result, "the refaulted page was activated");
+
+	s = sizeof(after);
+	T_ASSERT_POSIX_SUCCESS(sysctlbyname("vm.phantom_cache_workingset_refaults",
+	    &after, &s, NULL, 0), "vm.phantom_cache_workingset_refaults");
+	T_EXPECT_GE(after - before, 1ul, "vm.phantom_cache_workingset_refaults went up");
+}
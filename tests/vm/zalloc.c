@@ -44,6 +44,14 @@ T_DECL(zone_gc_stress_test, "stress test for zone_gc")
 	T_EXPECT_EQ(1ull, run_sysctl_test("zone_gc_stress_test", 10), "zone_gc_stress_test");
 }
 
+T_DECL(zone_batch_test, "zalloc_n/zfree_n against zalloc/zfree")
+{
+	/* timings are reported in the kernel log */
+	T_EXPECT_EQ(1ull, run_sysctl_test("zone_batch_test", 4), "zone_batch_test 4");
+	T_EXPECT_EQ(1ull, run_sysctl_test("zone_batch_test", 16), "zone_batch_test 16");
+	T_EXPECT_EQ(1ull, run_sysctl_test("zone_batch_test", 64), "zone_batch_test 64");
+}
+
 #define ZLOG_ZONE "data.kalloc.128"
 
 T_DECL(zlog_smoke_test, "check that zlog functions at all",
@@ -0,0 +1,102 @@
+#include <string.h>
+#include <stdlib.h>
+#include <mach/mach.h>
+#include <mach_debug/mach_debug.h>
+#include <darwintest.h>
+
+T_GLOBAL_META(
+	T_META_NAMESPACE("xnu.vm"),
+	T_META_RADAR_COMPONENT_NAME("xnu"),
+	T_META_RADAR_COMPONENT_VERSION("zalloc"),
+	T_META_CHECK_LEAKS(false),
+	T_META_RUN_CONCURRENTLY(true)
+	);
+
+extern kern_return_t mach_zone_cache_info(
+	host_priv_t                     host,
+	mach_zone_name_array_t          *names,
+	mach_msg_type_number_t          *namesCnt,
+	mach_zone_cache_info_array_t    *info,
+	mach_msg_type_number_t          *infoCnt);
+
+/*
+ * Magazines are 8 elements at least (the default on small machines),
+ * and at most 8 times the size of the initial ones.
+ */
+#define ZC_MAG_SIZE_MIN         8
+#define ZC_MAG_SIZE_MAX         ((128 / 8) * 8)
+
+T_DECL(zalloc_cache_info,
+    "verifies the per-cpu cache state reported by mach_zone_cache_info",
+    T_META_ASROOT(true))
+{
+	kern_return_t kr;
+	mach_zone_name_t *name = NULL;
+	unsigned int nameCnt = 0;
+	mach_zone_cache_info_t *info = NULL;
+	unsigned int infoCnt = 0;
+	unsigned int cached_zones = 0;
+	uint64_t hits = 0;
+
+	/* generate some caching activity in the ipc zones */
+	for (int i = 0; i < 1000; i++) {
+		mach_port_t port;
+
+		kr = mach_port_allocate(mach_task_self(),
+		    MACH_PORT_RIGHT_RECEIVE, &port);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_allocate");
+		kr = mach_port_mod_refs(mach_task_self(), port,
+		    MACH_PORT_RIGHT_RECEIVE, -1);
+		T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "mach_port_mod_refs");
+	}
+
+	kr = mach_zone_cache_info(mach_host_self(),
+	    &name, &nameCnt, &info, &infoCnt);
+	T_ASSERT_MACH_SUCCESS(kr, "mach_zone_cache_info");
+	T_QUIET; T_ASSERT_EQ(nameCnt, infoCnt, "zone name and info counts don't match");
+
+	for (unsigned int i = 0; i < infoCnt; i++) {
+		mach_zone_cache_info_t *zci = &info[i];
+
+		if (zci->mzci_mag_size == 0) {
+			T_QUIET; T_ASSERT_EQ(zci->mzci_cached, 0ull,
+			    "%s: elements cached without a cache", name[i].mzn_name);
+			continue;
+		}
+
+		cached_zones++;
+		hits += zci->mzci_depot_hits;
+
+		T_QUIET; T_ASSERT_GE(zci->mzci_mag_size, (uint64_t)ZC_MAG_SIZE_MIN,
+		    "%s: magazine size", name[i].mzn_name);
+		T_QUIET; T_ASSERT_LE(zci->mzci_mag_size, (uint64_t)ZC_MAG_SIZE_MAX,
+		    "%s: magazine size", name[i].mzn_name);
+		T_QUIET; T_ASSERT_LE(zci->mzci_depot_size, zci->mzci_depot_limit,
+		    "%s: depot size within its limit", name[i].mzn_name);
+
+		if (zci->mzci_cluster_xfrees || zci->mzci_cluster_steals) {
+			T_LOG("%-32s cluster xfrees %lld, steals %lld",
+			    name[i].mzn_name, zci->mzci_cluster_xfrees,
+			    zci->mzci_cluster_steals);
+		}
+
+		if (zci->mzci_mag_resizes) {
+			T_LOG("%-32s mag %3lld (%lld resizes), depot %lld/%lld, "
+			    "hits %lld, misses %lld, contended %lld",
+			    name[i].mzn_name, zci->mzci_mag_size, zci->mzci_mag_resizes,
+			    zci->mzci_depot_size, zci->mzci_depot_limit,
+			    zci->mzci_depot_hits, zci->mzci_depot_misses,
+			    zci->mzci_depot_contended);
+		}
+	}
+
+	T_EXPECT_GT(cached_zones, 0u, "some zones have per-cpu caching enabled");
+	T_EXPECT_GT(hits, 0ull, "the per-cpu depots are being used");
+
+	kr = vm_deallocate(mach_task_self(), (vm_address_t)name,
+	    (vm_size_t)(nameCnt * sizeof *name));
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "vm_deallocate name");
+	kr = vm_deallocate(mach_task_self(), (vm_address_t)info,
+	    (vm_size_t)(infoCnt * sizeof *info));
+	T_QUIET; T_ASSERT_MACH_SUCCESS(kr, "vm_deallocate info");
+}
@@ -18,40 +18,74 @@ import xnudefines
 import kmemory
 
 @lldb_type_summary(['struct ipc_entry_table *', 'ipc_entry_table_t'])
-def PrintIpcEntryTable(array):
-    t, s = kalloc_array_decode(array, 'struct ipc_entry')
-    return "ptr = {:#x}, size = {:d}, elem_type = struct ipc_entry".format(unsigned(t), s)
+def PrintIpcEntryTable(table):
+    return "ptr = {:#x}, chunks = {:d}, size = {:d}, elem_type = struct ipc_entry".format(
+        unsigned(table), unsigned(table.iet_nchunks), GetSpaceTableCount(table))
 
 @lldb_type_summary(['struct ipc_port_requests_table *', 'ipc_port_requests_table_t'])
 def PrintIpcPortRequestTable(array):
     t, s = kalloc_array_decode(array, 'struct ipc_port_requests')
     return "ptr = {:#x}, size = {:d}, elem_type = struct ipc_port_requests".format(unsigned(t), s)
 
+IPC_ENTRY_CHUNK_SHIFT = 10
+
+def GetSpaceTableChunks(table):
+    """ Return the decoded chunks of entries of an ipc_entry_table
+    """
+    chunks = kern.GetValueFromAddress(unsigned(addressof(table.iet_chunks)), 'ipc_entry_chunk_t *')
+    return [
+        kalloc_array_decode(chunks[i], 'struct ipc_entry')
+        for i in range(unsigned(table.iet_nchunks))
+    ]
+
+def GetSpaceTableCount(table):
+    """ Return the number of entries of an ipc_entry_table
+    """
+    nchunks = unsigned(table.iet_nchunks)
+    if nchunks == 1:
+        return GetSpaceTableChunks(table)[0][1]
+    return nchunks << IPC_ENTRY_CHUNK_SHIFT
+
 def GetSpaceTable(space):
-    """ Return the tuple of (entries, size) of the table for a space
+    """ Return the tuple of (table, size) of the entry table for a space
     """
     table = space.is_table.__smr_ptr
     if table:
-        return kalloc_array_decode(table, 'struct ipc_entry')
+        return (table, GetSpaceTableCount(table))
     return (None, 0)
 
+def GetSpaceEntryAtIndex(is_tableval, index):
+    """ Return the ipc_entry at the given index of an entry table
+    """
+    chunk, _ = GetSpaceTableChunks(is_tableval)[index >> IPC_ENTRY_CHUNK_SHIFT]
+    return GetObjectAtIndexFromArray(chunk, index & ((1 << IPC_ENTRY_CHUNK_SHIFT) - 1))
+
+def GetSpaceEntries(is_tableval, num_entries):
+    """ Iterate the (index, entry) pairs of an entry table, skipping index 0
+    """
+    index = 0
+    for chunk, size in GetSpaceTableChunks(is_tableval):
+        base = chunk.GetSBValue().Dereference()
+        for iep in base.xIterSiblings(0, min(size, num_entries - index)):
+            if index:
+                yield (index, iep)
+            index += 1
+
 def GetSpaceEntriesWithBits(is_tableval, num_entries, mask):
-    base = is_tableval.GetSBValue().Dereference()
     return (
         (index, iep)
-        for index, iep in enumerate(base.xIterSiblings(1, num_entries), 1)
+        for index, iep in GetSpaceEntries(is_tableval, num_entries)
         if  iep.xGetIntegerByName('ie_bits') & mask
     )
 
 def GetSpaceObjectsWithBits(is_tableval, num_entries, mask, ty):
-    base = is_tableval.GetSBValue().Dereference()
     return (
         iep.xCreateValueFromAddress(
             None,
             iep.xGetIntegerByName('ie_object'),
             ty,
         )
-        for iep in base.xIterSiblings(1, num_entries)
+        for _, iep in GetSpaceEntries(is_tableval, num_entries)
         if  iep.xGetIntegerByName('ie_bits') & mask
     )
 
@@ -441,7 +475,7 @@ def PrintPortSetSummary(pset, space=0, verbose=True, O=None):
     if space:
         is_tableval, _ = GetSpaceTable(space)
         if is_tableval:
-            entry_val = GetObjectAtIndexFromArray(is_tableval, local_name >> 8)
+            entry_val = GetSpaceEntryAtIndex(is_tableval, local_name >> 8)
             local_name |= unsigned(entry_val.ie_bits) >> 24
         dest = GetSpaceProcDesc(space)
     else:
@@ -781,12 +815,12 @@ def GetPortUserStack(port, task):
     return out_str
 
 @lldb_type_summary(['ipc_space *'])
-@header("{0: <20s} {1: <20s} {2: <20s} {3: <8s} {4: <10s} {5: >8s} {6: <8s}".format('ipc_space', 'is_task', 'is_table', 'flags', 'ports', 'low_mod', 'high_mod'))
+@header("{0: <20s} {1: <20s} {2: <20s} {3: <8s} {4: <10s} {5: >8s}".format('ipc_space', 'is_task', 'is_table', 'flags', 'ports', 'chunks'))
 def PrintIPCInformation(space, show_entries=False, show_userstack=False, rights_filter=0):
     """ Provide a summary of the ipc space
     """
     out_str = ''
-    format_string = "{0: <#20x} {1: <#20x} {2: <#20x} {3: <8s} {4: <10d} {5: >8d} {6: <8d}"
+    format_string = "{0: <#20x} {1: <#20x} {2: <#20x} {3: <8s} {4: <10d} {5: >8d}"
     is_tableval, num_entries = GetSpaceTable(space)
     flags =''
     if is_tableval:
@@ -796,7 +830,7 @@ def PrintIPCInformation(space, show_entries=False, show_userstack=False, rights_
     if (space.is_grower) != 0:
         flags += 'G'
     print(format_string.format(space, space.is_task, is_tableval if is_tableval else 0, flags,
-            num_entries, space.is_low_mod, space.is_high_mod))
+            num_entries, unsigned(is_tableval.iet_nchunks) if is_tableval else 0))
 
     #should show the each individual entries if asked.
     if show_entries and is_tableval:
@@ -1266,13 +1300,12 @@ def IterateAllPorts(tasklist, func, ctx, include_psets, follow_busyports, should
         if not is_tableval:
             continue
 
-        base  = is_tableval.GetSBValue().Dereference()
         entries = (
-            value(iep.AddressOf())
-            for iep in base.xIterSiblings(1, num_entries)
+            (index, value(iep.AddressOf()))
+            for index, iep in GetSpaceEntries(is_tableval, num_entries)
         )
 
-        for idx, entry_val in enumerate(entries, 1):
+        for idx, entry_val in entries:
             entry_bits= unsigned(entry_val.ie_bits)
             entry_obj = 0
             entry_str = ''
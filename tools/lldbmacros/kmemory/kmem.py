@@ -148,6 +148,9 @@ class KMem(object, metaclass=ABCMeta):
         self.num_zones  = target.chkFindFirstGlobalVariable('num_zones').xGetValueAsInteger()
         self.mag_size   = target.chkFindFirstGlobalVariable('_zc_mag_size').xGetValueAsInteger()
         self.zone_array = target.chkFindFirstGlobalVariable('zone_array')
+        self.mag_zid    = (target.chkFindFirstGlobalVariable('zc_magazine_zone')
+            .chkGetChildAtIndex(0).GetValueAsAddress() -
+            self.zone_array.GetLoadAddress()) // gettype('struct zone').GetByteSize()
         self.zsec_array = target.chkFindFirstGlobalVariable('zone_security_array')
 
         self.kernel_map = target.chkFindFirstGlobalVariable('kernel_map').Dereference()
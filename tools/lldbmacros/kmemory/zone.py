@@ -725,19 +725,37 @@ class Zone(object):
             pva  = meta.next_pva
             yield meta
 
+    def partial_queues(self):
+        """
+        Returns the names of the queues of partially used chunks:
+        z_pageq_partial, followed by the per-cluster pools if any.
+        """
+
+        local = self.sbv.GetChildMemberWithName('z_pageq_local')
+        names = ['z_pageq_partial']
+        if local.IsValid():
+            names += [
+                'z_pageq_local[{}]'.format(i)
+                for i in range(local.GetNumChildren())
+            ]
+        return names
+
     def _depotElements(self, depot, into):
         last   = depot.xGetPointeeByName('zd_tail').GetValueAsAddress()
         mag    = depot.xGetPointeeByName('zd_head')
 
         kmem   = self.kmem
-        n      = kmem.mag_size
         target = kmem.target
 
         while mag and mag.GetLoadAddress() != last:
-            into.update(kmem.iter_addresses(target.xIterAsULong(
-                mag.xGetLoadAddressByName('zm_elems'),
-                n
-            )))
+            # magazines double in size with each class, header included,
+            # and the class is the index of their zone among magazine zones
+            elems  = mag.xGetLoadAddressByName('zm_elems')
+            hdr    = (elems - mag.GetLoadAddress()) // target.GetAddressByteSize()
+            meta   = ZonePageMetadata._create_with_zone_address(kmem, mag.GetLoadAddress())
+            mclass = meta.sbv.xGetIntegerByName('zm_index') - kmem.mag_zid
+            n      = ((kmem.mag_size + hdr) << mclass) - hdr
+            into.update(kmem.iter_addresses(target.xIterAsULong(elems, n)))
             mag = mag.xGetPointeeByName('zm_next')
 
         return into
@@ -794,7 +812,7 @@ class Zone(object):
             addr
             for name in (
                 'z_pageq_full',
-                'z_pageq_partial',
+                *self.partial_queues(),
                 'z_pageq_empty',
             )
             for meta in self.iter_page_queue(name)
@@ -827,7 +845,7 @@ class Zone(object):
             addr
             for name in (
                 'z_pageq_full',
-                'z_pageq_partial',
+                *self.partial_queues(),
             )
             for meta in self.iter_page_queue(name)
             for addr in meta.iter_all(self)
@@ -860,7 +878,7 @@ class Zone(object):
             addr
             for name in (
                 'z_pageq_full',
-                'z_pageq_partial',
+                *self.partial_queues(),
             )
             for meta in self.iter_page_queue(name)
             for addr in meta.iter_allocated(self)
@@ -320,25 +320,29 @@ def GetZoneCacheCPUSummary(zone, zone_security, O):
     cache_elem_count = 0
 
     mag_capacity = unsigned(kern.GetGlobalVariable('_zc_mag_size'))
+    mag_capacity = ((mag_capacity + 3) << unsigned(zone.z_mag_class)) - 3
 
-    recirc_elem_count = zone.z_recirc.zd_full * mag_capacity
+    recirc_elem_count = unsigned(zone.z_recirc.zd_elems)
     free_elem_count = zone.z_elems_free + recirc_elem_count
     cpu_info = ""
 
     if zone.z_pcpu_cache:
         depot_cur = 0
+        depot_elems = 0
         depot_full = 0
         depot_empty = 0
         for cache in IterateZPerCPU(zone.z_pcpu_cache):
             depot_cur += unsigned(cache.zc_alloc_cur)
             depot_cur += unsigned(cache.zc_free_cur)
+            depot_elems += unsigned(cache.zc_depot.zd_elems)
             depot_full += unsigned(cache.zc_depot.zd_full)
             depot_empty += unsigned(cache.zc_depot.zd_empty)
-        cache_elem_count += depot_cur + depot_full * mag_capacity
+        cache_elem_count += depot_cur + depot_elems
 
         cpus = unsigned(kern.globals.zpercpu_early_count)
-        cpu_info = "total: {:d}, avg: {:.1f}, full: {:d}, emtpy: {:d}".format(
-                depot_cur, float(depot_cur) / cpus, depot_full, depot_empty)
+        cpu_info = "total: {:d}, avg: {:.1f}, full: {:d}, emtpy: {:d}, mag: {:d} ({:d} resizes)".format(
+                depot_cur, float(depot_cur) / cpus, depot_full, depot_empty,
+                mag_capacity, unsigned(zone.z_mag_resizes))
 
     fail = 0
     for stats in IterateZPerCPU(zone.z_stats):
@@ -425,18 +429,17 @@ def GetZone(zone_val, zs_val, marks, security_marks):
         pcpu_scale = unsigned(kern.globals.zpercpu_early_count)
     pagesize = kern.globals.page_size
     zone = {}
-    mag_capacity = unsigned(kern.GetGlobalVariable('_zc_mag_size'))
     zone["page_count"] = unsigned(zone_val.z_wired_cur) * pcpu_scale
     zone["allfree_page_count"] = unsigned(zone_val.z_wired_empty)
 
     cache_elem_count = 0
-    free_elem_count = zone_val.z_elems_free + zone_val.z_recirc.zd_full * mag_capacity
+    free_elem_count = zone_val.z_elems_free + unsigned(zone_val.z_recirc.zd_elems)
 
     if zone_val.z_pcpu_cache:
         for cache in IterateZPerCPU(zone_val.z_pcpu_cache):
             cache_elem_count += unsigned(cache.zc_alloc_cur)
             cache_elem_count += unsigned(cache.zc_free_cur)
-            cache_elem_count += unsigned(cache.zc_depot.zd_full) * mag_capacity
+            cache_elem_count += unsigned(cache.zc_depot.zd_elems)
 
     alloc_fail_count = 0
     for stats in IterateZPerCPU(zone_val.z_stats):
@@ -881,10 +884,11 @@ def ShowZChunksImpl(zone, extra_addr=None, cmd_options={}, O=None):
 
     if extra_addr is None:
         with O.table(GetZoneChunk.header):
+            queues = ['z_pageq_full'] + zone.partial_queues() + ['z_pageq_empty']
             metas = (
-                (name, meta)
-                for name in ('full', 'partial', 'empty',)
-                for meta in zone.iter_page_queue('z_pageq_' + name)
+                (name[len('z_pageq_'):], meta)
+                for name in queues
+                for meta in zone.iter_page_queue(name)
             )
             for name, meta in metas:
                 print(GetZoneChunk(zone, meta, name, O))
@@ -4869,6 +4873,10 @@ def ShowMapRB(cmd_args=None):
     print(GetVMMapSummary.header)
     print(GetVMMapSummary(map_val))
 
+    if unsigned(map_val.hdr.entries_btree):
+        print("map entries are in a B+-tree, use showmapvme")
+        return None
+
     vme_type = gettype('struct vm_map_entry')
     to_entry = vme_type.xContainerOfTransform('store')
 
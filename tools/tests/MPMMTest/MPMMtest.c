@@ -24,6 +24,7 @@
 #include <libkern/OSAtomic.h>
 
 #define MAX(A, B) ((A) < (B) ? (B) : (A))
+#define MIN(A, B) ((A) < (B) ? (A) : (B))
 
 
 typedef struct {
@@ -61,6 +62,7 @@ struct port_args {
 
 	mach_port_t *set;
 	mach_port_t *port_list;
+	mach_msg_batch_entry_t *batch;
 };
 
 typedef union {
@@ -86,6 +88,7 @@ int                     client_spin;
 int                     client_pages;
 int                     portcount = 1;
 int                     setcount = 0;
+int                     batch_size = 0;
 boolean_t               stress_prepost = FALSE;
 char                    **server_port_name;
 
@@ -135,6 +138,7 @@ usage(const char *progname)
 	fprintf(stderr, "    -set nset num\tcreate [nset] portsets and [num] ports in each server.\n");
 	fprintf(stderr, "                 \tEach port is connected to each set.\n");
 	fprintf(stderr, "    -prepost\t\tstress the prepost system (implies -threaded, requires -set X Y)\n");
+	fprintf(stderr, "    -batch num\t\tsend and receive oneway messages num at a time\n");
 	fprintf(stderr, "default values are:\n");
 	fprintf(stderr, "    . no affinity\n");
 	fprintf(stderr, "    . not timeshare\n");
@@ -149,6 +153,7 @@ usage(const char *progname)
 	fprintf(stderr, "    . no delay\n");
 	fprintf(stderr, "    . no sets / extra ports\n");
 	fprintf(stderr, "    . no prepost stress\n");
+	fprintf(stderr, "    . one message per mach_msg() call\n");
 	exit(1);
 }
 
@@ -267,6 +272,15 @@ parse_args(int argc, char *argv[])
 			stress_prepost = TRUE;
 			threaded = TRUE;
 			argc--; argv++;
+		} else if (0 == strcmp("-batch", argv[0])) {
+			if (argc < 2) {
+				usage(progname);
+			}
+			batch_size = strtoul(argv[1], NULL, 0);
+			if (batch_size < 1 || batch_size > MACH_MSG_BATCH_MAX_COUNT) {
+				usage(progname);
+			}
+			argc -= 2; argv += 2;
 		} else {
 			fprintf(stderr, "unknown option '%s'\n", argv[0]);
 			usage(progname);
@@ -283,6 +297,11 @@ parse_args(int argc, char *argv[])
 			exit(1);
 		}
 	}
+
+	if (batch_size && !oneway) {
+		fprintf(stderr, "Batched messages must be oneway (-oneway)\n");
+		exit(1);
+	}
 }
 
 void
@@ -297,8 +316,15 @@ setup_server_ports(struct port_args *ports)
 	    sizeof(ipc_complex_message));
 	ports->reply_size = sizeof(ipc_trivial_message) -
 	    sizeof(mach_msg_trailer_t);
-	ports->req_msg = malloc(ports->req_size);
+	ports->req_msg = malloc(ports->req_size * MAX(batch_size, 1));
 	ports->reply_msg = malloc(ports->reply_size);
+	if (batch_size) {
+		ports->batch = calloc(sizeof(mach_msg_batch_entry_t), batch_size);
+		if (!ports->batch) {
+			fprintf(stderr, "calloc(%lu, %d) failed!\n", sizeof(mach_msg_batch_entry_t), batch_size);
+			exit(1);
+		}
+	}
 	if (setcount > 0) {
 		ports->set = (mach_port_t *)calloc(sizeof(mach_port_t), setcount);
 		if (!ports->set) {
@@ -435,8 +461,15 @@ setup_client_ports(struct port_args *ports)
 	}
 	ports->req_size -= sizeof(mach_msg_trailer_t);
 	ports->reply_size = sizeof(ipc_trivial_message);
-	ports->req_msg = malloc(ports->req_size);
+	ports->req_msg = malloc(ports->req_size * MAX(batch_size, 1));
 	ports->reply_msg = malloc(ports->reply_size);
+	if (batch_size) {
+		ports->batch = calloc(sizeof(mach_msg_batch_entry_t), batch_size);
+		if (!ports->batch) {
+			fprintf(stderr, "calloc(%lu, %d) failed!\n", sizeof(mach_msg_batch_entry_t), batch_size);
+			exit(1);
+		}
+	}
 
 	ret = mach_port_allocate(mach_task_self(),
 	    MACH_PORT_RIGHT_RECEIVE,
@@ -446,12 +479,16 @@ setup_client_ports(struct port_args *ports)
 		exit(1);
 	}
 	if (verbose) {
-		printf("Client sending %d %s IPC messages to port '%s' in %s mode\n",
+		printf("Client sending %d %s IPC messages to port '%s' in %s mode",
 		    num_msgs, (msg_type == msg_type_inline) ?
 		    "inline" :  ((msg_type == msg_type_complex) ?
 		    "complex" : "trivial"),
 		    server_port_name[ports->server_num],
 		    (oneway ? "oneway" : "rpc"));
+		if (batch_size) {
+			printf(", %d at a time", batch_size);
+		}
+		printf("\n");
 	}
 }
 
@@ -486,6 +523,59 @@ thread_setup(int tag)
 	}
 }
 
+/*
+ * Receive the messages of all the clients of a server with mach_msg2()
+ * batches: every call waits for one message, and takes up to batch_size
+ * of them off the queue.
+ */
+static void
+server_receive_batches(struct port_args *args, mach_port_t recv_port, int totalmsg)
+{
+	mach_msg_batch_entry_t *batch = args->batch;
+	mach_msg_header_t *msg;
+	kern_return_t ret;
+	int idx = 0;
+
+	while (idx < totalmsg) {
+		int count = MIN(batch_size, totalmsg - idx);
+
+		for (int i = 0; i < count; i++) {
+			batch[i].msgb_data = (mach_vm_address_t)((char *)args->req_msg + i * args->req_size);
+			batch[i].msgb_rcv_addr = 0;
+			batch[i].msgb_send_size = 0;
+			batch[i].msgb_rcv_size = args->req_size;
+		}
+		if (verbose > 2) {
+			printf("server awaiting messages %d-%d\n", idx, idx + count - 1);
+		}
+		ret = mach_msg2_batch(batch,
+		    MACH64_RCV_MSG | MACH64_RCV_INTERRUPT | MACH64_RCV_LARGE,
+		    0,
+		    count,
+		    recv_port,
+		    MACH_MSG_TIMEOUT_NONE,
+		    0);
+		if (MACH_RCV_INTERRUPTED == ret) {
+			break;
+		}
+		if (MACH_MSG_SUCCESS != ret) {
+			mach_error("mach_msg2 (receive batch): ", ret);
+			exit(1);
+		}
+		for (int i = 0; i < count && batch[i].msgb_rcv_return == MACH_MSG_SUCCESS; i++, idx++) {
+			msg = (mach_msg_header_t *)batch[i].msgb_data;
+			if (msg->msgh_bits & MACH_MSGH_BITS_COMPLEX) {
+				ret = vm_deallocate(mach_task_self(),
+				    (vm_address_t)((ipc_complex_message *)msg)->descriptor.address,
+				    ((ipc_complex_message *)msg)->descriptor.size);
+			}
+		}
+		if (verbose > 2) {
+			printf("server received %d messages\n", idx);
+		}
+	}
+}
+
 void *
 server(void *serverarg)
 {
@@ -505,6 +595,11 @@ server(void *serverarg)
 
 	recv_port = (useset) ? args->rcv_set : args->port;
 
+	if (batch_size) {
+		server_receive_batches(args, recv_port, totalmsg);
+		totalmsg = 0;
+	}
+
 	for (idx = 0; idx < totalmsg; idx++) {
 		if (verbose > 2) {
 			printf("server awaiting message %d\n", idx);
@@ -681,7 +776,7 @@ client(void *threadarg)
 {
 	struct port_args args;
 	struct port_args *svr_args = NULL;
-	int idx;
+	int idx, count;
 	mach_msg_header_t *req, *reply;
 	mach_port_t bsport, servport;
 	kern_return_t ret;
@@ -728,47 +823,68 @@ client(void *threadarg)
 	uint64_t starttm, endtm;
 
 	/* start message loop */
-	for (idx = 0; idx < num_msgs; idx++) {
-		req = args.req_msg;
+	for (idx = 0; idx < num_msgs; idx += count) {
+		count = batch_size ? MIN(batch_size, num_msgs - idx) : 1;
 		reply = args.reply_msg;
 
-		req->msgh_size = args.req_size;
-		if (stress_prepost) {
-			req->msgh_remote_port = svr_args->port_list[idx % portcount];
-		} else {
-			req->msgh_remote_port = servport;
-		}
-		if (oneway) {
-			req->msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_COPY_SEND, 0);
-			req->msgh_local_port = MACH_PORT_NULL;
-		} else {
-			req->msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_COPY_SEND,
-			    MACH_MSG_TYPE_MAKE_SEND_ONCE);
-			req->msgh_local_port = args.port;
-		}
-		req->msgh_id = oneway ? 0 : 1;
-		if (msg_type == msg_type_complex) {
-			(req)->msgh_bits |=  MACH_MSGH_BITS_COMPLEX;
-			((ipc_complex_message *)req)->body.msgh_descriptor_count = 1;
-			((ipc_complex_message *)req)->descriptor.address = ints;
-			((ipc_complex_message *)req)->descriptor.size =
-			    num_ints * sizeof(u_int32_t);
-			((ipc_complex_message *)req)->descriptor.deallocate = FALSE;
-			((ipc_complex_message *)req)->descriptor.copy = MACH_MSG_VIRTUAL_COPY;
-			((ipc_complex_message *)req)->descriptor.type = MACH_MSG_OOL_DESCRIPTOR;
+		for (int i = 0; i < count; i++) {
+			req = (mach_msg_header_t *)((char *)args.req_msg + i * args.req_size);
+
+			req->msgh_size = args.req_size;
+			if (stress_prepost) {
+				req->msgh_remote_port = svr_args->port_list[(idx + i) % portcount];
+			} else {
+				req->msgh_remote_port = servport;
+			}
+			if (oneway) {
+				req->msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_COPY_SEND, 0);
+				req->msgh_local_port = MACH_PORT_NULL;
+			} else {
+				req->msgh_bits = MACH_MSGH_BITS(MACH_MSG_TYPE_COPY_SEND,
+				    MACH_MSG_TYPE_MAKE_SEND_ONCE);
+				req->msgh_local_port = args.port;
+			}
+			req->msgh_id = oneway ? 0 : 1;
+			if (msg_type == msg_type_complex) {
+				(req)->msgh_bits |=  MACH_MSGH_BITS_COMPLEX;
+				((ipc_complex_message *)req)->body.msgh_descriptor_count = 1;
+				((ipc_complex_message *)req)->descriptor.address = ints;
+				((ipc_complex_message *)req)->descriptor.size =
+				    num_ints * sizeof(u_int32_t);
+				((ipc_complex_message *)req)->descriptor.deallocate = FALSE;
+				((ipc_complex_message *)req)->descriptor.copy = MACH_MSG_VIRTUAL_COPY;
+				((ipc_complex_message *)req)->descriptor.type = MACH_MSG_OOL_DESCRIPTOR;
+			}
+			if (batch_size) {
+				args.batch[i].msgb_data = (mach_vm_address_t)req;
+				args.batch[i].msgb_rcv_addr = 0;
+				args.batch[i].msgb_send_size = args.req_size;
+				args.batch[i].msgb_rcv_size = 0;
+			}
 		}
+		req = args.req_msg;
 		if (verbose > 2) {
-			printf("client sending message %d to port %#x\n",
-			    idx, req->msgh_remote_port);
+			printf("client sending message(s) %d-%d to port %#x\n",
+			    idx, idx + count - 1, req->msgh_remote_port);
 		}
 		starttm = mach_absolute_time();
-		ret = mach_msg(req,
-		    MACH_SEND_MSG,
-		    args.req_size,
-		    0,
-		    MACH_PORT_NULL,
-		    MACH_MSG_TIMEOUT_NONE,
-		    MACH_PORT_NULL);
+		if (batch_size) {
+			ret = mach_msg2_batch(args.batch,
+			    MACH64_SEND_MSG | MACH64_SEND_MQ_CALL,
+			    count,
+			    0,
+			    MACH_PORT_NULL,
+			    MACH_MSG_TIMEOUT_NONE,
+			    0);
+		} else {
+			ret = mach_msg(req,
+			    MACH_SEND_MSG,
+			    args.req_size,
+			    0,
+			    MACH_PORT_NULL,
+			    MACH_MSG_TIMEOUT_NONE,
+			    MACH_PORT_NULL);
+		}
 		endtm = mach_absolute_time();
 		if (MACH_MSG_SUCCESS != ret) {
 			mach_error("mach_msg (send): ", ret);
@@ -951,11 +1067,15 @@ main(int argc, char *argv[])
 	 */
 	wait_for_servers();
 
-	printf("%d server%s, %d client%s per server (%d total) %u messages...",
+	printf("%d server%s, %d client%s per server (%d total) %u messages",
 	    num_servers, (num_servers > 1)? "s" : "",
 	    num_clients, (num_clients > 1)? "s" : "",
 	    totalclients,
 	    totalmsg);
+	if (batch_size) {
+		printf(" in batches of %d", batch_size);
+	}
+	printf("...");
 	fflush(stdout);
 
 	/* Call gettimeofday() once and throw away result; some implementations
@@ -1015,8 +1135,16 @@ main(int argc, char *argv[])
 
 	if (save_perfdata == TRUE) {
 		char name[256];
-		snprintf(name, sizeof(name), "%s_avg_msg_latency", basename(argv[0]));
+		char batch[32] = "";
+		if (batch_size) {
+			snprintf(batch, sizeof(batch), "_batch%d", batch_size);
+		}
+		snprintf(name, sizeof(name), "%s%s_avg_msg_latency", basename(argv[0]), batch);
 		record_perf_data(name, "usec", avg_msg_latency, "Message latency measured in microseconds. Lower is better", stderr);
+		if (oneway) {
+			snprintf(name, sizeof(name), "%s%s_oneway_throughput", basename(argv[0]), batch);
+			record_perf_data(name, "msg/sec", throughput_msg_p_sec, "Oneway messages per second. Higher is better", stderr);
+		}
 	}
 
 	if (stress_prepost) {
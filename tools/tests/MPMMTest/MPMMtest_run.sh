@@ -41,6 +41,12 @@ if [ -e $MPMMTEST_64 ] && [ -x $MPMMTEST_64 ] && [ $IS_64BIT_BOOTED_OS == 1 ]
 then
 	echo ""; echo " Running $MPMMTEST_64"
 	$MPMMTEST_64 -perf || { x=$?; echo "$MPMMTEST_64 failed $x"; exit $x; }
+
+	# oneway throughput, one message per trap vs. batched mach_msg2()
+	echo ""; echo " Running $MPMMTEST_64 -oneway"
+	$MPMMTEST_64 -perf -oneway || { x=$?; echo "$MPMMTEST_64 -oneway failed $x"; exit $x; }
+	echo ""; echo " Running $MPMMTEST_64 -oneway -batch 16"
+	$MPMMTEST_64 -perf -oneway -batch 16 || { x=$?; echo "$MPMMTEST_64 -oneway -batch 16 failed $x"; exit $x; }
 fi
 
 if [ -e $KQMPMMTEST ] && [ -x $KQMPMMTEST ]
@@ -0,0 +1,142 @@
+/*
+ * WKdm with AVX2.  Only called after WKdm_impls() has checked the CPU.
+ */
+#include <immintrin.h>
+
+#include "WKdm_c.h"
+
+#define WK_VEC_FN(name)         name##_avx2
+#define WK_VEC_TAGS             32
+
+static inline unsigned int
+wk_vec_nonzero(const WK_word *p)
+{
+	__m256i v = _mm256_loadu_si256((const __m256i *)p);
+	__m256i z = _mm256_cmpeq_epi32(v, _mm256_setzero_si256());
+
+	return ~(unsigned int)_mm256_movemask_ps(_mm256_castsi256_ps(z)) & 0xff;
+}
+
+static inline bool
+wk_vec_tags_nonzero(const uint8_t *tags)
+{
+	__m256i v = _mm256_loadu_si256((const __m256i *)tags);
+
+	return !_mm256_testz_si256(v, v);
+}
+
+static inline void
+wk_vec_store_zero(WK_word *p)
+{
+	__m256i zero = _mm256_setzero_si256();
+
+	_mm256_storeu_si256((__m256i *)p, zero);
+	_mm256_storeu_si256((__m256i *)(p + 8), zero);
+	_mm256_storeu_si256((__m256i *)(p + 16), zero);
+	_mm256_storeu_si256((__m256i *)(p + 24), zero);
+}
+
+/* the 4x4 transpose of WKdm_sse2.c, in each 128 bit half */
+static inline void
+wk_transpose4(__m256i a, __m256i b, __m256i c, __m256i d, __m256i r[4])
+{
+	__m256i ab_lo = _mm256_unpacklo_epi32(a, b);
+	__m256i cd_lo = _mm256_unpacklo_epi32(c, d);
+	__m256i ab_hi = _mm256_unpackhi_epi32(a, b);
+	__m256i cd_hi = _mm256_unpackhi_epi32(c, d);
+
+	r[0] = _mm256_unpacklo_epi64(ab_lo, cd_lo);
+	r[1] = _mm256_unpackhi_epi64(ab_lo, cd_lo);
+	r[2] = _mm256_unpacklo_epi64(ab_hi, cd_hi);
+	r[3] = _mm256_unpackhi_epi64(ab_hi, cd_hi);
+}
+
+/*
+ * Eight blocks at a time: the even ones end up in the low halves and
+ * the odd ones in the high halves, and one permute puts them back in
+ * order.
+ */
+static inline void
+wk_vec_pack_2bits(const uint8_t *tags, WK_word *out)
+{
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+	for (unsigned int i = 0; i < WKDM_PAGE_WORDS; i += 128, out += 8) {
+		__m256i r[4];
+
+		wk_transpose4(_mm256_loadu_si256((const __m256i *)(tags + i)),
+		    _mm256_loadu_si256((const __m256i *)(tags + i + 32)),
+		    _mm256_loadu_si256((const __m256i *)(tags + i + 64)),
+		    _mm256_loadu_si256((const __m256i *)(tags + i + 96)), r);
+
+		r[0] = _mm256_or_si256(r[0], _mm256_slli_epi32(r[1], 2));
+		r[2] = _mm256_or_si256(_mm256_slli_epi32(r[2], 4), _mm256_slli_epi32(r[3], 6));
+		r[0] = _mm256_or_si256(r[0], r[2]);
+		_mm256_storeu_si256((__m256i *)out, _mm256_permutevar8x32_epi32(r[0], order));
+	}
+}
+
+static inline void
+wk_vec_unpack_2bits(const WK_word *in, uint8_t *tags)
+{
+	const __m256i order = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+	__m256i mask = _mm256_set1_epi8(3);
+
+	for (unsigned int i = 0; i < WKDM_TAGS_WORDS; i += 8, tags += 128) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+		__m256i r[4];
+
+		v = _mm256_permutevar8x32_epi32(v, order);
+		wk_transpose4(_mm256_and_si256(v, mask),
+		    _mm256_and_si256(_mm256_srli_epi32(v, 2), mask),
+		    _mm256_and_si256(_mm256_srli_epi32(v, 4), mask),
+		    _mm256_and_si256(_mm256_srli_epi32(v, 6), mask), r);
+
+		_mm256_storeu_si256((__m256i *)tags, r[0]);
+		_mm256_storeu_si256((__m256i *)(tags + 32), r[1]);
+		_mm256_storeu_si256((__m256i *)(tags + 64), r[2]);
+		_mm256_storeu_si256((__m256i *)(tags + 96), r[3]);
+	}
+}
+
+static inline WK_word *
+wk_vec_pack_4bits(const uint8_t *qpos, unsigned int n, WK_word *out)
+{
+	const __m256i even = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+	unsigned int i = 0;
+
+	for (; i + 32 <= n; i += 32, out += 4) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(qpos + i));
+
+		v = _mm256_or_si256(v, _mm256_srli_epi64(v, 28));
+		v = _mm256_permutevar8x32_epi32(v, even);
+		_mm_storeu_si128((__m128i *)out, _mm256_castsi256_si128(v));
+	}
+	for (; i < n; i += 8) {
+		*out++ = WKdm_load_word(qpos + i) | (WKdm_load_word(qpos + i + 4) << 4);
+	}
+	return out;
+}
+
+static inline void
+wk_vec_unpack_4bits(const WK_word *in, const WK_word *end, uint8_t *qpos)
+{
+	__m256i mask = _mm256_set1_epi8(0x0f);
+
+	for (; in + 8 <= end; in += 8, qpos += 64) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)in);
+		__m256i lo = _mm256_and_si256(v, mask);
+		__m256i hi = _mm256_and_si256(_mm256_srli_epi32(v, 4), mask);
+		__m256i u0 = _mm256_unpacklo_epi32(lo, hi);
+		__m256i u1 = _mm256_unpackhi_epi32(lo, hi);
+
+		_mm256_storeu_si256((__m256i *)qpos, _mm256_permute2x128_si256(u0, u1, 0x20));
+		_mm256_storeu_si256((__m256i *)(qpos + 32), _mm256_permute2x128_si256(u0, u1, 0x31));
+	}
+	for (; in < end; in++, qpos += 8) {
+		WKdm_store_word(qpos, *in & 0x0f0f0f0f);
+		WKdm_store_word(qpos + 4, (*in >> 4) & 0x0f0f0f0f);
+	}
+}
+
+#include "WKdm_vec.h"
@@ -0,0 +1,226 @@
+/*
+ * Portable C implementations of the 4k WKdm page compressor.
+ *
+ * These produce the same compressed stream, byte for byte, as the
+ * hand written kernel versions in osfmk/x86_64/WKdm*_new.s (and the
+ * arm64 4k variants, which share the format): see the description
+ * at the top of WKdmCompress_new.s for the layout.  The scalar
+ * reference follows the assembly step by step; the vector versions
+ * are built from WKdm_vec.h once per instruction set and are checked
+ * against it by wkdm_fuzz.
+ */
+#ifndef _WKDM_C_H_
+#define _WKDM_C_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef uint32_t WK_word;
+
+#define WKDM_PAGE_BYTES         4096
+#define WKDM_PAGE_WORDS         (WKDM_PAGE_BYTES / sizeof(WK_word))
+
+#define WKDM_HEADER_WORDS       3
+#define WKDM_TAGS_WORDS         (WKDM_PAGE_WORDS / 16)
+#define WKDM_FULL_WORDS_START   (WKDM_HEADER_WORDS + WKDM_TAGS_WORDS)   /* 67 */
+
+/* scratch layout, shared with the assembly */
+#define WKDM_SCRATCH_BYTES      4096
+#define WKDM_SCRATCH_TAGS       0
+#define WKDM_SCRATCH_QPOS       1024
+#define WKDM_SCRATCH_LOW_BITS   2048
+
+/* early abort: after CHKPT_BYTES of input, give up if it isn't shrinking */
+#define WKDM_CHKPT_WORDS        (416 / sizeof(WK_word))
+#define WKDM_CHKPT_TAG_BYTES    (416 / 16)
+#define WKDM_CHKPT_SHRUNK_BYTES 426
+
+/* first word of a mostly zero page, stored as (word, byte offset) pairs */
+#define WKDM_MZV_MAGIC          17185
+
+/*
+ * The compressor can write full words past the budget before it gives
+ * up, so dest_buf needs room for the header, the tags, and a page.
+ */
+#define WKDM_DEST_BYTES         (4 * WKDM_FULL_WORDS_START + WKDM_PAGE_BYTES)
+
+enum {
+	WKDM_ZERO_TAG           = 0,
+	WKDM_PARTIAL_TAG        = 1,
+	WKDM_MISS_TAG           = 2,
+	WKDM_EXACT_TAG          = 3,
+};
+
+/* hashLookupTable_new, as dictionary indices rather than byte offsets */
+extern const uint8_t WKdm_hash_table[256];
+
+/*
+ * compress returns the size of the compressed stream, 0 for a zero or
+ * single value page (which the caller encodes itself), or -1 if the
+ * page doesn't fit in limit bytes.  decompress takes the size compress
+ * returned.
+ */
+typedef int (*WKdm_compress_fn)(const WK_word *src_buf, WK_word *dest_buf,
+    WK_word *scratch, unsigned int limit);
+typedef void (*WKdm_decompress_fn)(const WK_word *src_buf, WK_word *dest_buf,
+    WK_word *scratch, unsigned int bytes);
+
+struct WKdm_impl {
+	const char              *name;
+	WKdm_compress_fn        compress;
+	WKdm_decompress_fn      decompress;
+};
+
+int     WKdm_compress_ref(const WK_word *src_buf, WK_word *dest_buf,
+    WK_word *scratch, unsigned int limit);
+void    WKdm_decompress_ref(const WK_word *src_buf, WK_word *dest_buf,
+    WK_word *scratch, unsigned int bytes);
+
+#if defined(__x86_64__)
+int     WKdm_compress_sse2(const WK_word *src_buf, WK_word *dest_buf,
+    WK_word *scratch, unsigned int limit);
+void    WKdm_decompress_sse2(const WK_word *src_buf, WK_word *dest_buf,
+    WK_word *scratch, unsigned int bytes);
+int     WKdm_compress_avx2(const WK_word *src_buf, WK_word *dest_buf,
+    WK_word *scratch, unsigned int limit);
+void    WKdm_decompress_avx2(const WK_word *src_buf, WK_word *dest_buf,
+    WK_word *scratch, unsigned int bytes);
+#endif
+#if defined(__aarch64__) || defined(__arm64__)
+int     WKdm_compress_neon(const WK_word *src_buf, WK_word *dest_buf,
+    WK_word *scratch, unsigned int limit);
+void    WKdm_decompress_neon(const WK_word *src_buf, WK_word *dest_buf,
+    WK_word *scratch, unsigned int bytes);
+#endif
+
+/*
+ * Every implementation this host can run, the reference first.  When
+ * built with WKDM_KERNEL_ASM on x86_64, the kernel's own assembly is
+ * in the list too.
+ */
+const struct WKdm_impl *WKdm_impls(unsigned int *count);
+
+/* the fastest of WKdm_impls() */
+const struct WKdm_impl *WKdm_best_impl(void);
+
+/*
+ * Helpers the implementations share.  These are the parts of the
+ * stream that don't vectorize usefully, kept in one place so that
+ * every implementation makes the same decisions.
+ */
+
+static inline WK_word
+WKdm_load_word(const void *p)
+{
+	WK_word w;
+
+	__builtin_memcpy(&w, p, sizeof(w));
+	return w;
+}
+
+static inline void
+WKdm_store_word(void *p, WK_word w)
+{
+	__builtin_memcpy(p, &w, sizeof(w));
+}
+
+/* is the page being scanned still worth compressing at the checkpoint? */
+static inline bool
+WKdm_checkpoint_ok(unsigned int n_full, unsigned int n_qpos, unsigned int n_low)
+{
+	uint64_t size;
+
+	size = ((uint64_t)(2 * n_low) * 1365) >> 11;
+	size += 4 * n_full + (n_qpos >> 1) + WKDM_CHKPT_TAG_BYTES;
+	return size <= WKDM_CHKPT_SHRUNK_BYTES;
+}
+
+/* zero page, or one value repeated across the whole page */
+static inline bool
+WKdm_is_single_value(const uint8_t *tags, unsigned int n_full,
+    unsigned int n_qpos, unsigned int n_low)
+{
+	if (n_full == 0 && n_qpos == 0) {
+		return true;
+	}
+	if (n_low == 0 && n_qpos == WKDM_PAGE_WORDS - 1 && n_full == 1 &&
+	    tags[0] == WKDM_MISS_TAG) {
+		return true;
+	}
+	if (n_low == 1 && n_qpos == WKDM_PAGE_WORDS && tags[0] == WKDM_PARTIAL_TAG) {
+		return true;
+	}
+	return false;
+}
+
+/* size of the (word, offset) encoding, or 0 if the default packer is smaller */
+static inline uint64_t
+WKdm_sparse_size(unsigned int n_full, unsigned int n_qpos, unsigned int n_low)
+{
+	uint64_t sparse, packed;
+
+	sparse = (uint64_t)(n_full + n_qpos) * 6 + 4;
+	packed = ((uint64_t)(2 * n_low) * 1365) >> 11;
+	packed += 4 * (uint64_t)n_full + (n_qpos >> 1) + 4 * WKDM_FULL_WORDS_START;
+	return packed < sparse ? 0 : sparse;
+}
+
+/*
+ * Pack the 10 bit low halves of partial matches three to a word, after
+ * the queue positions.  Returns the end of the area, or NULL if it
+ * doesn't fit in what is left of the budget.
+ */
+static inline WK_word *
+WKdm_pack_3_tenbits(const uint16_t *low, unsigned int n_low, WK_word *out,
+    int32_t byte_count)
+{
+	unsigned int n_words = (n_low + 2) / 3;
+	unsigned int i;
+
+	if (n_words && byte_count <= (int32_t)(4 * n_words)) {
+		return NULL;
+	}
+	for (i = 0; i + 3 <= n_low; i += 3) {
+		*out++ = low[i] | ((WK_word)low[i + 1] << 10) | ((WK_word)low[i + 2] << 20);
+	}
+	if (i < n_low) {
+		WK_word w = low[i];
+
+		if (i + 1 < n_low) {
+			w |= (WK_word)low[i + 1] << 10;
+		}
+		*out++ = w;
+	}
+	return out;
+}
+
+static inline void
+WKdm_unpack_3_tenbits(const WK_word *in, const WK_word *end, uint16_t *low)
+{
+	for (; in < end; in++) {
+		WK_word w = *in;
+
+		low[0] = w & 0x3ff;
+		low[1] = (w >> 10) & 0x3ff;
+		low[2] = (w >> 20) & 0x3ff;
+		low += 3;
+	}
+}
+
+static inline void
+WKdm_decompress_sparse(const WK_word *src_buf, WK_word *dest_buf, unsigned int bytes)
+{
+	const uint8_t *src = (const uint8_t *)src_buf;
+	uint8_t *dst = (uint8_t *)dest_buf;
+	unsigned int off;
+
+	__builtin_memset(dest_buf, 0, WKDM_PAGE_BYTES);
+	for (off = sizeof(WK_word); off < bytes; off += 6) {
+		uint16_t index;
+
+		__builtin_memcpy(&index, src + off + 4, sizeof(index));
+		__builtin_memcpy(dst + index, src + off, sizeof(WK_word));
+	}
+}
+
+#endif /* _WKDM_C_H_ */
@@ -0,0 +1,64 @@
+/*
+ * Which WKdm implementations this host can run.
+ */
+#include <stddef.h>
+
+#include "WKdm_c.h"
+
+#if WKDM_KERNEL_ASM
+/*
+ * osfmk/x86_64/WKdm*_new.s, assembled as they are for the kernel.
+ * The labels carry the Mach-O leading underscore on every target.
+ */
+extern int WKdm_compress_asm(const WK_word *src_buf, WK_word *dest_buf,
+    WK_word *scratch, unsigned int limit) __asm__("_WKdm_compress_new");
+extern void WKdm_decompress_asm(const WK_word *src_buf, WK_word *dest_buf,
+    WK_word *scratch, unsigned int bytes) __asm__("_WKdm_decompress_new");
+#endif
+
+static struct WKdm_impl WKdm_impl_list[5];
+static unsigned int WKdm_impl_count;
+static unsigned int WKdm_impl_best;
+
+static void
+WKdm_impl_add(const char *name, WKdm_compress_fn compress, WKdm_decompress_fn decompress)
+{
+	WKdm_impl_list[WKdm_impl_count++] = (struct WKdm_impl){
+		.name = name,
+		.compress = compress,
+		.decompress = decompress,
+	};
+}
+
+const struct WKdm_impl *
+WKdm_impls(unsigned int *count)
+{
+	if (WKdm_impl_count == 0) {
+		WKdm_impl_add("ref", WKdm_compress_ref, WKdm_decompress_ref);
+#if defined(__x86_64__)
+		WKdm_impl_best = WKdm_impl_count;
+		WKdm_impl_add("sse2", WKdm_compress_sse2, WKdm_decompress_sse2);
+		if (__builtin_cpu_supports("avx2")) {
+			WKdm_impl_best = WKdm_impl_count;
+			WKdm_impl_add("avx2", WKdm_compress_avx2, WKdm_decompress_avx2);
+		}
+#endif
+#if defined(__aarch64__) || defined(__arm64__)
+		WKdm_impl_best = WKdm_impl_count;
+		WKdm_impl_add("neon", WKdm_compress_neon, WKdm_decompress_neon);
+#endif
+#if WKDM_KERNEL_ASM
+		WKdm_impl_add("asm", WKdm_compress_asm, WKdm_decompress_asm);
+#endif
+	}
+	*count = WKdm_impl_count;
+	return WKdm_impl_list;
+}
+
+const struct WKdm_impl *
+WKdm_best_impl(void)
+{
+	unsigned int count;
+
+	return &WKdm_impls(&count)[WKdm_impl_best];
+}
@@ -0,0 +1,107 @@
+/*
+ * WKdm with NEON, on arm64.  The structure loads and stores do the
+ * transposes the x86 versions spell out.
+ */
+#include <arm_neon.h>
+
+#include "WKdm_c.h"
+
+#define WK_VEC_FN(name)         name##_neon
+#define WK_VEC_TAGS             16
+
+static inline unsigned int
+wk_vec_nonzero(const WK_word *p)
+{
+	static const uint16_t bits[8] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+	uint32x4_t a = vld1q_u32(p);
+	uint32x4_t b = vld1q_u32(p + 4);
+	uint16x8_t nz;
+
+	nz = vcombine_u16(vmovn_u32(vtstq_u32(a, a)), vmovn_u32(vtstq_u32(b, b)));
+	return vaddvq_u16(vandq_u16(nz, vld1q_u16(bits)));
+}
+
+static inline bool
+wk_vec_tags_nonzero(const uint8_t *tags)
+{
+	return vmaxvq_u8(vld1q_u8(tags)) != 0;
+}
+
+static inline void
+wk_vec_store_zero(WK_word *p)
+{
+	uint32x4_t zero = vdupq_n_u32(0);
+
+	vst1q_u32(p, zero);
+	vst1q_u32(p + 4, zero);
+	vst1q_u32(p + 8, zero);
+	vst1q_u32(p + 12, zero);
+}
+
+static inline void
+wk_vec_pack_2bits(const uint8_t *tags, WK_word *out)
+{
+	for (unsigned int i = 0; i < WKDM_PAGE_WORDS; i += 64, out += 4) {
+		uint32x4x4_t v = vld4q_u32((const uint32_t *)(const void *)(tags + i));
+		uint32x4_t w;
+
+		w = vorrq_u32(v.val[0], vshlq_n_u32(v.val[1], 2));
+		w = vorrq_u32(w, vshlq_n_u32(v.val[2], 4));
+		w = vorrq_u32(w, vshlq_n_u32(v.val[3], 6));
+		vst1q_u32(out, w);
+	}
+}
+
+static inline void
+wk_vec_unpack_2bits(const WK_word *in, uint8_t *tags)
+{
+	uint32x4_t mask = vdupq_n_u32(0x03030303);
+
+	for (unsigned int i = 0; i < WKDM_TAGS_WORDS; i += 4, tags += 64) {
+		uint32x4_t v = vld1q_u32(in + i);
+		uint32x4x4_t t;
+
+		t.val[0] = vandq_u32(v, mask);
+		t.val[1] = vandq_u32(vshrq_n_u32(v, 2), mask);
+		t.val[2] = vandq_u32(vshrq_n_u32(v, 4), mask);
+		t.val[3] = vandq_u32(vshrq_n_u32(v, 6), mask);
+		vst4q_u32((uint32_t *)(void *)tags, t);
+	}
+}
+
+static inline WK_word *
+wk_vec_pack_4bits(const uint8_t *qpos, unsigned int n, WK_word *out)
+{
+	unsigned int i = 0;
+
+	for (; i + 32 <= n; i += 32, out += 4) {
+		uint32x4x2_t v = vld2q_u32((const uint32_t *)(const void *)(qpos + i));
+
+		vst1q_u32(out, vorrq_u32(v.val[0], vshlq_n_u32(v.val[1], 4)));
+	}
+	for (; i < n; i += 8) {
+		*out++ = WKdm_load_word(qpos + i) | (WKdm_load_word(qpos + i + 4) << 4);
+	}
+	return out;
+}
+
+static inline void
+wk_vec_unpack_4bits(const WK_word *in, const WK_word *end, uint8_t *qpos)
+{
+	uint32x4_t mask = vdupq_n_u32(0x0f0f0f0f);
+
+	for (; in + 4 <= end; in += 4, qpos += 32) {
+		uint32x4_t v = vld1q_u32(in);
+		uint32x4x2_t t;
+
+		t.val[0] = vandq_u32(v, mask);
+		t.val[1] = vandq_u32(vshrq_n_u32(v, 4), mask);
+		vst2q_u32((uint32_t *)(void *)qpos, t);
+	}
+	for (; in < end; in++, qpos += 8) {
+		WKdm_store_word(qpos, *in & 0x0f0f0f0f);
+		WKdm_store_word(qpos + 4, (*in >> 4) & 0x0f0f0f0f);
+	}
+}
+
+#include "WKdm_vec.h"
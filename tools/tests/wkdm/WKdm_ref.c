@@ -0,0 +1,235 @@
+/*
+ * Scalar reference WKdm, a line by line rendering of
+ * osfmk/x86_64/WKdmCompress_new.s and WKdmDecompress_new.s.
+ * Everything else is checked against this.
+ */
+#include <string.h>
+
+#include "WKdm_c.h"
+
+const uint8_t WKdm_hash_table[256] = {
+	0, 13, 2, 14, 4, 3, 7, 5, 1, 9, 12, 6, 11, 10, 8, 15,
+	2, 3, 7, 5, 1, 15, 4, 9, 6, 12, 11, 8, 13, 14, 10, 3,
+	2, 12, 4, 13, 15, 7, 14, 8, 5, 6, 9, 10, 11, 1, 2, 10,
+	15, 8, 5, 11, 1, 9, 13, 6, 4, 14, 12, 3, 7, 4, 2, 10,
+	9, 7, 8, 3, 1, 11, 13, 5, 6, 12, 15, 14, 10, 12, 2, 8,
+	7, 9, 1, 11, 5, 14, 15, 6, 13, 4, 3, 3, 1, 12, 5, 2,
+	13, 4, 15, 6, 9, 11, 7, 14, 10, 8, 9, 5, 6, 15, 10, 11,
+	13, 4, 8, 1, 12, 2, 7, 14, 3, 7, 8, 10, 13, 9, 4, 5,
+	12, 2, 1, 15, 6, 14, 11, 3, 2, 9, 6, 7, 4, 15, 5, 14,
+	8, 10, 12, 3, 1, 11, 13, 11, 10, 3, 14, 2, 9, 6, 15, 7,
+	12, 1, 8, 5, 4, 13, 15, 3, 6, 9, 2, 1, 4, 14, 12, 11,
+	10, 13, 8, 5, 7, 8, 3, 9, 7, 6, 14, 10, 4, 13, 11, 1,
+	5, 15, 2, 12, 12, 13, 3, 5, 8, 11, 9, 7, 1, 10, 6, 2,
+	14, 15, 4, 9, 8, 2, 10, 1, 13, 6, 11, 5, 3, 7, 12, 14,
+	4, 15, 1, 13, 15, 12, 5, 4, 14, 11, 6, 2, 10, 3, 8, 7,
+	9, 6, 8, 3, 1, 5, 4, 15, 9, 7, 2, 13, 10, 12, 11, 14,
+};
+
+/*
+ * Sixteen 2 bit tags to a word: byte j holds tags j, j+4, j+8 and
+ * j+12, lowest bits first.
+ */
+static void
+WKdm_pack_2bits_ref(const uint8_t *tags, WK_word *out)
+{
+	for (unsigned int w = 0; w < WKDM_TAGS_WORDS; w++, tags += 16) {
+		WK_word packed = 0;
+
+		for (unsigned int j = 0; j < 4; j++) {
+			WK_word byte = tags[j] | (tags[j + 4] << 2) |
+			    (tags[j + 8] << 4) | (tags[j + 12] << 6);
+			packed |= byte << (8 * j);
+		}
+		out[w] = packed;
+	}
+}
+
+static void
+WKdm_unpack_2bits_ref(const WK_word *in, uint8_t *tags)
+{
+	for (unsigned int w = 0; w < WKDM_TAGS_WORDS; w++, tags += 16) {
+		WK_word packed = in[w];
+
+		for (unsigned int j = 0; j < 4; j++) {
+			uint8_t byte = (uint8_t)(packed >> (8 * j));
+
+			tags[j] = byte & 3;
+			tags[j + 4] = (byte >> 2) & 3;
+			tags[j + 8] = (byte >> 4) & 3;
+			tags[j + 12] = (byte >> 6) & 3;
+		}
+	}
+}
+
+/*
+ * Eight 4 bit queue positions to a word: byte j holds positions j and
+ * j+4.  n is a multiple of 8, the caller pads with zeroes.
+ */
+static WK_word *
+WKdm_pack_4bits_ref(const uint8_t *qpos, unsigned int n, WK_word *out)
+{
+	for (unsigned int i = 0; i < n; i += 8) {
+		*out++ = WKdm_load_word(qpos + i) | (WKdm_load_word(qpos + i + 4) << 4);
+	}
+	return out;
+}
+
+static void
+WKdm_unpack_4bits_ref(const WK_word *in, const WK_word *end, uint8_t *qpos)
+{
+	for (; in < end; in++, qpos += 8) {
+		WKdm_store_word(qpos, *in & 0x0f0f0f0f);
+		WKdm_store_word(qpos + 4, (*in >> 4) & 0x0f0f0f0f);
+	}
+}
+
+int
+WKdm_compress_ref(const WK_word *src_buf, WK_word *dest_buf, WK_word *scratch,
+    unsigned int limit)
+{
+	uint8_t *tags = (uint8_t *)scratch + WKDM_SCRATCH_TAGS;
+	uint8_t *qpos = (uint8_t *)scratch + WKDM_SCRATCH_QPOS;
+	uint16_t *low = (uint16_t *)((uint8_t *)scratch + WKDM_SCRATCH_LOW_BITS);
+	WK_word dictionary[16] = { 0 };
+	WK_word *next_full = dest_buf + WKDM_FULL_WORDS_START;
+	WK_word *end;
+	unsigned int n_full, n_qpos = 0, n_low = 0, n_padded;
+	unsigned int checkpoint = WKDM_CHKPT_WORDS;
+	uint64_t sparse;
+	int32_t byte_count;
+
+	if ((int32_t)limit <= (int32_t)(4 * WKDM_FULL_WORDS_START)) {
+		return -1;
+	}
+	byte_count = (int32_t)limit - 4 * WKDM_FULL_WORDS_START;
+
+	for (unsigned int i = 0; i < WKDM_PAGE_WORDS;) {
+		WK_word input = src_buf[i];
+
+		if (input == 0) {
+			tags[i] = WKDM_ZERO_TAG;
+		} else {
+			unsigned int d = WKdm_hash_table[(input >> 10) & 0xff];
+			WK_word dict_word = dictionary[d];
+
+			if (dict_word == input) {
+				tags[i] = WKDM_EXACT_TAG;
+				qpos[n_qpos++] = (uint8_t)d;
+			} else if (((dict_word ^ input) >> 10) == 0) {
+				tags[i] = WKDM_PARTIAL_TAG;
+				dictionary[d] = input;
+				qpos[n_qpos++] = (uint8_t)d;
+				low[n_low++] = input & 0x3ff;
+			} else {
+				tags[i] = WKDM_MISS_TAG;
+				dictionary[d] = input;
+				*next_full++ = input;
+				byte_count -= 4;
+				if (byte_count <= 0) {
+					return -1;
+				}
+			}
+		}
+
+		if (++i == checkpoint && checkpoint != WKDM_PAGE_WORDS) {
+			n_full = (unsigned int)(next_full - (dest_buf + WKDM_FULL_WORDS_START));
+			if (!WKdm_checkpoint_ok(n_full, n_qpos, n_low)) {
+				return -1;
+			}
+			checkpoint = WKDM_PAGE_WORDS;
+		}
+	}
+
+	n_full = (unsigned int)(next_full - (dest_buf + WKDM_FULL_WORDS_START));
+
+	if (WKdm_is_single_value(tags, n_full, n_qpos, n_low)) {
+		return 0;
+	}
+
+	sparse = WKdm_sparse_size(n_full, n_qpos, n_low);
+	if (sparse) {
+		uint8_t *dst = (uint8_t *)dest_buf;
+
+		if (sparse > limit) {
+			return -1;
+		}
+		WKdm_store_word(dst, WKDM_MZV_MAGIC);
+		dst += sizeof(WK_word);
+		for (unsigned int i = 0; i < WKDM_PAGE_WORDS; i++) {
+			uint16_t index = (uint16_t)(i * sizeof(WK_word));
+
+			if (src_buf[i] == 0) {
+				continue;
+			}
+			WKdm_store_word(dst, src_buf[i]);
+			memcpy(dst + 4, &index, sizeof(index));
+			dst += 6;
+		}
+		return (int)sparse;
+	}
+
+	dest_buf[0] = (WK_word)(next_full - dest_buf);
+	WKdm_pack_2bits_ref(tags, dest_buf + WKDM_HEADER_WORDS);
+
+	n_padded = (n_qpos + 7) & ~7u;
+	byte_count -= n_padded / 2;
+	if (byte_count < 0) {
+		return -1;
+	}
+	memset(qpos + n_qpos, 0, n_padded - n_qpos);
+	end = WKdm_pack_4bits_ref(qpos, n_padded, next_full);
+	dest_buf[1] = (WK_word)(end - dest_buf);
+
+	end = WKdm_pack_3_tenbits(low, n_low, end, byte_count);
+	if (end == NULL) {
+		return -1;
+	}
+	dest_buf[2] = (WK_word)(end - dest_buf);
+
+	return (int)(4 * dest_buf[2]);
+}
+
+void
+WKdm_decompress_ref(const WK_word *src_buf, WK_word *dest_buf, WK_word *scratch,
+    unsigned int bytes)
+{
+	uint8_t *tags = (uint8_t *)scratch + WKDM_SCRATCH_TAGS;
+	uint8_t *qpos = (uint8_t *)scratch + WKDM_SCRATCH_QPOS;
+	uint16_t *low = (uint16_t *)((uint8_t *)scratch + WKDM_SCRATCH_LOW_BITS);
+	WK_word dictionary[16] = { 0 };
+	const WK_word *next_full = src_buf + WKDM_FULL_WORDS_START;
+
+	if (src_buf[0] == WKDM_MZV_MAGIC) {
+		WKdm_decompress_sparse(src_buf, dest_buf, bytes);
+		return;
+	}
+
+	WKdm_unpack_2bits_ref(src_buf + WKDM_HEADER_WORDS, tags);
+	WKdm_unpack_4bits_ref(src_buf + src_buf[0], src_buf + src_buf[1], qpos);
+	WKdm_unpack_3_tenbits(src_buf + src_buf[1], src_buf + src_buf[2], low);
+
+	for (unsigned int i = 0; i < WKDM_PAGE_WORDS; i++) {
+		WK_word w;
+		unsigned int d;
+
+		switch (tags[i]) {
+		case WKDM_ZERO_TAG:
+			w = 0;
+			break;
+		case WKDM_PARTIAL_TAG:
+			d = *qpos++;
+			w = (dictionary[d] & ~0x3ffu) | *low++;
+			dictionary[d] = w;
+			break;
+		case WKDM_MISS_TAG:
+			w = *next_full++;
+			dictionary[WKdm_hash_table[(w >> 10) & 0xff]] = w;
+			break;
+		default:
+			w = dictionary[*qpos++];
+			break;
+		}
+		dest_buf[i] = w;
+	}
+}
@@ -0,0 +1,138 @@
+/*
+ * WKdm with SSE2, which every x86_64 machine has.
+ */
+#include <emmintrin.h>
+
+#include "WKdm_c.h"
+
+#define WK_VEC_FN(name)         name##_sse2
+#define WK_VEC_TAGS             16
+
+static inline unsigned int
+wk_vec_nonzero(const WK_word *p)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i a = _mm_loadu_si128((const __m128i *)p);
+	__m128i b = _mm_loadu_si128((const __m128i *)(p + 4));
+	unsigned int zmask;
+
+	zmask = (unsigned int)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, zero)));
+	zmask |= (unsigned int)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(b, zero))) << 4;
+	return ~zmask & 0xff;
+}
+
+static inline bool
+wk_vec_tags_nonzero(const uint8_t *tags)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *)tags);
+
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) != 0xffff;
+}
+
+static inline void
+wk_vec_store_zero(WK_word *p)
+{
+	__m128i zero = _mm_setzero_si128();
+
+	_mm_storeu_si128((__m128i *)p, zero);
+	_mm_storeu_si128((__m128i *)(p + 4), zero);
+	_mm_storeu_si128((__m128i *)(p + 8), zero);
+	_mm_storeu_si128((__m128i *)(p + 12), zero);
+}
+
+/* r[k] = { a[k], b[k], c[k], d[k] } */
+static inline void
+wk_transpose4(__m128i a, __m128i b, __m128i c, __m128i d, __m128i r[4])
+{
+	__m128i ab_lo = _mm_unpacklo_epi32(a, b);
+	__m128i cd_lo = _mm_unpacklo_epi32(c, d);
+	__m128i ab_hi = _mm_unpackhi_epi32(a, b);
+	__m128i cd_hi = _mm_unpackhi_epi32(c, d);
+
+	r[0] = _mm_unpacklo_epi64(ab_lo, cd_lo);
+	r[1] = _mm_unpackhi_epi64(ab_lo, cd_lo);
+	r[2] = _mm_unpacklo_epi64(ab_hi, cd_hi);
+	r[3] = _mm_unpackhi_epi64(ab_hi, cd_hi);
+}
+
+/*
+ * Each 32 bit lane of a 16 tag block holds the tags that share the
+ * output bytes at one shift, so transposing four blocks lines the
+ * lanes up for a plain shift and or.
+ */
+static inline void
+wk_vec_pack_2bits(const uint8_t *tags, WK_word *out)
+{
+	for (unsigned int i = 0; i < WKDM_PAGE_WORDS; i += 64, out += 4) {
+		__m128i r[4];
+
+		wk_transpose4(_mm_loadu_si128((const __m128i *)(tags + i)),
+		    _mm_loadu_si128((const __m128i *)(tags + i + 16)),
+		    _mm_loadu_si128((const __m128i *)(tags + i + 32)),
+		    _mm_loadu_si128((const __m128i *)(tags + i + 48)), r);
+
+		r[0] = _mm_or_si128(r[0], _mm_slli_epi32(r[1], 2));
+		r[2] = _mm_or_si128(_mm_slli_epi32(r[2], 4), _mm_slli_epi32(r[3], 6));
+		_mm_storeu_si128((__m128i *)out, _mm_or_si128(r[0], r[2]));
+	}
+}
+
+static inline void
+wk_vec_unpack_2bits(const WK_word *in, uint8_t *tags)
+{
+	__m128i mask = _mm_set1_epi8(3);
+
+	for (unsigned int i = 0; i < WKDM_TAGS_WORDS; i += 4, tags += 64) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128i r[4];
+
+		wk_transpose4(_mm_and_si128(v, mask),
+		    _mm_and_si128(_mm_srli_epi32(v, 2), mask),
+		    _mm_and_si128(_mm_srli_epi32(v, 4), mask),
+		    _mm_and_si128(_mm_srli_epi32(v, 6), mask), r);
+
+		_mm_storeu_si128((__m128i *)tags, r[0]);
+		_mm_storeu_si128((__m128i *)(tags + 16), r[1]);
+		_mm_storeu_si128((__m128i *)(tags + 32), r[2]);
+		_mm_storeu_si128((__m128i *)(tags + 48), r[3]);
+	}
+}
+
+static inline WK_word *
+wk_vec_pack_4bits(const uint8_t *qpos, unsigned int n, WK_word *out)
+{
+	unsigned int i = 0;
+
+	for (; i + 16 <= n; i += 16, out += 2) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(qpos + i));
+
+		/* lo | hi << 4 in the low half of each 64 bit lane */
+		v = _mm_or_si128(v, _mm_srli_epi64(v, 28));
+		_mm_storel_epi64((__m128i *)out, _mm_shuffle_epi32(v, _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+	if (i < n) {
+		*out++ = WKdm_load_word(qpos + i) | (WKdm_load_word(qpos + i + 4) << 4);
+	}
+	return out;
+}
+
+static inline void
+wk_vec_unpack_4bits(const WK_word *in, const WK_word *end, uint8_t *qpos)
+{
+	__m128i mask = _mm_set1_epi8(0x0f);
+
+	for (; in + 4 <= end; in += 4, qpos += 32) {
+		__m128i v = _mm_loadu_si128((const __m128i *)in);
+		__m128i lo = _mm_and_si128(v, mask);
+		__m128i hi = _mm_and_si128(_mm_srli_epi32(v, 4), mask);
+
+		_mm_storeu_si128((__m128i *)qpos, _mm_unpacklo_epi32(lo, hi));
+		_mm_storeu_si128((__m128i *)(qpos + 16), _mm_unpackhi_epi32(lo, hi));
+	}
+	for (; in < end; in++, qpos += 8) {
+		WKdm_store_word(qpos, *in & 0x0f0f0f0f);
+		WKdm_store_word(qpos + 4, (*in >> 4) & 0x0f0f0f0f);
+	}
+}
+
+#include "WKdm_vec.h"
@@ -0,0 +1,202 @@
+/*
+ * WKdm built on vector primitives, included once per instruction set.
+ *
+ * The includer defines WK_VEC_FN(name) to name the entry points, and
+ * provides:
+ *
+ *   WK_VEC_TAGS                   tags examined at once when decoding
+ *   wk_vec_nonzero(p)             bitmask of the nonzero words in p[0..7]
+ *   wk_vec_tags_nonzero(tags)     are any of the next WK_VEC_TAGS tags set?
+ *   wk_vec_store_zero(p)          zero WK_VEC_TAGS words at p
+ *   wk_vec_pack_2bits(tags, out)  all 1024 tags into 64 words
+ *   wk_vec_unpack_2bits(in, tags) and back
+ *   wk_vec_pack_4bits(qpos, n, out)      n queue positions, n % 8 == 0
+ *   wk_vec_unpack_4bits(in, end, qpos)   and back
+ *
+ * The dictionary walk is inherently serial, so the scan only uses the
+ * vector unit to skip zero words eight at a time; what is left is the
+ * same sequence of decisions the scalar reference makes, in the same
+ * order, which is what keeps the output identical.
+ */
+
+#define WK_VEC_WORDS    8
+
+_Static_assert(WKDM_CHKPT_WORDS % WK_VEC_WORDS == 0,
+    "the checkpoint must fall on a block boundary");
+
+/*
+ * Tag one nonzero word, exactly as the reference does.  A macro rather
+ * than a function so that running out of budget can return from the
+ * compressor directly.
+ */
+#define WK_VEC_RECORD(j)                                                \
+	do {                                                            \
+	        WK_word input = src_buf[(j)];                           \
+	        unsigned int d = WKdm_hash_table[(input >> 10) & 0xff]; \
+	        WK_word dict_word = dictionary[d];                      \
+                                                                        \
+	        if (dict_word == input) {                               \
+	                tags[(j)] = WKDM_EXACT_TAG;                     \
+	                qpos[n_qpos++] = (uint8_t)d;                    \
+	        } else if (((dict_word ^ input) >> 10) == 0) {          \
+	                tags[(j)] = WKDM_PARTIAL_TAG;                   \
+	                dictionary[d] = input;                          \
+	                qpos[n_qpos++] = (uint8_t)d;                    \
+	                low[n_low++] = input & 0x3ff;                   \
+	        } else {                                                \
+	                tags[(j)] = WKDM_MISS_TAG;                      \
+	                dictionary[d] = input;                          \
+	                *next_full++ = input;                           \
+	                byte_count -= 4;                                \
+	                if (byte_count <= 0) {                          \
+	                        return -1;                              \
+	                }                                               \
+	        }                                                       \
+	} while (0)
+
+int
+WK_VEC_FN(WKdm_compress)(const WK_word *src_buf, WK_word *dest_buf,
+    WK_word *scratch, unsigned int limit)
+{
+	uint8_t *tags = (uint8_t *)scratch + WKDM_SCRATCH_TAGS;
+	uint8_t *qpos = (uint8_t *)scratch + WKDM_SCRATCH_QPOS;
+	uint16_t *low = (uint16_t *)((uint8_t *)scratch + WKDM_SCRATCH_LOW_BITS);
+	WK_word dictionary[16] = { 0 };
+	WK_word *next_full = dest_buf + WKDM_FULL_WORDS_START;
+	WK_word *end;
+	unsigned int n_full, n_qpos = 0, n_low = 0, n_padded;
+	uint64_t sparse;
+	int32_t byte_count;
+
+	if ((int32_t)limit <= (int32_t)(4 * WKDM_FULL_WORDS_START)) {
+		return -1;
+	}
+	byte_count = (int32_t)limit - 4 * WKDM_FULL_WORDS_START;
+
+	for (unsigned int i = 0; i < WKDM_PAGE_WORDS; i += WK_VEC_WORDS) {
+		unsigned int mask = wk_vec_nonzero(src_buf + i);
+
+		if (mask == (1u << WK_VEC_WORDS) - 1) {
+			/* dense: no zeroes to skip, walk the block straight through */
+			for (unsigned int j = i; j < i + WK_VEC_WORDS; j++) {
+				WK_VEC_RECORD(j);
+			}
+		} else {
+			__builtin_memset(tags + i, WKDM_ZERO_TAG, WK_VEC_WORDS);
+			while (mask) {
+				unsigned int j = i + (unsigned int)__builtin_ctz(mask);
+
+				mask &= mask - 1;
+				WK_VEC_RECORD(j);
+			}
+		}
+
+		if (i + WK_VEC_WORDS == WKDM_CHKPT_WORDS) {
+			n_full = (unsigned int)(next_full - (dest_buf + WKDM_FULL_WORDS_START));
+			if (!WKdm_checkpoint_ok(n_full, n_qpos, n_low)) {
+				return -1;
+			}
+		}
+	}
+
+	n_full = (unsigned int)(next_full - (dest_buf + WKDM_FULL_WORDS_START));
+
+	if (WKdm_is_single_value(tags, n_full, n_qpos, n_low)) {
+		return 0;
+	}
+
+	sparse = WKdm_sparse_size(n_full, n_qpos, n_low);
+	if (sparse) {
+		uint8_t *dst = (uint8_t *)dest_buf;
+
+		if (sparse > limit) {
+			return -1;
+		}
+		WKdm_store_word(dst, WKDM_MZV_MAGIC);
+		dst += sizeof(WK_word);
+		for (unsigned int i = 0; i < WKDM_PAGE_WORDS; i += WK_VEC_WORDS) {
+			unsigned int mask = wk_vec_nonzero(src_buf + i);
+
+			while (mask) {
+				unsigned int j = i + (unsigned int)__builtin_ctz(mask);
+				uint16_t index = (uint16_t)(j * sizeof(WK_word));
+
+				mask &= mask - 1;
+				WKdm_store_word(dst, src_buf[j]);
+				__builtin_memcpy(dst + 4, &index, sizeof(index));
+				dst += 6;
+			}
+		}
+		return (int)sparse;
+	}
+
+	dest_buf[0] = (WK_word)(next_full - dest_buf);
+	wk_vec_pack_2bits(tags, dest_buf + WKDM_HEADER_WORDS);
+
+	n_padded = (n_qpos + 7) & ~7u;
+	byte_count -= n_padded / 2;
+	if (byte_count < 0) {
+		return -1;
+	}
+	__builtin_memset(qpos + n_qpos, 0, n_padded - n_qpos);
+	end = wk_vec_pack_4bits(qpos, n_padded, next_full);
+	dest_buf[1] = (WK_word)(end - dest_buf);
+
+	end = WKdm_pack_3_tenbits(low, n_low, end, byte_count);
+	if (end == NULL) {
+		return -1;
+	}
+	dest_buf[2] = (WK_word)(end - dest_buf);
+
+	return (int)(4 * dest_buf[2]);
+}
+
+void
+WK_VEC_FN(WKdm_decompress)(const WK_word *src_buf, WK_word *dest_buf,
+    WK_word *scratch, unsigned int bytes)
+{
+	uint8_t *tags = (uint8_t *)scratch + WKDM_SCRATCH_TAGS;
+	uint8_t *qpos = (uint8_t *)scratch + WKDM_SCRATCH_QPOS;
+	uint16_t *low = (uint16_t *)((uint8_t *)scratch + WKDM_SCRATCH_LOW_BITS);
+	WK_word dictionary[16] = { 0 };
+	const WK_word *next_full = src_buf + WKDM_FULL_WORDS_START;
+
+	if (src_buf[0] == WKDM_MZV_MAGIC) {
+		WKdm_decompress_sparse(src_buf, dest_buf, bytes);
+		return;
+	}
+
+	wk_vec_unpack_2bits(src_buf + WKDM_HEADER_WORDS, tags);
+	wk_vec_unpack_4bits(src_buf + src_buf[0], src_buf + src_buf[1], qpos);
+	WKdm_unpack_3_tenbits(src_buf + src_buf[1], src_buf + src_buf[2], low);
+
+	for (unsigned int i = 0; i < WKDM_PAGE_WORDS; i += WK_VEC_TAGS) {
+		if (!wk_vec_tags_nonzero(tags + i)) {
+			wk_vec_store_zero(dest_buf + i);
+			continue;
+		}
+		for (unsigned int j = i; j < i + WK_VEC_TAGS; j++) {
+			WK_word w;
+			unsigned int d;
+
+			switch (tags[j]) {
+			case WKDM_ZERO_TAG:
+				w = 0;
+				break;
+			case WKDM_PARTIAL_TAG:
+				d = *qpos++;
+				w = (dictionary[d] & ~0x3ffu) | *low++;
+				dictionary[d] = w;
+				break;
+			case WKDM_MISS_TAG:
+				w = *next_full++;
+				dictionary[WKdm_hash_table[(w >> 10) & 0xff]] = w;
+				break;
+			default:
+				w = dictionary[*qpos++];
+				break;
+			}
+			dest_buf[j] = w;
+		}
+	}
+}
@@ -0,0 +1,180 @@
+/*
+ * Throughput of the WKdm implementations.
+ *
+ * Builds a set of pages of each kind in wkdm_corpus (or of one kind
+ * with -k), then times compressing all of them with each
+ * implementation, and decompressing what the reference produced.
+ */
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "WKdm_c.h"
+#include "wkdm_corpus.h"
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static double
+mb_per_sec(uint64_t bytes, uint64_t ns)
+{
+	return ns ? ((double)bytes / (1024 * 1024)) / ((double)ns / 1e9) : 0;
+}
+
+static void *
+xaligned_alloc(size_t size)
+{
+	void *p = NULL;
+
+	if (posix_memalign(&p, 64, size) != 0) {
+		perror("posix_memalign");
+		exit(1);
+	}
+	return p;
+}
+
+static void
+bench_corpus(const char *name, WK_word *pages, unsigned int n_pages, unsigned int rounds)
+{
+	unsigned int count;
+	const struct WKdm_impl *impls = WKdm_impls(&count);
+	WK_word *dest = xaligned_alloc((size_t)n_pages * WKDM_DEST_BYTES);
+	WK_word *scratch = xaligned_alloc(WKDM_SCRATCH_BYTES);
+	WK_word *out = xaligned_alloc(WKDM_PAGE_BYTES);
+	int *sizes = calloc(n_pages, sizeof(int));
+	uint64_t in_bytes = (uint64_t)n_pages * WKDM_PAGE_BYTES * rounds;
+	uint64_t out_bytes = 0, decomp_bytes = 0;
+
+	/* the reference's output is what everyone decompresses */
+	for (unsigned int p = 0; p < n_pages; p++) {
+		WK_word *d = dest + (size_t)p * (WKDM_DEST_BYTES / sizeof(WK_word));
+
+		sizes[p] = impls[0].compress(pages + (size_t)p * WKDM_PAGE_WORDS, d, scratch, WKDM_PAGE_BYTES);
+		out_bytes += sizes[p] > 0 ? (uint64_t)sizes[p] : sizes[p] == 0 ? 4 : WKDM_PAGE_BYTES;
+		decomp_bytes += sizes[p] > 0 ? WKDM_PAGE_BYTES : 0;
+	}
+
+	printf("%-14s %6u pages, ratio %6.3f\n", name, n_pages,
+	    (double)n_pages * WKDM_PAGE_BYTES / (double)out_bytes);
+
+	for (unsigned int n = 0; n < count; n++) {
+		WK_word *cdest = xaligned_alloc(WKDM_DEST_BYTES);
+		uint64_t start, ctime, dtime;
+
+		start = now_ns();
+		for (unsigned int r = 0; r < rounds; r++) {
+			for (unsigned int p = 0; p < n_pages; p++) {
+				impls[n].compress(pages + (size_t)p * WKDM_PAGE_WORDS, cdest, scratch, WKDM_PAGE_BYTES);
+			}
+		}
+		ctime = now_ns() - start;
+
+		start = now_ns();
+		for (unsigned int r = 0; r < rounds; r++) {
+			for (unsigned int p = 0; p < n_pages; p++) {
+				if (sizes[p] > 0) {
+					impls[n].decompress(dest + (size_t)p * (WKDM_DEST_BYTES / sizeof(WK_word)),
+					    out, scratch, (unsigned int)sizes[p]);
+				}
+			}
+		}
+		dtime = now_ns() - start;
+
+		printf("    %-6s compress %9.1f MB/s   decompress %9.1f MB/s\n", impls[n].name,
+		    mb_per_sec(in_bytes, ctime), mb_per_sec(decomp_bytes * rounds, dtime));
+		free(cdest);
+	}
+
+	free(sizes);
+	free(out);
+	free(scratch);
+	free(dest);
+}
+
+static void
+usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [-k kind] [-p pages] [-r rounds] [-s seed]\n", progname);
+	fprintf(stderr, "kinds:");
+	for (unsigned int k = 0; k < WKDM_PAGE_KINDS; k++) {
+		fprintf(stderr, " %s", wkdm_page_kind_names[k]);
+	}
+	fprintf(stderr, "\n");
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned int n_pages = 4096, rounds = 8;
+	int only_kind = -1;
+	uint64_t seed = 0x5eed;
+	WK_word *pages;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "k:p:r:s:")) != -1) {
+		switch (ch) {
+		case 'k':
+			for (unsigned int k = 0; k < WKDM_PAGE_KINDS; k++) {
+				if (strcmp(optarg, wkdm_page_kind_names[k]) == 0) {
+					only_kind = (int)k;
+				}
+			}
+			if (only_kind < 0) {
+				usage(argv[0]);
+			}
+			break;
+		case 'p':
+			n_pages = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			rounds = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (n_pages == 0 || rounds == 0) {
+		usage(argv[0]);
+	}
+
+	pages = xaligned_alloc((size_t)n_pages * WKDM_PAGE_BYTES);
+
+	for (unsigned int k = 0; k < WKDM_PAGE_KINDS; k++) {
+		uint64_t rng = seed | 1;
+
+		if (only_kind >= 0 && (unsigned int)only_kind != k) {
+			continue;
+		}
+		for (unsigned int p = 0; p < n_pages; p++) {
+			wkdm_fill_page(pages + (size_t)p * WKDM_PAGE_WORDS, (enum wkdm_page_kind)k, &rng);
+		}
+		bench_corpus(wkdm_page_kind_names[k], pages, n_pages, rounds);
+	}
+
+	if (only_kind < 0) {
+		/* every kind in turn, roughly what a compressor sees */
+		uint64_t rng = seed | 1;
+
+		for (unsigned int p = 0; p < n_pages; p++) {
+			wkdm_fill_page(pages + (size_t)p * WKDM_PAGE_WORDS,
+			    (enum wkdm_page_kind)(p % WKDM_PAGE_KINDS), &rng);
+		}
+		bench_corpus("all", pages, n_pages, rounds);
+	}
+
+	free(pages);
+	return 0;
+}
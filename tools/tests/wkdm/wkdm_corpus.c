@@ -0,0 +1,181 @@
+#include <string.h>
+
+#include "wkdm_corpus.h"
+
+const char *const wkdm_page_kind_names[WKDM_PAGE_KINDS] = {
+	[WKDM_PAGE_ZERO]         = "zero",
+	[WKDM_PAGE_SINGLE_VALUE] = "single_value",
+	[WKDM_PAGE_SPARSE]       = "sparse",
+	[WKDM_PAGE_SMALL_INTS]   = "small_ints",
+	[WKDM_PAGE_POINTERS]     = "pointers",
+	[WKDM_PAGE_REPEATS]      = "repeats",
+	[WKDM_PAGE_TEXT]         = "text",
+	[WKDM_PAGE_RANDOM]       = "random",
+	[WKDM_PAGE_LATE_NOISE]   = "late_noise",
+	[WKDM_PAGE_MIXED]        = "mixed",
+};
+
+static const char *const wkdm_words[] = {
+	"the", "page", "segment", "compressor", "memory", "object", "swap",
+	"kernel", "thread", "queue", "of", "and", "to", "in", "is", "that",
+};
+
+/*
+ * A value that lands in the same dictionary slot as the one before,
+ * so it is a partial match more often than not.
+ */
+static WK_word
+wkdm_near(WK_word base, uint64_t *rng)
+{
+	return (base & ~0x3ffu) | (WK_word)(wkdm_rand(rng) & 0x3ff);
+}
+
+static void
+wkdm_fill_words(WK_word *page, unsigned int start, unsigned int end,
+    enum wkdm_page_kind kind, uint64_t *rng)
+{
+	WK_word values[20];
+	unsigned int n_values;
+	WK_word base;
+
+	switch (kind) {
+	case WKDM_PAGE_ZERO:
+		memset(page + start, 0, (end - start) * sizeof(WK_word));
+		break;
+
+	case WKDM_PAGE_SINGLE_VALUE:
+		/* small values start out as a partial match against the empty dictionary */
+		base = (wkdm_rand(rng) & 1) ? (WK_word)(wkdm_rand(rng) & 0x3ff) + 1 :
+		    (WK_word)wkdm_rand(rng) | 1;
+		for (unsigned int i = start; i < end; i++) {
+			page[i] = base;
+		}
+		break;
+
+	case WKDM_PAGE_SPARSE:
+		memset(page + start, 0, (end - start) * sizeof(WK_word));
+		n_values = (unsigned int)(wkdm_rand(rng) % 200);
+		for (unsigned int i = 0; i < n_values; i++) {
+			page[start + wkdm_rand(rng) % (end - start)] = (WK_word)wkdm_rand(rng);
+		}
+		break;
+
+	case WKDM_PAGE_SMALL_INTS:
+		for (unsigned int i = start; i < end; i++) {
+			page[i] = (wkdm_rand(rng) % 4) ? (WK_word)(wkdm_rand(rng) % 1024) : 0;
+		}
+		break;
+
+	case WKDM_PAGE_POINTERS:
+		base = 0x60000000u | ((WK_word)wkdm_rand(rng) & 0x00ff0000);
+		for (unsigned int i = start; i < end; i++) {
+			page[i] = (i & 1) ? wkdm_near(base + (WK_word)(wkdm_rand(rng) % 4) * 0x400, rng) :
+			    (WK_word)(wkdm_rand(rng) % 256);
+		}
+		break;
+
+	case WKDM_PAGE_REPEATS:
+		n_values = 2 + (unsigned int)(wkdm_rand(rng) % 18);
+		for (unsigned int i = 0; i < n_values; i++) {
+			values[i] = (WK_word)wkdm_rand(rng);
+		}
+		for (unsigned int i = start; i < end; i++) {
+			page[i] = values[wkdm_rand(rng) % n_values];
+		}
+		break;
+
+	case WKDM_PAGE_TEXT: {
+		uint8_t *bytes = (uint8_t *)(page + start);
+		size_t size = (end - start) * sizeof(WK_word), i = 0;
+
+		while (i < size) {
+			const char *w = wkdm_words[wkdm_rand(rng) % (sizeof(wkdm_words) / sizeof(wkdm_words[0]))];
+
+			for (size_t j = 0; w[j] && i < size; j++) {
+				bytes[i++] = (uint8_t)w[j];
+			}
+			if (i < size) {
+				bytes[i++] = ' ';
+			}
+		}
+		break;
+	}
+
+	case WKDM_PAGE_RANDOM:
+		for (unsigned int i = start; i < end; i++) {
+			page[i] = (WK_word)wkdm_rand(rng);
+		}
+		break;
+
+	case WKDM_PAGE_LATE_NOISE:
+	case WKDM_PAGE_MIXED:
+	case WKDM_PAGE_KINDS:
+		break;
+	}
+}
+
+void
+wkdm_fill_page(WK_word *page, enum wkdm_page_kind kind, uint64_t *rng)
+{
+	unsigned int split;
+
+	switch (kind) {
+	case WKDM_PAGE_LATE_NOISE:
+		/*
+		 * compressible up to somewhere around the checkpoint, noise
+		 * after, or the other way around
+		 */
+		split = WKDM_CHKPT_WORDS - 16 + (unsigned int)(wkdm_rand(rng) % 32);
+		if (wkdm_rand(rng) & 1) {
+			wkdm_fill_words(page, 0, split, WKDM_PAGE_SMALL_INTS, rng);
+			wkdm_fill_words(page, split, WKDM_PAGE_WORDS, WKDM_PAGE_RANDOM, rng);
+		} else {
+			wkdm_fill_words(page, 0, split, WKDM_PAGE_RANDOM, rng);
+			wkdm_fill_words(page, split, WKDM_PAGE_WORDS, WKDM_PAGE_ZERO, rng);
+		}
+		break;
+
+	case WKDM_PAGE_MIXED:
+		/* runs of every other kind */
+		for (unsigned int i = 0; i < WKDM_PAGE_WORDS;) {
+			unsigned int run = 1 + (unsigned int)(wkdm_rand(rng) % 256);
+			enum wkdm_page_kind k = (enum wkdm_page_kind)(wkdm_rand(rng) % WKDM_PAGE_LATE_NOISE);
+
+			if (run > WKDM_PAGE_WORDS - i) {
+				run = WKDM_PAGE_WORDS - i;
+			}
+			wkdm_fill_words(page, i, i + run, k, rng);
+			i += run;
+		}
+		break;
+
+	default:
+		wkdm_fill_words(page, 0, WKDM_PAGE_WORDS, kind, rng);
+		break;
+	}
+}
+
+void
+wkdm_mutate_page(WK_word *page, uint64_t *rng)
+{
+	unsigned int n = 1 + (unsigned int)(wkdm_rand(rng) % 8);
+
+	for (unsigned int i = 0; i < n; i++) {
+		unsigned int at = (unsigned int)(wkdm_rand(rng) % WKDM_PAGE_WORDS);
+
+		switch (wkdm_rand(rng) % 4) {
+		case 0:
+			page[at] = 0;
+			break;
+		case 1:
+			page[at] = (WK_word)(wkdm_rand(rng) % 1024);
+			break;
+		case 2:
+			page[at] = page[wkdm_rand(rng) % WKDM_PAGE_WORDS];
+			break;
+		default:
+			page[at] = (WK_word)wkdm_rand(rng);
+			break;
+		}
+	}
+}
@@ -0,0 +1,46 @@
+/*
+ * Synthetic pages for wkdm_fuzz and wkdm_bench, chosen to reach every
+ * branch of the compressor: the zero, single value and sparse
+ * encodings, each tag, the early abort at the checkpoint, and budget
+ * exhaustion in each area of the stream.
+ */
+#ifndef _WKDM_CORPUS_H_
+#define _WKDM_CORPUS_H_
+
+#include "WKdm_c.h"
+
+enum wkdm_page_kind {
+	WKDM_PAGE_ZERO,
+	WKDM_PAGE_SINGLE_VALUE,
+	WKDM_PAGE_SPARSE,
+	WKDM_PAGE_SMALL_INTS,
+	WKDM_PAGE_POINTERS,
+	WKDM_PAGE_REPEATS,
+	WKDM_PAGE_TEXT,
+	WKDM_PAGE_RANDOM,
+	WKDM_PAGE_LATE_NOISE,
+	WKDM_PAGE_MIXED,
+	WKDM_PAGE_KINDS,
+};
+
+extern const char *const wkdm_page_kind_names[WKDM_PAGE_KINDS];
+
+/* xorshift64*, so runs are reproducible from the seed on every host */
+static inline uint64_t
+wkdm_rand(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+void    wkdm_fill_page(WK_word *page, enum wkdm_page_kind kind, uint64_t *rng);
+
+/* overwrite a few random words, to knock a page off its pattern */
+void    wkdm_mutate_page(WK_word *page, uint64_t *rng);
+
+#endif /* _WKDM_CORPUS_H_ */
@@ -0,0 +1,242 @@
+/*
+ * Differential fuzzer for the WKdm implementations.
+ *
+ * Every page is compressed by each implementation under the same
+ * budget; the return values and the compressed streams must match the
+ * scalar reference byte for byte, and every implementation must
+ * decompress the stream back to the original page.
+ *
+ * Built standalone it draws pages from wkdm_corpus with a seeded
+ * generator; built with WKDM_LIBFUZZER it is a libFuzzer target that
+ * takes the budget and the page from the input.
+ */
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "WKdm_c.h"
+#include "wkdm_corpus.h"
+
+static WK_word page[WKDM_PAGE_WORDS] __attribute__((aligned(64)));
+static WK_word scratch[WKDM_SCRATCH_BYTES / sizeof(WK_word)] __attribute__((aligned(64)));
+static WK_word ref_dest[WKDM_DEST_BYTES / sizeof(WK_word)] __attribute__((aligned(64)));
+static WK_word dest[WKDM_DEST_BYTES / sizeof(WK_word)] __attribute__((aligned(64)));
+static WK_word out[WKDM_PAGE_WORDS] __attribute__((aligned(64)));
+
+static const char *fuzz_context = "";
+
+static void
+dump_words(const char *what, const WK_word *w, unsigned int count)
+{
+	fprintf(stderr, "%s:", what);
+	for (unsigned int i = 0; i < count; i++) {
+		fprintf(stderr, "%s%08x", (i % 8) ? " " : "\n    ", w[i]);
+	}
+	fprintf(stderr, "\n");
+}
+
+static void __attribute__((noreturn, format(printf, 3, 4)))
+fuzz_fail(const char *impl, unsigned int limit, const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "FAIL %s: %s, limit %u: ", fuzz_context, impl, limit);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fprintf(stderr, "\n");
+	dump_words("page", page, WKDM_PAGE_WORDS);
+	abort();
+}
+
+static unsigned int
+first_difference(const void *a, const void *b, size_t size)
+{
+	const uint8_t *pa = a, *pb = b;
+	unsigned int i = 0;
+
+	while (i < size && pa[i] == pb[i]) {
+		i++;
+	}
+	return i;
+}
+
+/* check every implementation against the reference for this page and budget */
+static int
+check_page(unsigned int limit)
+{
+	unsigned int count;
+	const struct WKdm_impl *impls = WKdm_impls(&count);
+	int ref_size;
+
+	memset(ref_dest, 0xa5, sizeof(ref_dest));
+	ref_size = impls[0].compress(page, ref_dest, scratch, limit);
+
+	if (ref_size > 0 && (unsigned int)ref_size > limit) {
+		fuzz_fail(impls[0].name, limit, "compressed to %d bytes, over the budget", ref_size);
+	}
+	if (ref_size == 0) {
+		for (unsigned int i = 1; i < WKDM_PAGE_WORDS; i++) {
+			if (page[i] != page[0]) {
+				fuzz_fail(impls[0].name, limit, "single value page, but word %u differs", i);
+			}
+		}
+	}
+
+	for (unsigned int n = 1; n < count; n++) {
+		int size;
+
+		memset(dest, 0x5a, sizeof(dest));
+		size = impls[n].compress(page, dest, scratch, limit);
+		if (size != ref_size) {
+			fuzz_fail(impls[n].name, limit, "returned %d, reference returned %d", size, ref_size);
+		}
+		if (size > 0 && memcmp(dest, ref_dest, (size_t)size) != 0) {
+			unsigned int at = first_difference(dest, ref_dest, (size_t)size);
+
+			dump_words("reference", ref_dest, (unsigned int)(size + 3) / 4);
+			dump_words(impls[n].name, dest, (unsigned int)(size + 3) / 4);
+			fuzz_fail(impls[n].name, limit, "stream differs at byte %u of %d", at, size);
+		}
+	}
+
+	if (ref_size <= 0) {
+		return ref_size;
+	}
+	for (unsigned int n = 0; n < count; n++) {
+		memset(out, 0xa5, sizeof(out));
+		impls[n].decompress(ref_dest, out, scratch, (unsigned int)ref_size);
+		if (memcmp(out, page, sizeof(page)) != 0) {
+			unsigned int at = first_difference(out, page, sizeof(page));
+
+			fuzz_fail(impls[n].name, limit, "decompressed page differs at byte %u", at);
+		}
+	}
+	return ref_size;
+}
+
+#if WKDM_LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+/* two bytes of budget, then the page, repeated to fill it */
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	uint8_t *bytes = (uint8_t *)page;
+	unsigned int limit;
+
+	if (size < 3) {
+		return 0;
+	}
+	limit = (unsigned int)(data[0] | (data[1] << 8)) % (WKDM_PAGE_BYTES + 512);
+	data += 2;
+	size -= 2;
+	for (size_t i = 0; i < WKDM_PAGE_BYTES; i++) {
+		bytes[i] = data[i % size];
+	}
+	check_page(limit);
+	return 0;
+}
+
+#else /* WKDM_LIBFUZZER */
+
+static unsigned int
+pick_limit(unsigned int step, int full_size, uint64_t *rng)
+{
+	switch (step) {
+	case 0:
+		return WKDM_PAGE_BYTES;
+	case 1:
+		/* right around the compressed size, to find off by ones in the budget */
+		if (full_size > 0) {
+			return (unsigned int)full_size - 8 + (unsigned int)(wkdm_rand(rng) % 17);
+		}
+		return (unsigned int)(wkdm_rand(rng) % WKDM_PAGE_BYTES);
+	case 2:
+		/* around the header and tags alone */
+		return 4 * WKDM_FULL_WORDS_START - 4 + (unsigned int)(wkdm_rand(rng) % 64);
+	default:
+		return (unsigned int)(wkdm_rand(rng) % (WKDM_PAGE_BYTES + 512));
+	}
+}
+
+static void
+usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [-n iterations] [-s seed] [-v]\n", progname);
+	exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+	uint64_t seed = 0x5eed, iterations = 200000;
+	uint64_t results[3] = { 0 };
+	unsigned int count;
+	const struct WKdm_impl *impls;
+	bool verbose = false;
+	char context[64];
+	int ch;
+
+	while ((ch = getopt(argc, argv, "n:s:v")) != -1) {
+		switch (ch) {
+		case 'n':
+			iterations = strtoull(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	impls = WKdm_impls(&count);
+	printf("wkdm_fuzz: seed 0x%" PRIx64 ", %" PRIu64 " iterations:", seed, iterations);
+	for (unsigned int n = 0; n < count; n++) {
+		printf(" %s", impls[n].name);
+	}
+	printf("\n");
+	if (count < 2) {
+		printf("wkdm_fuzz: nothing to compare the reference with\n");
+		return 1;
+	}
+
+	for (uint64_t iter = 0; iter < iterations; iter++) {
+		/* each iteration gets its own stream, so a failure can be replayed alone */
+		uint64_t rng = (seed ^ (iter * 0x9e3779b97f4a7c15ULL)) | 1;
+		enum wkdm_page_kind kind = (enum wkdm_page_kind)(wkdm_rand(&rng) % WKDM_PAGE_KINDS);
+		int full_size;
+
+		wkdm_fill_page(page, kind, &rng);
+		if (wkdm_rand(&rng) % 4 == 0) {
+			wkdm_mutate_page(page, &rng);
+		}
+		snprintf(context, sizeof(context), "seed 0x%" PRIx64 " iteration %" PRIu64 " (%s)",
+		    seed, iter, wkdm_page_kind_names[kind]);
+		fuzz_context = context;
+
+		full_size = check_page(WKDM_PAGE_BYTES);
+		results[full_size < 0 ? 0 : full_size == 0 ? 1 : 2]++;
+
+		for (unsigned int step = 1; step < 4; step++) {
+			check_page(pick_limit(step, full_size, &rng));
+		}
+		if (verbose && iter % 10000 == 0) {
+			printf("%s\n", context);
+		}
+	}
+
+	printf("wkdm_fuzz: PASS, %" PRIu64 " pages incompressible, %" PRIu64
+	    " single value, %" PRIu64 " compressed\n", results[0], results[1], results[2]);
+	return 0;
+}
+
+#endif /* WKDM_LIBFUZZER */